@@ -7,6 +7,7 @@
 #ifndef CVMFS_BIGVECTOR_H_
 #define CVMFS_BIGVECTOR_H_
 
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
 
@@ -84,6 +85,17 @@ class BigVector {
     shared_buffer_ = true;
   }
 
+  /**
+   * Exchanges the buffers of the two vectors without copying the items
+   */
+  void Swap(BigVector<Item> *other) {
+    std::swap(buffer_, other->buffer_);
+    std::swap(size_, other->size_);
+    std::swap(capacity_, other->capacity_);
+    std::swap(large_alloc_, other->large_alloc_);
+    std::swap(shared_buffer_, other->shared_buffer_);
+  }
+
   void DoubleCapacity() {
     Item *old_buffer = buffer_;
     bool old_large_alloc = large_alloc_;
@@ -9,6 +9,7 @@
 #define __STDC_FORMAT_MACROS
 #endif
 
+#include <errno.h>
 #include <stdint.h>
 
 #include <string>
@@ -26,6 +27,7 @@ enum CacheManagerIds {
   kRamCacheManager,
   kTieredCacheManager,
   kExternalCacheManager,
+  kSlabCacheManager,
 };
 
 enum CacheModes {
@@ -170,6 +172,13 @@ class CacheManager : SingleCopy {
   virtual int64_t Pread(int fd, void *buf, uint64_t size, uint64_t offset) = 0;
   virtual int Dup(int fd) = 0;
   virtual int Readahead(int fd) = 0;
+  /**
+   * Returns a kernel file descriptor that provides the plain content of the
+   * object behind fd, or -1 if the cache manager does not store objects in
+   * files.  The returned descriptor is owned by the cache manager and valid
+   * until fd is closed.
+   */
+  virtual int GetBackingFd(int fd) { return -1; }
 
   virtual uint32_t SizeOfTxn() = 0;
   virtual int StartTxn(const shash::Any &id, uint64_t size, void *txn) = 0;
@@ -180,6 +189,15 @@ class CacheManager : SingleCopy {
   virtual int Reset(void *txn) = 0;
   virtual int AbortTxn(void *txn) = 0;
   virtual int OpenFromTxn(void *txn) = 0;
+  /**
+   * Like OpenFromTxn() but can be called before the transaction is complete.
+   * Reads on the returned descriptor block until the requested range has been
+   * written to the transaction.  Once the transaction is aborted, reads fail
+   * with -EIO.  If the transaction is reset, e.g. on a proxy failover, only
+   * the descriptors that already read some of the discarded data fail.
+   * Requires a known object size.
+   */
+  virtual int OpenFromTxnStreaming(void *txn) { return -ENOTSUP; }
   virtual int CommitTxn(void *txn) = 0;
 
   virtual void Spawn() = 0;
@@ -60,6 +60,7 @@
 #include "statistics.h"
 #include "util/atomic.h"
 #include "util/logging.h"
+#include "util/mutex.h"
 #include "util/platform.h"
 #include "util/posix.h"
 #include "util/smalloc.h"
@@ -110,11 +111,148 @@ atomic_int32 CallGuard::global_drainout_ = 0;
 const uint64_t PosixCacheManager::kBigFile = 25 * 1024 * 1024;  // 25M
 
 
+PosixCacheManager::AsyncWrites::AsyncWrites(const uint64_t expected_size)
+  : buffer_size(kBufferSize)
+  , current(0)
+  , offset(0)
+  , error(0)
+{
+  if ((expected_size != kSizeUnknown) && (expected_size < kBufferSize))
+    buffer_size = std::max(expected_size, static_cast<uint64_t>(1));
+  for (unsigned i = 0; i < kNumBuffers; ++i) {
+    buffers[i] = NULL;
+    sizes[i] = 0;
+  }
+}
+
+
+PosixCacheManager::AsyncWrites::~AsyncWrites() {
+  for (unsigned i = 0; i < kNumBuffers; ++i) {
+    assert(sizes[i] == 0);
+    free(buffers[i]);
+  }
+}
+
+
+unsigned char *PosixCacheManager::AsyncWrites::GetBuffer(const unsigned slot) {
+  if (buffers[slot] == NULL)
+    buffers[slot] = reinterpret_cast<unsigned char *>(smalloc(buffer_size));
+  return buffers[slot];
+}
+
+
+PosixCacheManager::StreamProgress::StreamProgress(const uint64_t size)
+  : size(size)
+  , flushed(0)
+  , num_waiters(0)
+  , state(kStreamRunning)
+  , attempt(0)
+  , refcount(1)
+{
+  int retval = pthread_mutex_init(&lock, NULL);
+  assert(retval == 0);
+  retval = pthread_cond_init(&cond_progress, NULL);
+  assert(retval == 0);
+}
+
+
+PosixCacheManager::StreamProgress::~StreamProgress() {
+  pthread_cond_destroy(&cond_progress);
+  pthread_mutex_destroy(&lock);
+}
+
+
+void PosixCacheManager::StreamProgress::Advance(const uint64_t nbytes) {
+  MutexLockGuard m(&lock);
+  flushed += nbytes;
+  if (num_waiters > 0)
+    pthread_cond_broadcast(&cond_progress);
+}
+
+
+/**
+ * A failed stream stays failed: readers might have seen data that did not
+ * end up in the committed object.
+ */
+void PosixCacheManager::StreamProgress::Finish(const State final_state) {
+  MutexLockGuard m(&lock);
+  if (state != kStreamFailed)
+    state = final_state;
+  pthread_cond_broadcast(&cond_progress);
+}
+
+
+/**
+ * The transaction file was truncated and is written again from the start.
+ * Readers that have not read anything yet simply wait for the new data.
+ */
+void PosixCacheManager::StreamProgress::Restart() {
+  MutexLockGuard m(&lock);
+  flushed = 0;
+  attempt++;
+}
+
+
+/**
+ * Blocks until the first end bytes of the object are in the transaction file.
+ * Readers that have seen data of an earlier attempt fail: the new download
+ * does not necessarily produce the same bytes.
+ */
+int PosixCacheManager::StreamProgress::WaitFor(
+  const int fd,
+  const uint64_t end)
+{
+  MutexLockGuard m(&lock);
+  if (IsStale(fd))
+    return -EIO;
+  num_waiters++;
+  while ((state == kStreamRunning) && (flushed < std::min(end, size)))
+    pthread_cond_wait(&cond_progress, &lock);
+  num_waiters--;
+  if ((state == kStreamFailed) || IsStale(fd))
+    return -EIO;
+  readers[fd] = attempt;
+  return 0;
+}
+
+
+/**
+ * Called with lock held.
+ */
+bool PosixCacheManager::StreamProgress::IsStale(const int fd) const {
+  map<int, unsigned>::const_iterator iter = readers.find(fd);
+  return (iter != readers.end()) && (iter->second != attempt);
+}
+
+
+void PosixCacheManager::StreamProgress::Forget(const int fd) {
+  MutexLockGuard m(&lock);
+  readers.erase(fd);
+}
+
+
+//------------------------------------------------------------------------------
+
+
+PosixCacheManager::~PosixCacheManager() {
+  while (!streams_.empty())
+    UnregisterStream(streams_.begin()->first);
+  pthread_mutex_destroy(&lock_streams_);
+  delete io_uring_;
+}
+
+
 int PosixCacheManager::AbortTxn(void *txn) {
   Transaction *transaction = reinterpret_cast<Transaction *>(txn);
   LogCvmfs(kLogCache, kLogDebug, "abort %s", transaction->tmp_path.c_str());
+  if (transaction->async != NULL)
+    WaitForWrites(transaction);
   close(transaction->fd);
   int result = unlink(transaction->tmp_path.c_str());
+  if (transaction->stream != NULL) {
+    transaction->stream->Finish(StreamProgress::kStreamFailed);
+    ReleaseStream(transaction->stream);
+  }
   transaction->~Transaction();
   atomic_dec32(&no_inflight_txns_);
   if (result == -1)
@@ -137,7 +275,25 @@ bool PosixCacheManager::AcquireQuotaManager(QuotaManager *quota_mgr) {
 }
 
 
+/**
+ * Returns the stream registered for fd with an extra reference, or NULL if fd
+ * is a regular descriptor.
+ */
+PosixCacheManager::StreamProgress *PosixCacheManager::AcquireStream(
+  const int fd)
+{
+  MutexLockGuard m(&lock_streams_);
+  map<int, StreamProgress *>::const_iterator iter = streams_.find(fd);
+  if (iter == streams_.end())
+    return NULL;
+  iter->second->refcount++;
+  return iter->second;
+}
+
+
 int PosixCacheManager::Close(int fd) {
+  if (atomic_read32(&num_streams_) > 0)
+    UnregisterStream(fd);
   int retval = close(fd);
   if (retval != 0)
     return -errno;
@@ -147,6 +303,18 @@ int PosixCacheManager::Close(int fd) {
 
 int PosixCacheManager::CommitTxn(void *txn) {
   Transaction *transaction = reinterpret_cast<Transaction *>(txn);
+  StreamProgress *stream = transaction->stream;
+  int result = DoCommitTxn(transaction);
+  if (stream != NULL) {
+    stream->Finish((result == 0) ? StreamProgress::kStreamCommitted
+                                 : StreamProgress::kStreamFailed);
+    ReleaseStream(stream);
+  }
+  return result;
+}
+
+
+int PosixCacheManager::DoCommitTxn(Transaction *transaction) {
   int result;
   LogCvmfs(kLogCache, kLogDebug, "commit %s %s",
            transaction->final_path.c_str(), transaction->tmp_path.c_str());
@@ -319,11 +487,44 @@ int PosixCacheManager::Dup(int fd) {
   int new_fd = dup(fd);
   if (new_fd < 0)
     return -errno;
+  if (atomic_read32(&num_streams_) > 0) {
+    StreamProgress *stream = AcquireStream(fd);
+    if (stream != NULL) {
+      RegisterStream(new_fd, stream);
+      ReleaseStream(stream);
+    }
+  }
   return new_fd;
 }
 
 
+/**
+ * Transactions started from now on write through io_uring.  Returns false if
+ * io_uring is unavailable, in which case the cache keeps using write().
+ */
+bool PosixCacheManager::EnableIoUring(const unsigned queue_depth) {
+  IoUring *io_uring = IoUring::Create(queue_depth);
+  if (io_uring == NULL)
+    return false;
+  assert(io_uring_ == NULL);
+  io_uring_ = io_uring;
+  LogCvmfs(kLogCache, kLogDebug, "using io_uring with queue depth %u",
+           io_uring->queue_depth());
+  return true;
+}
+
+
+/**
+ * Writes out the buffered data.  With io_uring, waits until all the submitted
+ * writes of the transaction are finished.
+ */
 int PosixCacheManager::Flush(Transaction *transaction) {
+  if (transaction->async != NULL) {
+    int retval = SubmitBuffer(transaction);
+    int retval_wait = WaitForWrites(transaction);
+    return (retval < 0) ? retval : retval_wait;
+  }
+
   if (transaction->buf_pos == 0)
     return 0;
   int written =
@@ -335,16 +536,50 @@ int PosixCacheManager::Flush(Transaction *transaction) {
     return -EIO;
   }
   transaction->buf_pos = 0;
+  if (transaction->stream != NULL)
+    transaction->stream->Advance(written);
   return 0;
 }
 
 
+/**
+ * The content of a stream is only final once its transaction is committed, so
+ * that zero-copy reads and fuse passthrough must not bypass Pread() before.
+ */
+int PosixCacheManager::GetBackingFd(int fd) {
+  if (atomic_read32(&num_streams_) == 0)
+    return fd;
+  StreamProgress *stream = AcquireStream(fd);
+  if (stream == NULL)
+    return fd;
+  int result = -1;
+  {
+    MutexLockGuard m(&stream->lock);
+    if ((stream->state == StreamProgress::kStreamCommitted) &&
+        !stream->IsStale(fd))
+    {
+      result = fd;
+    }
+  }
+  ReleaseStream(stream);
+  return result;
+}
+
+
 inline string PosixCacheManager::GetPathInCache(const shash::Any &id) {
   return cache_path_ + "/" + id.MakePathWithoutSuffix();
 }
 
 
 int64_t PosixCacheManager::GetSize(int fd) {
+  if (atomic_read32(&num_streams_) > 0) {
+    StreamProgress *stream = AcquireStream(fd);
+    if (stream != NULL) {
+      const int64_t size = stream->size;
+      ReleaseStream(stream);
+      return size;
+    }
+  }
   platform_stat64 info;
   int retval = platform_fstat(fd, &info);
   if (retval != 0)
@@ -381,12 +616,39 @@ int PosixCacheManager::OpenFromTxn(void *txn) {
 }
 
 
+int PosixCacheManager::OpenFromTxnStreaming(void *txn) {
+  Transaction *transaction = reinterpret_cast<Transaction *>(txn);
+  if (transaction->expected_size == kSizeUnknown)
+    return -EINVAL;
+  int fd_rdonly = OpenFromTxn(txn);
+  if (fd_rdonly < 0)
+    return fd_rdonly;
+  if (transaction->stream == NULL) {
+    transaction->stream = new StreamProgress(transaction->expected_size);
+    // OpenFromTxn() flushed the buffer
+    transaction->stream->flushed = transaction->size;
+  }
+  RegisterStream(fd_rdonly, transaction->stream);
+  return fd_rdonly;
+}
+
+
 int64_t PosixCacheManager::Pread(
   int fd,
   void *buf,
   uint64_t size,
   uint64_t offset)
 {
+  if (atomic_read32(&num_streams_) > 0) {
+    StreamProgress *stream = AcquireStream(fd);
+    if (stream != NULL) {
+      int retval = stream->WaitFor(fd, offset + size);
+      ReleaseStream(stream);
+      if (retval < 0)
+        return retval;
+    }
+  }
+
   int64_t result;
   do {
     errno = 0;
@@ -398,6 +660,21 @@ int64_t PosixCacheManager::Pread(
 }
 
 
+void PosixCacheManager::RegisterStream(const int fd, StreamProgress *stream) {
+  MutexLockGuard m(&lock_streams_);
+  stream->refcount++;
+  streams_[fd] = stream;
+  atomic_inc32(&num_streams_);
+}
+
+
+void PosixCacheManager::ReleaseStream(StreamProgress *stream) {
+  MutexLockGuard m(&lock_streams_);
+  if (--stream->refcount == 0)
+    delete stream;
+}
+
+
 int PosixCacheManager::Rename(const char *oldpath, const char *newpath) {
   int result;
   if (rename_workaround_ != kRenameLink) {
@@ -443,6 +720,13 @@ int PosixCacheManager::Readahead(int fd) {
 
 int PosixCacheManager::Reset(void *txn) {
   Transaction *transaction = reinterpret_cast<Transaction *>(txn);
+  if (transaction->async != NULL) {
+    WaitForWrites(transaction);
+    transaction->async->offset = 0;
+    transaction->async->error = 0;
+  }
+  if (transaction->stream != NULL)
+    transaction->stream->Restart();
   transaction->buf_pos = 0;
   transaction->size = 0;
   int retval = lseek(transaction->fd, 0, SEEK_SET);
@@ -516,6 +800,8 @@ int PosixCacheManager::StartTxn(
            template_path, transaction->fd);
   transaction->tmp_path = template_path;
   transaction->expected_size = size;
+  if (io_uring_ != NULL)
+    transaction->async = new AsyncWrites(size);
   return transaction->fd;
 }
 
@@ -537,6 +823,34 @@ bool PosixCacheManager::StoreBreadcrumb(std::string fqrn,
 }
 
 
+/**
+ * Hands the current io_uring buffer to the kernel and switches to the next
+ * one, which might still be in flight.
+ */
+int PosixCacheManager::SubmitBuffer(Transaction *transaction) {
+  AsyncWrites *async = transaction->async;
+  if (transaction->buf_pos == 0)
+    return async->error;
+
+  const unsigned slot = async->current;
+  if (!io_uring_->SubmitWrite(transaction->fd, async->buffers[slot],
+                              transaction->buf_pos, async->offset,
+                              &async->requests[slot]))
+  {
+    return -EIO;
+  }
+  async->sizes[slot] = transaction->buf_pos;
+  async->offset += transaction->buf_pos;
+  transaction->buf_pos = 0;
+  async->current = (slot + 1) % AsyncWrites::kNumBuffers;
+
+  // Streaming readers need to see the data as soon as possible
+  if (transaction->stream != NULL)
+    return WaitForWrites(transaction);
+  return WaitForWrite(transaction, async->current);
+}
+
+
 void PosixCacheManager::TearDown2ReadOnly() {
   cache_mode_ = kCacheReadOnly;
   while (atomic_read32(&no_inflight_txns_) != 0)
@@ -548,6 +862,61 @@ void PosixCacheManager::TearDown2ReadOnly() {
 }
 
 
+void PosixCacheManager::UnregisterStream(const int fd) {
+  StreamProgress *stream;
+  {
+    MutexLockGuard m(&lock_streams_);
+    map<int, StreamProgress *>::iterator iter = streams_.find(fd);
+    if (iter == streams_.end())
+      return;
+    stream = iter->second;
+    streams_.erase(iter);
+    atomic_dec32(&num_streams_);
+  }
+  stream->Forget(fd);
+  ReleaseStream(stream);
+}
+
+
+/**
+ * Returns the error of the first failed write of the transaction, if any.
+ */
+int PosixCacheManager::WaitForWrite(
+  Transaction *transaction,
+  const unsigned slot)
+{
+  AsyncWrites *async = transaction->async;
+  const unsigned size = async->sizes[slot];
+  if (size == 0)
+    return async->error;
+
+  int64_t result = async->requests[slot].Wait();
+  async->sizes[slot] = 0;
+  if ((result >= 0) && (static_cast<uint64_t>(result) != size))
+    result = -EIO;
+  if (result < 0) {
+    if (async->error == 0)
+      async->error = result;
+    return async->error;
+  }
+  if (transaction->stream != NULL)
+    transaction->stream->Advance(size);
+  return async->error;
+}
+
+
+/**
+ * Waits for the writes in flight in the order of submission.
+ */
+int PosixCacheManager::WaitForWrites(Transaction *transaction) {
+  for (unsigned i = 0; i < AsyncWrites::kNumBuffers; ++i) {
+    WaitForWrite(transaction,
+                 (transaction->async->current + i) % AsyncWrites::kNumBuffers);
+  }
+  return transaction->async->error;
+}
+
+
 int64_t PosixCacheManager::Write(const void *buf, uint64_t size, void *txn) {
   Transaction *transaction = reinterpret_cast<Transaction *>(txn);
 
@@ -563,18 +932,25 @@ int64_t PosixCacheManager::Write(const void *buf, uint64_t size, void *txn) {
   uint64_t written = 0;
   const unsigned char *read_pos = reinterpret_cast<const unsigned char *>(buf);
   while (written < size) {
-    if (transaction->buf_pos == sizeof(transaction->buffer)) {
-      int retval = Flush(transaction);
+    unsigned char *buffer = transaction->buffer;
+    unsigned buffer_size = sizeof(transaction->buffer);
+    if (transaction->async != NULL) {
+      buffer = transaction->async->GetBuffer(transaction->async->current);
+      buffer_size = transaction->async->buffer_size;
+    }
+    if (transaction->buf_pos == buffer_size) {
+      int retval = (transaction->async == NULL) ? Flush(transaction)
+                                                : SubmitBuffer(transaction);
       if (retval != 0) {
         transaction->size += written;
         return retval;
       }
+      continue;
     }
     uint64_t remaining = size - written;
-    uint64_t space_in_buffer =
-      sizeof(transaction->buffer) - transaction->buf_pos;
+    uint64_t space_in_buffer = buffer_size - transaction->buf_pos;
     uint64_t batch_size = std::min(remaining, space_in_buffer);
-    memcpy(transaction->buffer + transaction->buf_pos, read_pos, batch_size);
+    memcpy(buffer + transaction->buf_pos, read_pos, batch_size);
     transaction->buf_pos += batch_size;
     written += batch_size;
     read_pos += batch_size;
@@ -5,9 +5,11 @@
 #ifndef CVMFS_CACHE_POSIX_H_
 #define CVMFS_CACHE_POSIX_H_
 
+#include <pthread.h>
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <cassert>
 #include <map>
 #include <string>
 #include <vector>
@@ -22,6 +24,7 @@
 #include "shortstring.h"
 #include "statistics.h"
 #include "util/atomic.h"
+#include "util/uring.h"
 
 namespace catalog {
 class DirectoryEntry;
@@ -41,10 +44,12 @@ class PosixCacheManager : public CacheManager {
   FRIEND_TEST(T_CacheManager, CommitTxnRenameFail);
   FRIEND_TEST(T_CacheManager, Open);
   FRIEND_TEST(T_CacheManager, OpenFromTxn);
+  FRIEND_TEST(T_CacheManager, OpenFromTxnStreaming);
   FRIEND_TEST(T_CacheManager, OpenPinned);
   FRIEND_TEST(T_CacheManager, Rename);
   FRIEND_TEST(T_CacheManager, StartTxn);
   FRIEND_TEST(T_CacheManager, TearDown2ReadOnly);
+  FRIEND_TEST(T_CacheManager, IoUringWrite);
 
  public:
   enum CacheModes {
@@ -72,7 +77,7 @@ class PosixCacheManager : public CacheManager {
     const std::string &cache_path,
     const bool alien_cache,
     const RenameWorkarounds rename_workaround = kRenameNormal);
-  virtual ~PosixCacheManager() { }
+  virtual ~PosixCacheManager();
   virtual bool AcquireQuotaManager(QuotaManager *quota_mgr);
 
   virtual int Open(const BlessedObject &object);
@@ -81,6 +86,7 @@ class PosixCacheManager : public CacheManager {
   virtual int64_t Pread(int fd, void *buf, uint64_t size, uint64_t offset);
   virtual int Dup(int fd);
   virtual int Readahead(int fd);
+  virtual int GetBackingFd(int fd);
 
   virtual uint32_t SizeOfTxn() { return sizeof(Transaction); }
   virtual int StartTxn(const shash::Any &id, uint64_t size, void *txn);
@@ -90,6 +96,7 @@ class PosixCacheManager : public CacheManager {
   virtual int64_t Write(const void *buf, uint64_t size, void *txn);
   virtual int Reset(void *txn);
   virtual int OpenFromTxn(void *txn);
+  virtual int OpenFromTxnStreaming(void *txn);
   virtual int AbortTxn(void *txn);
   virtual int CommitTxn(void *txn);
 
@@ -100,6 +107,7 @@ class PosixCacheManager : public CacheManager {
   bool StoreBreadcrumb(std::string fqrn, manifest::Breadcrumb breadcrumb);
 
   void TearDown2ReadOnly();
+  bool EnableIoUring(const unsigned queue_depth);
   CacheModes cache_mode() { return cache_mode_; }
   bool alien_cache() { return alien_cache_; }
   std::string cache_path() { return cache_path_; }
@@ -110,6 +118,81 @@ class PosixCacheManager : public CacheManager {
   virtual bool DoFreeState(void *data);
 
  private:
+  /**
+   * Progress of a transaction that is read while it is being written, see
+   * OpenFromTxnStreaming().  Shared by the transaction and all the read-only
+   * file descriptors opened from it; the reference count is protected by
+   * lock_streams_.
+   */
+  struct StreamProgress {
+    enum State {
+      kStreamRunning = 0,
+      kStreamCommitted,
+      kStreamFailed,
+    };
+
+    explicit StreamProgress(const uint64_t size);
+    ~StreamProgress();
+    void Advance(const uint64_t nbytes);
+    void Restart();
+    void Finish(const State final_state);
+    int WaitFor(const int fd, const uint64_t end);
+    bool IsStale(const int fd) const;
+    void Forget(const int fd);
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond_progress;
+    uint64_t size;
+    /**
+     * Number of bytes that have been written to the transaction file
+     */
+    uint64_t flushed;
+    unsigned num_waiters;
+    State state;
+    /**
+     * Incremented when the download starts over, e.g. after a proxy failover
+     */
+    unsigned attempt;
+    /**
+     * Maps the read-only file descriptors that have read data to the attempt
+     * that the data came from
+     */
+    std::map<int, unsigned> readers;
+    unsigned refcount;
+  };
+
+  /**
+   * Write buffers of a transaction that are handed to io_uring.  While the
+   * kernel writes out one buffer, the next one is filled.  The buffers are
+   * allocated on first use and not larger than the expected object size, so
+   * that small objects do not pay for the full set.
+   */
+  struct AsyncWrites {
+    static const unsigned kNumBuffers = 4;
+    static const unsigned kBufferSize = 64 * 1024;
+
+    explicit AsyncWrites(const uint64_t expected_size);
+    ~AsyncWrites();
+    unsigned char *GetBuffer(const unsigned slot);
+
+    unsigned char *buffers[kNumBuffers];
+    unsigned buffer_size;
+    IoUring::Request requests[kNumBuffers];
+    /**
+     * Number of bytes in flight per buffer, zero if the buffer is free
+     */
+    unsigned sizes[kNumBuffers];
+    unsigned current;
+    /**
+     * File offset of the next write
+     */
+    uint64_t offset;
+    /**
+     * The first error of a write that completed in the background
+     */
+    int error;
+  };
+
   struct Transaction {
     Transaction(const shash::Any &id, const std::string &final_path)
       : buf_pos(0)
@@ -120,7 +203,10 @@ class PosixCacheManager : public CacheManager {
       , tmp_path()
       , final_path(final_path)
       , id(id)
+      , stream(NULL)
+      , async(NULL)
     { }
+    ~Transaction() { delete async; }
 
     unsigned char buffer[4096];
     unsigned buf_pos;
@@ -131,6 +217,11 @@ class PosixCacheManager : public CacheManager {
     std::string tmp_path;
     std::string final_path;
     shash::Any id;
+    StreamProgress *stream;
+    /**
+     * Set if the cache writes through io_uring, replaces buffer
+     */
+    AsyncWrites *async;
   };
 
   PosixCacheManager(const std::string &cache_path, const bool alien_cache)
@@ -140,13 +231,25 @@ class PosixCacheManager : public CacheManager {
     , rename_workaround_(kRenameNormal)
     , cache_mode_(kCacheReadWrite)
     , reports_correct_filesize_(true)
+    , io_uring_(NULL)
   {
     atomic_init32(&no_inflight_txns_);
+    atomic_init32(&num_streams_);
+    int retval = pthread_mutex_init(&lock_streams_, NULL);
+    assert(retval == 0);
   }
 
   std::string GetPathInCache(const shash::Any &id);
   int Rename(const char *oldpath, const char *newpath);
   int Flush(Transaction *transaction);
+  int SubmitBuffer(Transaction *transaction);
+  int WaitForWrite(Transaction *transaction, const unsigned slot);
+  int WaitForWrites(Transaction *transaction);
+  int DoCommitTxn(Transaction *transaction);
+  void RegisterStream(const int fd, StreamProgress *stream);
+  StreamProgress *AcquireStream(const int fd);
+  void ReleaseStream(StreamProgress *stream);
+  void UnregisterStream(const int fd);
 
   std::string cache_path_;
   std::string txn_template_path_;
@@ -165,6 +268,19 @@ class PosixCacheManager : public CacheManager {
    * Hack for HDFS which writes file sizes asynchronously.
    */
   bool reports_correct_filesize_;
+
+  /**
+   * Read-only file descriptors of transactions that are still being written.
+   * The counter allows Pread() to skip the lookup when there are no streams.
+   */
+  std::map<int, StreamProgress *> streams_;
+  atomic_int32 num_streams_;
+  pthread_mutex_t lock_streams_;
+
+  /**
+   * If set, transactions are written asynchronously through io_uring
+   */
+  IoUring *io_uring_;
 };  // class PosixCacheManager
 
 #endif  // CVMFS_CACHE_POSIX_H_
@@ -0,0 +1,1190 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#define __STDC_FORMAT_MACROS
+
+#include "cvmfs_config.h"
+#include "cache_slab.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <set>
+
+#include "util/logging.h"
+#include "util/mutex.h"
+#include "util/platform.h"
+#include "util/posix.h"
+#include "util/smalloc.h"
+#include "util/string.h"
+
+using namespace std;  // NOLINT
+
+namespace {
+
+bool PreadAll(int fd, void *buf, uint64_t size, uint64_t offset) {
+  char *pos = static_cast<char *>(buf);
+  while (size > 0) {
+    const ssize_t nbytes = pread(fd, pos, size, offset);
+    if (nbytes < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    if (nbytes == 0)
+      return false;
+    pos += nbytes;
+    size -= nbytes;
+    offset += nbytes;
+  }
+  return true;
+}
+
+bool PwriteAll(int fd, const void *buf, uint64_t size, uint64_t offset) {
+  const char *pos = static_cast<const char *>(buf);
+  while (size > 0) {
+    const ssize_t nbytes = pwrite(fd, pos, size, offset);
+    if (nbytes < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    pos += nbytes;
+    size -= nbytes;
+    offset += nbytes;
+  }
+  return true;
+}
+
+}  // anonymous namespace
+
+
+const uint64_t SlabCacheManager::kDefaultSegmentSize = 64 * 1024 * 1024;
+const uint32_t SlabCacheManager::kMagicSegment = 0x42414c53;  // SLAB
+const uint32_t SlabCacheManager::kMagicRecord = 0x4a424f53;   // SOBJ
+
+
+int SlabCacheManager::AbortTxn(void *txn) {
+  Transaction *transaction = reinterpret_cast<Transaction *>(txn);
+  LogCvmfs(kLogCache, kLogDebug, "abort transaction %s",
+           transaction->id.ToString().c_str());
+  if (transaction->segment != 0) {
+    SetRecordState(transaction->fd, transaction->offset, kRecordDead);
+    MutexLockGuard m(&lock_);
+    ReleaseSegment(transaction->segment);
+  }
+  free(transaction->buffer);
+  transaction->~Transaction();
+  return 0;
+}
+
+
+bool SlabCacheManager::AcquireQuotaManager(QuotaManager *quota_mgr) {
+  if (quota_mgr == NULL)
+    return false;
+  delete quota_mgr_;
+  quota_mgr_ = quota_mgr;
+  return true;
+}
+
+
+int SlabCacheManager::AddFd(const ReadOnlyHandle &handle) {
+  int result = fd_table_.OpenFd(handle);
+  if (result == -ENFILE)
+    LogCvmfs(kLogCache, kLogDebug, "too many open files");
+  return result;
+}
+
+
+int SlabCacheManager::Close(int fd) {
+  MutexLockGuard m(&lock_);
+  ReadOnlyHandle handle = fd_table_.GetHandle(fd);
+  if (handle == ReadOnlyHandle()) {
+    LogCvmfs(kLogCache, kLogDebug, "bad fd %d on Close", fd);
+    return -EBADF;
+  }
+  int retval = fd_table_.CloseFd(fd);
+  assert(retval == 0);
+  ReleaseSegment(handle.segment);
+  return 0;
+}
+
+
+int SlabCacheManager::CommitTxn(void *txn) {
+  Transaction *transaction = reinterpret_cast<Transaction *>(txn);
+  LogCvmfs(kLogCache, kLogDebug, "commit %s",
+           transaction->id.ToString().c_str());
+
+  int result = Flush(transaction);
+  if (result < 0) {
+    AbortTxn(txn);
+    return result;
+  }
+  if (transaction->size != transaction->expected_size) {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+             "size check failure for %s, expected %" PRIu64 ", got %" PRIu64,
+             transaction->id.ToString().c_str(),
+             transaction->expected_size, transaction->size);
+    AbortTxn(txn);
+    return -EIO;
+  }
+  if (!WriteRecordHeader(transaction->fd, transaction->offset, transaction->id,
+                         transaction->object_info, transaction->size,
+                         kRecordCommitted))
+  {
+    AbortTxn(txn);
+    return -EIO;
+  }
+
+  Entry entry;
+  entry.segment = transaction->segment;
+  entry.offset = transaction->offset;
+  entry.header_size = transaction->header_size;
+  entry.size = transaction->size;
+  entry.type = transaction->object_info.type;
+  {
+    MutexLockGuard m(&lock_);
+    entry.last_access = ++clock_;
+    InsertEntry(transaction->id, entry);
+    ReleaseSegment(transaction->segment);
+  }
+
+  if ((transaction->object_info.type == kTypePinned) ||
+      (transaction->object_info.type == kTypeCatalog))
+  {
+    bool retval = quota_mgr_->Pin(
+      transaction->id, transaction->size, transaction->object_info.description,
+      (transaction->object_info.type == kTypeCatalog));
+    if (!retval) {
+      LogCvmfs(kLogCache, kLogDebug, "commit failed: cannot pin %s",
+               transaction->id.ToString().c_str());
+      RemoveObject(transaction->id);
+      transaction->~Transaction();
+      return -ENOSPC;
+    }
+  }
+  transaction->~Transaction();
+  return 0;
+}
+
+
+/**
+ * Copies the record of entry from a segment that is about to be reclaimed to
+ * the end of the active segment.  Called with lock_ held.
+ */
+bool SlabCacheManager::CopyForward(
+  Segment *from,
+  const shash::Any &id,
+  Entry *entry)
+{
+  const uint64_t length = entry->length();
+  if ((active_ == NULL) || (active_->head + length > active_->size))
+    return false;
+
+  const uint64_t to = active_->head;
+  vector<unsigned char> buffer(std::min(length, static_cast<uint64_t>(
+    1024 * 1024)));
+  for (uint64_t pos = 0; pos < length; ) {
+    const uint64_t nbytes = std::min(static_cast<uint64_t>(buffer.size()),
+                                     length - pos);
+    if (!PreadAll(from->fd, &buffer[0], nbytes, entry->offset + pos) ||
+        !PwriteAll(active_->fd, &buffer[0], nbytes, to + pos))
+    {
+      LogCvmfs(kLogCache, kLogDebug, "failed to copy forward %s",
+               id.ToString().c_str());
+      return false;
+    }
+    pos += nbytes;
+  }
+
+  active_->head += length;
+  active_->live += length;
+  active_->objects.push_back(id);
+  from->live -= length;
+  entry->segment = active_->id;
+  entry->offset = to;
+  perf::Inc(counters_.n_copied);
+  perf::Xadd(counters_.sz_copied, length);
+  return true;
+}
+
+
+SlabCacheManager *SlabCacheManager::Create(
+  const string &cache_path,
+  const uint64_t limit,
+  const uint64_t segment_size,
+  const unsigned max_open_fds,
+  perf::StatisticsTemplate statistics)
+{
+  const uint64_t effective_segment_size = std::min(segment_size, limit / 4);
+  if (effective_segment_size < 2 * kSegmentHeaderSize) {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+             "slab cache too small (%" PRIu64 " bytes)", limit);
+    return NULL;
+  }
+  if (!MkdirDeep(cache_path, 0700, false)) {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+             "cannot create slab cache directory %s", cache_path.c_str());
+    return NULL;
+  }
+
+  SlabCacheManager *cache_mgr = new SlabCacheManager(
+    cache_path, limit, effective_segment_size, max_open_fds, statistics);
+
+  vector<uint64_t> ids;
+  const vector<string> paths = FindFilesByPrefix(cache_path, "segment.");
+  for (unsigned i = 0; i < paths.size(); ++i) {
+    uint64_t id;
+    if (String2Uint64Parse(GetFileName(paths[i]).substr(8), &id) && (id > 0))
+      ids.push_back(id);
+  }
+  std::sort(ids.begin(), ids.end());
+
+  MutexLockGuard m(&cache_mgr->lock_);
+  for (unsigned i = 0; i < ids.size(); ++i)
+    cache_mgr->LoadSegment(ids[i]);
+  // On reload, the file descriptors of the previous instance still point into
+  // some of the segments and pinned objects have to stay
+  cache_mgr->HoldSegments();
+  cache_mgr->Reclaim(limit, true);
+  LogCvmfs(kLogCache, kLogDebug, "slab cache %s: %u segments, %u objects",
+           cache_path.c_str(),
+           static_cast<unsigned>(cache_mgr->segments_.size()),
+           static_cast<unsigned>(cache_mgr->index_.size()));
+  return cache_mgr;
+}
+
+
+/**
+ * Creates a new, preallocated segment file.  Called with lock_ held.
+ */
+SlabCacheManager::Segment *SlabCacheManager::CreateSegment(
+  const uint64_t size)
+{
+  const uint64_t id = next_segment_id_++;
+  const string path = GetSegmentPath(id);
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+             "failed to create segment %s (%d)", path.c_str(), errno);
+    return NULL;
+  }
+
+  SegmentHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = kMagicSegment;
+  header.version = kVersion;
+  header.id = id;
+  int retval = platform_fallocate(fd, size);
+  if ((retval != 0) || !PwriteAll(fd, &header, sizeof(header), 0)) {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+             "failed to allocate %" PRIu64 " bytes for segment %s (%d)",
+             size, path.c_str(), retval);
+    close(fd);
+    unlink(path.c_str());
+    return NULL;
+  }
+
+  Segment *segment = new Segment();
+  segment->id = id;
+  segment->fd = fd;
+  segment->size = size;
+  segment->head = kSegmentHeaderSize;
+  segments_[id] = segment;
+  allocated_ += size;
+  perf::Inc(counters_.n_segments);
+  LogCvmfs(kLogCache, kLogDebug, "created segment %s (%" PRIu64 " bytes)",
+           path.c_str(), size);
+  return segment;
+}
+
+
+void SlabCacheManager::CtrlTxn(
+  const ObjectInfo &object_info,
+  const int flags,
+  void *txn)
+{
+  Transaction *transaction = reinterpret_cast<Transaction *>(txn);
+  transaction->object_info = object_info;
+}
+
+
+/**
+ * Called with lock_ held.  All the objects of the segment must have been
+ * dropped or copied forward.
+ */
+void SlabCacheManager::DeleteSegment(Segment *segment) {
+  assert(segment->num_refs == 0);
+  close(segment->fd);
+  unlink(GetSegmentPath(segment->id).c_str());
+  allocated_ -= segment->size;
+  if (active_ == segment)
+    active_ = NULL;
+  segments_.erase(segment->id);
+  delete segment;
+  perf::Dec(counters_.n_segments);
+}
+
+
+string SlabCacheManager::Describe() {
+  return "Slab cache manager (cache directory: " + cache_path_ + ", size " +
+         StringifyInt(limit_ / (1024 * 1024)) + "MB, segment size " +
+         StringifyInt(segment_size_ / (1024 * 1024)) + "MB)\n";
+}
+
+
+bool SlabCacheManager::DoFreeState(void *data) {
+  SavedState *saved_state = reinterpret_cast<SavedState *>(data);
+  delete saved_state->fd_table;
+  delete saved_state;
+  return true;
+}
+
+
+/**
+ * The new cache manager has already rebuilt the index from the segments.  The
+ * open file descriptors refer to records by segment and offset, which did not
+ * change in between.  The segments were held since startup, so they must
+ * still be there; if not, the file descriptor is dropped.  Once referenced by
+ * the file descriptors, the segments need not be held any longer.
+ */
+int SlabCacheManager::DoRestoreState(void *data) {
+  SavedState *saved_state = reinterpret_cast<SavedState *>(data);
+  MutexLockGuard m(&lock_);
+
+  // When DoRestoreState is called, we have fd 0 assigned to the root file
+  // catalog unless this is a lower layer cache in a tiered setup
+  for (unsigned i = 1; i < fd_table_.GetMaxFds(); ++i) {
+    assert(fd_table_.GetHandle(i) == ReadOnlyHandle());
+  }
+  ReadOnlyHandle handle_root = fd_table_.GetHandle(0);
+
+  fd_table_.AssignFrom(*saved_state->fd_table);
+  unsigned num_lost = 0;
+  for (unsigned i = 0; i < fd_table_.GetMaxFds(); ++i) {
+    ReadOnlyHandle handle = fd_table_.GetHandle(i);
+    if (handle == ReadOnlyHandle())
+      continue;
+    map<uint64_t, Segment *>::const_iterator iter =
+      segments_.find(handle.segment);
+    if (iter == segments_.end()) {
+      fd_table_.CloseFd(i);
+      num_lost++;
+      continue;
+    }
+    iter->second->num_refs++;
+  }
+  if (num_lost > 0) {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+             "slab cache %s: %u open files refer to missing segments",
+             cache_path_.c_str(), num_lost);
+  }
+
+  // Keep appending to the same segment if nothing happened to it
+  map<uint64_t, Segment *>::const_iterator iter =
+    segments_.find(saved_state->active);
+  if ((iter != segments_.end()) && (iter->second->head == saved_state->head))
+    active_ = iter->second;
+
+  ReleaseHeldSegments();
+
+  int new_root_fd = -1;
+  if (handle_root != ReadOnlyHandle()) {
+    new_root_fd = fd_table_.OpenFd(handle_root);
+    // There must be a free file descriptor because the root file catalog gets
+    // closed before a reload
+    assert(new_root_fd >= 0);
+  }
+  return new_root_fd;
+}
+
+
+void *SlabCacheManager::DoSaveState() {
+  MutexLockGuard m(&lock_);
+  SavedState *saved_state = new SavedState();
+  saved_state->fd_table = fd_table_.Clone();
+  if (active_ != NULL) {
+    saved_state->active = active_->id;
+    saved_state->head = active_->head;
+  }
+
+  // The next instance reclaims space before the file descriptors are restored.
+  // Tell it which segments must survive until then and which objects are
+  // pinned.
+  set<uint64_t> in_use;
+  for (unsigned i = 0; i < fd_table_.GetMaxFds(); ++i) {
+    ReadOnlyHandle handle = fd_table_.GetHandle(i);
+    if (handle != ReadOnlyHandle())
+      in_use.insert(handle.segment);
+  }
+  string held;
+  for (set<uint64_t>::const_iterator i = in_use.begin(), iEnd = in_use.end();
+       i != iEnd; ++i)
+  {
+    held += "segment " + StringifyUint(*i) + "\n";
+  }
+  for (map<shash::Any, Entry>::const_iterator i = index_.begin(),
+       iEnd = index_.end(); i != iEnd; ++i)
+  {
+    if (i->second.pinned)
+      held += "pinned " + i->first.ToString() + "\n";
+  }
+  const string path = cache_path_ + "/held";
+  if (!SafeWriteToFile(held, path, 0600)) {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+             "failed to write %s (%d)", path.c_str(), errno);
+  }
+  return saved_state;
+}
+
+
+/**
+ * Called with lock_ held.
+ */
+void SlabCacheManager::DropEntry(map<shash::Any, Entry>::iterator iter) {
+  const Entry &entry = iter->second;
+  map<uint64_t, Segment *>::const_iterator iter_segment =
+    segments_.find(entry.segment);
+  assert(iter_segment != segments_.end());
+  iter_segment->second->live -= entry.length();
+  if (entry.pinned)
+    pinned_ -= entry.size;
+  index_.erase(iter);
+}
+
+
+int SlabCacheManager::Dup(int fd) {
+  MutexLockGuard m(&lock_);
+  ReadOnlyHandle handle = fd_table_.GetHandle(fd);
+  if (handle == ReadOnlyHandle()) {
+    LogCvmfs(kLogCache, kLogDebug, "bad fd %d on Dup", fd);
+    return -EBADF;
+  }
+  int result = AddFd(handle);
+  if (result < 0)
+    return result;
+  map<uint64_t, Segment *>::const_iterator iter =
+    segments_.find(handle.segment);
+  if (iter != segments_.end())
+    iter->second->num_refs++;
+  return result;
+}
+
+
+/**
+ * Copies forward pinned objects and, if keep_regular is set, objects that
+ * were opened after the segment became inactive.  Everything else is dropped.
+ * Fails if a pinned object cannot be moved.  Called with lock_ held.
+ */
+bool SlabCacheManager::Evacuate(Segment *victim, const bool keep_regular) {
+  // Leave most of the active segment to new objects
+  uint64_t budget = segment_size_ / 4;
+  for (unsigned i = 0; i < victim->objects.size(); ++i) {
+    map<shash::Any, Entry>::iterator iter = index_.find(victim->objects[i]);
+    if ((iter == index_.end()) || (iter->second.segment != victim->id))
+      continue;
+    Entry *entry = &iter->second;
+    const uint64_t length = entry->length();
+    const bool keep = entry->pinned ||
+      (keep_regular && (entry->type != kTypeVolatile) &&
+       (entry->last_access > victim->sealed_at) && (length <= budget));
+    if (keep) {
+      if (CopyForward(victim, iter->first, entry)) {
+        if (!entry->pinned)
+          budget -= length;
+        continue;
+      }
+      if (entry->pinned) {
+        LogCvmfs(kLogCache, kLogDebug, "cannot move pinned object %s",
+                 iter->first.ToString().c_str());
+        return false;
+      }
+    }
+    DropEntry(iter);
+    perf::Inc(counters_.n_dropped);
+  }
+  return true;
+}
+
+
+/**
+ * Makes objects of unknown size, which are kept in memory, part of a segment.
+ * Objects of known size are written into their segment directly.
+ */
+int SlabCacheManager::Flush(Transaction *transaction) {
+  if (transaction->segment == 0) {
+    if (transaction->expected_size == kSizeUnknown)
+      transaction->expected_size = transaction->size;
+    int retval = Reserve(transaction);
+    if (retval < 0)
+      return retval;
+  }
+  if (transaction->buffer != NULL) {
+    if (!PwriteAll(transaction->fd, transaction->buffer, transaction->size,
+                   transaction->offset + transaction->header_size))
+    {
+      return -EIO;
+    }
+    free(transaction->buffer);
+    transaction->buffer = NULL;
+    transaction->buffer_size = 0;
+  }
+  return 0;
+}
+
+
+int64_t SlabCacheManager::GetSize(int fd) {
+  MutexLockGuard m(&lock_);
+  ReadOnlyHandle handle = fd_table_.GetHandle(fd);
+  if (handle == ReadOnlyHandle()) {
+    LogCvmfs(kLogCache, kLogDebug, "bad fd %d on GetSize", fd);
+    return -EBADF;
+  }
+  return handle.size;
+}
+
+
+uint64_t SlabCacheManager::GetPinned() {
+  MutexLockGuard m(&lock_);
+  return pinned_;
+}
+
+
+string SlabCacheManager::GetSegmentPath(const uint64_t id) {
+  return cache_path_ + "/segment." + StringifyUint(id);
+}
+
+
+uint64_t SlabCacheManager::GetUsed() {
+  MutexLockGuard m(&lock_);
+  uint64_t result = 0;
+  for (map<uint64_t, Segment *>::const_iterator i = segments_.begin(),
+       iEnd = segments_.end(); i != iEnd; ++i)
+  {
+    result += i->second->live;
+  }
+  return result;
+}
+
+
+/**
+ * On reload, references the segments that are still used by the previous
+ * instance, so that they are not reclaimed before DoRestoreState, and pins the
+ * objects that were pinned before.  The list is removed right away; after a
+ * crash during reload, the segments stay until the next restart.  Called with
+ * lock_ held.
+ */
+void SlabCacheManager::HoldSegments() {
+  const string path = cache_path_ + "/held";
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+  string content;
+  const bool retval = SafeReadToString(fd, &content);
+  close(fd);
+  unlink(path.c_str());
+  if (!retval)
+    return;
+
+  const vector<string> lines = SplitString(content, '\n');
+  for (unsigned i = 0; i < lines.size(); ++i) {
+    const vector<string> fields = SplitString(lines[i], ' ');
+    if (fields.size() != 2)
+      continue;
+    if (fields[0] == "segment") {
+      uint64_t id;
+      if (!String2Uint64Parse(fields[1], &id))
+        continue;
+      map<uint64_t, Segment *>::const_iterator iter = segments_.find(id);
+      if (iter == segments_.end())
+        continue;
+      iter->second->num_refs++;
+      held_segments_.push_back(id);
+    } else if (fields[0] == "pinned") {
+      map<shash::Any, Entry>::iterator iter =
+        index_.find(shash::MkFromHexPtr(shash::HexPtr(fields[1])));
+      if ((iter == index_.end()) || iter->second.pinned)
+        continue;
+      iter->second.pinned = true;
+      pinned_ += iter->second.size;
+    }
+  }
+}
+
+
+/**
+ * Called with lock_ held.  Replaces older copies of the same object.
+ */
+void SlabCacheManager::InsertEntry(const shash::Any &id, const Entry &entry) {
+  map<shash::Any, Entry>::iterator iter = index_.find(id);
+  if (iter != index_.end())
+    DropEntry(iter);
+  Segment *segment = segments_[entry.segment];
+  assert(segment != NULL);
+  segment->live += entry.length();
+  segment->objects.push_back(id);
+  index_[id] = entry;
+}
+
+
+vector<string> SlabCacheManager::ListObjects(
+  const bool pinned_only,
+  const ObjectType type,
+  const bool any_type)
+{
+  vector<string> result;
+  MutexLockGuard m(&lock_);
+  for (map<shash::Any, Entry>::const_iterator i = index_.begin(),
+       iEnd = index_.end(); i != iEnd; ++i)
+  {
+    const Entry &entry = i->second;
+    if ((pinned_only && !entry.pinned) || (!any_type && (entry.type != type)))
+      continue;
+    const int fd = segments_[entry.segment]->fd;
+    RecordHeader header;
+    if (!PreadAll(fd, &header, sizeof(header), entry.offset))
+      continue;
+    string description(std::min(header.description_size,
+                                static_cast<uint32_t>(kMaxDescriptionSize)),
+                       '\0');
+    if (!description.empty() &&
+        !PreadAll(fd, &description[0], description.size(),
+                  entry.offset + sizeof(header)))
+    {
+      continue;
+    }
+    result.push_back(description);
+  }
+  return result;
+}
+
+
+manifest::Breadcrumb SlabCacheManager::LoadBreadcrumb(const string &fqrn) {
+  return manifest::Manifest::ReadBreadcrumb(fqrn, cache_path_);
+}
+
+
+/**
+ * Adds the committed records of a segment file to the index.  Scanning stops
+ * at the first record header that does not make sense, e.g. after a crash.
+ * Called with lock_ held.
+ */
+bool SlabCacheManager::LoadSegment(const uint64_t id) {
+  next_segment_id_ = std::max(next_segment_id_, id + 1);
+  const string path = GetSegmentPath(id);
+  int fd = open(path.c_str(), O_RDWR);
+  platform_stat64 info;
+  SegmentHeader header;
+  if ((fd < 0) || (platform_fstat(fd, &info) != 0) ||
+      !PreadAll(fd, &header, sizeof(header), 0) ||
+      (header.magic != kMagicSegment) || (header.version != kVersion) ||
+      (header.id != id))
+  {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogWarn,
+             "removing invalid segment %s", path.c_str());
+    if (fd >= 0)
+      close(fd);
+    unlink(path.c_str());
+    return false;
+  }
+
+  Segment *segment = new Segment();
+  segment->id = id;
+  segment->fd = fd;
+  segment->size = info.st_size;
+  segments_[id] = segment;
+  allocated_ += segment->size;
+  perf::Inc(counters_.n_segments);
+
+  uint64_t offset = kSegmentHeaderSize;
+  while (offset + sizeof(RecordHeader) <= segment->size) {
+    RecordHeader record;
+    if (!PreadAll(fd, &record, sizeof(record), offset) ||
+        (record.magic != kMagicRecord) ||
+        (record.description_size > kMaxDescriptionSize) ||
+        (record.algorithm >= shash::kAny) ||
+        (record.size > segment->size))
+    {
+      break;
+    }
+    const uint32_t header_size =
+      Align(sizeof(RecordHeader) + record.description_size);
+    const uint64_t length = header_size + Align(record.size);
+    if (offset + length > segment->size)
+      break;
+    if (record.state == kRecordCommitted) {
+      Entry entry;
+      entry.segment = id;
+      entry.offset = offset;
+      entry.header_size = header_size;
+      entry.size = record.size;
+      entry.type = static_cast<ObjectType>(record.type);
+      InsertEntry(shash::Any(static_cast<shash::Algorithms>(record.algorithm),
+                             record.digest, record.suffix),
+                  entry);
+    }
+    offset += length;
+  }
+  segment->head = offset;
+  return true;
+}
+
+
+int SlabCacheManager::Open(const BlessedObject &object) {
+  MutexLockGuard m(&lock_);
+  map<shash::Any, Entry>::iterator iter = index_.find(object.id);
+  if (iter == index_.end()) {
+    LogCvmfs(kLogCache, kLogDebug, "miss %s", object.id.ToString().c_str());
+    return -ENOENT;
+  }
+  Entry *entry = &iter->second;
+  int fd = AddFd(ReadOnlyHandle(entry->segment,
+                                entry->offset + entry->header_size,
+                                entry->size));
+  if (fd < 0)
+    return fd;
+  entry->last_access = ++clock_;
+  segments_[entry->segment]->num_refs++;
+  LogCvmfs(kLogCache, kLogDebug, "hit %s", object.id.ToString().c_str());
+  return fd;
+}
+
+
+int SlabCacheManager::OpenFromTxn(void *txn) {
+  Transaction *transaction = reinterpret_cast<Transaction *>(txn);
+  int retval = Flush(transaction);
+  if (retval < 0)
+    return retval;
+
+  MutexLockGuard m(&lock_);
+  int fd = AddFd(ReadOnlyHandle(transaction->segment,
+                                transaction->offset + transaction->header_size,
+                                transaction->size));
+  if (fd < 0)
+    return fd;
+  segments_[transaction->segment]->num_refs++;
+  LogCvmfs(kLogCache, kLogDebug, "opened pending transaction for %s",
+           transaction->id.ToString().c_str());
+  return fd;
+}
+
+
+/**
+ * Pinned objects cannot occupy more than half of the cache.
+ */
+bool SlabCacheManager::PinObject(const shash::Any &id, const uint64_t size) {
+  const uint64_t watermark = kHighPinWatermark * (limit_ / 2) / 100;
+  bool result;
+  uint64_t pinned;
+  {
+    MutexLockGuard m(&lock_);
+    map<shash::Any, Entry>::iterator iter = index_.find(id);
+    if (iter == index_.end())
+      return false;
+    Entry *entry = &iter->second;
+    if (entry->pinned)
+      return true;
+    result = (pinned_ + entry->size <= limit_ / 2);
+    if (result) {
+      entry->pinned = true;
+      pinned_ += entry->size;
+    } else {
+      LogCvmfs(kLogCache, kLogDebug, "cannot pin %s, pinned size %" PRIu64,
+               id.ToString().c_str(), pinned_);
+    }
+    pinned = pinned_;
+  }
+
+  if ((!result || (pinned > watermark)) && (quota_mgr_ != NULL)) {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogWarn,
+             "high watermark of pinned files (%" PRIu64 "M > %" PRIu64 "M)",
+             pinned / (1024 * 1024), watermark / (1024 * 1024));
+    quota_mgr_->BroadcastBackchannels("R");  // clients: please release pinned
+  }
+  return result;
+}
+
+
+int64_t SlabCacheManager::Pread(
+  int fd,
+  void *buf,
+  uint64_t size,
+  uint64_t offset)
+{
+  ReadOnlyHandle handle;
+  int segment_fd;
+  {
+    MutexLockGuard m(&lock_);
+    handle = fd_table_.GetHandle(fd);
+    if (handle == ReadOnlyHandle()) {
+      LogCvmfs(kLogCache, kLogDebug, "bad fd %d on Pread", fd);
+      return -EBADF;
+    }
+    map<uint64_t, Segment *>::const_iterator iter =
+      segments_.find(handle.segment);
+    if (iter == segments_.end())
+      return -EIO;
+    // The segment stays open as long as fd is open
+    segment_fd = iter->second->fd;
+  }
+
+  if (offset >= handle.size)
+    return 0;
+  size = std::min(size, handle.size - offset);
+  int64_t result;
+  do {
+    errno = 0;
+    result = pread(segment_fd, buf, size, handle.offset + offset);
+  } while ((result == -1) && (errno == EINTR));
+  if (result < 0)
+    return -errno;
+  return result;
+}
+
+
+int SlabCacheManager::Readahead(int fd) {
+  MutexLockGuard m(&lock_);
+  if (fd_table_.GetHandle(fd) == ReadOnlyHandle()) {
+    LogCvmfs(kLogCache, kLogDebug, "bad fd %d on Readahead", fd);
+    return -EBADF;
+  }
+  return 0;
+}
+
+
+/**
+ * Drops entire segments, oldest first, until at most target bytes are
+ * allocated.  Segments that are in use and the active segment are skipped.
+ * Called with lock_ held.
+ */
+bool SlabCacheManager::Reclaim(const uint64_t target, const bool keep_regular) {
+  while (allocated_ > target) {
+    Segment *victim = NULL;
+    for (map<uint64_t, Segment *>::const_iterator i = segments_.begin(),
+         iEnd = segments_.end(); i != iEnd; ++i)
+    {
+      if ((i->second != active_) && (i->second->num_refs == 0)) {
+        victim = i->second;
+        break;
+      }
+    }
+    if ((victim == NULL) || !Evacuate(victim, keep_regular)) {
+      LogCvmfs(kLogCache, kLogDebug, "cannot shrink slab cache to %" PRIu64
+               " bytes (%" PRIu64 " bytes allocated)", target, allocated_);
+      perf::Inc(counters_.n_full);
+      return false;
+    }
+    LogCvmfs(kLogCache, kLogDebug, "reclaimed segment %" PRIu64, victim->id);
+    DeleteSegment(victim);
+    perf::Inc(counters_.n_reclaimed);
+  }
+  return true;
+}
+
+
+/**
+ * Called with lock_ held.
+ */
+void SlabCacheManager::ReleaseHeldSegments() {
+  for (unsigned i = 0; i < held_segments_.size(); ++i)
+    ReleaseSegment(held_segments_[i]);
+  held_segments_.clear();
+}
+
+
+/**
+ * Called with lock_ held.
+ */
+void SlabCacheManager::ReleaseSegment(const uint64_t id) {
+  map<uint64_t, Segment *>::const_iterator iter = segments_.find(id);
+  if (iter == segments_.end())
+    return;
+  assert(iter->second->num_refs > 0);
+  iter->second->num_refs--;
+}
+
+
+void SlabCacheManager::RemoveObject(const shash::Any &id) {
+  MutexLockGuard m(&lock_);
+  map<shash::Any, Entry>::iterator iter = index_.find(id);
+  if (iter == index_.end())
+    return;
+  SetRecordState(segments_[iter->second.segment]->fd, iter->second.offset,
+                 kRecordDead);
+  DropEntry(iter);
+}
+
+
+/**
+ * Reserves space for the record of the transaction and writes a pending
+ * record header.  The segment is referenced until the transaction is
+ * committed or aborted.
+ */
+int SlabCacheManager::Reserve(Transaction *transaction) {
+  assert(transaction->expected_size != kSizeUnknown);
+  const uint32_t header_size = Align(sizeof(RecordHeader) + std::min(
+    transaction->object_info.description.size(),
+    static_cast<size_t>(kMaxDescriptionSize)));
+  const uint64_t length = header_size + Align(transaction->expected_size);
+  {
+    MutexLockGuard m(&lock_);
+    Segment *segment;
+    if (kSegmentHeaderSize + length > segment_size_) {
+      segment = CreateSegment(kSegmentHeaderSize + length);
+      if (segment == NULL)
+        return -ENOSPC;
+      segment->sealed_at = clock_;
+    } else {
+      if ((active_ == NULL) || (active_->head + length > active_->size)) {
+        if (active_ != NULL)
+          active_->sealed_at = clock_;
+        active_ = CreateSegment(segment_size_);
+        if (active_ == NULL)
+          return -ENOSPC;
+      }
+      segment = active_;
+    }
+    transaction->segment = segment->id;
+    transaction->fd = segment->fd;
+    transaction->offset = segment->head;
+    transaction->header_size = header_size;
+    segment->head += length;
+    segment->num_refs++;
+    Reclaim(limit_, true);
+  }
+
+  if (!WriteRecordHeader(transaction->fd, transaction->offset, transaction->id,
+                         transaction->object_info, transaction->expected_size,
+                         kRecordPending))
+  {
+    return -EIO;
+  }
+  return 0;
+}
+
+
+int SlabCacheManager::Reset(void *txn) {
+  Transaction *transaction = reinterpret_cast<Transaction *>(txn);
+  transaction->size = 0;
+  return 0;
+}
+
+
+bool SlabCacheManager::SetRecordState(
+  const int fd,
+  const uint64_t offset,
+  const RecordState state)
+{
+  const uint8_t value = state;
+  return PwriteAll(fd, &value, sizeof(value),
+                   offset + offsetof(RecordHeader, state));
+}
+
+
+/**
+ * Used for cleanup requests.  Only pinned objects are copied forward and the
+ * active segment is reclaimed, too, if it is not in use.
+ */
+bool SlabCacheManager::Shrink(const uint64_t leave_size) {
+  MutexLockGuard m(&lock_);
+  if ((active_ != NULL) && (active_->num_refs == 0)) {
+    active_->sealed_at = clock_;
+    active_ = NULL;
+  }
+  return Reclaim(leave_size, false);
+}
+
+
+SlabCacheManager::SlabCacheManager(
+  const string &cache_path,
+  const uint64_t limit,
+  const uint64_t segment_size,
+  const unsigned max_open_fds,
+  perf::StatisticsTemplate statistics)
+  : cache_path_(cache_path)
+  , limit_(limit)
+  , segment_size_(segment_size)
+  , fd_table_(max_open_fds, ReadOnlyHandle())
+  , active_(NULL)
+  , next_segment_id_(1)
+  , allocated_(0)
+  , pinned_(0)
+  , clock_(0)
+  , counters_(statistics)
+{
+  int retval = pthread_mutex_init(&lock_, NULL);
+  assert(retval == 0);
+}
+
+
+SlabCacheManager::~SlabCacheManager() {
+  for (map<uint64_t, Segment *>::iterator i = segments_.begin(),
+       iEnd = segments_.end(); i != iEnd; ++i)
+  {
+    close(i->second->fd);
+    delete i->second;
+  }
+  pthread_mutex_destroy(&lock_);
+}
+
+
+int SlabCacheManager::StartTxn(const shash::Any &id, uint64_t size, void *txn) {
+  LogCvmfs(kLogCache, kLogDebug, "new transaction with id %s",
+           id.ToString().c_str());
+  new (txn) Transaction(id, size);
+  return 0;
+}
+
+
+bool SlabCacheManager::StoreBreadcrumb(const manifest::Manifest &manifest) {
+  return manifest.ExportBreadcrumb(cache_path_, 0600);
+}
+
+
+void SlabCacheManager::UnpinObject(const shash::Any &id) {
+  MutexLockGuard m(&lock_);
+  map<shash::Any, Entry>::iterator iter = index_.find(id);
+  if ((iter == index_.end()) || !iter->second.pinned)
+    return;
+  iter->second.pinned = false;
+  pinned_ -= iter->second.size;
+}
+
+
+int64_t SlabCacheManager::Write(const void *buf, uint64_t size, void *txn) {
+  Transaction *transaction = reinterpret_cast<Transaction *>(txn);
+
+  if (transaction->expected_size == kSizeUnknown) {
+    if (transaction->size + size > transaction->buffer_size) {
+      transaction->buffer_size = std::max(2 * transaction->buffer_size,
+        std::max(transaction->size + size, static_cast<uint64_t>(4096)));
+      transaction->buffer = reinterpret_cast<unsigned char *>(
+        srealloc(transaction->buffer, transaction->buffer_size));
+    }
+    memcpy(transaction->buffer + transaction->size, buf, size);
+    transaction->size += size;
+    return size;
+  }
+
+  if (transaction->size + size > transaction->expected_size) {
+    LogCvmfs(kLogCache, kLogDebug,
+             "attempted to write more than requested (%" PRIu64 ">%" PRIu64 ")",
+             transaction->size + size, transaction->expected_size);
+    return -EFBIG;
+  }
+  if (transaction->segment == 0) {
+    int retval = Reserve(transaction);
+    if (retval < 0)
+      return retval;
+  }
+  if (!PwriteAll(transaction->fd, buf, size,
+                 transaction->offset + transaction->header_size +
+                 transaction->size))
+  {
+    return -errno;
+  }
+  transaction->size += size;
+  return size;
+}
+
+
+bool SlabCacheManager::WriteRecordHeader(
+  const int fd,
+  const uint64_t offset,
+  const shash::Any &id,
+  const ObjectInfo &object_info,
+  const uint64_t size,
+  const RecordState state)
+{
+  const string description =
+    object_info.description.substr(0, kMaxDescriptionSize);
+  vector<unsigned char> buffer(
+    Align(sizeof(RecordHeader) + description.size()), 0);
+  RecordHeader *header = reinterpret_cast<RecordHeader *>(&buffer[0]);
+  header->magic = kMagicRecord;
+  header->state = state;
+  header->type = object_info.type;
+  header->algorithm = id.algorithm;
+  header->suffix = id.suffix;
+  header->description_size = description.size();
+  header->size = size;
+  memcpy(header->digest, id.digest, shash::kMaxDigestSize);
+  memcpy(&buffer[sizeof(RecordHeader)], description.data(),
+         description.size());
+  return PwriteAll(fd, &buffer[0], buffer.size(), offset);
+}
+
+
+//------------------------------------------------------------------------------
+
+
+SlabQuotaManager *SlabQuotaManager::Create(SlabCacheManager *cache_mgr) {
+  return new SlabQuotaManager(cache_mgr);
+}
+
+
+bool SlabQuotaManager::HasCapability(Capabilities capability) {
+  switch (capability) {
+    case kCapIntrospectSize:
+    case kCapList:
+    case kCapShrink:
+    case kCapListeners:
+      return true;
+    default:
+      return false;
+  }
+}
+
+
+vector<string> SlabQuotaManager::List() {
+  return cache_mgr_->ListObjects(false, CacheManager::kTypeRegular, false);
+}
+
+
+vector<string> SlabQuotaManager::ListCatalogs() {
+  return cache_mgr_->ListObjects(false, CacheManager::kTypeCatalog, false);
+}
+
+
+vector<string> SlabQuotaManager::ListPinned() {
+  return cache_mgr_->ListObjects(true, CacheManager::kTypeRegular, true);
+}
+
+
+vector<string> SlabQuotaManager::ListVolatile() {
+  return cache_mgr_->ListObjects(false, CacheManager::kTypeVolatile, false);
+}
+
+
+void SlabQuotaManager::RegisterBackChannel(
+  int back_channel[2],
+  const string &channel_id)
+{
+  shash::Md5 hash_id = shash::Md5(shash::AsciiPtr(channel_id));
+  MakePipe(back_channel);
+  LockBackChannels();
+  assert(back_channels_.find(hash_id) == back_channels_.end());
+  back_channels_[hash_id] = back_channel[1];
+  UnlockBackChannels();
+}
+
+
+void SlabQuotaManager::UnregisterBackChannel(
+  int back_channel[2],
+  const string &channel_id)
+{
+  shash::Md5 hash_id = shash::Md5(shash::AsciiPtr(channel_id));
+  LockBackChannels();
+  back_channels_.erase(hash_id);
+  UnlockBackChannels();
+  ClosePipe(back_channel);
+}
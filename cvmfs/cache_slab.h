@@ -0,0 +1,409 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#ifndef CVMFS_CACHE_SLAB_H_
+#define CVMFS_CACHE_SLAB_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "cache.h"
+#include "crypto/hash.h"
+#include "fd_table.h"
+#include "gtest/gtest_prod.h"
+#include "quota.h"
+#include "statistics.h"
+
+
+/**
+ * Stores objects in a few large, preallocated segment files instead of one
+ * file per object.  Objects are appended to the active segment and an
+ * in-memory index maps content hashes to their location.  Space is reclaimed
+ * by whole segments in the order in which they were written: pinned objects
+ * and objects that were opened after their segment filled up are copied
+ * forward into the active segment, the other objects of the segment are
+ * dropped together with the segment file.
+ *
+ * Every object is preceded by a record header that carries its content hash,
+ * type, size, and description.  On startup, the index is rebuilt from the
+ * committed records in the segment files.  Segments that are referenced by
+ * open file descriptors or pending transactions are never reclaimed.
+ *
+ * Objects of unknown size are buffered in memory until they are committed.
+ * Objects that do not fit into a segment get a segment of their own.
+ *
+ * The cache manages its space by itself.  The SlabQuotaManager provides
+ * pinning, listing, and shrinking on top of it.
+ *
+ * To use this cache, set CVMFS_CACHE_<INSTANCE>_TYPE=slab together with
+ * CVMFS_CACHE_<INSTANCE>_DIR, CVMFS_CACHE_<INSTANCE>_SIZE (MB), and optionally
+ * CVMFS_CACHE_<INSTANCE>_SEGMENT_SIZE (MB).
+ */
+class SlabCacheManager : public CacheManager {
+  friend class SlabQuotaManager;
+  FRIEND_TEST(T_SlabCacheManager, Reclaim);
+  FRIEND_TEST(T_SlabCacheManager, SaveRestore);
+  FRIEND_TEST(T_SlabCacheManager, SaveRestoreOverLimit);
+
+ public:
+  static const uint64_t kDefaultSegmentSize;  // 64M
+
+  struct Counters {
+    perf::Counter *n_segments;
+    perf::Counter *n_reclaimed;
+    perf::Counter *n_copied;
+    perf::Counter *sz_copied;
+    perf::Counter *n_dropped;
+    perf::Counter *n_full;
+
+    explicit Counters(perf::StatisticsTemplate statistics) {
+      n_segments = statistics.RegisterTemplated("n_segments",
+        "Number of segment files");
+      n_reclaimed = statistics.RegisterTemplated("n_reclaimed",
+        "Number of reclaimed segments");
+      n_copied = statistics.RegisterTemplated("n_copied",
+        "Number of objects copied forward during reclamation");
+      sz_copied = statistics.RegisterTemplated("sz_copied",
+        "Number of bytes copied forward during reclamation");
+      n_dropped = statistics.RegisterTemplated("n_dropped",
+        "Number of objects dropped from the cache");
+      n_full = statistics.RegisterTemplated("n_full",
+        "Number of times the cache could not be shrunk below its limit");
+    }
+  };
+
+  virtual CacheManagerIds id() { return kSlabCacheManager; }
+  virtual std::string Describe();
+
+  /**
+   * Opens or creates the segment files in cache_path and rebuilds the index.
+   * The segment size is capped at a quarter of the limit.
+   */
+  static SlabCacheManager *Create(const std::string &cache_path,
+                                  const uint64_t limit,
+                                  const uint64_t segment_size,
+                                  const unsigned max_open_fds,
+                                  perf::StatisticsTemplate statistics);
+  virtual ~SlabCacheManager();
+  virtual bool AcquireQuotaManager(QuotaManager *quota_mgr);
+
+  virtual int Open(const BlessedObject &object);
+  virtual int64_t GetSize(int fd);
+  virtual int Close(int fd);
+  virtual int64_t Pread(int fd, void *buf, uint64_t size, uint64_t offset);
+  virtual int Dup(int fd);
+  virtual int Readahead(int fd);
+
+  virtual uint32_t SizeOfTxn() { return sizeof(Transaction); }
+  virtual int StartTxn(const shash::Any &id, uint64_t size, void *txn);
+  virtual void CtrlTxn(const ObjectInfo &object_info,
+                       const int flags,
+                       void *txn);
+  virtual int64_t Write(const void *buf, uint64_t size, void *txn);
+  virtual int Reset(void *txn);
+  virtual int OpenFromTxn(void *txn);
+  virtual int AbortTxn(void *txn);
+  virtual int CommitTxn(void *txn);
+
+  virtual void Spawn() { }
+
+  virtual manifest::Breadcrumb LoadBreadcrumb(const std::string &fqrn);
+  virtual bool StoreBreadcrumb(const manifest::Manifest &manifest);
+
+  std::string cache_path() { return cache_path_; }
+  uint64_t limit() { return limit_; }
+  uint64_t segment_size() { return segment_size_; }
+
+ protected:
+  virtual void *DoSaveState();
+  virtual int DoRestoreState(void *data);
+  virtual bool DoFreeState(void *data);
+
+ private:
+  static const uint32_t kMagicSegment;
+  static const uint32_t kMagicRecord;
+  static const uint32_t kVersion = 1;
+  /**
+   * Records, descriptions, and data start on multiples of kAlignment
+   */
+  static const unsigned kAlignment = 64;
+  static const unsigned kSegmentHeaderSize = 4096;
+  static const unsigned kMaxDescriptionSize = 4096;
+  /**
+   * Clients are asked to release pinned catalogs once pinned objects occupy
+   * more than this percentage of the space available for pinning
+   */
+  static const unsigned kHighPinWatermark = 75;
+
+  enum RecordState {
+    kRecordPending = 1,
+    kRecordCommitted,
+    kRecordDead,
+  };
+
+  struct SegmentHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t id;
+  };
+
+  /**
+   * Precedes the description and the data of every object in a segment
+   */
+  struct RecordHeader {
+    uint32_t magic;
+    uint8_t state;
+    uint8_t type;
+    uint8_t algorithm;
+    char suffix;
+    uint32_t description_size;
+    uint32_t padding;
+    uint64_t size;
+    unsigned char digest[shash::kMaxDigestSize];
+  };
+
+  struct Segment {
+    Segment()
+      : id(0), fd(-1), size(0), head(0), live(0), num_refs(0), sealed_at(0)
+    { }
+
+    uint64_t id;
+    int fd;
+    uint64_t size;
+    /**
+     * Offset of the next record
+     */
+    uint64_t head;
+    /**
+     * Bytes of the records that are referenced from the index
+     */
+    uint64_t live;
+    /**
+     * Open file descriptors and pending transactions
+     */
+    unsigned num_refs;
+    /**
+     * Value of the access clock when the segment became inactive
+     */
+    uint64_t sealed_at;
+    /**
+     * Objects that have been stored in the segment, possibly outdated
+     */
+    std::vector<shash::Any> objects;
+  };
+
+  struct Entry {
+    Entry()
+      : segment(0), offset(0), header_size(0), size(0), type(kTypeRegular)
+      , pinned(false), last_access(0)
+    { }
+    uint64_t length() const { return header_size + Align(size); }
+
+    uint64_t segment;
+    uint64_t offset;
+    uint32_t header_size;
+    uint64_t size;
+    ObjectType type;
+    bool pinned;
+    uint64_t last_access;
+  };
+
+  struct ReadOnlyHandle {
+    ReadOnlyHandle() : segment(0), offset(0), size(0) { }
+    ReadOnlyHandle(uint64_t g, uint64_t o, uint64_t s)
+      : segment(g), offset(o), size(s) { }
+    bool operator ==(const ReadOnlyHandle &other) const {
+      return (segment == other.segment) && (offset == other.offset) &&
+             (size == other.size);
+    }
+    bool operator !=(const ReadOnlyHandle &other) const {
+      return !(*this == other);
+    }
+
+    /**
+     * Segment ids start at 1, zero marks an unused file descriptor
+     */
+    uint64_t segment;
+    /**
+     * Offset of the data in the segment
+     */
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  struct Transaction {
+    Transaction(const shash::Any &i, const uint64_t s)
+      : id(i), expected_size(s), size(0), segment(0), fd(-1), offset(0)
+      , header_size(0), buffer(NULL), buffer_size(0)
+    { }
+
+    shash::Any id;
+    uint64_t expected_size;
+    uint64_t size;
+    ObjectInfo object_info;
+    /**
+     * Set once space is reserved for the record
+     */
+    uint64_t segment;
+    /**
+     * File descriptor of the segment, valid while the transaction holds a
+     * reference to it
+     */
+    int fd;
+    uint64_t offset;
+    uint32_t header_size;
+    /**
+     * Objects of unknown size are collected here until commit
+     */
+    unsigned char *buffer;
+    uint64_t buffer_size;
+  };
+
+  struct SavedState {
+    SavedState() : fd_table(NULL), active(0), head(0) { }
+    FdTable<ReadOnlyHandle> *fd_table;
+    uint64_t active;
+    uint64_t head;
+  };
+
+  static uint64_t Align(const uint64_t size) {
+    return (size + kAlignment - 1) / kAlignment * kAlignment;
+  }
+
+  SlabCacheManager(const std::string &cache_path,
+                   const uint64_t limit,
+                   const uint64_t segment_size,
+                   const unsigned max_open_fds,
+                   perf::StatisticsTemplate statistics);
+  std::string GetSegmentPath(const uint64_t id);
+  void HoldSegments();
+  void ReleaseHeldSegments();
+  bool LoadSegment(const uint64_t id);
+  Segment *CreateSegment(const uint64_t size);
+  void DeleteSegment(Segment *segment);
+  int Reserve(Transaction *transaction);
+  int Flush(Transaction *transaction);
+  bool WriteRecordHeader(const int fd,
+                         const uint64_t offset,
+                         const shash::Any &id,
+                         const ObjectInfo &object_info,
+                         const uint64_t size,
+                         const RecordState state);
+  bool SetRecordState(const int fd,
+                      const uint64_t offset,
+                      const RecordState state);
+  void InsertEntry(const shash::Any &id, const Entry &entry);
+  void DropEntry(std::map<shash::Any, Entry>::iterator iter);
+  void ReleaseSegment(const uint64_t id);
+  bool Reclaim(const uint64_t target, const bool keep_regular);
+  bool Evacuate(Segment *victim, const bool keep_regular);
+  bool CopyForward(Segment *from, const shash::Any &id, Entry *entry);
+  int AddFd(const ReadOnlyHandle &handle);
+
+  // Called by the SlabQuotaManager
+  bool PinObject(const shash::Any &id, const uint64_t size);
+  void UnpinObject(const shash::Any &id);
+  void RemoveObject(const shash::Any &id);
+  bool Shrink(const uint64_t leave_size);
+  std::vector<std::string> ListObjects(const bool pinned_only,
+                                       const ObjectType type,
+                                       const bool any_type);
+  uint64_t GetUsed();
+  uint64_t GetPinned();
+
+  std::string cache_path_;
+  uint64_t limit_;
+  uint64_t segment_size_;
+
+  /**
+   * Protects all of the following members
+   */
+  pthread_mutex_t lock_;
+  FdTable<ReadOnlyHandle> fd_table_;
+  std::map<shash::Any, Entry> index_;
+  std::map<uint64_t, Segment *> segments_;
+  /**
+   * Segment that receives new records, NULL until the first write
+   */
+  Segment *active_;
+  uint64_t next_segment_id_;
+  /**
+   * Sum of the sizes of all segment files
+   */
+  uint64_t allocated_;
+  uint64_t pinned_;
+  /**
+   * Segments that were in use by the previous instance before a reload.  They
+   * are referenced until the file descriptors are restored.
+   */
+  std::vector<uint64_t> held_segments_;
+  uint64_t clock_;
+  Counters counters_;
+};  // class SlabCacheManager
+
+
+/**
+ * Forwards pinning, listing, and cleanup requests to the slab cache manager,
+ * which keeps track of its objects by itself.
+ */
+class SlabQuotaManager : public QuotaManager {
+ public:
+  static SlabQuotaManager *Create(SlabCacheManager *cache_mgr);
+  virtual bool HasCapability(Capabilities capability);
+
+  virtual void Insert(const shash::Any &hash, const uint64_t size,
+                      const std::string &description)
+  { }
+
+  virtual void InsertVolatile(const shash::Any &hash, const uint64_t size,
+                              const std::string &description)
+  { }
+
+  virtual bool Pin(const shash::Any &hash, const uint64_t size,
+                   const std::string &description, const bool is_catalog)
+  {
+    return cache_mgr_->PinObject(hash, size);
+  }
+
+  virtual void Unpin(const shash::Any &hash) { cache_mgr_->UnpinObject(hash); }
+  virtual void Touch(const shash::Any &hash) { }
+  virtual void Remove(const shash::Any &file) {
+    cache_mgr_->RemoveObject(file);
+  }
+  virtual bool Cleanup(const uint64_t leave_size) {
+    return cache_mgr_->Shrink(leave_size);
+  }
+
+  virtual void RegisterBackChannel(int back_channel[2],
+                                   const std::string &channel_id);
+  virtual void UnregisterBackChannel(int back_channel[2],
+                                     const std::string &channel_id);
+
+  virtual std::vector<std::string> List();
+  virtual std::vector<std::string> ListPinned();
+  virtual std::vector<std::string> ListCatalogs();
+  virtual std::vector<std::string> ListVolatile();
+  virtual uint64_t GetMaxFileSize() { return cache_mgr_->limit() / 2; }
+  virtual uint64_t GetCapacity() { return cache_mgr_->limit(); }
+  virtual uint64_t GetSize() { return cache_mgr_->GetUsed(); }
+  virtual uint64_t GetSizePinned() { return cache_mgr_->GetPinned(); }
+  virtual uint64_t GetCleanupRate(uint64_t period_s) { return 0; }
+
+  virtual void Spawn() { }
+  virtual pid_t GetPid() { return getpid(); }
+  virtual uint32_t GetProtocolRevision() { return 0; }
+
+ private:
+  explicit SlabQuotaManager(SlabCacheManager *cache_mgr)
+    : cache_mgr_(cache_mgr) { }
+
+  SlabCacheManager *cache_mgr_;
+};
+
+#endif  // CVMFS_CACHE_SLAB_H_
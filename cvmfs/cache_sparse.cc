@@ -0,0 +1,644 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#define __STDC_FORMAT_MACROS
+
+#include "cvmfs_config.h"
+#include "cache_sparse.h"
+
+#include <alloca.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "clientctx.h"
+#include "network/download.h"
+#include "network/sink.h"
+#include "util/logging.h"
+#include "util/mutex.h"
+#include "util/posix.h"
+#include "util/smalloc.h"
+
+using namespace std;  // NOLINT
+
+namespace {
+
+/**
+ * Writes a single block into the sparse file of an object.  Refuses more data
+ * than the block size, e.g. if a server ignores the range request.
+ */
+class BlockSink : public cvmfs::Sink {
+ public:
+  BlockSink(int fd, uint64_t offset, uint64_t size)
+    : fd_(fd), offset_(offset), size_(size), written_(0) { }
+  virtual ~BlockSink() { }
+
+  virtual int64_t Write(const void *buf, uint64_t sz) {
+    if (written_ + sz > size_)
+      return -EFBIG;
+    const char *pos = static_cast<const char *>(buf);
+    uint64_t remaining = sz;
+    while (remaining > 0) {
+      const ssize_t nbytes =
+        pwrite(fd_, pos, remaining, offset_ + written_);
+      if (nbytes < 0) {
+        if (errno == EINTR)
+          continue;
+        return -errno;
+      }
+      pos += nbytes;
+      written_ += nbytes;
+      remaining -= nbytes;
+    }
+    return sz;
+  }
+  virtual int Reset() {
+    written_ = 0;
+    return 0;
+  }
+
+  uint64_t written() const { return written_; }
+
+ private:
+  int fd_;
+  uint64_t offset_;
+  uint64_t size_;
+  uint64_t written_;
+};
+
+}  // anonymous namespace
+
+
+const unsigned SparseCache::kDefaultBlockSize = 1024 * 1024;
+
+
+int SparseCache::Close(const uint64_t handle) {
+  MutexLockGuard m(&lock_);
+  map<uint64_t, Object *>::iterator iter = handles_.find(handle);
+  if (iter == handles_.end())
+    return -EBADF;
+  Object *object = iter->second;
+  handles_.erase(iter);
+  Unref(object);
+  return 0;
+}
+
+
+SparseCache *SparseCache::Create(
+  const string &path,
+  const unsigned block_size,
+  const uint64_t limit,
+  CacheManager *cache_mgr,
+  download::DownloadManager *download_mgr,
+  download::DownloadManager *external_download_mgr,
+  perf::StatisticsTemplate statistics)
+{
+  assert(block_size > 0);
+  if (!MkdirDeep(path, 0700, false)) {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+             "cannot create sparse cache directory %s", path.c_str());
+    return NULL;
+  }
+  return new SparseCache(path, block_size, limit, cache_mgr, download_mgr,
+                         external_download_mgr, statistics);
+}
+
+
+uint64_t SparseCache::GetStoredBytes(const Object *object) const {
+  uint64_t stored = static_cast<uint64_t>(object->num_present) * block_size_;
+  if (object->present.back())
+    stored -= object->present.size() * block_size_ - object->size;
+  return stored;
+}
+
+
+/**
+ * Called with lock_ held.  Only unreferenced objects can be deleted.
+ */
+void SparseCache::DeleteObject(Object *object) {
+  assert(object->refcount == 0);
+  const uint64_t stored = GetStoredBytes(object);
+  assert(used_ >= stored);
+  used_ -= stored;
+  LogCvmfs(kLogCache, kLogDebug, "dropping sparse object %s (%" PRIu64 " "
+           "bytes)", object->id.ToString().c_str(), stored);
+  objects_.erase(object->id);
+  close(object->fd);
+  delete object;
+}
+
+
+/**
+ * Called with lock_ held.  Drops the least recently used objects that are not
+ * open until the limit is met.
+ */
+void SparseCache::Evict() {
+  while (used_ > limit_) {
+    Object *victim = NULL;
+    for (map<shash::Any, Object *>::const_iterator i = objects_.begin(),
+         iEnd = objects_.end(); i != iEnd; ++i)
+    {
+      if (i->second->refcount > 0)
+        continue;
+      if ((victim == NULL) || (i->second->last_used < victim->last_used))
+        victim = i->second;
+    }
+    if (victim == NULL)
+      return;
+    DeleteObject(victim);
+  }
+}
+
+
+/**
+ * Downloads the given block unless it is present or being downloaded by
+ * another thread.
+ */
+int SparseCache::FetchBlock(Object *object, const unsigned block) {
+  {
+    MutexLockGuard m(&object->lock);
+    while (true) {
+      if (object->failed)
+        return -EIO;
+      if (object->present[block])
+        return 0;
+      if (!object->inflight[block])
+        break;
+      pthread_cond_wait(&object->cond_block, &object->lock);
+    }
+    object->inflight[block] = true;
+  }
+
+  const uint64_t offset = static_cast<uint64_t>(block) * block_size_;
+  const uint64_t size = std::min(static_cast<uint64_t>(block_size_),
+                                 object->size - offset);
+  BlockSink sink(object->fd, offset, size);
+  download::JobInfo download_job(&object->url, false /* compressed */,
+                                 true /* probe hosts */, &sink, NULL);
+  download_job.range_offset = offset;
+  download_job.range_size = size;
+  ClientCtx *ctx = ClientCtx::GetInstance();
+  if (ctx->IsSet()) {
+    ctx->Get(&download_job.uid,
+             &download_job.gid,
+             &download_job.pid,
+             &download_job.interrupt_cue);
+  }
+  object->download_mgr->Fetch(&download_job);
+  const bool ok = (download_job.error_code == download::kFailOk) &&
+                  (sink.written() == size);
+
+  bool complete = false;
+  {
+    MutexLockGuard m(&object->lock);
+    object->inflight[block] = false;
+    if (ok) {
+      object->present[block] = true;
+      object->num_present++;
+      complete = (object->num_present == object->present.size());
+    }
+    pthread_cond_broadcast(&object->cond_block);
+  }
+  if (!ok) {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+             "failed to fetch block %u of %s (error %d [%s])", block,
+             object->url.c_str(), download_job.error_code,
+             download::Code2Ascii(download_job.error_code));
+    return -EIO;
+  }
+
+  perf::Inc(n_blocks_);
+  perf::Xadd(sz_downloaded_, size);
+  perf::Xadd(sz_saved_, -static_cast<int64_t>(size));
+  {
+    MutexLockGuard m(&lock_);
+    used_ += size;
+    if (used_ > limit_)
+      Evict();
+    if (complete) {
+      object->refcount++;
+      verify_queue_.push_back(object);
+      pthread_cond_signal(&cond_verify_);
+    }
+  }
+  return 0;
+}
+
+
+/**
+ * Verifies the complete objects of the queue one by one.  Objects that are
+ * still queued when the thread stops are verified after a reload.
+ */
+void *SparseCache::MainVerify(void *data) {
+  SparseCache *sparse_cache = reinterpret_cast<SparseCache *>(data);
+  LogCvmfs(kLogCache, kLogDebug, "starting sparse cache verification thread");
+
+  pthread_mutex_lock(&sparse_cache->lock_);
+  while (true) {
+    while (sparse_cache->verify_queue_.empty() && !sparse_cache->verify_stop_)
+      pthread_cond_wait(&sparse_cache->cond_verify_, &sparse_cache->lock_);
+    if (sparse_cache->verify_stop_)
+      break;
+    Object *object = sparse_cache->verify_queue_.front();
+    sparse_cache->verify_queue_.pop_front();
+    pthread_mutex_unlock(&sparse_cache->lock_);
+    sparse_cache->Verify(object);
+    pthread_mutex_lock(&sparse_cache->lock_);
+    sparse_cache->Unref(object);
+  }
+  pthread_mutex_unlock(&sparse_cache->lock_);
+
+  LogCvmfs(kLogCache, kLogDebug, "stopping sparse cache verification thread");
+  return NULL;
+}
+
+
+/**
+ * Drops the references of the objects that are still queued.
+ */
+void SparseCache::StopVerify() {
+  {
+    MutexLockGuard m(&lock_);
+    if (!verify_running_)
+      return;
+    verify_stop_ = true;
+    pthread_cond_signal(&cond_verify_);
+  }
+  pthread_join(thread_verify_, NULL);
+
+  MutexLockGuard m(&lock_);
+  verify_running_ = false;
+  while (!verify_queue_.empty()) {
+    verify_queue_.front()->refcount--;
+    verify_queue_.pop_front();
+  }
+}
+
+
+int64_t SparseCache::Open(
+  const shash::Any &id,
+  const uint64_t size,
+  const string &name,
+  const bool external,
+  const CacheManager::ObjectType type)
+{
+  MutexLockGuard m(&lock_);
+  Object *object = NULL;
+  map<shash::Any, Object *>::const_iterator iter = objects_.find(id);
+  if (iter != objects_.end()) {
+    object = iter->second;
+    bool failed;
+    {
+      MutexLockGuard m_object(&object->lock);
+      failed = object->failed;
+    }
+    if (failed) {
+      if (object->refcount > 0)
+        return -EIO;
+      DeleteObject(object);
+      object = NULL;
+    }
+  }
+
+  if (object == NULL) {
+    // The file is anonymous so that it disappears with the process
+    string template_path = path_ + "/sparseXXXXXX";
+    const int fd = mkstemp(&template_path[0]);
+    if (fd < 0)
+      return -errno;
+    unlink(template_path.c_str());
+
+    const unsigned num_blocks = (size + block_size_ - 1) / block_size_;
+    object = new Object(id, size, num_blocks);
+    object->fd = fd;
+    object->url = external ? name : ("/data/" + id.MakePath());
+    object->download_mgr = external ? external_download_mgr_ : download_mgr_;
+    object->description = name;
+    object->type = type;
+    object->external = external;
+    objects_[id] = object;
+    perf::Xadd(sz_saved_, size);
+    LogCvmfs(kLogCache, kLogDebug, "new sparse object %s (%" PRIu64 " bytes, "
+             "%u blocks)", id.ToString().c_str(), size, num_blocks);
+  }
+
+  object->refcount++;
+  object->last_used = ++clock_;
+  handles_[next_handle_] = object;
+  return next_handle_++;
+}
+
+
+int64_t SparseCache::Pread(
+  const uint64_t handle,
+  void *buf,
+  uint64_t size,
+  uint64_t offset)
+{
+  Object *object;
+  {
+    MutexLockGuard m(&lock_);
+    map<uint64_t, Object *>::const_iterator iter = handles_.find(handle);
+    if (iter == handles_.end())
+      return -EBADF;
+    object = iter->second;
+    object->last_used = ++clock_;
+  }
+
+  if (offset >= object->size)
+    return 0;
+  size = std::min(size, object->size - offset);
+  if (size == 0)
+    return 0;
+  const unsigned first_block = offset / block_size_;
+  const unsigned last_block = (offset + size - 1) / block_size_;
+  for (unsigned i = first_block; i <= last_block; ++i) {
+    int retval = FetchBlock(object, i);
+    if (retval < 0)
+      return retval;
+  }
+
+  int64_t result;
+  do {
+    errno = 0;
+    result = pread(object->fd, buf, size, offset);
+  } while ((result == -1) && (errno == EINTR));
+  if (result < 0)
+    return -errno;
+
+  // Verification of the complete object might have failed in the meantime
+  MutexLockGuard m(&object->lock);
+  if (object->failed)
+    return -EIO;
+  return result;
+}
+
+
+SparseCache::SparseCache(
+  const string &path,
+  const unsigned block_size,
+  const uint64_t limit,
+  CacheManager *cache_mgr,
+  download::DownloadManager *download_mgr,
+  download::DownloadManager *external_download_mgr,
+  perf::StatisticsTemplate statistics)
+  : path_(path)
+  , block_size_(block_size)
+  , limit_(limit)
+  , cache_mgr_(cache_mgr)
+  , download_mgr_(download_mgr)
+  , external_download_mgr_(external_download_mgr)
+  , next_handle_(0)
+  , clock_(0)
+  , used_(0)
+  , verify_stop_(false)
+  , verify_running_(false)
+{
+  int retval = pthread_mutex_init(&lock_, NULL);
+  assert(retval == 0);
+  retval = pthread_cond_init(&cond_verify_, NULL);
+  assert(retval == 0);
+  n_blocks_ = statistics.RegisterTemplated("n_blocks",
+    "overall number of downloaded blocks");
+  n_committed_ = statistics.RegisterTemplated("n_committed",
+    "number of verified objects committed to the cache");
+  n_verify_failed_ = statistics.RegisterTemplated("n_verify_failed",
+    "number of complete objects that did not match their content hash");
+  sz_downloaded_ = statistics.RegisterTemplated("sz_downloaded",
+    "overall number of downloaded bytes");
+  sz_saved_ = statistics.RegisterTemplated("sz_saved",
+    "number of bytes not downloaded compared to fetching the whole objects");
+
+  retval = pthread_create(&thread_verify_, NULL, MainVerify, this);
+  assert(retval == 0);
+  verify_running_ = true;
+}
+
+
+SparseCache::~SparseCache() {
+  StopVerify();
+  for (map<shash::Any, Object *>::iterator i = objects_.begin(),
+       iEnd = objects_.end(); i != iEnd; ++i)
+  {
+    close(i->second->fd);
+    delete i->second;
+  }
+  pthread_cond_destroy(&cond_verify_);
+  pthread_mutex_destroy(&lock_);
+}
+
+
+void SparseCache::FreeState(SavedState *state) {
+  for (unsigned i = 0; i < state->objects.size(); ++i) {
+    if (state->objects[i].fd >= 0)
+      close(state->objects[i].fd);
+  }
+  delete state;
+}
+
+
+void SparseCache::RestoreState(SavedState *state) {
+  MutexLockGuard m(&lock_);
+  vector<Object *> restored(state->objects.size(), NULL);
+  for (unsigned i = 0; i < state->objects.size(); ++i) {
+    SavedObject *saved = &state->objects[i];
+    if (objects_.count(saved->id) > 0) {
+      // Cannot happen unless objects are opened before the restore
+      continue;
+    }
+    const unsigned num_blocks = (saved->size + block_size_ - 1) / block_size_;
+    Object *object = new Object(saved->id, saved->size, num_blocks);
+    object->fd = saved->fd;
+    saved->fd = -1;
+    object->url = saved->url;
+    object->description = saved->description;
+    object->type = saved->type;
+    object->external = saved->external;
+    object->download_mgr =
+      saved->external ? external_download_mgr_ : download_mgr_;
+    object->failed = saved->failed;
+    if (state->block_size == block_size_) {
+      object->present = saved->present;
+      object->num_present =
+        std::count(object->present.begin(), object->present.end(), true);
+      object->verified = saved->verified;
+    } else {
+      // The blocks do not match the configured block size anymore
+      if (ftruncate(object->fd, 0) != 0) {
+        LogCvmfs(kLogCache, kLogDebug, "failed to truncate sparse object %s "
+                 "(%d)", saved->id.ToString().c_str(), errno);
+      }
+    }
+    object->last_used = ++clock_;
+    used_ += GetStoredBytes(object);
+    objects_[object->id] = object;
+    restored[i] = object;
+  }
+
+  for (unsigned i = 0; i < state->handles.size(); ++i) {
+    Object *object = restored[state->handles[i].second];
+    if (object == NULL)
+      continue;
+    object->refcount++;
+    handles_[state->handles[i].first] = object;
+  }
+  next_handle_ = std::max(next_handle_, state->next_handle);
+
+  // Objects that were complete but not yet verified before the reload
+  for (unsigned i = 0; i < restored.size(); ++i) {
+    Object *object = restored[i];
+    if ((object == NULL) || object->verified || object->failed ||
+        (object->num_present < object->present.size()))
+    {
+      continue;
+    }
+    object->refcount++;
+    verify_queue_.push_back(object);
+  }
+  pthread_cond_signal(&cond_verify_);
+  LogCvmfs(kLogCache, kLogDebug, "restored %u sparse objects, %u handles",
+           static_cast<unsigned>(objects_.size()),
+           static_cast<unsigned>(handles_.size()));
+}
+
+
+SparseCache::SavedState *SparseCache::SaveState() {
+  StopVerify();
+
+  MutexLockGuard m(&lock_);
+  SavedState *state = new SavedState();
+  state->block_size = block_size_;
+  state->next_handle = next_handle_;
+  map<Object *, unsigned> indexes;
+  for (map<shash::Any, Object *>::iterator i = objects_.begin(),
+       iEnd = objects_.end(); i != iEnd; ++i)
+  {
+    Object *object = i->second;
+    SavedObject saved;
+    saved.id = object->id;
+    saved.size = object->size;
+    saved.fd = object->fd;
+    saved.present = object->present;
+    saved.url = object->url;
+    saved.description = object->description;
+    saved.type = object->type;
+    saved.external = object->external;
+    saved.verified = object->verified;
+    saved.failed = object->failed;
+    indexes[object] = state->objects.size();
+    state->objects.push_back(saved);
+    delete object;
+  }
+  for (map<uint64_t, Object *>::const_iterator i = handles_.begin(),
+       iEnd = handles_.end(); i != iEnd; ++i)
+  {
+    state->handles.push_back(make_pair(i->first, indexes[i->second]));
+  }
+  objects_.clear();
+  handles_.clear();
+  used_ = 0;
+  return state;
+}
+
+
+/**
+ * Called with lock_ held.  Drops a reference.  Unreferenced objects are
+ * deleted if they failed verification or if they are committed to the cache
+ * manager.
+ */
+void SparseCache::Unref(Object *object) {
+  assert(object->refcount > 0);
+  if (--object->refcount > 0)
+    return;
+
+  bool drop;
+  {
+    MutexLockGuard m_object(&object->lock);
+    drop = object->failed || object->committed;
+  }
+  if (drop)
+    DeleteObject(object);
+  else if (used_ > limit_)
+    Evict();
+}
+
+
+/**
+ * Once all the blocks of an object are present, it can be checked against its
+ * content hash.  The object is committed to the cache manager in the same
+ * pass.  Runs in the verification thread and only for referenced objects.
+ */
+void SparseCache::Verify(Object *object) {
+  shash::Any digest(object->id.algorithm, object->id.suffix);
+  shash::ContextPtr hash_context(object->id.algorithm);
+  hash_context.buffer = alloca(hash_context.size);
+  shash::Init(hash_context);
+
+  void *txn = NULL;
+  if (cache_mgr_ != NULL) {
+    txn = alloca(cache_mgr_->SizeOfTxn());
+    if (cache_mgr_->StartTxn(object->id, object->size, txn) < 0) {
+      txn = NULL;
+    } else {
+      cache_mgr_->CtrlTxn(
+        CacheManager::ObjectInfo(object->type, object->description), 0, txn);
+    }
+  }
+
+  const unsigned kBufferSize = 64 * 1024;
+  unsigned char *buffer = static_cast<unsigned char *>(smalloc(kBufferSize));
+  bool ok = true;
+  uint64_t offset = 0;
+  while (offset < object->size) {
+    const ssize_t nbytes = pread(object->fd, buffer, kBufferSize, offset);
+    if (nbytes < 0) {
+      if (errno == EINTR)
+        continue;
+      ok = false;
+      break;
+    }
+    if (nbytes == 0) {
+      ok = false;
+      break;
+    }
+    shash::Update(buffer, nbytes, hash_context);
+    if ((txn != NULL) && (cache_mgr_->Write(buffer, nbytes, txn) != nbytes)) {
+      cache_mgr_->AbortTxn(txn);
+      txn = NULL;
+    }
+    offset += nbytes;
+  }
+  free(buffer);
+  shash::Final(hash_context, &digest);
+  ok = ok && (digest == object->id);
+
+  if (ok) {
+    bool committed = false;
+    if (txn != NULL) {
+      committed = (cache_mgr_->CommitTxn(txn) == 0);
+      if (committed)
+        perf::Inc(n_committed_);
+    }
+    LogCvmfs(kLogCache, kLogDebug, "verified sparse object %s (committed: %s)",
+             object->id.ToString().c_str(), committed ? "yes" : "no");
+    MutexLockGuard m(&object->lock);
+    object->verified = true;
+    object->committed = committed;
+    return;
+  }
+
+  if (txn != NULL)
+    cache_mgr_->AbortTxn(txn);
+  LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+           "sparse object %s does not match its content hash (%s)",
+           object->url.c_str(), object->id.ToString().c_str());
+  perf::Inc(n_verify_failed_);
+  MutexLockGuard m(&object->lock);
+  object->failed = true;
+  pthread_cond_broadcast(&object->cond_block);
+}
@@ -0,0 +1,236 @@
+/**
+ * This file is part of the CernVM File System.
+ *
+ * Keeps parts of large, uncompressed objects (including external data) that
+ * are read sparsely.  Instead of downloading the entire object on open, reads
+ * fetch the missing, aligned blocks with HTTP range requests.  Blocks are
+ * stored in an anonymous, sparse file per object.  Objects are verified
+ * against their content hash once all their blocks are present; there are no
+ * hashes for individual blocks.  Verified objects are committed to the cache
+ * manager, so that later opens find them there.
+ */
+
+#ifndef CVMFS_CACHE_SPARSE_H_
+#define CVMFS_CACHE_SPARSE_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cache.h"
+#include "compression.h"
+#include "crypto/hash.h"
+#include "gtest/gtest_prod.h"
+#include "statistics.h"
+#include "util/single_copy.h"
+
+namespace download {
+class DownloadManager;
+}
+
+class SparseCache : SingleCopy {
+  FRIEND_TEST(T_SparseCache, Evict);
+  FRIEND_TEST(T_SparseCache, SaveRestore);
+
+ public:
+  static const unsigned kDefaultBlockSize;  // 1M
+  /**
+   * Smaller objects are fetched as a whole
+   */
+  static const unsigned kMinBlocks = 8;
+
+  /**
+   * The open handles and the stored blocks survive a reload.  The sparse
+   * files are anonymous, their file descriptors are handed over to the new
+   * instance.
+   */
+  struct SavedObject {
+    SavedObject()
+      : size(0), fd(-1), type(CacheManager::kTypeRegular), external(false)
+      , verified(false), failed(false) { }
+    shash::Any id;
+    uint64_t size;
+    int fd;
+    std::vector<bool> present;
+    std::string url;
+    std::string description;
+    CacheManager::ObjectType type;
+    bool external;
+    bool verified;
+    bool failed;
+  };
+  struct SavedState {
+    SavedState() : version(0), block_size(0), next_handle(0) { }
+    unsigned version;
+    unsigned block_size;
+    std::vector<SavedObject> objects;
+    /**
+     * Handle --> index in objects
+     */
+    std::vector<std::pair<uint64_t, unsigned> > handles;
+    uint64_t next_handle;
+  };
+
+  /**
+   * Verified objects are committed to cache_mgr, which can be NULL.
+   */
+  static SparseCache *Create(const std::string &path,
+                             const unsigned block_size,
+                             const uint64_t limit,
+                             CacheManager *cache_mgr,
+                             download::DownloadManager *download_mgr,
+                             download::DownloadManager *external_download_mgr,
+                             perf::StatisticsTemplate statistics);
+  ~SparseCache();
+
+  bool IsEligible(const uint64_t size,
+                  const zlib::Algorithms compression_algorithm) const
+  {
+    return (compression_algorithm == zlib::kNoCompression) &&
+           (size >= static_cast<uint64_t>(kMinBlocks) * block_size_);
+  }
+
+  /**
+   * Returns a handle to the object or -errno.  For external objects, name is
+   * the URL path, like for the external fetcher.
+   */
+  int64_t Open(const shash::Any &id,
+               const uint64_t size,
+               const std::string &name,
+               const bool external,
+               const CacheManager::ObjectType type =
+                 CacheManager::kTypeRegular);
+  int64_t Pread(const uint64_t handle, void *buf, uint64_t size,
+                uint64_t offset);
+  int Close(const uint64_t handle);
+
+  /**
+   * Moves all the objects and handles into the returned state.  The cache is
+   * empty afterwards.
+   */
+  SavedState *SaveState();
+  /**
+   * Takes over the objects and handles of the saved state.  The file
+   * descriptors then belong to this instance.
+   */
+  void RestoreState(SavedState *state);
+  /**
+   * Closes the file descriptors that were not taken over.
+   */
+  static void FreeState(SavedState *state);
+
+  unsigned block_size() const { return block_size_; }
+  uint64_t used() const { return used_; }
+
+ private:
+  struct Object {
+    Object(const shash::Any &i, const uint64_t s, const unsigned num_blocks)
+      : id(i), size(s), fd(-1), refcount(0), last_used(0)
+      , type(CacheManager::kTypeRegular), external(false)
+      , present(num_blocks, false), inflight(num_blocks, false)
+      , num_present(0), download_mgr(NULL), verified(false), failed(false)
+      , committed(false)
+    {
+      pthread_mutex_init(&lock, NULL);
+      pthread_cond_init(&cond_block, NULL);
+    }
+    ~Object() {
+      pthread_cond_destroy(&cond_block);
+      pthread_mutex_destroy(&lock);
+    }
+
+    shash::Any id;
+    uint64_t size;
+    int fd;
+    /**
+     * Protected by SparseCache::lock_
+     */
+    unsigned refcount;
+    uint64_t last_used;
+    std::string description;
+    CacheManager::ObjectType type;
+    bool external;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond_block;
+    std::vector<bool> present;
+    std::vector<bool> inflight;
+    unsigned num_present;
+    std::string url;
+    download::DownloadManager *download_mgr;
+    /**
+     * Set once the complete object matches its content hash
+     */
+    bool verified;
+    /**
+     * Set if the complete object does not match its content hash
+     */
+    bool failed;
+    /**
+     * Set once the verified object is in the cache manager.  The sparse file
+     * is then dropped when the object is closed.
+     */
+    bool committed;
+  };
+
+  SparseCache(const std::string &path,
+              const unsigned block_size,
+              const uint64_t limit,
+              CacheManager *cache_mgr,
+              download::DownloadManager *download_mgr,
+              download::DownloadManager *external_download_mgr,
+              perf::StatisticsTemplate statistics);
+  static void *MainVerify(void *data);
+  void StopVerify();
+  int FetchBlock(Object *object, const unsigned block);
+  void Verify(Object *object);
+  void Unref(Object *object);
+  void Evict();
+  uint64_t GetStoredBytes(const Object *object) const;
+  void DeleteObject(Object *object);
+
+  std::string path_;
+  unsigned block_size_;
+  /**
+   * Soft limit for the bytes stored in all the objects.  Objects that are not
+   * open are evicted in LRU order when it is exceeded.
+   */
+  uint64_t limit_;
+  CacheManager *cache_mgr_;
+  download::DownloadManager *download_mgr_;
+  download::DownloadManager *external_download_mgr_;
+
+  pthread_mutex_t lock_;
+  std::map<shash::Any, Object *> objects_;
+  std::map<uint64_t, Object *> handles_;
+  /**
+   * Handles are never reused, also not across reloads (see SaveState)
+   */
+  uint64_t next_handle_;
+  uint64_t clock_;
+  uint64_t used_;
+
+  /**
+   * Complete objects are verified and committed in a separate thread, so
+   * that the read that completes an object does not hash the entire object.
+   * Queued objects are referenced.  Protected by lock_.
+   */
+  pthread_t thread_verify_;
+  pthread_cond_t cond_verify_;
+  std::deque<Object *> verify_queue_;
+  bool verify_stop_;
+  bool verify_running_;
+
+  perf::Counter *n_blocks_;
+  perf::Counter *n_committed_;
+  perf::Counter *n_verify_failed_;
+  perf::Counter *sz_downloaded_;
+  perf::Counter *sz_saved_;
+};
+
+#endif  // CVMFS_CACHE_SPARSE_H_
@@ -49,6 +49,7 @@ class TieredCacheManager : public CacheManager {
   { return upper_->Pread(fd, buf, size, offset); }
   virtual int Dup(int fd) { return upper_->Dup(fd); }
   virtual int Readahead(int fd) { return upper_->Readahead(fd); }
+  virtual int GetBackingFd(int fd) { return upper_->GetBackingFd(fd); }
 
   virtual uint32_t SizeOfTxn()
   { return upper_->SizeOfTxn() + lower_->SizeOfTxn(); }
@@ -6,10 +6,13 @@
 
 #include <alloca.h>
 #include <errno.h>
+#include <inttypes.h>
 
 #include <algorithm>
 #include <cassert>
+#include <cstring>
 
+#include "catalog_index.h"
 #include "catalog_mgr.h"
 #include "util/concurrency.h"
 #include "util/logging.h"
@@ -23,6 +26,18 @@ namespace catalog {
 const shash::Md5 Catalog::kMd5PathEmpty("", 0);
 
 
+/**
+ * A read-only connection to the catalog database with its own prepared
+ * statements for path lookups and listings.
+ */
+struct Catalog::Reader {
+  CatalogDatabase *database;
+  SqlLookupPathHash *sql_lookup_md5path;
+  SqlLookupPathHashes *sql_lookup_md5paths;
+  SqlListing *sql_listing;
+};
+
+
 /**
  * Open a catalog outside the framework of a catalog manager.
  */
@@ -59,29 +74,65 @@ Catalog::Catalog(const PathString &mountpoint,
   parent_(parent),
   nested_catalog_cache_dirty_(true),
   voms_authz_status_(kVomsUnknown),
-  initialized_(false)
+  initialized_(false),
+  has_directory_digests_(false)
 {
   max_row_id_ = 0;
   inode_annotation_ = NULL;
   lock_ = reinterpret_cast<pthread_mutex_t *>(smalloc(sizeof(pthread_mutex_t)));
   int retval = pthread_mutex_init(lock_, NULL);
   assert(retval == 0);
+  lock_readers_ =
+    reinterpret_cast<pthread_mutex_t *>(smalloc(sizeof(pthread_mutex_t)));
+  retval = pthread_mutex_init(lock_readers_, NULL);
+  assert(retval == 0);
+  num_readers_ = 0;
+  lock_hardlink_groups_ =
+    reinterpret_cast<pthread_mutex_t *>(smalloc(sizeof(pthread_mutex_t)));
+  retval = pthread_mutex_init(lock_hardlink_groups_, NULL);
+  assert(retval == 0);
 
   database_ = NULL;
   uid_map_ = NULL;
   gid_map_ = NULL;
+  path_index_ = NULL;
+  atomic_init32(&path_index_ready_);
+  path_index_size_ = 0;
+  path_index_budget_ = NULL;
+  num_sql_queries_ = 0;
+  path_index_failed_ = false;
+  path_filter_ = NULL;
+  path_filter_counters_ = NULL;
   sql_listing_ = NULL;
   sql_lookup_md5path_ = NULL;
+  sql_lookup_md5paths_ = NULL;
   sql_lookup_nested_ = NULL;
   sql_list_nested_ = NULL;
   sql_own_list_nested_ = NULL;
   sql_all_chunks_ = NULL;
   sql_chunks_listing_ = NULL;
   sql_lookup_xattrs_ = NULL;
+  sql_lookup_digest_ = NULL;
 }
 
 
 Catalog::~Catalog() {
+  if (path_index_ != NULL) {
+    path_index_budget_->Release(path_index_size_);
+    delete path_index_;
+  }
+  delete path_filter_;
+  for (unsigned i = 0; i < idle_readers_.size(); ++i) {
+    delete idle_readers_[i]->sql_lookup_md5path;
+    delete idle_readers_[i]->sql_lookup_md5paths;
+    delete idle_readers_[i]->sql_listing;
+    delete idle_readers_[i]->database;
+    delete idle_readers_[i];
+  }
+  pthread_mutex_destroy(lock_hardlink_groups_);
+  free(lock_hardlink_groups_);
+  pthread_mutex_destroy(lock_readers_);
+  free(lock_readers_);
   pthread_mutex_destroy(lock_);
   free(lock_);
   FinalizePreparedStatements();
@@ -98,21 +149,29 @@ Catalog::~Catalog() {
 void Catalog::InitPreparedStatements() {
   sql_listing_          = new SqlListing(database());
   sql_lookup_md5path_   = new SqlLookupPathHash(database());
+  sql_lookup_md5paths_  = new SqlLookupPathHashes(database());
   sql_lookup_nested_    = new SqlNestedCatalogLookup(database());
   sql_list_nested_      = new SqlNestedCatalogListing(database());
   sql_own_list_nested_  = new SqlOwnNestedCatalogListing(database());
   sql_all_chunks_       = new SqlAllChunks(database());
   sql_chunks_listing_   = new SqlChunksListing(database());
   sql_lookup_xattrs_    = new SqlLookupXattrs(database());
+  if (database().IsEqualSchema(database().schema_version(), 2.5) &&
+      (database().schema_revision() >= 7))
+  {
+    sql_lookup_digest_  = new SqlDirectoryDigestLookup(database());
+  }
 }
 
 
 void Catalog::FinalizePreparedStatements() {
+  delete sql_lookup_digest_;
   delete sql_lookup_xattrs_;
   delete sql_chunks_listing_;
   delete sql_all_chunks_;
   delete sql_listing_;
   delete sql_lookup_md5path_;
+  delete sql_lookup_md5paths_;
   delete sql_lookup_nested_;
   delete sql_list_nested_;
   delete sql_own_list_nested_;
@@ -162,6 +221,14 @@ bool Catalog::ReadCatalogCounters() {
  * @return true on successful initialization otherwise false
  */
 bool Catalog::OpenDatabase(const string &db_path) {
+  if (!OpenDatabaseUnlinked(db_path))
+    return false;
+  LinkToParent();
+  return true;
+}
+
+
+bool Catalog::OpenDatabaseUnlinked(const string &db_path) {
   database_ = CatalogDatabase::Open(db_path, DatabaseOpenMode());
   if (NULL == database_) {
     return false;
@@ -217,6 +284,12 @@ bool Catalog::OpenDatabase(const string &db_path) {
   volatile_flag_ = database_->GetPropertyDefault<bool>("volatile",
                                                        volatile_flag_);
 
+  // Directory digests are only valid if they were updated by the last writer
+  has_directory_digests_ = (sql_lookup_digest_ != NULL) &&
+    database_->HasProperty("directory_digests_revision") &&
+    (database_->GetProperty<uint64_t>("directory_digests_revision") ==
+     GetRevision());
+
   // Read Catalog Counter Statistics
   if (!ReadCatalogCounters()) {
     LogCvmfs(kLogCatalog, kLogStderr,
@@ -225,12 +298,15 @@ bool Catalog::OpenDatabase(const string &db_path) {
     return false;
   }
 
+  initialized_ = true;
+  return true;
+}
+
+
+void Catalog::LinkToParent() {
   if (HasParent()) {
     parent_->AddChild(this);
   }
-
-  initialized_ = true;
-  return true;
 }
 
 
@@ -305,15 +381,37 @@ bool Catalog::LookupEntry(const shash::Md5 &md5path, const bool expand_symlink,
 {
   assert(IsInitialized());
 
-  MutexLockGuard m(lock_);
-  sql_lookup_md5path_->BindPathHash(md5path);
-  bool found = sql_lookup_md5path_->FetchRow();
+  if (path_filter_ != NULL) {
+    if (!path_filter_->MayContain(md5path)) {
+      perf::Inc(path_filter_counters_->n_rejects);
+      return false;
+    }
+  }
+
+  Reader *reader = LockStatements();
+  if (UsePathIndex(reader)) {
+    const bool found = path_index_->Lookup(md5path, dirent);
+    if (found && (dirent != NULL))
+      FixIndexedEntry(md5path, dirent);
+    UnlockStatements(reader);
+    if (!found && (path_filter_ != NULL))
+      perf::Inc(path_filter_counters_->n_false_positives);
+    return found;
+  }
+
+  SqlLookupPathHash *sql_lookup_md5path =
+    (reader == NULL) ? sql_lookup_md5path_ : reader->sql_lookup_md5path;
+  sql_lookup_md5path->BindPathHash(md5path);
+  bool found = sql_lookup_md5path->FetchRow();
   if (found && (dirent != NULL)) {
-    *dirent = sql_lookup_md5path_->GetDirent(this, expand_symlink);
+    *dirent = sql_lookup_md5path->GetDirent(this, expand_symlink);
     FixTransitionPoint(md5path, dirent);
   }
-  sql_lookup_md5path_->Reset();
+  sql_lookup_md5path->Reset();
+  UnlockStatements(reader);
 
+  if (!found && (path_filter_ != NULL))
+    perf::Inc(path_filter_counters_->n_false_positives);
   return found;
 }
 
@@ -331,6 +429,84 @@ bool Catalog::LookupMd5Path(const shash::Md5 &md5path,
 }
 
 
+/**
+ * Like LookupEntry() for many paths.  The SQL statement fetches the rows of up
+ * to SqlLookupPathHashes::kMaxPaths paths at once.
+ */
+void Catalog::LookupEntries(const std::vector<shash::Md5> &md5paths,
+                            std::vector<DirectoryEntry> *dirents) const
+{
+  assert(IsInitialized());
+  dirents->assign(md5paths.size(), DirectoryEntry(kDirentNegative));
+
+  vector<unsigned> candidates;
+  for (unsigned i = 0; i < md5paths.size(); ++i) {
+    if ((path_filter_ != NULL) && !path_filter_->MayContain(md5paths[i])) {
+      perf::Inc(path_filter_counters_->n_rejects);
+      continue;
+    }
+    candidates.push_back(i);
+  }
+  if (candidates.empty())
+    return;
+
+  Reader *reader = LockStatements();
+  if (UsePathIndex(reader)) {
+    for (unsigned i = 0; i < candidates.size(); ++i) {
+      const unsigned idx = candidates[i];
+      DirectoryEntry dirent;
+      if (path_index_->Lookup(md5paths[idx], &dirent)) {
+        FixIndexedEntry(md5paths[idx], &dirent);
+        (*dirents)[idx] = dirent;
+      }
+    }
+  } else {
+    SqlLookupPathHashes *sql_lookup_md5paths =
+      (reader == NULL) ? sql_lookup_md5paths_ : reader->sql_lookup_md5paths;
+    const unsigned num_candidates = candidates.size();
+    const unsigned batch_size = SqlLookupPathHashes::kMaxPaths;
+    for (unsigned begin = 0; begin < num_candidates; begin += batch_size) {
+      const unsigned end = std::min(begin + batch_size, num_candidates);
+      for (unsigned slot = 0; slot < batch_size; ++slot) {
+        const unsigned i = std::min(begin + slot, end - 1);
+        sql_lookup_md5paths->BindPathHash(slot, md5paths[candidates[i]]);
+      }
+      while (sql_lookup_md5paths->FetchRow()) {
+        // Rows match only the first half of the path hash
+        const shash::Md5 md5path = sql_lookup_md5paths->GetPathHash();
+        for (unsigned i = begin; i < end; ++i) {
+          if (md5paths[candidates[i]] != md5path)
+            continue;
+          DirectoryEntry *dirent = &(*dirents)[candidates[i]];
+          *dirent = sql_lookup_md5paths->GetDirent(this);
+          FixTransitionPoint(md5path, dirent);
+        }
+      }
+      sql_lookup_md5paths->Reset();
+    }
+  }
+  UnlockStatements(reader);
+
+  if (path_filter_ != NULL) {
+    for (unsigned i = 0; i < candidates.size(); ++i) {
+      if ((*dirents)[candidates[i]].IsNegative())
+        perf::Inc(path_filter_counters_->n_false_positives);
+    }
+  }
+}
+
+
+void Catalog::LookupPaths(const std::vector<PathString> &paths,
+                          std::vector<DirectoryEntry> *dirents) const
+{
+  vector<shash::Md5> md5paths;
+  md5paths.reserve(paths.size());
+  for (unsigned i = 0; i < paths.size(); ++i)
+    md5paths.push_back(NormalizePath(paths[i]));
+  LookupEntries(md5paths, dirents);
+}
+
+
 bool Catalog::LookupRawSymlink(const PathString &path,
                                LinkString *raw_symlink) const
 {
@@ -360,6 +536,25 @@ bool Catalog::LookupXattrsMd5Path(
 }
 
 
+bool Catalog::LookupDirectoryDigestMd5(
+  const shash::Md5 &md5path,
+  shash::Any *digest) const
+{
+  assert(IsInitialized());
+  if (sql_lookup_digest_ == NULL)
+    return false;
+
+  MutexLockGuard m(lock_);
+  sql_lookup_digest_->BindPathHash(md5path);
+  bool found = sql_lookup_digest_->FetchRow();
+  if (found)
+    *digest = sql_lookup_digest_->GetDigest();
+  sql_lookup_digest_->Reset();
+
+  return found && !digest->IsNull();
+}
+
+
 /**
  * Perform a listing of the directory with the given MD5 path hash.
  * @param path_hash the MD5 hash of the path of the directory to list
@@ -374,10 +569,28 @@ bool Catalog::ListingMd5PathStat(const shash::Md5 &md5path,
   DirectoryEntry dirent;
   StatEntry entry;
 
-  MutexLockGuard m(lock_);
-  sql_listing_->BindPathHash(md5path);
-  while (sql_listing_->FetchRow()) {
-    dirent = sql_listing_->GetDirent(this);
+  Reader *reader = LockStatements();
+  if (UsePathIndex(reader)) {
+    uint32_t first, count;
+    path_index_->Listing(md5path, &first, &count);
+    for (uint32_t i = first; i < first + count; ++i) {
+      if (path_index_->GetEntry(i).IsHidden())
+        continue;
+      dirent = path_index_->GetEntry(i);
+      FixIndexedEntry(md5path, &dirent);
+      entry.name = dirent.name();
+      entry.info = dirent.GetStatStructure();
+      listing->PushBack(entry);
+    }
+    UnlockStatements(reader);
+    return true;
+  }
+
+  SqlListing *sql_listing =
+    (reader == NULL) ? sql_listing_ : reader->sql_listing;
+  sql_listing->BindPathHash(md5path);
+  while (sql_listing->FetchRow()) {
+    dirent = sql_listing->GetDirent(this);
     if (dirent.IsHidden())
       continue;
     FixTransitionPoint(md5path, &dirent);
@@ -385,7 +598,8 @@ bool Catalog::ListingMd5PathStat(const shash::Md5 &md5path,
     entry.info = dirent.GetStatStructure();
     listing->PushBack(entry);
   }
-  sql_listing_->Reset();
+  sql_listing->Reset();
+  UnlockStatements(reader);
 
   return true;
 }
@@ -405,15 +619,29 @@ bool Catalog::ListingMd5Path(const shash::Md5 &md5path,
 {
   assert(IsInitialized());
 
-  MutexLockGuard m(lock_);
+  Reader *reader = LockStatements();
+  if (UsePathIndex(reader)) {
+    uint32_t first, count;
+    path_index_->Listing(md5path, &first, &count);
+    for (uint32_t i = first; i < first + count; ++i) {
+      DirectoryEntry dirent = path_index_->GetEntry(i);
+      FixIndexedEntry(md5path, &dirent);
+      listing->push_back(dirent);
+    }
+    UnlockStatements(reader);
+    return true;
+  }
 
-  sql_listing_->BindPathHash(md5path);
-  while (sql_listing_->FetchRow()) {
-    DirectoryEntry dirent = sql_listing_->GetDirent(this, expand_symlink);
+  SqlListing *sql_listing =
+    (reader == NULL) ? sql_listing_ : reader->sql_listing;
+  sql_listing->BindPathHash(md5path);
+  while (sql_listing->FetchRow()) {
+    DirectoryEntry dirent = sql_listing->GetDirent(this, expand_symlink);
     FixTransitionPoint(md5path, &dirent);
     listing->push_back(dirent);
   }
-  sql_listing_->Reset();
+  sql_listing->Reset();
+  UnlockStatements(reader);
 
   return true;
 }
@@ -603,6 +831,7 @@ inode_t Catalog::GetMangledInode(const uint64_t row_id,
   // Hardlinks are encoded in catalog-wide unique hard link group ids.
   // These ids must be resolved to actual inode relationships at runtime.
   if (hardlink_group > 0) {
+    MutexLockGuard m(lock_hardlink_groups_);
     HardlinkGroupMap::const_iterator inode_iter =
       hardlink_groups_.find(hardlink_group);
 
@@ -622,6 +851,240 @@ inode_t Catalog::GetMangledInode(const uint64_t row_id,
 }
 
 
+/**
+ * Takes lock_ and returns NULL or, if lock_ is busy, returns a reader.  Only
+ * path lookups and listings can use readers.
+ */
+Catalog::Reader *Catalog::LockStatements() const {
+  if (pthread_mutex_trylock(lock_) == 0)
+    return NULL;
+  Reader *reader = AcquireReader();
+  if (reader == NULL)
+    pthread_mutex_lock(lock_);
+  return reader;
+}
+
+
+void Catalog::UnlockStatements(Reader *reader) const {
+  if (reader == NULL)
+    pthread_mutex_unlock(lock_);
+  else
+    ReleaseReader(reader);
+}
+
+
+/**
+ * Returns an idle reader.  New readers are opened on demand up to kMaxReaders,
+ * so that only catalogs with concurrent lookups keep additional connections.
+ * Returns NULL if all the readers are busy.  Writable catalogs have no
+ * readers because other connections do not see the open transaction.
+ */
+Catalog::Reader *Catalog::AcquireReader() const {
+  if (IsWritable())
+    return NULL;
+
+  {
+    MutexLockGuard m(lock_readers_);
+    if (!idle_readers_.empty()) {
+      Reader *reader = idle_readers_.back();
+      idle_readers_.pop_back();
+      return reader;
+    }
+    if (num_readers_ >= kMaxReaders)
+      return NULL;
+    num_readers_++;
+  }
+
+  // If opening fails, the slot stays taken so that the catalog file is not
+  // reopened on every lookup
+  return CreateReader();
+}
+
+
+void Catalog::ReleaseReader(Reader *reader) const {
+  MutexLockGuard m(lock_readers_);
+  idle_readers_.push_back(reader);
+}
+
+
+/**
+ * Catalogs of the client are opened on a cache manager file descriptor
+ * ("@<fd>") that belongs to the catalog's connection.  The reader asks the
+ * VFS for a duplicate of that descriptor ("@@<fd>"), which it owns and closes
+ * on its own.
+ */
+Catalog::Reader *Catalog::CreateReader() const {
+  string filename = database_->filename();
+  if (filename[0] == '@')
+    filename = "@" + filename;
+  CatalogDatabase *db = CatalogDatabase::Open(filename,
+                                              CatalogDatabase::kOpenReadOnly);
+  if (db == NULL) {
+    LogCvmfs(kLogCatalog, kLogDebug, "failed to open reader for %s",
+             mountpoint_.c_str());
+    return NULL;
+  }
+  db->EnforceSchema(database_->schema_version(), database_->schema_revision());
+
+  Reader *reader = new Reader();
+  reader->database = db;
+  reader->sql_lookup_md5path = new SqlLookupPathHash(*db);
+  reader->sql_lookup_md5paths = new SqlLookupPathHashes(*db);
+  reader->sql_listing = new SqlListing(*db);
+  LogCvmfs(kLogCatalog, kLogDebug, "opened reader for %s", mountpoint_.c_str());
+  return reader;
+}
+
+
+/**
+ * Enables the in-memory path index for a catalog that is managed by a catalog
+ * manager.  Writable catalogs change and are never indexed.
+ */
+void Catalog::SetPathIndexBudget(PathIndexBudget *budget) {
+  if (IsWritable())
+    return;
+  MutexLockGuard m(lock_);
+  assert(path_index_ == NULL);
+  path_index_budget_ = budget;
+}
+
+
+/**
+ * Builds the path filter from the path hashes of all the entries.  Needs to be
+ * called before the catalog is used by concurrent lookups.  The filter is not
+ * charged to the path index budget, it takes about kBitsPerEntry bits per
+ * entry.  Writable catalogs change and never get a filter.
+ */
+void Catalog::EnablePathFilter(const PathFilterCounters *counters) {
+  if (IsWritable())
+    return;
+  assert(path_filter_ == NULL);
+
+  // The row ids are an upper bound for the number of entries, they are known
+  // also for catalogs without statistics counters
+  PathFilter *filter = new PathFilter(max_row_id_);
+  SqlAllPathHashes sql_all_paths(database());
+  while (sql_all_paths.FetchRow())
+    filter->Add(sql_all_paths.GetPathHash());
+  sql_all_paths.Reset();
+
+  path_filter_ = filter;
+  path_filter_counters_ = counters;
+  LogCvmfs(kLogCatalog, kLogDebug, "built path filter of %s: %" PRIu64
+           " bytes", mountpoint_.c_str(), filter->GetMemoryUsage());
+}
+
+
+/**
+ * Needs to be called with lock_ held or with a reader, as returned by
+ * LockStatements().  Returns true if the path index answers the following
+ * lookup or listing.  The index is built by the lookup that exceeds the
+ * budget's threshold of SQL queries.  If the index cannot be built, the
+ * catalog stays with SQL.  Once built, the index is immutable and readers use
+ * it without lock_.
+ */
+bool Catalog::UsePathIndex(const Reader *reader) const {
+  if (reader != NULL) {
+    // Readers do not hold lock_ and only use an index that is already built
+    if (atomic_read32(&path_index_ready_) == 0) {
+      if (path_index_budget_ != NULL)
+        perf::Inc(path_index_budget_->n_misses());
+      return false;
+    }
+    perf::Inc(path_index_budget_->n_hits());
+    return true;
+  }
+  if (path_index_ != NULL) {
+    perf::Inc(path_index_budget_->n_hits());
+    return true;
+  }
+  if ((path_index_budget_ == NULL) || path_index_failed_)
+    return false;
+
+  if (++num_sql_queries_ >= path_index_budget_->threshold()) {
+    path_index_ = BuildPathIndex();
+    if (path_index_ != NULL) {
+      atomic_write32(&path_index_ready_, 1);
+      perf::Inc(path_index_budget_->n_hits());
+      return true;
+    }
+  }
+  perf::Inc(path_index_budget_->n_misses());
+  return false;
+}
+
+
+/**
+ * Reads all the directory entries of the catalog into a new path index.
+ * Returns NULL if the index does not fit into the budget or if the catalog
+ * contains variant symlinks, which need to be expanded on every lookup.
+ */
+PathIndex *Catalog::BuildPathIndex() const {
+  path_index_failed_ = true;
+  const uint64_t estimate =
+    counters_.GetSelfEntries() * PathIndex::kBytesPerEntry;
+  if (!path_index_budget_->Reserve(estimate)) {
+    LogCvmfs(kLogCatalog, kLogDebug, "no space for the path index of %s",
+             mountpoint_.c_str());
+    return NULL;
+  }
+
+  // Building the index must not assign the inodes of hardlink groups.  The
+  // raw entries leave the hardlink group map alone, which concurrent readers
+  // keep using while the index is built.
+  PathIndex *index = new PathIndex();
+  bool has_variant_symlinks = false;
+  SqlAllDirents sql_all_dirents(database());
+  while (sql_all_dirents.FetchRow()) {
+    DirectoryEntry dirent = sql_all_dirents.GetRawDirent(this);
+    if (dirent.IsLink() && (memchr(dirent.symlink().GetChars(), '$',
+                                   dirent.symlink().GetLength()) != NULL))
+    {
+      has_variant_symlinks = true;
+      break;
+    }
+    index->Add(sql_all_dirents.GetPathHash(),
+               sql_all_dirents.GetParentPathHash(),
+               dirent);
+  }
+  sql_all_dirents.Reset();
+  path_index_budget_->Release(estimate);
+
+  if (has_variant_symlinks) {
+    LogCvmfs(kLogCatalog, kLogDebug, "not indexing %s (variant symlinks)",
+             mountpoint_.c_str());
+    delete index;
+    return NULL;
+  }
+  index->Finalize();
+  path_index_size_ = index->GetMemoryUsage();
+  if (!path_index_budget_->Reserve(path_index_size_)) {
+    LogCvmfs(kLogCatalog, kLogDebug, "no space for the path index of %s",
+             mountpoint_.c_str());
+    delete index;
+    return NULL;
+  }
+
+  perf::Inc(path_index_budget_->n_builds());
+  LogCvmfs(kLogCatalog, kLogDebug, "built path index of %s: %u entries, "
+           "%" PRIu64 " bytes", mountpoint_.c_str(), index->size(),
+           path_index_size_);
+  return index;
+}
+
+
+/**
+ * Entries in the path index carry the row id instead of the inode.
+ */
+void Catalog::FixIndexedEntry(const shash::Md5 &md5path,
+                              DirectoryEntry *dirent) const
+{
+  dirent->set_inode(GetMangledInode(dirent->inode(),
+                                    dirent->hardlink_group()));
+  FixTransitionPoint(md5path, dirent);
+}
+
+
 /**
  * Get a list of all registered nested catalogs and bind mountpoints in this
  * catalog.
@@ -22,6 +22,7 @@
 #include "shortstring.h"
 #include "sql.h"
 #include "uid_map.h"
+#include "util/atomic.h"
 #include "xattr.h"
 
 namespace swissknife {
@@ -36,6 +37,10 @@ class AbstractCatalogManager;
 class Catalog;
 
 class Counters;
+class PathFilter;
+class PathIndex;
+class PathIndexBudget;
+struct PathFilterCounters;
 
 typedef std::vector<Catalog *> CatalogList;
 typedef IntegerMap<uint64_t> OwnerMap;  // used to map uid/gid
@@ -91,7 +96,9 @@ class InodeAnnotation {
 class Catalog : SingleCopy {
   FRIEND_TEST(T_Catalog, NormalizePath);
   FRIEND_TEST(T_Catalog, PlantPath);
+  FRIEND_TEST(T_Catalog, ConcurrentLookupVfs);
   friend class swissknife::CommandMigrate;  // for catalog version migration
+  friend class RevisionDiff;  // for scanning the catalog tables
 
  public:
   typedef std::vector<shash::Any> HashVector;
@@ -120,14 +127,38 @@ class Catalog : SingleCopy {
                                const bool          is_nested = false);
 
   bool OpenDatabase(const std::string &db_path);
+  /**
+   * Like OpenDatabase() but does not yet add the catalog to the children of
+   * its parent.  That is done by LinkToParent(), so that the catalog manager
+   * can open the database without holding the lock on the catalog tree.
+   */
+  bool OpenDatabaseUnlinked(const std::string &db_path);
+  void LinkToParent();
 
   inline bool LookupPath(const PathString &path, DirectoryEntry *dirent) const {
     return LookupMd5Path(NormalizePath(path), dirent);
   }
+  /**
+   * Looks up several paths of this catalog at once, with one SQL query per
+   * batch of SqlLookupPathHashes::kMaxPaths paths.  The entries of the paths
+   * that are not found are negative.
+   */
+  void LookupPaths(const std::vector<PathString> &paths,
+                   std::vector<DirectoryEntry> *dirents) const;
   bool LookupRawSymlink(const PathString &path, LinkString *raw_symlink) const;
   bool LookupXattrsPath(const PathString &path, XattrList *xattrs) const {
     return LookupXattrsMd5Path(NormalizePath(path), xattrs);
   }
+  /**
+   * Finds the digest of the listing of the given directory.  Returns false
+   * if the catalog has no valid directory digests.
+   */
+  bool LookupDirectoryDigest(const PathString &path, shash::Any *digest) const
+  {
+    if (!has_directory_digests_)
+      return false;
+    return LookupDirectoryDigestMd5(NormalizePath(path), digest);
+  }
 
   inline bool ListingPath(const PathString &path,
                           DirectoryEntryList *listing,
@@ -191,6 +222,7 @@ class Catalog : SingleCopy {
     return inode_range_.IsInitialized() && initialized_;
   }
   inline bool IsRoot() const { return is_root_; }
+  inline bool HasDirectoryDigests() const { return has_directory_digests_; }
   bool IsAutogenerated() const {
     DirectoryEntry dirent;
     assert(IsInitialized());
@@ -216,6 +248,8 @@ class Catalog : SingleCopy {
                           const uint64_t hardlink_group) const;
 
   void SetOwnerMaps(const OwnerMap *uid_map, const OwnerMap *gid_map);
+  void SetPathIndexBudget(PathIndexBudget *budget);
+  void EnablePathFilter(const PathFilterCounters *counters);
   uint64_t MapUid(const uint64_t uid) const {
     if (uid_map_) { return uid_map_->Map(uid); }
     return uid;
@@ -253,6 +287,11 @@ class Catalog : SingleCopy {
   void ResetNestedCatalogCacheUnprotected();
 
   bool LookupMd5Path(const shash::Md5 &md5path, DirectoryEntry *dirent) const;
+  bool LookupDirectoryDigestMd5(const shash::Md5 &md5path,
+                                shash::Any *digest) const;
+  inline void set_has_directory_digests(const bool value) {
+    has_directory_digests_ = value;
+  }
 
  private:
   typedef std::map<PathString, Catalog*> NestedCatalogMap;
@@ -263,6 +302,12 @@ class Catalog : SingleCopy {
    */
   static const shash::Md5 kMd5PathEmpty;
 
+  /**
+   * Upper bound for the number of additional read-only database connections
+   * per catalog, see AcquireReader()
+   */
+  static const unsigned kMaxReaders = 8;
+
   enum VomsAuthzStatus {
     kVomsUnknown,  // Not yet looked up
     kVomsNone,     // No voms_authz key in properties table
@@ -276,6 +321,18 @@ class Catalog : SingleCopy {
   void FixTransitionPoint(const shash::Md5 &md5path,
                           DirectoryEntry *dirent) const;
 
+  struct Reader;
+  Reader *LockStatements() const;
+  void UnlockStatements(Reader *reader) const;
+  Reader *AcquireReader() const;
+  void ReleaseReader(Reader *reader) const;
+  Reader *CreateReader() const;
+
+  bool UsePathIndex(const Reader *reader) const;
+  PathIndex *BuildPathIndex() const;
+  void FixIndexedEntry(const shash::Md5 &md5path,
+                       DirectoryEntry *dirent) const;
+
   bool LookupXattrsMd5Path(const shash::Md5 &md5path, XattrList *xattrs) const;
   bool ListMd5PathChunks(const shash::Md5 &md5path,
                          const shash::Algorithms interpret_hashes_as,
@@ -287,6 +344,8 @@ class Catalog : SingleCopy {
                           StatEntryList *listing) const;
   bool LookupEntry(const shash::Md5 &md5path, const bool expand_symlink,
                    DirectoryEntry *dirent) const;
+  void LookupEntries(const std::vector<shash::Md5> &md5paths,
+                     std::vector<DirectoryEntry> *dirents) const;
 
   CatalogDatabase *database_;
 
@@ -317,6 +376,11 @@ class Catalog : SingleCopy {
   mutable std::string voms_authz_;
 
   bool initialized_;
+  /**
+   * True if the directory digests were computed for the current revision of
+   * the catalog (see WritableCatalog::UpdateDirectoryDigests())
+   */
+  bool has_directory_digests_;
   InodeRange inode_range_;
   uint64_t max_row_id_;
   InodeAnnotation *inode_annotation_;
@@ -325,14 +389,48 @@ class Catalog : SingleCopy {
   const OwnerMap *uid_map_;
   const OwnerMap *gid_map_;
 
+  /**
+   * Built on demand once the catalog is heavily used, see UsePathIndex().
+   * Protected by lock_.
+   */
+  mutable PathIndex *path_index_;
+  /**
+   * Set once path_index_ is built, so that readers can use the index
+   */
+  mutable atomic_int32 path_index_ready_;
+  mutable uint64_t path_index_size_;
+  PathIndexBudget *path_index_budget_;
+  mutable uint64_t num_sql_queries_;
+  mutable bool path_index_failed_;
+
+  /**
+   * Built when the catalog is attached, immutable afterwards
+   */
+  PathFilter *path_filter_;
+  const PathFilterCounters *path_filter_counters_;
+
+  /**
+   * Idle additional connections for path lookups and listings that would
+   * otherwise wait for lock_.  Protected by lock_readers_.
+   */
+  pthread_mutex_t *lock_readers_;
+  mutable std::vector<Reader *> idle_readers_;
+  mutable unsigned num_readers_;
+  /**
+   * Protects hardlink_groups_, which is also used from readers
+   */
+  pthread_mutex_t *lock_hardlink_groups_;
+
   SqlListing                  *sql_listing_;
   SqlLookupPathHash           *sql_lookup_md5path_;
+  SqlLookupPathHashes         *sql_lookup_md5paths_;
   SqlNestedCatalogLookup      *sql_lookup_nested_;
   SqlNestedCatalogListing     *sql_list_nested_;
   SqlOwnNestedCatalogListing  *sql_own_list_nested_;
   SqlAllChunks                *sql_all_chunks_;
   SqlChunksListing            *sql_chunks_listing_;
   SqlLookupXattrs             *sql_lookup_xattrs_;
+  SqlDirectoryDigestLookup    *sql_lookup_digest_;
 
   mutable HashVector        referenced_hashes_;
 };  // class Catalog
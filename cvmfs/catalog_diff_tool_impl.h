@@ -218,6 +218,15 @@ void CatalogDiffTool<RoCatalogMgr>::DiffRec(const PathString& path) {
       continue;
     }
 
+    // Early recursion stop if the directory listings are identical
+    shash::Any digest_from, digest_to;
+    if (old_catalog_mgr_->LookupDirectoryDigest(old_path, &digest_from) &&
+        new_catalog_mgr_->LookupDirectoryDigest(new_path, &digest_to) &&
+        (digest_from == digest_to))
+    {
+      continue;
+    }
+
     // Recursion
     DiffRec(old_path);
   }
@@ -0,0 +1,169 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include "catalog_index.h"
+
+#include <cassert>
+#include <cstring>
+
+#include "statistics.h"
+
+namespace catalog {
+
+static inline uint32_t hasher_md5(const shash::Md5 &key) {
+  // Don't start with the first bytes, because == is using them as well
+  return (uint32_t) *(reinterpret_cast<const uint32_t *>(key.digest) + 1);
+}
+
+
+PathIndexBudget::PathIndexBudget(
+  const uint64_t limit,
+  const unsigned threshold,
+  perf::Counter *n_hits,
+  perf::Counter *n_misses,
+  perf::Counter *n_builds)
+  : limit_(limit)
+  , threshold_(threshold)
+  , n_hits_(n_hits)
+  , n_misses_(n_misses)
+  , n_builds_(n_builds)
+{
+  atomic_init64(&used_);
+}
+
+
+bool PathIndexBudget::Reserve(const uint64_t size) {
+  const int64_t before = atomic_xadd64(&used_, size);
+  if (static_cast<uint64_t>(before) + size <= limit_)
+    return true;
+  atomic_xadd64(&used_, -static_cast<int64_t>(size));
+  return false;
+}
+
+
+void PathIndexBudget::Release(const uint64_t size) {
+  const int64_t before = atomic_xadd64(&used_, -static_cast<int64_t>(size));
+  assert(static_cast<uint64_t>(before) >= size);
+}
+
+
+//------------------------------------------------------------------------------
+
+
+// Both hash tables are at most 1 / 0.7 times larger than the number of
+// entries; there are usually fewer directories than entries
+const unsigned PathIndex::kBytesPerEntry = sizeof(DirectoryEntry) +
+  2 * (sizeof(shash::Md5) + sizeof(uint32_t)) +
+  2 * (sizeof(shash::Md5) + sizeof(uint64_t));
+
+
+void PathIndex::Add(
+  const shash::Md5 &md5path,
+  const shash::Md5 &parent_md5path,
+  const DirectoryEntry &dirent)
+{
+  if (parent_md5paths_.empty() || !(parent_md5paths_.back() == parent_md5path))
+    num_listings_++;
+  entries_.push_back(dirent);
+  md5paths_.push_back(md5path);
+  parent_md5paths_.push_back(parent_md5path);
+}
+
+
+/**
+ * Builds the hash tables and drops the path hashes that are only needed
+ * during construction.
+ */
+void PathIndex::Finalize() {
+  const shash::Md5 empty_key(shash::AsciiPtr("!"));
+  const uint32_t num_entries = entries_.size();
+  paths_.Init(num_entries + 1, empty_key, hasher_md5);
+  listings_.Init(num_listings_ + 1, empty_key, hasher_md5);
+
+  Range range;
+  for (uint32_t i = 0; i < num_entries; ++i) {
+    paths_.Insert(md5paths_[i], i);
+    if ((i > 0) && (parent_md5paths_[i] == parent_md5paths_[i - 1])) {
+      range.count++;
+      continue;
+    }
+    if (i > 0)
+      listings_.Insert(parent_md5paths_[i - 1], range);
+    range.first = i;
+    range.count = 1;
+  }
+  if (num_entries > 0)
+    listings_.Insert(parent_md5paths_[num_entries - 1], range);
+
+  std::vector<DirectoryEntry>(entries_).swap(entries_);
+  std::vector<shash::Md5>().swap(md5paths_);
+  std::vector<shash::Md5>().swap(parent_md5paths_);
+}
+
+
+bool PathIndex::Lookup(const shash::Md5 &md5path,
+                       DirectoryEntry *dirent) const
+{
+  uint32_t idx;
+  if (!paths_.Lookup(md5path, &idx))
+    return false;
+  if (dirent != NULL)
+    *dirent = entries_[idx];
+  return true;
+}
+
+
+void PathIndex::Listing(
+  const shash::Md5 &md5path,
+  uint32_t *first,
+  uint32_t *count) const
+{
+  Range range;
+  listings_.Lookup(md5path, &range);
+  *first = range.first;
+  *count = range.count;
+}
+
+
+uint64_t PathIndex::GetMemoryUsage() const {
+  return entries_.capacity() * sizeof(DirectoryEntry) +
+         paths_.bytes_allocated() + listings_.bytes_allocated();
+}
+
+
+//------------------------------------------------------------------------------
+
+
+PathFilter::PathFilter(const uint64_t num_entries) {
+  const uint64_t num_words = (num_entries * kBitsPerEntry + 63) / 64;
+  bitmap_.resize((num_words > 0) ? num_words : 1, 0);
+  num_bits_ = bitmap_.size() * 64;
+}
+
+
+void PathFilter::Add(const shash::Md5 &md5path) {
+  uint64_t h[2];
+  memcpy(h, md5path.digest, sizeof(h));
+  // The number of bits is even, an odd step does not revisit bits early
+  h[1] |= 1;
+  for (unsigned i = 0; i < kNumHashes; ++i) {
+    const uint64_t bit = (h[0] + i * h[1]) % num_bits_;
+    bitmap_[bit / 64] |= uint64_t(1) << (bit % 64);
+  }
+}
+
+
+bool PathFilter::MayContain(const shash::Md5 &md5path) const {
+  uint64_t h[2];
+  memcpy(h, md5path.digest, sizeof(h));
+  h[1] |= 1;
+  for (unsigned i = 0; i < kNumHashes; ++i) {
+    const uint64_t bit = (h[0] + i * h[1]) % num_bits_;
+    if ((bitmap_[bit / 64] & (uint64_t(1) << (bit % 64))) == 0)
+      return false;
+  }
+  return true;
+}
+
+}  // namespace catalog
@@ -0,0 +1,167 @@
+/**
+ * This file is part of the CernVM File System.
+ *
+ * An in-memory copy of the directory entries of a read-only catalog.  Once
+ * built, path lookups and listings of the catalog are served from two
+ * open-addressing hash tables instead of SQLite.  Indexes are optional and
+ * share a memory budget per catalog manager.
+ *
+ * The much smaller path filter only tells the paths that are certainly not in
+ * a catalog, so that failing lookups do not reach SQLite.
+ */
+
+#ifndef CVMFS_CATALOG_INDEX_H_
+#define CVMFS_CATALOG_INDEX_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "crypto/hash.h"
+#include "directory_entry.h"
+#include "smallhash.h"
+#include "util/atomic.h"
+#include "util/single_copy.h"
+
+namespace perf {
+class Counter;
+}
+
+namespace catalog {
+
+/**
+ * Shared by all the catalogs of a catalog manager.  Limits the memory of the
+ * path indexes and collects their statistics.  A catalog builds its index
+ * after it answered threshold path lookups and listings from SQLite.
+ */
+class PathIndexBudget : SingleCopy {
+ public:
+  static const unsigned kDefaultThreshold = 1000;
+
+  PathIndexBudget(const uint64_t limit,
+                  const unsigned threshold,
+                  perf::Counter *n_hits,
+                  perf::Counter *n_misses,
+                  perf::Counter *n_builds);
+
+  bool Reserve(const uint64_t size);
+  void Release(const uint64_t size);
+  uint64_t limit() const { return limit_; }
+  unsigned threshold() const { return threshold_; }
+  uint64_t used() { return atomic_read64(&used_); }
+
+  perf::Counter *n_hits() const { return n_hits_; }
+  perf::Counter *n_misses() const { return n_misses_; }
+  perf::Counter *n_builds() const { return n_builds_; }
+
+ private:
+  const uint64_t limit_;
+  const unsigned threshold_;
+  atomic_int64 used_;
+  perf::Counter *n_hits_;
+  perf::Counter *n_misses_;
+  perf::Counter *n_builds_;
+};
+
+
+/**
+ * Directory entries are stored grouped by their parent directory, so that a
+ * listing is a contiguous range.  The inode field of the stored entries holds
+ * the catalog row id; the caller mangles it into the actual inode.  Symlinks
+ * are stored unexpanded.
+ */
+class PathIndex : SingleCopy {
+ public:
+  /**
+   * Expected memory per entry, used to decide if an index fits into the budget
+   * before building it
+   */
+  static const unsigned kBytesPerEntry;
+
+  PathIndex() : num_listings_(0) { }
+
+  /**
+   * Entries have to be added in the order of their parent path hash.
+   */
+  void Add(const shash::Md5 &md5path,
+           const shash::Md5 &parent_md5path,
+           const DirectoryEntry &dirent);
+  void Finalize();
+
+  bool Lookup(const shash::Md5 &md5path, DirectoryEntry *dirent) const;
+  /**
+   * Returns the range of the given directory's entries.  The entries are
+   * accessed through GetEntry().
+   */
+  void Listing(const shash::Md5 &md5path,
+               uint32_t *first, uint32_t *count) const;
+  const DirectoryEntry &GetEntry(const uint32_t idx) const {
+    return entries_[idx];
+  }
+
+  uint64_t GetMemoryUsage() const;
+  uint32_t size() const { return entries_.size(); }
+
+ private:
+  struct Range {
+    Range() : first(0), count(0) { }
+    uint32_t first;
+    uint32_t count;
+  };
+
+  std::vector<DirectoryEntry> entries_;
+  std::vector<shash::Md5> md5paths_;
+  std::vector<shash::Md5> parent_md5paths_;
+  uint32_t num_listings_;
+  SmallHashFixed<shash::Md5, uint32_t> paths_;
+  SmallHashFixed<shash::Md5, Range> listings_;
+};
+
+
+/**
+ * Shared by the catalogs of a catalog manager that have a path filter
+ */
+struct PathFilterCounters {
+  PathFilterCounters() : n_rejects(NULL), n_false_positives(NULL) { }
+  /**
+   * Lookups answered by the filter
+   */
+  perf::Counter *n_rejects;
+  /**
+   * Lookups of missing paths that passed the filter
+   */
+  perf::Counter *n_false_positives;
+};
+
+
+/**
+ * A Bloom filter of the path hashes of a catalog.  The path hashes are MD5
+ * sums, so the bit positions are derived from the two halves of the path hash
+ * by double hashing.  With kBitsPerEntry bits per entry and kNumHashes bit
+ * positions, about 1% of the lookups of missing paths pass the filter.
+ */
+class PathFilter : SingleCopy {
+ public:
+  static const unsigned kBitsPerEntry = 10;
+  static const unsigned kNumHashes = 7;
+
+  explicit PathFilter(const uint64_t num_entries);
+
+  void Add(const shash::Md5 &md5path);
+  /**
+   * False if the path hash has certainly not been added
+   */
+  bool MayContain(const shash::Md5 &md5path) const;
+
+  uint64_t GetMemoryUsage() const {
+    return bitmap_.capacity() * sizeof(uint64_t);
+  }
+
+ private:
+  std::vector<uint64_t> bitmap_;
+  uint64_t num_bits_;
+};
+
+}  // namespace catalog
+
+#endif  // CVMFS_CATALOG_INDEX_H_
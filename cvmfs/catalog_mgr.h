@@ -18,12 +18,14 @@
 #include <vector>
 
 #include "catalog.h"
+#include "catalog_index.h"
 #include "crypto/hash.h"
 #include "directory_entry.h"
 #include "file_chunk.h"
 #include "statistics.h"
 #include "util/atomic.h"
 #include "util/logging.h"
+#include "util/mutex.h"
 
 class XattrList;
 
@@ -68,10 +70,16 @@ struct Statistics {
   perf::Counter *n_lookup_inode;
   perf::Counter *n_lookup_path;
   perf::Counter *n_lookup_path_negative;
+  perf::Counter *n_lookup_path_batch;
   perf::Counter *n_lookup_xattrs;
   perf::Counter *n_listing;
   perf::Counter *n_nested_listing;
   perf::Counter *n_detach_siblings;
+  perf::Counter *n_path_index_hits;
+  perf::Counter *n_path_index_misses;
+  perf::Counter *n_path_index_builds;
+  perf::Counter *n_path_filter_rejects;
+  perf::Counter *n_path_filter_false_positives;
   perf::Counter *catalog_revision;
 
   explicit Statistics(perf::Statistics *statistics) {
@@ -82,6 +90,9 @@ struct Statistics {
     n_lookup_path_negative = statistics->Register(
         "catalog_mgr.n_lookup_path_negative",
         "Number of negative path lookups");
+    n_lookup_path_batch = statistics->Register(
+        "catalog_mgr.n_lookup_path_batch",
+        "Number of batches of path lookups");
     n_lookup_xattrs = statistics->Register("catalog_mgr.n_lookup_xattrs",
         "Number of xattrs lookups");
     n_listing = statistics->Register("catalog_mgr.n_listing",
@@ -90,6 +101,20 @@ struct Statistics {
         "Number of listings of nested catalogs");
     n_detach_siblings = statistics->Register("catalog_mgr.n_detach_siblings",
         "Number of times the CVMFS_CATALOG_WATERMARK was hit");
+    n_path_index_hits = statistics->Register("catalog_mgr.n_path_index_hits",
+        "Number of lookups and listings served by catalog path indexes");
+    n_path_index_misses = statistics->Register(
+        "catalog_mgr.n_path_index_misses",
+        "Number of lookups and listings of indexable catalogs served by SQL");
+    n_path_index_builds = statistics->Register(
+        "catalog_mgr.n_path_index_builds",
+        "Number of catalog path indexes built");
+    n_path_filter_rejects = statistics->Register(
+        "catalog_mgr.n_path_filter_rejects",
+        "Number of negative path lookups answered by catalog path filters");
+    n_path_filter_false_positives = statistics->Register(
+        "catalog_mgr.n_path_filter_false_positives",
+        "Number of negative path lookups that passed catalog path filters");
     catalog_revision = statistics->Register("catalog_revision",
                                     "Revision number of the root file catalog");
   }
@@ -141,7 +166,21 @@ class AbstractCatalogManager : public SingleCopy {
     p.Assign(&path[0], path.length());
     return LookupPath(p, options, entry);
   }
+  /**
+   * Looks up many paths at once, e.g. the entries of a directory listing.  The
+   * paths are grouped by the catalog that hosts them, so that every catalog
+   * runs one SQL query per batch of paths.  Paths that require mounting a
+   * nested catalog fall back to LookupPath().  Sets found[i] to the result
+   * of LookupPath() for paths[i], i.e. the entries of paths that are not
+   * found are negative or, on I/O errors, empty.  Returns the number of found
+   * paths.
+   */
+  unsigned LookupPaths(const std::vector<PathString> &paths,
+                       const LookupOptions options,
+                       std::vector<DirectoryEntry> *dirents,
+                       std::vector<bool> *found);
   bool LookupXattrs(const PathString &path, XattrList *xattrs);
+  bool LookupDirectoryDigest(const PathString &path, shash::Any *digest);
 
   bool LookupNested(const PathString &path,
                     PathString *mountpoint,
@@ -167,6 +206,10 @@ class AbstractCatalogManager : public SingleCopy {
                       FileChunkList *chunks);
   void SetOwnerMaps(const OwnerMap &uid_map, const OwnerMap &gid_map);
   void SetCatalogWatermark(unsigned limit);
+  void SetPathIndexLimit(const uint64_t limit, const unsigned threshold =
+                         PathIndexBudget::kDefaultThreshold);
+  void EnablePathFilters();
+  void SetNestedPrefetchBudget(unsigned budget);
 
   shash::Any GetNestedCatalogHash(const PathString &mountpoint);
 
@@ -219,6 +262,13 @@ class AbstractCatalogManager : public SingleCopy {
                                 shash::Any   *catalog_hash) = 0;
   virtual void UnloadCatalog(const CatalogT *catalog) { }
   virtual void ActivateCatalog(CatalogT *catalog) { }
+  /**
+   * Called before a nested catalog is loaded with up to the nested prefetch
+   * budget of its siblings that are not yet attached.  Derived classes can
+   * fetch them in the background, so that they are already cached when they
+   * are needed.  Called without holding the lock on the catalog tree.
+   */
+  virtual void PrefetchCatalogs(const Catalog::NestedCatalogList &catalogs) { }
   const std::vector<CatalogT*>& GetCatalogs() const { return catalogs_; }
 
   /**
@@ -240,14 +290,22 @@ class AbstractCatalogManager : public SingleCopy {
                     const CatalogT *entry_point,
                     bool can_listing,
                     CatalogT **leaf_catalog);
+  bool MountNestedCatalogs(const PathString &path,
+                           bool is_listable,
+                           CatalogT **leaf_catalog);
 
   CatalogT *LoadFreeCatalog(const PathString &mountpoint,
                             const shash::Any &hash);
 
   bool AttachCatalog(const std::string &db_path, CatalogT *new_catalog);
+  bool PrepareCatalog(const std::string &db_path, CatalogT *new_catalog);
+  bool LinkCatalog(CatalogT *new_catalog);
   void DetachCatalog(CatalogT *catalog);
   void DetachSubtree(CatalogT *catalog);
-  void DetachSiblings(const PathString &current_tree);
+  void DetachSiblings(const PathString &current_tree, CatalogList *unlinked);
+  void UnlinkCatalog(CatalogT *catalog);
+  void UnlinkSubtree(CatalogT *catalog, CatalogList *unlinked);
+  void UnloadCatalogs(const CatalogList &catalogs);
   void DetachAll() { if (!catalogs_.empty()) DetachSubtree(GetRootCatalog()); }
   bool IsAttached(const PathString &root_path,
                   CatalogT **attached_catalog) const;
@@ -266,10 +324,27 @@ class AbstractCatalogManager : public SingleCopy {
     int retval = pthread_rwlock_unlock(rwlock_);
     assert(retval == 0);
   }
+  /**
+   * Derived classes that change the catalog tree need to hold this mutex
+   * before taking the write lock, see lock_mount_
+   */
+  pthread_mutex_t *lock_mount() const { return lock_mount_; }
   virtual void EnforceSqliteMemLimit();
 
  private:
   void CheckInodeWatermark();
+  void FindPrefetchSiblings(const CatalogT *parent,
+                            const PathString &mountpoint,
+                            Catalog::NestedCatalogList *siblings);
+  bool FindNextNested(const PathString &path,
+                      const CatalogT *parent,
+                      bool is_listable,
+                      PathString *mountpoint,
+                      shash::Any *hash);
+  CatalogT *AttachLoadedCatalog(const PathString &mountpoint,
+                                const std::string &catalog_path,
+                                const shash::Any &catalog_hash,
+                                CatalogT *parent_catalog);
 
   /**
    * The flat list of all attached catalogs.
@@ -284,6 +359,20 @@ class AbstractCatalogManager : public SingleCopy {
    * a DetachSiblings() call.
    */
   unsigned catalog_watermark_;
+  /**
+   * Maximum number of sibling catalogs passed to PrefetchCatalogs() when a
+   * nested catalog is mounted.  Zero disables prefetching.
+   */
+  unsigned nested_prefetch_budget_;
+  /**
+   * Memory budget for the in-memory path indexes of the attached catalogs.
+   * NULL if path indexes are disabled.
+   */
+  PathIndexBudget *path_index_budget_;
+  /**
+   * NULL if path filters are disabled
+   */
+  PathFilterCounters *path_filter_counters_;
   /**
    * Not protected by a read lock because it can only change when the root
    * catalog is exchanged (during big global lock of the file system).
@@ -304,6 +393,14 @@ class AbstractCatalogManager : public SingleCopy {
   // TODO(molina) we could just add an atomic global counter instead
   InodeAnnotation *inode_annotation_;  /**< applied to all catalogs */
   pthread_rwlock_t *rwlock_;
+  /**
+   * Serializes loading catalogs and changing the catalog tree.  Nested
+   * catalogs are loaded, i.e. possibly downloaded, while holding only this
+   * lock, so that lookups in the attached catalogs are not blocked.  The write
+   * lock on rwlock_ is only taken to attach or detach loaded catalogs.  Must
+   * be acquired before rwlock_.
+   */
+  pthread_mutex_t *lock_mount_;
   Statistics statistics_;
   pthread_key_t pkey_sqlitemem_;
   OwnerMap uid_map_;
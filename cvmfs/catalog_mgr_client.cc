@@ -2,13 +2,18 @@
  * This file is part of the CernVM file system.
  */
 
+#define __STDC_FORMAT_MACROS
+
 #include "cvmfs_config.h"
 #include "catalog_mgr_client.h"
 
+#include <inttypes.h>
+
 #include <string>
 #include <vector>
 
 #include "cache_posix.h"
+#include "catalog_revision_diff.h"
 #include "crypto/signature.h"
 #include "fetch.h"
 #include "manifest.h"
@@ -16,6 +21,7 @@
 #include "network/download.h"
 #include "quota.h"
 #include "statistics.h"
+#include "util/mutex.h"
 #include "util/posix.h"
 #include "util/string.h"
 
@@ -30,8 +36,10 @@ void ClientCatalogManager::ActivateCatalog(Catalog *catalog) {
   const Counters &counters = const_cast<const Catalog*>(catalog)->GetCounters();
   if (catalog->IsRoot()) {
     all_inodes_ = counters.GetAllEntries();
+    revision_catalogs_.clear();
   }
   loaded_inodes_ += counters.GetSelfEntries();
+  revision_catalogs_[catalog->mountpoint()] = catalog->hash();
 }
 
 
@@ -45,16 +53,37 @@ ClientCatalogManager::ClientCatalogManager(MountPoint *mountpoint)
   , all_inodes_(0)
   , loaded_inodes_(0)
   , fixed_alt_root_catalog_(false)
+  , prefetch_stop_(false)
+  , prefetch_budget_(0)
 {
   LogCvmfs(kLogCatalog, kLogDebug, "constructing client catalog manager");
+  int retval = pthread_mutex_init(&lock_prefetch_, NULL);
+  assert(retval == 0);
+  retval = pthread_cond_init(&cond_prefetch_, NULL);
+  assert(retval == 0);
   n_certificate_hits_ = mountpoint->statistics()->Register(
     "cache.n_certificate_hits", "Number of certificate hits");
   n_certificate_misses_ = mountpoint->statistics()->Register(
     "cache.n_certificate_misses", "Number of certificate misses");
+  n_prefetch_ = mountpoint->statistics()->Register(
+    "catalog_mgr.n_prefetch", "Number of prefetched nested catalogs");
+  n_prefetch_waits_ = mountpoint->statistics()->Register(
+    "catalog_mgr.n_prefetch_waits",
+    "Number of catalog loads that waited for a prefetch");
 }
 
 
 ClientCatalogManager::~ClientCatalogManager() {
+  {
+    MutexLockGuard m(&lock_prefetch_);
+    prefetch_stop_ = true;
+    pthread_cond_broadcast(&cond_prefetch_);
+  }
+  for (unsigned i = 0; i < threads_prefetch_.size(); ++i)
+    pthread_join(threads_prefetch_[i], NULL);
+  pthread_cond_destroy(&cond_prefetch_);
+  pthread_mutex_destroy(&lock_prefetch_);
+
   LogCvmfs(kLogCache, kLogDebug, "unpinning / unloading all catalogs");
 
   for (map<PathString, shash::Any>::iterator i = mounted_catalogs_.begin(),
@@ -76,9 +105,133 @@ Catalog *ClientCatalogManager::CreateCatalog(
 }
 
 
+/**
+ * When a nested catalog is mounted, up to budget of its siblings are fetched
+ * into the cache in the background.  Deep first accesses of a directory tree
+ * with many nested catalogs then find most of the catalogs in the cache.
+ */
+void ClientCatalogManager::EnablePrefetch(unsigned budget) {
+  prefetch_budget_ = budget;
+  SetNestedPrefetchBudget(budget);
+}
+
+
+void ClientCatalogManager::PrefetchCatalogs(
+  const Catalog::NestedCatalogList &catalogs)
+{
+  MutexLockGuard m(&lock_prefetch_);
+  if (prefetch_stop_)
+    return;
+  if (threads_prefetch_.empty()) {
+    for (unsigned i = 0; i < kNumPrefetchThreads; ++i) {
+      pthread_t thread;
+      int retval = pthread_create(&thread, NULL, MainPrefetch, this);
+      assert(retval == 0);
+      threads_prefetch_.push_back(thread);
+    }
+  }
+
+  for (unsigned i = 0; i < catalogs.size(); ++i) {
+    if (prefetch_queue_.size() >= prefetch_budget_)
+      break;
+    if (prefetch_inflight_.count(catalogs[i].hash) > 0)
+      continue;
+    bool is_queued = false;
+    for (unsigned j = 0; j < prefetch_queue_.size(); ++j) {
+      if (prefetch_queue_[j].hash == catalogs[i].hash) {
+        is_queued = true;
+        break;
+      }
+    }
+    if (!is_queued)
+      prefetch_queue_.push_back(catalogs[i]);
+  }
+  pthread_cond_broadcast(&cond_prefetch_);
+}
+
+
+/**
+ * Fetches queued nested catalogs as regular objects so that they are cached
+ * but not pinned.  Loading the catalog later pins it.
+ */
+void *ClientCatalogManager::MainPrefetch(void *data) {
+  ClientCatalogManager *catalog_mgr =
+    reinterpret_cast<ClientCatalogManager *>(data);
+  LogCvmfs(kLogCatalog, kLogDebug, "starting catalog prefetch thread");
+
+  pthread_mutex_lock(&catalog_mgr->lock_prefetch_);
+  while (true) {
+    while (catalog_mgr->prefetch_queue_.empty() &&
+           !catalog_mgr->prefetch_stop_)
+    {
+      pthread_cond_wait(&catalog_mgr->cond_prefetch_,
+                        &catalog_mgr->lock_prefetch_);
+    }
+    if (catalog_mgr->prefetch_stop_)
+      break;
+    const Catalog::NestedCatalog nested = catalog_mgr->prefetch_queue_.front();
+    catalog_mgr->prefetch_queue_.pop_front();
+    catalog_mgr->prefetch_inflight_.insert(nested.hash);
+    pthread_mutex_unlock(&catalog_mgr->lock_prefetch_);
+
+    const string name = "file catalog at " + catalog_mgr->repo_name_ + ":" +
+      nested.mountpoint.ToString() + " (" + nested.hash.ToString() + ")";
+    // Catalogs created by old server versions do not record their size
+    const uint64_t size =
+      (nested.size > 0) ? nested.size : CacheManager::kSizeUnknown;
+    const int fd = catalog_mgr->fetcher_->Fetch(nested.hash, size, name,
+      zlib::kZlibDefault, CacheManager::kTypeRegular);
+    if (fd >= 0) {
+      catalog_mgr->fetcher_->cache_mgr()->Close(fd);
+      perf::Inc(catalog_mgr->n_prefetch_);
+    } else {
+      LogCvmfs(kLogCatalog, kLogDebug, "failed to prefetch %s (%d)",
+               name.c_str(), fd);
+    }
+
+    pthread_mutex_lock(&catalog_mgr->lock_prefetch_);
+    catalog_mgr->prefetch_inflight_.erase(nested.hash);
+    pthread_cond_broadcast(&catalog_mgr->cond_prefetch_);
+  }
+  pthread_mutex_unlock(&catalog_mgr->lock_prefetch_);
+
+  LogCvmfs(kLogCatalog, kLogDebug, "stopping catalog prefetch thread");
+  return NULL;
+}
+
+
+/**
+ * Drops the catalog from the prefetch queue or, if it is being prefetched,
+ * waits until the prefetch finished.  A concurrent download would otherwise
+ * be collapsed with the prefetch, which does not pin the catalog.
+ */
+void ClientCatalogManager::WaitForPrefetch(const shash::Any &hash) {
+  MutexLockGuard m(&lock_prefetch_);
+  for (std::deque<Catalog::NestedCatalog>::iterator i = prefetch_queue_.begin(),
+       iend = prefetch_queue_.end(); i != iend; ++i)
+  {
+    if (i->hash == hash) {
+      prefetch_queue_.erase(i);
+      break;
+    }
+  }
+  if (prefetch_inflight_.count(hash) == 0)
+    return;
+  perf::Inc(n_prefetch_waits_);
+  while (prefetch_inflight_.count(hash) > 0)
+    pthread_cond_wait(&cond_prefetch_, &lock_prefetch_);
+}
+
+
+/**
+ * Uses the root catalog instead of mounted_catalogs_, which is protected by
+ * the mount mutex and not by the lock on the catalog tree.
+ */
 shash::Any ClientCatalogManager::GetRootHash() {
   ReadLock();
-  shash::Any result = mounted_catalogs_[PathString("", 0)];
+  shash::Any result;
+  if (!GetCatalogs().empty())
+    result = GetRootCatalog()->hash();
   Unlock();
   return result;
 }
@@ -93,6 +246,7 @@ bool ClientCatalogManager::InitFixed(
 {
   LogCvmfs(kLogCatalog, kLogDebug, "Initialize catalog with root hash %s",
            root_hash.ToString().c_str());
+  MutexLockGuard m(lock_mount());
   WriteLock();
   fixed_alt_root_catalog_ = alternative_path;
   bool attached = MountCatalog(PathString("", 0), root_hash, NULL);
@@ -128,6 +282,8 @@ LoadError ClientCatalogManager::LoadCatalog(
     string alt_catalog_path = "";
     if (mountpoint.IsEmpty() && fixed_alt_root_catalog_)
       alt_catalog_path = hash.MakeAlternativePath();
+    if (prefetch_budget_ > 0)
+      WaitForPrefetch(hash);
     LoadError load_error =
       LoadCatalogCas(hash, cvmfs_path, alt_catalog_path, catalog_path);
     if (load_error == catalog::kLoadNew)
@@ -269,6 +425,142 @@ LoadError ClientCatalogManager::LoadCatalogCas(
 }
 
 
+void ClientCatalogManager::GetRevisionCatalogs(
+  map<PathString, shash::Any> *catalogs)
+{
+  ReadLock();
+  *catalogs = revision_catalogs_;
+  Unlock();
+}
+
+
+/**
+ * Compares the catalogs of the current revision that can have contributed to
+ * the meta-data caches with the revision given by root_hash.  Starting from
+ * the new root catalog, walks down the new catalog tree towards the mount
+ * points of the old catalogs.  As soon as a catalog on the way has the same
+ * hash as in the current revision, the subtree is unchanged.  Otherwise, the
+ * old and the new catalog are compared entry by entry.  Catalogs are taken
+ * from the cache or downloaded without being mounted, so that this can run in
+ * the background before the remount.  Returns false if a catalog cannot be
+ * loaded, in which case the caller needs to consider everything as changed.
+ */
+bool ClientCatalogManager::DiffRevision(
+  const shash::Any &root_hash,
+  RevisionDiff *diff)
+{
+  diff->set_root_hash(root_hash);
+  GetRevisionCatalogs(diff->catalogs());
+  const map<PathString, shash::Any> &old_catalogs = *diff->catalogs();
+
+  // Catalogs of the new revision that have been opened so far
+  map<PathString, Catalog *> new_catalogs;
+  bool result = true;
+  for (map<PathString, shash::Any>::const_iterator i = old_catalogs.begin(),
+       iend = old_catalogs.end(); i != iend; ++i)
+  {
+    PathString mountpoint;
+    shash::Any hash = root_hash;
+    Catalog *new_catalog = NULL;
+    bool is_unchanged = false;
+    while (true) {
+      map<PathString, shash::Any>::const_iterator old_catalog =
+        old_catalogs.find(mountpoint);
+      if ((old_catalog != iend) && (old_catalog->second == hash)) {
+        is_unchanged = true;
+        break;
+      }
+      map<PathString, Catalog *>::const_iterator open_catalog =
+        new_catalogs.find(mountpoint);
+      if (open_catalog == new_catalogs.end()) {
+        new_catalog = OpenDiffCatalog(mountpoint, hash);
+        if (new_catalog == NULL) {
+          result = false;
+          break;
+        }
+        new_catalogs[mountpoint] = new_catalog;
+      } else {
+        new_catalog = open_catalog->second;
+      }
+      if (mountpoint == i->first)
+        break;
+
+      // Descend into the nested catalog on the path to the old mount point
+      const Catalog::NestedCatalogList nested_catalogs =
+        new_catalog->ListOwnNestedCatalogs();
+      bool has_nested = false;
+      for (unsigned j = 0; j < nested_catalogs.size(); ++j) {
+        const PathString &nested = nested_catalogs[j].mountpoint;
+        if (i->first.StartsWith(nested) &&
+            ((i->first.GetLength() == nested.GetLength()) ||
+             (i->first.GetChars()[nested.GetLength()] == '/')))
+        {
+          mountpoint = nested;
+          hash = nested_catalogs[j].hash;
+          has_nested = true;
+          break;
+        }
+      }
+      if (!has_nested) {
+        // The old catalog has no counterpart in the new revision
+        new_catalog = NULL;
+        break;
+      }
+    }
+    if (!result)
+      break;
+    if (is_unchanged)
+      continue;
+
+    Catalog *old_catalog = OpenDiffCatalog(i->first, i->second);
+    if (old_catalog == NULL) {
+      result = false;
+      break;
+    }
+    diff->AddCatalogs(old_catalog, new_catalog);
+    delete old_catalog;
+  }
+
+  for (map<PathString, Catalog *>::iterator i = new_catalogs.begin(),
+       iend = new_catalogs.end(); i != iend; ++i)
+  {
+    delete i->second;
+  }
+  diff->Finalize();
+  LogCvmfs(kLogCatalog, kLogDebug,
+           "revision diff to %s: %u out of %u catalogs changed, "
+           "%" PRIu64 " changed paths (%s)",
+           root_hash.ToString().c_str(), diff->num_diffed_catalogs(),
+           static_cast<unsigned>(old_catalogs.size()),
+           static_cast<uint64_t>(diff->num_paths()),
+           result ? "complete" : "failed");
+  return result;
+}
+
+
+/**
+ * Opens a catalog for DiffRevision() without mounting it.  The catalog is
+ * fetched as a regular object so that it is not pinned in the cache.
+ */
+Catalog *ClientCatalogManager::OpenDiffCatalog(
+  const PathString &mountpoint,
+  const shash::Any &hash)
+{
+  const string name = "file catalog at " + repo_name_ + ":" +
+    (mountpoint.IsEmpty() ? "/" : mountpoint.ToString()) +
+    " (" + hash.ToString() + ")";
+  const int fd = fetcher_->Fetch(hash, CacheManager::kSizeUnknown, name,
+    zlib::kZlibDefault, CacheManager::kTypeRegular);
+  if (fd < 0) {
+    LogCvmfs(kLogCatalog, kLogDebug, "failed to load %s for diff (%d)",
+             name.c_str(), fd);
+    return NULL;
+  }
+  return Catalog::AttachFreely(mountpoint.ToString(), "@" + StringifyInt(fd),
+                               hash, NULL, !mountpoint.IsEmpty());
+}
+
+
 void ClientCatalogManager::UnloadCatalog(const Catalog *catalog) {
   LogCvmfs(kLogCache, kLogDebug, "unloading catalog %s",
            catalog->mountpoint().c_str());
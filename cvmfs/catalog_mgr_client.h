@@ -8,12 +8,17 @@
 #include "catalog_mgr.h"
 
 #include <inttypes.h>
+#include <pthread.h>
 
+#include <deque>
 #include <map>
+#include <set>
 #include <string>
+#include <vector>
 
 #include "backoff.h"
 #include "crypto/hash.h"
+#include "gtest/gtest_prod.h"
 #include "manifest_fetch.h"
 #include "shortstring.h"
 
@@ -32,6 +37,8 @@ class SignatureManager;
 
 namespace catalog {
 
+class RevisionDiff;
+
 /**
  * A catalog manager that uses a Fetcher to get file catalgs in the form of
  * (virtual) file descriptors from a cache manager.  Sqlite has a path based
@@ -49,17 +56,27 @@ namespace catalog {
 class ClientCatalogManager : public AbstractCatalogManager<Catalog> {
   // Maintains certificate hit/miss counters
   friend class CachedManifestEnsemble;
+  FRIEND_TEST(T_ClientCatalogManager, Prefetch);
 
  public:
+  /**
+   * Upper bound for the number of queued nested catalog prefetches
+   */
+  static const unsigned kMaxPrefetchBudget = 64;
+
   explicit ClientCatalogManager(MountPoint *mountpoint);
   virtual ~ClientCatalogManager();
 
   bool InitFixed(const shash::Any &root_hash, bool alternative_path);
+  void EnablePrefetch(unsigned budget);
 
   shash::Any GetRootHash();
 
   bool IsRevisionBlacklisted();
 
+  void GetRevisionCatalogs(std::map<PathString, shash::Any> *catalogs);
+  bool DiffRevision(const shash::Any &root_hash, RevisionDiff *diff);
+
   bool offline_mode() const { return offline_mode_; }
   uint64_t all_inodes() const { return all_inodes_; }
   uint64_t loaded_inodes() const { return loaded_inodes_; }
@@ -76,18 +93,35 @@ class ClientCatalogManager : public AbstractCatalogManager<Catalog> {
                                   const shash::Any  &catalog_hash,
                                   catalog::Catalog *parent_catalog);
   void ActivateCatalog(catalog::Catalog *catalog);
+  void PrefetchCatalogs(const Catalog::NestedCatalogList &catalogs);
 
  private:
+  /**
+   * Number of threads that fetch nested catalogs in the background, started
+   * on the first call to PrefetchCatalogs()
+   */
+  static const unsigned kNumPrefetchThreads = 4;
+
+  static void *MainPrefetch(void *data);
+  void WaitForPrefetch(const shash::Any &hash);
   LoadError LoadCatalogCas(const shash::Any &hash,
                            const std::string &name,
                            const std::string &alt_catalog_path,
                            std::string *catalog_path);
+  Catalog *OpenDiffCatalog(const PathString &mountpoint,
+                           const shash::Any &hash);
 
   /**
-   * Required for unpinning
+   * Required for unpinning.  Protected by the mount mutex of the base class.
    */
   std::map<PathString, shash::Any> loaded_catalogs_;
   std::map<PathString, shash::Any> mounted_catalogs_;
+  /**
+   * All catalogs that were mounted since the root catalog of the current
+   * revision, including the ones that were detached in the meantime.  Any of
+   * them can have contributed entries to the meta-data caches.
+   */
+  std::map<PathString, shash::Any> revision_catalogs_;
 
   UniquePtr<manifest::Manifest> manifest_;
 
@@ -100,8 +134,31 @@ class ClientCatalogManager : public AbstractCatalogManager<Catalog> {
   uint64_t loaded_inodes_;
   bool fixed_alt_root_catalog_;  /**< fixed root hash but alternative url */
   BackoffThrottle backoff_throttle_;
+  /**
+   * Nested catalogs waiting to be prefetched.  At most the nested prefetch
+   * budget of catalogs are queued.
+   */
+  std::deque<Catalog::NestedCatalog> prefetch_queue_;
+  /**
+   * Catalogs that are being prefetched.  Loading one of them waits for the
+   * prefetch so that the catalog is not downloaded twice.
+   */
+  std::set<shash::Any> prefetch_inflight_;
+  std::vector<pthread_t> threads_prefetch_;
+  bool prefetch_stop_;
+  /**
+   * Protects the prefetch queue and the inflight set
+   */
+  pthread_mutex_t lock_prefetch_;
+  /**
+   * Signals new prefetch jobs, finished prefetches, and termination
+   */
+  pthread_cond_t cond_prefetch_;
+  unsigned prefetch_budget_;
   perf::Counter *n_certificate_hits_;
   perf::Counter *n_certificate_misses_;
+  perf::Counter *n_prefetch_;
+  perf::Counter *n_prefetch_waits_;
 };
 
 
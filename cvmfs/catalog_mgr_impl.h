@@ -12,6 +12,7 @@
 #include "cvmfs_config.h"
 
 #include <cassert>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -32,6 +33,9 @@ AbstractCatalogManager<CatalogT>::AbstractCatalogManager(
   inode_gauge_ = AbstractCatalogManager<CatalogT>::kInodeOffset;
   revision_cache_ = 0;
   catalog_watermark_ = 0;
+  nested_prefetch_budget_ = 0;
+  path_index_budget_ = NULL;
+  path_filter_counters_ = NULL;
   volatile_flag_ = false;
   has_authz_cache_ = false;
   inode_annotation_ = NULL;
@@ -40,6 +44,10 @@ AbstractCatalogManager<CatalogT>::AbstractCatalogManager(
     reinterpret_cast<pthread_rwlock_t *>(smalloc(sizeof(pthread_rwlock_t)));
   int retval = pthread_rwlock_init(rwlock_, NULL);
   assert(retval == 0);
+  lock_mount_ =
+    reinterpret_cast<pthread_mutex_t *>(smalloc(sizeof(pthread_mutex_t)));
+  retval = pthread_mutex_init(lock_mount_, NULL);
+  assert(retval == 0);
   retval = pthread_key_create(&pkey_sqlitemem_, NULL);
   assert(retval == 0);
 }
@@ -47,9 +55,13 @@ AbstractCatalogManager<CatalogT>::AbstractCatalogManager(
 template <class CatalogT>
 AbstractCatalogManager<CatalogT>::~AbstractCatalogManager() {
   DetachAll();
+  delete path_index_budget_;
+  delete path_filter_counters_;
   pthread_key_delete(pkey_sqlitemem_);
   pthread_rwlock_destroy(rwlock_);
   free(rwlock_);
+  pthread_mutex_destroy(lock_mount_);
+  free(lock_mount_);
 }
 
 template <class CatalogT>
@@ -73,6 +85,45 @@ void AbstractCatalogManager<CatalogT>::SetCatalogWatermark(unsigned limit) {
   catalog_watermark_ = limit;
 }
 
+/**
+ * When a nested catalog is mounted, up to budget of its not yet attached
+ * siblings are handed to PrefetchCatalogs().
+ */
+template <class CatalogT>
+void AbstractCatalogManager<CatalogT>::SetNestedPrefetchBudget(
+  unsigned budget)
+{
+  nested_prefetch_budget_ = budget;
+}
+
+/**
+ * Enables the path indexes of the catalogs attached from now on.  Indexes
+ * of all the catalogs together use at most limit bytes.
+ */
+template <class CatalogT>
+void AbstractCatalogManager<CatalogT>::SetPathIndexLimit(
+  const uint64_t limit,
+  const unsigned threshold)
+{
+  assert(catalogs_.empty() && (path_index_budget_ == NULL));
+  path_index_budget_ = new PathIndexBudget(limit, threshold,
+    statistics_.n_path_index_hits, statistics_.n_path_index_misses,
+    statistics_.n_path_index_builds);
+}
+
+/**
+ * Catalogs attached from now on get a path filter, which answers most of the
+ * lookups of paths that don't exist without a SQL query.
+ */
+template <class CatalogT>
+void AbstractCatalogManager<CatalogT>::EnablePathFilters() {
+  assert(catalogs_.empty() && (path_filter_counters_ == NULL));
+  path_filter_counters_ = new PathFilterCounters();
+  path_filter_counters_->n_rejects = statistics_.n_path_filter_rejects;
+  path_filter_counters_->n_false_positives =
+    statistics_.n_path_filter_false_positives;
+}
+
 template <class CatalogT>
 void AbstractCatalogManager<CatalogT>::CheckInodeWatermark() {
   if (inode_watermark_status_ > 0)
@@ -97,6 +148,7 @@ void AbstractCatalogManager<CatalogT>::CheckInodeWatermark() {
 template <class CatalogT>
 bool AbstractCatalogManager<CatalogT>::Init() {
   LogCvmfs(kLogCatalog, kLogDebug, "Initialize catalog");
+  MutexLockGuard m(lock_mount_);
   WriteLock();
   bool attached = MountCatalog(PathString("", 0), shash::Any(), NULL);
   Unlock();
@@ -121,6 +173,7 @@ LoadError AbstractCatalogManager<CatalogT>::Remount(const bool dry_run) {
   if (dry_run)
     return LoadCatalog(PathString("", 0), shash::Any(), NULL, NULL);
 
+  MutexLockGuard m(lock_mount_);
   WriteLock();
 
   string     catalog_path;
@@ -159,6 +212,7 @@ LoadError AbstractCatalogManager<CatalogT>::ChangeRoot(
   LogCvmfs(kLogCatalog, kLogDebug,
            "switching to root hash %s", root_hash.ToString().c_str());
 
+  MutexLockGuard m(lock_mount_);
   WriteLock();
 
   string     catalog_path;
@@ -193,6 +247,7 @@ LoadError AbstractCatalogManager<CatalogT>::ChangeRoot(
  */
 template <class CatalogT>
 void AbstractCatalogManager<CatalogT>::DetachNested() {
+  MutexLockGuard m(lock_mount_);
   WriteLock();
   if (catalogs_.empty()) {
     Unlock();
@@ -271,46 +326,25 @@ bool AbstractCatalogManager<CatalogT>::LookupPath(const PathString &path,
     LogCvmfs(kLogCatalog, kLogDebug, "looking up '%s' in a nested catalog",
              path.c_str());
     Unlock();
-    WriteLock();
-    // Check again to avoid race
-    best_fit = FindCatalog(path);
-    assert(best_fit != NULL);
-    perf::Inc(statistics_.n_lookup_path);
-    found = best_fit->LookupPath(path, dirent);
+    CatalogT *nested_catalog;
+    if (!MountNestedCatalogs(path, false /* is_listable */, &nested_catalog)) {
+      LogCvmfs(kLogCatalog, kLogDebug,
+               "failed to load nested catalog for '%s'", path.c_str());
+      // Not found due to I/O error, the lock is already released
+      perf::Inc(statistics_.n_lookup_path_negative);
+      return false;
+    }
 
+    perf::Inc(statistics_.n_lookup_path);
+    found = nested_catalog->LookupPath(path, dirent);
     if (!found) {
       LogCvmfs(kLogCatalog, kLogDebug,
-               "entry not found, we may have to load nested catalogs");
-
-      CatalogT *nested_catalog;
-      found =
-        MountSubtree(path, best_fit, false /* is_listable */, &nested_catalog);
-
-      if (!found) {
-        LogCvmfs(kLogCatalog, kLogDebug,
-                 "failed to load nested catalog for '%s'", path.c_str());
-        goto lookup_path_notfound;
-      }
-
-      if (nested_catalog != best_fit) {
-        perf::Inc(statistics_.n_lookup_path);
-        found = nested_catalog->LookupPath(path, dirent);
-        if (!found) {
-          LogCvmfs(kLogCatalog, kLogDebug,
-                   "nested catalogs loaded but entry '%s' was still not found",
-                   path.c_str());
-          if (dirent != NULL) *dirent = dirent_negative;
-          goto lookup_path_notfound;
-        } else {
-          best_fit = nested_catalog;
-        }
-      } else {
-        LogCvmfs(kLogCatalog, kLogDebug, "no nested catalog fits");
-        if (dirent != NULL) *dirent = dirent_negative;
-        goto lookup_path_notfound;
-      }
+               "nested catalogs loaded but entry '%s' was still not found",
+               path.c_str());
+      if (dirent != NULL) *dirent = dirent_negative;
+      goto lookup_path_notfound;
     }
-    assert(found);
+    best_fit = nested_catalog;
   }
   // Not in a nested catalog (because no nested cataog fits), ENOENT
   if (!found) {
@@ -340,6 +374,84 @@ bool AbstractCatalogManager<CatalogT>::LookupPath(const PathString &path,
 }
 
 
+template <class CatalogT>
+unsigned AbstractCatalogManager<CatalogT>::LookupPaths(
+  const std::vector<PathString> &paths,
+  const LookupOptions options,
+  std::vector<DirectoryEntry> *dirents,
+  std::vector<bool> *found)
+{
+  typedef std::map<CatalogT *, std::vector<unsigned> > CatalogGroups;
+
+  dirents->assign(paths.size(), DirectoryEntry());
+  found->assign(paths.size(), false);
+  perf::Inc(statistics_.n_lookup_path_batch);
+
+  EnforceSqliteMemLimit();
+  ReadLock();
+
+  CatalogGroups groups;
+  for (unsigned i = 0; i < paths.size(); ++i) {
+    CatalogT *best_fit = FindCatalog(paths[i]);
+    assert(best_fit != NULL);
+    groups[best_fit].push_back(i);
+  }
+
+  unsigned num_found = 0;
+  std::vector<unsigned> unresolved;
+  for (typename CatalogGroups::const_iterator i = groups.begin(),
+       iEnd = groups.end(); i != iEnd; ++i)
+  {
+    CatalogT *catalog = i->first;
+    const std::vector<unsigned> &indexes = i->second;
+    std::vector<PathString> catalog_paths;
+    catalog_paths.reserve(indexes.size());
+    for (unsigned j = 0; j < indexes.size(); ++j)
+      catalog_paths.push_back(paths[indexes[j]]);
+
+    std::vector<DirectoryEntry> catalog_dirents;
+    perf::Xadd(statistics_.n_lookup_path, indexes.size());
+    catalog->LookupPaths(catalog_paths, &catalog_dirents);
+
+    for (unsigned j = 0; j < indexes.size(); ++j) {
+      DirectoryEntry *dirent = &(*dirents)[indexes[j]];
+      if (catalog_dirents[j].IsNegative()) {
+        // Possibly in a nested catalog that is not yet mounted
+        if (MountSubtree(catalog_paths[j], catalog, false /* is_listable */,
+                         NULL))
+        {
+          unresolved.push_back(indexes[j]);
+          continue;
+        }
+        perf::Inc(statistics_.n_lookup_path_negative);
+      } else if (((options & kLookupRawSymlink) == kLookupRawSymlink) &&
+                 catalog_dirents[j].IsLink())
+      {
+        LinkString raw_symlink;
+        bool retval = catalog->LookupRawSymlink(catalog_paths[j], &raw_symlink);
+        assert(retval);  // Must be true, we have just found the entry
+        catalog_dirents[j].set_symlink(raw_symlink);
+      }
+      if (!catalog_dirents[j].IsNegative()) {
+        (*found)[indexes[j]] = true;
+        num_found++;
+      }
+      *dirent = catalog_dirents[j];
+    }
+  }
+  Unlock();
+
+  for (unsigned i = 0; i < unresolved.size(); ++i) {
+    const unsigned idx = unresolved[i];
+    if (LookupPath(paths[idx], options, &(*dirents)[idx])) {
+      (*found)[idx] = true;
+      num_found++;
+    }
+  }
+  return num_found;
+}
+
+
 /**
  * Perform a lookup for Nested Catalog that serves this path.
  *  If the path specified is a catalog mountpoint the catalog at that point is
@@ -372,14 +484,10 @@ bool AbstractCatalogManager<CatalogT>::LookupNested(
   CatalogT *catalog = best_fit;
   if (MountSubtree(catalog_path, best_fit, false /* is_listable */, NULL)) {
     Unlock();
-    WriteLock();
-    // Check again to avoid race
-    best_fit = FindCatalog(catalog_path);
     result =
-      MountSubtree(catalog_path, best_fit, false /* is_listable */, &catalog);
+      MountNestedCatalogs(catalog_path, false /* is_listable */, &catalog);
     // Result is false if an available catalog failed to load (error happened)
     if (!result) {
-      Unlock();
       return false;
     }
   }
@@ -435,13 +543,9 @@ bool AbstractCatalogManager<CatalogT>::ListCatalogSkein(
   // True if there is an available nested catalog
   if (MountSubtree(test, best_fit, false /* is_listable */, NULL)) {
     Unlock();
-    WriteLock();
-    // Check again to avoid race
-    best_fit = FindCatalog(test);
-    result = MountSubtree(test, best_fit, false /* is_listable */, &catalog);
+    result = MountNestedCatalogs(test, false /* is_listable */, &catalog);
     // result is false if an available catalog failed to load
     if (!result) {
-      Unlock();
       return false;
     }
   }
@@ -491,12 +595,8 @@ bool AbstractCatalogManager<CatalogT>::LookupXattrs(
   CatalogT *catalog = best_fit;
   if (MountSubtree(path, best_fit, false /* is_listable */, NULL)) {
     Unlock();
-    WriteLock();
-    // Check again to avoid race
-    best_fit = FindCatalog(path);
-    result = MountSubtree(path, best_fit, false /* is_listable */, &catalog);
+    result = MountNestedCatalogs(path, false /* is_listable */, &catalog);
     if (!result) {
-      Unlock();
       return false;
     }
   }
@@ -509,6 +609,38 @@ bool AbstractCatalogManager<CatalogT>::LookupXattrs(
 }
 
 
+/**
+ * Finds the content digest of the listing of the given directory.  For nested
+ * catalog mountpoints, the digest is taken from the root of the nested
+ * catalog.  Returns false if the catalog has no valid directory digests.
+ */
+template <class CatalogT>
+bool AbstractCatalogManager<CatalogT>::LookupDirectoryDigest(
+  const PathString &path,
+  shash::Any *digest)
+{
+  EnforceSqliteMemLimit();
+  bool result;
+  ReadLock();
+
+  // Find catalog, possibly load nested
+  CatalogT *best_fit = FindCatalog(path);
+  CatalogT *catalog = best_fit;
+  if (MountSubtree(path, best_fit, true /* is_listable */, NULL)) {
+    Unlock();
+    result = MountNestedCatalogs(path, true /* is_listable */, &catalog);
+    if (!result) {
+      return false;
+    }
+  }
+
+  result = catalog->LookupDirectoryDigest(path, digest);
+
+  Unlock();
+  return result;
+}
+
+
 /**
  * Do a listing of the specified directory.
  * @param path the path of the directory to list
@@ -529,12 +661,8 @@ bool AbstractCatalogManager<CatalogT>::Listing(const PathString &path,
   CatalogT *catalog = best_fit;
   if (MountSubtree(path, best_fit, true /* is_listable */, NULL)) {
     Unlock();
-    WriteLock();
-    // Check again to avoid race
-    best_fit = FindCatalog(path);
-    result = MountSubtree(path, best_fit, true /* is_listable */, &catalog);
+    result = MountNestedCatalogs(path, true /* is_listable */, &catalog);
     if (!result) {
-      Unlock();
       return false;
     }
   }
@@ -566,12 +694,8 @@ bool AbstractCatalogManager<CatalogT>::ListingStat(const PathString &path,
   CatalogT *catalog = best_fit;
   if (MountSubtree(path, best_fit, true /* is_listable */, NULL)) {
     Unlock();
-    WriteLock();
-    // Check again to avoid race
-    best_fit = FindCatalog(path);
-    result = MountSubtree(path, best_fit, true /* is_listable */, &catalog);
+    result = MountNestedCatalogs(path, true /* is_listable */, &catalog);
     if (!result) {
-      Unlock();
       return false;
     }
   }
@@ -606,12 +730,8 @@ bool AbstractCatalogManager<CatalogT>::ListFileChunks(
   CatalogT *catalog = best_fit;
   if (MountSubtree(path, best_fit, false /* is_listable */, NULL)) {
     Unlock();
-    WriteLock();
-    // Check again to avoid race
-    best_fit = FindCatalog(path);
-    result = MountSubtree(path, best_fit, false /* is_listable */, &catalog);
+    result = MountNestedCatalogs(path, false /* is_listable */, &catalog);
     if (!result) {
-      Unlock();
       return false;
     }
   }
@@ -642,14 +762,10 @@ catalog::Counters AbstractCatalogManager<CatalogT>::LookupCounters(
   CatalogT *catalog = best_fit;
   if (MountSubtree(catalog_path, best_fit, false /* is_listable */, NULL)) {
     Unlock();
-    WriteLock();
-    // Check again to avoid race
-    best_fit = FindCatalog(catalog_path);
     result =
-      MountSubtree(catalog_path, best_fit, false /* is_listable */, &catalog);
+      MountNestedCatalogs(catalog_path, false /* is_listable */, &catalog);
     // Result is false if an available catalog failed to load (error happened)
     if (!result) {
-      Unlock();
       *subcatalog_path = "error: failed to load catalog!";
       *hash = shash::Any();
       return catalog::Counters();
@@ -820,6 +936,165 @@ bool AbstractCatalogManager<CatalogT>::MountSubtree(
                      GetRootCatalog() : const_cast<CatalogT *>(entry_point);
   assert(path.StartsWith(parent->mountpoint()));
 
+  PathString mountpoint;
+  shash::Any hash;
+  if (FindNextNested(path, parent, is_listable, &mountpoint, &hash)) {
+    if (leaf_catalog == NULL)
+      return true;
+    CatalogT *new_nested;
+    LogCvmfs(kLogCatalog, kLogDebug, "load nested catalog at %s",
+             mountpoint.c_str());
+    // prevent endless recursion with corrupted catalogs
+    // (due to reloading root)
+    if (hash.IsNull())
+      return false;
+    new_nested = MountCatalog(mountpoint, hash, parent);
+    if (!new_nested)
+      return false;
+
+    result = MountSubtree(path, new_nested, is_listable, &parent);
+  }
+
+  if (leaf_catalog == NULL)
+    return false;
+  *leaf_catalog = parent;
+  return result;
+}
+
+
+/**
+ * Like MountSubtree() but for concurrent lookups: the nested catalogs are
+ * loaded while holding only lock_mount_, so that lookups in the attached
+ * catalogs can go on while a nested catalog is downloaded.  The write lock is
+ * only taken to attach a loaded catalog to the tree.  Must be called without
+ * holding the lock.  On success, returns with the read lock held and with
+ * leaf_catalog set to the catalog that serves path.  Returns false without
+ * holding the lock if an available catalog failed to load.
+ */
+template <class CatalogT>
+bool AbstractCatalogManager<CatalogT>::MountNestedCatalogs(
+  const PathString &path,
+  bool is_listable,
+  CatalogT **leaf_catalog)
+{
+  MutexLockGuard m(lock_mount_);
+  ReadLock();
+  CatalogT *parent = FindCatalog(path);
+  while (true) {
+    PathString mountpoint;
+    shash::Any hash;
+    if (!FindNextNested(path, parent, is_listable, &mountpoint, &hash)) {
+      *leaf_catalog = parent;
+      return true;
+    }
+    CatalogT *new_nested;
+    if (IsAttached(mountpoint, &new_nested)) {
+      parent = new_nested;
+      continue;
+    }
+    Catalog::NestedCatalogList siblings;
+    if (nested_prefetch_budget_ > 0)
+      FindPrefetchSiblings(parent, mountpoint, &siblings);
+    Unlock();
+    if (!siblings.empty())
+      PrefetchCatalogs(siblings);
+
+    LogCvmfs(kLogCatalog, kLogDebug, "load nested catalog at %s",
+             mountpoint.c_str());
+    // prevent endless recursion with corrupted catalogs
+    // (due to reloading root)
+    if (hash.IsNull())
+      return false;
+    // The catalog tree only changes under lock_mount_, so parent remains
+    // attached while the nested catalog is loaded and opened
+    string     catalog_path;
+    shash::Any catalog_hash;
+    const LoadError retval =
+      LoadCatalog(mountpoint, hash, &catalog_path, &catalog_hash);
+    if ((retval == kLoadFail) || (retval == kLoadNoSpace)) {
+      LogCvmfs(kLogCatalog, kLogDebug, "failed to load catalog '%s' (%d - %s)",
+               mountpoint.c_str(), retval, Code2Ascii(retval));
+      return false;
+    }
+    new_nested = CreateCatalog(mountpoint, catalog_hash, parent);
+    CatalogList unlinked;
+    bool linked = PrepareCatalog(catalog_path, new_nested);
+    if (linked) {
+      WriteLock();
+      linked = LinkCatalog(new_nested);
+      if (linked && (catalog_watermark_ > 0) &&
+          (catalogs_.size() >= catalog_watermark_))
+      {
+        DetachSiblings(mountpoint, &unlinked);
+      }
+      Unlock();
+    }
+    if (!linked) {
+      LogCvmfs(kLogCatalog, kLogDebug, "failed to attach catalog '%s'",
+               mountpoint.c_str());
+      unlinked.push_back(new_nested);
+    }
+    UnloadCatalogs(unlinked);
+    if (!linked)
+      return false;
+    ReadLock();
+    parent = new_nested;
+  }
+}
+
+
+/**
+ * Collects up to nested_prefetch_budget_ nested catalogs of parent, other than
+ * the one at mountpoint, that are not yet attached.  Starts with the catalogs
+ * that are listed after mountpoint because a traversal of the directory tree
+ * is likely to need those next.
+ */
+template <class CatalogT>
+void AbstractCatalogManager<CatalogT>::FindPrefetchSiblings(
+  const CatalogT *parent,
+  const PathString &mountpoint,
+  Catalog::NestedCatalogList *siblings)
+{
+  typedef typename CatalogT::NestedCatalogList NestedCatalogList;
+  const NestedCatalogList &nested_catalogs = parent->ListNestedCatalogs();
+  const unsigned num_nested = nested_catalogs.size();
+  unsigned idx_mountpoint = 0;
+  while ((idx_mountpoint < num_nested) &&
+         (nested_catalogs[idx_mountpoint].mountpoint != mountpoint))
+  {
+    idx_mountpoint++;
+  }
+  for (unsigned i = 1; i < num_nested; ++i) {
+    if (siblings->size() >= nested_prefetch_budget_)
+      break;
+    const unsigned idx = (idx_mountpoint + i) % num_nested;
+    if (nested_catalogs[idx].hash.IsNull() ||
+        IsAttached(nested_catalogs[idx].mountpoint, NULL))
+    {
+      continue;
+    }
+    Catalog::NestedCatalog sibling;
+    sibling.mountpoint = nested_catalogs[idx].mountpoint;
+    sibling.hash = nested_catalogs[idx].hash;
+    sibling.size = nested_catalogs[idx].size;
+    siblings->push_back(sibling);
+  }
+}
+
+
+/**
+ * Finds the nested catalog of parent that needs to be mounted next in order to
+ * serve path.  The is_listable parameter has the same meaning as for
+ * MountSubtree().  Returns false if path is served by parent.
+ */
+template <class CatalogT>
+bool AbstractCatalogManager<CatalogT>::FindNextNested(
+  const PathString &path,
+  const CatalogT *parent,
+  bool is_listable,
+  PathString *mountpoint,
+  shash::Any *hash)
+{
   unsigned path_len = path.GetLength();
 
   // Try to find path as a super string of nested catalog mount points
@@ -841,30 +1116,14 @@ bool AbstractCatalogManager<CatalogT>::MountSubtree(
 
       // Found a nested catalog transition point
       if (!is_listable && (path_len == mountpoint_len))
-        break;
-
-      if (leaf_catalog == NULL)
-        return true;
-      CatalogT *new_nested;
-      LogCvmfs(kLogCatalog, kLogDebug, "load nested catalog at %s",
-               i->mountpoint.c_str());
-      // prevent endless recursion with corrupted catalogs
-      // (due to reloading root)
-      if (i->hash.IsNull())
-        return false;
-      new_nested = MountCatalog(i->mountpoint, i->hash, parent);
-      if (!new_nested)
         return false;
 
-      result = MountSubtree(path, new_nested, is_listable, &parent);
-      break;
+      *mountpoint = i->mountpoint;
+      *hash = i->hash;
+      return true;
     }
   }
-
-  if (leaf_catalog == NULL)
-    return false;
-  *leaf_catalog = parent;
-  return result;
+  return false;
 }
 
 
@@ -892,18 +1151,37 @@ CatalogT *AbstractCatalogManager<CatalogT>::MountCatalog(
     return NULL;
   }
 
-  attached_catalog = CreateCatalog(mountpoint, catalog_hash, parent_catalog);
+  return AttachLoadedCatalog(mountpoint, catalog_path, catalog_hash,
+                             parent_catalog);
+}
+
+
+/**
+ * Creates and attaches a catalog that has been loaded by LoadCatalog().
+ * Requires the write lock.
+ */
+template <class CatalogT>
+CatalogT *AbstractCatalogManager<CatalogT>::AttachLoadedCatalog(
+  const PathString &mountpoint,
+  const string &catalog_path,
+  const shash::Any &catalog_hash,
+  CatalogT *parent_catalog)
+{
+  CatalogT *attached_catalog =
+    CreateCatalog(mountpoint, catalog_hash, parent_catalog);
 
   // Attach loaded catalog
   if (!AttachCatalog(catalog_path, attached_catalog)) {
     LogCvmfs(kLogCatalog, kLogDebug, "failed to attach catalog '%s'",
              mountpoint.c_str());
-    UnloadCatalog(attached_catalog);
+    UnloadCatalogs(CatalogList(1, attached_catalog));
     return NULL;
   }
 
   if ((catalog_watermark_ > 0) && (catalogs_.size() >= catalog_watermark_)) {
-    DetachSiblings(mountpoint);
+    CatalogList unlinked;
+    DetachSiblings(mountpoint, &unlinked);
+    UnloadCatalogs(unlinked);
   }
 
   return attached_catalog;
@@ -942,23 +1220,50 @@ CatalogT *AbstractCatalogManager<CatalogT>::LoadFreeCatalog(
 template <class CatalogT>
 bool AbstractCatalogManager<CatalogT>::AttachCatalog(const string &db_path,
                                            CatalogT *new_catalog)
+{
+  return PrepareCatalog(db_path, new_catalog) && LinkCatalog(new_catalog);
+}
+
+
+/**
+ * Opens the database of a newly created catalog and builds its in-memory
+ * structures.  The catalog is not yet visible to lookups, so this does not
+ * require the write lock.  Callers that are not holding the write lock must
+ * hold lock_mount_.
+ */
+template <class CatalogT>
+bool AbstractCatalogManager<CatalogT>::PrepareCatalog(const string &db_path,
+                                                      CatalogT *new_catalog)
 {
   LogCvmfs(kLogCatalog, kLogDebug, "attaching catalog file %s",
            db_path.c_str());
 
   // Initialize the new catalog
-  if (!new_catalog->OpenDatabase(db_path)) {
+  if (!new_catalog->OpenDatabaseUnlinked(db_path)) {
     LogCvmfs(kLogCatalog, kLogDebug, "initialization of catalog %s failed",
              db_path.c_str());
     return false;
   }
 
+  new_catalog->SetInodeAnnotation(inode_annotation_);
+  new_catalog->SetOwnerMaps(&uid_map_, &gid_map_);
+  if (path_index_budget_ != NULL)
+    new_catalog->SetPathIndexBudget(path_index_budget_);
+  if (path_filter_counters_ != NULL)
+    new_catalog->EnablePathFilter(path_filter_counters_);
+  return true;
+}
+
+
+/**
+ * Adds a prepared catalog to the catalog tree.  Requires the write lock.
+ */
+template <class CatalogT>
+bool AbstractCatalogManager<CatalogT>::LinkCatalog(CatalogT *new_catalog) {
   // Determine the inode offset of this catalog
   uint64_t inode_chunk_size = new_catalog->max_row_id();
   InodeRange range = AcquireInodes(inode_chunk_size);
   new_catalog->set_inode_range(range);
-  new_catalog->SetInodeAnnotation(inode_annotation_);
-  new_catalog->SetOwnerMaps(&uid_map_, &gid_map_);
 
   // Add catalog to the manager
   if (!new_catalog->IsInitialized()) {
@@ -977,6 +1282,7 @@ bool AbstractCatalogManager<CatalogT>::AttachCatalog(const string &db_path,
     volatile_flag_ = new_catalog->volatile_flag();
   }
 
+  new_catalog->LinkToParent();
   catalogs_.push_back(new_catalog);
   ActivateCatalog(new_catalog);
   return true;
@@ -993,24 +1299,9 @@ bool AbstractCatalogManager<CatalogT>::AttachCatalog(const string &db_path,
  */
 template <class CatalogT>
 void AbstractCatalogManager<CatalogT>::DetachCatalog(CatalogT *catalog) {
-  if (catalog->HasParent())
-    catalog->parent()->RemoveChild(catalog);
-
-  ReleaseInodes(catalog->inode_range());
+  UnlinkCatalog(catalog);
   UnloadCatalog(catalog);
-
-  // Delete catalog from internal lists
-  typename CatalogList::iterator i;
-  typename CatalogList::const_iterator iend;
-  for (i = catalogs_.begin(), iend = catalogs_.end(); i != iend; ++i) {
-    if (*i == catalog) {
-      catalogs_.erase(i);
-      delete catalog;
-      return;
-    }
-  }
-
-  assert(false);
+  delete catalog;
 }
 
 
@@ -1022,27 +1313,21 @@ void AbstractCatalogManager<CatalogT>::DetachCatalog(CatalogT *catalog) {
  */
 template <class CatalogT>
 void AbstractCatalogManager<CatalogT>::DetachSubtree(CatalogT *catalog) {
-  // Detach all child catalogs recursively
-  typename CatalogList::const_iterator i;
-  typename CatalogList::const_iterator iend;
-  CatalogList catalogs_to_detach = catalog->GetChildren();
-  for (i = catalogs_to_detach.begin(), iend = catalogs_to_detach.end();
-       i != iend; ++i)
-  {
-    DetachSubtree(*i);
-  }
-
-  DetachCatalog(catalog);
+  CatalogList unlinked;
+  UnlinkSubtree(catalog, &unlinked);
+  UnloadCatalogs(unlinked);
 }
 
 
 /**
- * Detaches all nested catalogs that are not on a prefix of the given tree.
- * Used when the catalog_watermark_ is surpassed.
+ * Unlinks all nested catalogs that are not on a prefix of the given tree.
+ * Used when the catalog_watermark_ is surpassed.  The caller unloads the
+ * unlinked catalogs, if possible after releasing the write lock.
  */
 template <class CatalogT>
 void AbstractCatalogManager<CatalogT>::DetachSiblings(
-  const PathString &current_tree)
+  const PathString &current_tree,
+  CatalogList *unlinked)
 {
   bool again;
   do {
@@ -1053,7 +1338,7 @@ void AbstractCatalogManager<CatalogT>::DetachSiblings(
                      catalogs_[i]->mountpoint().ToString(),
                      false /* ignore_case */))
       {
-        DetachSubtree(catalogs_[i]);
+        UnlinkSubtree(catalogs_[i], unlinked);
         again = true;
         break;
       }
@@ -1063,6 +1348,67 @@ void AbstractCatalogManager<CatalogT>::DetachSiblings(
 }
 
 
+/**
+ * Removes a catalog from the catalog tree and from the list of attached
+ * catalogs without unloading it.  Requires the write lock.
+ */
+template <class CatalogT>
+void AbstractCatalogManager<CatalogT>::UnlinkCatalog(CatalogT *catalog) {
+  if (catalog->HasParent())
+    catalog->parent()->RemoveChild(catalog);
+
+  ReleaseInodes(catalog->inode_range());
+
+  // Delete catalog from internal lists
+  typename CatalogList::iterator i;
+  typename CatalogList::const_iterator iend;
+  for (i = catalogs_.begin(), iend = catalogs_.end(); i != iend; ++i) {
+    if (*i == catalog) {
+      catalogs_.erase(i);
+      return;
+    }
+  }
+
+  assert(false);
+}
+
+
+/**
+ * Unlinks a catalog and all of its children.  The catalogs are appended to
+ * unlinked, children first.  Requires the write lock.
+ */
+template <class CatalogT>
+void AbstractCatalogManager<CatalogT>::UnlinkSubtree(
+  CatalogT *catalog,
+  CatalogList *unlinked)
+{
+  CatalogList children = catalog->GetChildren();
+  for (typename CatalogList::const_iterator i = children.begin(),
+       iEnd = children.end(); i != iEnd; ++i)
+  {
+    UnlinkSubtree(*i, unlinked);
+  }
+  UnlinkCatalog(catalog);
+  unlinked->push_back(catalog);
+}
+
+
+/**
+ * Unloads and frees catalogs that are not part of the catalog tree, i.e. that
+ * were unlinked or never linked.  Does not require the write lock but callers
+ * that are not holding it must hold lock_mount_.
+ */
+template <class CatalogT>
+void AbstractCatalogManager<CatalogT>::UnloadCatalogs(
+  const CatalogList &catalogs)
+{
+  for (unsigned i = 0; i < catalogs.size(); ++i) {
+    UnloadCatalog(catalogs[i]);
+    delete catalogs[i];
+  }
+}
+
+
 /**
  * Formats the catalog hierarchy
  */
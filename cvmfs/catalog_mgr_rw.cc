@@ -49,6 +49,7 @@ WritableCatalogManager::WritableCatalogManager(
   , nested_kcatalog_limit_(nested_kcatalog_limit)
   , root_kcatalog_limit_(root_kcatalog_limit)
   , file_mbyte_limit_(file_mbyte_limit)
+  , directory_digests_(false)
   , is_balanceable_(is_balanceable)
   , max_weight_(max_weight)
   , min_weight_(min_weight)
@@ -1159,6 +1160,8 @@ void WritableCatalogManager::FinalizeCatalog(WritableCatalog *catalog,
   catalog->UpdateCounters();
   catalog->UpdateLastModified();
   catalog->IncrementRevision();
+  if (directory_digests_)
+    catalog->UpdateDirectoryDigests();
 
   // update the previous catalog revision pointer
   if (catalog->IsRoot()) {
@@ -141,6 +141,11 @@ class WritableCatalogManager : public SimpleCatalogManager {
 
   void SetTTL(const uint64_t new_ttl);
   bool SetVOMSAuthz(const std::string &voms_authz);
+  /**
+   * Maintain the directory digests of the catalogs on commit, which lets
+   * CatalogDiffTool skip unchanged subtrees
+   */
+  void SetDirectoryDigests(const bool value) { directory_digests_ = value; }
   bool Commit(const bool           stop_for_tweaks,
               const uint64_t       manual_revision,
               manifest::Manifest  *manifest);
@@ -240,6 +245,8 @@ class WritableCatalogManager : public SimpleCatalogManager {
   unsigned root_kcatalog_limit_;
   unsigned file_mbyte_limit_;
 
+  bool directory_digests_;
+
   /**
    * Directories don't have extended attributes at this point.
    */
@@ -0,0 +1,101 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include "cvmfs_config.h"
+#include "catalog_revision_diff.h"
+
+#include <algorithm>
+#include <cassert>
+#include <set>
+
+#include "catalog.h"
+#include "catalog_sql.h"
+#include "directory_entry.h"
+#include "util/pointer.h"
+
+using namespace std;  // NOLINT
+
+namespace catalog {
+
+void RevisionDiff::AddCatalogs(
+  const Catalog *old_catalog,
+  const Catalog *new_catalog)
+{
+  assert((old_catalog != NULL) || (new_catalog != NULL));
+  num_diffed_catalogs_++;
+
+  UniquePtr<SqlAllDirentsByPathHash> sql_old;
+  UniquePtr<SqlAllDirentsByPathHash> sql_new;
+  bool has_old = false;
+  bool has_new = false;
+  if (old_catalog != NULL) {
+    sql_old = new SqlAllDirentsByPathHash(old_catalog->database());
+    has_old = sql_old->FetchRow();
+  }
+  if (new_catalog != NULL) {
+    sql_new = new SqlAllDirentsByPathHash(new_catalog->database());
+    has_new = sql_new->FetchRow();
+  }
+
+  while (has_old || has_new) {
+    int cmp;
+    if (!has_new)
+      cmp = -1;
+    else if (!has_old)
+      cmp = 1;
+    else
+      cmp = sql_old->ComparePathHash(*sql_new);
+
+    if (cmp < 0) {
+      paths_.push_back(sql_old->GetPathHash());
+      paths_.push_back(sql_old->GetParentPathHash());
+      has_old = sql_old->FetchRow();
+    } else if (cmp > 0) {
+      paths_.push_back(sql_new->GetPathHash());
+      paths_.push_back(sql_new->GetParentPathHash());
+      has_new = sql_new->FetchRow();
+    } else {
+      const DirectoryEntry old_dirent = sql_old->GetDirent(old_catalog, false);
+      const DirectoryEntry new_dirent = sql_new->GetDirent(new_catalog, false);
+      if ((old_dirent.CompareTo(new_dirent) !=
+           DirectoryEntry::Difference::kIdentical) ||
+          (old_dirent.uid() != new_dirent.uid()) ||
+          (old_dirent.gid() != new_dirent.gid()) ||
+          (old_dirent.compression_algorithm() !=
+           new_dirent.compression_algorithm()))
+      {
+        paths_.push_back(sql_old->GetPathHash());
+      }
+      has_old = sql_old->FetchRow();
+      has_new = sql_new->FetchRow();
+    }
+  }
+
+  if ((old_catalog != NULL) && (new_catalog != NULL)) {
+    set<PathString> old_nested;
+    const Catalog::NestedCatalogList old_list =
+      old_catalog->ListOwnNestedCatalogs();
+    for (unsigned i = 0; i < old_list.size(); ++i)
+      old_nested.insert(old_list[i].mountpoint);
+    const Catalog::NestedCatalogList new_list =
+      new_catalog->ListOwnNestedCatalogs();
+    for (unsigned i = 0; i < new_list.size(); ++i) {
+      if (old_nested.find(new_list[i].mountpoint) == old_nested.end())
+        has_new_nested_catalogs_ = true;
+    }
+  }
+}
+
+
+bool RevisionDiff::Contains(const shash::Md5 &md5path) const {
+  return binary_search(paths_.begin(), paths_.end(), md5path);
+}
+
+
+void RevisionDiff::Finalize() {
+  sort(paths_.begin(), paths_.end());
+  paths_.erase(unique(paths_.begin(), paths_.end()), paths_.end());
+}
+
+}  // namespace catalog
@@ -0,0 +1,74 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#ifndef CVMFS_CATALOG_REVISION_DIFF_H_
+#define CVMFS_CATALOG_REVISION_DIFF_H_
+
+#include <map>
+#include <vector>
+
+#include "crypto/hash.h"
+#include "shortstring.h"
+
+namespace catalog {
+
+class Catalog;
+
+/**
+ * The set of paths whose directory entries differ between the catalogs of the
+ * mounted revision and the catalogs of a new revision.  Paths are identified
+ * by their MD5 sum, just like in the md5path cache.  On remount, the client
+ * compares only the catalogs that could have contributed entries to the
+ * meta-data caches (see ClientCatalogManager::DiffRevision()).  Cache entries
+ * of paths that are not part of the diff remain valid in the new revision.
+ *
+ * Removed and added entries also mark their parent directory as changed.
+ */
+class RevisionDiff {
+ public:
+  RevisionDiff() : num_diffed_catalogs_(0), has_new_nested_catalogs_(false) { }
+
+  /**
+   * Compares two revisions of the catalog at the same mount point entry by
+   * entry.  One of the catalogs can be NULL if the catalog exists only in one
+   * of the revisions, in which case all of the entries of the other catalog
+   * are considered changed.
+   */
+  void AddCatalogs(const Catalog *old_catalog, const Catalog *new_catalog);
+  /**
+   * Needs to be called after the last AddCatalogs() and before Contains()
+   */
+  void Finalize();
+  bool Contains(const shash::Md5 &md5path) const;
+
+  void set_root_hash(const shash::Any &root_hash) { root_hash_ = root_hash; }
+  shash::Any root_hash() const { return root_hash_; }
+  /**
+   * Mount point and hash of the catalogs of the mounted revision that are
+   * covered by the diff
+   */
+  std::map<PathString, shash::Any> *catalogs() { return &catalogs_; }
+  size_t num_paths() const { return paths_.size(); }
+  unsigned num_diffed_catalogs() const { return num_diffed_catalogs_; }
+  /**
+   * A new nested catalog below a changed catalog can contain paths that
+   * were looked up in the old revision without being found.  Such paths are
+   * not part of the diff, so that negative cache entries cannot be kept.
+   */
+  bool has_new_nested_catalogs() const { return has_new_nested_catalogs_; }
+
+ private:
+  shash::Any root_hash_;
+  std::map<PathString, shash::Any> catalogs_;
+  /**
+   * Sorted by Finalize()
+   */
+  std::vector<shash::Md5> paths_;
+  unsigned num_diffed_catalogs_;
+  bool has_new_nested_catalogs_;
+};
+
+}  // namespace catalog
+
+#endif  // CVMFS_CATALOG_REVISION_DIFF_H_
@@ -7,12 +7,15 @@
 #include "catalog_rw.h"
 
 #include <inttypes.h>
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
+#include <utility>
 
 #include "util/concurrency.h"
 #include "util/exception.h"
 #include "util/logging.h"
+#include "util/string.h"
 #include "xattr.h"
 
 using namespace std;  // NOLINT
@@ -40,7 +43,10 @@ WritableCatalog::WritableCatalog(const string      &path,
   sql_chunks_count_(NULL),
   sql_max_link_id_(NULL),
   sql_inc_linkcount_(NULL),
-  dirty_(false)
+  sql_digest_insert_(NULL),
+  sql_digest_remove_(NULL),
+  dirty_(false),
+  rebuild_directory_digests_(false)
 {
   atomic_init32(&dirty_children_);
 }
@@ -100,6 +106,12 @@ void WritableCatalog::InitPreparedStatements() {
   sql_chunks_count_  = new SqlChunksCount      (database());
   sql_max_link_id_   = new SqlMaxHardlinkGroup (database());
   sql_inc_linkcount_ = new SqlIncLinkcount     (database());
+  if (database().IsEqualSchema(database().schema_version(), 2.5) &&
+      (database().schema_revision() >= 7))
+  {
+    sql_digest_insert_ = new SqlDirectoryDigestInsert(database());
+    sql_digest_remove_ = new SqlDirectoryDigestRemove(database());
+  }
 }
 
 
@@ -115,6 +127,8 @@ void WritableCatalog::FinalizePreparedStatements() {
   delete sql_chunks_count_;
   delete sql_max_link_id_;
   delete sql_inc_linkcount_;
+  delete sql_digest_insert_;
+  delete sql_digest_remove_;
 }
 
 
@@ -146,6 +160,9 @@ void WritableCatalog::AddEntry(
   const string &parent_path)
 {
   SetDirty();
+  MarkDirectoryDirty(parent_path);
+  if (entry.IsDirectory())
+    MarkDirectoryDirty(entry_path);
 
   LogCvmfs(kLogCatalog, kLogVerboseMsg, "add entry '%s' to '%s'",
                                         entry_path.c_str(),
@@ -187,6 +204,9 @@ void WritableCatalog::RemoveEntry(const string &file_path) {
   assert(retval);
 
   SetDirty();
+  MarkDirectoryDirty(GetParentPath(file_path));
+  if (entry.IsDirectory())
+    MarkDirectoryDirty(file_path);
 
   // If the entry used to be a chunked file... remove the chunks
   if (entry.IsChunkedFile()) {
@@ -209,6 +229,7 @@ void WritableCatalog::IncLinkcount(const string &path_within_group,
                                    const int delta)
 {
   SetDirty();
+  MarkDirectoryDirty(GetParentPath(path_within_group));
 
   shash::Md5 path_hash = shash::Md5(shash::AsciiPtr(path_within_group));
 
@@ -264,6 +285,7 @@ void WritableCatalog::UpdateEntry(const DirectoryEntry &entry,
 void WritableCatalog::AddFileChunk(const std::string &entry_path,
                                    const FileChunk &chunk) {
   SetDirty();
+  MarkDirectoryDirty(GetParentPath(entry_path));
 
   shash::Md5 path_hash((shash::AsciiPtr(entry_path)));
 
@@ -292,6 +314,8 @@ void WritableCatalog::RemoveFileChunks(const std::string &entry_path) {
   shash::Md5 path_hash((shash::AsciiPtr(entry_path)));
   bool retval;
 
+  MarkDirectoryDirty(GetParentPath(entry_path));
+
   // subtract the number of chunks from the statistics counters
   retval =
     sql_chunks_count_->BindPathHash(path_hash)  &&
@@ -522,6 +546,7 @@ void WritableCatalog::InsertNestedCatalog(const string &mountpoint,
     AddChild(attached_reference);
 
   ResetNestedCatalogCacheUnprotected();
+  MarkDirectoryDirty(GetParentPath(mountpoint));
 
   delta_counters_.self.nested_catalogs++;
 }
@@ -546,6 +571,7 @@ void WritableCatalog::InsertBindMountpoint(
      stmt.BindInt64(3, size) &&
      stmt.Execute();
   assert(retval);
+  MarkDirectoryDirty(GetParentPath(mountpoint));
 }
 
 
@@ -584,6 +610,7 @@ void WritableCatalog::RemoveNestedCatalog(const string &mountpoint,
     *attached_reference = child;
 
   ResetNestedCatalogCacheUnprotected();
+  MarkDirectoryDirty(GetParentPath(mountpoint));
 
   delta_counters_.self.nested_catalogs--;
 }
@@ -607,6 +634,7 @@ void WritableCatalog::RemoveBindMountpoint(const std::string &mountpoint) {
     stmt.BindText(1, mountpoint) &&
     stmt.Execute();
   assert(retval);
+  MarkDirectoryDirty(GetParentPath(mountpoint));
 }
 
 
@@ -623,6 +651,7 @@ void WritableCatalog::UpdateNestedCatalog(const std::string   &path,
                                           const DeltaCounters &child_counters) {
   MutexLockGuard guard(lock_);
   SetDirty();
+  MarkDirectoryDirty(GetParentPath(path));
 
   child_counters.PopulateToParent(&delta_counters_);
 
@@ -742,6 +771,8 @@ void WritableCatalog::CopyToParent() {
   retval = SqlCatalog(database(), "DETACH other;").Execute();
   assert(retval);
   parent->SetDirty();
+  // The copied directories are not tracked individually
+  parent->rebuild_directory_digests_ = true;
 
   // Change the just copied nested catalog root to an ordinary directory
   // (the nested catalog is merged into it's parent)
@@ -769,6 +800,183 @@ void WritableCatalog::UpdateCounters() {
 }
 
 
+/**
+ * Remembers that the listing of the given directory changed.  The parent
+ * directories up to the catalog root are marked, too, because their digests
+ * depend on the digests of their subdirectories.  Directories outside the
+ * catalog (e.g. the parent of the nested catalog root) are ignored.
+ */
+void WritableCatalog::MarkDirectoryDirty(const string &directory) {
+  if (sql_digest_insert_ == NULL)
+    return;
+
+  const string root_path = mountpoint().ToString();
+  string path = directory;
+  while ((path == root_path) || HasPrefix(path, root_path + "/", false)) {
+    // Parent directories have been marked before
+    if (!dirty_directories_.insert(path).second)
+      return;
+    if (path == root_path)
+      return;
+    path = GetParentPath(path);
+  }
+}
+
+
+static bool IsSmallerName(const DirectoryEntry &a, const DirectoryEntry &b) {
+  return a.name() < b.name();
+}
+
+
+/**
+ * Computes and stores the digest of the given directory.  The digest covers
+ * the sorted listing of the directory including the metadata of all entries,
+ * the digests of the subdirectories, and the content hashes of nested
+ * catalogs.  Two directories with the same digest have the same subtree.
+ * @param directory the directory to digest
+ * @param recursive if true, the subdirectories are digested, too.  Otherwise
+ *        their stored digests are used.
+ */
+shash::Any WritableCatalog::ComputeDirectoryDigest(const string &directory,
+                                                   const bool recursive)
+{
+  DirectoryEntryList listing;
+  const bool resolve_magic_symlinks = false;
+  bool retval = ListingPath(PathString(directory), &listing,
+                            resolve_magic_symlinks);
+  assert(retval);
+  std::sort(listing.begin(), listing.end(), IsSmallerName);
+
+  string record;
+  for (DirectoryEntryList::const_iterator i = listing.begin(),
+       iEnd = listing.end(); i != iEnd; ++i)
+  {
+    const string full_path = i->GetFullPath(directory);
+    record += i->name().ToString() + '\0' +
+      StringifyInt(i->mode()) + '\0' +
+      StringifyInt(i->size()) + '\0' +
+      StringifyInt(i->mtime()) + '\0' +
+      StringifyInt(i->uid()) + '\0' +
+      StringifyInt(i->gid()) + '\0' +
+      StringifyInt(i->linkcount()) + '\0' +
+      StringifyInt(i->hardlink_group()) + '\0' +
+      StringifyInt(i->compression_algorithm()) + '\0' +
+      (i->IsNestedCatalogMountpoint() ? "M" : "") +
+      (i->IsBindMountpoint() ? "B" : "") +
+      (i->IsChunkedFile() ? "C" : "") +
+      (i->IsExternalFile() ? "E" : "") +
+      (i->IsDirectIo() ? "D" : "") +
+      (i->IsHidden() ? "H" : "") + '\0' +
+      i->symlink().ToString() + '\0' +
+      i->checksum().ToString() + '\0';
+
+    if (i->IsNestedCatalogMountpoint() || i->IsBindMountpoint()) {
+      shash::Any nested_hash;
+      uint64_t nested_size;
+      if (FindNested(PathString(full_path), &nested_hash, &nested_size))
+        record += nested_hash.ToString();
+    } else if (i->IsDirectory()) {
+      shash::Any subdir_digest;
+      if (recursive ||
+          !LookupDirectoryDigestMd5(shash::Md5(shash::AsciiPtr(full_path)),
+                                    &subdir_digest))
+      {
+        subdir_digest = ComputeDirectoryDigest(full_path, recursive);
+      }
+      record += subdir_digest.ToString();
+    }
+    record += '\0';
+
+    if (i->HasXattrs()) {
+      XattrList xattrs;
+      retval = LookupXattrsPath(PathString(full_path), &xattrs);
+      assert(retval);
+      unsigned char *buffer;
+      unsigned size;
+      xattrs.Serialize(&buffer, &size);
+      record.append(reinterpret_cast<char *>(buffer), size);
+      free(buffer);
+    }
+    record += '\n';
+  }
+
+  shash::Any digest(kDirectoryDigestAlgorithm);
+  shash::HashMem(reinterpret_cast<const unsigned char *>(record.data()),
+                 record.length(), &digest);
+
+  retval =
+    sql_digest_insert_->BindPathHash(shash::Md5(shash::AsciiPtr(directory))) &&
+    sql_digest_insert_->BindDigest(digest) &&
+    sql_digest_insert_->Execute();
+  assert(retval);
+  sql_digest_insert_->Reset();
+
+  return digest;
+}
+
+
+/**
+ * Brings the directory digests up to date with the current revision of the
+ * catalog.  If the digests were valid when the catalog was opened, only the
+ * changed directories and their parents are digested again.  Otherwise the
+ * digests of all directories are computed from scratch.  Needs to be called
+ * after the revision is incremented.
+ */
+void WritableCatalog::UpdateDirectoryDigests() {
+  if (sql_digest_insert_ == NULL) {
+    LogCvmfs(kLogCatalog, kLogStderr, "WARNING: catalog schema of '%s' does "
+             "not support directory digests", mountpoint().c_str());
+    return;
+  }
+
+  SetDirty();
+  const string root_path = mountpoint().ToString();
+  bool retval;
+  if (!HasDirectoryDigests() || rebuild_directory_digests_) {
+    LogCvmfs(kLogCatalog, kLogVerboseMsg, "computing all directory digests "
+             "of '%s'", root_path.c_str());
+    retval = SqlCatalog(database(), "DELETE FROM directory_digests;").Execute();
+    assert(retval);
+    ComputeDirectoryDigest(root_path, true);
+  } else {
+    LogCvmfs(kLogCatalog, kLogVerboseMsg, "updating %u directory digests "
+             "of '%s'", static_cast<unsigned>(dirty_directories_.size()),
+             root_path.c_str());
+    // Subdirectories have longer paths than their parents and are digested
+    // first
+    std::vector<std::pair<size_t, string> > directories;
+    for (std::set<string>::const_iterator i = dirty_directories_.begin(),
+         iEnd = dirty_directories_.end(); i != iEnd; ++i)
+    {
+      directories.push_back(std::make_pair(i->length(), *i));
+    }
+    std::sort(directories.rbegin(), directories.rend());
+
+    for (unsigned i = 0; i < directories.size(); ++i) {
+      const string &path = directories[i].second;
+      DirectoryEntry dirent;
+      if (LookupPath(PathString(path), &dirent) && dirent.IsDirectory() &&
+          ((path == root_path) || !dirent.IsNestedCatalogMountpoint()))
+      {
+        ComputeDirectoryDigest(path, false);
+        continue;
+      }
+      // Removed or moved into a nested catalog
+      retval =
+        sql_digest_remove_->BindPathHash(shash::Md5(shash::AsciiPtr(path))) &&
+        sql_digest_remove_->Execute();
+      assert(retval);
+      sql_digest_remove_->Reset();
+    }
+  }
+
+  dirty_directories_.clear();
+  rebuild_directory_digests_ = false;
+  database().SetProperty("directory_digests_revision", GetRevision());
+  set_has_directory_digests(true);
+}
+
+
 /**
  * Checks if the database of this catalogs needs cleanup and defragments it
  * if necessary
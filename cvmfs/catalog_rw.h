@@ -17,6 +17,7 @@
 
 #include <stdint.h>
 
+#include <set>
 #include <string>
 #include <vector>
 
@@ -70,6 +71,7 @@ class WritableCatalog : public Catalog {
     const XattrList &xattrs,
     const std::string &path)
   {
+    MarkDirectoryDirty(GetParentPath(path));
     TouchEntry(entry, xattrs, shash::Md5(shash::AsciiPtr(path)));
   }
   void RemoveEntry(const std::string &entry_path);
@@ -105,6 +107,7 @@ class WritableCatalog : public Catalog {
   void SetPreviousRevision(const shash::Any &hash);
   void SetTTL(const uint64_t new_ttl);
   bool SetVOMSAuthz(const std::string &voms_authz);
+  void UpdateDirectoryDigests();
 
  protected:
   static const double kMaximalFreePageRatio;  // = 0.2
@@ -119,6 +122,7 @@ class WritableCatalog : public Catalog {
     const DirectoryEntry &entry,
     const std::string &path)
   {
+    MarkDirectoryDirty(GetParentPath(path));
     UpdateEntry(entry, shash::Md5(shash::AsciiPtr(path)));
   }
 
@@ -157,9 +161,23 @@ class WritableCatalog : public Catalog {
   SqlChunksCount      *sql_chunks_count_;
   SqlMaxHardlinkGroup *sql_max_link_id_;
   SqlIncLinkcount     *sql_inc_linkcount_;
+  SqlDirectoryDigestInsert *sql_digest_insert_;
+  SqlDirectoryDigestRemove *sql_digest_remove_;
 
   bool dirty_;  /**< Indicates if the catalog has been changed */
 
+  /**
+   * Directories whose listing changed since the catalog was opened, together
+   * with all their parent directories up to the catalog root.  Used to update
+   * the directory digests incrementally.
+   */
+  std::set<std::string> dirty_directories_;
+  /**
+   * Set if the catalog was changed in a way that is not tracked in
+   * dirty_directories_, e.g. by merging a nested catalog into it
+   */
+  bool rebuild_directory_digests_;
+
   DeltaCounters delta_counters_;
 
   // parallel commit state
@@ -198,6 +216,10 @@ class WritableCatalog : public Catalog {
 
   void UpdateCounters();
   void VacuumDatabaseIfNecessary();
+
+  void MarkDirectoryDirty(const std::string &directory);
+  shash::Any ComputeDirectoryDigest(const std::string &directory,
+                                    const bool recursive);
 };  // class WritableCatalog
 
 typedef std::vector<WritableCatalog *> WritableCatalogList;
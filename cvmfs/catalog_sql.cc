@@ -77,7 +77,9 @@ const float CatalogDatabase::kLatestSupportedSchema = 2.5;  // + 1.X (r/o)
 //            * add self_special and subtree_special statistics counters
 //   5 --> 6: (Jul 01 2021):
 //            * Add kFlagDirectIo
-const unsigned CatalogDatabase::kLatestSchemaRevision = 6;
+//   6 --> 7: (Oct 18 2026):
+//            * add table directory_digests
+const unsigned CatalogDatabase::kLatestSchemaRevision = 7;
 
 bool CatalogDatabase::CheckSchemaCompatibility() {
   return !( (schema_version() >= 2.0-kSchemaEpsilon)                   &&
@@ -209,6 +211,26 @@ bool CatalogDatabase::LiveSchemaUpgradeIfNecessary() {
     }
   }
 
+
+  if (IsEqualSchema(schema_version(), 2.5) && (schema_revision() == 6)) {
+    LogCvmfs(kLogCatalog, kLogDebug, "upgrading schema revision (6 --> 7)");
+
+    SqlCatalog sql_upgrade11(*this,
+      "CREATE TABLE directory_digests (md5path_1 INTEGER, md5path_2 INTEGER, "
+      "digest BLOB, "
+      "CONSTRAINT pk_directory_digests PRIMARY KEY (md5path_1, md5path_2));");
+    if (!sql_upgrade11.Execute()) {
+      LogCvmfs(kLogCatalog, kLogDebug, "failed to upgrade catalogs (6 --> 7)");
+      return false;
+    }
+
+    set_schema_revision(7);
+    if (!StoreSchemaRevision()) {
+      LogCvmfs(kLogCatalog, kLogDebug, "failed to upgrade schema revision");
+      return false;
+    }
+  }
+
   return true;
 }
 
@@ -248,6 +270,13 @@ bool CatalogDatabase::CreateEmptyDatabase() {
   SqlCatalog(*this,
     "CREATE TABLE bind_mountpoints (path TEXT, sha1 TEXT, size INTEGER, "
     "CONSTRAINT pk_bind_mountpoints PRIMARY KEY (path));")        .Execute()  &&
+  // Optional content digests of directory listings, see
+  // WritableCatalog::UpdateDirectoryDigests()
+  SqlCatalog(*this,
+    "CREATE TABLE directory_digests (md5path_1 INTEGER, md5path_2 INTEGER, "
+    "digest BLOB, "
+    "CONSTRAINT pk_directory_digests PRIMARY KEY (md5path_1, md5path_2));")
+                                                                  .Execute()  &&
   SqlCatalog(*this,
     "CREATE TABLE statistics (counter TEXT, value INTEGER, "
     "CONSTRAINT pk_statistics PRIMARY KEY (counter));")           .Execute();
@@ -695,6 +724,18 @@ shash::Md5 SqlLookup::GetParentPathHash() const {
  */
 DirectoryEntry SqlLookup::GetDirent(const Catalog *catalog,
                                     const bool expand_symlink) const
+{
+  return ReadDirent(catalog, expand_symlink, true);
+}
+
+
+/**
+ * Without mangle_inode, the inode of the entry is its row id.  Hardlink groups
+ * are then not resolved and not assigned in the catalog.
+ */
+DirectoryEntry SqlLookup::ReadDirent(const Catalog *catalog,
+                                     const bool expand_symlink,
+                                     const bool mangle_inode) const
 {
   DirectoryEntry result;
 
@@ -709,7 +750,8 @@ DirectoryEntry SqlLookup::GetDirent(const Catalog *catalog,
   if (catalog->schema() < 2.1 - CatalogDatabase::kSchemaEpsilon) {
     result.linkcount_       = 1;
     result.hardlink_group_  = 0;
-    result.inode_           = catalog->GetMangledInode(RetrieveInt64(12), 0);
+    result.inode_           = mangle_inode ?
+      catalog->GetMangledInode(RetrieveInt64(12), 0) : RetrieveInt64(12);
     result.is_chunked_file_ = false;
     result.has_xattrs_      = false;
     result.checksum_        = RetrieveHashBlob(0, shash::kSha1);
@@ -719,8 +761,9 @@ DirectoryEntry SqlLookup::GetDirent(const Catalog *catalog,
     const uint64_t hardlinks   = RetrieveInt64(1);
     result.linkcount_          = Hardlinks2Linkcount(hardlinks);
     result.hardlink_group_     = Hardlinks2HardlinkGroup(hardlinks);
-    result.inode_              =
-      catalog->GetMangledInode(RetrieveInt64(12), result.hardlink_group_);
+    result.inode_              = mangle_inode ?
+      catalog->GetMangledInode(RetrieveInt64(12), result.hardlink_group_) :
+      RetrieveInt64(12);
     result.is_bind_mountpoint_ = (database_flags & kFlagDirBindMountpoint);
     result.is_chunked_file_    = (database_flags & kFlagFileChunk);
     result.is_hidden_          = (database_flags & kFlagHidden);
@@ -793,6 +836,85 @@ bool SqlLookupPathHash::BindPathHash(const struct shash::Md5 &hash) {
 //------------------------------------------------------------------------------
 
 
+static string MakeLookupPathHashesTemplate() {
+  string stmt = "SELECT @DB_FIELDS@ FROM catalog WHERE md5path_1 IN (";
+  for (unsigned i = 0; i < SqlLookupPathHashes::kMaxPaths; ++i)
+    stmt += (i == 0) ? "?" : ", ?";
+  return stmt + ");";
+}
+
+
+SqlLookupPathHashes::SqlLookupPathHashes(const CatalogDatabase &database) {
+  MAKE_STATEMENTS(MakeLookupPathHashesTemplate());
+  DEFERRED_INITS(database);
+}
+
+
+bool SqlLookupPathHashes::BindPathHash(const unsigned slot,
+                                       const struct shash::Md5 &hash)
+{
+  assert(slot < kMaxPaths);
+  uint64_t high, low;
+  hash.ToIntPair(&high, &low);
+  return BindInt64(slot + 1, static_cast<int64_t>(high));
+}
+
+
+//------------------------------------------------------------------------------
+
+
+SqlAllDirents::SqlAllDirents(const CatalogDatabase &database) {
+  MAKE_STATEMENTS("SELECT @DB_FIELDS@ FROM catalog "
+                  "ORDER BY parent_1, parent_2, rowid;");
+  DEFERRED_INITS(database);
+}
+
+
+DirectoryEntry SqlAllDirents::GetRawDirent(const Catalog *catalog) const {
+  return ReadDirent(catalog, false, false);
+}
+
+
+//------------------------------------------------------------------------------
+
+
+SqlAllDirentsByPathHash::SqlAllDirentsByPathHash(
+  const CatalogDatabase &database)
+{
+  MAKE_STATEMENTS("SELECT @DB_FIELDS@ FROM catalog "
+                  "ORDER BY md5path_1, md5path_2;");
+  DEFERRED_INITS(database);
+}
+
+
+int SqlAllDirentsByPathHash::ComparePathHash(
+  const SqlAllDirentsByPathHash &other) const
+{
+  // The path hash halves are stored as signed integers
+  const int64_t high = RetrieveInt64(8);
+  const int64_t other_high = other.RetrieveInt64(8);
+  if (high != other_high)
+    return (high < other_high) ? -1 : 1;
+  const int64_t low = RetrieveInt64(9);
+  const int64_t other_low = other.RetrieveInt64(9);
+  if (low != other_low)
+    return (low < other_low) ? -1 : 1;
+  return 0;
+}
+
+
+//------------------------------------------------------------------------------
+
+
+SqlAllPathHashes::SqlAllPathHashes(const CatalogDatabase &database) {
+  DeferredInit(database.sqlite_db(),
+               "SELECT md5path_1, md5path_2 FROM catalog;");
+}
+
+
+//------------------------------------------------------------------------------
+
+
 SqlLookupInode::SqlLookupInode(const CatalogDatabase &database) {
   MAKE_STATEMENTS("SELECT @DB_FIELDS@ FROM catalog WHERE rowid = :rowid;");
   DEFERRED_INITS(database);
@@ -1409,4 +1531,64 @@ XattrList SqlLookupXattrs::GetXattrs() {
   return *xattrs;
 }
 
+//------------------------------------------------------------------------------
+
+
+SqlDirectoryDigestLookup::SqlDirectoryDigestLookup(
+  const CatalogDatabase &database)
+{
+  DeferredInit(database.sqlite_db(),
+    "SELECT digest FROM directory_digests "
+    "WHERE (md5path_1 = :md5_1) AND (md5path_2 = :md5_2);");
+}
+
+
+bool SqlDirectoryDigestLookup::BindPathHash(const shash::Md5 &hash) {
+  return BindMd5(1, 2, hash);
+}
+
+
+shash::Any SqlDirectoryDigestLookup::GetDigest() const {
+  return RetrieveHashBlob(0, kDirectoryDigestAlgorithm);
+}
+
+
+//------------------------------------------------------------------------------
+
+
+SqlDirectoryDigestInsert::SqlDirectoryDigestInsert(
+  const CatalogDatabase &database)
+{
+  DeferredInit(database.sqlite_db(),
+    "INSERT OR REPLACE INTO directory_digests (md5path_1, md5path_2, digest) "
+    "VALUES (:md5_1, :md5_2, :digest);");
+}
+
+
+bool SqlDirectoryDigestInsert::BindPathHash(const shash::Md5 &hash) {
+  return BindMd5(1, 2, hash);
+}
+
+
+bool SqlDirectoryDigestInsert::BindDigest(const shash::Any &digest) {
+  return BindHashBlob(3, digest);
+}
+
+
+//------------------------------------------------------------------------------
+
+
+SqlDirectoryDigestRemove::SqlDirectoryDigestRemove(
+  const CatalogDatabase &database)
+{
+  DeferredInit(database.sqlite_db(),
+    "DELETE FROM directory_digests "
+    "WHERE (md5path_1 = :md5_1) AND (md5path_2 = :md5_2);");
+}
+
+
+bool SqlDirectoryDigestRemove::BindPathHash(const shash::Md5 &hash) {
+  return BindMd5(1, 2, hash);
+}
+
 }  // namespace catalog
@@ -310,6 +310,11 @@ class SqlLookup : public SqlDirent {
    * @return the MD5 parent path hash of a freshly performed lookup
    */
   shash::Md5 GetParentPathHash() const;
+
+ protected:
+  DirectoryEntry ReadDirent(const Catalog *catalog,
+                            const bool expand_symlink,
+                            const bool mangle_inode) const;
 };
 
 
@@ -336,6 +341,76 @@ class SqlLookupPathHash : public SqlLookup {
 //------------------------------------------------------------------------------
 
 
+/**
+ * Looks up a batch of up to kMaxPaths path hashes in a single query.  The
+ * query selects by the first half of the path hashes, which uses the primary
+ * key index, so the caller needs to compare the full path hash of the rows.
+ * All the slots need to be bound; unused slots can repeat a path hash.
+ */
+class SqlLookupPathHashes : public SqlLookup {
+ public:
+  static const unsigned kMaxPaths = 64;
+
+  explicit SqlLookupPathHashes(const CatalogDatabase &database);
+  bool BindPathHash(const unsigned slot, const struct shash::Md5 &hash);
+};
+
+
+//------------------------------------------------------------------------------
+
+
+/**
+ * Iterates through all the entries of a catalog, grouped by their parent
+ * directory.  Used to build the in-memory path index (see catalog_index.h).
+ */
+class SqlAllDirents : public SqlLookup {
+ public:
+  explicit SqlAllDirents(const CatalogDatabase &database);
+  /**
+   * Like GetDirent() without symlink expansion, but the inode is the row id.
+   * Reading all the entries does not assign the inodes of hardlink groups.
+   */
+  DirectoryEntry GetRawDirent(const Catalog *catalog) const;
+};
+
+
+//------------------------------------------------------------------------------
+
+
+/**
+ * Iterates through all the entries of a catalog in the order of the primary
+ * key, i.e. of the path hash.  Two revisions of a catalog can then be compared
+ * in a single merge pass (see RevisionDiff).
+ */
+class SqlAllDirentsByPathHash : public SqlLookup {
+ public:
+  explicit SqlAllDirentsByPathHash(const CatalogDatabase &database);
+  /**
+   * Compares the path hashes of the current rows in the SQL sort order.
+   * Returns a negative number, zero, or a positive number if the path hash of
+   * this statement sorts before, equal to, or after the other one.
+   */
+  int ComparePathHash(const SqlAllDirentsByPathHash &other) const;
+};
+
+
+//------------------------------------------------------------------------------
+
+
+/**
+ * Iterates through the path hashes of all the entries of a catalog.  Only
+ * reads the primary key index, used to build the path filter (see PathFilter).
+ */
+class SqlAllPathHashes : public SqlCatalog {
+ public:
+  explicit SqlAllPathHashes(const CatalogDatabase &database);
+  shash::Md5 GetPathHash() const { return RetrieveMd5(0, 1); }
+};
+
+
+//------------------------------------------------------------------------------
+
+
 class SqlLookupInode : public SqlLookup {
  public:
   explicit SqlLookupInode(const CatalogDatabase &database);
@@ -593,6 +668,44 @@ class SqlLookupXattrs : public SqlCatalog {
   XattrList GetXattrs();
 };
 
+
+//------------------------------------------------------------------------------
+
+
+/**
+ * Directory digests summarize the listing of a directory including the
+ * digests of its sub directories (schema revision 7 and later).
+ */
+const shash::Algorithms kDirectoryDigestAlgorithm = shash::kSha1;
+
+class SqlDirectoryDigestLookup : public SqlCatalog {
+ public:
+  explicit SqlDirectoryDigestLookup(const CatalogDatabase &database);
+  bool BindPathHash(const shash::Md5 &hash);
+  shash::Any GetDigest() const;
+};
+
+
+//------------------------------------------------------------------------------
+
+
+class SqlDirectoryDigestInsert : public SqlCatalog {
+ public:
+  explicit SqlDirectoryDigestInsert(const CatalogDatabase &database);
+  bool BindPathHash(const shash::Md5 &hash);
+  bool BindDigest(const shash::Any &digest);
+};
+
+
+//------------------------------------------------------------------------------
+
+
+class SqlDirectoryDigestRemove : public SqlCatalog {
+ public:
+  explicit SqlDirectoryDigestRemove(const CatalogDatabase &database);
+  bool BindPathHash(const shash::Md5 &hash);
+};
+
 }  // namespace catalog
 
 #endif  // CVMFS_CATALOG_SQL_H_
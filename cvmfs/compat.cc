@@ -168,6 +168,65 @@ void Migrate(InodeTracker *old_tracker, glue::InodeTracker *new_tracker) {
 //------------------------------------------------------------------------------
 
 
+namespace inode_tracker_v4 {
+
+static uint32_t hasher_md5(const shash::Md5 &key) {
+  return (uint32_t) *((uint32_t *)key.digest + 1);  // NOLINT
+}
+
+static uint32_t hasher_inode(const uint64_t &inode) {
+  return MurmurHash2(&inode, sizeof(inode), 0x07387a4f);
+}
+
+static uint32_t hasher_inode_ex(const glue::InodeEx &inode_ex) {
+  return hasher_inode(inode_ex.GetInode());
+}
+
+void Migrate(InodeTracker *old_tracker, glue::InodeTracker *new_tracker) {
+  old_tracker->inode_ex_map_.map_.SetHasher(hasher_inode_ex);
+  old_tracker->path_map_.map_.SetHasher(hasher_md5);
+  old_tracker->path_map_.path_store_.map_.SetHasher(hasher_md5);
+
+  SmallHashDynamic<uint64_t, uint32_t> *old_inodes =
+    &old_tracker->inode_references_.map_;
+  for (unsigned i = 0; i < old_inodes->capacity(); ++i) {
+    const uint64_t inode = old_inodes->keys()[i];
+    if (inode == 0) continue;
+
+    const uint32_t references = old_inodes->values()[i];
+    glue::InodeEx inode_ex(inode, glue::InodeEx::kUnknownType);
+    PathString path;
+    bool retval = old_tracker->FindPath(&inode_ex, &path);
+    assert(retval);
+    new_tracker->VfsGetBy(inode_ex, references, path);
+  }
+}
+
+}  // namespace inode_tracker_v4
+
+
+//------------------------------------------------------------------------------
+
+
+/**
+ * Distributes the entries of an unsharded map from an older version of the
+ * chunk tables over the shards of the current chunk tables.
+ */
+template <typename ValueT>
+static void MigrateToShards(
+  const SmallHashDynamic<uint64_t, ValueT> &old_map,
+  SmallHashDynamic<uint64_t, ValueT> (::ChunkTables::Shard::*new_map),
+  ::ChunkTables *new_tables)
+{
+  for (unsigned i = 0; i < old_map.capacity(); ++i) {
+    const uint64_t key = old_map.keys()[i];
+    if (key == old_map.empty_key())
+      continue;
+    (new_tables->Key2Shard(key)->*new_map).Insert(key, old_map.values()[i]);
+  }
+}
+
+
 namespace chunk_tables {
 
 ChunkTables::~ChunkTables() {
@@ -181,8 +240,10 @@ ChunkTables::~ChunkTables() {
 
 void Migrate(ChunkTables *old_tables, ::ChunkTables *new_tables) {
   new_tables->next_handle = old_tables->next_handle;
-  new_tables->handle2fd = old_tables->handle2fd;
-  new_tables->inode2references = old_tables->inode2references;
+  MigrateToShards(old_tables->handle2fd, &::ChunkTables::Shard::handle2fd,
+                  new_tables);
+  MigrateToShards(old_tables->inode2references,
+                  &::ChunkTables::Shard::inode2references, new_tables);
 
   SmallHashDynamic<uint64_t, FileChunkReflist> *old_inode2chunks =
     &old_tables->inode2chunks;
@@ -204,7 +265,7 @@ void Migrate(ChunkTables *old_tables, ::ChunkTables *new_tables) {
     delete old_list;
     ::FileChunkReflist new_reflist(new_list, old_reflist->path,
                                    zlib::kZlibDefault, false);
-    new_tables->inode2chunks.Insert(inode, new_reflist);
+    new_tables->Inode2Shard(inode)->inode2chunks.Insert(inode, new_reflist);
   }
 }
 
@@ -227,8 +288,10 @@ ChunkTables::~ChunkTables() {
 
 void Migrate(ChunkTables *old_tables, ::ChunkTables *new_tables) {
   new_tables->next_handle = old_tables->next_handle;
-  new_tables->handle2fd = old_tables->handle2fd;
-  new_tables->inode2references = old_tables->inode2references;
+  MigrateToShards(old_tables->handle2fd, &::ChunkTables::Shard::handle2fd,
+                  new_tables);
+  MigrateToShards(old_tables->inode2references,
+                  &::ChunkTables::Shard::inode2references, new_tables);
 
   SmallHashDynamic<uint64_t, FileChunkReflist> *old_inode2chunks =
     &old_tables->inode2chunks;
@@ -250,7 +313,7 @@ void Migrate(ChunkTables *old_tables, ::ChunkTables *new_tables) {
     delete old_list;
     ::FileChunkReflist new_reflist(new_list, old_reflist->path,
                                    zlib::kZlibDefault, false);
-    new_tables->inode2chunks.Insert(inode, new_reflist);
+    new_tables->Inode2Shard(inode)->inode2chunks.Insert(inode, new_reflist);
   }
 }
 
@@ -273,11 +336,43 @@ ChunkTables::~ChunkTables() {
 
 void Migrate(ChunkTables *old_tables, ::ChunkTables *new_tables) {
   new_tables->next_handle = old_tables->next_handle;
-  new_tables->handle2fd = old_tables->handle2fd;
-  new_tables->inode2chunks = old_tables->inode2chunks;
-  new_tables->inode2references = old_tables->inode2references;
+  MigrateToShards(old_tables->handle2fd, &::ChunkTables::Shard::handle2fd,
+                  new_tables);
+  MigrateToShards(old_tables->inode2chunks,
+                  &::ChunkTables::Shard::inode2chunks, new_tables);
+  MigrateToShards(old_tables->inode2references,
+                  &::ChunkTables::Shard::inode2references, new_tables);
 }
 
 }  // namespace chunk_tables_v3
 
+
+//------------------------------------------------------------------------------
+
+
+namespace chunk_tables_v4 {
+
+ChunkTables::~ChunkTables() {
+  pthread_mutex_destroy(lock);
+  free(lock);
+  for (unsigned i = 0; i < kNumHandleLocks; ++i) {
+    pthread_mutex_destroy(handle_locks.At(i));
+    free(handle_locks.At(i));
+  }
+}
+
+void Migrate(ChunkTables *old_tables, ::ChunkTables *new_tables) {
+  new_tables->next_handle = old_tables->next_handle;
+  MigrateToShards(old_tables->handle2uniqino,
+                  &::ChunkTables::Shard::handle2uniqino, new_tables);
+  MigrateToShards(old_tables->handle2fd, &::ChunkTables::Shard::handle2fd,
+                  new_tables);
+  MigrateToShards(old_tables->inode2chunks,
+                  &::ChunkTables::Shard::inode2chunks, new_tables);
+  MigrateToShards(old_tables->inode2references,
+                  &::ChunkTables::Shard::inode2references, new_tables);
+}
+
+}  // namespace chunk_tables_v4
+
 }  // namespace compat
@@ -68,6 +68,7 @@
 #include "auto_umount.h"
 #include "backoff.h"
 #include "cache.h"
+#include "cache_sparse.h"
 #include "catalog_mgr_client.h"
 #include "clientctx.h"
 #include "compat.h"
@@ -111,6 +112,7 @@
 #include "util/exception.h"
 #include "util/logging.h"
 #include "util/platform.h"
+#include "util/single_copy.h"
 #include "util/smalloc.h"
 #include "util/uuid.h"
 #include "wpad.h"
@@ -362,6 +364,44 @@ static bool GetDirentForInode(const fuse_ino_t ino,
 }
 
 
+/**
+ * Second half of GetDirentForPath(): fixes up the inode of an entry that was
+ * looked up in the catalogs and populates the md5path cache.
+ */
+static uint64_t FinishDirentForPath(const PathString &path,
+                                    const shash::Md5 &md5path,
+                                    const uint64_t live_inode,
+                                    const bool found,
+                                    catalog::DirectoryEntry *dirent)
+{
+  if (found) {
+    if (file_system_->IsNfsSource()) {
+      dirent->set_inode(file_system_->nfs_maps()->GetInode(path));
+      mount_point_->md5path_cache()->Insert(md5path, *dirent);
+    } else if (live_inode != 0) {
+      dirent->set_inode(live_inode);
+      if (FixupOpenInode(path, dirent)) {
+        LogCvmfs(kLogCvmfs, kLogDebug,
+          "content of %s change, replacing inode %" PRIu64 " --> %" PRIu64,
+          path.c_str(), live_inode, dirent->inode());
+        return live_inode;
+        // Do not populate the md5path cache until the inode tracker is fixed
+      } else {
+        mount_point_->md5path_cache()->Insert(md5path, *dirent);
+      }
+    }
+    return 1;
+  }
+
+  LogCvmfs(kLogCvmfs, kLogDebug, "GetDirentForPath, no entry");
+  // Only insert ENOENT results into negative cache.  Otherwise it was an
+  // error loading nested catalogs
+  if (dirent->GetSpecial() == catalog::kDirentNegative)
+    mount_point_->md5path_cache()->InsertNegative(md5path);
+  return 0;
+}
+
+
 /**
  * Returns 0 if the path does not exist
  *         1 if the live inode is returned
@@ -390,33 +430,60 @@ static uint64_t GetDirentForPath(const PathString &path,
   catalog::ClientCatalogManager *catalog_mgr = mount_point_->catalog_mgr();
 
   // Lookup inode in catalog TODO: not twice md5 calculation
-  bool retval;
-  retval = catalog_mgr->LookupPath(path, catalog::kLookupDefault, dirent);
-  if (retval) {
-    if (file_system_->IsNfsSource()) {
-      dirent->set_inode(file_system_->nfs_maps()->GetInode(path));
-      mount_point_->md5path_cache()->Insert(md5path, *dirent);
-    } else if (live_inode != 0) {
-      dirent->set_inode(live_inode);
-      if (FixupOpenInode(path, dirent)) {
-        LogCvmfs(kLogCvmfs, kLogDebug,
-          "content of %s change, replacing inode %" PRIu64 " --> %" PRIu64,
-          path.c_str(), live_inode, dirent->inode());
-        return live_inode;
-        // Do not populate the md5path cache until the inode tracker is fixed
-      } else {
-        mount_point_->md5path_cache()->Insert(md5path, *dirent);
-      }
+  const bool found =
+    catalog_mgr->LookupPath(path, catalog::kLookupDefault, dirent);
+  return FinishDirentForPath(path, md5path, live_inode, found, dirent);
+}
+
+
+/**
+ * Like GetDirentForPath() for the entries of a directory listing.  The entries
+ * that are not in the md5path cache are looked up in the catalogs as a batch.
+ * Sets results[i] to the return value of GetDirentForPath() for paths[i].
+ */
+static void GetDirentsForPaths(const std::vector<PathString> &paths,
+                               std::vector<catalog::DirectoryEntry> *dirents,
+                               std::vector<uint64_t> *results)
+{
+  const unsigned num_paths = paths.size();
+  dirents->resize(num_paths);
+  results->assign(num_paths, 0);
+  std::vector<uint64_t> live_inodes(num_paths, 0);
+  std::vector<shash::Md5> md5paths;
+  md5paths.reserve(num_paths);
+  std::vector<unsigned> misses;
+  std::vector<PathString> miss_paths;
+
+  for (unsigned i = 0; i < num_paths; ++i) {
+    if (!file_system_->IsNfsSource())
+      live_inodes[i] = mount_point_->inode_tracker()->FindInode(paths[i]);
+    md5paths.push_back(shash::Md5(paths[i].GetChars(), paths[i].GetLength()));
+    catalog::DirectoryEntry *dirent = &(*dirents)[i];
+    if (mount_point_->md5path_cache()->Lookup(md5paths[i], dirent)) {
+      if (dirent->GetSpecial() == catalog::kDirentNegative)
+        continue;
+      if (!file_system_->IsNfsSource() && (live_inodes[i] != 0))
+        dirent->set_inode(live_inodes[i]);
+      (*results)[i] = 1;
+      continue;
     }
-    return 1;
+    misses.push_back(i);
+    miss_paths.push_back(paths[i]);
   }
+  if (misses.empty())
+    return;
 
-  LogCvmfs(kLogCvmfs, kLogDebug, "GetDirentForPath, no entry");
-  // Only insert ENOENT results into negative cache.  Otherwise it was an
-  // error loading nested catalogs
-  if (dirent->GetSpecial() == catalog::kDirentNegative)
-    mount_point_->md5path_cache()->InsertNegative(md5path);
-  return 0;
+  std::vector<catalog::DirectoryEntry> miss_dirents;
+  std::vector<bool> found;
+  mount_point_->catalog_mgr()->LookupPaths(
+    miss_paths, catalog::kLookupDefault, &miss_dirents, &found);
+  for (unsigned i = 0; i < misses.size(); ++i) {
+    const unsigned idx = misses[i];
+    catalog::DirectoryEntry *dirent = &(*dirents)[idx];
+    *dirent = miss_dirents[i];
+    (*results)[idx] = FinishDirentForPath(
+      paths[idx], md5paths[idx], live_inodes[idx], found[i], dirent);
+  }
 }
 
 
@@ -564,8 +631,15 @@ static void cvmfs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
       if (replaced)
         perf::Inc(file_system_->n_fs_inode_replace());
     }
-    mount_point_->inode_tracker()->VfsGet(
+    bool tracked = mount_point_->inode_tracker()->VfsGet(
       glue::InodeEx(dirent.inode(), dirent.mode()), path);
+    if (!tracked) {
+      fuse_remounter_->fence()->Leave();
+      LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogErr,
+               "inode tracker full, failed to look up %s", path.c_str());
+      fuse_reply_err(req, ENOMEM);
+      return;
+    }
   }
   // We do _not_ track (and evict) positive replies; among other things, test
   // 076 fails with the following line uncommented
@@ -927,23 +1001,30 @@ static void cvmfs_opendir(fuse_req_t req, fuse_ino_t ino,
     fuse_reply_err(req, EIO);
     return;
   }
+  // Fix inodes
+  std::vector<PathString> entry_paths;
+  entry_paths.reserve(listing_from_catalog.size());
   for (unsigned i = 0; i < listing_from_catalog.size(); ++i) {
-    // Fix inodes
     PathString entry_path;
     entry_path.Assign(path);
     entry_path.Append("/", 1);
     entry_path.Append(listing_from_catalog.AtPtr(i)->name.GetChars(),
                       listing_from_catalog.AtPtr(i)->name.GetLength());
+    entry_paths.push_back(entry_path);
+  }
+  std::vector<catalog::DirectoryEntry> entry_dirents;
+  std::vector<uint64_t> entry_results;
+  GetDirentsForPaths(entry_paths, &entry_dirents, &entry_results);
 
-    catalog::DirectoryEntry entry_dirent;
-    if (!GetDirentForPath(entry_path, &entry_dirent)) {
+  for (unsigned i = 0; i < listing_from_catalog.size(); ++i) {
+    if (entry_results[i] == 0) {
       LogCvmfs(kLogCvmfs, kLogDebug, "listing entry %s vanished, skipping",
-               entry_path.c_str());
+               entry_paths[i].c_str());
       continue;
     }
 
     struct stat fixed_info = listing_from_catalog.AtPtr(i)->info;
-    fixed_info.st_ino = entry_dirent.inode();
+    fixed_info.st_ino = entry_dirents[i].inode();
     AddToDirListing(req, listing_from_catalog.AtPtr(i)->name.c_str(),
                     &fixed_info, &fuse_listing);
   }
@@ -1069,6 +1150,161 @@ static void FillOpenFlags(const glue::PageCacheTracker::OpenDirectives od,
 }
 
 
+/**
+ * For files opened in fuse passthrough mode, the backing id returned by the
+ * kernel is kept in the upper half of the file handle, next to the cache
+ * manager's file descriptor.  Unlike a separate table, this survives reloads.
+ */
+static const unsigned kPassthroughShift = 32;
+static const uint64_t kPassthroughMask = (static_cast<uint64_t>(1) << 24) - 1;
+
+/**
+ * Marks handles of the sparse cache, see cvmfs_open().  Such handles are not
+ * cache manager file descriptors and never have a backing id.
+ */
+static const unsigned kBitSparse = 61;
+
+static void ClearBackingId(uint64_t *fh) {
+  *fh &= ~(kPassthroughMask << kPassthroughShift);
+}
+
+/**
+ * Registers the cache file behind fd as backing file of the open file, so
+ * that the kernel serves reads without calling into cvmfs.  Falls back to
+ * regular reads if the kernel refuses.
+ */
+static void SetupPassthrough(fuse_req_t req, int fd, struct fuse_file_info *fi)
+{
+#if defined(FUSE_CAP_PASSTHROUGH)
+  if (!mount_point_->fuse_passthrough() || fi->direct_io)
+    return;
+  const int backing_fd = file_system_->cache_mgr()->GetBackingFd(fd);
+  if (backing_fd < 0)
+    return;
+  const int backing_id = fuse_passthrough_open(req, backing_fd);
+  if (backing_id <= 0) {
+    LogCvmfs(kLogCvmfs, kLogDebug, "fuse passthrough refused for fd %d", fd);
+    return;
+  }
+  if (static_cast<uint64_t>(backing_id) > kPassthroughMask) {
+    fuse_passthrough_close(req, backing_id);
+    return;
+  }
+  fi->backing_id = backing_id;
+  fi->fh |= static_cast<uint64_t>(backing_id) << kPassthroughShift;
+  perf::Inc(file_system_->n_fs_open_passthrough());
+#endif
+}
+
+static void ReleasePassthrough(fuse_req_t req, const uint64_t fh) {
+#if defined(FUSE_CAP_PASSTHROUGH)
+  const int backing_id =
+    static_cast<int>((fh >> kPassthroughShift) & kPassthroughMask);
+  if (backing_id > 0)
+    fuse_passthrough_close(req, backing_id);
+#endif
+}
+
+
+#ifdef FUSE_CAP_SPLICE_WRITE
+/**
+ * Collects the pieces of a read reply in zero-copy mode.  Pieces of cache
+ * objects with a backing file are spliced into the fuse device instead of
+ * being copied through user space.  Other pieces are taken from memory.
+ * Without libfuse support for splicing, the zero-copy mode is compiled out.
+ */
+class SpliceReply : SingleCopy {
+ public:
+  SpliceReply() : size_(0), num_spliced_(0) { }
+  ~SpliceReply() {
+    for (unsigned i = 0; i < pieces_.size(); ++i) {
+      if (pieces_[i].owned_fd >= 0)
+        file_system_->cache_mgr()->Close(pieces_[i].owned_fd);
+    }
+  }
+
+  /**
+   * Adds size bytes starting at offset of the cache object fd.  If the fd
+   * might be closed before the reply is sent, e.g. chunk file descriptors,
+   * the reply keeps a duplicate.  Returns false if fd has no backing file.
+   */
+  bool AddFd(int fd, size_t size, off_t offset, bool duplicate) {
+    CacheManager *cache_mgr = file_system_->cache_mgr();
+    Piece piece;
+    if (duplicate) {
+      if (cache_mgr->GetBackingFd(fd) < 0)
+        return false;
+      piece.owned_fd = cache_mgr->Dup(fd);
+      if (piece.owned_fd < 0)
+        return false;
+      fd = piece.owned_fd;
+    }
+    piece.backing_fd = cache_mgr->GetBackingFd(fd);
+    if (piece.backing_fd < 0)
+      return false;
+    piece.size = size;
+    piece.offset = offset;
+    pieces_.push_back(piece);
+    size_ += size;
+    num_spliced_++;
+    return true;
+  }
+
+  void AddMem(const char *mem, size_t size) {
+    Piece piece;
+    piece.mem = mem;
+    piece.size = size;
+    pieces_.push_back(piece);
+    size_ += size;
+  }
+
+  /**
+   * Only used if at least one piece is spliced.
+   */
+  void Send(fuse_req_t req) {
+    assert(num_spliced_ > 0);
+    struct fuse_bufvec *bufv = static_cast<struct fuse_bufvec *>(alloca(
+      sizeof(struct fuse_bufvec) +
+      (pieces_.size() - 1) * sizeof(struct fuse_buf)));
+    memset(bufv, 0, sizeof(struct fuse_bufvec));
+    bufv->count = pieces_.size();
+    for (unsigned i = 0; i < pieces_.size(); ++i) {
+      struct fuse_buf *buf = &bufv->buf[i];
+      memset(buf, 0, sizeof(*buf));
+      buf->size = pieces_[i].size;
+      if (pieces_[i].backing_fd >= 0) {
+        buf->flags = static_cast<enum fuse_buf_flags>(
+          FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+        buf->fd = pieces_[i].backing_fd;
+        buf->pos = pieces_[i].offset;
+      } else {
+        buf->mem = const_cast<char *>(pieces_[i].mem);
+      }
+    }
+    fuse_reply_data(req, bufv, FUSE_BUF_SPLICE_MOVE);
+    perf::Inc(file_system_->n_fs_read_splice());
+  }
+
+  size_t size() const { return size_; }
+  unsigned num_spliced() const { return num_spliced_; }
+
+ private:
+  struct Piece {
+    Piece() : backing_fd(-1), owned_fd(-1), mem(NULL), size(0), offset(0) { }
+    int backing_fd;
+    int owned_fd;
+    const char *mem;
+    size_t size;
+    off_t offset;
+  };
+
+  std::vector<Piece> pieces_;
+  size_t size_;
+  unsigned num_spliced_;
+};
+#endif  // FUSE_CAP_SPLICE_WRITE
+
+
 #ifdef __APPLE__
 // On macOS, xattr on a symlink opens and closes the file (with O_SYMLINK)
 // around the actual getxattr call. In order to not run into an I/O error
@@ -1187,9 +1423,10 @@ static void cvmfs_open(fuse_req_t req, fuse_ino_t ino,
     const uint64_t unique_inode = dirent_origin.inode();
 
     ChunkTables *chunk_tables = mount_point_->chunk_tables();
-    chunk_tables->Lock();
-    if (!chunk_tables->inode2chunks.Contains(unique_inode)) {
-      chunk_tables->Unlock();
+    ChunkTables::Shard *inode_shard = chunk_tables->Inode2Shard(unique_inode);
+    inode_shard->Lock();
+    if (!inode_shard->inode2chunks.Contains(unique_inode)) {
+      inode_shard->Unlock();
 
       // Retrieve File chunks from the catalog
       UniquePtr<FileChunkList> chunks(new FileChunkList());
@@ -1208,46 +1445,50 @@ static void cvmfs_open(fuse_req_t req, fuse_ino_t ino,
       }
       fuse_remounter_->fence()->Leave();
 
-      chunk_tables->Lock();
+      inode_shard->Lock();
       // Check again to avoid race
-      if (!chunk_tables->inode2chunks.Contains(unique_inode)) {
-        chunk_tables->inode2chunks.Insert(
+      if (!inode_shard->inode2chunks.Contains(unique_inode)) {
+        inode_shard->inode2chunks.Insert(
           unique_inode, FileChunkReflist(chunks.Release(), path,
                                          dirent.compression_algorithm(),
                                          dirent.IsExternalFile()));
-        chunk_tables->inode2references.Insert(unique_inode, 1);
+        inode_shard->inode2references.Insert(unique_inode, 1);
       } else {
         uint32_t refctr;
         bool retval =
-          chunk_tables->inode2references.Lookup(unique_inode, &refctr);
+          inode_shard->inode2references.Lookup(unique_inode, &refctr);
         assert(retval);
-        chunk_tables->inode2references.Insert(unique_inode, refctr+1);
+        inode_shard->inode2references.Insert(unique_inode, refctr+1);
       }
     } else {
       fuse_remounter_->fence()->Leave();
       uint32_t refctr;
       bool retval =
-        chunk_tables->inode2references.Lookup(unique_inode, &refctr);
+        inode_shard->inode2references.Lookup(unique_inode, &refctr);
       assert(retval);
-      chunk_tables->inode2references.Insert(unique_inode, refctr+1);
+      inode_shard->inode2references.Insert(unique_inode, refctr+1);
     }
+    // The reference taken above keeps the chunk list alive
+    FileChunkReflist chunk_reflist;
+    bool retval =
+        inode_shard->inode2chunks.Lookup(unique_inode, &chunk_reflist);
+    assert(retval);
+    inode_shard->Unlock();
 
     // Update the chunk handle list
+    const uint64_t chunk_handle = chunk_tables->NextHandle();
     LogCvmfs(kLogCvmfs, kLogDebug,
-             "linking chunk handle %d to unique inode: %" PRIu64,
-             chunk_tables->next_handle, uint64_t(unique_inode));
-    chunk_tables->handle2fd.Insert(chunk_tables->next_handle, ChunkFd());
-    chunk_tables->handle2uniqino.Insert(chunk_tables->next_handle,
-                                        unique_inode);
+             "linking chunk handle %" PRIu64 " to unique inode: %" PRIu64,
+             chunk_handle, uint64_t(unique_inode));
+    ChunkTables::Shard *handle_shard = chunk_tables->Handle2Shard(chunk_handle);
+    handle_shard->Lock();
+    handle_shard->handle2fd.Insert(chunk_handle, ChunkFd());
+    handle_shard->handle2uniqino.Insert(chunk_handle, unique_inode);
+    handle_shard->Unlock();
 
     // Generate artificial content hash as hash over chunk hashes
     // TODO(jblomer): we may want to cache the result in the chunk tables
-    FileChunkReflist chunk_reflist;
-    bool retval =
-        chunk_tables->inode2chunks.Lookup(unique_inode, &chunk_reflist);
-    assert(retval);
-
-    fi->fh = chunk_tables->next_handle;
+    fi->fh = chunk_handle;
     if (dirent.IsDirectIo()) {
       open_directives = mount_point_->page_cache_tracker()->OpenDirect();
     } else {
@@ -1256,24 +1497,74 @@ static void cvmfs_open(fuse_req_t req, fuse_ino_t ino,
     }
     FillOpenFlags(open_directives, fi);
     fi->fh = static_cast<uint64_t>(-static_cast<int64_t>(fi->fh));
-    ++chunk_tables->next_handle;
-    chunk_tables->Unlock();
 
     fuse_reply_open(req, fi);
     return;
   }
 
+  const CacheManager::ObjectType object_type =
+    mount_point_->catalog_mgr()->volatile_flag()
+      ? CacheManager::kTypeVolatile
+      : CacheManager::kTypeRegular;
+
+  // Large, uncompressed files that are not yet cached are read block-wise
+  // with range requests instead of being downloaded on open
+  SparseCache *sparse_cache = mount_point_->sparse_cache();
+  if ((sparse_cache != NULL) &&
+      sparse_cache->IsEligible(dirent.size(), dirent.compression_algorithm()))
+  {
+    fd = file_system_->cache_mgr()->Open(CacheManager::Bless(
+      dirent.checksum(), object_type,
+      string(path.GetChars(), path.GetLength())));
+    if (fd < 0) {
+      const int64_t handle = sparse_cache->Open(
+        dirent.checksum(), dirent.size(),
+        string(path.GetChars(), path.GetLength()), dirent.IsExternalFile(),
+        object_type);
+      if (handle < 0) {
+        LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogErr,
+                 "failed to open %s in the sparse cache (%" PRId64 ")",
+                 path.c_str(), handle);
+        fuse_reply_err(req, -handle);
+        return;
+      }
+      if (perf::Xadd(file_system_->no_open_files(), 1) >=
+          (static_cast<int>(max_open_files_))-kNumReservedFd)
+      {
+        perf::Dec(file_system_->no_open_files());
+        sparse_cache->Close(handle);
+        LogCvmfs(kLogCvmfs, kLogSyslogErr,
+                 "open file descriptor limit exceeded");
+        fuse_reply_err(req, EMFILE);
+        return;
+      }
+      LogCvmfs(kLogCvmfs, kLogDebug, "file %s opened sparse (handle %" PRId64
+               ")", path.c_str(), handle);
+      // Blocks are verified only once the object is complete
+      if (!open_directives.direct_io) {
+        mount_point_->page_cache_tracker()->Close(ino);
+        open_directives = mount_point_->page_cache_tracker()->OpenDirect();
+      }
+      fi->fh = handle;
+      FillOpenFlags(open_directives, fi);
+      SetBit(kBitSparse, &fi->fh);
+      fuse_reply_open(req, fi);
+      return;
+    }
+  }
+
   Fetcher *this_fetcher = dirent.IsExternalFile()
     ? mount_point_->external_fetcher()
     : mount_point_->fetcher();
-  fd = this_fetcher->Fetch(
-    dirent.checksum(),
-    dirent.size(),
-    string(path.GetChars(), path.GetLength()),
-    dirent.compression_algorithm(),
-    mount_point_->catalog_mgr()->volatile_flag()
-      ? CacheManager::kTypeVolatile
-      : CacheManager::kTypeRegular);
+  if (fd < 0) {
+    fd = this_fetcher->Fetch(
+      dirent.checksum(),
+      dirent.size(),
+      string(path.GetChars(), path.GetLength()),
+      dirent.compression_algorithm(),
+      object_type,
+      "", -1, true /* allow_streaming */);
+  }
 
   if (fd >= 0) {
     if (perf::Xadd(file_system_->no_open_files(), 1) <
@@ -1281,7 +1572,14 @@ static void cvmfs_open(fuse_req_t req, fuse_ino_t ino,
       LogCvmfs(kLogCvmfs, kLogDebug, "file %s opened (fd %d)",
                path.c_str(), fd);
       fi->fh = fd;
+      // The content is verified only once the download completes, until then
+      // it must not end up in the page cache
+      if (!open_directives.direct_io && this_fetcher->IsStreaming(fd)) {
+        mount_point_->page_cache_tracker()->Close(ino);
+        open_directives = mount_point_->page_cache_tracker()->OpenDirect();
+      }
       FillOpenFlags(open_directives, fi);
+      SetupPassthrough(req, fd, fi);
       fuse_reply_open(req, fi);
       return;
     } else {
@@ -1341,10 +1639,16 @@ static void cvmfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
   // Get data chunk (<=128k guaranteed by Fuse)
   char *data = static_cast<char *>(alloca(size));
   unsigned int overall_bytes_fetched = 0;
+#ifdef FUSE_CAP_SPLICE_WRITE
+  const bool splice = mount_point_->fuse_splice();
+  SpliceReply splice_reply;
+#endif
 
   int64_t fd = static_cast<int64_t>(fi->fh);
   uint64_t abs_fd = (fd < 0) ? -fd : fd;
   ClearBit(glue::PageCacheTracker::kBitDirectIo, &abs_fd);
+  if (fd >= 0)
+    ClearBackingId(&abs_fd);
 
   // Do we have a a chunked file?
   if (fd < 0) {
@@ -1358,28 +1662,30 @@ static void cvmfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
     FileChunkReflist chunks;
     bool retval;
 
-    // Fetch unique inode, chunk list and file descriptor
+    // Lock chunk handle
     ChunkTables *chunk_tables = mount_point_->chunk_tables();
-    chunk_tables->Lock();
-    retval = chunk_tables->handle2uniqino.Lookup(chunk_handle, &unique_inode);
+    pthread_mutex_t *handle_lock = chunk_tables->Handle2Lock(chunk_handle);
+    MutexLockGuard m(handle_lock);
+
+    // Fetch unique inode, file descriptor and chunk list
+    ChunkTables::Shard *handle_shard = chunk_tables->Handle2Shard(chunk_handle);
+    handle_shard->Lock();
+    retval = handle_shard->handle2uniqino.Lookup(chunk_handle, &unique_inode);
     if (!retval) {
       LogCvmfs(kLogCvmfs, kLogDebug, "no unique inode, fall back to fuse ino");
       unique_inode = ino;
     }
-    retval = chunk_tables->inode2chunks.Lookup(unique_inode, &chunks);
+    retval = handle_shard->handle2fd.Lookup(chunk_handle, &chunk_fd);
     assert(retval);
-    chunk_tables->Unlock();
+    handle_shard->Unlock();
+    ChunkTables::Shard *inode_shard = chunk_tables->Inode2Shard(unique_inode);
+    inode_shard->Lock();
+    retval = inode_shard->inode2chunks.Lookup(unique_inode, &chunks);
+    assert(retval);
+    inode_shard->Unlock();
 
     unsigned chunk_idx = chunks.FindChunkIdx(off);
 
-    // Lock chunk handle
-    pthread_mutex_t *handle_lock = chunk_tables->Handle2Lock(chunk_handle);
-    MutexLockGuard m(handle_lock);
-    chunk_tables->Lock();
-    retval = chunk_tables->handle2fd.Lookup(chunk_handle, &chunk_fd);
-    assert(retval);
-    chunk_tables->Unlock();
-
     // Fetch all needed chunks and read the requested data
     off_t offset_in_chunk = off - chunks.list->AtPtr(chunk_idx)->offset();
     do {
@@ -1410,9 +1716,9 @@ static void cvmfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
         }
         if (chunk_fd.fd < 0) {
           chunk_fd.fd = -1;
-          chunk_tables->Lock();
-          chunk_tables->handle2fd.Insert(chunk_handle, chunk_fd);
-          chunk_tables->Unlock();
+          handle_shard->Lock();
+          handle_shard->handle2fd.Insert(chunk_handle, chunk_fd);
+          handle_shard->Unlock();
 
           LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogErr,
               "EIO (05) on %s", chunks.path.ToString().c_str() );
@@ -1432,18 +1738,34 @@ static void cvmfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
         chunks.list->AtPtr(chunk_idx)->size() - offset_in_chunk;
       size_t bytes_to_read_in_chunk =
         std::min(bytes_to_read, remaining_bytes_in_chunk);
-      const int64_t bytes_fetched = file_system_->cache_mgr()->Pread(
-        chunk_fd.fd,
-        data + overall_bytes_fetched,
-        bytes_to_read_in_chunk,
-        offset_in_chunk);
+#ifdef FUSE_CAP_SPLICE_WRITE
+      const bool spliced = splice &&
+        splice_reply.AddFd(chunk_fd.fd, bytes_to_read_in_chunk,
+                           offset_in_chunk, true);
+#else
+      const bool spliced = false;
+#endif
+      int64_t bytes_fetched;
+      if (spliced) {
+        bytes_fetched = bytes_to_read_in_chunk;
+      } else {
+        bytes_fetched = file_system_->cache_mgr()->Pread(
+          chunk_fd.fd,
+          data + overall_bytes_fetched,
+          bytes_to_read_in_chunk,
+          offset_in_chunk);
+#ifdef FUSE_CAP_SPLICE_WRITE
+        if (splice && (bytes_fetched > 0))
+          splice_reply.AddMem(data + overall_bytes_fetched, bytes_fetched);
+#endif
+      }
 
       if (bytes_fetched < 0) {
         LogCvmfs(kLogCvmfs, kLogSyslogErr, "read err no %" PRId64 " (%s)",
                  bytes_fetched, chunks.path.ToString().c_str());
-        chunk_tables->Lock();
-        chunk_tables->handle2fd.Insert(chunk_handle, chunk_fd);
-        chunk_tables->Unlock();
+        handle_shard->Lock();
+        handle_shard->handle2fd.Insert(chunk_handle, chunk_fd);
+        handle_shard->Unlock();
         if ( EIO == errno || EIO == -bytes_fetched ) {
           LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogErr,
              "EIO (07) on %s", chunks.path.ToString().c_str() );
@@ -1462,12 +1784,52 @@ static void cvmfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
              (chunk_idx < chunks.list->size()));
 
     // Update chunk file descriptor
-    chunk_tables->Lock();
-    chunk_tables->handle2fd.Insert(chunk_handle, chunk_fd);
-    chunk_tables->Unlock();
+    handle_shard->Lock();
+    handle_shard->handle2fd.Insert(chunk_handle, chunk_fd);
+    handle_shard->Unlock();
     LogCvmfs(kLogCvmfs, kLogDebug, "released chunk file descriptor %d",
              chunk_fd.fd);
+  } else if (TestBit(kBitSparse, abs_fd)) {
+    ClearBit(kBitSparse, &abs_fd);
+    SparseCache *sparse_cache = mount_point_->sparse_cache();
+    if (sparse_cache == NULL) {
+      fuse_reply_err(req, EBADF);
+      return;
+    }
+    const struct fuse_ctx *fuse_ctx = fuse_req_ctx(req);
+    FuseInterruptCue ic(&req);
+    ClientCtxGuard ctx_guard(fuse_ctx->uid, fuse_ctx->gid, fuse_ctx->pid, &ic);
+    const int64_t nbytes = sparse_cache->Pread(abs_fd, data, size, off);
+    if (nbytes < 0) {
+      if (nbytes == -EIO) {
+        perf::Inc(file_system_->n_eio_total());
+        perf::Inc(file_system_->n_eio_08());
+      }
+      fuse_reply_err(req, -nbytes);
+      return;
+    }
+    overall_bytes_fetched = nbytes;
   } else {
+#ifdef FUSE_CAP_SPLICE_WRITE
+    if (splice) {
+      const int64_t file_size = file_system_->cache_mgr()->GetSize(abs_fd);
+      if (file_size >= 0) {
+        const size_t nbytes = (off >= file_size) ? 0 :
+          std::min(static_cast<uint64_t>(size),
+                   static_cast<uint64_t>(file_size - off));
+        if (nbytes == 0) {
+          fuse_reply_buf(req, NULL, 0);
+          return;
+        }
+        if (splice_reply.AddFd(abs_fd, nbytes, off, false)) {
+          splice_reply.Send(req);
+          LogCvmfs(kLogCvmfs, kLogDebug, "spliced %" PRIu64 " bytes to user",
+                   uint64_t(nbytes));
+          return;
+        }
+      }
+    }
+#endif
     int64_t nbytes = file_system_->cache_mgr()->Pread(abs_fd, data, size, off);
     if (nbytes < 0) {
       if ( EIO == errno || EIO == -nbytes ) {
@@ -1490,7 +1852,16 @@ static void cvmfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
   }
 
   // Push it to user
+#ifdef FUSE_CAP_SPLICE_WRITE
+  if (splice_reply.num_spliced() > 0) {
+    assert(splice_reply.size() == overall_bytes_fetched);
+    splice_reply.Send(req);
+  } else {
+    fuse_reply_buf(req, data, overall_bytes_fetched);
+  }
+#else
   fuse_reply_buf(req, data, overall_bytes_fetched);
+#endif
   LogCvmfs(kLogCvmfs, kLogDebug, "pushed %d bytes to user",
            overall_bytes_fetched);
 }
@@ -1534,39 +1905,50 @@ static void cvmfs_release(fuse_req_t req, fuse_ino_t ino,
     bool retval;
 
     ChunkTables *chunk_tables = mount_point_->chunk_tables();
-    chunk_tables->Lock();
-    retval = chunk_tables->handle2uniqino.Lookup(chunk_handle, &unique_inode);
+    ChunkTables::Shard *handle_shard = chunk_tables->Handle2Shard(chunk_handle);
+    handle_shard->Lock();
+    retval = handle_shard->handle2uniqino.Lookup(chunk_handle, &unique_inode);
     if (!retval) {
       LogCvmfs(kLogCvmfs, kLogDebug, "no unique inode, fall back to fuse ino");
       unique_inode = ino;
     } else {
-      chunk_tables->handle2uniqino.Erase(chunk_handle);
+      handle_shard->handle2uniqino.Erase(chunk_handle);
     }
-    retval = chunk_tables->handle2fd.Lookup(chunk_handle, &chunk_fd);
+    retval = handle_shard->handle2fd.Lookup(chunk_handle, &chunk_fd);
     assert(retval);
-    chunk_tables->handle2fd.Erase(chunk_handle);
+    handle_shard->handle2fd.Erase(chunk_handle);
+    handle_shard->Unlock();
 
-    retval = chunk_tables->inode2references.Lookup(unique_inode, &refctr);
+    ChunkTables::Shard *inode_shard = chunk_tables->Inode2Shard(unique_inode);
+    inode_shard->Lock();
+    retval = inode_shard->inode2references.Lookup(unique_inode, &refctr);
     assert(retval);
     refctr--;
     if (refctr == 0) {
       LogCvmfs(kLogCvmfs, kLogDebug, "releasing chunk list for inode %" PRIu64,
                uint64_t(unique_inode));
       FileChunkReflist to_delete;
-      retval = chunk_tables->inode2chunks.Lookup(unique_inode, &to_delete);
+      retval = inode_shard->inode2chunks.Lookup(unique_inode, &to_delete);
       assert(retval);
-      chunk_tables->inode2references.Erase(unique_inode);
-      chunk_tables->inode2chunks.Erase(unique_inode);
+      inode_shard->inode2references.Erase(unique_inode);
+      inode_shard->inode2chunks.Erase(unique_inode);
       delete to_delete.list;
     } else {
-      chunk_tables->inode2references.Insert(unique_inode, refctr);
+      inode_shard->inode2references.Insert(unique_inode, refctr);
     }
-    chunk_tables->Unlock();
+    inode_shard->Unlock();
 
     if (chunk_fd.fd != -1)
       file_system_->cache_mgr()->Close(chunk_fd.fd);
     perf::Dec(file_system_->no_open_files());
+  } else if (TestBit(kBitSparse, abs_fd)) {
+    ClearBit(kBitSparse, &abs_fd);
+    if (mount_point_->sparse_cache() != NULL)
+      mount_point_->sparse_cache()->Close(abs_fd);
+    perf::Dec(file_system_->no_open_files());
   } else {
+    ReleasePassthrough(req, abs_fd);
+    ClearBackingId(&abs_fd);
     if (file_system_->cache_mgr()->Close(abs_fd) == 0) {
       perf::Dec(file_system_->no_open_files());
     }
@@ -1949,6 +2331,48 @@ static void cvmfs_init(void *userdata, struct fuse_conn_info *conn) {
 #endif
   }
 
+  if (mount_point_->fuse_passthrough()) {
+#ifdef FUSE_CAP_PASSTHROUGH
+    if ((conn->capable & FUSE_CAP_PASSTHROUGH) == FUSE_CAP_PASSTHROUGH) {
+      conn->want |= FUSE_CAP_PASSTHROUGH;
+      // The backing files are regular files of the cache directory
+      conn->max_backing_stack_depth = 1;
+      LogCvmfs(kLogCvmfs, kLogDebug, "FUSE: Enable passthrough");
+    } else {
+      mount_point_->DisableFusePassthrough();
+      LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogWarn,
+           "FUSE: Passthrough requested but missing fuse kernel support, "
+           "falling back to regular reads");
+    }
+#else
+    mount_point_->DisableFusePassthrough();
+    LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogWarn,
+          "FUSE: Passthrough requested but missing libfuse support, "
+          "falling back to regular reads");
+#endif
+  }
+
+  if (mount_point_->fuse_splice()) {
+#ifdef FUSE_CAP_SPLICE_WRITE
+    if ((conn->capable & FUSE_CAP_SPLICE_WRITE) == FUSE_CAP_SPLICE_WRITE) {
+      conn->want |= FUSE_CAP_SPLICE_WRITE;
+      if ((conn->capable & FUSE_CAP_SPLICE_MOVE) == FUSE_CAP_SPLICE_MOVE)
+        conn->want |= FUSE_CAP_SPLICE_MOVE;
+      LogCvmfs(kLogCvmfs, kLogDebug, "FUSE: Enable splice for read replies");
+    } else {
+      mount_point_->DisableFuseSplice();
+      LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogWarn,
+           "FUSE: Splice requested but missing fuse kernel support, "
+           "falling back to copying reads");
+    }
+#else
+    mount_point_->DisableFuseSplice();
+    LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogWarn,
+          "FUSE: Splice requested but missing libfuse support, "
+          "falling back to copying reads");
+#endif
+  }
+
 #ifdef FUSE_CAP_EXPIRE_ONLY
   if ((conn->capable & FUSE_CAP_EXPIRE_ONLY) == FUSE_CAP_EXPIRE_ONLY) {
     mount_point_->EnableFuseExpireEntry();
@@ -2445,8 +2869,27 @@ static bool MaintenanceMode(const int fd_progress) {
 }
 
 
+/**
+ * Reports the time it took to save or restore a state.  The time depends on
+ * the size of the state, e.g. on the number of paths in the inode tracker,
+ * and the file system is blocked in the meantime.
+ */
+static void ReportStateTime(const int fd_progress,
+                            const string &action,
+                            const loader::StateId state_id,
+                            const uint64_t start_ns)
+{
+  const uint64_t duration_us = (platform_monotonic_time_ns() - start_ns) / 1000;
+  LogCvmfs(kLogCvmfs, kLogDebug, "%s state %d took %" PRIu64 "us",
+           action.c_str(), state_id, duration_us);
+  SendMsg2Socket(fd_progress, "  (" + action + " state " +
+    StringifyInt(state_id) + " took " + StringifyInt(duration_us) + "us)\n");
+}
+
+
 static bool SaveState(const int fd_progress, loader::StateList *saved_states) {
   string msg_progress;
+  uint64_t start_ns;
 
   unsigned num_open_dirs = cvmfs::directory_handles_->size();
   if (num_open_dirs != 0) {
@@ -2462,6 +2905,7 @@ static bool SaveState(const int fd_progress, loader::StateList *saved_states) {
     msg_progress = "Saving open directory handles (" +
       StringifyInt(num_open_dirs) + " handles)\n";
     SendMsg2Socket(fd_progress, msg_progress);
+    start_ns = platform_monotonic_time_ns();
 
     // TODO(jblomer): should rather be saved just in a malloc'd memory block
     cvmfs::DirectoryHandles *saved_handles =
@@ -2470,48 +2914,63 @@ static bool SaveState(const int fd_progress, loader::StateList *saved_states) {
     save_open_dirs->state_id = loader::kStateOpenDirs;
     save_open_dirs->state = saved_handles;
     saved_states->push_back(save_open_dirs);
+    ReportStateTime(fd_progress, "saving", loader::kStateOpenDirs, start_ns);
   }
 
   if (!cvmfs::file_system_->IsNfsSource()) {
     msg_progress = "Saving inode tracker\n";
     SendMsg2Socket(fd_progress, msg_progress);
-    glue::InodeTracker *saved_inode_tracker =
-      new glue::InodeTracker(*cvmfs::mount_point_->inode_tracker());
+    start_ns = platform_monotonic_time_ns();
+    // The file system is fenced, so the tracker can be handed over as is
+    // instead of being copied
+    glue::InodeTracker *saved_inode_tracker = new glue::InodeTracker();
+    saved_inode_tracker->Swap(cvmfs::mount_point_->inode_tracker());
     loader::SavedState *state_glue_buffer = new loader::SavedState();
-    state_glue_buffer->state_id = loader::kStateGlueBufferV4;
+    state_glue_buffer->state_id = loader::kStateGlueBufferV5;
     state_glue_buffer->state = saved_inode_tracker;
     saved_states->push_back(state_glue_buffer);
+    ReportStateTime(fd_progress, "saving", loader::kStateGlueBufferV5,
+                    start_ns);
   }
 
   msg_progress = "Saving negative entry cache\n";
   SendMsg2Socket(fd_progress, msg_progress);
+  start_ns = platform_monotonic_time_ns();
   glue::DentryTracker *saved_dentry_tracker =
     new glue::DentryTracker(*cvmfs::mount_point_->dentry_tracker());
   loader::SavedState *state_dentry_tracker = new loader::SavedState();
   state_dentry_tracker->state_id = loader::kStateDentryTracker;
   state_dentry_tracker->state = saved_dentry_tracker;
   saved_states->push_back(state_dentry_tracker);
+  ReportStateTime(fd_progress, "saving", loader::kStateDentryTracker, start_ns);
 
   msg_progress = "Saving page cache entry tracker\n";
   SendMsg2Socket(fd_progress, msg_progress);
+  start_ns = platform_monotonic_time_ns();
   glue::PageCacheTracker *saved_page_cache_tracker =
-    new glue::PageCacheTracker(*cvmfs::mount_point_->page_cache_tracker());
+    new glue::PageCacheTracker();
+  saved_page_cache_tracker->Swap(cvmfs::mount_point_->page_cache_tracker());
   loader::SavedState *state_page_cache_tracker = new loader::SavedState();
   state_page_cache_tracker->state_id = loader::kStatePageCacheTracker;
   state_page_cache_tracker->state = saved_page_cache_tracker;
   saved_states->push_back(state_page_cache_tracker);
+  ReportStateTime(fd_progress, "saving", loader::kStatePageCacheTracker,
+                  start_ns);
 
   msg_progress = "Saving chunk tables\n";
   SendMsg2Socket(fd_progress, msg_progress);
-  ChunkTables *saved_chunk_tables = new ChunkTables(
-    *cvmfs::mount_point_->chunk_tables());
+  start_ns = platform_monotonic_time_ns();
+  ChunkTables *saved_chunk_tables = new ChunkTables();
+  saved_chunk_tables->Swap(cvmfs::mount_point_->chunk_tables());
   loader::SavedState *state_chunk_tables = new loader::SavedState();
-  state_chunk_tables->state_id = loader::kStateOpenChunksV4;
+  state_chunk_tables->state_id = loader::kStateOpenChunksV5;
   state_chunk_tables->state = saved_chunk_tables;
   saved_states->push_back(state_chunk_tables);
+  ReportStateTime(fd_progress, "saving", loader::kStateOpenChunksV5, start_ns);
 
   msg_progress = "Saving inode generation\n";
   SendMsg2Socket(fd_progress, msg_progress);
+  start_ns = platform_monotonic_time_ns();
   cvmfs::inode_generation_info_.inode_generation +=
     cvmfs::mount_point_->catalog_mgr()->inode_gauge();
   cvmfs::InodeGenerationInfo *saved_inode_generation =
@@ -2520,15 +2979,32 @@ static bool SaveState(const int fd_progress, loader::StateList *saved_states) {
   state_inode_generation->state_id = loader::kStateInodeGeneration;
   state_inode_generation->state = saved_inode_generation;
   saved_states->push_back(state_inode_generation);
+  ReportStateTime(fd_progress, "saving", loader::kStateInodeGeneration,
+                  start_ns);
+
+  if (cvmfs::mount_point_->sparse_cache() != NULL) {
+    msg_progress = "Saving sparse cache handles\n";
+    SendMsg2Socket(fd_progress, msg_progress);
+    start_ns = platform_monotonic_time_ns();
+    loader::SavedState *state_sparse_cache = new loader::SavedState();
+    state_sparse_cache->state_id = loader::kStateSparseCache;
+    state_sparse_cache->state =
+      cvmfs::mount_point_->sparse_cache()->SaveState();
+    saved_states->push_back(state_sparse_cache);
+    ReportStateTime(fd_progress, "saving", loader::kStateSparseCache,
+                    start_ns);
+  }
 
   // Close open file catalogs
   ShutdownMountpoint();
 
+  start_ns = platform_monotonic_time_ns();
   loader::SavedState *state_cache_mgr = new loader::SavedState();
   state_cache_mgr->state_id = loader::kStateOpenFiles;
   state_cache_mgr->state =
     cvmfs::file_system_->cache_mgr()->SaveState(fd_progress);
   saved_states->push_back(state_cache_mgr);
+  ReportStateTime(fd_progress, "saving", loader::kStateOpenFiles, start_ns);
 
   msg_progress = "Saving open files counter\n";
   uint32_t *saved_num_fd =
@@ -2551,6 +3027,8 @@ static bool RestoreState(const int fd_progress,
   cvmfs::mount_point_->page_cache_tracker()->Disable();
 
   for (unsigned i = 0, l = saved_states.size(); i < l; ++i) {
+    const uint64_t start_ns = platform_monotonic_time_ns();
+
     if (saved_states[i]->state_id == loader::kStateOpenDirs) {
       SendMsg2Socket(fd_progress, "Restoring open directory handles... ");
       delete cvmfs::directory_handles_;
@@ -2571,7 +3049,7 @@ static bool RestoreState(const int fd_progress,
     }
 
     if (saved_states[i]->state_id == loader::kStateGlueBuffer) {
-      SendMsg2Socket(fd_progress, "Migrating inode tracker (v1 to v4)... ");
+      SendMsg2Socket(fd_progress, "Migrating inode tracker (v1 to v5)... ");
       compat::inode_tracker::InodeTracker *saved_inode_tracker =
         (compat::inode_tracker::InodeTracker *)saved_states[i]->state;
       compat::inode_tracker::Migrate(
@@ -2580,7 +3058,7 @@ static bool RestoreState(const int fd_progress,
     }
 
     if (saved_states[i]->state_id == loader::kStateGlueBufferV2) {
-      SendMsg2Socket(fd_progress, "Migrating inode tracker (v2 to v4)... ");
+      SendMsg2Socket(fd_progress, "Migrating inode tracker (v2 to v5)... ");
       compat::inode_tracker_v2::InodeTracker *saved_inode_tracker =
         (compat::inode_tracker_v2::InodeTracker *)saved_states[i]->state;
       compat::inode_tracker_v2::Migrate(saved_inode_tracker,
@@ -2589,7 +3067,7 @@ static bool RestoreState(const int fd_progress,
     }
 
     if (saved_states[i]->state_id == loader::kStateGlueBufferV3) {
-      SendMsg2Socket(fd_progress, "Migrating inode tracker (v3 to v4)... ");
+      SendMsg2Socket(fd_progress, "Migrating inode tracker (v3 to v5)... ");
       compat::inode_tracker_v3::InodeTracker *saved_inode_tracker =
         (compat::inode_tracker_v3::InodeTracker *)saved_states[i]->state;
       compat::inode_tracker_v3::Migrate(saved_inode_tracker,
@@ -2598,12 +3076,21 @@ static bool RestoreState(const int fd_progress,
     }
 
     if (saved_states[i]->state_id == loader::kStateGlueBufferV4) {
+      SendMsg2Socket(fd_progress, "Migrating inode tracker (v4 to v5)... ");
+      compat::inode_tracker_v4::InodeTracker *saved_inode_tracker =
+        (compat::inode_tracker_v4::InodeTracker *)saved_states[i]->state;
+      compat::inode_tracker_v4::Migrate(saved_inode_tracker,
+                                        cvmfs::mount_point_->inode_tracker());
+      SendMsg2Socket(fd_progress, " done\n");
+    }
+
+    if (saved_states[i]->state_id == loader::kStateGlueBufferV5) {
       SendMsg2Socket(fd_progress, "Restoring inode tracker... ");
-      cvmfs::mount_point_->inode_tracker()->~InodeTracker();
+      // Same layout, so that the saved tracker can be taken over as is.  The
+      // saved tracker receives the empty tracker and is freed later on.
       glue::InodeTracker *saved_inode_tracker =
         (glue::InodeTracker *)saved_states[i]->state;
-      new (cvmfs::mount_point_->inode_tracker())
-        glue::InodeTracker(*saved_inode_tracker);
+      cvmfs::mount_point_->inode_tracker()->Swap(saved_inode_tracker);
       SendMsg2Socket(fd_progress, " done\n");
     }
 
@@ -2619,49 +3106,56 @@ static bool RestoreState(const int fd_progress,
 
     if (saved_states[i]->state_id == loader::kStatePageCacheTracker) {
       SendMsg2Socket(fd_progress, "Restoring page cache entry tracker... ");
-      cvmfs::mount_point_->page_cache_tracker()->~PageCacheTracker();
       glue::PageCacheTracker *saved_page_cache_tracker =
         (glue::PageCacheTracker *)saved_states[i]->state;
-      new (cvmfs::mount_point_->page_cache_tracker())
-        glue::PageCacheTracker(*saved_page_cache_tracker);
+      cvmfs::mount_point_->page_cache_tracker()->Swap(
+        saved_page_cache_tracker);
       SendMsg2Socket(fd_progress, " done\n");
     }
 
     ChunkTables *chunk_tables = cvmfs::mount_point_->chunk_tables();
 
     if (saved_states[i]->state_id == loader::kStateOpenChunks) {
-      SendMsg2Socket(fd_progress, "Migrating chunk tables (v1 to v4)... ");
+      SendMsg2Socket(fd_progress, "Migrating chunk tables (v1 to v5)... ");
       compat::chunk_tables::ChunkTables *saved_chunk_tables =
         (compat::chunk_tables::ChunkTables *)saved_states[i]->state;
       compat::chunk_tables::Migrate(saved_chunk_tables, chunk_tables);
       SendMsg2Socket(fd_progress,
-        StringifyInt(chunk_tables->handle2fd.size()) + " handles\n");
+        StringifyInt(chunk_tables->NumHandles()) + " handles\n");
     }
 
     if (saved_states[i]->state_id == loader::kStateOpenChunksV2) {
-      SendMsg2Socket(fd_progress, "Migrating chunk tables (v2 to v4)... ");
+      SendMsg2Socket(fd_progress, "Migrating chunk tables (v2 to v5)... ");
       compat::chunk_tables_v2::ChunkTables *saved_chunk_tables =
         (compat::chunk_tables_v2::ChunkTables *)saved_states[i]->state;
       compat::chunk_tables_v2::Migrate(saved_chunk_tables, chunk_tables);
       SendMsg2Socket(fd_progress,
-        StringifyInt(chunk_tables->handle2fd.size()) + " handles\n");
+        StringifyInt(chunk_tables->NumHandles()) + " handles\n");
     }
 
     if (saved_states[i]->state_id == loader::kStateOpenChunksV3) {
-      SendMsg2Socket(fd_progress, "Migrating chunk tables (v3 to v4)... ");
+      SendMsg2Socket(fd_progress, "Migrating chunk tables (v3 to v5)... ");
       compat::chunk_tables_v3::ChunkTables *saved_chunk_tables =
         (compat::chunk_tables_v3::ChunkTables *)saved_states[i]->state;
       compat::chunk_tables_v3::Migrate(saved_chunk_tables, chunk_tables);
       SendMsg2Socket(fd_progress,
-        StringifyInt(chunk_tables->handle2fd.size()) + " handles\n");
+        StringifyInt(chunk_tables->NumHandles()) + " handles\n");
     }
 
     if (saved_states[i]->state_id == loader::kStateOpenChunksV4) {
+      SendMsg2Socket(fd_progress, "Migrating chunk tables (v4 to v5)... ");
+      compat::chunk_tables_v4::ChunkTables *saved_chunk_tables =
+        (compat::chunk_tables_v4::ChunkTables *)saved_states[i]->state;
+      compat::chunk_tables_v4::Migrate(saved_chunk_tables, chunk_tables);
+      SendMsg2Socket(fd_progress,
+        StringifyInt(chunk_tables->NumHandles()) + " handles\n");
+    }
+
+    if (saved_states[i]->state_id == loader::kStateOpenChunksV5) {
       SendMsg2Socket(fd_progress, "Restoring chunk tables... ");
-      chunk_tables->~ChunkTables();
       ChunkTables *saved_chunk_tables = reinterpret_cast<ChunkTables *>(
         saved_states[i]->state);
-      new (chunk_tables) ChunkTables(*saved_chunk_tables);
+      chunk_tables->Swap(saved_chunk_tables);
       SendMsg2Socket(fd_progress, " done\n");
     }
 
@@ -2683,6 +3177,17 @@ static bool RestoreState(const int fd_progress,
       SendMsg2Socket(fd_progress, " done\n");
     }
 
+    if (saved_states[i]->state_id == loader::kStateSparseCache) {
+      SendMsg2Socket(fd_progress, "Restoring sparse cache handles... ");
+      // Without a sparse cache, reads and releases of the saved handles fail
+      // with EBADF
+      if (cvmfs::mount_point_->sparse_cache() != NULL) {
+        cvmfs::mount_point_->sparse_cache()->RestoreState(
+          static_cast<SparseCache::SavedState *>(saved_states[i]->state));
+      }
+      SendMsg2Socket(fd_progress, " done\n");
+    }
+
     if (saved_states[i]->state_id == loader::kStateOpenFilesCounter) {
       SendMsg2Socket(fd_progress, "Restoring open files counter... ");
       cvmfs::file_system_->no_open_files()->Set(*(reinterpret_cast<uint32_t *>(
@@ -2699,6 +3204,9 @@ static bool RestoreState(const int fd_progress,
         cvmfs::file_system_->RemapCatalogFd(0, new_root_fd);
       }
     }
+
+    ReportStateTime(fd_progress, "restoring", saved_states[i]->state_id,
+                    start_ns);
   }
   if (cvmfs::mount_point_->inode_annotation()) {
     uint64_t saved_generation = cvmfs::inode_generation_info_.inode_generation;
@@ -2737,6 +3245,12 @@ static void FreeSavedState(const int fd_progress,
           saved_states[i]->state);
         break;
       case loader::kStateGlueBufferV4:
+        SendMsg2Socket(
+          fd_progress, "Releasing saved glue buffer (version 4)\n");
+        delete static_cast<compat::inode_tracker_v4::InodeTracker *>(
+          saved_states[i]->state);
+        break;
+      case loader::kStateGlueBufferV5:
         SendMsg2Socket(fd_progress, "Releasing saved glue buffer\n");
         delete static_cast<glue::InodeTracker *>(saved_states[i]->state);
         break;
@@ -2764,6 +3278,11 @@ static void FreeSavedState(const int fd_progress,
           saved_states[i]->state);
         break;
       case loader::kStateOpenChunksV4:
+        SendMsg2Socket(fd_progress, "Releasing chunk tables (version 4)\n");
+        delete static_cast<compat::chunk_tables_v4::ChunkTables *>(
+          saved_states[i]->state);
+        break;
+      case loader::kStateOpenChunksV5:
         SendMsg2Socket(fd_progress, "Releasing chunk tables\n");
         delete static_cast<ChunkTables *>(saved_states[i]->state);
         break;
@@ -2776,6 +3295,11 @@ static void FreeSavedState(const int fd_progress,
         cvmfs::file_system_->cache_mgr()->FreeState(
           fd_progress, saved_states[i]->state);
         break;
+      case loader::kStateSparseCache:
+        SendMsg2Socket(fd_progress, "Releasing saved sparse cache handles\n");
+        SparseCache::FreeState(
+          static_cast<SparseCache::SavedState *>(saved_states[i]->state));
+        break;
       case loader::kStateOpenFilesCounter:
         SendMsg2Socket(fd_progress, "Releasing open files counter\n");
         delete static_cast<uint32_t *>(saved_states[i]->state);
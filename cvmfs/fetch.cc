@@ -16,7 +16,9 @@
 #include "statistics.h"
 #include "util/concurrency.h"
 #include "util/logging.h"
+#include "util/platform.h"
 #include "util/posix.h"
+#include "util/smalloc.h"
 
 using namespace std;  // NOLINT
 
@@ -49,7 +51,6 @@ void TLSDestructor(void *data) {
  * removes the pointer to it from tls_blocks_.
  */
 void Fetcher::CleanupTls(ThreadLocalStorage *tls) {
-  ClosePipe(tls->pipe_wait);
   delete tls;
 }
 
@@ -65,7 +66,6 @@ Fetcher::ThreadLocalStorage *Fetcher::GetTls() {
 
   tls = new ThreadLocalStorage();
   tls->fetcher = this;
-  MakePipe(tls->pipe_wait);
   tls->download_job.destination = download::kDestinationSink;
   tls->download_job.compressed = true;
   tls->download_job.probe_hosts = true;
@@ -86,7 +86,8 @@ int Fetcher::Fetch(
   const zlib::Algorithms compression_algorithm,
   const CacheManager::ObjectType object_type,
   const std::string &alt_url,
-  off_t range_offset)
+  off_t range_offset,
+  const bool allow_streaming)
 {
   int fd_return;  // Read-only file descriptor that is returned
   int retval;
@@ -108,17 +109,28 @@ int Fetcher::Fetch(
   }
 
   ThreadLocalStorage *tls = GetTls();
+  InflightDownload *inflight;
 
   // Synchronization point: either act as a master thread for this object or
   // enqueue to the list of waiting threads.
   pthread_mutex_lock(lock_queues_download_);
+  std::map<shash::Any, int>::const_iterator iStream = streams_.find(id);
+  if (iStream != streams_.end()) {
+    fd_return = cache_mgr_->Dup(iStream->second);
+    pthread_mutex_unlock(lock_queues_download_);
+    LogCvmfs(kLogCache, kLogDebug, "joining stream of %s", name.c_str());
+    return fd_return;
+  }
   ThreadQueues::iterator iDownloadQueue = queues_download_.find(id);
   if (iDownloadQueue != queues_download_.end()) {
     LogCvmfs(kLogCache, kLogDebug, "waiting for download of %s", name.c_str());
 
-    iDownloadQueue->second->push_back(tls->pipe_wait[1]);
+    InflightDownload *other = iDownloadQueue->second;
+    const unsigned slot = other->num_waiters++;
+    atomic_inc32(&other->refcount);
     pthread_mutex_unlock(lock_queues_download_);
-    ReadPipe(tls->pipe_wait[0], &fd_return, sizeof(int));
+    fd_return = other->Wait(slot);
+    other->Release();
 
     LogCvmfs(kLogCache, kLogDebug, "received from another thread fd %d for %s",
              fd_return, name.c_str());
@@ -132,7 +144,8 @@ int Fetcher::Fetch(
     }
 
     // Create a new queue for this chunk
-    queues_download_[id] = &tls->other_pipes_waiting;
+    inflight = new InflightDownload();
+    queues_download_[id] = inflight;
     pthread_mutex_unlock(lock_queues_download_);
   }
 
@@ -146,15 +159,26 @@ int Fetcher::Fetch(
   } else {
     url = "/" + (alt_url.size() ? alt_url : "data/" + id.MakePath());
   }
-  void *txn = alloca(cache_mgr_->SizeOfTxn());
+  // A streamed transaction outlives this call
+  const bool streaming = allow_streaming && (streaming_min_size_ > 0) &&
+    (size != CacheManager::kSizeUnknown) && (size >= streaming_min_size_) &&
+    (range_offset < 0);
+  void *txn = streaming ? smalloc(cache_mgr_->SizeOfTxn())
+                        : alloca(cache_mgr_->SizeOfTxn());
   retval = cache_mgr_->StartTxn(id, size, txn);
   if (retval < 0) {
     LogCvmfs(kLogCache, kLogDebug, "could not start transaction on %s",
              name.c_str());
-    SignalWaitingThreads(retval, id, tls);
+    if (streaming)
+      free(txn);
+    SignalWaitingThreads(retval, id, inflight);
     return retval;
   }
   cache_mgr_->CtrlTxn(CacheManager::ObjectInfo(object_type, name), 0, txn);
+  if (streaming) {
+    return StartStreaming(id, size, url, name, compression_algorithm, txn,
+                          inflight);
+  }
 
   LogCvmfs(kLogCache, kLogDebug, "miss: %s %s", name.c_str(), url.c_str());
   TransactionSink sink(cache_mgr_, txn);
@@ -180,17 +204,17 @@ int Fetcher::Fetch(
     fd_return = cache_mgr_->OpenFromTxn(txn);
     if (fd_return < 0) {
       cache_mgr_->AbortTxn(txn);
-      SignalWaitingThreads(fd_return, id, tls);
+      SignalWaitingThreads(fd_return, id, inflight);
       return fd_return;
     }
 
     retval = cache_mgr_->CommitTxn(txn);
     if (retval < 0) {
       cache_mgr_->Close(fd_return);
-      SignalWaitingThreads(retval, id, tls);
+      SignalWaitingThreads(retval, id, inflight);
       return retval;
     }
-    SignalWaitingThreads(fd_return, id, tls);
+    SignalWaitingThreads(fd_return, id, inflight);
     return fd_return;
   }
 
@@ -201,7 +225,7 @@ int Fetcher::Fetch(
            download::Code2Ascii(tls->download_job.error_code));
   cache_mgr_->AbortTxn(txn);
   backoff_throttle_->Throttle();
-  SignalWaitingThreads(-EIO, id, tls);
+  SignalWaitingThreads(-EIO, id, inflight);
   return -EIO;
 }
 
@@ -214,6 +238,7 @@ Fetcher::Fetcher(
   bool external)
   : external_(external)
   , lock_queues_download_(NULL)
+  , streaming_min_size_(0)
   , lock_tls_blocks_(NULL)
   , cache_mgr_(cache_mgr)
   , download_mgr_(download_mgr)
@@ -234,12 +259,18 @@ Fetcher::Fetcher(
     "overall number of downloaded files (incl. catalogs, chunks)");
   n_invocations = statistics.RegisterTemplated("n_invocations",
     "overall number of object requests (incl. catalogs, chunks)");
+  n_streamed = statistics.RegisterTemplated("n_streamed",
+    "overall number of files opened while being downloaded");
+  atomic_init32(&num_streaming_jobs_);
 }
 
 
 Fetcher::~Fetcher() {
   int retval;
 
+  while (atomic_read32(&num_streaming_jobs_) > 0)
+    SafeSleepMs(50);
+
   {
     MutexLockGuard m(lock_tls_blocks_);
     for (unsigned i = 0; i < tls_blocks_.size(); ++i)
@@ -259,6 +290,50 @@ Fetcher::~Fetcher() {
 }
 
 
+bool Fetcher::IsStreaming(int fd) {
+  return (streaming_min_size_ > 0) && (cache_mgr_->GetBackingFd(fd) < 0);
+}
+
+
+/**
+ * Finishes the download and commits the transaction of a streamed object.
+ */
+void *Fetcher::MainStreaming(void *data) {
+  StreamingJob *job = static_cast<StreamingJob *>(data);
+  Fetcher *fetcher = job->fetcher;
+  CacheManager *cache_mgr = fetcher->cache_mgr_;
+
+  fetcher->download_mgr_->Fetch(&job->download_job);
+  if (job->download_job.error_code == download::kFailOk) {
+    LogCvmfs(kLogCache, kLogDebug, "finished streaming of %s",
+             job->url.c_str());
+    int retval = cache_mgr->CommitTxn(job->txn);
+    if (retval < 0) {
+      LogCvmfs(kLogCache, kLogDebug, "failed to commit stream of %s (%d)",
+               job->name.c_str(), retval);
+    }
+  } else {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+             "failed to stream %s (hash: %s, error %d [%s])",
+             job->name.c_str(), job->id.ToString().c_str(),
+             job->download_job.error_code,
+             download::Code2Ascii(job->download_job.error_code));
+    cache_mgr->AbortTxn(job->txn);
+    fetcher->backoff_throttle_->Throttle();
+  }
+
+  {
+    MutexLockGuard m(fetcher->lock_queues_download_);
+    fetcher->streams_.erase(job->id);
+  }
+  cache_mgr->Close(job->fd);
+  free(job->txn);
+  delete job;
+  atomic_dec32(&fetcher->num_streaming_jobs_);
+  return NULL;
+}
+
+
 /**
  * Depending on the object type, uses either Open() or OpenPinned() from the
  * cache manager
@@ -277,18 +352,116 @@ int Fetcher::OpenSelect(
 }
 
 
+/**
+ * Returns a file descriptor to the open transaction txn and hands the download
+ * over to a background thread.  Takes ownership of txn.
+ */
+int Fetcher::StartStreaming(
+  const shash::Any &id,
+  const uint64_t size,
+  const std::string &url,
+  const std::string &name,
+  const zlib::Algorithms compression_algorithm,
+  void *txn,
+  InflightDownload *inflight)
+{
+  int fd_return = cache_mgr_->OpenFromTxnStreaming(txn);
+  int fd_stream = (fd_return >= 0) ? cache_mgr_->Dup(fd_return) : fd_return;
+  if (fd_stream < 0) {
+    LogCvmfs(kLogCache, kLogDebug, "could not stream %s (%d)",
+             name.c_str(), fd_stream);
+    if (fd_return >= 0)
+      cache_mgr_->Close(fd_return);
+    cache_mgr_->AbortTxn(txn);
+    free(txn);
+    SignalWaitingThreads(fd_stream, id, inflight);
+    return fd_stream;
+  }
+
+  LogCvmfs(kLogCache, kLogDebug, "miss, streaming: %s %s",
+           name.c_str(), url.c_str());
+  StreamingJob *job = new StreamingJob(this, txn);
+  job->id = id;
+  job->url = url;
+  job->name = name;
+  job->fd = fd_stream;
+  job->download_job.url = &job->url;
+  job->download_job.destination = download::kDestinationSink;
+  job->download_job.destination_sink = &job->sink;
+  job->download_job.expected_hash = &job->id;
+  job->download_job.extra_info = &job->name;
+  job->download_job.compressed = (compression_algorithm == zlib::kZlibDefault);
+  job->download_job.probe_hosts = true;
+  job->download_job.range_size = size;
+  // The download continues if the requesting process is interrupted
+  ClientCtx *ctx = ClientCtx::GetInstance();
+  if (ctx->IsSet()) {
+    InterruptCue *interrupt_cue;
+    ctx->Get(&job->download_job.uid,
+             &job->download_job.gid,
+             &job->download_job.pid,
+             &interrupt_cue);
+  }
+
+  {
+    MutexLockGuard m(lock_queues_download_);
+    streams_[id] = fd_stream;
+  }
+  atomic_inc32(&num_streaming_jobs_);
+  pthread_t thread_streaming;
+  int retval = pthread_create(&thread_streaming, NULL, MainStreaming, job);
+  assert(retval == 0);
+  retval = pthread_detach(thread_streaming);
+  assert(retval == 0);
+  perf::Inc(n_streamed);
+
+  SignalWaitingThreads(fd_return, id, inflight);
+  return fd_return;
+}
+
+
+/**
+ * Hands a file descriptor (or the error code) to every thread that waits for
+ * the object and releases the downloading thread's reference.
+ */
 void Fetcher::SignalWaitingThreads(
   const int fd,
   const shash::Any &id,
-  ThreadLocalStorage *tls)
+  InflightDownload *inflight)
 {
-  MutexLockGuard m(lock_queues_download_);
-  for (unsigned i = 0, s = tls->other_pipes_waiting.size(); i < s; ++i) {
-    int fd_dup = (fd >= 0) ? cache_mgr_->Dup(fd) : fd;
-    WritePipe(tls->other_pipes_waiting[i], &fd_dup, sizeof(int));
+  {
+    MutexLockGuard m(lock_queues_download_);
+    for (unsigned i = 0; i < inflight->num_waiters; ++i) {
+      int fd_dup = (fd >= 0) ? cache_mgr_->Dup(fd) : fd;
+      inflight->results.push_back(fd_dup);
+    }
+    queues_download_.erase(id);
   }
-  tls->other_pipes_waiting.clear();
-  queues_download_.erase(id);
+  inflight->Publish();
+  inflight->Release();
+}
+
+
+/**
+ * Blocks until the downloading thread published the results.  Waiters do not
+ * need lock_queues_download_ to pick up their file descriptor.
+ */
+int Fetcher::InflightDownload::Wait(const unsigned slot) {
+  while (atomic_read32(&state) == 0)
+    platform_futex_wait(&state, 0);
+  return results[slot];
+}
+
+
+void Fetcher::InflightDownload::Publish() {
+  atomic_inc32(&state);
+  platform_futex_wake(&state);
+}
+
+
+void Fetcher::InflightDownload::Release() {
+  if (atomic_xadd32(&refcount, -1) == 1)
+    delete this;
 }
 
 }  // namespace cvmfs
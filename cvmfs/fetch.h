@@ -16,6 +16,7 @@
 #include "gtest/gtest_prod.h"
 #include "network/download.h"
 #include "network/sink.h"
+#include "util/atomic.h"
 
 class BackoffThrottle;
 
@@ -57,6 +58,12 @@ class TransactionSink : public Sink {
  * If the object is not in the cache, it is downloaded and stored in the cache.
  *
  * Concurrent download requests for the same id are collapsed.
+ *
+ * In streaming mode, large objects are returned before their download is
+ * complete.  A background thread finishes the download while reads on the
+ * returned file descriptor block until their range arrived.  The content hash
+ * is still verified before the object is committed; if verification fails,
+ * reads on the descriptor fail with EIO.
  */
 class Fetcher : SingleCopy {
   FRIEND_TEST(T_Fetcher, GetTls);
@@ -80,60 +87,112 @@ class Fetcher : SingleCopy {
             const zlib::Algorithms compression_algorithm,
             const CacheManager::ObjectType object_type,
             const std::string &alt_url = "",
-            off_t range_offset = -1);
+            off_t range_offset = -1,
+            const bool allow_streaming = false);
+
+  /**
+   * Objects of at least min_size bytes are streamed if the caller allows it.
+   * Requires a cache manager that supports OpenFromTxnStreaming().
+   */
+  void EnableStreaming(const uint64_t min_size) {
+    streaming_min_size_ = min_size;
+  }
+  /**
+   * True if fd, returned by Fetch(), is still being downloaded.
+   */
+  bool IsStreaming(int fd);
 
   CacheManager *cache_mgr() { return cache_mgr_; }
   download::DownloadManager *download_mgr() { return download_mgr_; }
 
  private:
+  struct ThreadLocalStorage {
+    ThreadLocalStorage() : fetcher(NULL) { }
+
+    /**
+     * Used during cleanup to find tls_blocks_.
+     */
+    Fetcher *fetcher;
+    /**
+     * It is sufficient to construct the JobInfo object once per thread, not
+     * on every call to Fetch().
+     */
+    download::JobInfo download_job;
+  };
+
   /**
    * Multiple threads might want to download the same object at the same time.
    * If that happens, only the first thread performs the download.  The other
-   * threads wait on a pipe for a notification from the first thread.
+   * threads take a slot in the object's InflightDownload and sleep on its
+   * state word until the first thread publishes the result.
    */
-  struct ThreadLocalStorage {
-    ThreadLocalStorage() {
-      pipe_wait[0] = -1;
-      pipe_wait[1] = -1;
-      fetcher = NULL;
+  struct InflightDownload {
+    InflightDownload() : num_waiters(0) {
+      atomic_init32(&state);
+      atomic_init32(&refcount);
+      atomic_inc32(&refcount);
     }
+    int Wait(const unsigned slot);
+    void Publish();
+    void Release();
 
     /**
-     * Used during cleanup to find tls_blocks_.
+     * Zero until the results are published, used as a futex
      */
-    Fetcher *fetcher;
+    atomic_int32 state;
     /**
-     * Wait on the reading end if another thread is already downloading the same
-     * object.
+     * Held by the downloading thread and by every waiter
      */
-    int pipe_wait[2];
+    atomic_int32 refcount;
     /**
-     * Writer ends of all the pipes of threads that want to download the same
-     * object.
+     * Number of slots handed out, protected by lock_queues_download_
      */
-    std::vector<int> other_pipes_waiting;
+    unsigned num_waiters;
     /**
-     * It is sufficient to construct the JobInfo object once per thread, not
-     * on every call to Fetch().
+     * A file descriptor or -errno per slot
      */
-    download::JobInfo download_job;
+    std::vector<int> results;
   };
 
   /**
-   * Maps currently downloaded chunks to the other_pipes_waiting member of the
-   * thread local storage of the downloading thread.  This way, a thread can
-   * enqueue itself to such an other_pipes_waiting list and gets informed when
-   * the download is completed.
+   * Maps currently downloaded objects to their waiting threads.
+   */
+  typedef std::map<shash::Any, InflightDownload *> ThreadQueues;
+
+  /**
+   * Owns the transaction of a streamed download until it is committed.
    */
-  typedef std::map< shash::Any, std::vector<int> * > ThreadQueues;
+  struct StreamingJob {
+    StreamingJob(Fetcher *f, void *t)
+      : fetcher(f), txn(t), fd(-1), sink(f->cache_mgr_, t) { }
+    Fetcher *fetcher;
+    shash::Any id;
+    std::string url;
+    std::string name;
+    void *txn;
+    /**
+     * Keeps the stream registered until the transaction is committed
+     */
+    int fd;
+    TransactionSink sink;
+    download::JobInfo download_job;
+  };
 
   ThreadLocalStorage *GetTls();
   void CleanupTls(ThreadLocalStorage *tls);
   void SignalWaitingThreads(const int fd, const shash::Any &id,
-                            ThreadLocalStorage *tls);
+                            InflightDownload *inflight);
   int OpenSelect(const shash::Any &id,
                  const std::string &name,
                  const CacheManager::ObjectType object_type);
+  int StartStreaming(const shash::Any &id,
+                     const uint64_t size,
+                     const std::string &url,
+                     const std::string &name,
+                     const zlib::Algorithms compression_algorithm,
+                     void *txn,
+                     InflightDownload *inflight);
+  static void *MainStreaming(void *data);
 
   /**
    * If set to true, this fetcher is in 'external data' mode:
@@ -150,6 +209,15 @@ class Fetcher : SingleCopy {
   ThreadQueues queues_download_;
   pthread_mutex_t *lock_queues_download_;
 
+  /**
+   * Objects that are currently streamed, mapped to a file descriptor from
+   * which further requests for the same object are served.  Protected by
+   * lock_queues_download_.
+   */
+  std::map<shash::Any, int> streams_;
+  uint64_t streaming_min_size_;
+  atomic_int32 num_streaming_jobs_;
+
   /**
    * All the threads register their thread local storage here, so that it can
    * be cleaned up properly in the destructor of Fetcher.
@@ -162,6 +230,7 @@ class Fetcher : SingleCopy {
   BackoffThrottle *backoff_throttle_;
   perf::Counter *n_downloads;
   perf::Counter *n_invocations;
+  perf::Counter *n_streamed;
 };
 
 }  // namespace cvmfs
@@ -5,6 +5,7 @@
 #include "cvmfs_config.h"
 #include "file_chunk.h"
 
+#include <algorithm>
 #include <cassert>
 
 #include "util/murmur.hxx"
@@ -66,10 +67,12 @@ shash::Any FileChunkReflist::HashChunkList() {
 
 
 void ChunkTables::InitLocks() {
-  lock =
-    reinterpret_cast<pthread_mutex_t *>(smalloc(sizeof(pthread_mutex_t)));
-  int retval = pthread_mutex_init(lock, NULL);
-  assert(retval == 0);
+  for (unsigned i = 0; i < kNumShards; ++i) {
+    shards[i].lock =
+      reinterpret_cast<pthread_mutex_t *>(smalloc(sizeof(pthread_mutex_t)));
+    int retval = pthread_mutex_init(shards[i].lock, NULL);
+    assert(retval == 0);
+  }
 
   for (unsigned i = 0; i < kNumHandleLocks; ++i) {
     pthread_mutex_t *m =
@@ -82,10 +85,12 @@ void ChunkTables::InitLocks() {
 
 
 void ChunkTables::InitHashmaps() {
-  handle2uniqino.Init(16, 0, hasher_uint64t);
-  handle2fd.Init(16, 0, hasher_uint64t);
-  inode2chunks.Init(16, 0, hasher_uint64t);
-  inode2references.Init(16, 0, hasher_uint64t);
+  for (unsigned i = 0; i < kNumShards; ++i) {
+    shards[i].handle2uniqino.Init(16, 0, hasher_uint64t);
+    shards[i].handle2fd.Init(16, 0, hasher_uint64t);
+    shards[i].inode2chunks.Init(16, 0, hasher_uint64t);
+    shards[i].inode2references.Init(16, 0, hasher_uint64t);
+  }
 }
 
 
@@ -98,8 +103,10 @@ ChunkTables::ChunkTables() {
 
 
 ChunkTables::~ChunkTables() {
-  pthread_mutex_destroy(lock);
-  free(lock);
+  for (unsigned i = 0; i < kNumShards; ++i) {
+    pthread_mutex_destroy(shards[i].lock);
+    free(shards[i].lock);
+  }
   for (unsigned i = 0; i < kNumHandleLocks; ++i) {
     pthread_mutex_destroy(handle_locks.At(i));
     free(handle_locks.At(i));
@@ -119,10 +126,12 @@ ChunkTables &ChunkTables::operator= (const ChunkTables &other) {
   if (&other == this)
     return *this;
 
-  handle2uniqino.Clear();
-  handle2fd.Clear();
-  inode2chunks.Clear();
-  inode2references.Clear();
+  for (unsigned i = 0; i < kNumShards; ++i) {
+    shards[i].handle2uniqino.Clear();
+    shards[i].handle2fd.Clear();
+    shards[i].inode2chunks.Clear();
+    shards[i].inode2references.Clear();
+  }
   CopyFrom(other);
   return *this;
 }
@@ -131,10 +140,24 @@ ChunkTables &ChunkTables::operator= (const ChunkTables &other) {
 void ChunkTables::CopyFrom(const ChunkTables &other) {
   assert(version == other.version);
   next_handle = other.next_handle;
-  inode2references = other.inode2references;
-  inode2chunks = other.inode2chunks;
-  handle2fd = other.handle2fd;
-  handle2uniqino = other.handle2uniqino;
+  for (unsigned i = 0; i < kNumShards; ++i) {
+    shards[i].inode2references = other.shards[i].inode2references;
+    shards[i].inode2chunks = other.shards[i].inode2chunks;
+    shards[i].handle2fd = other.shards[i].handle2fd;
+    shards[i].handle2uniqino = other.shards[i].handle2uniqino;
+  }
+}
+
+
+void ChunkTables::Swap(ChunkTables *other) {
+  assert(version == other->version);
+  std::swap(next_handle, other->next_handle);
+  for (unsigned i = 0; i < kNumShards; ++i) {
+    shards[i].inode2references.Swap(&other->shards[i].inode2references);
+    shards[i].inode2chunks.Swap(&other->shards[i].inode2chunks);
+    shards[i].handle2fd.Swap(&other->shards[i].handle2fd);
+    shards[i].handle2uniqino.Swap(&other->shards[i].handle2uniqino);
+  }
 }
 
 
@@ -147,6 +170,26 @@ pthread_mutex_t *ChunkTables::Handle2Lock(const uint64_t handle) const {
 }
 
 
+/**
+ * Uses a different hash seed than the hash maps so that the keys of a shard
+ * are still spread evenly over the buckets of the shard's maps.
+ */
+ChunkTables::Shard *ChunkTables::Key2Shard(const uint64_t key) {
+  return &shards[MurmurHash2(&key, sizeof(key), 0x2a3c5f1e) % kNumShards];
+}
+
+
+unsigned ChunkTables::NumHandles() {
+  unsigned result = 0;
+  for (unsigned i = 0; i < kNumShards; ++i) {
+    shards[i].Lock();
+    result += shards[i].handle2fd.size();
+    shards[i].Unlock();
+  }
+  return result;
+}
+
+
 //------------------------------------------------------------------------------
 
 
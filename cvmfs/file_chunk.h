@@ -85,46 +85,68 @@ struct ChunkFd {
 
 
 /**
- * All chunk related data structures in the Fuse module.
+ * All chunk related data structures in the Fuse module.  The maps are
+ * partitioned into shards with their own locks, so that concurrent reads from
+ * different chunked files do not serialize on a single lock.  Maps keyed by
+ * handle are found in the shard of the handle, maps keyed by inode in the shard
+ * of the inode.  Users never hold more than one shard lock at a time.
  */
 struct ChunkTables {
+  struct Shard {
+    inline void Lock() {
+      int retval = pthread_mutex_lock(lock);
+      assert(retval == 0);
+    }
+
+    inline void Unlock() {
+      int retval = pthread_mutex_unlock(lock);
+      assert(retval == 0);
+    }
+
+    // Versions < 4 of ChunkTables didn't have this map.  Therefore, after a
+    // hot patch a handle can be missing from this map.  In this case, the fuse
+    // module falls back to the inode passed by the kernel.
+    SmallHashDynamic<uint64_t, uint64_t> handle2uniqino;
+    SmallHashDynamic<uint64_t, ChunkFd> handle2fd;
+    SmallHashDynamic<uint64_t, FileChunkReflist> inode2chunks;
+    SmallHashDynamic<uint64_t, uint32_t> inode2references;
+    pthread_mutex_t *lock;
+  };
+
   ChunkTables();
   ~ChunkTables();
   ChunkTables(const ChunkTables &other);
   ChunkTables &operator= (const ChunkTables &other);
   void CopyFrom(const ChunkTables &other);
+  /**
+   * Exchanges the maps with another instance without copying them.  Used on
+   * reload to hand the tables over to the new version of the library.  Neither
+   * instance must be in use by other threads.
+   */
+  void Swap(ChunkTables *other);
   void InitLocks();
   void InitHashmaps();
 
   pthread_mutex_t *Handle2Lock(const uint64_t handle) const;
+  Shard *Key2Shard(const uint64_t key);
+  Shard *Handle2Shard(const uint64_t handle) { return Key2Shard(handle); }
+  Shard *Inode2Shard(const uint64_t inode) { return Key2Shard(inode); }
 
-  inline void Lock() {
-    int retval = pthread_mutex_lock(lock);
-    assert(retval == 0);
-  }
-
-  inline void Unlock() {
-    int retval = pthread_mutex_unlock(lock);
-    assert(retval == 0);
-  }
+  uint64_t NextHandle() { return atomic_xadd64(&next_handle, 1); }
+  unsigned NumHandles();
 
   // Version 2 --> 4: add handle2uniqino
-  static const unsigned kVersion = 4;
+  // Version 4 --> 5: partition the maps into shards
+  static const unsigned kVersion = 5;
 
   int version;
   static const unsigned kNumHandleLocks = 128;
-  // Versions < 4 of ChunkTables didn't have this map.  Therefore, after a
-  // hot patch a handle can be missing from this map.  In this case, the fuse
-  // module falls back to the inode passed by the kernel.
-  SmallHashDynamic<uint64_t, uint64_t> handle2uniqino;
-  SmallHashDynamic<uint64_t, ChunkFd> handle2fd;
+  static const unsigned kNumShards = 32;
+  Shard shards[kNumShards];
   // The file descriptors attached to handles need to be locked.
   // Using a hash map to survive with a small, fixed number of locks
   BigVector<pthread_mutex_t *> handle_locks;
-  SmallHashDynamic<uint64_t, FileChunkReflist> inode2chunks;
-  SmallHashDynamic<uint64_t, uint32_t> inode2references;
-  uint64_t next_handle;
-  pthread_mutex_t *lock;
+  atomic_int64 next_handle;
 };
 
 
@@ -10,6 +10,7 @@
 #include <inttypes.h>
 #include <stdint.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
 #include <cstring>
@@ -74,6 +75,9 @@ FuseInvalidator::FuseInvalidator(
   , dentry_tracker_(dentry_tracker)
   , fuse_channel_or_session_(fuse_channel_or_session)
   , spawned_(false)
+  , max_ops_per_sec_(0)
+  , num_ops_window_(0)
+  , window_start_ns_(0)
 {
   g_fuse_notify_invalidation_ = fuse_notify_invalidation;
   MakePipe(pipe_ctrl_);
@@ -100,6 +104,15 @@ void FuseInvalidator::InvalidateInodes(Handle *handle) {
   WritePipe(pipe_ctrl_[1], &handle, sizeof(handle));
 }
 
+void FuseInvalidator::InvalidateKeys(Handle *handle, Keys *keys) {
+  assert(handle != NULL);
+  assert(keys != NULL);
+  char c = 'K';
+  WritePipe(pipe_ctrl_[1], &c, 1);
+  WritePipe(pipe_ctrl_[1], &handle, sizeof(handle));
+  WritePipe(pipe_ctrl_[1], &keys, sizeof(keys));
+}
+
 void FuseInvalidator::InvalidateDentry(
   uint64_t parent_ino, const NameString &name)
 {
@@ -155,10 +168,13 @@ void *FuseInvalidator::MainInvalidator(void *data) {
       continue;
     }
 
-    assert(c == 'I');
+    assert((c == 'I') || (c == 'K'));
     ReadPipe(invalidator->pipe_ctrl_[0], &handle, sizeof(handle));
-    LogCvmfs(kLogCvmfs, kLogDebug, "invalidating kernel caches, timeout %u",
-             handle->timeout_s_);
+    Keys *keys = NULL;
+    if (c == 'K')
+      ReadPipe(invalidator->pipe_ctrl_[0], &keys, sizeof(keys));
+    LogCvmfs(kLogCvmfs, kLogDebug, "invalidating kernel caches, timeout %u%s",
+             handle->timeout_s_, (keys == NULL) ? "" : " (targeted)");
 
     uint64_t deadline = platform_monotonic_time() + handle->timeout_s_;
 
@@ -174,6 +190,16 @@ void *FuseInvalidator::MainInvalidator(void *data) {
           break;
         }
       }
+      delete keys;
+      handle->SetDone();
+      continue;
+    }
+
+    invalidator->num_ops_window_ = 0;
+    invalidator->window_start_ns_ = platform_monotonic_time_ns();
+    if (keys != NULL) {
+      invalidator->EvictKeys(keys, deadline);
+      delete keys;
       handle->SetDone();
       continue;
     }
@@ -195,24 +221,8 @@ void *FuseInvalidator::MainInvalidator(void *data) {
       uint64_t inode = invalidator->evict_list_.At(i);
       if (inode == 0)
         inode = FUSE_ROOT_ID;
-      // Can fail, e.g. the inode might be already evicted
-
-      int dbg_retval;
-
-#if CVMFS_USE_LIBFUSE == 2
-      dbg_retval = fuse_lowlevel_notify_inval_inode(
-                    *reinterpret_cast<struct fuse_chan**>(
-                    invalidator->fuse_channel_or_session_), inode, 0, 0);
-#else
-      dbg_retval = fuse_lowlevel_notify_inval_inode(
-                    *reinterpret_cast<struct fuse_session**>(
-                    invalidator->fuse_channel_or_session_), inode, 0, 0);
-#endif
-      LogCvmfs(kLogCvmfs, kLogDebug,
-                "evicting inode %" PRIu64 " with retval: %d",
-                inode, dbg_retval);
-
-      (void) dbg_retval;  // prevent compiler complaining
+      invalidator->NotifyInvalInode(inode);
+      invalidator->Throttle();
 
       if ((++i % kCheckTimeoutFreqOps) == 0) {
         if (platform_monotonic_time() >= deadline) {
@@ -238,29 +248,8 @@ void *FuseInvalidator::MainInvalidator(void *data) {
     i = 0;
     while (dentries_copy->NextEntry(&dentry_cursor, &entry_parent, &entry_name))
     {
-      LogCvmfs(kLogCvmfs, kLogDebug, "evicting dentry %d --> %s",
-               entry_parent, entry_name.c_str());
-      // Can fail, e.g. the entry might be already evicted
-#if CVMFS_USE_LIBFUSE == 2
-      struct fuse_chan* channel_or_session =
-                                    *reinterpret_cast<struct fuse_chan**>(
-                                     invalidator->fuse_channel_or_session_);
-#else
-      struct fuse_session* channel_or_session =
-                                  *reinterpret_cast<struct fuse_session**>(
-                                  invalidator->fuse_channel_or_session_);
-#endif
-
-// we do not care if fuse kernel supports expire_entry as if it is
-// not support it will just be handled like a fuse_inval
-#ifdef FUSE_CAP_EXPIRE_ONLY
-      fuse_lowlevel_notify_expire_entry(channel_or_session,
-        entry_parent, entry_name.GetChars(), entry_name.GetLength(),
-        FUSE_LL_EXPIRE_ONLY);
-#else
-      fuse_lowlevel_notify_inval_entry(channel_or_session,
-        entry_parent, entry_name.GetChars(), entry_name.GetLength());
-#endif
+      invalidator->NotifyInvalDentry(entry_parent, entry_name);
+      invalidator->Throttle();
 
       if ((++i % kCheckTimeoutFreqOps) == 0) {
         if (atomic_read32(&invalidator->terminated_) == 1) {
@@ -282,6 +271,119 @@ void *FuseInvalidator::MainInvalidator(void *data) {
 }
 
 
+/**
+ * Targeted invalidation of the given keys.  Duplicate keys are removed first.
+ * Like in the full invalidation, inodes go first and dentries last.  After
+ * every batch of kCheckTimeoutFreqOps notifications, the eviction stops if
+ * the entries anyway expired by timeout or on termination.
+ */
+void FuseInvalidator::EvictKeys(Keys *keys, uint64_t deadline) {
+  sort(keys->inodes.begin(), keys->inodes.end());
+  keys->inodes.erase(unique(keys->inodes.begin(), keys->inodes.end()),
+                     keys->inodes.end());
+  sort(keys->dentries.begin(), keys->dentries.end());
+  keys->dentries.erase(unique(keys->dentries.begin(), keys->dentries.end()),
+                       keys->dentries.end());
+
+  const unsigned num_inodes = keys->inodes.size();
+  const unsigned num_keys = num_inodes + keys->dentries.size();
+  unsigned i = 0;
+  while (i < num_keys) {
+    if (i < num_inodes) {
+      NotifyInvalInode(keys->inodes[i]);
+    } else {
+      NotifyInvalDentry(keys->dentries[i - num_inodes].first,
+                        keys->dentries[i - num_inodes].second);
+    }
+    Throttle();
+
+    if ((++i % kCheckTimeoutFreqOps) == 0) {
+      if (platform_monotonic_time() >= deadline) {
+        LogCvmfs(kLogCvmfs, kLogDebug,
+                 "cancel cache eviction after %u entries due to timeout", i);
+        break;
+      }
+      if (atomic_read32(&terminated_) == 1) {
+        LogCvmfs(kLogCvmfs, kLogDebug,
+                 "cancel cache eviction due to termination");
+        break;
+      }
+    }
+  }
+  LogCvmfs(kLogCvmfs, kLogDebug,
+           "targeted cache eviction of %u inodes and %u dentries, "
+           "%u notifications sent", num_inodes, num_keys - num_inodes, i);
+}
+
+
+void FuseInvalidator::NotifyInvalInode(uint64_t inode) {
+  // Can fail, e.g. the inode might be already evicted
+  int dbg_retval;
+
+#if CVMFS_USE_LIBFUSE == 2
+  dbg_retval = fuse_lowlevel_notify_inval_inode(
+                *reinterpret_cast<struct fuse_chan**>(
+                fuse_channel_or_session_), inode, 0, 0);
+#else
+  dbg_retval = fuse_lowlevel_notify_inval_inode(
+                *reinterpret_cast<struct fuse_session**>(
+                fuse_channel_or_session_), inode, 0, 0);
+#endif
+  LogCvmfs(kLogCvmfs, kLogDebug,
+            "evicting inode %" PRIu64 " with retval: %d",
+            inode, dbg_retval);
+
+  (void) dbg_retval;  // prevent compiler complaining
+}
+
+
+void FuseInvalidator::NotifyInvalDentry(
+  uint64_t parent_ino, const NameString &name)
+{
+  LogCvmfs(kLogCvmfs, kLogDebug, "evicting dentry %" PRIu64 " --> %s",
+           parent_ino, name.c_str());
+  // Can fail, e.g. the entry might be already evicted
+#if CVMFS_USE_LIBFUSE == 2
+  struct fuse_chan* channel_or_session =
+                                *reinterpret_cast<struct fuse_chan**>(
+                                 fuse_channel_or_session_);
+#else
+  struct fuse_session* channel_or_session =
+                              *reinterpret_cast<struct fuse_session**>(
+                              fuse_channel_or_session_);
+#endif
+
+// we do not care if fuse kernel supports expire_entry as if it is
+// not support it will just be handled like a fuse_inval
+#ifdef FUSE_CAP_EXPIRE_ONLY
+  fuse_lowlevel_notify_expire_entry(channel_or_session,
+    parent_ino, name.GetChars(), name.GetLength(),
+    FUSE_LL_EXPIRE_ONLY);
+#else
+  fuse_lowlevel_notify_inval_entry(channel_or_session,
+    parent_ino, name.GetChars(), name.GetLength());
+#endif
+}
+
+
+/**
+ * Called after every notification.  Once the budget of the current one second
+ * window is used up, sleeps until the window is over.
+ */
+void FuseInvalidator::Throttle() {
+  if (max_ops_per_sec_ == 0)
+    return;
+  if (++num_ops_window_ < max_ops_per_sec_)
+    return;
+  const uint64_t elapsed_ms =
+    (platform_monotonic_time_ns() - window_start_ns_) / (1000 * 1000);
+  if (elapsed_ms < 1000)
+    SafeSleepMs(1000 - elapsed_ms);
+  num_ops_window_ = 0;
+  window_start_ns_ = platform_monotonic_time_ns();
+}
+
+
 void FuseInvalidator::Spawn() {
   int retval;
   retval = pthread_create(&thread_invalidator_, NULL, MainInvalidator, this);
@@ -8,6 +8,9 @@
 #include <pthread.h>
 #include <stdint.h>
 
+#include <utility>
+#include <vector>
+
 #include "bigvector.h"
 #include "duplex_fuse.h"
 #include "gtest/gtest_prod.h"
@@ -28,11 +31,18 @@ class DentryTracker;
  *
  * Evicting entries from the cache must be done from a separate thread to
  * avoid a deadlock in the fuse callbacks (see Fuse documentation).
+ *
+ * Instead of all known entries, the invalidator can also evict an explicit set
+ * of keys, e.g. the inodes and dentries of the paths that changed between two
+ * catalog revisions.  Notifications are sent in batches and can be limited to
+ * a maximum number per second so that the invalidation does not monopolize
+ * the fuse channel.
  */
 class FuseInvalidator : SingleCopy {
   FRIEND_TEST(T_FuseInvalidator, StartStop);
   FRIEND_TEST(T_FuseInvalidator, InvalidateTimeout);
   FRIEND_TEST(T_FuseInvalidator, InvalidateOps);
+  FRIEND_TEST(T_FuseInvalidator, InvalidateKeys);
 
  public:
   static bool HasFuseNotifyInval();
@@ -61,6 +71,16 @@ class FuseInvalidator : SingleCopy {
     atomic_int32 *status_;
   };
 
+  /**
+   * The kernel cache entries evicted by a targeted invalidation.  Dentries are
+   * given as pairs of parent inode and name.  Inodes are the inodes as known
+   * to the kernel, i.e. the root inode is FUSE_ROOT_ID.
+   */
+  struct Keys {
+    std::vector<uint64_t> inodes;
+    std::vector<std::pair<uint64_t, NameString> > dentries;
+  };
+
   FuseInvalidator(glue::InodeTracker *inode_tracker,
                   glue::DentryTracker *dentry_tracker,
                   void **fuse_channel_or_session,
@@ -68,9 +88,19 @@ class FuseInvalidator : SingleCopy {
   ~FuseInvalidator();
   void Spawn();
   void InvalidateInodes(Handle *handle);
+  /**
+   * Evicts only the given keys, takes ownership of keys.  The dentry tracker
+   * is not emptied.
+   */
+  void InvalidateKeys(Handle *handle, Keys *keys);
 
   void InvalidateDentry(uint64_t parent_ino, const NameString &name);
 
+  /**
+   * Zero means no limit.  Must be set before Spawn().
+   */
+  void set_max_ops_per_sec(unsigned value) { max_ops_per_sec_ = value; }
+
  private:
   /**
    * Add one second to the caller-provided timeout to be on the safe side.
@@ -88,6 +118,11 @@ class FuseInvalidator : SingleCopy {
 
   static void *MainInvalidator(void *data);
 
+  void EvictKeys(Keys *keys, uint64_t deadline);
+  void NotifyInvalInode(uint64_t inode);
+  void NotifyInvalDentry(uint64_t parent_ino, const NameString &name);
+  void Throttle();
+
   glue::InodeTracker *inode_tracker_;
   glue::DentryTracker *dentry_tracker_;
   /**
@@ -103,6 +138,15 @@ class FuseInvalidator : SingleCopy {
    */
   atomic_int32 terminated_;
   BigVector<uint64_t> evict_list_;
+  /**
+   * Budget of kernel notifications per second, zero for unlimited
+   */
+  unsigned max_ops_per_sec_;
+  /**
+   * Notifications sent in the current one second window of the throttle
+   */
+  unsigned num_ops_window_;
+  uint64_t window_start_ns_;
 
   static bool g_fuse_notify_invalidation_;
 };  // class FuseInvalidator
@@ -2,22 +2,32 @@
  * This file is part of the CernVM File System.
  */
 
+#define __STDC_FORMAT_MACROS
+
 #include "cvmfs_config.h"
 #include "fuse_remount.h"
 
 #include <errno.h>
+#include <inttypes.h>
 #include <poll.h>
 #include <unistd.h>
 
 #include <cassert>
 #include <cstdlib>
 #include <cstring>
+#include <map>
+#include <utility>
+#include <vector>
 
 #include "backoff.h"
 #include "catalog_mgr_client.h"
+#include "catalog_revision_diff.h"
 #include "fuse_inode_gen.h"
+#include "glue_buffer.h"
 #include "lru_md.h"
+#include "manifest.h"
 #include "mountpoint.h"
+#include "shortstring.h"
 #include "statistics.h"
 #include "util/exception.h"
 #include "util/logging.h"
@@ -35,14 +45,18 @@ FuseRemounter::Status FuseRemounter::ChangeRoot(const shash::Any &root_hash) {
   if (IsInMaintenanceMode())
     return kStatusMaintenance;
 
+  catalog::RevisionDiff *diff = NULL;
+  if (atomic_read32(&drainout_mode_) == 0)
+    diff = PrepareDiff(root_hash);
   if (atomic_cas32(&drainout_mode_, 0, 1)) {
     // As of this point, fuse callbacks return zero as cache timeout
     LogCvmfs(kLogCvmfs, kLogDebug, "chroot, draining out meta-data caches");
-    invalidator_handle_.Reset();
-    invalidator_->InvalidateInodes(&invalidator_handle_);
+    diff_ = diff;
+    InvalidateKcache(diff);
     atomic_inc32(&drainout_mode_);
     // drainout_mode_ == 2, IsInDrainoutMode is now 'true'
   } else {
+    delete diff;
     LogCvmfs(kLogCvmfs, kLogDebug, "already in drainout mode, leaving");
     return kStatusDraining;
   }
@@ -84,21 +98,30 @@ FuseRemounter::Status FuseRemounter::Check() {
   LogCvmfs(kLogCvmfs, kLogDebug, "remounting root catalog");
   catalog::LoadError retval = mountpoint_->catalog_mgr()->Remount(true);
   switch (retval) {
-    case catalog::kLoadNew:
+    case catalog::kLoadNew: {
       SetOfflineMode(false);
+      catalog::RevisionDiff *diff = NULL;
+      manifest::Manifest *manifest = mountpoint_->catalog_mgr()->manifest();
+      if ((atomic_read32(&drainout_mode_) == 0) && (manifest != NULL) &&
+          !mountpoint_->catalog_mgr()->offline_mode())
+      {
+        diff = PrepareDiff(manifest->catalog_hash());
+      }
       if (atomic_cas32(&drainout_mode_, 0, 1)) {
         // As of this point, fuse callbacks return zero as cache timeout
         LogCvmfs(kLogCvmfs, kLogDebug,
                  "new catalog revision available, "
                  "draining out meta-data caches");
-        invalidator_handle_.Reset();
-        invalidator_->InvalidateInodes(&invalidator_handle_);
+        diff_ = diff;
+        InvalidateKcache(diff);
         atomic_inc32(&drainout_mode_);
         // drainout_mode_ == 2, IsInDrainoutMode is now 'true'
       } else {
+        delete diff;
         LogCvmfs(kLogCvmfs, kLogDebug, "already in drainout mode, leaving");
       }
       return kStatusDraining;
+    }
     case catalog::kLoadFail:
     case catalog::kLoadNoSpace:
       LogCvmfs(kLogCvmfs, kLogDebug,
@@ -172,12 +195,22 @@ FuseRemounter::FuseRemounter(MountPoint *mountpoint,
       invalidator_handle_(static_cast<int>(mountpoint->kcache_timeout_sec())),
       fence_(new Fence()),
       offline_mode_(false),
-      catalogs_valid_until_(MountPoint::kIndefiniteDeadline) {
+      catalogs_valid_until_(MountPoint::kIndefiniteDeadline),
+      diff_(NULL) {
+  invalidator_->set_max_ops_per_sec(mountpoint->kcache_inval_rate());
   memset(&thread_remount_trigger_, 0, sizeof(thread_remount_trigger_));
   pipe_remount_trigger_[0] = pipe_remount_trigger_[1] = -1;
   atomic_init32(&drainout_mode_);
   atomic_init32(&maintenance_mode_);
   atomic_init32(&critical_section_);
+  n_incremental_ = mountpoint->statistics()->Register("remount.n_incremental",
+    "Number of remounts that kept the cache entries of unchanged paths");
+  n_kept_ = mountpoint->statistics()->Register("remount.n_kept",
+    "Number of meta-data cache entries kept on remount");
+  n_evicted_ = mountpoint->statistics()->Register("remount.n_evicted",
+    "Number of meta-data cache entries evicted on remount");
+  n_kcache_keys_ = mountpoint->statistics()->Register("remount.n_kcache_keys",
+    "Number of kernel cache entries selected for targeted invalidation");
 }
 
 FuseRemounter::~FuseRemounter() {
@@ -189,6 +222,7 @@ FuseRemounter::~FuseRemounter() {
   }
   delete invalidator_;
   delete fence_;
+  delete diff_;
 }
 
 
@@ -287,6 +321,203 @@ void FuseRemounter::Spawn() {
 }
 
 
+/**
+ * Compares the catalogs behind the user-level caches with the revision given
+ * by root_hash.  Called before moving into drainout mode because comparing
+ * can require downloading the changed catalogs.  Returns NULL if incremental
+ * remounts are disabled or if the revisions cannot be compared.
+ */
+catalog::RevisionDiff *FuseRemounter::PrepareDiff(const shash::Any &root_hash)
+{
+  if (!mountpoint_->incremental_remount() ||
+      mountpoint_->file_system()->IsNfsSource())
+  {
+    return NULL;
+  }
+  catalog::RevisionDiff *diff = new catalog::RevisionDiff();
+  if (!mountpoint_->catalog_mgr()->DiffRevision(root_hash, diff)) {
+    delete diff;
+    return NULL;
+  }
+  return diff;
+}
+
+
+/**
+ * Starts the eviction of the kernel caches.  Called after the move into
+ * drainout mode, so that new kernel cache entries have a zero timeout.  If
+ * no further catalogs were loaded since the diff was taken, only the entries
+ * of the changed paths are evicted.
+ */
+void FuseRemounter::InvalidateKcache(catalog::RevisionDiff *diff) {
+  invalidator_handle_.Reset();
+  kcache_diff_root_ = shash::Any();
+  if (diff != NULL) {
+    std::map<PathString, shash::Any> catalogs;
+    mountpoint_->catalog_mgr()->GetRevisionCatalogs(&catalogs);
+    if (catalogs == *diff->catalogs()) {
+      kcache_diff_root_ = diff->root_hash();
+      invalidator_->InvalidateKeys(&invalidator_handle_,
+                                   CollectKcacheKeys(*diff));
+      return;
+    }
+  }
+  invalidator_->InvalidateInodes(&invalidator_handle_);
+}
+
+
+/**
+ * Translates the changed paths of the diff into the inodes and dentries known
+ * to the kernel.  The inode tracker knows about every path the kernel
+ * references.  Tracked dentries, in particular negative ones, are checked
+ * through the path of their parent inode.  If the parent is unknown or if new
+ * nested catalogs appear, the dentry is evicted anyway.
+ */
+FuseInvalidator::Keys *FuseRemounter::CollectKcacheKeys(
+  const catalog::RevisionDiff &diff)
+{
+  FuseInvalidator::Keys *keys = new FuseInvalidator::Keys();
+  glue::InodeTracker *inode_tracker = mountpoint_->inode_tracker();
+  shash::Md5 md5path;
+  uint64_t inode;
+  uint64_t inode_parent;
+  NameString name;
+
+  glue::InodeTracker::Cursor cursor = inode_tracker->BeginEnumerate();
+  while (inode_tracker->NextPath(&cursor, &md5path, &inode, &inode_parent,
+                                 &name))
+  {
+    if (!diff.Contains(md5path))
+      continue;
+    if (name.IsEmpty()) {
+      keys->inodes.push_back(FUSE_ROOT_ID);
+      continue;
+    }
+    if (inode != 0)
+      keys->inodes.push_back(inode);
+    keys->dentries.push_back(std::make_pair(
+      (inode_parent == 0) ? FUSE_ROOT_ID : inode_parent, name));
+  }
+  inode_tracker->EndEnumerate(&cursor);
+
+  // Copy first, the dentry tracker must not be locked while looking up paths
+  std::vector<std::pair<uint64_t, NameString> > dentries;
+  glue::DentryTracker *dentry_tracker = mountpoint_->dentry_tracker();
+  dentry_tracker->Prune();
+  glue::DentryTracker::Cursor dentry_cursor = dentry_tracker->BeginEnumerate();
+  while (dentry_tracker->NextEntry(&dentry_cursor, &inode_parent, &name))
+    dentries.push_back(std::make_pair(inode_parent, name));
+  dentry_tracker->EndEnumerate(&dentry_cursor);
+
+  for (unsigned i = 0; i < dentries.size(); ++i) {
+    PathString path;
+    bool is_changed = diff.has_new_nested_catalogs();
+    if (!is_changed && (dentries[i].first != FUSE_ROOT_ID)) {
+      glue::InodeEx inode_ex(
+        mountpoint_->catalog_mgr()->MangleInode(dentries[i].first),
+        glue::InodeEx::kUnknownType);
+      is_changed = !inode_tracker->FindPath(&inode_ex, &path);
+    }
+    if (!is_changed) {
+      path.Append("/", 1);
+      path.Append(dentries[i].second.GetChars(),
+                  dentries[i].second.GetLength());
+      is_changed = diff.Contains(shash::Md5(path.GetChars(),
+                                            path.GetLength()));
+    }
+    if (is_changed)
+      keys->dentries.push_back(dentries[i]);
+  }
+
+  perf::Xadd(n_kcache_keys_, keys->inodes.size() + keys->dentries.size());
+  LogCvmfs(kLogCvmfs, kLogDebug,
+           "targeted kernel cache invalidation of %" PRIu64 " inodes and %"
+           PRIu64 " dentries", static_cast<uint64_t>(keys->inodes.size()),
+           static_cast<uint64_t>(keys->dentries.size()));
+  return keys;
+}
+
+
+/**
+ * Removes the user-level cache entries that can be stale after the remount.
+ * Without a diff, all the caches are dropped.  Otherwise, only the entries of
+ * the changed paths are evicted.  The inode based caches are checked through
+ * the path of the inode.  Must be called with paused caches.
+ */
+void FuseRemounter::EvictCaches(const catalog::RevisionDiff *diff) {
+  lru::InodeCache *inode_cache = mountpoint_->inode_cache();
+  lru::PathCache *path_cache = mountpoint_->path_cache();
+  lru::Md5PathCache *md5path_cache = mountpoint_->md5path_cache();
+
+  if (diff == NULL) {
+    perf::Xadd(n_evicted_, inode_cache->GetSize() + path_cache->GetSize() +
+                           md5path_cache->GetSize());
+    inode_cache->Drop();
+    path_cache->Drop();
+    md5path_cache->Drop();
+    return;
+  }
+
+  uint64_t num_kept = 0;
+  uint64_t num_evicted = 0;
+  fuse_ino_t inode;
+  PathString path;
+  catalog::DirectoryEntry dirent;
+
+  inode_cache->FilterBegin();
+  while (inode_cache->FilterNext()) {
+    inode_cache->FilterGet(&inode, &dirent);
+    glue::InodeEx inode_ex(inode, glue::InodeEx::kUnknownType);
+    if (mountpoint_->inode_tracker()->FindPath(&inode_ex, &path) &&
+        !diff->Contains(shash::Md5(path.GetChars(), path.GetLength())))
+    {
+      num_kept++;
+    } else {
+      inode_cache->FilterDelete();
+      num_evicted++;
+    }
+  }
+  inode_cache->FilterEnd();
+
+  path_cache->FilterBegin();
+  while (path_cache->FilterNext()) {
+    path_cache->FilterGet(&inode, &path);
+    if (diff->Contains(shash::Md5(path.GetChars(), path.GetLength()))) {
+      path_cache->FilterDelete();
+      num_evicted++;
+    } else {
+      num_kept++;
+    }
+  }
+  path_cache->FilterEnd();
+
+  shash::Md5 md5path;
+  md5path_cache->FilterBegin();
+  while (md5path_cache->FilterNext()) {
+    md5path_cache->FilterGet(&md5path, &dirent);
+    if (diff->Contains(md5path) ||
+        (diff->has_new_nested_catalogs() &&
+         (dirent.GetSpecial() == catalog::kDirentNegative)))
+    {
+      md5path_cache->FilterDelete();
+      num_evicted++;
+    } else {
+      num_kept++;
+    }
+  }
+  md5path_cache->FilterEnd();
+
+  perf::Inc(n_incremental_);
+  perf::Xadd(n_kept_, num_kept);
+  perf::Xadd(n_evicted_, num_evicted);
+  LogCvmfs(kLogCvmfs, kLogDebug,
+           "incremental remount: %" PRIu64 " changed paths in %u catalogs, "
+           "kept %" PRIu64 " and evicted %" PRIu64 " meta-data cache entries",
+           static_cast<uint64_t>(diff->num_paths()),
+           diff->num_diffed_catalogs(), num_kept, num_evicted);
+}
+
+
 /**
  * Applies a previously started remount operation.  This is called from the
  * fuse callbacks or from CheckSynchronously().  Usually, the method quits
@@ -316,18 +547,42 @@ void FuseRemounter::TryFinish(const shash::Any &root_hash) {
   mountpoint_->inode_cache()->Pause();
   mountpoint_->path_cache()->Pause();
   mountpoint_->md5path_cache()->Pause();
-  mountpoint_->inode_cache()->Drop();
-  mountpoint_->path_cache()->Drop();
-  mountpoint_->md5path_cache()->Drop();
 
   // Ensure that all Fuse callbacks left the catalog query code
   fence_->Drain();
+  const shash::Any old_root_hash = mountpoint_->catalog_mgr()->GetRootHash();
+  catalog::RevisionDiff *diff = diff_;
+  diff_ = NULL;
+  if (diff != NULL) {
+    // Catalogs that got mounted after the diff was taken are not covered
+    std::map<PathString, shash::Any> catalogs;
+    mountpoint_->catalog_mgr()->GetRevisionCatalogs(&catalogs);
+    if (catalogs != *diff->catalogs()) {
+      delete diff;
+      diff = NULL;
+    }
+  }
   catalog::LoadError retval;
   if (root_hash.IsNull()) {
     retval = mountpoint_->catalog_mgr()->Remount(false);
   } else {
     retval = mountpoint_->catalog_mgr()->ChangeRoot(root_hash);
   }
+  if ((diff != NULL) &&
+      (mountpoint_->catalog_mgr()->GetRootHash() != diff->root_hash()))
+  {
+    // Failed remount or yet another revision got published in the meantime
+    delete diff;
+    diff = NULL;
+  }
+  const shash::Any new_root_hash = mountpoint_->catalog_mgr()->GetRootHash();
+  const shash::Any kcache_diff_root = kcache_diff_root_;
+  kcache_diff_root_ = shash::Any();
+  const bool is_kcache_stale = !kcache_diff_root.IsNull() &&
+                               (new_root_hash != old_root_hash) &&
+                               (new_root_hash != kcache_diff_root);
+  EvictCaches(diff);
+  delete diff;
   if (mountpoint_->inode_annotation()) {
     inode_generation_info_->inode_generation =
       mountpoint_->inode_annotation()->GetGeneration();
@@ -339,6 +594,19 @@ void FuseRemounter::TryFinish(const shash::Any &root_hash) {
   mountpoint_->path_cache()->Resume();
   mountpoint_->md5path_cache()->Resume();
 
+  if (is_kcache_stale) {
+    // The kernel caches were only invalidated for the changes up to the diffed
+    // revision.  Stay in drainout mode until they are entirely flushed.
+    LogCvmfs(kLogCvmfs, kLogDebug,
+             "applied revision %s instead of %s, flushing kernel caches",
+             new_root_hash.ToString().c_str(),
+             kcache_diff_root.ToString().c_str());
+    invalidator_handle_.Reset();
+    invalidator_->InvalidateInodes(&invalidator_handle_);
+    LeaveCriticalSection();
+    return;
+  }
+
   atomic_xadd32(&drainout_mode_, -2);  // 2 --> 0, end of drainout mode
 
   if ((retval == catalog::kLoadFail) || (retval == catalog::kLoadNoSpace)) {
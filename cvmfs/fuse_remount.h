@@ -16,10 +16,16 @@
 #include "util/atomic.h"
 #include "util/single_copy.h"
 
+namespace catalog {
+class RevisionDiff;
+}
 namespace cvmfs {
 struct InodeGenerationInfo;
 }
 class MountPoint;
+namespace perf {
+class Counter;
+}
 
 /**
  * Orchestrates an orderly remount of a new snapshot revision in the Fuse
@@ -34,6 +40,12 @@ class MountPoint;
  * flushed.  We do this through the FuseInvalidator.  Once the FuseInvalidor
  * is ready (either by waiting or by active eviction), we flush all user-level
  * caches and reload a new root catalog.
+ *
+ * With incremental remounts, Check() compares the catalogs behind the
+ * user-level caches with the new revision before the drainout starts.  The
+ * FuseInvalidator then only evicts the kernel cache entries of the changed
+ * paths and TryFinish() only evicts the user-level cache entries of the
+ * changed paths.
  */
 class FuseRemounter : SingleCopy {
  public:
@@ -83,6 +95,10 @@ class FuseRemounter : SingleCopy {
   void LeaveCriticalSection() { atomic_dec32(&critical_section_); /* 1 -> 0 */ }
 
   void SetOfflineMode(bool value);
+  catalog::RevisionDiff *PrepareDiff(const shash::Any &root_hash);
+  void InvalidateKcache(catalog::RevisionDiff *diff);
+  FuseInvalidator::Keys *CollectKcacheKeys(const catalog::RevisionDiff &diff);
+  void EvictCaches(const catalog::RevisionDiff *diff);
 
   MountPoint *mountpoint_;  ///< Not owned
   cvmfs::InodeGenerationInfo *inode_generation_info_;  ///< Not owned
@@ -141,6 +157,22 @@ class FuseRemounter : SingleCopy {
    * from concurrent execution.
    */
   atomic_int32 critical_section_;
+  /**
+   * Set together with the move into drainout mode if incremental remounts
+   * are enabled and the new revision could be compared with the current one.
+   * Consumed by TryFinish().
+   */
+  catalog::RevisionDiff *diff_;
+  /**
+   * The revision up to which the kernel caches were invalidated if the
+   * FuseInvalidator only evicted the changed paths.  Null after a full
+   * invalidation.
+   */
+  shash::Any kcache_diff_root_;
+  perf::Counter *n_incremental_;
+  perf::Counter *n_kept_;
+  perf::Counter *n_evicted_;
+  perf::Counter *n_kcache_keys_;
 };  // class FuseRemounter
 
 #endif  // CVMFS_FUSE_REMOUNT_H_
@@ -11,6 +11,7 @@
 #include <poll.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
 #include <cstring>
@@ -29,33 +30,122 @@ using namespace std;  // NOLINT
 
 namespace glue {
 
-PathStore &PathStore::operator= (const PathStore &other) {
+const double NameTable::kMinUsage = 0.5;
+
+
+NameTable &NameTable::operator= (const NameTable &other) {
   if (&other == this)
     return *this;
 
+  map_.Clear();
   delete string_heap_;
   CopyFrom(other);
   return *this;
 }
 
 
-PathStore::PathStore(const PathStore &other) {
+NameTable::NameTable(const NameTable &other) {
+  map_.Init(16, 0, hasher_name);
   CopyFrom(other);
 }
 
 
-void PathStore::CopyFrom(const PathStore &other) {
+void NameTable::CopyFrom(const NameTable &other) {
   map_ = other.map_;
+  names_ = other.names_;
+  free_ids_ = other.free_ids_;
+
+  string_heap_ = new StringHeap(other.string_heap_->used(),
+                                other.string_heap_->max_size());
+  for (size_t i = 0; i < names_.size(); ++i) {
+    NameInfo info = names_.At(i);
+    if (info.refcnt == 0)
+      continue;
+    const StringRef name = other.string_heap_->GetString(info.handle);
+    bool retval =
+      string_heap_->AddString(name.length(), name.data(), &info.handle);
+    assert(retval);
+    names_.Replace(i, info);
+  }
+}
 
-  string_heap_ = new StringHeap(other.string_heap_->used());
-  shash::Md5 empty_path = map_.empty_key();
-  for (unsigned i = 0; i < map_.capacity(); ++i) {
-    if (map_.keys()[i] != empty_path) {
-      (map_.values() + i)->name =
-      string_heap_->AddString(map_.values()[i].name.length(),
-                              map_.values()[i].name.data());
+
+/**
+ * Copies the names to a new heap without the garbage of removed names
+ */
+void NameTable::CompactHeap() {
+  StringHeap *new_string_heap =
+    new StringHeap(string_heap_->used(), string_heap_->max_size());
+  for (size_t i = 0; i < names_.size(); ++i) {
+    NameInfo info = names_.At(i);
+    if (info.refcnt == 0)
+      continue;
+    const StringRef name = string_heap_->GetString(info.handle);
+    bool retval =
+      new_string_heap->AddString(name.length(), name.data(), &info.handle);
+    assert(retval);
+    names_.Replace(i, info);
+  }
+  delete string_heap_;
+  string_heap_ = new_string_heap;
+}
+
+
+//------------------------------------------------------------------------------
+
+
+PathStore &PathStore::operator= (const PathStore &other) {
+  if (&other == this)
+    return *this;
+
+  map_.Clear();
+  map_ = other.map_;
+  nodes_ = other.nodes_;
+  free_nodes_ = other.free_nodes_;
+  num_free_nodes_ = other.num_free_nodes_;
+  names_ = other.names_;
+  return *this;
+}
+
+
+PathStore::PathStore(const PathStore &other)
+  : free_nodes_(kNoNode)
+  , num_free_nodes_(0)
+{
+  map_.Init(16, Md5Key(shash::Md5(shash::AsciiPtr("!"))), hasher_md5_key);
+  *this = other;
+}
+
+
+void PathStore::Compact(std::vector<uint32_t> *new_ids) {
+  const uint32_t num_nodes = nodes_.size() - num_free_nodes_;
+  new_ids->resize(nodes_.size());
+  BigVector<PathNode> compacted(num_nodes > 0 ? num_nodes : 1);
+  for (size_t i = 0; i < nodes_.size(); ++i) {
+    const PathNode *node = nodes_.AtPtr(i);
+    if (node->refcnt == 0)
+      continue;
+    (*new_ids)[i] = compacted.size();
+    compacted.PushBack(*node);
+  }
+
+  // Parents can be stored after their children if their slot was recycled
+  for (size_t i = 0; i < compacted.size(); ++i) {
+    PathNode node = compacted.At(i);
+    if (node.parent != kNoNode) {
+      node.parent = (*new_ids)[node.parent];
+      compacted.Replace(i, node);
     }
   }
+  const Md5Key empty_key = map_.empty_key();
+  for (unsigned i = 0; i < map_.capacity(); ++i) {
+    if (map_.keys()[i] != empty_key)
+      map_.values()[i] = (*new_ids)[map_.values()[i]];
+  }
+
+  nodes_ = compacted;
+  free_nodes_ = kNoNode;
+  num_free_nodes_ = 0;
 }
 
 
@@ -73,9 +163,8 @@ void InodeTracker::InitLock() {
 void InodeTracker::CopyFrom(const InodeTracker &other) {
   assert(other.version_ == kVersion);
   version_ = kVersion;
-  path_map_ = other.path_map_;
+  path_store_ = other.path_store_;
   inode_ex_map_ = other.inode_ex_map_;
-  inode_references_ = other.inode_references_;
   statistics_ = other.statistics_;
 }
 
@@ -101,6 +190,18 @@ InodeTracker &InodeTracker::operator= (const InodeTracker &other) {
 }
 
 
+void InodeTracker::Swap(InodeTracker *other) {
+  assert(other->version_ == kVersion);
+  Lock();
+  other->Lock();
+  path_store_.Swap(&other->path_store_);
+  inode_ex_map_.Swap(&other->inode_ex_map_);
+  std::swap(statistics_, other->statistics_);
+  other->Unlock();
+  Unlock();
+}
+
+
 InodeTracker::~InodeTracker() {
   pthread_mutex_destroy(lock_);
   free(lock_);
@@ -307,6 +408,17 @@ void PageCacheTracker::CopyFrom(const PageCacheTracker &other) {
 }
 
 
+void PageCacheTracker::Swap(PageCacheTracker *other) {
+  assert(other->version_ == kVersion);
+  MutexLockGuard guard(lock_);
+  MutexLockGuard guard_other(other->lock_);
+  std::swap(is_active_, other->is_active_);
+  std::swap(statistics_, other->statistics_);
+  map_.Swap(&other->map_);
+  stat_store_.Swap(&other->stat_store_);
+}
+
+
 void PageCacheTracker::InitLock() {
   lock_ =
     reinterpret_cast<pthread_mutex_t *>(smalloc(sizeof(pthread_mutex_t)));
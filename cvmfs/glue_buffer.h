@@ -13,6 +13,7 @@
 #include <sched.h>
 #include <stdint.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <map>
@@ -133,6 +134,12 @@ class StringRef {
       memcpy(result.length_ + 1, str, length);
     return result;
   }
+  static StringRef At(const void *addr) {
+    StringRef result;
+    result.length_ = reinterpret_cast<uint16_t *>(const_cast<void *>(addr));
+    return result;
+  }
+
  private:
   uint16_t *length_;
 };
@@ -142,56 +149,68 @@ class StringRef {
 
 
 /**
- * Manages memory bins with immutable strings (deleting is a no-op).
- * When the fraction of garbage is too large, the user of the StringHeap
- * can copy the entire contents to a new heap.
+ * Manages a contiguous memory area with immutable strings (deleting only
+ * accounts for the freed space).  Strings are addressed by 32 bit handles
+ * that count 2 byte units from the beginning of the area, which limits the
+ * heap to 8GB.  The area doubles in size when it is full.  When the fraction
+ * of garbage is too large, the user of the StringHeap can copy the live
+ * strings to a new heap.  Adding a string fails if the heap would exceed its
+ * maximum size.
  */
 class StringHeap : public SingleCopy {
  public:
+  static const uint64_t kMaxSize = uint64_t(8) * 1024 * 1024 * 1024;
+
   StringHeap() {
-    Init(128*1024);  // 128kB (should be >= 64kB+2B which is largest string)
+    Init(128*1024, kMaxSize);  // 128kB (should be >= 64kB+2B, largest string)
   }
 
-  explicit StringHeap(const uint64_t minimum_size) {
-    Init(minimum_size);
+  explicit StringHeap(const uint64_t minimum_size,
+                      const uint64_t maximum_size = kMaxSize)
+  {
+    Init(minimum_size, maximum_size);
   }
 
-  void Init(const uint64_t minimum_size) {
+  void Init(const uint64_t minimum_size, const uint64_t maximum_size) {
+    assert(maximum_size <= kMaxSize);
     size_ = 0;
     used_ = 0;
+    max_size_ = maximum_size;
 
-    // Initial bin: 128kB or smallest power of 2 >= minimum size
-    uint64_t pow2_size = 128 * 1024;
-    while (pow2_size < minimum_size)
-      pow2_size *= 2;
-    AddBin(pow2_size);
+    // Initial area: 128kB or smallest power of 2 >= minimum size
+    capacity_ = 128 * 1024;
+    while (capacity_ < minimum_size)
+      capacity_ *= 2;
+    area_ = static_cast<char *>(smmap(capacity_));
   }
 
   ~StringHeap() {
-    for (unsigned i = 0; i < bins_.size(); ++i) {
-      smunmap(bins_.At(i));
-    }
+    smunmap(area_);
   }
 
-  StringRef AddString(const uint16_t length, const char *str) {
-    const uint16_t str_size = StringRef::size(length);
-    const uint64_t remaining_bin_size = bin_size_ - bin_used_;
-    // May require opening of new bin
-    if (remaining_bin_size < str_size) {
-      size_ += remaining_bin_size;
-      AddBin(2*bin_size_);
-    }
-    StringRef result =
-      StringRef::Place(length, str,
-                       static_cast<char *>(bins_.At(bins_.size()-1))+bin_used_);
+  /**
+   * Returns false if the string does not fit anymore
+   */
+  bool AddString(const uint16_t length, const char *str, uint32_t *handle) {
+    // Padded to keep the length fields aligned
+    const uint64_t str_size = Pad(StringRef::size(length));
+    if (max_size_ - size_ < str_size)
+      return false;
+    while (capacity_ - size_ < str_size)
+      Grow();
+    StringRef::Place(length, str, area_ + size_);
+    *handle = static_cast<uint32_t>(size_ / 2);
     size_ += str_size;
     used_ += str_size;
-    bin_used_ += str_size;
-    return result;
+    return true;
   }
 
-  void RemoveString(const StringRef str_ref) {
-    used_ -= str_ref.size();
+  StringRef GetString(const uint32_t handle) const {
+    return StringRef::At(area_ + static_cast<uint64_t>(handle) * 2);
+  }
+
+  void RemoveString(const uint32_t handle) {
+    used_ -= Pad(GetString(handle).size());
   }
 
   double GetUsage() const {
@@ -199,40 +218,214 @@ class StringHeap : public SingleCopy {
     return static_cast<double>(used_) / static_cast<double>(size_);
   }
 
+  uint64_t size() const { return size_; }
   uint64_t used() const { return used_; }
+  uint64_t max_size() const { return max_size_; }
 
   // mmap'd bytes, used for testing
-  uint64_t GetSizeAlloc() const {
-    uint64_t s = bin_size_;
-    uint64_t result = 0;
-    for (unsigned i = 0; i < bins_.size(); ++i) {
-      result += s;
-      s /= 2;
-    }
-    return result;
-  }
+  uint64_t GetSizeAlloc() const { return capacity_; }
 
  private:
-  void AddBin(const uint64_t size) {
-    void *bin = smmap(size);
-    bins_.PushBack(bin);
-    bin_size_ = size;
-    bin_used_ = 0;
+  static uint64_t Pad(const uint64_t size) { return (size + 1) & ~uint64_t(1); }
+
+  void Grow() {
+    char *new_area = static_cast<char *>(smmap(2 * capacity_));
+    memcpy(new_area, area_, size_);
+    smunmap(area_);
+    area_ = new_area;
+    capacity_ *= 2;
   }
 
   uint64_t size_;
   uint64_t used_;
-  uint64_t bin_size_;
-  uint64_t bin_used_;
-  BigVector<void *> bins_;
+  uint64_t capacity_;
+  uint64_t max_size_;
+  char *area_;
+};
+
+
+//------------------------------------------------------------------------------
+
+
+/**
+ * Interned names of path components.  Every distinct name is stored only once
+ * and it is addressed by a 32 bit id.  Names are reference counted, the ids
+ * of removed names are recycled.  Names are found by their 64 bit hash.  In
+ * the unlikely case of a hash collision, the colliding name gets an id of its
+ * own that is not reachable through the hash map.
+ *
+ * Removed names leave garbage in the string heap.  The heap is compacted once
+ * it is larger than kMinCompactSize and at least half of it is garbage, so
+ * that the cost of a compaction is amortized over many removals.
+ */
+class NameTable {
+ public:
+  static const uint32_t kNoId = uint32_t(-1);
+
+  NameTable() : free_ids_(kNoId) {
+    map_.Init(16, 0, hasher_name);
+    string_heap_ = new StringHeap();
+  }
+
+  explicit NameTable(const uint64_t max_heap_size) : free_ids_(kNoId) {
+    map_.Init(16, 0, hasher_name);
+    string_heap_ = new StringHeap(0, max_heap_size);
+  }
+
+  ~NameTable() {
+    delete string_heap_;
+  }
+
+  explicit NameTable(const NameTable &other);
+  NameTable &operator= (const NameTable &other);
+
+  /**
+   * Returns kNoId if the string heap is full
+   */
+  uint32_t Add(const char *str, const uint16_t length) {
+    const uint64_t hash = HashName(str, length);
+    uint32_t id;
+    if (map_.Lookup(hash, &id)) {
+      NameInfo info = names_.At(id);
+      const StringRef name = string_heap_->GetString(info.handle);
+      if ((name.length() == length) && (memcmp(name.data(), str, length) == 0))
+      {
+        info.refcnt++;
+        names_.Replace(id, info);
+        return id;
+      }
+      return NewName(str, length);
+    }
+    id = NewName(str, length);
+    if (id != kNoId)
+      map_.Insert(hash, id);
+    return id;
+  }
+
+  void Remove(const uint32_t id) {
+    NameInfo info = names_.At(id);
+    assert(info.refcnt > 0);
+    info.refcnt--;
+    if (info.refcnt > 0) {
+      names_.Replace(id, info);
+      return;
+    }
+
+    const StringRef name = string_heap_->GetString(info.handle);
+    const uint64_t hash = HashName(name.data(), name.length());
+    uint32_t indexed_id;
+    if (map_.Lookup(hash, &indexed_id) && (indexed_id == id))
+      map_.Erase(hash);
+    string_heap_->RemoveString(info.handle);
+    names_.Replace(id, NameInfo(free_ids_, 0));
+    free_ids_ = id;
+    if ((string_heap_->size() >= kMinCompactSize) &&
+        (string_heap_->GetUsage() < kMinUsage))
+    {
+      CompactHeap();
+    }
+  }
+
+  StringRef Get(const uint32_t id) const {
+    return string_heap_->GetString(names_.AtPtr(id)->handle);
+  }
+
+  void Clear() {
+    map_.Clear();
+    names_.Clear();
+    free_ids_ = kNoId;
+    const uint64_t max_heap_size = string_heap_->max_size();
+    delete string_heap_;
+    string_heap_ = new StringHeap(0, max_heap_size);
+  }
+
+  void Swap(NameTable *other) {
+    map_.Swap(&other->map_);
+    names_.Swap(&other->names_);
+    std::swap(free_ids_, other->free_ids_);
+    std::swap(string_heap_, other->string_heap_);
+  }
+
+  // Bytes in the string heap including garbage, used for testing
+  uint64_t GetHeapSize() const { return string_heap_->size(); }
+
+ private:
+  static const uint64_t kMinCompactSize = 4 * 1024 * 1024;
+  static const double kMinUsage;
+
+  /**
+   * For free ids, the handle links to the next free id
+   */
+  struct NameInfo {
+    NameInfo() : handle(0), refcnt(0) { }
+    NameInfo(const uint32_t h, const uint32_t r) : handle(h), refcnt(r) { }
+    uint32_t handle;
+    uint32_t refcnt;
+  };
+
+  static uint32_t hasher_name(const uint64_t &hash) {
+    return static_cast<uint32_t>(hash);
+  }
+
+  /**
+   * Zero is the empty key of the hash map
+   */
+  static uint64_t HashName(const char *str, const uint16_t length) {
+    const uint64_t hash = MurmurHash64A(str, length, 0x9ce603115bba659bLLU);
+    return (hash == 0) ? 1 : hash;
+  }
+
+  uint32_t NewName(const char *str, const uint16_t length) {
+    NameInfo info(0, 1);
+    if (!string_heap_->AddString(length, str, &info.handle)) {
+      // Make room by dropping the garbage, if there is any
+      if (string_heap_->used() == string_heap_->size())
+        return kNoId;
+      CompactHeap();
+      if (!string_heap_->AddString(length, str, &info.handle))
+        return kNoId;
+    }
+    if (free_ids_ == kNoId) {
+      names_.PushBack(info);
+      return static_cast<uint32_t>(names_.size() - 1);
+    }
+    const uint32_t id = free_ids_;
+    free_ids_ = names_.At(id).handle;
+    names_.Replace(id, info);
+    return id;
+  }
+
+  void CompactHeap();
+  void CopyFrom(const NameTable &other);
+
+  SmallHashDynamic<uint64_t, uint32_t> map_;
+  BigVector<NameInfo> names_;
+  uint32_t free_ids_;
+  StringHeap *string_heap_;
 };
 
 
 //------------------------------------------------------------------------------
 
 
+/**
+ * Stores the paths known to the inode tracker as a tree of path components.
+ * Every node refers to its name in the name table and to its parent node by
+ * 32 bit ids, so that common path prefixes are stored only once.  The nodes
+ * are indexed by the MD5 hash of their path.  A node is referenced by its
+ * children and by the inodes that use the path.  It also stores the inode
+ * under which the path is known, or zero for paths that are only known as
+ * parents of other paths.  If several inodes use the same path, e.g. an open
+ * file and its replacement after a catalog update, the node keeps the inode
+ * that was registered first as long as it is in use.
+ *
+ * The slots of removed nodes are recycled.  If most of the slots are unused,
+ * Compact() moves the nodes to the front, which changes the node ids.
+ */
 class PathStore {
  public:
+  static const uint32_t kNoNode = uint32_t(-1);
+
   /**
    * Used to enumerate all paths
    */
@@ -241,110 +434,189 @@ class PathStore {
     uint32_t idx;
   };
 
-
-  PathStore() {
-    map_.Init(16, shash::Md5(shash::AsciiPtr("!")), hasher_md5);
-    string_heap_ = new StringHeap();
-  }
-
-  ~PathStore() {
-    delete string_heap_;
+  PathStore() : free_nodes_(kNoNode), num_free_nodes_(0) {
+    map_.Init(16, Md5Key(shash::Md5(shash::AsciiPtr("!"))), hasher_md5_key);
   }
 
   explicit PathStore(const PathStore &other);
   PathStore &operator= (const PathStore &other);
 
-  void Insert(const shash::Md5 &md5path, const PathString &path) {
-    PathInfo info;
-    bool found = map_.Lookup(md5path, &info);
-    if (found) {
-      info.refcnt++;
-      map_.Insert(md5path, info);
-      return;
+  /**
+   * Adds a reference to the node of the path, which is created together with
+   * its missing parent nodes if necessary.  Returns kNoNode if the name table
+   * is full.
+   */
+  uint32_t Insert(const shash::Md5 &md5path, const PathString &path) {
+    const Md5Key key(md5path);
+    uint32_t node_id;
+    if (map_.Lookup(key, &node_id)) {
+      PathNode node = nodes_.At(node_id);
+      node.refcnt++;
+      nodes_.Replace(node_id, node);
+      return node_id;
     }
 
-    PathInfo new_entry;
+    PathNode new_node;
+    new_node.md5path = key;
     if (path.IsEmpty()) {
-      new_entry.name = string_heap_->AddString(0, "");
-      map_.Insert(md5path, new_entry);
-      return;
+      new_node.name = names_.Add("", 0);
+    } else {
+      PathString parent_path = GetParentPath(path);
+      new_node.parent = Insert(
+        shash::Md5(parent_path.GetChars(), parent_path.GetLength()),
+        parent_path);
+      if (new_node.parent == kNoNode)
+        return kNoNode;
+      const uint16_t name_length =
+        path.GetLength() - parent_path.GetLength() - 1;
+      const char *name_str = path.GetChars() + parent_path.GetLength() + 1;
+      new_node.name = names_.Add(name_str, name_length);
     }
+    if (new_node.name == NameTable::kNoId) {
+      Erase(new_node.parent);
+      return kNoNode;
+    }
+    node_id = NewNode(new_node);
+    map_.Insert(key, node_id);
+    return node_id;
+  }
 
-    PathString parent_path = GetParentPath(path);
-    new_entry.parent = shash::Md5(parent_path.GetChars(),
-                                  parent_path.GetLength());
-    Insert(new_entry.parent, parent_path);
+  /**
+   * Drops a reference to the node.  Unreferenced nodes are removed and drop
+   * their reference to the parent node.
+   */
+  void Erase(uint32_t node_id) {
+    while (node_id != kNoNode) {
+      PathNode node = nodes_.At(node_id);
+      assert(node.refcnt > 0);
+      node.refcnt--;
+      if (node.refcnt > 0) {
+        nodes_.Replace(node_id, node);
+        return;
+      }
 
-    const uint16_t name_length = path.GetLength() - parent_path.GetLength() - 1;
-    const char *name_str = path.GetChars() + parent_path.GetLength() + 1;
-    new_entry.name = string_heap_->AddString(name_length, name_str);
-    map_.Insert(md5path, new_entry);
+      map_.Erase(node.md5path);
+      names_.Remove(node.name);
+      nodes_.Replace(node_id, PathNode(free_nodes_));
+      free_nodes_ = node_id;
+      num_free_nodes_++;
+      node_id = node.parent;
+    }
   }
 
-  bool Lookup(const shash::Md5 &md5path, PathString *path) {
-    PathInfo info;
-    bool retval = map_.Lookup(md5path, &info);
-    if (!retval)
-      return false;
+  uint32_t Lookup(const shash::Md5 &md5path) const {
+    uint32_t node_id;
+    if (map_.Lookup(Md5Key(md5path), &node_id))
+      return node_id;
+    return kNoNode;
+  }
 
-    if (info.parent.IsNull())
-      return true;
+  void GetPath(const uint32_t node_id, PathString *path) const {
+    const PathNode *node = nodes_.AtPtr(node_id);
+    if (node->parent == kNoNode)
+      return;
 
-    retval = Lookup(info.parent, path);
-    assert(retval);
+    GetPath(node->parent, path);
+    const StringRef name = names_.Get(node->name);
     path->Append("/", 1);
-    path->Append(info.name.data(), info.name.length());
-    return true;
+    path->Append(name.data(), name.length());
   }
 
-  void Erase(const shash::Md5 &md5path) {
-    PathInfo info;
-    bool found = map_.Lookup(md5path, &info);
-    if (!found)
-      return;
+  shash::Md5 GetMd5Path(const uint32_t node_id) const {
+    const PathNode *node = nodes_.AtPtr(node_id);
+    return shash::Md5(node->md5path.lo, node->md5path.hi);
+  }
 
-    info.refcnt--;
-    if (info.refcnt == 0) {
-      map_.Erase(md5path);
-      string_heap_->RemoveString(info.name);
-      if (string_heap_->GetUsage() < 0.75) {
-        StringHeap *new_string_heap = new StringHeap(string_heap_->used());
-        shash::Md5 empty_path = map_.empty_key();
-        for (unsigned i = 0; i < map_.capacity(); ++i) {
-          if (map_.keys()[i] != empty_path) {
-            (map_.values() + i)->name =
-              new_string_heap->AddString(map_.values()[i].name.length(),
-                                         map_.values()[i].name.data());
-          }
-        }
-        delete string_heap_;
-        string_heap_ = new_string_heap;
-      }
-      Erase(info.parent);
-    } else {
-      map_.Insert(md5path, info);
-    }
+  bool HasMd5Path(const uint32_t node_id, const shash::Md5 &md5path) const {
+    return nodes_.AtPtr(node_id)->md5path == Md5Key(md5path);
+  }
+
+  StringRef GetName(const uint32_t node_id) const {
+    return names_.Get(nodes_.AtPtr(node_id)->name);
+  }
+
+  uint32_t GetParent(const uint32_t node_id) const {
+    return nodes_.AtPtr(node_id)->parent;
+  }
+
+  uint64_t GetInode(const uint32_t node_id) const {
+    return nodes_.AtPtr(node_id)->inode;
+  }
+
+  void SetInode(const uint32_t node_id, const uint64_t inode) {
+    PathNode node = nodes_.At(node_id);
+    node.inode = inode;
+    nodes_.Replace(node_id, node);
+  }
+
+  /**
+   * Counts an inode that uses the path.  The node takes the inode unless it
+   * already has one.
+   */
+  void AddInode(const uint32_t node_id, const uint64_t inode) {
+    PathNode node = nodes_.At(node_id);
+    node.num_inodes++;
+    if (node.inode == 0)
+      node.inode = inode;
+    nodes_.Replace(node_id, node);
+  }
+
+  /**
+   * Returns true if the node loses its inode while other inodes still use the
+   * path, in which case the caller has to set one of them.
+   */
+  bool RemoveInode(const uint32_t node_id, const uint64_t inode) {
+    PathNode node = nodes_.At(node_id);
+    assert(node.num_inodes > 0);
+    node.num_inodes--;
+    const bool orphaned = (node.inode == inode) && (node.num_inodes > 0);
+    if (node.inode == inode)
+      node.inode = 0;
+    nodes_.Replace(node_id, node);
+    return orphaned;
   }
 
+  /**
+   * True if less than a quarter of a not too small node array is in use
+   */
+  bool NeedsCompaction() const {
+    return (nodes_.size() > kMinCompactSize) &&
+           (num_free_nodes_ > 3 * (nodes_.size() - num_free_nodes_));
+  }
+
+  /**
+   * Moves all nodes to the front of the node array.  Returns the new ids of
+   * the nodes, indexed by their old id.
+   */
+  void Compact(std::vector<uint32_t> *new_ids);
+
   void Clear() {
     map_.Clear();
-    delete string_heap_;
-    string_heap_ = new StringHeap();
+    nodes_.Clear();
+    names_.Clear();
+    free_nodes_ = kNoNode;
+    num_free_nodes_ = 0;
+  }
+
+  void Swap(PathStore *other) {
+    map_.Swap(&other->map_);
+    nodes_.Swap(&other->nodes_);
+    std::swap(free_nodes_, other->free_nodes_);
+    std::swap(num_free_nodes_, other->num_free_nodes_);
+    names_.Swap(&other->names_);
   }
 
   Cursor BeginEnumerate() {
     return Cursor();
   }
 
-  bool Next(Cursor *cursor, shash::Md5 *parent, StringRef *name) {
-    shash::Md5 empty_key = map_.empty_key();
-    while (cursor->idx < map_.capacity()) {
-      if (map_.keys()[cursor->idx] == empty_key) {
+  bool Next(Cursor *cursor, uint32_t *node_id) {
+    while (cursor->idx < nodes_.size()) {
+      if (nodes_.AtPtr(cursor->idx)->refcnt == 0) {
         cursor->idx++;
         continue;
       }
-      *parent = map_.values()[cursor->idx].parent;
-      *name = map_.values()[cursor->idx].name;
+      *node_id = cursor->idx;
       cursor->idx++;
       return true;
     }
@@ -352,19 +624,63 @@ class PathStore {
   }
 
  private:
-  struct PathInfo {
-    PathInfo() {
-      refcnt = 1;
+  static const uint32_t kMinCompactSize = 1024;
+
+  /**
+   * The MD5 path hash as a pair of integers, which takes 16 bytes instead of
+   * the 24 bytes of a shash::Md5
+   */
+  struct Md5Key {
+    Md5Key() : lo(0), hi(0) { }
+    explicit Md5Key(const shash::Md5 &md5) { md5.ToIntPair(&lo, &hi); }
+    bool operator==(const Md5Key &other) const {
+      return (lo == other.lo) && (hi == other.hi);
     }
-    shash::Md5 parent;
+    bool operator!=(const Md5Key &other) const { return !(*this == other); }
+    uint64_t lo;
+    uint64_t hi;
+  };
+
+  /**
+   * Free nodes have a reference counter of zero and link to the next free
+   * node through the parent field.  The number of inodes fits into the
+   * alignment padding.
+   */
+  struct PathNode {
+    PathNode()
+      : inode(0), parent(kNoNode), name(0), refcnt(1), num_inodes(0) { }
+    explicit PathNode(const uint32_t next_free)
+      : inode(0), parent(next_free), name(0), refcnt(0), num_inodes(0) { }
+    Md5Key md5path;
+    uint64_t inode;
+    uint32_t parent;
+    uint32_t name;
     uint32_t refcnt;
-    StringRef name;
+    uint32_t num_inodes;
   };
 
-  void CopyFrom(const PathStore &other);
+  static uint32_t hasher_md5_key(const Md5Key &key) {
+    // Same bytes as hasher_md5()
+    return static_cast<uint32_t>(key.lo >> 32);
+  }
 
-  SmallHashDynamic<shash::Md5, PathInfo> map_;
-  StringHeap *string_heap_;
+  uint32_t NewNode(const PathNode &node) {
+    if (free_nodes_ == kNoNode) {
+      nodes_.PushBack(node);
+      return static_cast<uint32_t>(nodes_.size() - 1);
+    }
+    const uint32_t node_id = free_nodes_;
+    free_nodes_ = nodes_.AtPtr(node_id)->parent;
+    num_free_nodes_--;
+    nodes_.Replace(node_id, node);
+    return node_id;
+  }
+
+  SmallHashDynamic<Md5Key, uint32_t> map_;
+  BigVector<PathNode> nodes_;
+  uint32_t free_nodes_;
+  uint32_t num_free_nodes_;
+  NameTable names_;
 };
 
 
@@ -399,72 +715,10 @@ class StatStore {
 
   struct stat Get(int32_t index) const { return store_.At(index); }
 
- private:
-  BigVector<struct stat> store_;
-};
-
-
-//------------------------------------------------------------------------------
-
-
-class PathMap {
- public:
-  PathMap() {
-    map_.Init(16, shash::Md5(shash::AsciiPtr("!")), hasher_md5);
-  }
-
-  bool LookupPath(const shash::Md5 &md5path, PathString *path) {
-    bool found = path_store_.Lookup(md5path, path);
-    return found;
-  }
-
-  uint64_t LookupInodeByPath(const PathString &path) {
-    uint64_t inode;
-    bool found = map_.Lookup(shash::Md5(path.GetChars(), path.GetLength()),
-                             &inode);
-    if (found) return inode;
-    return 0;
-  }
-
-  uint64_t LookupInodeByMd5Path(const shash::Md5 &md5path) {
-    uint64_t inode;
-    bool found = map_.Lookup(md5path, &inode);
-    if (found) return inode;
-    return 0;
-  }
-
-  shash::Md5 Insert(const PathString &path, const uint64_t inode) {
-    shash::Md5 md5path(path.GetChars(), path.GetLength());
-    if (!map_.Contains(md5path)) {
-      path_store_.Insert(md5path, path);
-      map_.Insert(md5path, inode);
-    }
-    return md5path;
-  }
-
-  void Erase(const shash::Md5 &md5path) {
-    bool found = map_.Contains(md5path);
-    if (found) {
-      path_store_.Erase(md5path);
-      map_.Erase(md5path);
-    }
-  }
-
-  void Replace(const shash::Md5 &md5path, uint64_t new_inode) {
-    map_.Insert(md5path, new_inode);
-  }
-
-  void Clear() {
-    map_.Clear();
-    path_store_.Clear();
-  }
-
-  // For enumerating
-  PathStore *path_store() { return &path_store_; }
+  void Swap(StatStore *other) { store_.Swap(&other->store_); }
 
  private:
-  SmallHashDynamic<shash::Md5, uint64_t> map_;
-  PathStore path_store_;
+  BigVector<struct stat> store_;
 };
 
 
@@ -472,101 +726,91 @@ class PathMap {
 
 
 /**
- * This class has the same memory layout than the previous "InodeMap" class,
- * therefore there is no data structure migration during reload required.
+ * Maps inodes, including their file type, to their node in the path store and
+ * to their reference counter.
  */
 class InodeExMap {
  public:
+  /**
+   * Used to enumerate all inodes
+   */
+  struct Cursor {
+    Cursor() : idx(0) { }
+    uint32_t idx;
+  };
+
+  struct InodeInfo {
+    InodeInfo() : node_id(PathStore::kNoNode), references(0) { }
+    InodeInfo(const uint32_t n, const uint32_t r)
+      : node_id(n), references(r) { }
+    uint32_t node_id;
+    uint32_t references;
+  };
+
   InodeExMap() {
     map_.Init(16, InodeEx(), hasher_inode_ex);
   }
 
-  bool LookupMd5Path(InodeEx *inode_ex, shash::Md5 *md5path) {
-    bool found = map_.LookupEx(inode_ex, md5path);
-    return found;
+  /**
+   * Also sets the file type of inode_ex
+   */
+  bool Lookup(InodeEx *inode_ex, InodeInfo *info) {
+    return map_.LookupEx(inode_ex, info);
   }
 
-  void Insert(const InodeEx inode_ex, const shash::Md5 &md5path) {
-    map_.Insert(inode_ex, md5path);
+  void Insert(const InodeEx inode_ex, const InodeInfo &info) {
+    map_.Insert(inode_ex, info);
   }
 
   void Erase(const uint64_t inode) {
     map_.Erase(InodeEx(inode, InodeEx::kUnknownType));
   }
 
-  void Clear() { map_.Clear(); }
-
- private:
-  SmallHashDynamic<InodeEx, shash::Md5> map_;
-};
-
-
-//------------------------------------------------------------------------------
-
-
-class InodeReferences {
- public:
   /**
-   * Used to enumerate all inodes
+   * Returns an inode other than except_inode that uses the node, or zero.
+   * Walks the entire map, which is only needed if several inodes share a path.
    */
-  struct Cursor {
-    Cursor() : idx(0) { }
-    uint32_t idx;
-  };
-
-  InodeReferences() {
-    map_.Init(16, 0, hasher_inode);
-  }
-
-  bool Get(const uint64_t inode, const uint32_t by) {
-    uint32_t refcounter = 0;
-    const bool found = map_.Lookup(inode, &refcounter);
-    const bool new_inode = !found;
-    refcounter += by;  // This is 0 if the inode is not found
-    map_.Insert(inode, refcounter);
-    return new_inode;
-  }
-
-  bool Put(const uint64_t inode, const uint32_t by) {
-    uint32_t refcounter;
-    bool found = map_.Lookup(inode, &refcounter);
-    if (!found) {
-      // May happen if a retired inode is cleared, i.e. if a file with
-      // outdated content is closed
-      return false;
+  uint64_t FindInodeOfNode(const uint32_t node_id,
+                           const uint64_t except_inode) const
+  {
+    const InodeEx empty_key = map_.empty_key();
+    for (unsigned i = 0; i < map_.capacity(); ++i) {
+      if ((map_.keys()[i] != empty_key) &&
+          (map_.values()[i].node_id == node_id) &&
+          (map_.keys()[i].GetInode() != except_inode))
+      {
+        return map_.keys()[i].GetInode();
+      }
     }
+    return 0;
+  }
 
-    assert(refcounter >= by);
-    if (refcounter == by) {
-      map_.Erase(inode);
-      return true;
+  void UpdateNodeIds(const std::vector<uint32_t> &new_ids) {
+    const InodeEx empty_key = map_.empty_key();
+    for (unsigned i = 0; i < map_.capacity(); ++i) {
+      if (map_.keys()[i] != empty_key) {
+        InodeInfo *info = map_.values() + i;
+        info->node_id = new_ids[info->node_id];
+      }
     }
-    refcounter -= by;
-    map_.Insert(inode, refcounter);
-    return false;
   }
 
-  void Replace(const uint64_t old_inode, const uint64_t new_inode) {
-    map_.Erase(old_inode);
-    map_.Insert(new_inode, 0);
-  }
+  void Clear() { map_.Clear(); }
 
-  void Clear() {
-    map_.Clear();
-  }
+  void Swap(InodeExMap *other) { map_.Swap(&other->map_); }
 
   Cursor BeginEnumerate() {
     return Cursor();
   }
 
   bool Next(Cursor *cursor, uint64_t *inode) {
-    uint64_t empty_key = map_.empty_key();
+    const InodeEx empty_key = map_.empty_key();
     while (cursor->idx < map_.capacity()) {
       if (map_.keys()[cursor->idx] == empty_key) {
         cursor->idx++;
         continue;
       }
-      *inode = map_.keys()[cursor->idx];
+      *inode = map_.keys()[cursor->idx].GetInode();
       cursor->idx++;
       return true;
     }
@@ -574,7 +818,7 @@ class InodeReferences {
   }
 
  private:
-  SmallHashDynamic<uint64_t, uint32_t> map_;
+  SmallHashDynamic<InodeEx, InodeInfo> map_;
 };
 
 
@@ -592,12 +836,12 @@ class InodeTracker {
   struct Cursor {
     explicit Cursor(
       const PathStore::Cursor &p,
-      const InodeReferences::Cursor &i)
+      const InodeExMap::Cursor &i)
       : csr_paths(p)
       , csr_inos(i)
     { }
     PathStore::Cursor csr_paths;
-    InodeReferences::Cursor csr_inos;
+    InodeExMap::Cursor csr_inos;
   };
 
   /**
@@ -614,16 +858,23 @@ class InodeTracker {
     ~VfsPutRaii() { tracker_->Unlock(); }
 
     bool VfsPut(const uint64_t inode, const uint32_t by) {
-      bool removed = tracker_->inode_references_.Put(inode, by);
-      if (removed) {
-        // TODO(jblomer): pop operation (Lookup+Erase)
-        shash::Md5 md5path;
-        InodeEx inode_ex(inode, InodeEx::kUnknownType);
-        bool found = tracker_->inode_ex_map_.LookupMd5Path(&inode_ex, &md5path);
-        assert(found);
-        tracker_->inode_ex_map_.Erase(inode);
-        tracker_->path_map_.Erase(md5path);
-        atomic_inc64(&tracker_->statistics_.num_removes);
+      InodeEx inode_ex(inode, InodeEx::kUnknownType);
+      InodeExMap::InodeInfo info;
+      bool removed = false;
+      // The inode may be missing if a retired inode is cleared, i.e. if a
+      // file with outdated content is closed
+      if (tracker_->inode_ex_map_.Lookup(&inode_ex, &info)) {
+        assert(info.references >= by);
+        if (info.references == by) {
+          tracker_->inode_ex_map_.Erase(inode);
+          tracker_->ReleasePath(info.node_id, inode);
+          tracker_->CompactIfNeeded();
+          removed = true;
+          atomic_inc64(&tracker_->statistics_.num_removes);
+        } else {
+          info.references -= by;
+          tracker_->inode_ex_map_.Insert(inode_ex, info);
+        }
       }
       atomic_xadd64(&tracker_->statistics_.num_references, -int32_t(by));
       return removed;
@@ -667,34 +918,59 @@ class InodeTracker {
   InodeTracker &operator= (const InodeTracker &other);
   ~InodeTracker();
 
-  void VfsGetBy(const InodeEx inode_ex, const uint32_t by,
+  /**
+   * Exchanges the content with another tracker without copying the paths and
+   * inodes.  Used on reload to hand the tracker over to the new version of
+   * the library.  The other tracker must not be in use by other threads.
+   */
+  void Swap(InodeTracker *other);
+
+  /**
+   * Returns false, without taking the references, if the path cannot be
+   * stored because the name table is full.
+   */
+  bool VfsGetBy(const InodeEx inode_ex, const uint32_t by,
                 const PathString &path)
   {
-    uint64_t inode = inode_ex.GetInode();
+    const uint64_t inode = inode_ex.GetInode();
+    const shash::Md5 md5path(path.GetChars(), path.GetLength());
     Lock();
-    bool is_new_inode = inode_references_.Get(inode, by);
-    shash::Md5 md5path = path_map_.Insert(path, inode);
-    inode_ex_map_.Insert(inode_ex, md5path);
+    InodeEx known_inode_ex = inode_ex;
+    InodeExMap::InodeInfo info;
+    const bool is_new_inode = !inode_ex_map_.Lookup(&known_inode_ex, &info);
+    if (is_new_inode || !path_store_.HasMd5Path(info.node_id, md5path)) {
+      // New inode or the inode is now known under a different path
+      const uint32_t node_id = path_store_.Insert(md5path, path);
+      if (node_id == PathStore::kNoNode) {
+        Unlock();
+        return false;
+      }
+      path_store_.AddInode(node_id, inode);
+      if (!is_new_inode)
+        ReleasePath(info.node_id, inode);
+      info.node_id = node_id;
+    }
+    info.references += by;
+    inode_ex_map_.Insert(inode_ex, info);
     Unlock();
 
     atomic_xadd64(&statistics_.num_references, by);
     if (is_new_inode) atomic_inc64(&statistics_.num_inserts);
+    return true;
   }
 
-  void VfsGet(const InodeEx inode_ex, const PathString &path) {
-    VfsGetBy(inode_ex, 1, path);
+  bool VfsGet(const InodeEx inode_ex, const PathString &path) {
+    return VfsGetBy(inode_ex, 1, path);
   }
 
   VfsPutRaii GetVfsPutRaii() { return VfsPutRaii(this); }
 
   bool FindPath(InodeEx *inode_ex, PathString *path) {
+    InodeExMap::InodeInfo info;
     Lock();
-    shash::Md5 md5path;
-    bool found = inode_ex_map_.LookupMd5Path(inode_ex, &md5path);
-    if (found) {
-      found = path_map_.LookupPath(md5path, path);
-      assert(found);
-    }
+    bool found = inode_ex_map_.Lookup(inode_ex, &info);
+    if (found)
+      path_store_.GetPath(info.node_id, path);
     Unlock();
 
     if (found) {
@@ -705,27 +981,33 @@ class InodeTracker {
     return found;
   }
 
+  /**
+   * Returns the inode of the path, zero if the path is unknown.  If several
+   * inodes use the path, the one that was registered first wins as long as it
+   * is in use.
+   */
   uint64_t FindInode(const PathString &path) {
+    const shash::Md5 md5path(path.GetChars(), path.GetLength());
+    uint64_t inode = 0;
     Lock();
-    uint64_t inode = path_map_.LookupInodeByPath(path);
+    const uint32_t node_id = path_store_.Lookup(md5path);
+    if (node_id != PathStore::kNoNode)
+      inode = path_store_.GetInode(node_id);
     Unlock();
     atomic_inc64(&statistics_.num_hits_inode);
     return inode;
   }
 
   bool FindDentry(uint64_t ino, uint64_t *parent_ino, NameString *name) {
-    PathString path;
     InodeEx inodex(ino, InodeEx::kUnknownType);
-    shash::Md5 md5path;
+    InodeExMap::InodeInfo info;
 
     Lock();
-    bool found = inode_ex_map_.LookupMd5Path(&inodex, &md5path);
+    bool found = inode_ex_map_.Lookup(&inodex, &info);
     if (found) {
-      found = path_map_.LookupPath(md5path, &path);
-      assert(found);
-      *name = GetFileName(path);
-      path = GetParentPath(path);
-      *parent_ino = path_map_.LookupInodeByPath(path);
+      const StringRef name_ref = path_store_.GetName(info.node_id);
+      name->Assign(name_ref.data(), name_ref.length());
+      *parent_ino = GetParentInode(info.node_id);
     }
     Unlock();
     return found;
@@ -736,15 +1018,21 @@ class InodeTracker {
    * found and replaced
    */
   bool ReplaceInode(uint64_t old_inode, const InodeEx &new_inode) {
-    shash::Md5 md5path;
     InodeEx old_inode_ex(old_inode, InodeEx::kUnknownType);
+    InodeExMap::InodeInfo info;
     Lock();
-    bool found = inode_ex_map_.LookupMd5Path(&old_inode_ex, &md5path);
+    bool found = inode_ex_map_.Lookup(&old_inode_ex, &info);
     if (found) {
-      inode_references_.Replace(old_inode, new_inode.GetInode());
-      path_map_.Replace(md5path, new_inode.GetInode());
       inode_ex_map_.Erase(old_inode);
-      inode_ex_map_.Insert(new_inode, md5path);
+      InodeEx replaced_inode_ex = new_inode;
+      InodeExMap::InodeInfo replaced_info;
+      if (inode_ex_map_.Lookup(&replaced_inode_ex, &replaced_info))
+        ReleasePath(replaced_info.node_id, new_inode.GetInode());
+      inode_ex_map_.Insert(new_inode, InodeExMap::InodeInfo(info.node_id, 0));
+      // The new inode takes over the place of the old inode in the node
+      const uint64_t node_inode = path_store_.GetInode(info.node_id);
+      if ((node_inode == old_inode) || (node_inode == 0))
+        path_store_.SetInode(info.node_id, new_inode.GetInode());
     }
     Unlock();
     return found;
@@ -752,27 +1040,41 @@ class InodeTracker {
 
   Cursor BeginEnumerate() {
     Lock();
-    return Cursor(path_map_.path_store()->BeginEnumerate(),
-                  inode_references_.BeginEnumerate());
+    return Cursor(path_store_.BeginEnumerate(),
+                  inode_ex_map_.BeginEnumerate());
   }
 
   bool NextEntry(Cursor *cursor, uint64_t *inode_parent, NameString *name) {
-    shash::Md5 parent_md5;
-    StringRef name_ref;
-    bool result = path_map_.path_store()->Next(
-      &(cursor->csr_paths), &parent_md5, &name_ref);
-    if (!result)
+    uint32_t node_id;
+    if (!path_store_.Next(&(cursor->csr_paths), &node_id))
+      return false;
+    *inode_parent = GetParentInode(node_id);
+    const StringRef name_ref = path_store_.GetName(node_id);
+    name->Assign(name_ref.data(), name_ref.length());
+    return true;
+  }
+
+  /**
+   * Like NextEntry() but also returns the path hash and the inode of the entry
+   * itself.  The inode is zero for paths that are only known as the parent of
+   * other paths.  The root entry has an empty name.
+   */
+  bool NextPath(Cursor *cursor, shash::Md5 *md5path, uint64_t *inode,
+                uint64_t *inode_parent, NameString *name)
+  {
+    uint32_t node_id;
+    if (!path_store_.Next(&(cursor->csr_paths), &node_id))
       return false;
-    if (parent_md5.IsNull())
-      *inode_parent = 0;
-    else
-      *inode_parent = path_map_.LookupInodeByMd5Path(parent_md5);
+    *md5path = path_store_.GetMd5Path(node_id);
+    *inode = path_store_.GetInode(node_id);
+    *inode_parent = GetParentInode(node_id);
+    const StringRef name_ref = path_store_.GetName(node_id);
     name->Assign(name_ref.data(), name_ref.length());
     return true;
   }
 
   bool NextInode(Cursor *cursor, uint64_t *inode) {
-    return inode_references_.Next(&(cursor->csr_inos), inode);
+    return inode_ex_map_.Next(&(cursor->csr_inos), inode);
   }
 
   void EndEnumerate(Cursor *cursor) {
@@ -780,7 +1082,7 @@ class InodeTracker {
   }
 
  private:
-  static const unsigned kVersion = 4;
+  static const unsigned kVersion = 5;
 
   void InitLock();
   void CopyFrom(const InodeTracker &other);
@@ -793,11 +1095,37 @@ class InodeTracker {
     assert(retval == 0);
   }
 
+  uint64_t GetParentInode(const uint32_t node_id) const {
+    const uint32_t parent_id = path_store_.GetParent(node_id);
+    if (parent_id == PathStore::kNoNode)
+      return 0;
+    return path_store_.GetInode(parent_id);
+  }
+
+  /**
+   * Drops the reference of the inode to its path.  If the path was known under
+   * this inode, another inode that still uses the path takes over.
+   */
+  void ReleasePath(const uint32_t node_id, const uint64_t inode) {
+    if (path_store_.RemoveInode(node_id, inode)) {
+      path_store_.SetInode(node_id,
+                           inode_ex_map_.FindInodeOfNode(node_id, inode));
+    }
+    path_store_.Erase(node_id);
+  }
+
+  void CompactIfNeeded() {
+    if (!path_store_.NeedsCompaction())
+      return;
+    std::vector<uint32_t> new_ids;
+    path_store_.Compact(&new_ids);
+    inode_ex_map_.UpdateNodeIds(new_ids);
+  }
+
   unsigned version_;
   pthread_mutex_t *lock_;
-  PathMap path_map_;
+  PathStore path_store_;
   InodeExMap inode_ex_map_;
-  InodeReferences inode_references_;
   Statistics statistics_;
 };  // class InodeTracker
 
@@ -1013,6 +1341,11 @@ class PageCacheTracker {
   PageCacheTracker &operator= (const PageCacheTracker &other);
   ~PageCacheTracker();
 
+  /**
+   * Like InodeTracker::Swap(), used on reload
+   */
+  void Swap(PageCacheTracker *other);
+
   OpenDirectives Open(uint64_t inode, const shash::Any &hash,
                       const struct stat &info);
   /**
@@ -722,6 +722,7 @@ class LruCache : SingleCopy {
 
   inline bool IsFull() const { return cache_gauge_ >= cache_size_; }
   inline bool IsEmpty() const { return cache_gauge_ == 0; }
+  inline unsigned int GetSize() const { return cache_gauge_; }
 
   Counters counters() {
     Lock();
@@ -34,6 +34,8 @@
 #include "cache_extern.h"
 #include "cache_posix.h"
 #include "cache_ram.h"
+#include "cache_slab.h"
+#include "cache_sparse.h"
 #include "cache_tiered.h"
 #include "catalog.h"
 #include "catalog_mgr_client.h"
@@ -70,6 +72,7 @@
 #include "util/pointer.h"
 #include "util/posix.h"
 #include "util/string.h"
+#include "util/uring.h"
 #include "util/uuid.h"
 #include "wpad.h"
 
@@ -192,10 +195,15 @@ FileSystem *FileSystem::Create(const FileSystem::FileSystemInfo &fs_info) {
   file_system->SetupUuid();
   if (!file_system->SetupNfsMaps())
     return file_system.Release();
+  string optarg;
+  const bool use_mmap =
+    file_system->options_mgr_->GetValue("CVMFS_CATALOG_MMAP", &optarg) &&
+    file_system->options_mgr_->IsOn(optarg);
   bool retval = sqlite::RegisterVfsRdOnly(
     file_system->cache_mgr_,
     file_system->statistics_,
-    sqlite::kVfsOptDefault);
+    sqlite::kVfsOptDefault,
+    use_mmap);
   assert(retval);
   file_system->has_custom_sqlitevfs_ = true;
 
@@ -220,6 +228,8 @@ void FileSystem::CreateStatistics() {
   // Callback counters
   n_fs_open_ = statistics_->Register("cvmfs.n_fs_open",
                                      "Overall number of file open operations");
+  n_fs_open_passthrough_ = statistics_->Register("cvmfs.n_fs_open_passthrough",
+    "Number of file open operations served by fuse passthrough");
   n_fs_dir_open_ = statistics_->Register("cvmfs.n_fs_dir_open",
                    "Overall number of directory open operations");
   n_fs_lookup_ = statistics_->Register("cvmfs.n_fs_lookup",
@@ -234,6 +244,8 @@ void FileSystem::CreateStatistics() {
   n_fs_statfs_cached_ = statistics_->Register("cvmfs.n_fs_statfs_cached",
                 "Number of statsfs calls that accessed the cached statfs info");
   n_fs_read_ = statistics_->Register("cvmfs.n_fs_read", "Number of files read");
+  n_fs_read_splice_ = statistics_->Register("cvmfs.n_fs_read_splice",
+    "Number of reads spliced from the cache");
   n_fs_readlink_ = statistics_->Register("cvmfs.n_fs_readlink",
                                          "Number of links read");
   n_fs_forget_ = statistics_->Register("cvmfs.n_fs_forget",
@@ -308,6 +320,12 @@ FileSystem::PosixCacheSettings FileSystem::DeterminePosixCacheSettings(
   {
     settings.avoid_rename = true;
   }
+  if (options_mgr_->GetValue(MkCacheParm("CVMFS_CACHE_IO_URING", instance),
+                             &optarg)
+      && options_mgr_->IsOn(optarg))
+  {
+    settings.use_io_uring = true;
+  }
 
   if (type_ == kFsFuse)
     settings.quota_limit = kDefaultQuotaLimit;
@@ -397,6 +415,7 @@ FileSystem::FileSystem(const FileSystem::FileSystemInfo &fs_info)
   , wait_workspace_(fs_info.wait_workspace)
   , foreground_(fs_info.foreground)
   , n_fs_open_(NULL)
+  , n_fs_open_passthrough_(NULL)
   , n_fs_dir_open_(NULL)
   , n_fs_lookup_(NULL)
   , n_fs_lookup_negative_(NULL)
@@ -405,6 +424,7 @@ FileSystem::FileSystem(const FileSystem::FileSystemInfo &fs_info)
   , n_fs_statfs_(NULL)
   , n_fs_statfs_cached_(NULL)
   , n_fs_read_(NULL)
+  , n_fs_read_splice_(NULL)
   , n_fs_readlink_(NULL)
   , n_fs_forget_(NULL)
   , n_fs_inode_replace_(NULL)
@@ -629,6 +649,8 @@ CacheManager *FileSystem::SetupCacheMgr(const string &instance) {
     return SetupPosixCacheMgr(instance);
   } else if (instance_type == "ram") {
     return SetupRamCacheMgr(instance);
+  } else if (instance_type == "slab") {
+    return SetupSlabCacheMgr(instance);
   } else if (instance_type == "tiered") {
     return SetupTieredCacheMgr(instance);
   } else if (instance_type == "external") {
@@ -698,6 +720,14 @@ CacheManager *FileSystem::SetupPosixCacheMgr(const string &instance) {
     return NULL;
   }
 
+  if (settings.use_io_uring &&
+      !cache_mgr->EnableIoUring(IoUring::kDefaultQueueDepth))
+  {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogWarn,
+             "io_uring not available for cache '%s', using system calls",
+             instance.c_str());
+  }
+
   // Sentinel file for future use
   // Might be a read-only cache
   const bool ignore_failure = settings.is_alien;
@@ -761,6 +791,50 @@ CacheManager *FileSystem::SetupRamCacheMgr(const string &instance) {
 }
 
 
+CacheManager *FileSystem::SetupSlabCacheMgr(const string &instance) {
+  string optarg;
+  unsigned nfiles = kDefaultNfiles;
+  if (options_mgr_->GetValue("CVMFS_NFILES", &optarg))
+    nfiles = String2Uint64(optarg);
+
+  string cache_dir;
+  if (!options_mgr_->GetValue(MkCacheParm("CVMFS_CACHE_DIR", instance),
+                              &cache_dir))
+  {
+    boot_error_ = MkCacheParm("CVMFS_CACHE_DIR", instance) + " missing";
+    boot_status_ = loader::kFailOptions;
+    return NULL;
+  }
+  if (!options_mgr_->GetValue(MkCacheParm("CVMFS_CACHE_SIZE", instance),
+                              &optarg))
+  {
+    boot_error_ = MkCacheParm("CVMFS_CACHE_SIZE", instance) + " missing";
+    boot_status_ = loader::kFailOptions;
+    return NULL;
+  }
+  const uint64_t limit = String2Uint64(optarg) * 1024 * 1024;
+  uint64_t segment_size = SlabCacheManager::kDefaultSegmentSize;
+  if (options_mgr_->GetValue(MkCacheParm("CVMFS_CACHE_SEGMENT_SIZE", instance),
+                             &optarg))
+  {
+    segment_size = String2Uint64(optarg) * 1024 * 1024;
+  }
+
+  const string cache_path = cache_dir + "/" + name_;
+  SlabCacheManager *cache_mgr = SlabCacheManager::Create(
+    cache_path, limit, segment_size, nfiles,
+    perf::StatisticsTemplate("cache." + instance, statistics_));
+  if (cache_mgr == NULL) {
+    boot_error_ = "Failed to setup slab cache '" + instance + "' in " +
+                  cache_path;
+    boot_status_ = loader::kFailCacheDir;
+    return NULL;
+  }
+  cache_mgr->AcquireQuotaManager(SlabQuotaManager::Create(cache_mgr));
+  return cache_mgr;
+}
+
+
 CacheManager *FileSystem::SetupTieredCacheMgr(const string &instance) {
   string optarg;
   if (!options_mgr_->GetValue(MkCacheParm("CVMFS_CACHE_UPPER", instance),
@@ -1227,6 +1301,25 @@ void MountPoint::DisableCacheSymlinks() {
   cache_symlinks_ = false;
 }
 
+/**
+ * Fuse passthrough requires fuse >= 3.16 (FUSE_CAP_PASSTHROUGH) and
+ * linux kernel >= 6.9.
+ *
+ * NOTE: This function should only be called before or within cvmfs_init().
+ */
+void MountPoint::DisableFusePassthrough() {
+  fuse_passthrough_ = false;
+}
+
+/**
+ * Zero-copy read replies require fuse >= 2.9 (FUSE_CAP_SPLICE_WRITE).
+ *
+ * NOTE: This function should only be called before or within cvmfs_init().
+ */
+void MountPoint::DisableFuseSplice() {
+  fuse_splice_ = false;
+}
+
 /**
  * Instead of invalidate dentries, they should be expired.
  * Fixes issues with mount-on-top mounts and symlink caching.
@@ -1265,6 +1358,7 @@ MountPoint *MountPoint::Create(
     return mountpoint.Release();
   }
   mountpoint->CreateFetchers();
+  mountpoint->CreateSparseCache();
   if (!mountpoint->CreateCatalogManager())
     return mountpoint.Release();
   if (!mountpoint->CreateTracer())
@@ -1314,6 +1408,29 @@ bool MountPoint::CreateCatalogManager() {
   SetupInodeAnnotation();
   if (!SetupOwnerMaps())
     return false;
+  if (options_mgr_->GetValue("CVMFS_CATALOG_INDEX_SIZE", &optarg) &&
+      (String2Uint64(optarg) > 0))
+  {
+    catalog_mgr_->SetPathIndexLimit(String2Uint64(optarg) * 1024 * 1024);
+  }
+  if (options_mgr_->GetValue("CVMFS_CATALOG_FILTER", &optarg) &&
+      options_mgr_->IsOn(optarg))
+  {
+    catalog_mgr_->EnablePathFilters();
+  }
+  if (options_mgr_->GetValue("CVMFS_CATALOG_PREFETCH", &optarg)) {
+    uint64_t budget = String2Uint64(optarg);
+    const unsigned max_budget =
+      catalog::ClientCatalogManager::kMaxPrefetchBudget;
+    if (budget > max_budget) {
+      LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogWarn,
+               "catalog prefetch budget %s exceeds %u, using %u",
+               optarg.c_str(), max_budget, max_budget);
+      budget = max_budget;
+    }
+    if (budget > 0)
+      catalog_mgr_->EnablePrefetch(budget);
+  }
   shash::Any root_hash;
   if (!DetermineRootHash(&root_hash))
     return false;
@@ -1365,9 +1482,20 @@ bool MountPoint::CreateCatalogManager() {
 
 bool MountPoint::CreateDownloadManagers() {
   string optarg;
+  // The connections are split among the download threads
+  unsigned num_shards = 1;
+  if (options_mgr_->GetValue("CVMFS_DOWNLOAD_SHARDS", &optarg)) {
+    num_shards = String2Uint64(optarg);
+    if ((num_shards == 0) || (num_shards > kDefaultNumConnections)) {
+      LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogWarn,
+               "invalid number of download shards: %s", optarg.c_str());
+      num_shards = 1;
+    }
+  }
   download_mgr_ = new download::DownloadManager();
   download_mgr_->Init(kDefaultNumConnections,
-                      perf::StatisticsTemplate("download", statistics_));
+                      perf::StatisticsTemplate("download", statistics_),
+                      num_shards);
   download_mgr_->SetCredentialsAttachment(authz_attachment_);
 
   if (options_mgr_->GetValue("CVMFS_SERVER_URL", &optarg)) {
@@ -1466,6 +1594,59 @@ void MountPoint::CreateFetchers() {
     backoff_throttle_,
     perf::StatisticsTemplate("fetch-external", statistics_),
     is_external_data);
+
+  string optarg;
+  if (options_mgr_->GetValue("CVMFS_STREAMING_THRESHOLD", &optarg) &&
+      (String2Uint64(optarg) > 0))
+  {
+    if (file_system_->cache_mgr()->id() == kPosixCacheManager) {
+      const uint64_t min_size = String2Uint64(optarg) * 1024 * 1024;
+      fetcher_->EnableStreaming(min_size);
+      external_fetcher_->EnableStreaming(min_size);
+    } else {
+      LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogWarn,
+               "CVMFS_STREAMING_THRESHOLD requires a posix cache, ignoring");
+    }
+  }
+}
+
+
+/**
+ * Large, uncompressed objects can be read block-wise with range requests
+ * instead of being fetched as a whole.  The blocks are stored in the cache
+ * directory but are not managed by the quota manager.  Complete and verified
+ * objects are committed to the cache manager.
+ */
+void MountPoint::CreateSparseCache() {
+  string optarg;
+  if (!options_mgr_->GetValue("CVMFS_SPARSE_CACHE_SIZE", &optarg) ||
+      (String2Uint64(optarg) == 0))
+  {
+    return;
+  }
+  const uint64_t limit = String2Uint64(optarg) * 1024 * 1024;
+  if (file_system_->cache_mgr()->id() != kPosixCacheManager) {
+    LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogWarn,
+             "CVMFS_SPARSE_CACHE_SIZE requires a posix cache, ignoring");
+    return;
+  }
+  unsigned block_size = SparseCache::kDefaultBlockSize;
+  if (options_mgr_->GetValue("CVMFS_SPARSE_BLOCK_SIZE", &optarg)) {
+    block_size = String2Uint64(optarg) * 1024;
+    if (block_size == 0) {
+      LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogWarn,
+               "invalid sparse block size: %s", optarg.c_str());
+      block_size = SparseCache::kDefaultBlockSize;
+    }
+  }
+
+  PosixCacheManager *posix_cache_mgr =
+    reinterpret_cast<PosixCacheManager *>(file_system_->cache_mgr());
+  sparse_cache_ = SparseCache::Create(
+    posix_cache_mgr->cache_path() + "/sparse",
+    block_size, limit, file_system_->cache_mgr(),
+    download_mgr_, external_download_mgr_,
+    perf::StatisticsTemplate("sparse", statistics_));
 }
 
 
@@ -1766,6 +1947,7 @@ MountPoint::MountPoint(
   , external_download_mgr_(NULL)
   , fetcher_(NULL)
   , external_fetcher_(NULL)
+  , sparse_cache_(NULL)
   , inode_annotation_(NULL)
   , catalog_mgr_(NULL)
   , chunk_tables_(NULL)
@@ -1781,10 +1963,14 @@ MountPoint::MountPoint(
   , resolv_conf_watcher_(NULL)
   , max_ttl_sec_(kDefaultMaxTtlSec)
   , kcache_timeout_sec_(static_cast<double>(kDefaultKCacheTtlSec))
+  , kcache_inval_rate_(0)
   , fixed_catalog_(false)
   , enforce_acls_(false)
   , cache_symlinks_(false)
   , fuse_expire_entry_(false)
+  , fuse_passthrough_(false)
+  , fuse_splice_(false)
+  , incremental_remount_(false)
   , has_membership_req_(false)
   , talk_socket_path_(std::string("./cvmfs_io.") + fqrn)
   , talk_socket_uid_(0)
@@ -1810,6 +1996,7 @@ MountPoint::~MountPoint() {
 
   delete catalog_mgr_;
   delete inode_annotation_;
+  delete sparse_cache_;
   delete external_fetcher_;
   delete fetcher_;
   if (external_download_mgr_ != NULL) {
@@ -1870,6 +2057,8 @@ bool MountPoint::SetupBehavior() {
   }
   LogCvmfs(kLogCvmfs, kLogDebug, "kernel caches expire after %d seconds",
            static_cast<int>(kcache_timeout_sec_));
+  if (options_mgr_->GetValue("CVMFS_KCACHE_INVALIDATION_RATE", &optarg))
+    kcache_inval_rate_ = String2Uint64(optarg);
 
   uint64_t statfs_time_cache_valid = 0;
   if (options_mgr_->GetValue("CVMFS_STATFS_CACHE_TIMEOUT", &optarg)) {
@@ -1946,6 +2135,24 @@ bool MountPoint::SetupBehavior() {
     cache_symlinks_ = true;
   }
 
+  if (options_mgr_->GetValue("CVMFS_FUSE_PASSTHROUGH", &optarg)
+      && options_mgr_->IsOn(optarg))
+  {
+    fuse_passthrough_ = true;
+  }
+
+  if (options_mgr_->GetValue("CVMFS_FUSE_SPLICE", &optarg)
+      && options_mgr_->IsOn(optarg))
+  {
+    fuse_splice_ = true;
+  }
+
+  if (options_mgr_->GetValue("CVMFS_INCREMENTAL_REMOUNT", &optarg)
+      && options_mgr_->IsOn(optarg))
+  {
+    incremental_remount_ = true;
+  }
+
 
 
   if (options_mgr_->GetValue("CVMFS_TALK_SOCKET", &optarg)) {
@@ -63,6 +63,7 @@ namespace signature {
 class SignatureManager;
 }
 class SimpleChunkTables;
+class SparseCache;
 class Tracer;
 
 
@@ -220,7 +221,9 @@ class FileSystem : SingleCopy, public BootFactory {
   perf::Counter *n_fs_lookup() { return n_fs_lookup_; }
   perf::Counter *n_fs_lookup_negative() { return n_fs_lookup_negative_; }
   perf::Counter *n_fs_open() { return n_fs_open_; }
+  perf::Counter *n_fs_open_passthrough() { return n_fs_open_passthrough_; }
   perf::Counter *n_fs_read() { return n_fs_read_; }
+  perf::Counter *n_fs_read_splice() { return n_fs_read_splice_; }
   perf::Counter *n_fs_readlink() { return n_fs_readlink_; }
   perf::Counter *n_fs_stat() { return n_fs_stat_; }
   perf::Counter *n_fs_stat_stale() { return n_fs_stat_stale_; }
@@ -260,7 +263,7 @@ class FileSystem : SingleCopy, public BootFactory {
     PosixCacheSettings() :
       is_shared(false), is_alien(false), is_managed(false),
       avoid_rename(false), cache_base_defined(false), cache_dir_defined(false),
-      quota_limit(0)
+      use_io_uring(false), quota_limit(0)
       { }
     bool is_shared;
     bool is_alien;
@@ -268,6 +271,10 @@ class FileSystem : SingleCopy, public BootFactory {
     bool avoid_rename;
     bool cache_base_defined;
     bool cache_dir_defined;
+    /**
+     * Write transactions through io_uring if the kernel supports it
+     */
+    bool use_io_uring;
     /**
      * Soft limit in bytes for the cache.  The quota manager removes half the
      * cache when the limit is exceeded.
@@ -306,6 +313,7 @@ class FileSystem : SingleCopy, public BootFactory {
   CacheManager *SetupCacheMgr(const std::string &instance);
   CacheManager *SetupPosixCacheMgr(const std::string &instance);
   CacheManager *SetupRamCacheMgr(const std::string &instance);
+  CacheManager *SetupSlabCacheMgr(const std::string &instance);
   CacheManager *SetupTieredCacheMgr(const std::string &instance);
   CacheManager *SetupExternalCacheMgr(const std::string &instance);
   PosixCacheSettings DeterminePosixCacheSettings(const std::string &instance);
@@ -325,6 +333,7 @@ class FileSystem : SingleCopy, public BootFactory {
   bool foreground_;
 
   perf::Counter *n_fs_open_;
+  perf::Counter *n_fs_open_passthrough_;
   perf::Counter *n_fs_dir_open_;
   perf::Counter *n_fs_lookup_;
   perf::Counter *n_fs_lookup_negative_;
@@ -333,6 +342,7 @@ class FileSystem : SingleCopy, public BootFactory {
   perf::Counter *n_fs_statfs_;
   perf::Counter *n_fs_statfs_cached_;
   perf::Counter *n_fs_read_;
+  perf::Counter *n_fs_read_splice_;
   perf::Counter *n_fs_readlink_;
   perf::Counter *n_fs_forget_;
   perf::Counter *n_fs_inode_replace_;
@@ -512,12 +522,16 @@ class MountPoint : SingleCopy, public BootFactory {
   bool enforce_acls() { return enforce_acls_; }
   bool cache_symlinks() { return cache_symlinks_; }
   bool fuse_expire_entry() { return fuse_expire_entry_; }
+  bool fuse_passthrough() { return fuse_passthrough_; }
+  bool fuse_splice() { return fuse_splice_; }
+  bool incremental_remount() { return incremental_remount_; }
   catalog::InodeAnnotation *inode_annotation() {
     return inode_annotation_;
   }
   glue::InodeTracker *inode_tracker() { return inode_tracker_; }
   lru::InodeCache *inode_cache() { return inode_cache_; }
   double kcache_timeout_sec() { return kcache_timeout_sec_; }
+  unsigned kcache_inval_rate() { return kcache_inval_rate_; }
   lru::Md5PathCache *md5path_cache() { return md5path_cache_; }
   std::string membership_req() { return membership_req_; }
   glue::DentryTracker *dentry_tracker() { return dentry_tracker_; }
@@ -525,6 +539,7 @@ class MountPoint : SingleCopy, public BootFactory {
   lru::PathCache *path_cache() { return path_cache_; }
   std::string repository_tag() { return repository_tag_; }
   SimpleChunkTables *simple_chunk_tables() { return simple_chunk_tables_; }
+  SparseCache *sparse_cache() { return sparse_cache_; }
   perf::Statistics *statistics() { return statistics_; }
   perf::TelemetryAggregator *telemetry_aggr() { return telemetry_aggr_; }
   signature::SignatureManager *signature_mgr() { return signature_mgr_; }
@@ -537,6 +552,8 @@ class MountPoint : SingleCopy, public BootFactory {
 
   bool ReloadBlacklists();
   void DisableCacheSymlinks();
+  void DisableFusePassthrough();
+  void DisableFuseSplice();
   void EnableFuseExpireEntry();
 
  private:
@@ -599,6 +616,7 @@ class MountPoint : SingleCopy, public BootFactory {
   bool CreateDownloadManagers();
   bool CreateResolvConfWatcher();
   void CreateFetchers();
+  void CreateSparseCache();
   bool CreateCatalogManager();
   void CreateTables();
   bool CreateTracer();
@@ -635,6 +653,10 @@ class MountPoint : SingleCopy, public BootFactory {
   download::DownloadManager *external_download_mgr_;
   cvmfs::Fetcher *fetcher_;
   cvmfs::Fetcher *external_fetcher_;
+  /**
+   * NULL unless configured
+   */
+  SparseCache *sparse_cache_;
   catalog::InodeAnnotation *inode_annotation_;
   catalog::ClientCatalogManager *catalog_mgr_;
   ChunkTables *chunk_tables_;
@@ -654,10 +676,21 @@ class MountPoint : SingleCopy, public BootFactory {
   unsigned max_ttl_sec_;
   pthread_mutex_t lock_max_ttl_;
   double kcache_timeout_sec_;
+  /**
+   * Maximum number of kernel cache entries invalidated per second on remount,
+   * zero for no limit
+   */
+  unsigned kcache_inval_rate_;
   bool fixed_catalog_;
   bool enforce_acls_;
   bool cache_symlinks_;
   bool fuse_expire_entry_;
+  bool fuse_passthrough_;
+  bool fuse_splice_;
+  /**
+   * Keep the meta-data cache entries of unchanged paths on remount
+   */
+  bool incremental_remount_;
   std::string repository_tag_;
   std::vector<std::string> blacklist_paths_;
 
@@ -61,6 +61,7 @@
 #include "util/concurrency.h"
 #include "util/exception.h"
 #include "util/logging.h"
+#include "util/platform.h"
 #include "util/posix.h"
 #include "util/prng.h"
 #include "util/smalloc.h"
@@ -415,6 +416,30 @@ int DownloadManager::ParseHttpCode(const char digits[3]) {
 }
 
 
+/**
+ * States of JobInfo::job_state.  Fetch() only sleeps in the kernel if the job
+ * is not yet done and the I/O thread only issues a wake-up if Fetch() sleeps.
+ */
+static const int32_t kJobPending = 0;
+static const int32_t kJobSleeping = 1;
+static const int32_t kJobDone = 2;
+
+static void CompleteJob(JobInfo *info) {
+  int32_t state;
+  do {
+    state = atomic_read32(&info->job_state);
+  } while (!atomic_cas32(&info->job_state, state, kJobDone));
+  if (state == kJobSleeping)
+    platform_futex_wake(&info->job_state);
+}
+
+static void WaitForJob(JobInfo *info) {
+  atomic_cas32(&info->job_state, kJobPending, kJobSleeping);
+  while (atomic_read32(&info->job_state) != kJobDone)
+    platform_futex_wait(&info->job_state, kJobSleeping);
+}
+
+
 /**
  * Called when new curl sockets arrive or existing curl sockets depart.
  */
@@ -426,65 +451,64 @@ int DownloadManager::CallbackCurlSocket(CURL * /* easy */,
 {
   // LogCvmfs(kLogDownload, kLogDebug, "CallbackCurlSocket called with easy "
   //          "handle %p, socket %d, action %d", easy, s, action);
-  DownloadManager *download_mgr = static_cast<DownloadManager *>(userp);
+  Shard *shard = static_cast<Shard *>(userp);
   if (action == CURL_POLL_NONE)
     return 0;
 
-  // Find s in watch_fds_
+  // Find s in watch_fds
   unsigned index;
 
-  // TODO(heretherebedragons) why start at index = 0 and not 2?
-  // fd[0] and fd[1] are fixed?
-  for (index = 0; index < download_mgr->watch_fds_inuse_; ++index) {
-    if (download_mgr->watch_fds_[index].fd == s)
+  // TODO(heretherebedragons) why start at index = 0 and not 1?
+  // fd[0] is fixed?
+  for (index = 0; index < shard->watch_fds_inuse; ++index) {
+    if (shard->watch_fds[index].fd == s)
       break;
   }
   // Or create newly
-  if (index == download_mgr->watch_fds_inuse_) {
+  if (index == shard->watch_fds_inuse) {
     // Extend array if necessary
-    if (download_mgr->watch_fds_inuse_ == download_mgr->watch_fds_size_)
+    if (shard->watch_fds_inuse == shard->watch_fds_size)
     {
-      assert(download_mgr->watch_fds_size_ > 0);
-      download_mgr->watch_fds_size_ *= 2;
-      download_mgr->watch_fds_ = static_cast<struct pollfd *>(
-        srealloc(download_mgr->watch_fds_,
-                 download_mgr->watch_fds_size_ * sizeof(struct pollfd)));
+      assert(shard->watch_fds_size > 0);
+      shard->watch_fds_size *= 2;
+      shard->watch_fds = static_cast<struct pollfd *>(
+        srealloc(shard->watch_fds,
+                 shard->watch_fds_size * sizeof(struct pollfd)));
     }
-    download_mgr->watch_fds_[download_mgr->watch_fds_inuse_].fd = s;
-    download_mgr->watch_fds_[download_mgr->watch_fds_inuse_].events = 0;
-    download_mgr->watch_fds_[download_mgr->watch_fds_inuse_].revents = 0;
-    download_mgr->watch_fds_inuse_++;
+    shard->watch_fds[shard->watch_fds_inuse].fd = s;
+    shard->watch_fds[shard->watch_fds_inuse].events = 0;
+    shard->watch_fds[shard->watch_fds_inuse].revents = 0;
+    shard->watch_fds_inuse++;
   }
 
   switch (action) {
     case CURL_POLL_IN:
-      download_mgr->watch_fds_[index].events = POLLIN | POLLPRI;
+      shard->watch_fds[index].events = POLLIN | POLLPRI;
       break;
     case CURL_POLL_OUT:
-      download_mgr->watch_fds_[index].events = POLLOUT | POLLWRBAND;
+      shard->watch_fds[index].events = POLLOUT | POLLWRBAND;
       break;
     case CURL_POLL_INOUT:
-      download_mgr->watch_fds_[index].events =
+      shard->watch_fds[index].events =
         POLLIN | POLLPRI | POLLOUT | POLLWRBAND;
       break;
     case CURL_POLL_REMOVE:
-      if (index < download_mgr->watch_fds_inuse_-1) {
-        download_mgr->watch_fds_[index] =
-          download_mgr->watch_fds_[download_mgr->watch_fds_inuse_-1];
+      if (index < shard->watch_fds_inuse-1) {
+        shard->watch_fds[index] = shard->watch_fds[shard->watch_fds_inuse-1];
       }
-      download_mgr->watch_fds_inuse_--;
+      shard->watch_fds_inuse--;
       // Shrink array if necessary
-      if ((download_mgr->watch_fds_inuse_ > download_mgr->watch_fds_max_) &&
-          (download_mgr->watch_fds_inuse_ < download_mgr->watch_fds_size_/2))
+      if ((shard->watch_fds_inuse > 4 * shard->pool_max_handles) &&
+          (shard->watch_fds_inuse < shard->watch_fds_size/2))
       {
-        download_mgr->watch_fds_size_ /= 2;
-        // LogCvmfs(kLogDownload, kLogDebug, "shrinking watch_fds_ (%d)",
-        //          watch_fds_size_);
-        download_mgr->watch_fds_ = static_cast<struct pollfd *>(
-          srealloc(download_mgr->watch_fds_,
-                   download_mgr->watch_fds_size_*sizeof(struct pollfd)));
-        // LogCvmfs(kLogDownload, kLogDebug, "shrinking watch_fds_ done",
-        //          watch_fds_size_);
+        shard->watch_fds_size /= 2;
+        // LogCvmfs(kLogDownload, kLogDebug, "shrinking watch_fds (%d)",
+        //          watch_fds_size);
+        shard->watch_fds = static_cast<struct pollfd *>(
+          srealloc(shard->watch_fds,
+                   shard->watch_fds_size*sizeof(struct pollfd)));
+        // LogCvmfs(kLogDownload, kLogDebug, "shrinking watch_fds done",
+        //          watch_fds_size);
       }
       break;
     default:
@@ -496,27 +520,61 @@ int DownloadManager::CallbackCurlSocket(CURL * /* easy */,
 
 
 /**
- * Worker thread event loop.  Waits on new JobInfo structs on a pipe.
+ * Multiple producers: pushes the job onto the lock-free stack and wakes up the
+ * I/O thread if the stack was empty.  Otherwise the I/O thread has a pending
+ * wake-up anyway.
+ */
+void DownloadManager::Shard::PushJob(JobInfo *info) {
+  JobInfo *head;
+  do {
+    head = jobs;
+    info->next_job = head;
+  } while (!__sync_bool_compare_and_swap(&jobs, head, info));
+  if (head == NULL)
+    platform_wakeup_signal(wakeup_fds[1]);
+}
+
+
+/**
+ * Single consumer: takes all the pending jobs at once and returns them in
+ * order of submission.  Since the stack is never popped element-wise, there is
+ * no ABA problem.
+ */
+JobInfo *DownloadManager::Shard::PopJobs() {
+  JobInfo *head;
+  do {
+    head = jobs;
+  } while (!__sync_bool_compare_and_swap(&jobs, head,
+                                         static_cast<JobInfo *>(NULL)));
+  JobInfo *result = NULL;
+  while (head != NULL) {
+    JobInfo *next = head->next_job;
+    head->next_job = result;
+    result = head;
+    head = next;
+  }
+  return result;
+}
+
+
+/**
+ * Worker thread event loop.  Waits on new JobInfo structs on the shard's job
+ * queue.
  */
 void *DownloadManager::MainDownload(void *data) {
   LogCvmfs(kLogDownload, kLogDebug, "download I/O thread started");
-  DownloadManager *download_mgr = static_cast<DownloadManager *>(data);
+  Shard *shard = static_cast<Shard *>(data);
+  DownloadManager *download_mgr = shard->download_mgr;
 
-  const int kIdxPipeTerminate = 0;
-  const int kIdxPipeJobs = 1;
+  const int kIdxWakeup = 0;
 
-  download_mgr->watch_fds_ =
+  shard->watch_fds =
     static_cast<struct pollfd *>(smalloc(2 * sizeof(struct pollfd)));
-  download_mgr->watch_fds_size_ = 2;
-  download_mgr->watch_fds_[kIdxPipeTerminate].fd =
-                                     download_mgr->pipe_terminate_->GetReadFd();
-  download_mgr->watch_fds_[kIdxPipeTerminate].events = POLLIN | POLLPRI;
-  download_mgr->watch_fds_[kIdxPipeTerminate].revents = 0;
-  download_mgr->watch_fds_[kIdxPipeJobs].fd =
-                                          download_mgr->pipe_jobs_->GetReadFd();
-  download_mgr->watch_fds_[kIdxPipeJobs].events = POLLIN | POLLPRI;
-  download_mgr->watch_fds_[kIdxPipeJobs].revents = 0;
-  download_mgr->watch_fds_inuse_ = 2;
+  shard->watch_fds_size = 2;
+  shard->watch_fds[kIdxWakeup].fd = shard->wakeup_fds[0];
+  shard->watch_fds[kIdxWakeup].events = POLLIN | POLLPRI;
+  shard->watch_fds[kIdxWakeup].revents = 0;
+  shard->watch_fds_inuse = 1;
 
   int still_running = 0;
   struct timeval timeval_start, timeval_stop;
@@ -541,37 +599,42 @@ void *DownloadManager::MainDownload(void *data) {
         1000 * DiffTimeSeconds(timeval_start, timeval_stop));
       perf::Xadd(download_mgr->counters_->sz_transfer_time, delta);
     }
-    int retval = poll(download_mgr->watch_fds_, download_mgr->watch_fds_inuse_,
-                      timeout);
+    int retval = poll(shard->watch_fds, shard->watch_fds_inuse, timeout);
     if (retval < 0) {
       continue;
     }
 
     // Handle timeout
     if (retval == 0) {
-      curl_multi_socket_action(download_mgr->curl_multi_,
+      curl_multi_socket_action(shard->curl_multi,
                                CURL_SOCKET_TIMEOUT,
                                0,
                                &still_running);
     }
 
-    // Terminate I/O thread
-    if (download_mgr->watch_fds_[kIdxPipeTerminate].revents)
-      break;
+    if (shard->watch_fds[kIdxWakeup].revents) {
+      shard->watch_fds[kIdxWakeup].revents = 0;
+      // Drain before taking the jobs, so that no wake-up gets lost
+      platform_wakeup_drain(shard->wakeup_fds[0]);
 
-    // New job arrives
-    if (download_mgr->watch_fds_[kIdxPipeJobs].revents) {
-      download_mgr->watch_fds_[kIdxPipeJobs].revents = 0;
-      JobInfo *info;
-      download_mgr->pipe_jobs_->Read<JobInfo*>(&info);
-      if (!still_running) {
+      // Terminate I/O thread
+      if (atomic_read32(&shard->terminate))
+        break;
+
+      // New jobs arrive
+      JobInfo *info = shard->PopJobs();
+      if ((info != NULL) && !still_running) {
         gettimeofday(&timeval_start, NULL);
       }
-      CURL *handle = download_mgr->AcquireCurlHandle();
-      download_mgr->InitializeRequest(info, handle);
-      download_mgr->SetUrlOptions(info);
-      curl_multi_add_handle(download_mgr->curl_multi_, handle);
-      curl_multi_socket_action(download_mgr->curl_multi_,
+      while (info != NULL) {
+        JobInfo *next = info->next_job;
+        CURL *handle = download_mgr->AcquireCurlHandle(shard);
+        download_mgr->InitializeRequest(shard, info, handle);
+        download_mgr->SetUrlOptions(info);
+        curl_multi_add_handle(shard->curl_multi, handle);
+        info = next;
+      }
+      curl_multi_socket_action(shard->curl_multi,
                                CURL_SOCKET_TIMEOUT,
                                0,
                                &still_running);
@@ -579,28 +642,28 @@ void *DownloadManager::MainDownload(void *data) {
 
     // Activity on curl sockets
     // Within this loop the curl_multi_socket_action() may cause socket(s)
-    // to be removed from watch_fds_. If a socket is removed it is replaced
+    // to be removed from watch_fds. If a socket is removed it is replaced
     // by the socket at the end of the array and the inuse count is decreased.
     // Therefore loop over the array in reverse order.
-    for (int64_t i = download_mgr->watch_fds_inuse_-1; i >= 2; --i) {
-      if (i >= download_mgr->watch_fds_inuse_) {
+    for (int64_t i = shard->watch_fds_inuse-1; i >= 1; --i) {
+      if (i >= shard->watch_fds_inuse) {
         continue;
       }
-      if (download_mgr->watch_fds_[i].revents) {
+      if (shard->watch_fds[i].revents) {
         int ev_bitmask = 0;
-        if (download_mgr->watch_fds_[i].revents & (POLLIN | POLLPRI))
+        if (shard->watch_fds[i].revents & (POLLIN | POLLPRI))
           ev_bitmask |= CURL_CSELECT_IN;
-        if (download_mgr->watch_fds_[i].revents & (POLLOUT | POLLWRBAND))
+        if (shard->watch_fds[i].revents & (POLLOUT | POLLWRBAND))
           ev_bitmask |= CURL_CSELECT_OUT;
-        if (download_mgr->watch_fds_[i].revents &
+        if (shard->watch_fds[i].revents &
             (POLLERR | POLLHUP | POLLNVAL))
         {
           ev_bitmask |= CURL_CSELECT_ERR;
         }
-        download_mgr->watch_fds_[i].revents = 0;
+        shard->watch_fds[i].revents = 0;
 
-        curl_multi_socket_action(download_mgr->curl_multi_,
-                                 download_mgr->watch_fds_[i].fd,
+        curl_multi_socket_action(shard->curl_multi,
+                                 shard->watch_fds[i].fd,
                                  ev_bitmask,
                                  &still_running);
       }
@@ -609,7 +672,7 @@ void *DownloadManager::MainDownload(void *data) {
     // Check if transfers are completed
     CURLMsg *curl_msg;
     int msgs_in_queue;
-    while ((curl_msg = curl_multi_info_read(download_mgr->curl_multi_,
+    while ((curl_msg = curl_multi_info_read(shard->curl_multi,
                                             &msgs_in_queue)))
     {
       if (curl_msg->msg == CURLMSG_DONE) {
@@ -619,31 +682,31 @@ void *DownloadManager::MainDownload(void *data) {
         int curl_error = curl_msg->data.result;
         curl_easy_getinfo(easy_handle, CURLINFO_PRIVATE, &info);
 
-        curl_multi_remove_handle(download_mgr->curl_multi_, easy_handle);
-        if (download_mgr->VerifyAndFinalize(curl_error, info)) {
-          curl_multi_add_handle(download_mgr->curl_multi_, easy_handle);
-          curl_multi_socket_action(download_mgr->curl_multi_,
+        curl_multi_remove_handle(shard->curl_multi, easy_handle);
+        if (download_mgr->VerifyAndFinalize(shard, curl_error, info)) {
+          curl_multi_add_handle(shard->curl_multi, easy_handle);
+          curl_multi_socket_action(shard->curl_multi,
                                    CURL_SOCKET_TIMEOUT,
                                    0,
                                    &still_running);
         } else {
-          // Return easy handle into pool and write result back
-          download_mgr->ReleaseCurlHandle(easy_handle);
-
-          info->pipe_job_results->Write<download::Failures>(info->error_code);
+          // Return easy handle into pool and wake up the waiting Fetch()
+          download_mgr->ReleaseCurlHandle(shard, easy_handle);
+          CompleteJob(info);
         }
       }
     }
   }
 
-  for (set<CURL *>::iterator i = download_mgr->pool_handles_inuse_->begin(),
-       iEnd = download_mgr->pool_handles_inuse_->end(); i != iEnd; ++i)
+  for (set<CURL *>::iterator i = shard->pool_handles_inuse->begin(),
+       iEnd = shard->pool_handles_inuse->end(); i != iEnd; ++i)
   {
-    curl_multi_remove_handle(download_mgr->curl_multi_, *i);
+    curl_multi_remove_handle(shard->curl_multi, *i);
     curl_easy_cleanup(*i);
   }
-  download_mgr->pool_handles_inuse_->clear();
-  free(download_mgr->watch_fds_);
+  shard->pool_handles_inuse->clear();
+  free(shard->watch_fds);
+  shard->watch_fds = NULL;
 
   LogCvmfs(kLogDownload, kLogDebug, "download I/O thread terminated");
   return NULL;
@@ -800,10 +863,10 @@ string DownloadManager::ProxyInfo::Print() {
  * Gets an idle CURL handle from the pool. Creates a new one and adds it to
  * the pool if necessary.
  */
-CURL *DownloadManager::AcquireCurlHandle() {
+CURL *DownloadManager::AcquireCurlHandle(Shard *shard) {
   CURL *handle;
 
-  if (pool_handles_idle_->empty()) {
+  if (shard->pool_handles_idle->empty()) {
     // Create a new handle
     handle = curl_easy_init();
     assert(handle != NULL);
@@ -813,27 +876,27 @@ CURL *DownloadManager::AcquireCurlHandle() {
     curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, CallbackCurlHeader);
     curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, CallbackCurlData);
   } else {
-    handle = *(pool_handles_idle_->begin());
-    pool_handles_idle_->erase(pool_handles_idle_->begin());
+    handle = *(shard->pool_handles_idle->begin());
+    shard->pool_handles_idle->erase(shard->pool_handles_idle->begin());
   }
 
-  pool_handles_inuse_->insert(handle);
+  shard->pool_handles_inuse->insert(handle);
 
   return handle;
 }
 
 
-void DownloadManager::ReleaseCurlHandle(CURL *handle) {
-  set<CURL *>::iterator elem = pool_handles_inuse_->find(handle);
-  assert(elem != pool_handles_inuse_->end());
+void DownloadManager::ReleaseCurlHandle(Shard *shard, CURL *handle) {
+  set<CURL *>::iterator elem = shard->pool_handles_inuse->find(handle);
+  assert(elem != shard->pool_handles_inuse->end());
 
-  if (pool_handles_idle_->size() > pool_max_handles_) {
+  if (shard->pool_handles_idle->size() > shard->pool_max_handles) {
     curl_easy_cleanup(*elem);
   } else {
-    pool_handles_idle_->insert(*elem);
+    shard->pool_handles_idle->insert(*elem);
   }
 
-  pool_handles_inuse_->erase(elem);
+  shard->pool_handles_inuse->erase(elem);
 }
 
 
@@ -841,7 +904,10 @@ void DownloadManager::ReleaseCurlHandle(CURL *handle) {
  * HTTP request options: set the URL and other options such as timeout and
  * proxy.
  */
-void DownloadManager::InitializeRequest(JobInfo *info, CURL *handle) {
+void DownloadManager::InitializeRequest(Shard *shard,
+                                        JobInfo *info,
+                                        CURL *handle)
+{
   // Initialize internal download state
   info->curl_handle = handle;
   info->error_code = kFailOk;
@@ -851,12 +917,12 @@ void DownloadManager::InitializeRequest(JobInfo *info, CURL *handle) {
   info->num_used_hosts = 1;
   info->num_retries = 0;
   info->backoff_ms = 0;
-  info->headers = header_lists_->DuplicateList(default_headers_);
+  info->headers = shard->header_lists->DuplicateList(shard->default_headers);
   if (info->info_header) {
-    header_lists_->AppendHeader(info->headers, info->info_header);
+    shard->header_lists->AppendHeader(info->headers, info->info_header);
   }
   if (info->force_nocache) {
-    SetNocache(info);
+    SetNocache(shard, info);
   } else {
     info->nocache = false;
   }
@@ -1170,16 +1236,19 @@ bool DownloadManager::CanRetry(const JobInfo *info) {
 void DownloadManager::Backoff(JobInfo *info) {
   unsigned backoff_init_ms = 0;
   unsigned backoff_max_ms = 0;
+  unsigned backoff_random_ms = 0;
   {
+    // Also protects prng_ against concurrent download threads
     MutexLockGuard m(lock_options_);
     backoff_init_ms = opt_backoff_init_ms_;
     backoff_max_ms = opt_backoff_max_ms_;
+    backoff_random_ms = prng_.Next(backoff_init_ms + 1);
   }
 
   info->num_retries++;
   perf::Inc(counters_->n_retries);
   if (info->backoff_ms == 0) {
-    info->backoff_ms = prng_.Next(backoff_init_ms + 1);  // Must be != 0
+    info->backoff_ms = backoff_random_ms;  // Must be != 0
   } else {
     info->backoff_ms *= 2;
   }
@@ -1189,11 +1258,11 @@ void DownloadManager::Backoff(JobInfo *info) {
   SafeSleepMs(info->backoff_ms);
 }
 
-void DownloadManager::SetNocache(JobInfo *info) {
+void DownloadManager::SetNocache(Shard *shard, JobInfo *info) {
   if (info->nocache)
     return;
-  header_lists_->AppendHeader(info->headers, "Pragma: no-cache");
-  header_lists_->AppendHeader(info->headers, "Cache-Control: no-cache");
+  shard->header_lists->AppendHeader(info->headers, "Pragma: no-cache");
+  shard->header_lists->AppendHeader(info->headers, "Cache-Control: no-cache");
   curl_easy_setopt(info->curl_handle, CURLOPT_HTTPHEADER, info->headers);
   info->nocache = true;
 }
@@ -1203,11 +1272,11 @@ void DownloadManager::SetNocache(JobInfo *info) {
  * Reverse operation of SetNocache. Makes sure that "no-cache" header
  * disappears from the list of headers to let proxies work normally.
  */
-void DownloadManager::SetRegularCache(JobInfo *info) {
+void DownloadManager::SetRegularCache(Shard *shard, JobInfo *info) {
   if (info->nocache == false)
     return;
-  header_lists_->CutHeader("Pragma: no-cache", &(info->headers));
-  header_lists_->CutHeader("Cache-Control: no-cache", &(info->headers));
+  shard->header_lists->CutHeader("Pragma: no-cache", &(info->headers));
+  shard->header_lists->CutHeader("Cache-Control: no-cache", &(info->headers));
   curl_easy_setopt(info->curl_handle, CURLOPT_HTTPHEADER, info->headers);
   info->nocache = false;
 }
@@ -1232,7 +1301,10 @@ void DownloadManager::ReleaseCredential(JobInfo *info) {
  *
  * \return true if another download should be performed, false otherwise
  */
-bool DownloadManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
+bool DownloadManager::VerifyAndFinalize(Shard *shard,
+                                        const int curl_error,
+                                        JobInfo *info)
+{
   LogCvmfs(kLogDownload, kLogDebug,
            "Verify downloaded url %s, proxy %s (curl error %d)",
            info->url->c_str(), info->proxy.c_str(), curl_error);
@@ -1445,14 +1517,14 @@ bool DownloadManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
       shash::Init(info->hash_context);
     if (info->compressed)
       zlib::DecompressInit(&info->zstream);
-    SetRegularCache(info);
+    SetRegularCache(shard, info);
 
     // Failure handling
     bool switch_proxy = false;
     bool switch_host = false;
     switch (info->error_code) {
       case kFailBadData:
-        SetNocache(info);
+        SetNocache(shard, info);
         break;
       case kFailProxyResolve:
       case kFailProxyHttp:
@@ -1514,7 +1586,7 @@ bool DownloadManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
     zlib::DecompressFini(&info->zstream);
 
   if (info->headers) {
-    header_lists_->PutList(info->headers);
+    shard->header_lists->PutList(info->headers);
     info->headers = NULL;
   }
 
@@ -1523,20 +1595,10 @@ bool DownloadManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
 
 
 DownloadManager::DownloadManager() {
-  pool_handles_idle_ = NULL;
-  pool_handles_inuse_ = NULL;
   pool_max_handles_ = 0;
-  curl_multi_ = NULL;
-  default_headers_ = NULL;
+  user_agent_ = NULL;
 
   atomic_init32(&multi_threaded_);
-  pipe_terminate_ = NULL;
-
-  pipe_jobs_ = NULL;
-  watch_fds_ = NULL;
-  watch_fds_size_ = 0;
-  watch_fds_inuse_ = 0;
-  watch_fds_max_ = 0;
 
   lock_options_ =
   reinterpret_cast<pthread_mutex_t *>(smalloc(sizeof(pthread_mutex_t)));
@@ -1588,46 +1650,73 @@ DownloadManager::~DownloadManager() {
   free(lock_synchronous_mode_);
 }
 
-void DownloadManager::InitHeaders() {
-  // User-Agent
-  string cernvm_id = "User-Agent: cvmfs ";
-#ifdef CVMFS_LIBCVMFS
-  cernvm_id += "libcvmfs ";
-#else
-  cernvm_id += "Fuse ";
-#endif
-  cernvm_id += string(VERSION);
-  if (getenv("CERNVM_UUID") != NULL) {
-    cernvm_id += " " +
-    sanitizer::InputSanitizer("az AZ 09 -").Filter(getenv("CERNVM_UUID"));
-  }
-  user_agent_ = strdup(cernvm_id.c_str());
+void DownloadManager::InitHeaders(Shard *shard) {
+  shard->header_lists = new HeaderLists();
+
+  shard->default_headers =
+    shard->header_lists->GetList("Connection: Keep-Alive");
+  shard->header_lists->AppendHeader(shard->default_headers, "Pragma:");
+  shard->header_lists->AppendHeader(shard->default_headers, user_agent_);
+}
 
-  header_lists_ = new HeaderLists();
 
-  default_headers_ = header_lists_->GetList("Connection: Keep-Alive");
-  header_lists_->AppendHeader(default_headers_, "Pragma:");
-  header_lists_->AppendHeader(default_headers_, user_agent_);
+void DownloadManager::FiniHeaders(Shard *shard) {
+  delete shard->header_lists;
+  shard->header_lists = NULL;
+  shard->default_headers = NULL;
 }
 
 
-void DownloadManager::FiniHeaders() {
-  delete header_lists_;
-  header_lists_ = NULL;
-  default_headers_ = NULL;
+/**
+ * The connection limits are split among the shards.
+ */
+DownloadManager::Shard *DownloadManager::CreateShard(
+  const unsigned max_pool_handles)
+{
+  Shard *shard = new Shard();
+  shard->download_mgr = this;
+  shard->pool_handles_idle = new set<CURL *>;
+  shard->pool_handles_inuse = new set<CURL *>;
+  shard->pool_max_handles = max_pool_handles;
+  InitHeaders(shard);
+
+  shard->curl_multi = curl_multi_init();
+  assert(shard->curl_multi != NULL);
+  curl_multi_setopt(shard->curl_multi, CURLMOPT_SOCKETFUNCTION,
+                    CallbackCurlSocket);
+  curl_multi_setopt(shard->curl_multi, CURLMOPT_SOCKETDATA,
+                    static_cast<void *>(shard));
+  curl_multi_setopt(shard->curl_multi, CURLMOPT_MAXCONNECTS,
+                    4 * shard->pool_max_handles);
+  curl_multi_setopt(shard->curl_multi, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+                    shard->pool_max_handles);
+  return shard;
+}
+
+
+void DownloadManager::DestroyShard(Shard *shard) {
+  for (set<CURL *>::iterator i = shard->pool_handles_idle->begin(),
+       iEnd = shard->pool_handles_idle->end(); i != iEnd; ++i)
+  {
+    curl_easy_cleanup(*i);
+  }
+  delete shard->pool_handles_idle;
+  delete shard->pool_handles_inuse;
+  curl_multi_cleanup(shard->curl_multi);
+  FiniHeaders(shard);
+  delete shard;
 }
 
 
 void DownloadManager::Init(const unsigned max_pool_handles,
-                           const perf::StatisticsTemplate &statistics)
+                           const perf::StatisticsTemplate &statistics,
+                           const unsigned num_shards)
 {
+  assert(num_shards > 0);
   atomic_init32(&multi_threaded_);
   int retval = curl_global_init(CURL_GLOBAL_ALL);
   assert(retval == CURLE_OK);
-  pool_handles_idle_ = new set<CURL *>;
-  pool_handles_inuse_ = new set<CURL *>;
   pool_max_handles_ = max_pool_handles;
-  watch_fds_max_ = 4*pool_max_handles_;
 
   opt_timeout_proxy_ = 5;
   opt_timeout_direct_ = 10;
@@ -1641,17 +1730,24 @@ void DownloadManager::Init(const unsigned max_pool_handles,
 
   counters_ = new Counters(statistics);
 
-  user_agent_ = NULL;
-  InitHeaders();
+  // User-Agent
+  string cernvm_id = "User-Agent: cvmfs ";
+#ifdef CVMFS_LIBCVMFS
+  cernvm_id += "libcvmfs ";
+#else
+  cernvm_id += "Fuse ";
+#endif
+  cernvm_id += string(VERSION);
+  if (getenv("CERNVM_UUID") != NULL) {
+    cernvm_id += " " +
+    sanitizer::InputSanitizer("az AZ 09 -").Filter(getenv("CERNVM_UUID"));
+  }
+  user_agent_ = strdup(cernvm_id.c_str());
 
-  curl_multi_ = curl_multi_init();
-  assert(curl_multi_ != NULL);
-  curl_multi_setopt(curl_multi_, CURLMOPT_SOCKETFUNCTION, CallbackCurlSocket);
-  curl_multi_setopt(curl_multi_, CURLMOPT_SOCKETDATA,
-                    static_cast<void *>(this));
-  curl_multi_setopt(curl_multi_, CURLMOPT_MAXCONNECTS, watch_fds_max_);
-  curl_multi_setopt(curl_multi_, CURLMOPT_MAX_TOTAL_CONNECTIONS,
-                    pool_max_handles_);
+  const unsigned shard_max_handles =
+    std::max(1U, pool_max_handles_ / num_shards);
+  for (unsigned i = 0; i < num_shards; ++i)
+    shards_.push_back(CreateShard(shard_max_handles));
 
   prng_.InitLocaltime();
 
@@ -1669,27 +1765,22 @@ void DownloadManager::Init(const unsigned max_pool_handles,
 
 void DownloadManager::Fini() {
   if (atomic_xadd32(&multi_threaded_, 0) == 1) {
-    // Shutdown I/O thread
-    pipe_terminate_->Write(kPipeTerminateSignal);
-    pthread_join(thread_download_, NULL);
-    // All handles are removed from the multi stack
-    pipe_terminate_.Destroy();
-    pipe_jobs_.Destroy();
+    // Shutdown I/O threads
+    for (unsigned i = 0; i < shards_.size(); ++i) {
+      atomic_inc32(&shards_[i]->terminate);
+      platform_wakeup_signal(shards_[i]->wakeup_fds[1]);
+    }
+    for (unsigned i = 0; i < shards_.size(); ++i) {
+      pthread_join(shards_[i]->thread_download, NULL);
+      // All handles are removed from the multi stack
+      platform_wakeup_destroy(shards_[i]->wakeup_fds);
+    }
   }
 
-  for (set<CURL *>::iterator i = pool_handles_idle_->begin(),
-       iEnd = pool_handles_idle_->end(); i != iEnd; ++i)
-  {
-    curl_easy_cleanup(*i);
-  }
-  delete pool_handles_idle_;
-  delete pool_handles_inuse_;
-  curl_multi_cleanup(curl_multi_);
-  pool_handles_idle_ = NULL;
-  pool_handles_inuse_ = NULL;
-  curl_multi_ = NULL;
+  for (unsigned i = 0; i < shards_.size(); ++i)
+    DestroyShard(shards_[i]);
+  shards_.clear();
 
-  FiniHeaders();
   if (user_agent_)
     free(user_agent_);
   user_agent_ = NULL;
@@ -1713,21 +1804,36 @@ void DownloadManager::Fini() {
 
 
 /**
- * Spawns the I/O worker thread and switches the module in multi-threaded mode.
+ * Spawns the I/O worker threads, one per shard, and switches the module in
+ * multi-threaded mode.
  * No way back except Fini(); Init();
  */
 void DownloadManager::Spawn() {
-  pipe_terminate_ = new Pipe<kPipeThreadTerminator>();
-  pipe_jobs_ = new Pipe<kPipeDownloadJobs>();
-
-  int retval = pthread_create(&thread_download_, NULL, MainDownload,
-                              static_cast<void *>(this));
-  assert(retval == 0);
+  for (unsigned i = 0; i < shards_.size(); ++i) {
+    bool retval = platform_wakeup_create(shards_[i]->wakeup_fds);
+    assert(retval);
+    int retval_thread = pthread_create(&shards_[i]->thread_download, NULL,
+                                       MainDownload,
+                                       static_cast<void *>(shards_[i]));
+    assert(retval_thread == 0);
+  }
 
   atomic_inc32(&multi_threaded_);
 }
 
 
+/**
+ * Objects are assigned to shards by their content hash, which is also the key
+ * of the proxy sharding.  Requests without a hash, e.g. for manifests, go
+ * to the first shard.
+ */
+DownloadManager::Shard *DownloadManager::SelectShard(const JobInfo *info) {
+  if ((shards_.size() == 1) || (info->expected_hash == NULL))
+    return shards_[0];
+  return shards_[info->expected_hash->Partial32() % shards_.size()];
+}
+
+
 /**
  * Downloads data from an insecure outside channel (currently HTTP or file).
  */
@@ -1762,20 +1868,16 @@ Failures DownloadManager::Fetch(JobInfo *info) {
   }
 
   if (atomic_xadd32(&multi_threaded_, 0) == 1) {
-    if (!info->pipe_job_results.IsValid()) {
-      info->pipe_job_results = new Pipe<kPipeDownloadJobsResults>();
-    }
-
-    // LogCvmfs(kLogDownload, kLogDebug, "send job to thread, pipe %d %d",
-    //          info->wait_at[0], info->wait_at[1]);
-    // NOLINTNEXTLINE(bugprone-sizeof-expression)
-    pipe_jobs_->Write<JobInfo*>(info);
-    info->pipe_job_results->Read<download::Failures>(&result);
+    atomic_init32(&info->job_state);
+    SelectShard(info)->PushJob(info);
+    WaitForJob(info);
+    result = info->error_code;
     // LogCvmfs(kLogDownload, kLogDebug, "got result %d", result);
   } else {
     MutexLockGuard l(lock_synchronous_mode_);
-    CURL *handle = AcquireCurlHandle();
-    InitializeRequest(info, handle);
+    Shard *shard = shards_[0];
+    CURL *handle = AcquireCurlHandle(shard);
+    InitializeRequest(shard, info, handle);
     SetUrlOptions(info);
     // curl_easy_setopt(handle, CURLOPT_VERBOSE, 1);
     int retval;
@@ -1788,9 +1890,9 @@ Failures DownloadManager::Fetch(JobInfo *info) {
         perf::Xadd(counters_->sz_transfer_time,
                    static_cast<int64_t>(elapsed * 1000));
       }
-    } while (VerifyAndFinalize(retval, info));
+    } while (VerifyAndFinalize(shard, retval, info));
     result = info->error_code;
-    ReleaseCurlHandle(info->curl_handle);
+    ReleaseCurlHandle(shard, info->curl_handle);
   }
 
   if (result != kFailOk) {
@@ -2786,7 +2888,8 @@ DownloadManager *DownloadManager::Clone(
   const perf::StatisticsTemplate &statistics)
 {
   DownloadManager *clone = new DownloadManager();
-  clone->Init(pool_max_handles_, statistics);
+  clone->Init(pool_max_handles_, statistics,
+              shards_.empty() ? 1 : shards_.size());
   if (resolver_) {
     clone->SetDnsParameters(resolver_->retries(), resolver_->timeout_ms());
     clone->SetDnsTtlLimits(resolver_->min_ttl(), resolver_->max_ttl());
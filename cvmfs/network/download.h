@@ -207,7 +207,8 @@ struct JobInfo {
     headers = NULL;
     memset(&zstream, 0, sizeof(zstream));
     info_header = NULL;
-    pipe_job_results = NULL;
+    atomic_init32(&job_state);
+    next_job = NULL;
     nocache = false;
     error_code = kFailOther;
     num_used_proxies = num_used_hosts = num_retries = 0;
@@ -271,12 +272,6 @@ struct JobInfo {
     head_request = true;
   }
 
-  ~JobInfo() {
-    if (pipe_job_results.IsValid()) {
-      pipe_job_results.Destroy();
-    }
-  }
-
   /**
    * Tells whether the error is because of a non-existing file. Should only
    * be called if error_code is not kFailOk
@@ -290,8 +285,10 @@ struct JobInfo {
   z_stream zstream;
   shash::ContextPtr hash_context;
 
-  /// Pipe used for the return value
-  UniquePtr<Pipe<kPipeDownloadJobsResults> > pipe_job_results;
+  /// Futex word, the download thread marks the job as done, see Fetch()
+  atomic_int32 job_state;
+  /// Link in the submission queue of a download thread
+  JobInfo *next_job;
 
   std::string proxy;
   bool nocache;
@@ -408,7 +405,8 @@ class DownloadManager {  // NOLINT(clang-analyzer-optin.performance.Padding)
   static int ParseHttpCode(const char digits[3]);
 
   void Init(const unsigned max_pool_handles,
-            const perf::StatisticsTemplate &statistics);
+            const perf::StatisticsTemplate &statistics,
+            const unsigned num_shards = 1);
   void Fini();
   void Spawn();
   DownloadManager *Clone(const perf::StatisticsTemplate &statistics);
@@ -467,7 +465,53 @@ class DownloadManager {  // NOLINT(clang-analyzer-optin.performance.Padding)
     return opt_ip_preference_;
   }
 
+  unsigned num_shards() const { return shards_.size(); }
+
  private:
+  /**
+   * A download I/O thread with its own curl multi handle, handle pool and
+   * header lists.  Jobs are pushed onto a lock-free stack and the thread is
+   * woken up through an eventfd.  Shard 0 also serves the synchronous mode.
+   */
+  struct Shard {
+    Shard()
+      : download_mgr(NULL)
+      , pool_handles_idle(NULL)
+      , pool_handles_inuse(NULL)
+      , pool_max_handles(0)
+      , curl_multi(NULL)
+      , header_lists(NULL)
+      , default_headers(NULL)
+      , jobs(NULL)
+      , watch_fds(NULL)
+      , watch_fds_size(0)
+      , watch_fds_inuse(0)
+    {
+      atomic_init32(&terminate);
+      wakeup_fds[0] = wakeup_fds[1] = -1;
+    }
+
+    void PushJob(JobInfo *info);
+    JobInfo *PopJobs();
+
+    DownloadManager *download_mgr;
+    std::set<CURL *> *pool_handles_idle;
+    std::set<CURL *> *pool_handles_inuse;
+    uint32_t pool_max_handles;
+    CURLM *curl_multi;
+    HeaderLists *header_lists;
+    curl_slist *default_headers;
+
+    pthread_t thread_download;
+    atomic_int32 terminate;
+    int wakeup_fds[2];
+    /// Pending jobs, in reverse order of submission
+    JobInfo *jobs;
+    struct pollfd *watch_fds;
+    uint32_t watch_fds_size;
+    uint32_t watch_fds_inuse;
+  };
+
   static int CallbackCurlSocket(CURL *easy, curl_socket_t s, int action,
                                 void *userp, void *socketp);
   static void *MainDownload(void *data);
@@ -481,20 +525,23 @@ class DownloadManager {  // NOLINT(clang-analyzer-optin.performance.Padding)
   ProxyInfo *ChooseProxyUnlocked(const shash::Any *hash);
   void UpdateProxiesUnlocked(const std::string &reason);
   void RebalanceProxiesUnlocked(const std::string &reason);
-  CURL *AcquireCurlHandle();
-  void ReleaseCurlHandle(CURL *handle);
+  Shard *CreateShard(const unsigned max_pool_handles);
+  void DestroyShard(Shard *shard);
+  Shard *SelectShard(const JobInfo *info);
+  CURL *AcquireCurlHandle(Shard *shard);
+  void ReleaseCurlHandle(Shard *shard, CURL *handle);
   void ReleaseCredential(JobInfo *info);
-  void InitializeRequest(JobInfo *info, CURL *handle);
+  void InitializeRequest(Shard *shard, JobInfo *info, CURL *handle);
   void SetUrlOptions(JobInfo *info);
   bool ValidateProxyIpsUnlocked(const std::string &url, const dns::Host &host);
   void UpdateStatistics(CURL *handle);
   bool CanRetry(const JobInfo *info);
   void Backoff(JobInfo *info);
-  void SetNocache(JobInfo *info);
-  void SetRegularCache(JobInfo *info);
-  bool VerifyAndFinalize(const int curl_error, JobInfo *info);
-  void InitHeaders();
-  void FiniHeaders();
+  void SetNocache(Shard *shard, JobInfo *info);
+  void SetRegularCache(Shard *shard, JobInfo *info);
+  bool VerifyAndFinalize(Shard *shard, const int curl_error, JobInfo *info);
+  void InitHeaders(Shard *shard);
+  void FiniHeaders(Shard *shard);
   void CloneProxyConfig(DownloadManager *clone);
 
   inline std::vector<ProxyInfo> *current_proxy_group() const {
@@ -503,23 +550,11 @@ class DownloadManager {  // NOLINT(clang-analyzer-optin.performance.Padding)
   }
 
   Prng prng_;
-  std::set<CURL *> *pool_handles_idle_;
-  std::set<CURL *> *pool_handles_inuse_;
   uint32_t pool_max_handles_;
-  CURLM *curl_multi_;
-  HeaderLists *header_lists_;
-  curl_slist *default_headers_;
   char *user_agent_;
 
-  pthread_t thread_download_;
   atomic_int32 multi_threaded_;
-  UniquePtr<Pipe<kPipeThreadTerminator> > pipe_terminate_;
-
-  UniquePtr<Pipe<kPipeDownloadJobs> > pipe_jobs_;
-  struct pollfd *watch_fds_;
-  uint32_t watch_fds_size_;
-  uint32_t watch_fds_inuse_;
-  uint32_t watch_fds_max_;
+  std::vector<Shard *> shards_;
 
   pthread_mutex_t *lock_options_;
   pthread_mutex_t *lock_synchronous_mode_;
@@ -4,6 +4,9 @@
  * Runs a thread using libcurls asynchronous I/O mode to push data to S3
  */
 
+#define __STDC_FORMAT_MACROS
+
+#include <inttypes.h>
 #include <pthread.h>
 
 #include <algorithm>
@@ -32,6 +35,13 @@ const unsigned S3FanoutManager::kMax429ThrottleMs = 10000;
 const unsigned S3FanoutManager::kThrottleReportIntervalSec = 10;
 const unsigned S3FanoutManager::kDefaultHTTPPort = 80;
 const unsigned S3FanoutManager::kDefaultHTTPSPort = 443;
+const unsigned S3FanoutManager::kMaxMultipartParts = 10000;
+
+
+JobInfo::~JobInfo() {
+  delete multipart;
+  free(errorbuffer);
+}
 
 
 /**
@@ -121,6 +131,13 @@ static size_t CallbackCurlHeader(void *ptr, size_t size, size_t nmemb,
     S3FanoutManager::DetectThrottleIndicator(header_line, info);
   }
 
+  if ((info->request == JobInfo::kReqPutPart) &&
+      HasPrefix(header_line, "etag:", true /* ignore_case */))
+  {
+    info->parent->multipart->etags[info->part_number - 1] =
+      Trim(header_line.substr(5), true /* trim_newline */);
+  }
+
   return num_bytes;
 }
 
@@ -138,7 +155,23 @@ static size_t CallbackCurlData(void *ptr, size_t size, size_t nmemb,
   if (num_bytes == 0)
     return 0;
 
-  uint64_t read_bytes = info->origin->Read(ptr, num_bytes);
+  uint64_t read_bytes;
+  if (info->request == JobInfo::kReqPutPart) {
+    // Parts are read concurrently from the origin of the parent job
+    read_bytes = info->parent->origin->ReadP(ptr,
+      std::min(static_cast<uint64_t>(num_bytes),
+               info->payload_size - info->body_pos),
+      info->part_offset + info->body_pos);
+    info->body_pos += read_bytes;
+  } else if (info->request == JobInfo::kReqMultipartComplete) {
+    const std::string &body = info->multipart->complete_body;
+    read_bytes = std::min(static_cast<uint64_t>(num_bytes),
+                          body.size() - info->body_pos);
+    memcpy(ptr, body.data() + info->body_pos, read_bytes);
+    info->body_pos += read_bytes;
+  } else {
+    read_bytes = info->origin->Read(ptr, num_bytes);
+  }
 
   LogCvmfs(kLogS3Fanout, kLogDebug,
            "source buffer pushed out %d bytes", read_bytes);
@@ -148,11 +181,18 @@ static size_t CallbackCurlData(void *ptr, size_t size, size_t nmemb,
 
 
 /**
- * For the time being, ignore all received information in the HTTP body
+ * Only the replies to the multipart initiate and complete requests are of
+ * interest, ignore the HTTP body otherwise
  */
 static size_t CallbackCurlBody(
-  char * /*ptr*/, size_t size, size_t nmemb, void * /*userdata*/)
+  char *ptr, size_t size, size_t nmemb, void *info_link)
 {
+  JobInfo *info = static_cast<JobInfo *>(info_link);
+  if ((info->request == JobInfo::kReqMultipartInit) ||
+      (info->request == JobInfo::kReqMultipartComplete))
+  {
+    info->response.append(ptr, size * nmemb);
+  }
   return size * nmemb;
 }
 
@@ -271,31 +311,11 @@ void *S3FanoutManager::MainUpload(void *data) {
       s3fanout_mgr->watch_fds_[1].revents = 0;
       JobInfo *info;
       ReadPipe(s3fanout_mgr->pipe_jobs_[0], &info, sizeof(info));
-      CURL *handle = s3fanout_mgr->AcquireCurlHandle();
-      if (handle == NULL) {
-        PANIC(kLogStderr, "Failed to acquire CURL handle.");
-      }
-      s3fanout::Failures init_failure =
-        s3fanout_mgr->InitializeRequest(info, handle);
-      if (init_failure != s3fanout::kFailOk) {
-        PANIC(kLogStderr,
-              "Failed to initialize CURL handle (error: %d - %s | errno: %d)",
-              init_failure, Code2Ascii(init_failure), errno);
-      }
-      s3fanout_mgr->SetUrlOptions(info);
-
-      curl_multi_add_handle(s3fanout_mgr->curl_multi_, handle);
+      if (s3fanout_mgr->UseMultipart(*info))
+        s3fanout_mgr->InitMultipart(info);
+      s3fanout_mgr->ScheduleRequest(info);
       s3fanout_mgr->active_requests_->insert(info);
       jobs_in_flight++;
-      int still_running = 0, retval = 0;
-      retval = curl_multi_socket_action(s3fanout_mgr->curl_multi_,
-                                        CURL_SOCKET_TIMEOUT,
-                                        0,
-                                        &still_running);
-
-      LogCvmfs(kLogS3Fanout, kLogDebug,
-               "curl_multi_socket_action: %d - %d",
-               retval, still_running);
     }
 
 
@@ -351,18 +371,30 @@ void *S3FanoutManager::MainUpload(void *data) {
                                  0,
                                  &still_running);
       } else {
-        // Return easy handle into pool and write result back
+        // Return easy handle into pool
+        s3fanout_mgr->ReleaseCurlHandle(info, easy_handle);
+        // Parts and intermediate steps of multipart uploads don't complete
+        // the job
+        if (s3fanout_mgr->ProgressMultipart(info))
+          continue;
+
+        // Write result back
         jobs_in_flight--;
         s3fanout_mgr->active_requests_->erase(info);
-        s3fanout_mgr->ReleaseCurlHandle(info, easy_handle);
         s3fanout_mgr->available_jobs_->Decrement();
 
         // Add to list of completed jobs
         s3fanout_mgr->PushCompletedJob(info);
       }
     }
+
+    s3fanout_mgr->DispatchParts();
   }
 
+  for (unsigned i = 0; i < s3fanout_mgr->parts_todo_.size(); ++i)
+    delete s3fanout_mgr->parts_todo_[i];
+  s3fanout_mgr->parts_todo_.clear();
+
   set<CURL *>::iterator i = s3fanout_mgr->pool_handles_inuse_->begin();
   const set<CURL *>::const_iterator i_end =
     s3fanout_mgr->pool_handles_inuse_->end();
@@ -453,6 +485,256 @@ void S3FanoutManager::InitPipeWatchFds() {
   ++watch_fds_inuse_;
 }
 
+/**
+ * Acquires a curl handle for the job and adds it to the multi handle.
+ */
+void S3FanoutManager::ScheduleRequest(JobInfo *info) {
+  CURL *handle = AcquireCurlHandle();
+  if (handle == NULL) {
+    PANIC(kLogStderr, "Failed to acquire CURL handle.");
+  }
+  s3fanout::Failures init_failure = InitializeRequest(info, handle);
+  if (init_failure != s3fanout::kFailOk) {
+    PANIC(kLogStderr,
+          "Failed to initialize CURL handle (error: %d - %s | errno: %d)",
+          init_failure, Code2Ascii(init_failure), errno);
+  }
+  SetUrlOptions(info);
+
+  curl_multi_add_handle(curl_multi_, handle);
+  int still_running = 0, retval = 0;
+  retval = curl_multi_socket_action(curl_multi_,
+                                    CURL_SOCKET_TIMEOUT,
+                                    0,
+                                    &still_running);
+
+  LogCvmfs(kLogS3Fanout, kLogDebug,
+           "curl_multi_socket_action: %d - %d",
+           retval, still_running);
+}
+
+
+/**
+ * Large objects are uploaded in parts, so that the parts are transferred in
+ * parallel and a failure only repeats the upload of a single part.  Azure
+ * blob storage has no S3 compatible multipart API.
+ */
+bool S3FanoutManager::UseMultipart(const JobInfo &info) const {
+  if ((config_.multipart_threshold == 0) ||
+      (config_.authz_method == kAuthzAzure))
+  {
+    return false;
+  }
+  if ((info.request != JobInfo::kReqPutCas) &&
+      (info.request != JobInfo::kReqPutDotCvmfs) &&
+      (info.request != JobInfo::kReqPutHtml))
+  {
+    return false;
+  }
+  return info.origin->GetSize() >= config_.multipart_threshold;
+}
+
+
+/**
+ * Turns a PUT request into the initiate request of a multipart upload.
+ */
+void S3FanoutManager::InitMultipart(JobInfo *info) const {
+  const uint64_t size = info->origin->GetSize();
+  MultipartUpload *multipart = new MultipartUpload();
+  multipart->request = info->request;
+  multipart->part_size = std::max(config_.multipart_part_size,
+    (size + kMaxMultipartParts - 1) / kMaxMultipartParts);
+  delete info->multipart;
+  info->multipart = multipart;
+  info->request = JobInfo::kReqMultipartInit;
+  LogCvmfs(kLogS3Fanout, kLogDebug, "multipart upload of %s (%" PRIu64
+           " bytes, parts of %" PRIu64 " bytes)", info->object_key.c_str(),
+           size, multipart->part_size);
+}
+
+
+/**
+ * Called for finished requests that belong to a multipart upload.  Schedules
+ * the next step of the upload.
+ *
+ * @return true if the job of the object is not yet finished, i.e. for all the
+ *         parts, for successful initiate requests, and for failed complete
+ *         requests that are followed by an abort request
+ */
+bool S3FanoutManager::ProgressMultipart(JobInfo *info) {
+  if (info->request == JobInfo::kReqPutPart) {
+    JobInfo *parent = info->parent;
+    MultipartUpload *multipart = parent->multipart;
+    Failures error_code = info->error_code;
+    if ((error_code == kFailOk) &&
+        multipart->etags[info->part_number - 1].empty())
+    {
+      LogCvmfs(kLogS3Fanout, kLogStderr, "S3: no ETag for part %u of %s",
+               info->part_number, info->object_key.c_str());
+      error_code = kFailOther;
+    }
+    if ((error_code != kFailOk) && (multipart->error_code == kFailOk)) {
+      multipart->error_code = error_code;
+      // Don't start the remaining parts
+      std::deque<JobInfo *>::iterator i = parts_todo_.begin();
+      while (i != parts_todo_.end()) {
+        if ((*i)->parent == parent) {
+          delete *i;
+          i = parts_todo_.erase(i);
+          multipart->num_parts_pending--;
+        } else {
+          ++i;
+        }
+      }
+    }
+    num_parts_inflight_--;
+    multipart->num_parts_pending--;
+    delete info;
+
+    if (multipart->num_parts_pending == 0)
+      FinishMultipart(parent);
+    return true;
+  }
+
+  MultipartUpload *multipart = info->multipart;
+  if (multipart == NULL)
+    return false;
+
+  switch (info->request) {
+    case JobInfo::kReqMultipartInit:
+      if (info->error_code == kFailOk) {
+        const size_t pos_begin = info->response.find("<UploadId>");
+        const size_t pos_end = info->response.find("</UploadId>");
+        if ((pos_begin != string::npos) && (pos_end != string::npos) &&
+            (pos_begin + 10 < pos_end))
+        {
+          multipart->upload_id =
+            info->response.substr(pos_begin + 10, pos_end - pos_begin - 10);
+          const uint64_t size = info->origin->GetSize();
+          const unsigned num_parts =
+            (size + multipart->part_size - 1) / multipart->part_size;
+          multipart->etags.resize(num_parts);
+          multipart->num_parts_pending = num_parts;
+          for (unsigned i = 0; i < num_parts; ++i) {
+            JobInfo *part = new JobInfo(info->object_key, NULL, NULL);
+            part->request = JobInfo::kReqPutPart;
+            part->parent = info;
+            part->part_number = i + 1;
+            part->part_offset = i * multipart->part_size;
+            part->payload_size =
+              std::min(multipart->part_size, size - part->part_offset);
+            parts_todo_.push_back(part);
+          }
+          statistics_->num_multipart_uploads++;
+          return true;
+        }
+        LogCvmfs(kLogS3Fanout, kLogStderr,
+                 "S3: invalid reply to multipart upload of %s",
+                 info->object_key.c_str());
+        info->error_code = kFailOther;
+      }
+      info->origin.Destroy();
+      break;
+    case JobInfo::kReqMultipartComplete:
+      if (info->error_code != kFailOk) {
+        // The storage keeps the uploaded parts until the upload is aborted
+        multipart->error_code = info->error_code;
+        FinishMultipart(info);
+        return true;
+      }
+      break;
+    case JobInfo::kReqMultipartAbort:
+      // Report the failure of the part or of the complete request rather
+      // than the result of the abort
+      info->error_code = multipart->error_code;
+      break;
+    default:
+      break;
+  }
+  // Report the job as the original PUT request
+  info->request = multipart->request;
+  return false;
+}
+
+
+/**
+ * Once all the parts are finished, the upload is either completed or
+ * aborted such that the storage drops the uploaded parts.  Also called to
+ * abort the upload if the complete request fails for good.
+ */
+void S3FanoutManager::FinishMultipart(JobInfo *info) {
+  MultipartUpload *multipart = info->multipart;
+  if (multipart->error_code == kFailOk) {
+    multipart->complete_body = "<CompleteMultipartUpload>";
+    for (unsigned i = 0; i < multipart->etags.size(); ++i) {
+      multipart->complete_body +=
+        "<Part><PartNumber>" + StringifyInt(i + 1) + "</PartNumber>"
+        "<ETag>" + multipart->etags[i] + "</ETag></Part>";
+    }
+    multipart->complete_body += "</CompleteMultipartUpload>";
+    info->request = JobInfo::kReqMultipartComplete;
+  } else {
+    LogCvmfs(kLogS3Fanout, kLogDebug, "aborting multipart upload of %s",
+             info->object_key.c_str());
+    info->request = JobInfo::kReqMultipartAbort;
+  }
+  ScheduleRequest(info);
+}
+
+
+/**
+ * Parts take up the connections of the pool one by one, such that they are
+ * signed only shortly before they are sent (CVM-1339).
+ */
+void S3FanoutManager::DispatchParts() {
+  const unsigned max_parts_inflight = std::max(config_.pool_max_handles, 1U);
+  while (!parts_todo_.empty() && (num_parts_inflight_ < max_parts_inflight)) {
+    JobInfo *part = parts_todo_.front();
+    parts_todo_.pop_front();
+    num_parts_inflight_++;
+    ScheduleRequest(part);
+  }
+}
+
+
+/**
+ * The sub-resource of the multipart requests.  In the canonical form of AWS
+ * signature v4, the upload id is URI encoded and every key has a value.
+ */
+string S3FanoutManager::GetQueryString(const JobInfo &info, bool canonical)
+  const
+{
+  const MultipartUpload *multipart =
+    (info.parent != NULL) ? info.parent->multipart : info.multipart;
+  switch (info.request) {
+    case JobInfo::kReqMultipartInit:
+      return canonical ? "uploads=" : "?uploads";
+    case JobInfo::kReqPutPart:
+      return string(canonical ? "" : "?") +
+             "partNumber=" + StringifyInt(info.part_number) +
+             "&uploadId=" + GetUriEncode(multipart->upload_id, true);
+    case JobInfo::kReqMultipartComplete:
+    case JobInfo::kReqMultipartAbort:
+      return string(canonical ? "" : "?") +
+             "uploadId=" + GetUriEncode(multipart->upload_id, true);
+    default:
+      return "";
+  }
+}
+
+
+/**
+ * The canned ACL is set when a multipart upload is initiated, it does not
+ * apply to the subsequent requests.
+ */
+bool S3FanoutManager::HasAclHeader(const JobInfo &info) const {
+  return (config_.x_amz_acl != "") &&
+         (info.request != JobInfo::kReqPutPart) &&
+         (info.request != JobInfo::kReqMultipartComplete) &&
+         (info.request != JobInfo::kReqMultipartAbort);
+}
+
+
 /**
  * The Amazon AWS 2 authorization header according to
  * http://docs.aws.amazon.com/AmazonS3/latest/dev/RESTAuthentication.html#ConstructingTheAuthenticationHeader
@@ -472,9 +754,11 @@ bool S3FanoutManager::MkV2Authz(const JobInfo &info, vector<string> *headers)
                    payload_hash + "\n" +
                    content_type + "\n" +
                    timestamp + "\n";
+  if (HasAclHeader(info))
+     to_sign +=    "x-amz-acl:" + config_.x_amz_acl + "\n";  // default ACL
   if (config_.x_amz_acl != "") {
-     to_sign +=    "x-amz-acl:" + config_.x_amz_acl + "\n" +  // default ACL
-                   "/" + config_.bucket + "/" + info.object_key;
+     to_sign +=    "/" + config_.bucket + "/" + info.object_key +
+                   GetQueryString(info, false);
   }
   LogCvmfs(kLogS3Fanout, kLogDebug, "%s string to sign for: %s",
            request.c_str(), info.object_key.c_str());
@@ -489,7 +773,8 @@ bool S3FanoutManager::MkV2Authz(const JobInfo &info, vector<string> *headers)
                      Base64(string(reinterpret_cast<char *>(hmac.digest),
                                    hmac.GetDigestSize())));
   headers->push_back("Date: " + timestamp);
-  headers->push_back("X-Amz-Acl: " + config_.x_amz_acl);
+  if (HasAclHeader(info))
+    headers->push_back("X-Amz-Acl: " + config_.x_amz_acl);
   if (!payload_hash.empty())
     headers->push_back("Content-MD5: " + payload_hash);
   if (!content_type.empty())
@@ -575,14 +860,15 @@ bool S3FanoutManager::MkV4Authz(const JobInfo &info, vector<string> *headers)
     headers->push_back("Content-Type: " + content_type);
     canonical_headers += "content-type:" + content_type + "\n";
   }
-  if (config_.x_amz_acl != "") {
+  const bool has_acl = HasAclHeader(info);
+  if (has_acl) {
     signed_headers += "host;x-amz-acl;x-amz-content-sha256;x-amz-date";
   } else {
     signed_headers += "host;x-amz-content-sha256;x-amz-date";
   }
   canonical_headers +=
     "host:" + canonical_hostname + "\n";
-  if (config_.x_amz_acl != "") {
+  if (has_acl) {
     canonical_headers += "x-amz-acl:" + config_.x_amz_acl +"\n";
   }
   canonical_headers += "x-amz-content-sha256:" + payload_hash + "\n" +
@@ -596,7 +882,7 @@ bool S3FanoutManager::MkV4Authz(const JobInfo &info, vector<string> *headers)
   string canonical_request =
     GetRequestString(info) + "\n" +
     GetUriEncode(uri, false) + "\n" +
-    "\n" +
+    GetQueryString(info, true) + "\n" +
     canonical_headers + "\n" +
     signed_headers + "\n" +
     payload_hash;
@@ -612,7 +898,8 @@ bool S3FanoutManager::MkV4Authz(const JobInfo &info, vector<string> *headers)
   string signing_key = GetAwsV4SigningKey(date);
   string signature = shash::Hmac256(signing_key, string_to_sign);
 
-  headers->push_back("X-Amz-Acl: " + config_.x_amz_acl);
+  if (has_acl)
+    headers->push_back("X-Amz-Acl: " + config_.x_amz_acl);
   headers->push_back("X-Amz-Content-Sha256: " + payload_hash);
   headers->push_back("X-Amz-Date: " + timestamp);
   headers->push_back(
@@ -769,7 +1056,9 @@ bool S3FanoutManager::MkPayloadHash(const JobInfo &info, string *hex_hash)
 {
   if ((info.request == JobInfo::kReqHeadOnly) ||
       (info.request == JobInfo::kReqHeadPut) ||
-      (info.request == JobInfo::kReqDelete))
+      (info.request == JobInfo::kReqDelete) ||
+      (info.request == JobInfo::kReqMultipartInit) ||
+      (info.request == JobInfo::kReqMultipartAbort))
   {
     switch (config_.authz_method) {
       case kAuthzAwsV2:
@@ -794,10 +1083,20 @@ bool S3FanoutManager::MkPayloadHash(const JobInfo &info, string *hex_hash)
   shash::Any payload_hash(shash::kMd5);
 
   unsigned char *data;
-  unsigned int nbytes =
-    info.origin->Data(reinterpret_cast<void **>(&data),
-                             info.origin->GetSize(), 0);
-  assert(nbytes == info.origin->GetSize());
+  unsigned int nbytes;
+  if (info.request == JobInfo::kReqPutPart) {
+    nbytes = info.parent->origin->Data(reinterpret_cast<void **>(&data),
+                                       info.payload_size, info.part_offset);
+    assert(nbytes == info.payload_size);
+  } else if (info.request == JobInfo::kReqMultipartComplete) {
+    const string &body = info.multipart->complete_body;
+    data = reinterpret_cast<unsigned char *>(const_cast<char *>(body.data()));
+    nbytes = body.size();
+  } else {
+    nbytes = info.origin->Data(reinterpret_cast<void **>(&data),
+                               info.origin->GetSize(), 0);
+    assert(nbytes == info.origin->GetSize());
+  }
 
   switch (config_.authz_method) {
     case kAuthzAwsV2:
@@ -828,9 +1127,14 @@ string S3FanoutManager::GetRequestString(const JobInfo &info) const {
     case JobInfo::kReqPutDotCvmfs:
     case JobInfo::kReqPutHtml:
     case JobInfo::kReqPutBucket:
+    case JobInfo::kReqPutPart:
       return "PUT";
     case JobInfo::kReqDelete:
+    case JobInfo::kReqMultipartAbort:
       return "DELETE";
+    case JobInfo::kReqMultipartInit:
+    case JobInfo::kReqMultipartComplete:
+      return "POST";
     default:
       PANIC(NULL);
   }
@@ -838,11 +1142,19 @@ string S3FanoutManager::GetRequestString(const JobInfo &info) const {
 
 
 string S3FanoutManager::GetContentType(const JobInfo &info) const {
-  switch (info.request) {
+  // The content type of the object is set by the initiate request
+  const JobInfo::RequestType request =
+    (info.request == JobInfo::kReqMultipartInit) ?
+      info.multipart->request : info.request;
+  switch (request) {
     case JobInfo::kReqHeadOnly:
     case JobInfo::kReqHeadPut:
     case JobInfo::kReqDelete:
+    case JobInfo::kReqPutPart:
+    case JobInfo::kReqMultipartAbort:
       return "";
+    case JobInfo::kReqMultipartComplete:
+      return "application/xml";
     case JobInfo::kReqPutCas:
       return "application/octet-stream";
     case JobInfo::kReqPutDotCvmfs:
@@ -871,23 +1183,29 @@ Failures S3FanoutManager::InitializeRequest(JobInfo *info, CURL *handle) const {
   info->throttle_ms = 0;
   info->throttle_timestamp = 0;
   info->http_headers = NULL;
+  info->body_pos = 0;
+  info->response.clear();
   // info->payload_size is needed in S3Uploader::MainCollectResults,
-  // where info->origin is already destroyed.
-  info->payload_size = info->origin->GetSize();
+  // where info->origin is already destroyed.  Parts have no origin of their
+  // own, their payload size is set on creation.
+  if (info->origin.IsValid())
+    info->payload_size = info->origin->GetSize();
 
   InitializeDnsSettings(handle, complete_hostname_);
 
   CURLcode retval;
   if ((info->request == JobInfo::kReqHeadOnly) ||
       (info->request == JobInfo::kReqHeadPut) ||
-      (info->request == JobInfo::kReqDelete))
+      (info->request == JobInfo::kReqDelete) ||
+      (info->request == JobInfo::kReqMultipartAbort))
   {
     retval = curl_easy_setopt(handle, CURLOPT_UPLOAD, 0);
     assert(retval == CURLE_OK);
     retval = curl_easy_setopt(handle, CURLOPT_NOBODY, 1);
     assert(retval == CURLE_OK);
 
-    if (info->request == JobInfo::kReqDelete)
+    if ((info->request == JobInfo::kReqDelete) ||
+        (info->request == JobInfo::kReqMultipartAbort))
     {
       retval = curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST,
                                 GetRequestString(*info).c_str());
@@ -897,20 +1215,41 @@ Failures S3FanoutManager::InitializeRequest(JobInfo *info, CURL *handle) const {
       assert(retval == CURLE_OK);
     }
   } else {
-    retval = curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, NULL);
+    // The multipart initiate and complete requests are uploads with POST
+    const bool is_post = (info->request == JobInfo::kReqMultipartInit) ||
+                         (info->request == JobInfo::kReqMultipartComplete);
+    retval = curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST,
+                              is_post ? "POST" : NULL);
     assert(retval == CURLE_OK);
     retval = curl_easy_setopt(handle, CURLOPT_UPLOAD, 1);
     assert(retval == CURLE_OK);
     retval = curl_easy_setopt(handle, CURLOPT_NOBODY, 0);
     assert(retval == CURLE_OK);
+    uint64_t body_size;
+    switch (info->request) {
+      case JobInfo::kReqMultipartInit:
+        body_size = 0;
+        break;
+      case JobInfo::kReqPutPart:
+        body_size = info->payload_size;
+        break;
+      case JobInfo::kReqMultipartComplete:
+        body_size = info->multipart->complete_body.size();
+        break;
+      default:
+        body_size = info->origin->GetSize();
+    }
     retval = curl_easy_setopt(handle, CURLOPT_INFILESIZE_LARGE,
-                              static_cast<curl_off_t>(info->origin->GetSize()));
+                              static_cast<curl_off_t>(body_size));
     assert(retval == CURLE_OK);
 
-    if (info->request == JobInfo::kReqPutDotCvmfs) {
+    const JobInfo::RequestType object_request =
+      (info->request == JobInfo::kReqMultipartInit) ?
+        info->multipart->request : info->request;
+    if (object_request == JobInfo::kReqPutDotCvmfs) {
       info->http_headers =
           curl_slist_append(info->http_headers, kCacheControlDotCvmfs);
-    } else if (info->request == JobInfo::kReqPutCas) {
+    } else if (object_request == JobInfo::kReqPutCas) {
       info->http_headers =
           curl_slist_append(info->http_headers, kCacheControlCas);
     }
@@ -960,6 +1299,9 @@ Failures S3FanoutManager::InitializeRequest(JobInfo *info, CURL *handle) const {
   retval = curl_easy_setopt(handle, CURLOPT_READDATA,
                             static_cast<void *>(info));
   assert(retval == CURLE_OK);
+  retval = curl_easy_setopt(handle, CURLOPT_WRITEDATA,
+                            static_cast<void *>(info));
+  assert(retval == CURLE_OK);
   retval = curl_easy_setopt(handle, CURLOPT_HTTPHEADER, info->http_headers);
   assert(retval == CURLE_OK);
   if (opt_ipv4_only_) {
@@ -1008,7 +1350,7 @@ void S3FanoutManager::SetUrlOptions(JobInfo *info) const {
     assert(retval == CURLE_OK);
   }
 
-  string url = MkUrl(info->object_key);
+  string url = MkUrl(info->object_key) + GetQueryString(*info, false);
   retval = curl_easy_setopt(curl_handle, CURLOPT_URL, url.c_str());
   assert(retval == CURLE_OK);
 
@@ -1132,6 +1474,16 @@ bool S3FanoutManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
       break;
   }
 
+  // Errors during the assembly of the parts come with HTTP 200
+  if ((info->request == JobInfo::kReqMultipartComplete) &&
+      (info->error_code == kFailOk) &&
+      (info->response.find("<Error>") != string::npos))
+  {
+    LogCvmfs(kLogS3Fanout, kLogDebug, "multipart upload of %s failed: %s",
+             info->object_key.c_str(), info->response.c_str());
+    info->error_code = kFailServiceUnavailable;
+  }
+
   // Transform HEAD to PUT request
   if ((info->error_code == kFailNotFound) &&
       (info->request == JobInfo::kReqHeadPut))
@@ -1139,6 +1491,8 @@ bool S3FanoutManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
     LogCvmfs(kLogS3Fanout, kLogDebug, "not found: %s, uploading",
              info->object_key.c_str());
     info->request = JobInfo::kReqPutCas;
+    if (UseMultipart(*info))
+      InitMultipart(info);
     curl_slist_free_all(info->http_headers);
     info->http_headers = NULL;
     s3fanout::Failures init_failure = InitializeRequest(info,
@@ -1170,6 +1524,8 @@ bool S3FanoutManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
       // Reset origin
       info->origin->Rewind();
     }
+    info->body_pos = 0;
+    info->response.clear();
     Backoff(info);
     info->error_code = kFailOk;
     info->http_error = 0;
@@ -1179,8 +1535,10 @@ bool S3FanoutManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
     return true;  // try again
   }
 
-  // Cleanup opened resources
-  info->origin.Destroy();
+  // Cleanup opened resources; the parts of a multipart upload read from the
+  // origin after the initiate request
+  if (info->request != JobInfo::kReqMultipartInit)
+    info->origin.Destroy();
 
   if ((info->error_code != kFailOk) &&
       (info->http_error != 0) && (info->http_error != 404))
@@ -1207,6 +1565,7 @@ S3FanoutManager::S3FanoutManager(const S3Config &config) : config_(config) {
   assert(retval == 0);
 
   active_requests_ = new set<JobInfo *>;
+  num_parts_inflight_ = 0;
   pool_handles_idle_ = new set<CURL *>;
   pool_handles_inuse_ = new set<CURL *>;
   curl_sharehandles_ = new map<CURL *, S3FanOutDnsEntry *>;
@@ -1359,7 +1718,9 @@ string Statistics::Print() const {
       "Number of requests: " +
       StringifyInt(num_requests) + "\n" +
       "Number of retries:  " +
-      StringifyInt(num_retries) + "\n";
+      StringifyInt(num_retries) + "\n" +
+      "Multipart uploads:  " +
+      StringifyInt(num_multipart_uploads) + "\n";
 }
 
 }  // namespace s3fanout
@@ -10,6 +10,7 @@
 
 #include <climits>
 #include <cstdlib>
+#include <deque>
 #include <map>
 #include <set>
 #include <string>
@@ -78,6 +79,7 @@ struct Statistics {
   uint64_t num_requests;
   uint64_t num_retries;
   uint64_t ms_throttled;  // Total waiting time imposed by HTTP 429 replies
+  uint64_t num_multipart_uploads;
 
   Statistics() {
     transferred_bytes = 0.0;
@@ -85,12 +87,15 @@ struct Statistics {
     num_requests = 0;
     num_retries = 0;
     ms_throttled = 0;
+    num_multipart_uploads = 0;
   }
 
   std::string Print() const;
 };  // Statistics
 
 
+struct MultipartUpload;
+
 /**
  * Contains all the information to specify an upload job.
  */
@@ -103,6 +108,11 @@ struct JobInfo : SingleCopy {
     kReqPutHtml,  // HTML file - display instead of downloading
     kReqPutBucket,  // bucket creation
     kReqDelete,
+    // Steps of the multipart upload of a large object
+    kReqMultipartInit,  // initiate, yields the upload id
+    kReqPutPart,  // one of the parts, a separate job
+    kReqMultipartComplete,  // assemble the uploaded parts
+    kReqMultipartAbort,  // discard the uploaded parts after a failure
   };
 
   const std::string object_key;
@@ -131,12 +141,15 @@ struct JobInfo : SingleCopy {
     backoff_ms = 0;
     throttle_ms = 0;
     throttle_timestamp = 0;
+    multipart = NULL;
+    parent = NULL;
+    part_number = 0;
+    part_offset = 0;
+    body_pos = 0;
     errorbuffer =
         reinterpret_cast<char *>(smalloc(sizeof(char) * CURL_ERROR_SIZE));
   }
-  ~JobInfo() {
-    free(errorbuffer);
-  }
+  ~JobInfo();
 
   // Internal state, don't touch
   CURL *curl_handle;
@@ -152,9 +165,45 @@ struct JobInfo : SingleCopy {
   unsigned throttle_ms;
   // Remember when the 429 reply came in to only throttle if still necessary
   uint64_t throttle_timestamp;
+  // Set for the job of an object that is uploaded in parts
+  MultipartUpload *multipart;
+  // Set for the jobs of the parts, which read from the parent's origin
+  JobInfo *parent;
+  unsigned part_number;
+  uint64_t part_offset;
+  // Read position in the body of part uploads and of the complete request
+  uint64_t body_pos;
+  // Reply body of the multipart initiate and complete requests
+  std::string response;
   char *errorbuffer;
 };  // JobInfo
 
+
+/**
+ * State of a multipart upload, owned by the job of the object.  The parts are
+ * uploaded by separate jobs that are scheduled by the I/O thread.
+ */
+struct MultipartUpload {
+  MultipartUpload()
+    : request(JobInfo::kReqPutCas)
+    , part_size(0)
+    , num_parts_pending(0)
+    , error_code(kFailOk)
+  { }
+
+  // The original request of the object, e.g. kReqPutCas
+  JobInfo::RequestType request;
+  std::string upload_id;
+  uint64_t part_size;
+  // Reported by the storage for every uploaded part
+  std::vector<std::string> etags;
+  // Parts that are scheduled or in flight
+  unsigned num_parts_pending;
+  // The first failure of a part; the upload is then aborted
+  Failures error_code;
+  std::string complete_body;
+};  // MultipartUpload
+
 struct S3FanOutDnsEntry {
   S3FanOutDnsEntry() : counter(0), dns_name(), ip(), port("80"),
      clist(NULL), sharehandle(NULL) {}
@@ -180,6 +229,8 @@ class S3FanoutManager : SingleCopy {
   static const unsigned kThrottleReportIntervalSec;
   static const unsigned kDefaultHTTPPort;
   static const unsigned kDefaultHTTPSPort;
+  // S3 limit for the number of parts of a multipart upload
+  static const unsigned kMaxMultipartParts;
 
   struct S3Config {
     S3Config() {
@@ -192,6 +243,8 @@ class S3FanoutManager : SingleCopy {
       opt_backoff_init_ms = 100;
       opt_backoff_max_ms = 2000;
       x_amz_acl = "public-read";
+      multipart_threshold = 0;
+      multipart_part_size = 0;
     }
     std::string access_key;
     std::string secret_key;
@@ -209,6 +262,12 @@ class S3FanoutManager : SingleCopy {
     unsigned opt_backoff_max_ms;
     std::string proxy;
     std::string x_amz_acl;
+    /**
+     * Objects of at least this size are uploaded in parts of
+     * multipart_part_size.  Zero disables multipart uploads.
+     */
+    uint64_t multipart_threshold;
+    uint64_t multipart_part_size;
   };
 
   static void DetectThrottleIndicator(const std::string &header, JobInfo *info);
@@ -247,12 +306,20 @@ class S3FanoutManager : SingleCopy {
                                  curl_slist *clist) const;
   Failures InitializeRequest(JobInfo *info, CURL *handle) const;
   void SetUrlOptions(JobInfo *info) const;
+  void ScheduleRequest(JobInfo *info);
+  bool UseMultipart(const JobInfo &info) const;
+  void InitMultipart(JobInfo *info) const;
+  bool ProgressMultipart(JobInfo *info);
+  void FinishMultipart(JobInfo *info);
+  void DispatchParts();
   void UpdateStatistics(CURL *handle);
   bool CanRetry(const JobInfo *info);
   void Backoff(JobInfo *info);
   bool VerifyAndFinalize(const int curl_error, JobInfo *info);
   std::string GetRequestString(const JobInfo &info) const;
   std::string GetContentType(const JobInfo &info) const;
+  std::string GetQueryString(const JobInfo &info, bool canonical) const;
+  bool HasAclHeader(const JobInfo &info) const;
   std::string GetUriEncode(const std::string &val, bool encode_slash) const;
   std::string GetAwsV4SigningKey(const std::string &date) const;
   bool MkPayloadHash(const JobInfo &info, std::string *hex_hash) const;
@@ -287,6 +354,13 @@ class S3FanoutManager : SingleCopy {
    */
   std::set<JobInfo *> *active_requests_;
 
+  /**
+   * Parts of multipart uploads that wait for a connection.  Only accessed by
+   * the I/O thread.
+   */
+  std::deque<JobInfo *> parts_todo_;
+  unsigned num_parts_inflight_;
+
   std::set<CURL *> *pool_handles_idle_;
   std::set<CURL *> *pool_handles_inuse_;
   std::set<S3FanOutDnsEntry *> *sharehandles_;
@@ -72,6 +72,7 @@ bool CatalogMergeTool<RwCatalogMgr, RoCatalogMgr>::Run(
         params.root_kcatalog_limit, params.file_mbyte_limit, statistics_,
         params.use_autocatalogs, params.max_weight, params.min_weight);
     output_catalog_mgr_->Init();
+    output_catalog_mgr_->SetDirectoryDigests(params.directory_digests);
   }
 
   bool ret = CatalogDiffTool<RoCatalogMgr>::Run(PathString(""));
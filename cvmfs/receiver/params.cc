@@ -156,6 +156,13 @@ bool GetParamsFromFile(const std::string& repo_name, Params* params) {
     params->enforce_limits = parser.IsOn(enforce_limits_str);
   }
 
+  std::string directory_digests_str;
+  if (parser.GetValue("CVMFS_DIRECTORY_DIGESTS", &directory_digests_str)) {
+    params->directory_digests = parser.IsOn(directory_digests_str);
+  } else {
+    params->directory_digests = false;
+  }
+
   // TODO(dwd): the next 3 limit variables should take defaults from
   // SyncParameters
   params->nested_kcatalog_limit = 0;
@@ -184,6 +191,14 @@ bool GetParamsFromFile(const std::string& repo_name, Params* params) {
     params->upload_stats_db = false;
   }
 
+  params->num_upload_tasks = 1;
+  std::string num_upload_tasks_str;
+  if (parser.GetValue("CVMFS_NUM_UPLOAD_TASKS", &num_upload_tasks_str)) {
+    params->num_upload_tasks = String2Uint64(num_upload_tasks_str);
+    if (params->num_upload_tasks == 0)
+      params->num_upload_tasks = 1;
+  }
+
   return true;
 }
 
@@ -27,6 +27,7 @@ struct Params {
   size_t avg_chunk_size;
   size_t max_chunk_size;
   bool enforce_limits;
+  bool directory_digests;
   size_t nested_kcatalog_limit;
   size_t root_kcatalog_limit;
   size_t file_mbyte_limit;
@@ -35,6 +36,7 @@ struct Params {
   size_t max_weight;
   size_t min_weight;
   bool upload_stats_db;
+  unsigned num_upload_tasks;
 };
 
 bool GetParamsFromFile(const std::string& repo_name, Params* params);
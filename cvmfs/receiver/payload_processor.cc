@@ -6,9 +6,12 @@
 
 #include <fcntl.h>
 #include <unistd.h>
+
+#include <cstring>
 #include <vector>
 
 #include "params.h"
+#include "util/exception.h"
 #include "util/logging.h"
 #include "util/posix.h"
 #include "util/string.h"
@@ -61,13 +64,30 @@ FileInfo& FileInfo::operator=(const FileInfo& other) {
   return *this;
 }
 
+ObjectBuffer::ObjectBuffer(const ObjectPackBuild::Event& event,
+                           const std::string& path)
+  : id(event.id),
+    is_named(event.object_type == ObjectPack::kNamed),
+    remote_path(path),
+    data(static_cast<unsigned char *>(smalloc(event.size > 0 ? event.size
+                                                             : 1))),
+    total_size(event.size),
+    current_size(0)
+{}
+
 PayloadProcessor::PayloadProcessor()
     : pending_files_(),
       current_repo_(),
       uploader_(),
       temp_dir_(),
       num_errors_(0),
-      statistics_(NULL) {}
+      statistics_(NULL),
+      num_upload_tasks_(1),
+      max_pipelined_size_(0),
+      assembling_objects_(),
+      completed_objects_(),
+      uploads_in_flight_(),
+      upload_workers_() {}
 
 PayloadProcessor::~PayloadProcessor() {}
 
@@ -94,6 +114,9 @@ PayloadProcessor::Result PayloadProcessor::Process(
   ObjectPackConsumer deserializer(digest, header_size);
   deserializer.RegisterListener(&PayloadProcessor::ConsumerEventCallback, this);
 
+  if (num_upload_tasks_ > 1)
+    StartUploadWorkers();
+
   int nb = 0;
   ObjectPackBuild::State consumer_state = ObjectPackBuild::kStateContinue;
   std::vector<unsigned char> buffer(kConsumerBuffer, 0);
@@ -110,6 +133,9 @@ PayloadProcessor::Result PayloadProcessor::Process(
     }
   } while (nb > 0 && consumer_state != ObjectPackBuild::kStateDone);
 
+  if (num_upload_tasks_ > 1)
+    StopUploadWorkers();
+
   assert(pending_files_.empty());
 
   Result res = Finalize();
@@ -131,7 +157,12 @@ void PayloadProcessor::ConsumerEventCallback(
     // kEmpty - this is an error.
     LogCvmfs(kLogReceiver, kLogSyslogErr,
              "PayloadProcessor - error: Event received with unknown object.");
-    num_errors_++;
+    atomic_inc32(&num_errors_);
+    return;
+  }
+
+  if ((num_upload_tasks_ > 1) && (event.size <= max_pipelined_size_)) {
+    ReassembleObject(event, path);
     return;
   }
 
@@ -172,7 +203,7 @@ void PayloadProcessor::ConsumerEventCallback(
           "size: %ld, file size: %ld, event hash: %s, file hash: %s",
           event.size, info.current_size,
           event.id.ToString(true).c_str(), file_hash.ToString(true).c_str());
-      num_errors_++;
+      atomic_inc32(&num_errors_);
       return;
     }
     // override final remote path if not CAS object
@@ -185,6 +216,137 @@ void PayloadProcessor::ConsumerEventCallback(
   }
 }
 
+/**
+ * Pipelined mode: copies the event data into the object buffer.  Complete
+ * objects are queued for the upload workers; this blocks while the queue is
+ * full, which in turn stops reading from the socket.
+ */
+void PayloadProcessor::ReassembleObject(const ObjectPackBuild::Event& event,
+                                        const std::string& path)
+{
+  std::map<shash::Any, ObjectBuffer *>::iterator it =
+    assembling_objects_.find(event.id);
+  ObjectBuffer *object;
+  if (it == assembling_objects_.end()) {
+    object = new ObjectBuffer(event, path);
+    assembling_objects_[event.id] = object;
+  } else {
+    object = it->second;
+  }
+
+  assert(object->current_size + event.buf_size <= object->total_size);
+  memcpy(object->data + object->current_size, event.buf, event.buf_size);
+  object->current_size += event.buf_size;
+
+  if (object->current_size == object->total_size) {
+    assembling_objects_.erase(event.id);
+    completed_objects_->Enqueue(object);
+  }
+}
+
+/**
+ * Pipelined mode: verifies the content hash of a complete object and hands
+ * it to the uploader.  Takes ownership of the object.
+ */
+void PayloadProcessor::UploadObject(ObjectBuffer *object) {
+  shash::Any file_hash(object->id.algorithm);
+  shash::HashMem(object->data, object->total_size, &file_hash);
+  if (file_hash != object->id) {
+    LogCvmfs(
+        kLogReceiver, kLogSyslogErr,
+        "PayloadProcessor - error: Hash mismatch for unpacked file: "
+        "file size: %ld, event hash: %s, file hash: %s",
+        object->total_size, object->id.ToString(true).c_str(),
+        file_hash.ToString(true).c_str());
+    atomic_inc32(&num_errors_);
+    free(object->data);
+    delete object;
+    return;
+  }
+
+  // Blocks if too many objects are being uploaded
+  uploads_in_flight_->Increment();
+  // handle is later deleted by FinalizeStreamedUpload
+  upload::UploadStreamHandle *handle = uploader_->InitStreamedUpload(
+    upload::AbstractUploader::MakeCallback(
+      &PayloadProcessor::OnObjectCommitted, this));
+  if (handle == NULL) {
+    LogCvmfs(kLogReceiver, kLogSyslogErr,
+             "PayloadProcessor - error: failed to start upload of %s",
+             object->id.ToString(true).c_str());
+    uploads_in_flight_->Decrement();
+    atomic_inc32(&num_errors_);
+    free(object->data);
+    delete object;
+    return;
+  }
+  if (object->is_named)
+    handle->remote_path = object->remote_path;
+
+  upload::AbstractUploader::UploadBuffer buf(object->total_size, object->data);
+  uploader_->ScheduleUpload(handle, buf,
+    upload::AbstractUploader::MakeClosure(
+      &PayloadProcessor::OnUploadJobComplete, this,
+      static_cast<void *>(object->data)));
+  uploader_->ScheduleCommit(handle, object->id);
+  delete object;
+}
+
+void PayloadProcessor::OnObjectCommitted(
+  const upload::UploaderResults & /* results */)
+{
+  uploads_in_flight_->Decrement();
+}
+
+void *PayloadProcessor::MainUploadWorker(void *data) {
+  PayloadProcessor *processor = static_cast<PayloadProcessor *>(data);
+  while (true) {
+    ObjectBuffer *object = processor->completed_objects_->Dequeue();
+    if (object == NULL)
+      break;
+    processor->UploadObject(object);
+  }
+  return NULL;
+}
+
+void PayloadProcessor::StartUploadWorkers() {
+  completed_objects_ =
+    new FifoChannel<ObjectBuffer *>(2 * num_upload_tasks_, num_upload_tasks_);
+  uploads_in_flight_ = new SynchronizingCounter<int32_t>(2 * num_upload_tasks_);
+  upload_workers_.resize(num_upload_tasks_);
+  for (unsigned i = 0; i < num_upload_tasks_; ++i) {
+    int retval = pthread_create(&upload_workers_[i], NULL, MainUploadWorker,
+                                this);
+    if (retval != 0)
+      PANIC(kLogSyslogErr, "failed to start upload worker (%d)", retval);
+  }
+}
+
+/**
+ * Drains the queue of complete objects and waits for their commits.  Objects
+ * that are still incomplete, e.g. due to a broken payload, are dropped.
+ */
+void PayloadProcessor::StopUploadWorkers() {
+  for (unsigned i = 0; i < upload_workers_.size(); ++i)
+    completed_objects_->Enqueue(NULL);
+  for (unsigned i = 0; i < upload_workers_.size(); ++i)
+    pthread_join(upload_workers_[i], NULL);
+  upload_workers_.clear();
+  uploads_in_flight_->WaitForZero();
+
+  for (std::map<shash::Any, ObjectBuffer *>::iterator
+       i = assembling_objects_.begin(), iEnd = assembling_objects_.end();
+       i != iEnd; ++i)
+  {
+    free(i->second->data);
+    delete i->second;
+    atomic_inc32(&num_errors_);
+  }
+  assembling_objects_.clear();
+  completed_objects_.Destroy();
+  uploads_in_flight_.Destroy();
+}
+
 void PayloadProcessor::OnUploadJobComplete(
   const upload::UploaderResults &results,
   void *buffer)
@@ -205,6 +367,12 @@ PayloadProcessor::Result PayloadProcessor::Initialize() {
     return kOtherError;
   }
 
+  return InitializeUploader(params);
+}
+
+PayloadProcessor::Result PayloadProcessor::InitializeUploader(
+  const Params& params)
+{
   const std::string spooler_temp_dir =
       GetSpoolerTempDir(params.spooler_configuration);
   assert(!spooler_temp_dir.empty());
@@ -217,6 +385,9 @@ PayloadProcessor::Result PayloadProcessor::Initialize() {
       params.generate_legacy_bulk_chunks, params.use_file_chunking,
       params.min_chunk_size, params.avg_chunk_size, params.max_chunk_size,
       "dummy_token", "dummy_key");
+  definition.num_upload_tasks = params.num_upload_tasks;
+  num_upload_tasks_ = params.num_upload_tasks;
+  max_pipelined_size_ = params.max_chunk_size;
 
   uploader_.Destroy();
 
@@ -5,13 +5,18 @@
 #ifndef CVMFS_RECEIVER_PAYLOAD_PROCESSOR_H_
 #define CVMFS_RECEIVER_PAYLOAD_PROCESSOR_H_
 
+#include <pthread.h>
 #include <stdint.h>
+
 #include <map>
 #include <string>
 #include <vector>
 
 #include "pack.h"
+#include "params.h"
 #include "upload.h"
+#include "util/atomic.h"
+#include "util/concurrency.h"
 #include "util/raii_temp_dir.h"
 
 namespace receiver {
@@ -29,6 +34,21 @@ struct FileInfo {
   std::vector<unsigned char> hash_buffer;
 };
 
+/**
+ * An object that is reassembled in memory and then handed over as a whole to
+ * the upload workers of the pipelined mode.
+ */
+struct ObjectBuffer {
+  ObjectBuffer(const ObjectPackBuild::Event& event, const std::string& path);
+
+  shash::Any id;
+  bool is_named;
+  std::string remote_path;
+  unsigned char *data;
+  size_t total_size;
+  size_t current_size;
+};
+
 /**
  * This class is used in the `cvmfs_receiver` tool, on repository gateway
  * machines. The receiver::Reactor class, implementing the event loop of the
@@ -37,6 +57,14 @@ struct FileInfo {
  *
  * Its responsibility is reading the payload - containing a serialized
  * ObjectPack - from a file descriptor, and unpacking it into the repository.
+ *
+ * If CVMFS_NUM_UPLOAD_TASKS is larger than 1, the payload is processed in a
+ * pipeline: the reading thread only reassembles objects, a bounded queue hands
+ * complete objects to a pool of workers that verify the content hash and
+ * schedule the upload, and the uploader itself uses as many upload streams.
+ * When the queue is full or too many objects are being uploaded, the reading
+ * thread blocks and stops draining the socket.  Objects larger than the
+ * maximum chunk size are streamed through the uploader as they arrive.
  */
 class PayloadProcessor {
  public:
@@ -53,7 +81,7 @@ class PayloadProcessor {
   virtual void OnUploadJobComplete(const upload::UploaderResults &results,
                                    void *buffer);
 
-  int GetNumErrors() const { return num_errors_; }
+  int GetNumErrors() const { return atomic_read32(&num_errors_); }
 
   void SetStatistics(perf::Statistics *st);
 
@@ -63,14 +91,38 @@ class PayloadProcessor {
   virtual Result Initialize();
   virtual Result Finalize();
 
+  /**
+   * Sets up the uploader and the pipeline parameters.  Used by Initialize()
+   * once the parameters are read from the repository configuration.
+   */
+  Result InitializeUploader(const Params& params);
+
  private:
+  static void *MainUploadWorker(void *data);
+  void StartUploadWorkers();
+  void StopUploadWorkers();
+  void ReassembleObject(const ObjectPackBuild::Event& event,
+                        const std::string& path);
+  void UploadObject(ObjectBuffer *object);
+  void OnObjectCommitted(const upload::UploaderResults &results);
+
   typedef std::map<shash::Any, FileInfo>::iterator FileIterator;
   std::map<shash::Any, FileInfo> pending_files_;
   std::string current_repo_;
   UniquePtr<upload::AbstractUploader> uploader_;
   UniquePtr<RaiiTempDir> temp_dir_;
-  int num_errors_;
+  mutable atomic_int32 num_errors_;
   UniquePtr<perf::StatisticsTemplate> statistics_;
+
+  /**
+   * Pipelined mode, only used if num_upload_tasks_ > 1
+   */
+  unsigned num_upload_tasks_;
+  size_t max_pipelined_size_;
+  std::map<shash::Any, ObjectBuffer *> assembling_objects_;
+  UniquePtr<FifoChannel<ObjectBuffer *> > completed_objects_;
+  UniquePtr<SynchronizingCounter<int32_t> > uploads_in_flight_;
+  std::vector<pthread_t> upload_workers_;
 };
 
 }  // namespace receiver
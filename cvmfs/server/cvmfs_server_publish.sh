@@ -250,6 +250,9 @@ cvmfs_server_publish() {
     if [ "x${CVMFS_ENFORCE_LIMITS:-$CVMFS_DEFAULT_ENFORCE_LIMITS}" = "xtrue" ]; then
       sync_command="$sync_command -E"
     fi
+    if [ "x$CVMFS_DIRECTORY_DIGESTS" = "xtrue" ]; then
+      sync_command="$sync_command -G"
+    fi
     if [ "x$CVMFS_NESTED_KCATALOG_LIMIT" != "x" ]; then
       sync_command="$sync_command -Q $CVMFS_NESTED_KCATALOG_LIMIT"
     fi
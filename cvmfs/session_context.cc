@@ -2,9 +2,14 @@
  * This file is part of the CernVM File System.
  */
 
+#define __STDC_FORMAT_MACROS
+
 #include "session_context.h"
 
+#include <inttypes.h>
+
 #include <algorithm>
+#include <cassert>
 #include <limits>
 
 #include "curl/curl.h"
@@ -12,8 +17,10 @@
 #include "gateway_util.h"
 #include "json_document.h"
 #include "json_document_write.h"
+#include "statistics.h"
 #include "swissknife_lease_curl.h"
 #include "util/exception.h"
+#include "util/platform.h"
 #include "util/pointer.h"
 #include "util/string.h"
 
@@ -79,23 +86,39 @@ SessionContextBase::SessionContextBase()
       session_token_(),
       key_id_(),
       secret_(),
+      num_upload_tasks_(1),
       max_pack_size_(ObjectPack::kDefaultLimit),
+      throughput_(0.0),
+      upload_start_ns_(0),
+      num_packs_uploaded_(0),
+      bytes_uploaded_(0),
+      upload_latency_ns_(0),
+      n_packs_(NULL),
+      sz_packs_bytes_(NULL),
+      ms_packs_latency_(NULL),
       active_handles_(),
       current_pack_(NULL),
       current_pack_mtx_(),
       objects_dispatched_(0),
       bytes_committed_(0),
       bytes_dispatched_(0),
-      initialized_(false) {}
+      initialized_(false) {
+  atomic_init64(&pack_size_);
+  int retval = pthread_mutex_init(&upload_stats_mtx_, NULL);
+  assert(retval == 0);
+}
 
-SessionContextBase::~SessionContextBase() {}
+SessionContextBase::~SessionContextBase() {
+  pthread_mutex_destroy(&upload_stats_mtx_);
+}
 
 bool SessionContextBase::Initialize(const std::string& api_url,
                                     const std::string& session_token,
                                     const std::string& key_id,
                                     const std::string& secret,
                                     uint64_t max_pack_size,
-                                    uint64_t max_queue_size) {
+                                    uint64_t max_queue_size,
+                                    unsigned num_upload_tasks) {
   bool ret = true;
 
   // Initialize session context lock
@@ -114,7 +137,17 @@ bool SessionContextBase::Initialize(const std::string& api_url,
   session_token_ = session_token;
   key_id_ = key_id;
   secret_ = secret;
+  num_upload_tasks_ = std::max(num_upload_tasks, 1U);
   max_pack_size_ = max_pack_size;
+  atomic_write64(&pack_size_, max_pack_size);
+  {
+    MutexLockGuard lock(upload_stats_mtx_);
+    throughput_ = 0.0;
+    upload_start_ns_ = 0;
+    num_packs_uploaded_ = 0;
+    bytes_uploaded_ = 0;
+    upload_latency_ns_ = 0;
+  }
 
   atomic_init64(&objects_dispatched_);
   bytes_committed_ = 0u;
@@ -164,6 +197,7 @@ bool SessionContextBase::Finalize(bool commit, const std::string& old_root_hash,
     delete future;
     jobs_finished++;
   }
+  LogUploadStatistics();
 
   if (commit) {
     if (old_root_hash.empty() || new_root_hash.empty()) {
@@ -192,7 +226,7 @@ bool SessionContextBase::Finalize(bool commit, const std::string& old_root_hash,
 ObjectPack::BucketHandle SessionContextBase::NewBucket() {
   MutexLockGuard lock(current_pack_mtx_);
   if (!current_pack_) {
-    current_pack_ = new ObjectPack(max_pack_size_);
+    current_pack_ = new ObjectPack(GetPackSize());
   }
   ObjectPack::BucketHandle hd = current_pack_->NewBucket();
   active_handles_.push_back(hd);
@@ -227,11 +261,9 @@ bool SessionContextBase::CommitBucket(const ObjectPack::BucketContentType type,
       current_pack_ = NULL;
     }
   } else {  // Current pack is full and can be dispatched
-    uint64_t new_size = 0;
-    if (handle->capacity > max_pack_size_) {
+    uint64_t new_size = GetPackSize();
+    if (handle->capacity > new_size) {
       new_size = handle->capacity + 1;
-    } else {
-      new_size = max_pack_size_;
     }
     ObjectPack* new_pack = new ObjectPack(new_size);
     for (size_t i = 0u; i < active_handles_.size(); ++i) {
@@ -253,6 +285,69 @@ int64_t SessionContextBase::NumJobsSubmitted() const {
   return atomic_read64(&objects_dispatched_);
 }
 
+void SessionContextBase::InitCounters(perf::StatisticsTemplate *statistics) {
+  n_packs_ = statistics->RegisterOrLookupTemplated(
+    "gateway_n_packs", "Number of object packs uploaded to the gateway");
+  sz_packs_bytes_ = statistics->RegisterOrLookupTemplated(
+    "gateway_sz_packs_bytes", "Number of bytes uploaded in object packs");
+  ms_packs_latency_ = statistics->RegisterOrLookupTemplated(
+    "gateway_ms_packs_latency",
+    "Accumulated upload time of object packs in milliseconds");
+}
+
+/**
+ * The size of new object packs follows the per-stream throughput such that a
+ * pack takes about kTargetPackUploadSec to upload.  The configured maximum
+ * pack size is never exceeded.
+ */
+void SessionContextBase::ReportUpload(uint64_t nbytes, uint64_t elapsed_ns) {
+  if (n_packs_ != NULL) {
+    perf::Inc(n_packs_);
+    perf::Xadd(sz_packs_bytes_, nbytes);
+    perf::Xadd(ms_packs_latency_, elapsed_ns / (1000 * 1000));
+  }
+
+  MutexLockGuard lock(upload_stats_mtx_);
+  num_packs_uploaded_++;
+  bytes_uploaded_ += nbytes;
+  upload_latency_ns_ += elapsed_ns;
+
+  if ((nbytes < kMinPackSize) || (elapsed_ns == 0))
+    return;
+  const double throughput = static_cast<double>(nbytes) * 1e9 / elapsed_ns;
+  throughput_ = (throughput_ == 0.0) ? throughput
+                                     : (0.75 * throughput_ + 0.25 * throughput);
+  uint64_t min_pack_size = kMinPackSize;
+  min_pack_size = std::min(min_pack_size, max_pack_size_);
+  const uint64_t pack_size = std::max(min_pack_size, std::min(max_pack_size_,
+    static_cast<uint64_t>(throughput_ * kTargetPackUploadSec)));
+  if (pack_size != GetPackSize()) {
+    LogCvmfs(kLogUploadGateway, kLogDebug,
+             "SessionContext: object pack size %" PRIu64 " bytes "
+             "(%.1f MB/s per stream)", pack_size, throughput_ / (1024 * 1024));
+    atomic_write64(&pack_size_, pack_size);
+  }
+}
+
+void SessionContextBase::LogUploadStatistics() {
+  MutexLockGuard lock(upload_stats_mtx_);
+  if (num_packs_uploaded_ == 0)
+    return;
+  const double elapsed_s =
+    static_cast<double>(platform_monotonic_time_ns() - upload_start_ns_) / 1e9;
+  LogCvmfs(kLogUploadGateway, kLogStdout,
+           "Uploaded %" PRIu64 " object packs (%.1f MB) to the gateway with %u "
+           "streams in %.1fs: %.1f MB/s, %.2fs average upload time per pack",
+           num_packs_uploaded_,
+           static_cast<double>(bytes_uploaded_) / (1024 * 1024),
+           num_upload_tasks_, elapsed_s,
+           (elapsed_s > 0.0) ?
+             static_cast<double>(bytes_uploaded_) / (1024 * 1024) / elapsed_s :
+             0.0,
+           static_cast<double>(upload_latency_ns_) / 1e9 /
+             static_cast<double>(num_packs_uploaded_));
+}
+
 void SessionContextBase::Dispatch() {
   MutexLockGuard lock(current_pack_mtx_);
 
@@ -260,7 +355,10 @@ void SessionContextBase::Dispatch() {
     return;
   }
 
-  atomic_inc64(&objects_dispatched_);
+  if (atomic_xadd64(&objects_dispatched_, 1) == 0) {
+    MutexLockGuard stats_lock(upload_stats_mtx_);
+    upload_start_ns_ = platform_monotonic_time_ns();
+  }
   bytes_dispatched_ += current_pack_->size();
   upload_results_.Enqueue(DispatchObjectPack(current_pack_));
 }
@@ -268,19 +366,35 @@ void SessionContextBase::Dispatch() {
 SessionContext::SessionContext()
     : SessionContextBase(),
       upload_jobs_(),
-      worker_()
+      workers_(),
+      curl_handles_()
 {
+  int retval = pthread_mutex_init(&curl_handles_mtx_, NULL);
+  assert(retval == 0);
+}
+
+SessionContext::~SessionContext() {
+  for (unsigned i = 0; i < curl_handles_.size(); ++i)
+    curl_easy_cleanup(curl_handles_[i]);
+  pthread_mutex_destroy(&curl_handles_mtx_);
 }
 
 bool SessionContext::InitializeDerived(uint64_t max_queue_size) {
-  // Start worker thread
+  // Start worker threads
   upload_jobs_ = new FifoChannel<UploadJob*>(max_queue_size, max_queue_size);
   upload_jobs_->Drop();
 
-  int retval =
-      pthread_create(&worker_, NULL, UploadLoop, reinterpret_cast<void*>(this));
+  workers_.clear();
+  for (unsigned i = 0; i < num_upload_tasks_; ++i) {
+    pthread_t worker;
+    int retval = pthread_create(&worker, NULL, UploadLoop,
+                                reinterpret_cast<void*>(this));
+    if (retval != 0)
+      return false;
+    workers_.push_back(worker);
+  }
 
-  return !retval;
+  return true;
 }
 
 bool SessionContext::FinalizeDerived() {
@@ -292,8 +406,11 @@ bool SessionContext::FinalizeDerived() {
   // TODO(jblomer): Refactor SessionContext (and Uploader*) classes to
   // use a factory method for construction.
   //
-  upload_jobs_->Enqueue(&terminator_);
-  pthread_join(worker_, NULL);
+  for (unsigned i = 0; i < workers_.size(); ++i)
+    upload_jobs_->Enqueue(&terminator_);
+  for (unsigned i = 0; i < workers_.size(); ++i)
+    pthread_join(workers_[i], NULL);
+  workers_.clear();
 
   return true;
 }
@@ -320,8 +437,10 @@ Future<bool>* SessionContext::DispatchObjectPack(ObjectPack* pack) {
   UploadJob* job = new UploadJob;
   job->pack = pack;
   job->result = new Future<bool>();
+  // The job is owned by the upload workers once it is enqueued
+  Future<bool>* result = job->result;
   upload_jobs_->Enqueue(job);
-  return job->result;
+  return result;
 }
 
 bool SessionContext::DoUpload(const SessionContext::UploadJob* job) {
@@ -349,7 +468,7 @@ bool SessionContext::DoUpload(const SessionContext::UploadJob* job) {
       json_msg.size() + serializer.GetHeaderSize() + job->pack->size();
 
   // Prepare the Curl POST request
-  CURL* h_curl = curl_easy_init();
+  CURL* h_curl = AcquireCurlHandle();
 
   if (!h_curl) {
     return false;
@@ -397,12 +516,38 @@ bool SessionContext::DoUpload(const SessionContext::UploadJob* job) {
              reply.c_str());
   }
 
-  curl_easy_cleanup(h_curl);
+  curl_slist_free_all(auth_header);
+  ReleaseCurlHandle(h_curl);
   h_curl = NULL;
 
   return ok && !ret;
 }
 
+/**
+ * Returns an idle handle or a new one.  There are at most as many handles as
+ * upload workers.
+ */
+CURL* SessionContext::AcquireCurlHandle() {
+  {
+    MutexLockGuard lock(curl_handles_mtx_);
+    if (!curl_handles_.empty()) {
+      CURL* h_curl = curl_handles_.back();
+      curl_handles_.pop_back();
+      return h_curl;
+    }
+  }
+  return curl_easy_init();
+}
+
+/**
+ * Keeps the handle, and with it the connection to the gateway, for the next
+ * object pack.
+ */
+void SessionContext::ReleaseCurlHandle(CURL* h_curl) {
+  MutexLockGuard lock(curl_handles_mtx_);
+  curl_handles_.push_back(h_curl);
+}
+
 void* SessionContext::UploadLoop(void* data) {
   SessionContext* ctx = reinterpret_cast<SessionContext*>(data);
   UploadJob *job;
@@ -411,10 +556,13 @@ void* SessionContext::UploadLoop(void* data) {
     job = ctx->upload_jobs_->Dequeue();
     if (job == &terminator_)
       return NULL;
+    const uint64_t nbytes = job->pack->size();
+    const uint64_t start_ns = platform_monotonic_time_ns();
     if (!ctx->DoUpload(job)) {
       PANIC(kLogStderr,
             "SessionContext: could not submit payload. Aborting.");
     }
+    ctx->ReportUpload(nbytes, platform_monotonic_time_ns() - start_ns);
     job->result->Set(true);
     delete job->pack;
     delete job;
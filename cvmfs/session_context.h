@@ -5,14 +5,23 @@
 #ifndef CVMFS_SESSION_CONTEXT_H_
 #define CVMFS_SESSION_CONTEXT_H_
 
+#include <pthread.h>
+
 #include <string>
 #include <vector>
 
+#include "curl/curl.h"
 #include "pack.h"
 #include "repository_tag.h"
+#include "util/atomic.h"
 #include "util/concurrency.h"
 #include "util/pointer.h"
 
+namespace perf {
+class Counter;
+class StatisticsTemplate;
+}
+
 namespace upload {
 
 struct CurlSendPayload {
@@ -35,6 +44,11 @@ size_t RecvCB(void* buffer, size_t size, size_t nmemb, void* userp);
  * destruction of the SessionContext. A session should begin when the spooler
  * and uploaders are initialized and should last until the call to
  * Spooler::WaitForUpload().
+ *
+ * Object packs can be uploaded concurrently.  The size of new object packs
+ * adapts to the observed upload throughput: on slow links, packs get smaller
+ * so that the uploads are spread over all streams and the last pack does not
+ * hold up the publication for long.
  */
 class SessionContextBase {
  public:
@@ -42,12 +56,23 @@ class SessionContextBase {
 
   virtual ~SessionContextBase();
 
+  /**
+   * Object packs are adapted such that uploading them takes about so long
+   */
+  static const unsigned kTargetPackUploadSec = 10;
+  /**
+   * Lower bound for adapted object packs.  Smaller packs are not used as
+   * throughput samples because their upload time is dominated by latency.
+   */
+  static const uint64_t kMinPackSize = 4 * 1024 * 1024;
+
 // By default, the maximum number of queued jobs is limited to 10,
 // representing 10 * 200 MB = 2GB max memory used by the queue
 bool Initialize(const std::string& api_url, const std::string& session_token,
                   const std::string& key_id, const std::string& secret,
                   uint64_t max_pack_size = ObjectPack::kDefaultLimit,
-                  uint64_t max_queue_size = 10);
+                  uint64_t max_queue_size = 10,
+                  unsigned num_upload_tasks = 1);
   bool Finalize(bool commit, const std::string& old_root_hash,
                 const std::string& new_root_hash,
                 const RepositoryTag& tag);
@@ -56,6 +81,11 @@ bool Initialize(const std::string& api_url, const std::string& session_token,
 
   ObjectPack::BucketHandle NewBucket();
 
+  /**
+   * Registers the upload statistics in the publish statistics
+   */
+  void InitCounters(perf::StatisticsTemplate *statistics);
+
   bool CommitBucket(const ObjectPack::BucketContentType type,
                     const shash::Any& id, const ObjectPack::BucketHandle handle,
                     const std::string& name = "",
@@ -74,17 +104,48 @@ bool Initialize(const std::string& api_url, const std::string& session_token,
 
   int64_t NumJobsSubmitted() const;
 
+  /**
+   * Called by the upload workers after every object pack.  Thread-safe.
+   */
+  void ReportUpload(uint64_t nbytes, uint64_t elapsed_ns);
+  uint64_t GetPackSize() const { return atomic_read64(&pack_size_); }
+
   FifoChannel<Future<bool>*> upload_results_;
 
   std::string api_url_;
   std::string session_token_;
   std::string key_id_;
   std::string secret_;
+  /**
+   * Number of concurrent object pack uploads
+   */
+  unsigned num_upload_tasks_;
 
  private:
   void Dispatch();
+  void LogUploadStatistics();
 
   uint64_t max_pack_size_;
+  /**
+   * Size of new object packs, adapted to the throughput between kMinPackSize
+   * and max_pack_size_
+   */
+  mutable atomic_int64 pack_size_;
+  /**
+   * Protects the throughput estimate and the upload statistics
+   */
+  pthread_mutex_t upload_stats_mtx_;
+  /**
+   * Exponentially weighted average of the per-stream throughput in bytes/s
+   */
+  double throughput_;
+  uint64_t upload_start_ns_;
+  uint64_t num_packs_uploaded_;
+  uint64_t bytes_uploaded_;
+  uint64_t upload_latency_ns_;
+  perf::Counter *n_packs_;
+  perf::Counter *sz_packs_bytes_;
+  perf::Counter *ms_packs_latency_;
 
   std::vector<ObjectPack::BucketHandle> active_handles_;
 
@@ -101,6 +162,7 @@ bool Initialize(const std::string& api_url, const std::string& session_token,
 class SessionContext : public SessionContextBase {
  public:
   SessionContext();
+  virtual ~SessionContext();
 
  protected:
   struct UploadJob {
@@ -123,9 +185,19 @@ class SessionContext : public SessionContextBase {
  private:
   static void* UploadLoop(void* data);
 
+  CURL* AcquireCurlHandle();
+  void ReleaseCurlHandle(CURL* h_curl);
+
   UniquePtr<FifoChannel<UploadJob*> > upload_jobs_;
 
-  pthread_t worker_;
+  std::vector<pthread_t> workers_;
+
+  /**
+   * Idle curl handles.  Handles are reused across object packs so that the
+   * connections to the gateway stay open.
+   */
+  std::vector<CURL*> curl_handles_;
+  pthread_mutex_t curl_handles_mtx_;
 
   static UploadJob terminator_;
 };
@@ -15,6 +15,7 @@
 #include "shrinkwrap/fs_traversal.h"
 #include "shrinkwrap/fs_traversal_interface.h"
 #include "shrinkwrap/fs_traversal_libcvmfs.h"
+#include "shrinkwrap/image/interface.h"
 #include "shrinkwrap/posix/interface.h"
 #include "shrinkwrap/spec_tree.h"
 #include "statistics.h"
@@ -111,6 +112,8 @@ struct fs_traversal* FindInterface(const char * type)
     return posix_get_interface();
   } else if (!strcmp(type, "cvmfs")) {
     return libcvmfs_get_interface();
+  } else if (!strcmp(type, "image")) {
+    return image_get_interface();
   }
   LogCvmfs(kLogCvmfs, kLogStderr,
     "Unknown File System Interface : %s", type);
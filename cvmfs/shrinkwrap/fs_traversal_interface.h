@@ -61,8 +61,9 @@ struct fs_traversal {
    * The context is freed during execution of this method
    * 
    * @param[in] ctx The context to finalize and free
+   * @returns 0 on success, -1 if pending data could not be written out
    */
-  void (*finalize)(struct fs_traversal_context *ctx);
+  int (*finalize)(struct fs_traversal_context *ctx);
 
   /**
    * Method that takes the specifications provided and stores
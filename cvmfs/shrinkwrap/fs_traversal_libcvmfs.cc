@@ -244,7 +244,7 @@ struct fs_traversal_context *libcvmfs_initialize(
 }
 
 
-void libcvmfs_finalize(struct fs_traversal_context *ctx) {
+int libcvmfs_finalize(struct fs_traversal_context *ctx) {
   cvmfs_context *context = reinterpret_cast<cvmfs_context *>(ctx->ctx);
   cvmfs_detach_repo(context);
   cvmfs_fini();
@@ -254,6 +254,7 @@ void libcvmfs_finalize(struct fs_traversal_context *ctx) {
   free(ctx->config);
   free(ctx->lib_version);
   delete ctx;
+  return 0;
 }
 
 
@@ -0,0 +1,128 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#include "format.h"
+
+#include <cassert>
+#include <cstring>
+
+namespace shrinkwrap {
+namespace image {
+
+namespace {
+
+void PutUint32(uint32_t value, std::string *buf) {
+  for (unsigned i = 0; i < 4; ++i)
+    buf->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+void PutUint64(uint64_t value, std::string *buf) {
+  for (unsigned i = 0; i < 8; ++i)
+    buf->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+uint32_t GetUint32(const unsigned char **buf) {
+  uint32_t result = 0;
+  for (unsigned i = 0; i < 4; ++i)
+    result |= static_cast<uint32_t>((*buf)[i]) << (8 * i);
+  *buf += 4;
+  return result;
+}
+
+uint64_t GetUint64(const unsigned char **buf) {
+  uint64_t result = 0;
+  for (unsigned i = 0; i < 8; ++i)
+    result |= static_cast<uint64_t>((*buf)[i]) << (8 * i);
+  *buf += 8;
+  return result;
+}
+
+}  // anonymous namespace
+
+
+void EncodeSuperblock(const ImageSuperblock &superblock, std::string *buf) {
+  const size_t start = buf->size();
+  buf->append(superblock.magic, sizeof(superblock.magic));
+  PutUint32(superblock.version, buf);
+  PutUint32(superblock.compression, buf);
+  PutUint32(superblock.block_size, buf);
+  PutUint32(superblock.reserved, buf);
+  PutUint64(superblock.num_inodes, buf);
+  PutUint64(superblock.inode_table_offset, buf);
+  PutUint64(superblock.num_extents, buf);
+  PutUint64(superblock.extent_table_offset, buf);
+  PutUint64(superblock.string_table_offset, buf);
+  PutUint64(superblock.string_table_size, buf);
+  PutUint64(superblock.provenance_offset, buf);
+  PutUint64(superblock.provenance_size, buf);
+  PutUint64(superblock.data_size, buf);
+  assert(buf->size() - start == kImageSuperblockSize);
+}
+
+
+void DecodeSuperblock(const unsigned char *buf, ImageSuperblock *superblock) {
+  memcpy(superblock->magic, buf, sizeof(superblock->magic));
+  buf += sizeof(superblock->magic);
+  superblock->version = GetUint32(&buf);
+  superblock->compression = GetUint32(&buf);
+  superblock->block_size = GetUint32(&buf);
+  superblock->reserved = GetUint32(&buf);
+  superblock->num_inodes = GetUint64(&buf);
+  superblock->inode_table_offset = GetUint64(&buf);
+  superblock->num_extents = GetUint64(&buf);
+  superblock->extent_table_offset = GetUint64(&buf);
+  superblock->string_table_offset = GetUint64(&buf);
+  superblock->string_table_size = GetUint64(&buf);
+  superblock->provenance_offset = GetUint64(&buf);
+  superblock->provenance_size = GetUint64(&buf);
+  superblock->data_size = GetUint64(&buf);
+}
+
+
+void EncodeExtent(const ImageExtent &extent, std::string *buf) {
+  PutUint64(extent.offset, buf);
+  PutUint32(extent.size_stored, buf);
+  PutUint32(extent.size, buf);
+}
+
+
+void DecodeExtent(const unsigned char *buf, ImageExtent *extent) {
+  extent->offset = GetUint64(&buf);
+  extent->size_stored = GetUint32(&buf);
+  extent->size = GetUint32(&buf);
+}
+
+
+void EncodeInode(const ImageInode &inode, std::string *buf) {
+  const size_t start = buf->size();
+  PutUint64(inode.size, buf);
+  PutUint64(static_cast<uint64_t>(inode.mtime), buf);
+  PutUint64(inode.first, buf);
+  PutUint32(inode.count, buf);
+  PutUint32(inode.mode, buf);
+  PutUint32(inode.uid, buf);
+  PutUint32(inode.gid, buf);
+  PutUint32(inode.parent, buf);
+  PutUint32(inode.name_offset, buf);
+  PutUint32(inode.name_length, buf);
+  PutUint32(inode.reserved, buf);
+  assert(buf->size() - start == kImageInodeSize);
+}
+
+
+void DecodeInode(const unsigned char *buf, ImageInode *inode) {
+  inode->size = GetUint64(&buf);
+  inode->mtime = static_cast<int64_t>(GetUint64(&buf));
+  inode->first = GetUint64(&buf);
+  inode->count = GetUint32(&buf);
+  inode->mode = GetUint32(&buf);
+  inode->uid = GetUint32(&buf);
+  inode->gid = GetUint32(&buf);
+  inode->parent = GetUint32(&buf);
+  inode->name_offset = GetUint32(&buf);
+  inode->name_length = GetUint32(&buf);
+  inode->reserved = GetUint32(&buf);
+}
+
+}  // namespace image
+}  // namespace shrinkwrap
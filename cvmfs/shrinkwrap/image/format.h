@@ -0,0 +1,110 @@
+/**
+ * This file is part of the CernVM File System.
+ *
+ * On-disk layout of the single-file shrinkwrap image.  The image is a
+ * read-only file system in the spirit of squashfs and erofs:
+ *
+ *   [superblock][data region][extent table][inode table][string table]
+ *   [provenance]
+ *
+ * The superblock is at offset 0 and padded to kImageDataOffset.  The data
+ * region contains the (optionally compressed) blocks of all regular files.
+ * Deduplication is per file: files with identical content hash share the
+ * same extents, blocks that are equal across different files are stored
+ * more than once.  All integers are stored in little-endian byte order.  The
+ * tables are arrays of fixed-size records, see the Encode and Decode
+ * functions below for the field order.
+ *
+ * Inodes are numbered in breadth-first order starting with the root
+ * directory (inode 0).  The children of a directory are contiguous in the
+ * inode table and sorted by name, so that a path can be resolved by binary
+ * search in every directory level.
+ */
+#ifndef CVMFS_SHRINKWRAP_IMAGE_FORMAT_H_
+#define CVMFS_SHRINKWRAP_IMAGE_FORMAT_H_
+
+#include <stdint.h>
+
+#include <string>
+
+namespace shrinkwrap {
+namespace image {
+
+const char kImageMagic[8] = {'C', 'V', 'M', 'F', 'S', 'I', 'M', 'G'};
+const uint32_t kImageVersion = 1;
+const uint64_t kImageDataOffset = 4096;
+const uint32_t kImageDefaultBlockSize = 128 * 1024;
+// Sizes of the encoded records
+const unsigned kImageSuperblockSize = 96;
+const unsigned kImageExtentSize = 16;
+const unsigned kImageInodeSize = 56;
+
+enum ImageCompression {
+  kImageCompressionNone = 0,
+  kImageCompressionZlib = 1,
+};
+
+struct ImageSuperblock {
+  char magic[8];
+  uint32_t version;
+  uint32_t compression;  ///< ImageCompression
+  uint32_t block_size;
+  uint32_t reserved;
+  uint64_t num_inodes;
+  uint64_t inode_table_offset;
+  uint64_t num_extents;
+  uint64_t extent_table_offset;
+  uint64_t string_table_offset;
+  uint64_t string_table_size;
+  uint64_t provenance_offset;
+  uint64_t provenance_size;
+  uint64_t data_size;    ///< Size of the data region in bytes
+};
+
+/**
+ * A stored block of file content.  If size_stored equals size, the block is
+ * stored uncompressed, otherwise it has to be inflated according to the
+ * compression set in the superblock.  Every block but the last one of a file
+ * has the block size given in the superblock.
+ */
+struct ImageExtent {
+  uint64_t offset;
+  uint32_t size_stored;
+  uint32_t size;
+};
+
+/**
+ * The meaning of first and count depends on the file type:
+ *   - directories: index of the first child inode and number of children
+ *   - regular files: index of the first extent and number of extents
+ *   - symlinks: offset and length of the link target in the string table
+ */
+struct ImageInode {
+  uint64_t size;
+  int64_t mtime;
+  uint64_t first;
+  uint32_t count;
+  uint32_t mode;
+  uint32_t uid;
+  uint32_t gid;
+  uint32_t parent;
+  uint32_t name_offset;
+  uint32_t name_length;
+  uint32_t reserved;
+};
+
+/**
+ * The Encode functions append the little-endian representation to buf.  The
+ * Decode functions read a record of the corresponding size from buf.
+ */
+void EncodeSuperblock(const ImageSuperblock &superblock, std::string *buf);
+void DecodeSuperblock(const unsigned char *buf, ImageSuperblock *superblock);
+void EncodeExtent(const ImageExtent &extent, std::string *buf);
+void DecodeExtent(const unsigned char *buf, ImageExtent *extent);
+void EncodeInode(const ImageInode &inode, std::string *buf);
+void DecodeInode(const unsigned char *buf, ImageInode *inode);
+
+}  // namespace image
+}  // namespace shrinkwrap
+
+#endif  // CVMFS_SHRINKWRAP_IMAGE_FORMAT_H_
@@ -0,0 +1,1048 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#include "interface.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "compression.h"
+#include "crypto/hash.h"
+#include "format.h"
+#include "libcvmfs.h"
+#include "options.h"
+#include "shrinkwrap/fs_traversal_interface.h"
+#include "shrinkwrap/util.h"
+#include "util/logging.h"
+#include "util/mutex.h"
+#include "util/posix.h"
+#include "util/smalloc.h"
+#include "util/string.h"
+
+using namespace shrinkwrap::image;  // NOLINT
+
+namespace {
+
+/**
+ * Content stored in the data region, keyed by content hash.  Several
+ * objects (content plus meta data) can share the same content.
+ */
+struct ImageContent {
+  ImageContent() : size(0), complete(false) { }
+  std::vector<ImageExtent> extents;
+  uint64_t size;
+  bool complete;
+};
+
+/**
+ * What an identifier returned by get_identifier() refers to.  The meta data
+ * is part of the identifier so that touch() carries it over to the links.
+ */
+struct ImageObject {
+  std::string content_key;
+  uint32_t mode;
+  uint32_t uid;
+  uint32_t gid;
+  int64_t mtime;
+  uint64_t size;
+};
+
+struct ImageNode {
+  ImageNode() : mode(0), uid(0), gid(0), mtime(0), size(0) { }
+  ~ImageNode() {
+    for (std::map<std::string, ImageNode *>::iterator i = children.begin(),
+         iEnd = children.end(); i != iEnd; ++i)
+    {
+      delete i->second;
+    }
+  }
+
+  uint32_t mode;
+  uint32_t uid;
+  uint32_t gid;
+  int64_t mtime;
+  uint64_t size;
+  std::string symlink;
+  std::string object;
+  // Sorted by name, which gives the order of the inode table
+  std::map<std::string, ImageNode *> children;
+};
+
+struct fs_traversal_image_context {
+  fs_traversal_image_context()
+    : fd(-1)
+    , compression(kImageCompressionZlib)
+    , block_size(kImageDefaultBlockSize)
+    , data_end(kImageDataOffset)
+    , root(new ImageNode())
+  {
+    int retval = pthread_mutex_init(&lock, NULL);
+    assert(retval == 0);
+  }
+  ~fs_traversal_image_context() {
+    delete root;
+    pthread_mutex_destroy(&lock);
+  }
+
+  int fd;
+  std::string image_path;
+  ImageCompression compression;
+  uint32_t block_size;
+  uint64_t data_end;
+  ImageNode *root;
+  std::map<std::string, ImageObject> objects;
+  std::map<std::string, ImageContent> contents;
+  std::string provenance;
+  /**
+   * Protects the tree, the object and content maps, and data_end.  The copy
+   * workers only hold it to reserve space in the data region and to publish
+   * finished contents.
+   */
+  pthread_mutex_t lock;
+};
+
+struct image_file_handle {
+  fs_traversal_image_context *img_ctx;
+  std::string identifier;
+  std::string content_key;
+  fs_open_type mode;
+  bool is_open;
+  // Writing: the current, not yet full block and the extents written so far
+  std::string block;
+  std::vector<ImageExtent> extents;
+  uint64_t size;
+  // Reading: the decoded current extent
+  unsigned next_extent;
+  std::string read_block;
+  size_t read_pos;
+};
+
+fs_traversal_image_context *GetImageContext(
+  struct fs_traversal_context *ctx)
+{
+  return reinterpret_cast<fs_traversal_image_context *>(ctx->ctx);
+}
+
+bool PwriteAll(int fd, const void *buf, size_t nbyte, uint64_t offset) {
+  const char *cbuf = reinterpret_cast<const char *>(buf);
+  while (nbyte > 0) {
+    ssize_t retval = pwrite(fd, cbuf, nbyte, offset);
+    if (retval < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    cbuf += retval;
+    nbyte -= retval;
+    offset += retval;
+  }
+  return true;
+}
+
+bool PreadAll(int fd, void *buf, size_t nbyte, uint64_t offset) {
+  char *cbuf = reinterpret_cast<char *>(buf);
+  while (nbyte > 0) {
+    ssize_t retval = pread(fd, cbuf, nbyte, offset);
+    if (retval < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    if (retval == 0) {
+      errno = EIO;
+      return false;
+    }
+    cbuf += retval;
+    nbyte -= retval;
+    offset += retval;
+  }
+  return true;
+}
+
+/**
+ * Splits "/a/b/c" in {"a", "b", "c"}.  The root directory is the empty path.
+ */
+std::vector<std::string> SplitImagePath(const char *path) {
+  std::vector<std::string> result;
+  std::vector<std::string> components = SplitString(path, '/');
+  for (unsigned i = 0; i < components.size(); ++i) {
+    if (!components[i].empty() && components[i] != ".")
+      result.push_back(components[i]);
+  }
+  return result;
+}
+
+ImageNode *LookupNode(fs_traversal_image_context *img_ctx, const char *path) {
+  std::vector<std::string> components = SplitImagePath(path);
+  ImageNode *node = img_ctx->root;
+  for (unsigned i = 0; i < components.size(); ++i) {
+    if (!S_ISDIR(node->mode))
+      return NULL;
+    std::map<std::string, ImageNode *>::const_iterator iter =
+      node->children.find(components[i]);
+    if (iter == node->children.end())
+      return NULL;
+    node = iter->second;
+  }
+  return node;
+}
+
+/**
+ * Finds the parent directory of path and the name of the entry in it.  Fails
+ * with ENOENT if the parent directory does not exist.
+ */
+ImageNode *LookupParent(
+  fs_traversal_image_context *img_ctx,
+  const char *path,
+  std::string *name)
+{
+  std::vector<std::string> components = SplitImagePath(path);
+  if (components.empty()) {
+    errno = EINVAL;
+    return NULL;
+  }
+  *name = components.back();
+  ImageNode *node = img_ctx->root;
+  for (unsigned i = 0; i + 1 < components.size(); ++i) {
+    std::map<std::string, ImageNode *>::const_iterator iter =
+      node->children.find(components[i]);
+    if ((iter == node->children.end()) || !S_ISDIR(iter->second->mode)) {
+      errno = ENOENT;
+      return NULL;
+    }
+    node = iter->second;
+  }
+  return node;
+}
+
+/**
+ * Replaces an existing entry, if any, by the given node.
+ */
+void InsertNode(ImageNode *parent, const std::string &name, ImageNode *node) {
+  std::map<std::string, ImageNode *>::iterator iter =
+    parent->children.find(name);
+  if (iter != parent->children.end()) {
+    delete iter->second;
+    iter->second = node;
+  } else {
+    parent->children[name] = node;
+  }
+}
+
+void SetNodeMeta(const struct cvmfs_attr *stat_info, ImageNode *node) {
+  node->mode = stat_info->st_mode;
+  node->uid = stat_info->st_uid;
+  node->gid = stat_info->st_gid;
+  node->mtime = stat_info->mtime;
+}
+
+bool FlushBlock(image_file_handle *handle) {
+  if (handle->block.empty())
+    return true;
+  fs_traversal_image_context *img_ctx = handle->img_ctx;
+
+  const void *buf = handle->block.data();
+  uint64_t size = handle->block.size();
+  void *compressed = NULL;
+  uint64_t size_compressed = 0;
+  if (img_ctx->compression == kImageCompressionZlib) {
+    if (!zlib::CompressMem2Mem(buf, size, &compressed, &size_compressed)) {
+      errno = EIO;
+      return false;
+    }
+    // Incompressible blocks are stored as-is
+    if (size_compressed < size) {
+      buf = compressed;
+      size = size_compressed;
+    }
+  }
+
+  ImageExtent extent;
+  extent.size = handle->block.size();
+  extent.size_stored = size;
+  {
+    MutexLockGuard guard(&img_ctx->lock);
+    extent.offset = img_ctx->data_end;
+    img_ctx->data_end += size;
+  }
+  bool retval = PwriteAll(img_ctx->fd, buf, size, extent.offset);
+  free(compressed);
+  if (!retval)
+    return false;
+
+  handle->extents.push_back(extent);
+  handle->size += handle->block.size();
+  handle->block.clear();
+  return true;
+}
+
+bool LoadExtent(image_file_handle *handle) {
+  const ImageExtent &extent = handle->extents[handle->next_extent];
+  std::string stored(extent.size_stored, '\0');
+  if (!PreadAll(handle->img_ctx->fd, &stored[0], extent.size_stored,
+                extent.offset))
+  {
+    return false;
+  }
+  if (extent.size_stored == extent.size) {
+    handle->read_block.swap(stored);
+  } else {
+    void *decompressed = NULL;
+    uint64_t size_decompressed = 0;
+    if (!zlib::DecompressMem2Mem(stored.data(), stored.size(),
+                                 &decompressed, &size_decompressed) ||
+        (size_decompressed != extent.size))
+    {
+      free(decompressed);
+      errno = EIO;
+      return false;
+    }
+    handle->read_block.assign(reinterpret_cast<char *>(decompressed),
+                              size_decompressed);
+    free(decompressed);
+  }
+  handle->read_pos = 0;
+  handle->next_extent++;
+  return true;
+}
+
+}  // anonymous namespace
+
+/*
+ * BASIC FS OPERATIONS
+ */
+
+void image_list_dir(struct fs_traversal_context *ctx,
+  const char *dir,
+  char ***buf,
+  size_t *len) {
+  fs_traversal_image_context *img_ctx = GetImageContext(ctx);
+  *len = 0;
+  size_t buflen = 5;
+  *buf = reinterpret_cast<char **>(smalloc(sizeof(char *) * buflen));
+
+  // NULL terminate the list;
+  AppendStringToList(NULL, buf, len, &buflen);
+
+  MutexLockGuard guard(&img_ctx->lock);
+  ImageNode *node = LookupNode(img_ctx, dir);
+  if ((node == NULL) || !S_ISDIR(node->mode))
+    return;
+  for (std::map<std::string, ImageNode *>::const_iterator
+       i = node->children.begin(), iEnd = node->children.end(); i != iEnd; ++i)
+  {
+    AppendStringToList(i->first.c_str(), buf, len, &buflen);
+  }
+}
+
+int image_get_stat(struct fs_traversal_context *ctx,
+  const char *path,
+  struct cvmfs_attr *stat_result,
+  bool get_hash)
+{
+  fs_traversal_image_context *img_ctx = GetImageContext(ctx);
+  MutexLockGuard guard(&img_ctx->lock);
+  ImageNode *node = LookupNode(img_ctx, path);
+  if (node == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+  stat_result->st_dev = 0;
+  stat_result->st_ino = 0;
+  stat_result->st_mode = node->mode;
+  stat_result->st_nlink = 1;
+  stat_result->st_uid = node->uid;
+  stat_result->st_gid = node->gid;
+  stat_result->st_rdev = 0;
+  stat_result->st_size = node->size;
+  stat_result->mtime = node->mtime;
+
+  stat_result->cvm_checksum = NULL;
+  if (get_hash && S_ISREG(node->mode)) {
+    stat_result->cvm_checksum =
+      strdup(img_ctx->objects[node->object].content_key.c_str());
+  }
+  stat_result->cvm_symlink =
+    S_ISLNK(node->mode) ? strdup(node->symlink.c_str()) : NULL;
+  stat_result->cvm_parent = strdup(GetParentPath(path).c_str());
+  stat_result->cvm_name = strdup(GetFileName(path).c_str());
+  // Extended attributes are not stored in the image
+  stat_result->cvm_xattrs = NULL;
+  return 0;
+}
+
+int image_set_meta(struct fs_traversal_context *ctx,
+  const char *path, const struct cvmfs_attr *stat_info) {
+  fs_traversal_image_context *img_ctx = GetImageContext(ctx);
+  MutexLockGuard guard(&img_ctx->lock);
+  ImageNode *node = LookupNode(img_ctx, path);
+  if (node == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+  const uint32_t type = node->mode & S_IFMT;
+  SetNodeMeta(stat_info, node);
+  node->mode = type | (stat_info->st_mode & ~S_IFMT);
+  return 0;
+}
+
+char *image_get_identifier(struct fs_traversal_context *ctx,
+  const struct cvmfs_attr *stat) {
+  shash::Any meta_hash = HashMeta(stat);
+  std::string ident = "/" + std::string(stat->cvm_checksum) + "." +
+                      meta_hash.ToString();
+  return strdup(ident.c_str());
+}
+
+bool image_has_file(struct fs_traversal_context *ctx,
+  const char *ident) {
+  fs_traversal_image_context *img_ctx = GetImageContext(ctx);
+  MutexLockGuard guard(&img_ctx->lock);
+  return img_ctx->objects.count(ident) > 0;
+}
+
+int image_do_unlink(struct fs_traversal_context *ctx,
+  const char *path) {
+  fs_traversal_image_context *img_ctx = GetImageContext(ctx);
+  MutexLockGuard guard(&img_ctx->lock);
+  std::string name;
+  ImageNode *parent = LookupParent(img_ctx, path, &name);
+  if (parent == NULL)
+    return -1;
+  std::map<std::string, ImageNode *>::iterator iter =
+    parent->children.find(name);
+  if (iter == parent->children.end()) {
+    errno = ENOENT;
+    return -1;
+  }
+  if (S_ISDIR(iter->second->mode)) {
+    errno = EISDIR;
+    return -1;
+  }
+  delete iter->second;
+  parent->children.erase(iter);
+  return 0;
+}
+
+int image_do_rmdir(struct fs_traversal_context *ctx,
+  const char *path) {
+  fs_traversal_image_context *img_ctx = GetImageContext(ctx);
+  MutexLockGuard guard(&img_ctx->lock);
+  std::string name;
+  ImageNode *parent = LookupParent(img_ctx, path, &name);
+  if (parent == NULL)
+    return -1;
+  std::map<std::string, ImageNode *>::iterator iter =
+    parent->children.find(name);
+  if (iter == parent->children.end()) {
+    errno = ENOENT;
+    return -1;
+  }
+  if (!S_ISDIR(iter->second->mode)) {
+    errno = ENOTDIR;
+    return -1;
+  }
+  if (!iter->second->children.empty()) {
+    errno = ENOTEMPTY;
+    return -1;
+  }
+  delete iter->second;
+  parent->children.erase(iter);
+  return 0;
+}
+
+int image_do_link(struct fs_traversal_context *ctx,
+  const char *path,
+  const char *identifier) {
+  fs_traversal_image_context *img_ctx = GetImageContext(ctx);
+  MutexLockGuard guard(&img_ctx->lock);
+  std::map<std::string, ImageObject>::const_iterator object =
+    img_ctx->objects.find(identifier);
+  if (object == img_ctx->objects.end()) {
+    errno = ENOENT;
+    return -1;
+  }
+  std::string name;
+  ImageNode *parent = LookupParent(img_ctx, path, &name);
+  if (parent == NULL)
+    return -1;
+
+  ImageNode *node = new ImageNode();
+  node->mode = object->second.mode;
+  node->uid = object->second.uid;
+  node->gid = object->second.gid;
+  node->mtime = object->second.mtime;
+  node->size = object->second.size;
+  node->object = identifier;
+  InsertNode(parent, name, node);
+  return 0;
+}
+
+int image_do_mkdir(struct fs_traversal_context *ctx,
+  const char *path,
+  const struct cvmfs_attr *stat_info) {
+  fs_traversal_image_context *img_ctx = GetImageContext(ctx);
+  MutexLockGuard guard(&img_ctx->lock);
+  std::string name;
+  ImageNode *parent = LookupParent(img_ctx, path, &name);
+  if (parent == NULL)
+    return -1;
+  std::map<std::string, ImageNode *>::const_iterator iter =
+    parent->children.find(name);
+  if ((iter != parent->children.end()) && S_ISDIR(iter->second->mode)) {
+    errno = EEXIST;
+    return -1;
+  }
+
+  ImageNode *node = new ImageNode();
+  SetNodeMeta(stat_info, node);
+  node->mode = S_IFDIR | (stat_info->st_mode & ~S_IFMT);
+  InsertNode(parent, name, node);
+  return 0;
+}
+
+int image_do_symlink(struct fs_traversal_context *ctx,
+  const char *src,
+  const char *dest,
+  const struct cvmfs_attr *stat_info) {
+  if ((dest == NULL) || (dest[0] == '\0')) {
+    errno = EINVAL;
+    return -1;
+  }
+  fs_traversal_image_context *img_ctx = GetImageContext(ctx);
+  MutexLockGuard guard(&img_ctx->lock);
+  std::string name;
+  ImageNode *parent = LookupParent(img_ctx, src, &name);
+  if (parent == NULL)
+    return -1;
+
+  ImageNode *node = new ImageNode();
+  SetNodeMeta(stat_info, node);
+  node->mode = S_IFLNK | (stat_info->st_mode & ~S_IFMT);
+  node->symlink = dest;
+  node->size = node->symlink.length();
+  InsertNode(parent, name, node);
+  return 0;
+}
+
+/**
+ * Registers the object.  If the content is already in the image (or is being
+ * copied by another worker), the object shares its extents and touch fails
+ * with EEXIST so that the content is not copied again.
+ */
+int image_touch(struct fs_traversal_context *ctx,
+  const struct cvmfs_attr *stat_info) {
+  fs_traversal_image_context *img_ctx = GetImageContext(ctx);
+  char *identifier = image_get_identifier(ctx, stat_info);
+  std::string ident(identifier);
+  free(identifier);
+
+  MutexLockGuard guard(&img_ctx->lock);
+  if (img_ctx->objects.count(ident) > 0) {
+    errno = EEXIST;
+    return -1;
+  }
+  ImageObject object;
+  object.content_key = stat_info->cvm_checksum;
+  object.mode = S_IFREG | (stat_info->st_mode & ~S_IFMT);
+  object.uid = stat_info->st_uid;
+  object.gid = stat_info->st_gid;
+  object.mtime = stat_info->mtime;
+  object.size = stat_info->st_size;
+  img_ctx->objects[ident] = object;
+
+  if (img_ctx->contents.count(object.content_key) > 0) {
+    errno = EEXIST;
+    return -1;
+  }
+  img_ctx->contents[object.content_key] = ImageContent();
+  return 0;
+}
+
+bool image_is_hash_consistent(struct fs_traversal_context *ctx,
+  const struct cvmfs_attr *stat_info) {
+  errno = 0;
+  fs_traversal_image_context *img_ctx = GetImageContext(ctx);
+  char *identifier = image_get_identifier(ctx, stat_info);
+  std::string ident(identifier);
+  free(identifier);
+
+  std::string path =
+    std::string(stat_info->cvm_parent) + "/" + stat_info->cvm_name;
+  MutexLockGuard guard(&img_ctx->lock);
+  ImageNode *node = LookupNode(img_ctx, path.c_str());
+  if ((node == NULL) || !S_ISREG(node->mode))
+    return false;
+  return node->object == ident;
+}
+
+/*
+ * FILE OPERATIONS
+ */
+
+void *image_get_handle(struct fs_traversal_context *ctx,
+  const char *identifier) {
+  image_file_handle *handle = new image_file_handle;
+  handle->img_ctx = GetImageContext(ctx);
+  handle->identifier = identifier;
+  handle->mode = fs_open_read;
+  handle->is_open = false;
+  handle->size = 0;
+  handle->next_extent = 0;
+  handle->read_pos = 0;
+  return handle;
+}
+
+int image_do_fopen(void *file_ctx, fs_open_type op_mode) {
+  image_file_handle *handle = reinterpret_cast<image_file_handle *>(file_ctx);
+  fs_traversal_image_context *img_ctx = handle->img_ctx;
+  if (op_mode == fs_open_append) {
+    // Stored extents are immutable
+    errno = ENOTSUP;
+    return -1;
+  }
+
+  MutexLockGuard guard(&img_ctx->lock);
+  std::map<std::string, ImageObject>::const_iterator object =
+    img_ctx->objects.find(handle->identifier);
+  if (object == img_ctx->objects.end()) {
+    errno = ENOENT;
+    return -1;
+  }
+  handle->content_key = object->second.content_key;
+  handle->mode = op_mode;
+  handle->block.clear();
+  handle->extents.clear();
+  handle->size = 0;
+  handle->read_block.clear();
+  handle->read_pos = 0;
+  handle->next_extent = 0;
+  if (op_mode == fs_open_read) {
+    const ImageContent &content = img_ctx->contents[handle->content_key];
+    if (!content.complete) {
+      errno = EAGAIN;
+      return -1;
+    }
+    handle->extents = content.extents;
+  }
+  handle->is_open = true;
+  return 0;
+}
+
+int image_do_fclose(void *file_ctx) {
+  image_file_handle *handle = reinterpret_cast<image_file_handle *>(file_ctx);
+  if (!handle->is_open) {
+    errno = EBADF;
+    return -1;
+  }
+  handle->is_open = false;
+  if (handle->mode == fs_open_read)
+    return 0;
+
+  if (!FlushBlock(handle))
+    return -1;
+  fs_traversal_image_context *img_ctx = handle->img_ctx;
+  MutexLockGuard guard(&img_ctx->lock);
+  ImageContent *content = &img_ctx->contents[handle->content_key];
+  // If two workers raced on the same content, the first one wins and the
+  // blocks of the second one become dead space in the data region
+  if (!content->complete) {
+    content->extents.swap(handle->extents);
+    content->size = handle->size;
+    content->complete = true;
+  }
+  return 0;
+}
+
+int image_do_fread(void *file_ctx, char *buff, size_t len, size_t *read_len) {
+  image_file_handle *handle = reinterpret_cast<image_file_handle *>(file_ctx);
+  *read_len = 0;
+  if (!handle->is_open || (handle->mode != fs_open_read)) {
+    errno = EBADF;
+    return -1;
+  }
+  while (*read_len < len) {
+    if (handle->read_pos == handle->read_block.size()) {
+      if (handle->next_extent == handle->extents.size())
+        break;
+      if (!LoadExtent(handle))
+        return -1;
+    }
+    size_t nbytes = std::min(len - *read_len,
+                             handle->read_block.size() - handle->read_pos);
+    memcpy(buff + *read_len, handle->read_block.data() + handle->read_pos,
+           nbytes);
+    handle->read_pos += nbytes;
+    *read_len += nbytes;
+  }
+  return 0;
+}
+
+int image_do_fwrite(void *file_ctx, const char *buff, size_t len) {
+  image_file_handle *handle = reinterpret_cast<image_file_handle *>(file_ctx);
+  if (!handle->is_open || (handle->mode != fs_open_write)) {
+    errno = EBADF;
+    return -1;
+  }
+  const uint32_t block_size = handle->img_ctx->block_size;
+  while (len > 0) {
+    size_t nbytes = std::min(len, block_size - handle->block.size());
+    handle->block.append(buff, nbytes);
+    buff += nbytes;
+    len -= nbytes;
+    if (handle->block.size() == block_size) {
+      if (!FlushBlock(handle))
+        return -1;
+    }
+  }
+  return 0;
+}
+
+void image_do_ffree(void *file_ctx) {
+  image_file_handle *handle = reinterpret_cast<image_file_handle *>(file_ctx);
+  if (handle->is_open)
+    image_do_fclose(file_ctx);
+  delete handle;
+}
+
+/*
+ * GARBAGE COLLECTION
+ */
+
+/**
+ * The image is rebuilt on every run and only referenced contents make it into
+ * the extent table, so there is nothing to collect.
+ */
+int image_garbage_collector(struct fs_traversal_context *ctx) {
+  return 0;
+}
+
+/*
+ * ARCHIVE PROVENANCE INFORMATION
+ */
+
+std::string image_provenance_info(struct fs_traversal_context *ctx) {
+  std::string result;
+  result += "repo : " + std::string(ctx->repo);
+  result += "\nversion : " + std::string(ctx->lib_version);
+  result += "\nbase : " + std::string(ctx->base ? ctx->base : "");
+  result += "\ncache : " + std::string(ctx->data ? ctx->data : "");
+  result += "\nconfig : " + std::string(ctx->config ? ctx->config : "");
+  result += "\n";
+  return result;
+}
+
+void image_archive_provenance(
+  struct fs_traversal_context *src,
+  struct fs_traversal_context *dest)
+{
+  fs_traversal_image_context *img_ctx = GetImageContext(dest);
+  MutexLockGuard guard(&img_ctx->lock);
+  img_ctx->provenance = "[src]\n" + image_provenance_info(src) +
+                        "[dest]\n" + image_provenance_info(dest);
+}
+
+/*
+ * INITIALIZATION
+ */
+
+bool image_parse_config(
+  const char *config,
+  fs_traversal_image_context *img_ctx)
+{
+  if (!config || (strlen(config) == 0))
+    return true;
+
+  SimpleOptionsParser options_parser;
+  std::vector<std::string> config_files = SplitString(config, ':');
+  for (unsigned i = 0; i < config_files.size(); ++i) {
+    if (!options_parser.TryParsePath(config_files[i])) {
+      LogCvmfs(kLogCvmfs, kLogStderr,
+        "Failed to parse image configuration '%s'", config_files[i].c_str());
+      return false;
+    }
+  }
+
+  std::string value;
+  if (options_parser.GetValue("CVMFS_IMAGE_COMPRESSION", &value)) {
+    if (value == "none") {
+      img_ctx->compression = kImageCompressionNone;
+    } else if (value == "zlib") {
+      img_ctx->compression = kImageCompressionZlib;
+    } else {
+      LogCvmfs(kLogCvmfs, kLogStderr,
+        "Unknown image compression '%s'", value.c_str());
+      return false;
+    }
+  }
+  if (options_parser.GetValue("CVMFS_IMAGE_BLOCK_SIZE", &value)) {
+    uint64_t block_size = String2Uint64(value);
+    if ((block_size < 4096) || (block_size > 16 * 1024 * 1024)) {
+      LogCvmfs(kLogCvmfs, kLogStderr,
+        "Invalid image block size '%s'", value.c_str());
+      return false;
+    }
+    img_ctx->block_size = block_size;
+  }
+  return true;
+}
+
+struct fs_traversal_context *image_initialize(
+  const char *repo,
+  const char *base,
+  const char *data,
+  const char *config,
+  int num_threads) {
+  if (!repo) {
+    LogCvmfs(kLogCvmfs, kLogStderr,
+      "Repository name must be specified");
+    return NULL;
+  }
+
+  fs_traversal_image_context *img_ctx = new fs_traversal_image_context();
+  if (!image_parse_config(config, img_ctx)) {
+    delete img_ctx;
+    return NULL;
+  }
+
+  fs_traversal_context *result = new struct fs_traversal_context;
+  result->version = 1;
+  result->lib_version = strdup("1.0");
+  result->ctx = img_ctx;
+  result->repo = strdup(repo);
+  result->base = strdup(base ? base : "/tmp/cvmfs/");
+  // The data location is the image file itself
+  if (!data || (strlen(data) == 0)) {
+    std::string image_path = std::string(result->base) + "/" + repo + ".img";
+    result->data = strdup(image_path.c_str());
+  } else {
+    result->data = strdup(data);
+  }
+  result->config = (config && (strlen(config) > 0)) ? strdup(config) : NULL;
+
+  img_ctx->image_path = result->data;
+  std::string image_dir = GetParentPath(img_ctx->image_path);
+  if (!image_dir.empty() && !DirectoryExists(image_dir)) {
+    if (!MkdirDeep(image_dir, 0755, true)) {
+      LogCvmfs(kLogCvmfs, kLogStderr,
+        "Failed to create image directory '%s'", image_dir.c_str());
+    }
+  }
+  img_ctx->fd = open(img_ctx->image_path.c_str(),
+                     O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (img_ctx->fd < 0) {
+    LogCvmfs(kLogCvmfs, kLogStderr,
+      "Failed to create image '%s' : %d : %s",
+      img_ctx->image_path.c_str(), errno, strerror(errno));
+    free(result->repo);
+    free(result->base);
+    free(result->data);
+    free(result->config);
+    free(result->lib_version);
+    delete img_ctx;
+    delete result;
+    return NULL;
+  }
+
+  img_ctx->root->mode = S_IFDIR | 0755;
+  img_ctx->root->mtime = time(NULL);
+  return result;
+}
+
+/**
+ * Lays out the inode table in breadth-first order and writes all the meta
+ * data tables behind the data region.  The superblock is written last, so
+ * that an interrupted run leaves an image without valid magic.
+ */
+bool image_write_tables(fs_traversal_image_context *img_ctx) {
+  std::vector<ImageInode> inodes;
+  std::vector<ImageExtent> extents;
+  std::string strings;
+  std::map<std::string, uint64_t> content_offsets;
+
+  std::vector<const ImageNode *> order;
+  std::vector<uint32_t> parents;
+  std::vector<const std::string *> names;
+  order.push_back(img_ctx->root);
+  parents.push_back(0);
+  names.push_back(NULL);
+  for (unsigned i = 0; i < order.size(); ++i) {
+    const ImageNode *node = order[i];
+    ImageInode inode;
+    memset(&inode, 0, sizeof(inode));
+    inode.size = node->size;
+    inode.mtime = node->mtime;
+    inode.mode = node->mode;
+    inode.uid = node->uid;
+    inode.gid = node->gid;
+    inode.parent = parents[i];
+    if (names[i] != NULL) {
+      inode.name_offset = strings.size();
+      inode.name_length = names[i]->length();
+      strings += *names[i];
+    }
+
+    if (S_ISDIR(node->mode)) {
+      inode.first = order.size();
+      inode.count = node->children.size();
+      for (std::map<std::string, ImageNode *>::const_iterator
+           j = node->children.begin(), jEnd = node->children.end();
+           j != jEnd; ++j)
+      {
+        order.push_back(j->second);
+        parents.push_back(i);
+        names.push_back(&j->first);
+      }
+    } else if (S_ISREG(node->mode)) {
+      const std::string &content_key =
+        img_ctx->objects[node->object].content_key;
+      const ImageContent &content = img_ctx->contents[content_key];
+      if (!content.complete) {
+        LogCvmfs(kLogCvmfs, kLogStderr,
+          "Image content missing for %s", node->object.c_str());
+        errno = EIO;
+        return false;
+      }
+      std::map<std::string, uint64_t>::const_iterator iter =
+        content_offsets.find(content_key);
+      if (iter == content_offsets.end()) {
+        content_offsets[content_key] = extents.size();
+        inode.first = extents.size();
+        extents.insert(extents.end(), content.extents.begin(),
+                       content.extents.end());
+      } else {
+        inode.first = iter->second;
+      }
+      inode.count = content.extents.size();
+      inode.size = content.size;
+    } else if (S_ISLNK(node->mode)) {
+      inode.first = strings.size();
+      inode.count = node->symlink.length();
+      strings += node->symlink;
+    }
+    inodes.push_back(inode);
+  }
+
+  ImageSuperblock superblock;
+  memset(&superblock, 0, sizeof(superblock));
+  memcpy(superblock.magic, kImageMagic, sizeof(superblock.magic));
+  superblock.version = kImageVersion;
+  superblock.compression = img_ctx->compression;
+  superblock.block_size = img_ctx->block_size;
+  superblock.data_size = img_ctx->data_end - kImageDataOffset;
+  uint64_t offset = img_ctx->data_end;
+
+  superblock.num_extents = extents.size();
+  superblock.extent_table_offset = offset;
+  std::string table;
+  for (unsigned i = 0; i < extents.size(); ++i)
+    EncodeExtent(extents[i], &table);
+  if (!PwriteAll(img_ctx->fd, table.data(), table.size(), offset))
+    return false;
+  offset += table.size();
+
+  superblock.num_inodes = inodes.size();
+  superblock.inode_table_offset = offset;
+  table.clear();
+  for (unsigned i = 0; i < inodes.size(); ++i)
+    EncodeInode(inodes[i], &table);
+  if (!PwriteAll(img_ctx->fd, table.data(), table.size(), offset))
+    return false;
+  offset += table.size();
+
+  superblock.string_table_offset = offset;
+  superblock.string_table_size = strings.size();
+  if (!PwriteAll(img_ctx->fd, strings.data(), strings.size(), offset))
+    return false;
+  offset += strings.size();
+
+  superblock.provenance_offset = offset;
+  superblock.provenance_size = img_ctx->provenance.size();
+  if (!PwriteAll(img_ctx->fd, img_ctx->provenance.data(),
+                 img_ctx->provenance.size(), offset))
+  {
+    return false;
+  }
+  offset += img_ctx->provenance.size();
+
+  if (ftruncate(img_ctx->fd, offset) != 0)
+    return false;
+  table.clear();
+  EncodeSuperblock(superblock, &table);
+  return PwriteAll(img_ctx->fd, table.data(), table.size(), 0);
+}
+
+/**
+ * Fails if the image could not be written completely.  The context is freed
+ * in any case.
+ */
+int image_finalize(struct fs_traversal_context *ctx) {
+  fs_traversal_image_context *img_ctx = GetImageContext(ctx);
+  int result = 0;
+  {
+    MutexLockGuard guard(&img_ctx->lock);
+    if (!image_write_tables(img_ctx)) {
+      LogCvmfs(kLogCvmfs, kLogStderr,
+        "Failed to write image '%s' : %d : %s",
+        img_ctx->image_path.c_str(), errno, strerror(errno));
+      result = -1;
+    }
+  }
+  if (close(img_ctx->fd) != 0) {
+    LogCvmfs(kLogCvmfs, kLogStderr,
+      "Failed to close image '%s' : %d : %s",
+      img_ctx->image_path.c_str(), errno, strerror(errno));
+    result = -1;
+  }
+  free(ctx->repo);
+  free(ctx->base);
+  free(ctx->data);
+  free(ctx->config);
+  free(ctx->lib_version);
+  delete img_ctx;
+  delete ctx;
+  return result;
+}
+
+struct fs_traversal *image_get_interface() {
+  struct fs_traversal *result = new struct fs_traversal;
+  result->initialize = image_initialize;
+  result->finalize = image_finalize;
+  result->archive_provenance = image_archive_provenance;
+  result->list_dir = image_list_dir;
+  result->get_stat = image_get_stat;
+  result->is_hash_consistent = image_is_hash_consistent;
+  result->set_meta = image_set_meta;
+  result->has_file = image_has_file;
+  result->get_identifier = image_get_identifier;
+  result->do_link = image_do_link;
+  result->do_unlink = image_do_unlink;
+  result->do_mkdir = image_do_mkdir;
+  result->do_rmdir = image_do_rmdir;
+  result->touch = image_touch;
+  result->get_handle = image_get_handle;
+  result->do_symlink = image_do_symlink;
+  result->garbage_collector = image_garbage_collector;
+
+  result->do_fopen = image_do_fopen;
+  result->do_fclose = image_do_fclose;
+  result->do_fread = image_do_fread;
+  result->do_fwrite = image_do_fwrite;
+  result->do_ffree = image_do_ffree;
+
+  return result;
+}
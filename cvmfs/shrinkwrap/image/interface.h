@@ -0,0 +1,16 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#ifndef CVMFS_SHRINKWRAP_IMAGE_INTERFACE_H_
+#define CVMFS_SHRINKWRAP_IMAGE_INTERFACE_H_
+
+/**
+ * Destination interface that writes the traversed repository into a single
+ * read-only image file (see image/format.h) instead of a directory tree.
+ * The data parameter of initialize() is the path of the image file.  The
+ * image is rebuilt from scratch on every run and written out on finalize().
+ * The ImageReader in image/reader.h gives access to the written image.
+ */
+struct fs_traversal *image_get_interface();
+
+#endif  // CVMFS_SHRINKWRAP_IMAGE_INTERFACE_H_
@@ -0,0 +1,296 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#include "reader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "compression.h"
+#include "util/logging.h"
+#include "util/platform.h"
+#include "util/string.h"
+
+namespace shrinkwrap {
+namespace image {
+
+namespace {
+
+bool PreadAll(int fd, void *buf, size_t nbyte, uint64_t offset) {
+  char *cbuf = reinterpret_cast<char *>(buf);
+  while (nbyte > 0) {
+    ssize_t retval = pread(fd, cbuf, nbyte, offset);
+    if (retval < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    if (retval == 0) {
+      errno = EIO;
+      return false;
+    }
+    cbuf += retval;
+    nbyte -= retval;
+    offset += retval;
+  }
+  return true;
+}
+
+/**
+ * True if [offset, offset + size) lies within [0, limit)
+ */
+bool InRange(uint64_t offset, uint64_t size, uint64_t limit) {
+  return (size <= limit) && (offset <= limit - size);
+}
+
+}  // anonymous namespace
+
+
+ImageReader::ImageReader() : fd_(-1), image_size_(0) {
+  memset(&superblock_, 0, sizeof(superblock_));
+}
+
+
+ImageReader::~ImageReader() {
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+
+ImageReader *ImageReader::Open(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LogCvmfs(kLogCvmfs, kLogDebug, "failed to open image %s (%d)",
+             path.c_str(), errno);
+    return NULL;
+  }
+  ImageReader *reader = new ImageReader();
+  reader->fd_ = fd;
+  if (!reader->LoadTables()) {
+    LogCvmfs(kLogCvmfs, kLogDebug, "invalid image %s", path.c_str());
+    delete reader;
+    return NULL;
+  }
+  return reader;
+}
+
+
+/**
+ * Reads the superblock and the tables and checks that all references stay
+ * within the image, so that the accessors do not need to check again.
+ */
+bool ImageReader::LoadTables() {
+  platform_stat64 info;
+  if (platform_fstat(fd_, &info) != 0)
+    return false;
+  image_size_ = info.st_size;
+  if (image_size_ < kImageDataOffset)
+    return false;
+
+  unsigned char buf[kImageSuperblockSize];
+  if (!PreadAll(fd_, buf, sizeof(buf), 0))
+    return false;
+  DecodeSuperblock(buf, &superblock_);
+  if ((memcmp(superblock_.magic, kImageMagic, sizeof(kImageMagic)) != 0) ||
+      (superblock_.version != kImageVersion) ||
+      (superblock_.compression > kImageCompressionZlib))
+  {
+    return false;
+  }
+  const uint64_t data_end = kImageDataOffset + superblock_.data_size;
+  if (!InRange(kImageDataOffset, superblock_.data_size, image_size_) ||
+      (superblock_.num_extents > image_size_ / kImageExtentSize) ||
+      (superblock_.num_inodes > image_size_ / kImageInodeSize) ||
+      (superblock_.num_inodes == 0) ||
+      !InRange(superblock_.extent_table_offset,
+               superblock_.num_extents * kImageExtentSize, image_size_) ||
+      !InRange(superblock_.inode_table_offset,
+               superblock_.num_inodes * kImageInodeSize, image_size_) ||
+      !InRange(superblock_.string_table_offset,
+               superblock_.string_table_size, image_size_) ||
+      !InRange(superblock_.provenance_offset,
+               superblock_.provenance_size, image_size_))
+  {
+    return false;
+  }
+
+  std::string table(superblock_.num_extents * kImageExtentSize, '\0');
+  if (!table.empty() && !PreadAll(fd_, &table[0], table.size(),
+                                  superblock_.extent_table_offset))
+  {
+    return false;
+  }
+  extents_.resize(superblock_.num_extents);
+  for (uint64_t i = 0; i < extents_.size(); ++i) {
+    DecodeExtent(reinterpret_cast<const unsigned char *>(table.data()) +
+                 i * kImageExtentSize, &extents_[i]);
+    if ((extents_[i].offset < kImageDataOffset) ||
+        !InRange(extents_[i].offset, extents_[i].size_stored, data_end) ||
+        (extents_[i].size > superblock_.block_size))
+    {
+      return false;
+    }
+  }
+
+  table.assign(superblock_.num_inodes * kImageInodeSize, '\0');
+  if (!PreadAll(fd_, &table[0], table.size(),
+                superblock_.inode_table_offset))
+  {
+    return false;
+  }
+  inodes_.resize(superblock_.num_inodes);
+  for (uint64_t i = 0; i < inodes_.size(); ++i) {
+    DecodeInode(reinterpret_cast<const unsigned char *>(table.data()) +
+                i * kImageInodeSize, &inodes_[i]);
+  }
+
+  strings_.assign(superblock_.string_table_size, '\0');
+  if (!strings_.empty() && !PreadAll(fd_, &strings_[0], strings_.size(),
+                                     superblock_.string_table_offset))
+  {
+    return false;
+  }
+  provenance_.assign(superblock_.provenance_size, '\0');
+  if (!provenance_.empty() && !PreadAll(fd_, &provenance_[0],
+                                        provenance_.size(),
+                                        superblock_.provenance_offset))
+  {
+    return false;
+  }
+
+  if (!S_ISDIR(inodes_[0].mode))
+    return false;
+  for (uint64_t i = 0; i < inodes_.size(); ++i) {
+    const ImageInode &inode = inodes_[i];
+    if (!InRange(inode.name_offset, inode.name_length, strings_.size()))
+      return false;
+    if (S_ISDIR(inode.mode)) {
+      // Breadth-first order: children come after their parent
+      if ((inode.count > 0) && (inode.first <= i))
+        return false;
+      if (!InRange(inode.first, inode.count, inodes_.size()))
+        return false;
+      for (uint64_t j = inode.first; j < inode.first + inode.count; ++j) {
+        if (inodes_[j].parent != i)
+          return false;
+      }
+    } else if (S_ISREG(inode.mode)) {
+      if (!InRange(inode.first, inode.count, extents_.size()))
+        return false;
+    } else if (S_ISLNK(inode.mode)) {
+      if (!InRange(inode.first, inode.count, strings_.size()))
+        return false;
+    }
+  }
+  return true;
+}
+
+
+std::string ImageReader::GetName(uint64_t inode) const {
+  return strings_.substr(inodes_[inode].name_offset,
+                         inodes_[inode].name_length);
+}
+
+
+bool ImageReader::Lookup(const std::string &path, uint64_t *inode) const {
+  std::vector<std::string> components = SplitString(path, '/');
+  uint64_t current = 0;
+  for (unsigned i = 0; i < components.size(); ++i) {
+    if (components[i].empty() || (components[i] == "."))
+      continue;
+    const ImageInode &dir = inodes_[current];
+    if (!S_ISDIR(dir.mode))
+      return false;
+    // The children of a directory are sorted by name
+    uint64_t low = dir.first;
+    uint64_t high = dir.first + dir.count;
+    while (low < high) {
+      const uint64_t mid = low + (high - low) / 2;
+      if (GetName(mid) < components[i])
+        low = mid + 1;
+      else
+        high = mid;
+    }
+    if ((low == dir.first + dir.count) || (GetName(low) != components[i]))
+      return false;
+    current = low;
+  }
+  *inode = current;
+  return true;
+}
+
+
+bool ImageReader::ListDirectory(
+  uint64_t inode,
+  std::vector<std::string> *names) const
+{
+  if ((inode >= inodes_.size()) || !S_ISDIR(inodes_[inode].mode))
+    return false;
+  names->clear();
+  for (uint64_t i = inodes_[inode].first;
+       i < inodes_[inode].first + inodes_[inode].count; ++i)
+  {
+    names->push_back(GetName(i));
+  }
+  return true;
+}
+
+
+bool ImageReader::ReadLink(uint64_t inode, std::string *target) const {
+  if ((inode >= inodes_.size()) || !S_ISLNK(inodes_[inode].mode))
+    return false;
+  *target = strings_.substr(inodes_[inode].first, inodes_[inode].count);
+  return true;
+}
+
+
+bool ImageReader::ReadExtent(
+  const ImageExtent &extent,
+  std::string *buf) const
+{
+  std::string stored(extent.size_stored, '\0');
+  if (!stored.empty() &&
+      !PreadAll(fd_, &stored[0], stored.size(), extent.offset))
+  {
+    return false;
+  }
+  if (extent.size_stored == extent.size) {
+    buf->append(stored);
+    return true;
+  }
+  if (superblock_.compression != kImageCompressionZlib)
+    return false;
+  void *decompressed = NULL;
+  uint64_t size_decompressed = 0;
+  bool retval = zlib::DecompressMem2Mem(stored.data(), stored.size(),
+                                        &decompressed, &size_decompressed);
+  if (retval && (size_decompressed == extent.size)) {
+    buf->append(reinterpret_cast<char *>(decompressed), size_decompressed);
+  } else {
+    retval = false;
+  }
+  free(decompressed);
+  return retval;
+}
+
+
+bool ImageReader::ReadFile(uint64_t inode, std::string *content) const {
+  if ((inode >= inodes_.size()) || !S_ISREG(inodes_[inode].mode))
+    return false;
+  content->clear();
+  for (uint64_t i = inodes_[inode].first;
+       i < inodes_[inode].first + inodes_[inode].count; ++i)
+  {
+    if (!ReadExtent(extents_[i], content))
+      return false;
+  }
+  return content->size() == inodes_[inode].size;
+}
+
+}  // namespace image
+}  // namespace shrinkwrap
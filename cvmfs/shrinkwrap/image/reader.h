@@ -0,0 +1,59 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#ifndef CVMFS_SHRINKWRAP_IMAGE_READER_H_
+#define CVMFS_SHRINKWRAP_IMAGE_READER_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "format.h"
+
+namespace shrinkwrap {
+namespace image {
+
+/**
+ * Read-only access to an image written by the shrinkwrap image destination.
+ * Open() loads and validates the meta data tables, file contents are read
+ * from the image on demand.  Inodes are indexes into the inode table; the
+ * root directory is inode 0.
+ */
+class ImageReader {
+ public:
+  static ImageReader *Open(const std::string &path);
+  ~ImageReader();
+
+  /**
+   * Resolves an absolute path, "" and "/" refer to the root directory
+   */
+  bool Lookup(const std::string &path, uint64_t *inode) const;
+  bool ListDirectory(uint64_t inode, std::vector<std::string> *names) const;
+  bool ReadFile(uint64_t inode, std::string *content) const;
+  bool ReadLink(uint64_t inode, std::string *target) const;
+  std::string GetName(uint64_t inode) const;
+
+  uint64_t num_inodes() const { return inodes_.size(); }
+  const ImageInode &inode(uint64_t inode) const { return inodes_[inode]; }
+  const ImageSuperblock &superblock() const { return superblock_; }
+  const std::string &provenance() const { return provenance_; }
+
+ private:
+  ImageReader();
+  bool LoadTables();
+  bool ReadExtent(const ImageExtent &extent, std::string *buf) const;
+
+  int fd_;
+  uint64_t image_size_;
+  ImageSuperblock superblock_;
+  std::vector<ImageInode> inodes_;
+  std::vector<ImageExtent> extents_;
+  std::string strings_;
+  std::string provenance_;
+};
+
+}  // namespace image
+}  // namespace shrinkwrap
+
+#endif  // CVMFS_SHRINKWRAP_IMAGE_READER_H_
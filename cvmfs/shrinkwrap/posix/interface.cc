@@ -126,7 +126,7 @@ struct fs_traversal_context *posix_initialize(
   const char *config,
   int num_threads);
 
-void posix_finalize(struct fs_traversal_context *ctx);
+int posix_finalize(struct fs_traversal_context *ctx);
 
 struct fs_traversal *posix_get_interface() {
   struct fs_traversal *result = new struct fs_traversal;
@@ -752,7 +752,7 @@ struct fs_traversal_context *posix_initialize(
   return result;
 }
 
-void posix_finalize(struct fs_traversal_context *ctx) {
+int posix_finalize(struct fs_traversal_context *ctx) {
   FinalizeFsOperations(ctx);
   free(ctx->repo);
   free(ctx->base);
@@ -763,4 +763,5 @@ void posix_finalize(struct fs_traversal_context *ctx) {
     =  reinterpret_cast<struct fs_traversal_posix_context*>(ctx->ctx);
   delete posix_ctx;
   delete ctx;
+  return 0;
 }
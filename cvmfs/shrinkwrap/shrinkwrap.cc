@@ -22,7 +22,8 @@ namespace {
 
 struct Params {
   bool CheckType(const std::string &type) {
-    if ((type == "cvmfs") || (type == "posix")) return true;
+    if ((type == "cvmfs") || (type == "posix") || (type == "image"))
+      return true;
     LogCvmfs(kLogCvmfs, kLogStderr, "Unknown type: %s", type.c_str());
     return false;
   }
@@ -34,8 +35,12 @@ struct Params {
   }
 
   void Complete() {
-    if (dst_data_dir.empty())
-      dst_data_dir = dst_base_dir + "/.data";
+    if (dst_data_dir.empty()) {
+      if (dst_type == "image")
+        dst_data_dir = dst_base_dir + "/" + repo_name + ".img";
+      else
+        dst_data_dir = dst_base_dir + "/.data";
+    }
 
     if (spec_trace_path.empty())
       spec_trace_path = repo_name + ".spec";
@@ -88,9 +93,11 @@ void Usage() {
         " -b --src-base    Source base location [default:/cvmfs/]\n"
         " -c --src-cache   Source cache\n"
         " -f --src-config  Source config [default:cvmfs.conf:cvmfs.local]\n"
-        " -d --dest-type   Dest filesystem type [default:posix]\n"
+        " -d --dest-type   Dest filesystem type, posix or image\n"
+        "                  [default:posix]\n"
         " -x --dest-base   Dest base [default:/export/cvmfs]\n"
-        " -y --dest-cache  Dest cache [default:$BASE/.data]\n"
+        " -y --dest-cache  Dest cache, image file for type image\n"
+        "                  [default:$BASE/.data or $BASE/$REPO.img]\n"
         " -z --dest-config Dest config\n"
         " -t --spec-file   Specification file [default=$REPO.spec]\n"
         " -j --threads     Number of concurrent copy threads [default:2*CPUs]\n"
@@ -239,7 +246,10 @@ int main(int argc, char **argv) {
   if (params.do_garbage_collection) {
     shrinkwrap::GarbageCollect(dest);
   }
-  dest->finalize(dest->context_);
+  if (dest->finalize(dest->context_) != 0) {
+    LogCvmfs(kLogCvmfs, kLogStderr, "Unable to finalize destination");
+    result = 1;
+  }
 
   delete src;
   delete dest;
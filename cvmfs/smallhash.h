@@ -298,6 +298,27 @@ class SmallHashDynamic :
     return *this;
   }
 
+  /**
+   * Exchanges the content with another table without rehashing the keys.  Both
+   * tables need to use the same empty key and equivalent hash functions.  The
+   * tables keep their hash function, so that a table filled by a previous
+   * version of the library can be taken over after a reload.
+   */
+  void Swap(SmallHashDynamic<Key, Value> *other) {
+    assert(Base::empty_key_ == other->empty_key_);
+    std::swap(Base::keys_, other->keys_);
+    std::swap(Base::values_, other->values_);
+    std::swap(Base::capacity_, other->capacity_);
+    std::swap(Base::initial_capacity_, other->initial_capacity_);
+    std::swap(Base::size_, other->size_);
+    std::swap(Base::bytes_allocated_, other->bytes_allocated_);
+    std::swap(Base::num_collisions_, other->num_collisions_);
+    std::swap(Base::max_collisions_, other->max_collisions_);
+    std::swap(num_migrates_, other->num_migrates_);
+    std::swap(threshold_grow_, other->threshold_grow_);
+    std::swap(threshold_shrink_, other->threshold_shrink_);
+  }
+
   uint32_t capacity() const { return Base::capacity_; }
   uint32_t size() const { return Base::size_; }
   uint32_t num_migrates() const { return num_migrates_; }
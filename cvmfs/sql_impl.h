@@ -192,8 +192,18 @@ bool Database<DerivedT>::Configure() {
         SqliteMemoryManager::GetInstance()->AssignLookasideBuffer(sqlite_db());
     }
 
-    return Sql(sqlite_db() , "PRAGMA temp_store=2;").Execute() &&
-           Sql(sqlite_db() , "PRAGMA locking_mode=EXCLUSIVE;").Execute();
+    if (!Sql(sqlite_db() , "PRAGMA temp_store=2;").Execute() ||
+        !Sql(sqlite_db() , "PRAGMA locking_mode=EXCLUSIVE;").Execute())
+    {
+      return false;
+    }
+    // Files opened through the cvmfs VFS may be memory mapped by the VFS.
+    // SQlite only asks for mapped pages if mmap_size is set; the value is
+    // capped by SQlite's compile-time maximum.
+    if (filename()[0] == '@') {
+      return Sql(sqlite_db(),
+                 "PRAGMA mmap_size=9223372036854775807;").Execute();
+    }
   }
   return true;
 }
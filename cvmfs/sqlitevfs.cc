@@ -19,6 +19,7 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <stdint.h>
+#include <sys/mman.h>
 #include <sys/select.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -62,6 +63,9 @@ struct VfsRdOnly {
     , n_sleep(NULL)
     , sz_sleep(NULL)
     , n_time(NULL)
+    , no_mmap(NULL)
+    , n_fetch(NULL)
+    , use_mmap(false)
   { }
   CacheManager *cache_mgr;
   perf::Counter *n_access;
@@ -73,6 +77,9 @@ struct VfsRdOnly {
   perf::Counter *n_sleep;
   perf::Counter *sz_sleep;
   perf::Counter *n_time;
+  perf::Counter *no_mmap;
+  perf::Counter *n_fetch;
+  bool use_mmap;
 };
 
 /**
@@ -83,6 +90,11 @@ struct VfsRdOnlyFile {
   VfsRdOnly *vfs_rdonly;
   int fd;
   uint64_t size;
+  /**
+   * Read-only mapping of the entire file, or NULL if the pages are read
+   * through the cache manager
+   */
+  void *mmap_ptr;
 };
 
 /**
@@ -108,9 +120,27 @@ static void ApplyFdMap(VfsRdOnlyFile *pFile) {
 }
 
 
+/**
+ * Like ApplyFdMap() but leaves the mapping in place for the connection that
+ * owns the original file descriptor.
+ */
+static int LookupFdMap(int fd) {
+  unsigned N = fd_from_->size();
+  for (unsigned i = 0; i < N; ++i) {
+    if (fd == (*fd_from_)[i])
+      return (*fd_to_)[i];
+  }
+  return fd;
+}
+
+
 static int VfsRdOnlyClose(sqlite3_file *pFile) {
   VfsRdOnlyFile *p = reinterpret_cast<VfsRdOnlyFile *>(pFile);
   ApplyFdMap(p);
+  if (p->mmap_ptr != NULL) {
+    munmap(p->mmap_ptr, p->size);
+    perf::Dec(p->vfs_rdonly->no_mmap);
+  }
   int retval = p->vfs_rdonly->cache_mgr->Close(p->fd);
   if (retval == 0) {
     perf::Dec(p->vfs_rdonly->no_open);
@@ -235,9 +265,67 @@ static int VfsRdOnlyDeviceCharacteristics(
 }
 
 
+/**
+ * Hands out pointers into the file mapping instead of copying the pages into
+ * the SQlite page cache.  Only used for files that are mapped.
+ */
+static int VfsRdOnlyFetch(
+  sqlite3_file *pFile,
+  sqlite3_int64 iOfst,
+  int iAmt,
+  void **pp)
+{
+  VfsRdOnlyFile *p = reinterpret_cast<VfsRdOnlyFile *>(pFile);
+  *pp = NULL;
+  if ((iOfst >= 0) && (static_cast<uint64_t>(iOfst) + iAmt <= p->size)) {
+    *pp = reinterpret_cast<char *>(p->mmap_ptr) + iOfst;
+    perf::Inc(p->vfs_rdonly->n_fetch);
+  }
+  return SQLITE_OK;
+}
+
+
+/**
+ * The files are immutable, so the mapping stays until the file is closed.
+ */
+static int VfsRdOnlyUnfetch(
+  sqlite3_file *pFile __attribute__((unused)),
+  sqlite3_int64 iOfst __attribute__((unused)),
+  void *p __attribute__((unused)))
+{
+  return SQLITE_OK;
+}
+
+
+/**
+ * Memory maps the file if it is a plain file in the cache.  Otherwise, the
+ * file is read through the cache manager.
+ */
+static void MapFile(VfsRdOnlyFile *p) {
+  p->mmap_ptr = NULL;
+  if (!p->vfs_rdonly->use_mmap || (p->size == 0))
+    return;
+  const int backing_fd = p->vfs_rdonly->cache_mgr->GetBackingFd(p->fd);
+  if (backing_fd < 0)
+    return;
+  void *mapping = mmap(NULL, p->size, PROT_READ, MAP_SHARED, backing_fd, 0);
+  if (mapping == MAP_FAILED) {
+    LogCvmfs(kLogSql, kLogDebug, "failed to map sqlite3 catalog on fd %d (%d)",
+             p->fd, errno);
+    return;
+  }
+  p->mmap_ptr = mapping;
+  perf::Inc(p->vfs_rdonly->no_mmap);
+}
+
+
 /**
  * Supports only read-only opens.  The "file name" has to be in the form of
  * '@<file descriptor>', where file descriptor is usable by the cache manager.
+ * The connection takes ownership of the file descriptor and closes it.  With
+ * '@@<file descriptor>', the connection duplicates the file descriptor through
+ * the cache manager and owns only the duplicate.  This opens another
+ * connection to a file that is already open by a connection.
  */
 static int VfsRdOnlyOpen(
   sqlite3_vfs *vfs,
@@ -261,6 +349,29 @@ static int VfsRdOnlyOpen(
     VfsRdOnlySectorSize,
     VfsRdOnlyDeviceCharacteristics
   };
+  // SQlite uses xFetch() only from version 3 on, so mapped files get their own
+  // table of methods
+  static const sqlite3_io_methods io_methods_mmap = {
+    3,  // iVersion
+    VfsRdOnlyClose,
+    VfsRdOnlyRead,
+    VfsRdOnlyWrite,
+    VfsRdOnlyTruncate,
+    VfsRdOnlySync,
+    VfsRdOnlyFileSize,
+    VfsRdOnlyLock,
+    VfsRdOnlyUnlock,
+    VfsRdOnlyCheckReservedLock,
+    VfsRdOnlyFileControl,
+    VfsRdOnlySectorSize,
+    VfsRdOnlyDeviceCharacteristics,
+    NULL,  // xShmMap
+    NULL,  // xShmLock
+    NULL,  // xShmBarrier
+    NULL,  // xShmUnmap
+    VfsRdOnlyFetch,
+    VfsRdOnlyUnfetch
+  };
 
   VfsRdOnlyFile *p = reinterpret_cast<VfsRdOnlyFile *>(pFile);
   CacheManager *cache_mgr =
@@ -276,7 +387,14 @@ static int VfsRdOnlyOpen(
     return SQLITE_IOERR;
 
   assert(zName && (zName[0] == '@'));
-  p->fd = String2Int64(string(&zName[1]));
+  if (zName[1] == '@') {
+    const int64_t fd_orig = String2Int64(string(&zName[2]));
+    if (fd_orig < 0)
+      return SQLITE_IOERR;
+    p->fd = cache_mgr->Dup(LookupFdMap(fd_orig));
+  } else {
+    p->fd = String2Int64(string(&zName[1]));
+  }
   if (p->fd < 0)
     return SQLITE_IOERR;
   int64_t size = cache_mgr->GetSize(p->fd);
@@ -294,10 +412,12 @@ static int VfsRdOnlyOpen(
   if (pOutFlags)
     *pOutFlags = flags;
   p->vfs_rdonly = reinterpret_cast<VfsRdOnly *>(vfs->pAppData);
-  p->base.pMethods = &io_methods;
+  MapFile(p);
+  p->base.pMethods = (p->mmap_ptr != NULL) ? &io_methods_mmap : &io_methods;
   perf::Inc(p->vfs_rdonly->no_open);
-  LogCvmfs(kLogSql, kLogDebug, "open sqlite3 catalog on fd %d, size %" PRIu64,
-           p->fd, p->size);
+  LogCvmfs(kLogSql, kLogDebug, "open sqlite3 catalog on fd %d, size %" PRIu64
+           " (mapped: %s)",
+           p->fd, p->size, (p->mmap_ptr != NULL) ? "yes" : "no");
   return SQLITE_OK;
 }
 
@@ -453,7 +573,8 @@ static int VfsRdOnlyGetLastError(
 bool RegisterVfsRdOnly(
   CacheManager *cache_mgr,
   perf::Statistics *statistics,
-  const VfsOptions options)
+  const VfsOptions options,
+  const bool use_mmap)
 {
   fd_from_ = new std::vector<int>();
   fd_to_ = new std::vector<int>();
@@ -492,6 +613,7 @@ bool RegisterVfsRdOnly(
   }
 
   vfs_rdonly->cache_mgr = cache_mgr;
+  vfs_rdonly->use_mmap = use_mmap;
   vfs_rdonly->n_access =
     statistics->Register("sqlite.n_access", "overall number of access() calls");
   vfs_rdonly->no_open =
@@ -510,6 +632,10 @@ bool RegisterVfsRdOnly(
     statistics->Register("sqlite.sz_sleep", "overall microseconds slept");
   vfs_rdonly->n_time =
     statistics->Register("sqlite.n_time", "overall number of time() calls");
+  vfs_rdonly->no_mmap =
+    statistics->Register("sqlite.no_mmap", "currently mapped sqlite files");
+  vfs_rdonly->n_fetch =
+    statistics->Register("sqlite.n_fetch", "overall number of mapped pages");
 
   return true;
 }
@@ -19,9 +19,16 @@ enum VfsOptions {
   kVfsOptDefault,  // the VFS becomes the default for new database connections.
 };
 
+/**
+ * With use_mmap, catalogs that are plain files in the cache are memory mapped
+ * and SQlite reads the pages directly from the mapping.  Every connection maps
+ * the file on its own, so RssFile counts the shared page cache pages once per
+ * connection; Pss_File in /proc/<pid>/smaps_rollup shows the actual share.
+ */
 bool RegisterVfsRdOnly(CacheManager *cache_mgr,
                        perf::Statistics *statistics,
-                       const VfsOptions options);
+                       const VfsOptions options,
+                       const bool use_mmap = false);
 bool UnregisterVfsRdOnly();
 
 /**
@@ -664,6 +664,7 @@ int swissknife::CommandSync::Main(const swissknife::ArgumentList &args) {
   }
 
   if (args.find('E') != args.end()) params.enforce_limits = true;
+  if (args.find('G') != args.end()) params.directory_digests = true;
   if (args.find('Q') != args.end()) {
     params.nested_kcatalog_limit = String2Uint64(*args.find('Q')->second);
   } else {
@@ -801,6 +802,7 @@ int swissknife::CommandSync::Main(const swissknife::ArgumentList &args) {
       params.root_kcatalog_limit, params.file_mbyte_limit, statistics(),
       params.is_balanced, params.max_weight, params.min_weight);
   catalog_manager.Init();
+  catalog_manager.SetDirectoryDigests(params.directory_digests);
 
   publish::SyncMediator mediator(&catalog_manager, &params, publish_statistics);
   LogCvmfs(kLogPublish, kLogStdout, "Processing changes...");
@@ -43,6 +43,7 @@ struct SyncParameters {
         branched_catalog(false),
         compression_alg(zlib::kZlibDefault),
         enforce_limits(false),
+        directory_digests(false),
         nested_kcatalog_limit(0),
         root_kcatalog_limit(0),
         file_mbyte_limit(0),
@@ -93,6 +94,7 @@ struct SyncParameters {
   bool branched_catalog;
   zlib::Algorithms compression_alg;
   bool enforce_limits;
+  bool directory_digests;
   unsigned nested_kcatalog_limit;
   unsigned root_kcatalog_limit;
   unsigned file_mbyte_limit;
@@ -303,6 +305,7 @@ class CommandSync : public Command {
     r.push_back(Parameter::Switch('y', "dry run"));
     r.push_back(Parameter::Switch('A', "autocatalog enabled/disabled"));
     r.push_back(Parameter::Switch('E', "enforce limits instead of warning"));
+    r.push_back(Parameter::Switch('G', "maintain directory digests"));
     r.push_back(Parameter::Switch('L', "enable HTTP redirects"));
     r.push_back(Parameter::Switch('V',
                                   "Publish format compatible with "
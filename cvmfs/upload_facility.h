@@ -328,7 +328,7 @@ class AbstractUploader
 
   virtual unsigned int GetNumberOfErrors() const = 0;
   static void RegisterPlugins();
-  void InitCounters(perf::StatisticsTemplate *statistics);
+  virtual void InitCounters(perf::StatisticsTemplate *statistics);
 
  protected:
   typedef Callbackable<UploaderResults>::CallbackTN *CallbackPtr;
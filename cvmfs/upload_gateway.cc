@@ -94,7 +94,13 @@ bool GatewayUploader::Initialize() {
   }
 
   return session_context_->Initialize(config_.api_url, session_token, key_id,
-                                      secret);
+                                      secret, ObjectPack::kDefaultLimit, 10,
+                                      GetNumTasks());
+}
+
+void GatewayUploader::InitCounters(perf::StatisticsTemplate *statistics) {
+  AbstractUploader::InitCounters(statistics);
+  session_context_->InitCounters(statistics);
 }
 
 bool GatewayUploader::FinalizeSession(bool commit,
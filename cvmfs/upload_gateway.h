@@ -66,6 +66,8 @@ class GatewayUploader : public AbstractUploader {
 
   virtual unsigned int GetNumberOfErrors() const;
 
+  virtual void InitCounters(perf::StatisticsTemplate *statistics);
+
  protected:
   virtual void DoUpload(const std::string& remote_path,
                         IngestionSource *source,
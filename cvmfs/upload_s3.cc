@@ -50,6 +50,8 @@ S3Uploader::S3Uploader(const SpoolerDefinition &spooler_definition)
   , num_parallel_uploads_(kDefaultNumParallelUploads)
   , num_retries_(kDefaultNumRetries)
   , timeout_sec_(kDefaultTimeoutSec)
+  , multipart_threshold_(kDefaultMultipartThreshold)
+  , multipart_part_size_(kDefaultMultipartPartSize)
   , authz_method_(s3fanout::kAuthzAwsV2)
   , peek_before_put_(true)
   , use_https_(false)
@@ -81,6 +83,8 @@ S3Uploader::S3Uploader(const SpoolerDefinition &spooler_definition)
   s3config.opt_backoff_init_ms = kDefaultBackoffInitMs;
   s3config.opt_backoff_max_ms = kDefaultBackoffMaxMs;
   s3config.x_amz_acl = x_amz_acl_;
+  s3config.multipart_threshold = multipart_threshold_;
+  s3config.multipart_part_size = multipart_part_size_;
 
   if (use_https_) {
     s3config.protocol = "https";
@@ -173,6 +177,18 @@ bool S3Uploader::ParseSpoolerDefinition(
   if (options_manager.GetValue("CVMFS_S3_TIMEOUT", &parameter)) {
     timeout_sec_ = String2Uint64(parameter);
   }
+  if (options_manager.GetValue("CVMFS_S3_MULTIPART_THRESHOLD", &parameter)) {
+    multipart_threshold_ = String2Uint64(parameter);
+  }
+  if (options_manager.GetValue("CVMFS_S3_MULTIPART_PART_SIZE", &parameter)) {
+    multipart_part_size_ = String2Uint64(parameter);
+    if (multipart_part_size_ < kMinMultipartPartSize) {
+      LogCvmfs(kLogUploadS3, kLogStderr,
+               "CVMFS_S3_MULTIPART_PART_SIZE must be at least %" PRIu64
+               " bytes", kMinMultipartPartSize);
+      return false;
+    }
+  }
   if (options_manager.GetValue("CVMFS_S3_REGION", &region_)) {
     authz_method_ = s3fanout::kAuthzAwsV4;
   }
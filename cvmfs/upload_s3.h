@@ -90,6 +90,13 @@ class S3Uploader : public AbstractUploader {
   static const unsigned kDefaultBackoffInitMs = 100;
   static const unsigned kDefaultBackoffMaxMs = 2000;
   static const unsigned kInMemoryObjectThreshold = 500*1024;  // 500KiB
+  static const uint64_t kDefaultMultipartThreshold = 256 * 1024 * 1024;
+  static const uint64_t kDefaultMultipartPartSize = 32 * 1024 * 1024;
+  /**
+   * S3 rejects the completion of uploads whose parts, except the last one,
+   * are smaller than 5 MiB
+   */
+  static const uint64_t kMinMultipartPartSize = 5 * 1024 * 1024;
 
   // Used to make the async HTTP requests synchronous in Peek() Create(),
   // and Upload() of single bits
@@ -126,6 +133,12 @@ class S3Uploader : public AbstractUploader {
   int num_parallel_uploads_;
   unsigned num_retries_;
   unsigned timeout_sec_;
+  /**
+   * Objects of at least this size are uploaded in parts, 0 disables multipart
+   * uploads
+   */
+  uint64_t multipart_threshold_;
+  uint64_t multipart_part_size_;
   std::string access_key_;
   std::string secret_key_;
   s3fanout::AuthzMethods authz_method_;
@@ -29,9 +29,7 @@ enum PipeType {
   kPipeWatchdogSupervisor,
   kPipeWatchdogPid,
   kPipeDetachedChild,
-  kPipeTest,
-  kPipeDownloadJobs,
-  kPipeDownloadJobsResults
+  kPipeTest
 };
 
 /**
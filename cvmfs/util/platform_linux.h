@@ -13,14 +13,17 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <linux/futex.h>
 #include <mntent.h>
 #include <pthread.h>
 #include <signal.h>
+#include <sys/eventfd.h>
 #include <sys/file.h>
 #include <sys/mount.h>
 #include <sys/prctl.h>
 #include <sys/select.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/utsname.h>
 #include <unistd.h>
 
@@ -157,6 +160,52 @@ inline void platform_spinlock_unlock(platform_spinlock *lock) {
   pthread_spin_unlock(lock);
 }
 
+/**
+ * Blocks while *addr == expected.  May return spuriously.
+ */
+inline void platform_futex_wait(volatile int32_t *addr,
+                                int32_t expected) {
+  syscall(SYS_futex, const_cast<int32_t *>(addr), FUTEX_WAIT_PRIVATE,
+          expected, NULL, NULL, 0);
+}
+
+/**
+ * Wakes up all the threads waiting on addr.
+ */
+inline void platform_futex_wake(volatile int32_t *addr) {
+  syscall(SYS_futex, const_cast<int32_t *>(addr), FUTEX_WAKE_PRIVATE,
+          INT_MAX, NULL, NULL, 0);
+}
+
+/**
+ * A wake-up channel for an event loop: an eventfd on Linux, a pipe on macOS.
+ * fds[0] is polled, fds[1] is signaled.  Both ends are non-blocking.
+ */
+inline bool platform_wakeup_create(int fds[2]) {
+  fds[0] = fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  return fds[0] >= 0;
+}
+
+inline void platform_wakeup_signal(int fd) {
+  const uint64_t one = 1;
+  int retval;
+  do {
+    retval = write(fd, &one, sizeof(one));
+  } while ((retval < 0) && (errno == EINTR));
+}
+
+inline void platform_wakeup_drain(int fd) {
+  uint64_t value;
+  int retval;
+  do {
+    retval = read(fd, &value, sizeof(value));
+  } while ((retval < 0) && (errno == EINTR));
+}
+
+inline void platform_wakeup_destroy(int fds[2]) {
+  close(fds[0]);
+}
+
 /**
  * pthread_self() is not necessarily an unsigned long.
  */
@@ -218,6 +267,13 @@ inline int platform_fstat(int filedes, platform_stat64 *buf) {
   return fstat64(filedes, buf);
 }
 
+/**
+ * Reserves the first size bytes of the file.  Returns 0 or an errno value.
+ */
+inline int platform_fallocate(int filedes, uint64_t size) {
+  return posix_fallocate(filedes, 0, size);
+}
+
 // TODO(jblomer): the translation from C to C++ should be done elsewhere
 inline bool platform_getxattr(const std::string &path, const std::string &name,
                               std::string *value) {
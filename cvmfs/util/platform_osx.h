@@ -9,6 +9,7 @@
 
 #include <alloca.h>
 #include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
 #if defined(__MAC_OS_X_VERSION_MIN_REQUIRED) && \
     __MAC_OS_X_VERSION_MIN_REQUIRED >= 101200
@@ -28,6 +29,7 @@
 #include <sys/types.h>
 #include <sys/ucred.h>
 #include <sys/xattr.h>
+#include <unistd.h>
 
 #include <cassert>
 #include <cstdio>
@@ -124,6 +126,59 @@ inline void platform_spinlock_unlock(platform_spinlock *lock) {
 
 #endif
 
+/**
+ * Futexes are available through the private __ulock interface, which is what
+ * libc++ uses for std::atomic::wait().
+ */
+extern "C" int __ulock_wait(uint32_t operation, void *addr, uint64_t value,
+                            uint32_t timeout);
+extern "C" int __ulock_wake(uint32_t operation, void *addr,
+                            uint64_t wake_value);
+#define CVMFS_UL_COMPARE_AND_WAIT 1
+#define CVMFS_ULF_WAKE_ALL 0x00000100
+
+inline void platform_futex_wait(volatile int32_t *addr,
+                                int32_t expected) {
+  __ulock_wait(CVMFS_UL_COMPARE_AND_WAIT, const_cast<int32_t *>(addr),
+               expected, 0);
+}
+
+inline void platform_futex_wake(volatile int32_t *addr) {
+  __ulock_wake(CVMFS_UL_COMPARE_AND_WAIT | CVMFS_ULF_WAKE_ALL,
+               const_cast<int32_t *>(addr), 0);
+}
+
+/**
+ * No eventfd on macOS, use a non-blocking pipe.
+ */
+inline bool platform_wakeup_create(int fds[2]) {
+  if (pipe(fds) != 0)
+    return false;
+  for (unsigned i = 0; i < 2; ++i) {
+    fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+    fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+  }
+  return true;
+}
+
+inline void platform_wakeup_signal(int fd) {
+  const char c = 'w';
+  int retval;
+  do {
+    retval = write(fd, &c, 1);
+  } while ((retval < 0) && (errno == EINTR));
+}
+
+inline void platform_wakeup_drain(int fd) {
+  char buf[64];
+  while (read(fd, buf, sizeof(buf)) > 0) { }
+}
+
+inline void platform_wakeup_destroy(int fds[2]) {
+  close(fds[0]);
+  close(fds[1]);
+}
+
 /**
  * pthread_self() is not necessarily an unsigned long.
  */
@@ -170,6 +225,16 @@ inline int platform_fstat(int filedes, platform_stat64 *buf) {
   return fstat(filedes, buf);
 }
 
+/**
+ * There is no posix_fallocate on macOS, the file is only extended.  Returns 0
+ * or an errno value.
+ */
+inline int platform_fallocate(int filedes, uint64_t size) {
+  if (ftruncate(filedes, size) != 0)
+    return errno;
+  return 0;
+}
+
 inline bool platform_getxattr(const std::string &path, const std::string &name,
                               std::string *value) {
   int size = 0;
@@ -0,0 +1,335 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include "cvmfs_config.h"
+#include "util/uring.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+#include "util/logging.h"
+#include "util/mutex.h"
+#include "util/platform.h"
+#include "util/pointer.h"
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup)
+#define CVMFS_HAS_IO_URING
+#endif
+
+
+int64_t IoUring::Request::Wait() {
+  while (atomic_read32(&done_) == 0)
+    platform_futex_wait(&done_, 0);
+  return result_;
+}
+
+
+#ifdef CVMFS_HAS_IO_URING
+
+/**
+ * The memory shared with the kernel
+ */
+struct IoUring::Ring {
+  Ring()
+    : fd(-1), sq_ptr(NULL), sq_size(0), cq_ptr(NULL), cq_size(0)
+    , sqes(NULL), sqes_size(0), sq_tail(NULL), sq_mask(0), sq_array(NULL)
+    , cq_head(NULL), cq_tail(NULL), cq_mask(0), cqes(NULL)
+  { }
+  ~Ring() {
+    if (sqes != NULL)
+      munmap(sqes, sqes_size);
+    if ((cq_ptr != NULL) && (cq_ptr != sq_ptr))
+      munmap(cq_ptr, cq_size);
+    if (sq_ptr != NULL)
+      munmap(sq_ptr, sq_size);
+    if (fd >= 0)
+      close(fd);
+  }
+
+  int Enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                   NULL, 0);
+  }
+
+  int fd;
+  void *sq_ptr;
+  size_t sq_size;
+  void *cq_ptr;
+  size_t cq_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+
+  unsigned *sq_tail;
+  unsigned sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+};
+
+
+IoUring *IoUring::Create(const unsigned queue_depth) {
+  assert(queue_depth > 0);
+  UniquePtr<Ring> ring(new Ring());
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring->fd = syscall(__NR_io_uring_setup, queue_depth, &params);
+  if (ring->fd < 0) {
+    LogCvmfs(kLogCvmfs, kLogDebug, "io_uring unavailable (%d)", errno);
+    return NULL;
+  }
+
+  ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_size = params.cq_off.cqes +
+                  params.cq_entries * sizeof(struct io_uring_cqe);
+  // Kernel headers older than 5.4 do not know about the shared ring mapping
+#ifdef IORING_FEAT_SINGLE_MMAP
+  const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+#else
+  const bool single_mmap = false;
+#endif
+  if (single_mmap) {
+    ring->sq_size = ring->cq_size = std::max(ring->sq_size, ring->cq_size);
+  }
+  void *ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ptr == MAP_FAILED)
+    return NULL;
+  ring->sq_ptr = ptr;
+  if (single_mmap) {
+    ring->cq_ptr = ring->sq_ptr;
+  } else {
+    ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ptr == MAP_FAILED)
+      return NULL;
+    ring->cq_ptr = ptr;
+  }
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ptr = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ptr == MAP_FAILED)
+    return NULL;
+  ring->sqes = static_cast<struct io_uring_sqe *>(ptr);
+
+  char *sq = static_cast<char *>(ring->sq_ptr);
+  ring->sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  ring->sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  ring->sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+  char *cq = static_cast<char *>(ring->cq_ptr);
+  ring->cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  ring->cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  ring->cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+  ring->cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+  IoUring *io_uring = new IoUring();
+  io_uring->ring_ = ring.Release();
+  // The completion queue has at least as many entries as the submission queue
+  io_uring->queue_depth_ = params.sq_entries;
+  int retval = pthread_create(&io_uring->thread_complete_, NULL, MainComplete,
+                              io_uring);
+  assert(retval == 0);
+  LogCvmfs(kLogCvmfs, kLogDebug, "io_uring with %u entries",
+           params.sq_entries);
+  return io_uring;
+}
+
+
+/**
+ * Reaps the completion queue until the NOP request without a Request object
+ * that is submitted on destruction.
+ */
+void *IoUring::MainComplete(void *data) {
+  IoUring *io_uring = reinterpret_cast<IoUring *>(data);
+  Ring *ring = io_uring->ring_;
+  bool stop = false;
+  while (!stop) {
+    int retval = ring->Enter(0, 1, IORING_ENTER_GETEVENTS);
+    if ((retval < 0) && (errno != EINTR)) {
+      LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogErr,
+               "io_uring completion failure (%d)", errno);
+      abort();
+    }
+
+    unsigned head = *ring->cq_head;
+    __sync_synchronize();
+    const unsigned tail = *ring->cq_tail;
+    unsigned num_completed = 0;
+    while (head != tail) {
+      struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+      Request *request = reinterpret_cast<Request *>(cqe->user_data);
+      if (request == NULL) {
+        stop = true;
+      } else {
+        request->result_ = cqe->res;
+        atomic_inc32(&request->done_);
+        platform_futex_wake(&request->done_);
+      }
+      head++;
+      num_completed++;
+    }
+    __sync_synchronize();
+    *ring->cq_head = head;
+
+    if (num_completed > 0) {
+      MutexLockGuard m(&io_uring->lock_);
+      io_uring->num_inflight_ -= num_completed;
+      pthread_cond_broadcast(&io_uring->cond_space_);
+    }
+  }
+  return NULL;
+}
+
+
+/**
+ * Submits a single request.  There is no kernel-side polling, so the kernel
+ * only looks at the submission queue during io_uring_enter().
+ */
+bool IoUring::Submit(
+  const uint8_t opcode,
+  int fd,
+  uint64_t offset,
+  Request *request)
+{
+  MutexLockGuard m(&lock_);
+  while (num_inflight_ >= queue_depth_)
+    pthread_cond_wait(&cond_space_, &lock_);
+
+  const unsigned tail = *ring_->sq_tail;
+  const unsigned index = tail & ring_->sq_mask;
+  struct io_uring_sqe *sqe = &ring_->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->off = offset;
+  if (request != NULL) {
+    sqe->addr = reinterpret_cast<uintptr_t>(&request->iov_);
+    sqe->len = 1;
+  }
+  sqe->user_data = reinterpret_cast<uintptr_t>(request);
+  ring_->sq_array[index] = index;
+  __sync_synchronize();
+  *ring_->sq_tail = tail + 1;
+  __sync_synchronize();
+
+  int retval;
+  do {
+    retval = ring_->Enter(1, 0, 0);
+  } while ((retval < 0) && ((errno == EINTR) || (errno == EAGAIN)));
+  if (retval != 1) {
+    // Take back the entry, nobody else submits in the meantime
+    *ring_->sq_tail = tail;
+    LogCvmfs(kLogCvmfs, kLogDebug, "io_uring submission failure (%d)", errno);
+    return false;
+  }
+  num_inflight_++;
+  return true;
+}
+
+
+IoUring::~IoUring() {
+  bool retval = Submit(IORING_OP_NOP, -1, 0, NULL);
+  assert(retval);
+  pthread_join(thread_complete_, NULL);
+  delete ring_;
+  pthread_cond_destroy(&cond_space_);
+  pthread_mutex_destroy(&lock_);
+}
+
+
+bool IoUring::SubmitRead(
+  int fd,
+  void *buf,
+  uint64_t size,
+  uint64_t offset,
+  Request *request)
+{
+  atomic_init32(&request->done_);
+  request->iov_.iov_base = buf;
+  request->iov_.iov_len = size;
+  return Submit(IORING_OP_READV, fd, offset, request);
+}
+
+
+bool IoUring::SubmitWrite(
+  int fd,
+  const void *buf,
+  uint64_t size,
+  uint64_t offset,
+  Request *request)
+{
+  atomic_init32(&request->done_);
+  request->iov_.iov_base = const_cast<void *>(buf);
+  request->iov_.iov_len = size;
+  return Submit(IORING_OP_WRITEV, fd, offset, request);
+}
+
+#else  // CVMFS_HAS_IO_URING
+
+struct IoUring::Ring { };
+
+IoUring *IoUring::Create(const unsigned queue_depth) {
+  LogCvmfs(kLogCvmfs, kLogDebug, "io_uring not supported on this platform");
+  return NULL;
+}
+
+IoUring::~IoUring() {
+  pthread_cond_destroy(&cond_space_);
+  pthread_mutex_destroy(&lock_);
+}
+
+bool IoUring::SubmitRead(int fd, void *buf, uint64_t size, uint64_t offset,
+                         Request *request)
+{
+  return false;
+}
+
+bool IoUring::SubmitWrite(int fd, const void *buf, uint64_t size,
+                          uint64_t offset, Request *request)
+{
+  return false;
+}
+
+#endif  // CVMFS_HAS_IO_URING
+
+
+IoUring::IoUring() : ring_(NULL), queue_depth_(0), num_inflight_(0) {
+  int retval = pthread_mutex_init(&lock_, NULL);
+  assert(retval == 0);
+  retval = pthread_cond_init(&cond_space_, NULL);
+  assert(retval == 0);
+}
+
+
+int64_t IoUring::Pread(int fd, void *buf, uint64_t size, uint64_t offset) {
+  Request request;
+  if (!SubmitRead(fd, buf, size, offset, &request))
+    return -EIO;
+  return request.Wait();
+}
+
+
+int64_t IoUring::Pwrite(
+  int fd,
+  const void *buf,
+  uint64_t size,
+  uint64_t offset)
+{
+  Request request;
+  if (!SubmitWrite(fd, buf, size, offset, &request))
+    return -EIO;
+  return request.Wait();
+}
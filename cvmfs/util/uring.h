@@ -0,0 +1,89 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#ifndef CVMFS_UTIL_URING_H_
+#define CVMFS_UTIL_URING_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "util/atomic.h"
+#include "util/export.h"
+#include "util/single_copy.h"
+
+/**
+ * Thin wrapper around the io_uring system calls of Linux, without depending on
+ * liburing.  Any thread can submit reads and writes; a completion thread reaps
+ * the completion queue and wakes up the submitters of the finished requests.
+ * This way, the submitting thread can go on (e.g. with the next download
+ * buffer) while the kernel writes the previous one.
+ *
+ * Only the vectored read and write operations are used, which are available
+ * since the first kernel version that supports io_uring.  Create() returns
+ * NULL if io_uring is unavailable at build time or at runtime.
+ */
+class CVMFS_EXPORT IoUring : SingleCopy {
+ public:
+  static const unsigned kDefaultQueueDepth = 64;
+
+  /**
+   * A submitted read or write.  Owned by the submitter; the request and the
+   * buffer must stay valid until Wait() returned.  Can be reused afterwards.
+   */
+  class Request : SingleCopy {
+    friend class IoUring;
+   public:
+    Request() : result_(0) { atomic_init32(&done_); }
+    /**
+     * Returns the number of transferred bytes or -errno.
+     */
+    int64_t Wait();
+    bool IsDone() { return atomic_read32(&done_) != 0; }
+
+   private:
+    struct iovec iov_;
+    atomic_int32 done_;
+    int64_t result_;
+  };
+
+  static IoUring *Create(const unsigned queue_depth);
+  ~IoUring();
+
+  /**
+   * Queue a request; blocks while the submission queue is full.  Returns
+   * false if the request could not be queued.
+   */
+  bool SubmitWrite(int fd, const void *buf, uint64_t size, uint64_t offset,
+                   Request *request);
+  bool SubmitRead(int fd, void *buf, uint64_t size, uint64_t offset,
+                  Request *request);
+
+  /**
+   * Blocking convenience versions, mostly for testing
+   */
+  int64_t Pwrite(int fd, const void *buf, uint64_t size, uint64_t offset);
+  int64_t Pread(int fd, void *buf, uint64_t size, uint64_t offset);
+
+  unsigned queue_depth() const { return queue_depth_; }
+
+ private:
+  struct Ring;
+
+  IoUring();
+  bool Submit(const uint8_t opcode, int fd, uint64_t offset, Request *request);
+  static void *MainComplete(void *data);
+
+  Ring *ring_;
+  unsigned queue_depth_;
+  /**
+   * Protects the submission queue and the number of requests in flight
+   */
+  pthread_mutex_t lock_;
+  pthread_cond_t cond_space_;
+  unsigned num_inflight_;
+  pthread_t thread_complete_;
+};
+
+#endif  // CVMFS_UTIL_URING_H_
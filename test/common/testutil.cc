@@ -387,6 +387,19 @@ bool MockCatalog::LookupPath(const PathString &path,
   return false;
 }
 
+void MockCatalog::LookupPaths(
+  const std::vector<PathString> &paths,
+  std::vector<catalog::DirectoryEntry> *dirents) const
+{
+  dirents->assign(paths.size(),
+                  catalog::DirectoryEntry(catalog::kDirentNegative));
+  for (unsigned i = 0; i < paths.size(); ++i) {
+    catalog::DirectoryEntry dirent;
+    if (LookupPath(paths[i], &dirent))
+      (*dirents)[i] = dirent;
+  }
+}
+
 bool MockCatalog::ListingPath(const PathString &path,
                  catalog::DirectoryEntryList *listing,
                  const bool /* expand_symlink */) const {
@@ -439,16 +439,25 @@ class MockCatalog : public MockObjectStorage<MockCatalog> {
   void RemoveChild(MockCatalog *child);
   catalog::InodeRange inode_range() const { return catalog::InodeRange(); }
   bool OpenDatabase(const std::string &db_path) {
+    OpenDatabaseUnlinked(db_path);
+    LinkToParent();
+    return true;
+  }
+  bool OpenDatabaseUnlinked(const std::string &db_path) {
     initialized_ = true;
+    return true;
+  }
+  void LinkToParent() {
     if (parent_ != NULL)
       parent_->AddChild(this);
-    return true;
   }
   uint64_t max_row_id() const { return std::numeric_limits<uint64_t>::max(); }
   void set_inode_range(const catalog::InodeRange value) { }
   void SetInodeAnnotation(catalog::InodeAnnotation *new_annotation) { }
   void SetOwnerMaps(const catalog::OwnerMap *uid_map,
                     const catalog::OwnerMap *gid_map) { }
+  void SetPathIndexBudget(catalog::PathIndexBudget *budget) { }
+  void EnablePathFilter(const catalog::PathFilterCounters *counters) { }
   bool IsInitialized() const { return initialized_; }
   MockCatalog* FindSubtree(const PathString &path);
   bool FindNested(const PathString &mountpoint,
@@ -458,6 +467,8 @@ class MockCatalog : public MockObjectStorage<MockCatalog> {
                                 LinkString *raw_symlink) const { return false; }
   bool LookupPath(const PathString &path,
                   catalog::DirectoryEntry *dirent) const;
+  void LookupPaths(const std::vector<PathString> &paths,
+                   std::vector<catalog::DirectoryEntry> *dirents) const;
   bool ListingPath(const PathString &path,
                    catalog::DirectoryEntryList *listing,
                    const bool expand_symlink) const;
@@ -0,0 +1,161 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#include <benchmark/benchmark.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <cassert>
+#include <string>
+#include <vector>
+
+#include "bm_util.h"
+#include "catalog.h"
+#include "catalog_sql.h"
+#include "crypto/hash.h"
+#include "shortstring.h"
+#include "util/mutex.h"
+#include "util/posix.h"
+#include "util/prng.h"
+#include "util/string.h"
+
+using namespace std;  // NOLINT
+
+/**
+ * A catalog with kNumDirs directories of kNumFiles files each, shared by all
+ * the benchmark threads.
+ */
+class BM_Catalog : public benchmark::Fixture {
+ protected:
+  virtual void SetUp(const benchmark::State &st) {
+    MutexLockGuard m(&lock_);
+    if (refcount_++ > 0)
+      return;
+
+    const string sandbox = CreateTempDir("/tmp/cvmfs_bm_catalog");
+    assert(!sandbox.empty());
+    const string db_path = sandbox + "/catalog.db";
+    catalog::CatalogDatabase *db = catalog::CatalogDatabase::Create(db_path);
+    assert(db != NULL);
+    bool retval = db->InsertInitialValues("", false, "");
+    assert(retval);
+    retval = db->BeginTransaction();
+    assert(retval);
+    for (unsigned i = 0; i < kNumDirs; ++i) {
+      const string dir = "/dir" + StringifyInt(i);
+      InsertEntry(db, "", "dir" + StringifyInt(i), S_IFDIR | 0755);
+      for (unsigned j = 0; j < kNumFiles; ++j) {
+        const string name = "file" + StringifyInt(j);
+        InsertEntry(db, dir, name, S_IFREG | 0644);
+        paths_.push_back(PathString(dir + "/" + name));
+      }
+    }
+    retval = db->CommitTransaction();
+    assert(retval);
+    delete db;
+
+    catalog_ = catalog::Catalog::AttachFreely("", db_path, shash::Any());
+    assert(catalog_ != NULL);
+  }
+
+  virtual void TearDown(const benchmark::State &st) {
+    MutexLockGuard m(&lock_);
+    if (--refcount_ > 0)
+      return;
+    const string sandbox = GetParentPath(catalog_->database_path());
+    delete catalog_;
+    catalog_ = NULL;
+    paths_.clear();
+    RemoveTree(sandbox);
+  }
+
+  static void InsertEntry(catalog::CatalogDatabase *db,
+                          const string &parent,
+                          const string &name,
+                          const unsigned mode)
+  {
+    catalog::SqlCatalog sql(*db,
+      "INSERT INTO catalog (md5path_1, md5path_2, parent_1, parent_2, "
+      "hardlinks, hash, size, mode, mtime, flags, name, symlink, uid, gid) "
+      "VALUES (:md5_1, :md5_2, :p_1, :p_2, 1, NULL, 0, :mode, 0, :flags, "
+      ":name, '', 0, 0);");
+    uint64_t p1, p2;
+    shash::Md5(shash::AsciiPtr(parent + "/" + name)).ToIntPair(&p1, &p2);
+    sql.BindInt64(1, p1);
+    sql.BindInt64(2, p2);
+    shash::Md5(shash::AsciiPtr(parent)).ToIntPair(&p1, &p2);
+    sql.BindInt64(3, p1);
+    sql.BindInt64(4, p2);
+    sql.BindInt64(5, mode);
+    sql.BindInt64(6, S_ISDIR(mode) ? catalog::SqlDirent::kFlagDir
+                                   : catalog::SqlDirent::kFlagFile);
+    sql.BindTextTransient(7, name);
+    const bool retval = sql.Execute();
+    assert(retval);
+  }
+
+  static const unsigned kNumDirs = 10;
+  static const unsigned kNumFiles = 1000;
+
+  static pthread_mutex_t lock_;
+  static unsigned refcount_;
+  static vector<PathString> paths_;
+  static catalog::Catalog *catalog_;
+};
+
+pthread_mutex_t BM_Catalog::lock_ = PTHREAD_MUTEX_INITIALIZER;
+unsigned BM_Catalog::refcount_ = 0;
+vector<PathString> BM_Catalog::paths_;
+catalog::Catalog *BM_Catalog::catalog_ = NULL;
+
+
+BENCHMARK_DEFINE_F(BM_Catalog, LookupPath)(benchmark::State &st) {
+  Prng prng;
+  prng.InitLocaltime();
+  catalog::DirectoryEntry dirent;
+  while (st.KeepRunning()) {
+    const bool found =
+      catalog_->LookupPath(paths_[prng.Next(paths_.size())], &dirent);
+    assert(found);
+    Escape(&dirent);
+  }
+  st.SetItemsProcessed(st.iterations());
+}
+BENCHMARK_REGISTER_F(BM_Catalog, LookupPath)->Repetitions(3)->UseRealTime()
+  ->Threads(1)->Threads(2)->Threads(4)->Threads(8)->Threads(16);
+
+
+BENCHMARK_DEFINE_F(BM_Catalog, LookupDirectory)(benchmark::State &st) {
+  Prng prng;
+  prng.InitLocaltime();
+  catalog::DirectoryEntry dirent;
+  while (st.KeepRunning()) {
+    const unsigned offset = prng.Next(kNumDirs) * kNumFiles;
+    for (unsigned i = 0; i < kNumFiles; ++i) {
+      const bool found = catalog_->LookupPath(paths_[offset + i], &dirent);
+      assert(found);
+      Escape(&dirent);
+    }
+  }
+  st.SetItemsProcessed(st.iterations() * kNumFiles);
+}
+BENCHMARK_REGISTER_F(BM_Catalog, LookupDirectory)->Repetitions(3)
+  ->UseRealTime()->Threads(1)->Threads(2)->Threads(4)->Threads(8);
+
+
+BENCHMARK_DEFINE_F(BM_Catalog, LookupPathsDirectory)(benchmark::State &st) {
+  Prng prng;
+  prng.InitLocaltime();
+  vector<catalog::DirectoryEntry> dirents;
+  while (st.KeepRunning()) {
+    const unsigned offset = prng.Next(kNumDirs) * kNumFiles;
+    const vector<PathString> directory(paths_.begin() + offset,
+                                       paths_.begin() + offset + kNumFiles);
+    catalog_->LookupPaths(directory, &dirents);
+    assert(!dirents[0].IsNegative());
+    Escape(&dirents);
+  }
+  st.SetItemsProcessed(st.iterations() * kNumFiles);
+}
+BENCHMARK_REGISTER_F(BM_Catalog, LookupPathsDirectory)->Repetitions(3)
+  ->UseRealTime()->Threads(1)->Threads(2)->Threads(4)->Threads(8);
@@ -0,0 +1,116 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#include <benchmark/benchmark.h>
+#include <pthread.h>
+
+#include <cassert>
+
+#include "bm_util.h"
+#include "crypto/hash.h"
+#include "file_chunk.h"
+#include "shortstring.h"
+#include "util/mutex.h"
+#include "util/prng.h"
+
+/**
+ * Chunk tables with kNumFiles open chunked files, shared by all the benchmark
+ * threads.  Every iteration does the chunk table bookkeeping of a cvmfs_read()
+ * call on a random file, without the actual data access.
+ */
+class BM_ChunkTables : public benchmark::Fixture {
+ protected:
+  virtual void SetUp(const benchmark::State &st) {
+    MutexLockGuard m(&lock_);
+    if (refcount_++ > 0)
+      return;
+
+    chunk_tables_ = new ChunkTables();
+    for (unsigned i = 0; i < kNumFiles; ++i) {
+      const uint64_t inode = 1000 + i;
+      FileChunkList *list = new FileChunkList();
+      for (unsigned j = 0; j < kNumChunks; ++j) {
+        list->PushBack(FileChunk(shash::Any(shash::kSha1), j * kChunkSize,
+                                 kChunkSize));
+      }
+      ChunkTables::Shard *inode_shard = chunk_tables_->Inode2Shard(inode);
+      inode_shard->inode2chunks.Insert(
+        inode, FileChunkReflist(list, PathString("/chunked"),
+                                zlib::kZlibDefault, false));
+      inode_shard->inode2references.Insert(inode, 1);
+
+      const uint64_t handle = chunk_tables_->NextHandle();
+      ChunkTables::Shard *handle_shard = chunk_tables_->Handle2Shard(handle);
+      handle_shard->handle2fd.Insert(handle, ChunkFd());
+      handle_shard->handle2uniqino.Insert(handle, inode);
+      handles_[i] = handle;
+    }
+  }
+
+  virtual void TearDown(const benchmark::State &st) {
+    MutexLockGuard m(&lock_);
+    if (--refcount_ > 0)
+      return;
+    for (unsigned i = 0; i < kNumFiles; ++i) {
+      FileChunkReflist chunks;
+      chunk_tables_->Inode2Shard(1000 + i)->inode2chunks.Lookup(1000 + i,
+                                                                &chunks);
+      delete chunks.list;
+    }
+    delete chunk_tables_;
+    chunk_tables_ = NULL;
+  }
+
+  static const unsigned kNumFiles = 1024;
+  static const unsigned kNumChunks = 16;
+  static const unsigned kChunkSize = 4 * 1024 * 1024;
+
+  static pthread_mutex_t lock_;
+  static unsigned refcount_;
+  static ChunkTables *chunk_tables_;
+  static uint64_t handles_[kNumFiles];
+};
+
+pthread_mutex_t BM_ChunkTables::lock_ = PTHREAD_MUTEX_INITIALIZER;
+unsigned BM_ChunkTables::refcount_ = 0;
+ChunkTables *BM_ChunkTables::chunk_tables_ = NULL;
+uint64_t BM_ChunkTables::handles_[BM_ChunkTables::kNumFiles];
+
+
+BENCHMARK_DEFINE_F(BM_ChunkTables, Read)(benchmark::State &st) {
+  Prng prng;
+  prng.InitLocaltime();
+  while (st.KeepRunning()) {
+    const uint64_t chunk_handle = handles_[prng.Next(kNumFiles)];
+    uint64_t unique_inode;
+    ChunkFd chunk_fd;
+    FileChunkReflist chunks;
+
+    MutexLockGuard m(chunk_tables_->Handle2Lock(chunk_handle));
+    ChunkTables::Shard *handle_shard =
+      chunk_tables_->Handle2Shard(chunk_handle);
+    handle_shard->Lock();
+    bool retval =
+      handle_shard->handle2uniqino.Lookup(chunk_handle, &unique_inode);
+    assert(retval);
+    retval = handle_shard->handle2fd.Lookup(chunk_handle, &chunk_fd);
+    assert(retval);
+    handle_shard->Unlock();
+    ChunkTables::Shard *inode_shard = chunk_tables_->Inode2Shard(unique_inode);
+    inode_shard->Lock();
+    retval = inode_shard->inode2chunks.Lookup(unique_inode, &chunks);
+    assert(retval);
+    inode_shard->Unlock();
+
+    chunk_fd.chunk_idx =
+      chunks.FindChunkIdx(prng.Next(kNumChunks * kChunkSize));
+    Escape(&chunk_fd);
+
+    handle_shard->Lock();
+    handle_shard->handle2fd.Insert(chunk_handle, chunk_fd);
+    handle_shard->Unlock();
+  }
+  st.SetItemsProcessed(st.iterations());
+}
+BENCHMARK_REGISTER_F(BM_ChunkTables, Read)->Repetitions(3)->UseRealTime()
+  ->Threads(1)->Threads(2)->Threads(4)->Threads(8)->Threads(16);
@@ -10,11 +10,16 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <string>
 
 #include "bm_util.h"
 #include "util/platform.h"
 #include "util/posix.h"
+#include "util/uring.h"
 
 class BM_Syscalls : public benchmark::Fixture {
  protected:
@@ -451,3 +456,210 @@ BENCHMARK_DEFINE_F(BM_Syscalls, SocketFdRead)(benchmark::State &st) {
 }
 BENCHMARK_REGISTER_F(BM_Syscalls, SocketFdRead)->Repetitions(3)->
   UseRealTime()->Arg(4*1024)->Arg(128*1024)->Arg(1024*1024);
+
+
+/**
+ * Sequential reads of a cached file as in cvmfs_read(): the data is either
+ * copied through a user space buffer or spliced from the file.  A pipe stands
+ * in for the fuse device; it is drained into /dev/null.
+ */
+class BM_CachedRead : public benchmark::Fixture {
+ protected:
+  static const unsigned kFileSize = 64 * 1024 * 1024;
+
+  virtual void SetUp(const benchmark::State &st) {
+    path_ = CreateTempPath("./cvmfs_bench_cached_read", 0600);
+    assert(!path_.empty());
+    int fd = open(path_.c_str(), O_WRONLY);
+    assert(fd >= 0);
+    std::string block(1024 * 1024, 'x');
+    for (unsigned i = 0; i < kFileSize / block.size(); ++i)
+      WritePipe(fd, block.data(), block.size());
+    close(fd);
+    fd_ = open(path_.c_str(), O_RDONLY);
+    assert(fd_ >= 0);
+    fd_null_ = open("/dev/null", O_WRONLY);
+    assert(fd_null_ >= 0);
+    MakePipe(pipe_);
+    int retval = fcntl(pipe_[1], F_SETPIPE_SZ, st.range(0));
+    assert(retval >= st.range(0));
+  }
+
+  virtual void TearDown(const benchmark::State &st) {
+    ClosePipe(pipe_);
+    close(fd_null_);
+    close(fd_);
+    unlink(path_.c_str());
+  }
+
+  void Drain(size_t size) {
+    while (size > 0) {
+      ssize_t nbytes =
+        splice(pipe_[0], NULL, fd_null_, NULL, size, SPLICE_F_MOVE);
+      assert(nbytes > 0);
+      size -= nbytes;
+    }
+  }
+
+  std::string path_;
+  int fd_;
+  int fd_null_;
+  int pipe_[2];
+};
+
+
+BENCHMARK_DEFINE_F(BM_CachedRead, Copy)(benchmark::State &st) {
+  const unsigned size = st.range(0);
+  char *buf = static_cast<char *>(malloc(size));
+  off_t offset = 0;
+  while (st.KeepRunning()) {
+    ssize_t nbytes = pread(fd_, buf, size, offset);
+    assert(nbytes == static_cast<ssize_t>(size));
+    WritePipe(pipe_[1], buf, nbytes);
+    Drain(nbytes);
+    offset = (offset + size) % kFileSize;
+  }
+  free(buf);
+  st.SetItemsProcessed(st.iterations());
+  st.SetBytesProcessed(int64_t(st.iterations()) * int64_t(size));
+}
+BENCHMARK_REGISTER_F(BM_CachedRead, Copy)->Repetitions(3)->
+  UseRealTime()->Arg(128*1024)->Arg(1024*1024);
+
+
+BENCHMARK_DEFINE_F(BM_CachedRead, Splice)(benchmark::State &st) {
+  const unsigned size = st.range(0);
+  off_t offset = 0;
+  while (st.KeepRunning()) {
+    size_t remaining = size;
+    while (remaining > 0) {
+      ssize_t nbytes =
+        splice(fd_, &offset, pipe_[1], NULL, remaining, SPLICE_F_MOVE);
+      assert(nbytes > 0);
+      remaining -= nbytes;
+    }
+    Drain(size);
+    offset %= kFileSize;
+  }
+  st.SetItemsProcessed(st.iterations());
+  st.SetBytesProcessed(int64_t(st.iterations()) * int64_t(size));
+}
+BENCHMARK_REGISTER_F(BM_CachedRead, Splice)->Repetitions(3)->
+  UseRealTime()->Arg(128*1024)->Arg(1024*1024);
+
+
+/**
+ * Stores an object in the cache as a transaction does: the download delivers
+ * 16kB pieces that are collected in a buffer.  Full buffers are either written
+ * with write() or handed to io_uring while the next buffer is filled.
+ */
+class BM_CacheWrite : public benchmark::Fixture {
+ protected:
+  static const unsigned kPieceSize = 16 * 1024;
+  static const unsigned kNumBuffers = 4;
+  static const unsigned kBufferSize = 64 * 1024;
+
+  virtual void SetUp(const benchmark::State &st) {
+    path_ = CreateTempPath("./cvmfs_bench_cache_write", 0600);
+    assert(!path_.empty());
+    fd_ = open(path_.c_str(), O_WRONLY);
+    assert(fd_ >= 0);
+    piece_ = std::string(kPieceSize, 'x');
+  }
+
+  virtual void TearDown(const benchmark::State &st) {
+    close(fd_);
+    unlink(path_.c_str());
+  }
+
+  std::string path_;
+  int fd_;
+  std::string piece_;
+};
+
+
+BENCHMARK_DEFINE_F(BM_CacheWrite, Syscalls)(benchmark::State &st) {
+  const uint64_t size = st.range(0);
+  unsigned char buffer[4096];
+  while (st.KeepRunning()) {
+    int retval = ftruncate(fd_, 0);
+    assert(retval == 0);
+    lseek(fd_, 0, SEEK_SET);
+    unsigned pos = 0;
+    for (uint64_t written = 0; written < size; written += kPieceSize) {
+      for (unsigned i = 0; i < kPieceSize; ) {
+        if (pos == sizeof(buffer)) {
+          WritePipe(fd_, buffer, pos);
+          pos = 0;
+        }
+        const unsigned n = std::min(kPieceSize - i,
+          static_cast<unsigned>(sizeof(buffer)) - pos);
+        memcpy(buffer + pos, piece_.data() + i, n);
+        pos += n;
+        i += n;
+      }
+    }
+    WritePipe(fd_, buffer, pos);
+  }
+  st.SetItemsProcessed(st.iterations());
+  st.SetBytesProcessed(int64_t(st.iterations()) * int64_t(size));
+}
+BENCHMARK_REGISTER_F(BM_CacheWrite, Syscalls)->Repetitions(3)->
+  UseRealTime()->Arg(1024*1024)->Arg(16*1024*1024);
+
+
+BENCHMARK_DEFINE_F(BM_CacheWrite, IoUring)(benchmark::State &st) {
+  IoUring *io_uring = IoUring::Create(IoUring::kDefaultQueueDepth);
+  if (io_uring == NULL) {
+    st.SkipWithError("io_uring not available");
+    return;
+  }
+  const uint64_t size = st.range(0);
+  unsigned char *buffers[kNumBuffers];
+  IoUring::Request requests[kNumBuffers];
+  bool inflight[kNumBuffers];
+  for (unsigned i = 0; i < kNumBuffers; ++i) {
+    buffers[i] = static_cast<unsigned char *>(malloc(kBufferSize));
+    inflight[i] = false;
+  }
+
+  while (st.KeepRunning()) {
+    int retval = ftruncate(fd_, 0);
+    assert(retval == 0);
+    unsigned current = 0;
+    unsigned pos = 0;
+    uint64_t offset = 0;
+    for (uint64_t written = 0; written <= size; written += kPieceSize) {
+      if ((pos == kBufferSize) || (written == size)) {
+        io_uring->SubmitWrite(fd_, buffers[current], pos, offset,
+                              &requests[current]);
+        inflight[current] = true;
+        offset += pos;
+        pos = 0;
+        current = (current + 1) % kNumBuffers;
+        if (inflight[current]) {
+          requests[current].Wait();
+          inflight[current] = false;
+        }
+      }
+      if (written == size)
+        break;
+      memcpy(buffers[current] + pos, piece_.data(), kPieceSize);
+      pos += kPieceSize;
+    }
+    for (unsigned i = 0; i < kNumBuffers; ++i) {
+      if (inflight[i]) {
+        requests[i].Wait();
+        inflight[i] = false;
+      }
+    }
+  }
+
+  for (unsigned i = 0; i < kNumBuffers; ++i)
+    free(buffers[i]);
+  delete io_uring;
+  st.SetItemsProcessed(st.iterations());
+  st.SetBytesProcessed(int64_t(st.iterations()) * int64_t(size));
+}
+BENCHMARK_REGISTER_F(BM_CacheWrite, IoUring)->Repetitions(3)->
+  UseRealTime()->Arg(1024*1024)->Arg(16*1024*1024);
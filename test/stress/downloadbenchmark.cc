@@ -0,0 +1,212 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#include <pthread.h>
+#include <unistd.h>
+
+#include <climits>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "c_http_server.h"
+#include "crypto/hash.h"
+#include "network/download.h"
+#include "statistics.h"
+#include "util/atomic.h"
+#include "util/logging.h"
+#include "util/platform.h"
+#include "util/posix.h"
+#include "util/prng.h"
+#include "util/string.h"
+
+using namespace std;  // NOLINT
+
+/**
+ * Serves num_objects random objects from the local mock HTTP server and
+ * fetches them with a given number of concurrent client threads through the
+ * download manager.
+ */
+class DownloadTestScenario {
+ public:
+  DownloadTestScenario(const string &tmp_path, int port, int num_objects,
+                       int object_size);
+  ~DownloadTestScenario();
+
+  int Run(unsigned num_shards, unsigned num_threads);
+
+ private:
+  struct FetchThread {
+    DownloadTestScenario *scenario;
+    download::DownloadManager *download_mgr;
+    unsigned first;
+    unsigned stride;
+  };
+
+  static void *MainFetch(void *data);
+  void GenerateObjects();
+
+  string tmp_path_;
+  int port_;
+  int num_objects_;
+  int object_size_;
+  vector<string> urls_;
+  vector<shash::Any> hashes_;
+  atomic_int32 num_errors_;
+  Prng prng_;
+};
+
+DownloadTestScenario::DownloadTestScenario(
+  const string &tmp_path,
+  int port,
+  int num_objects,
+  int object_size)
+  : tmp_path_(tmp_path)
+  , port_(port)
+  , num_objects_(num_objects)
+  , object_size_(object_size)
+{
+  atomic_init32(&num_errors_);
+  prng_.InitLocaltime();
+  assert(MkdirDeep(tmp_path_, 0755, true));
+  GenerateObjects();
+}
+
+DownloadTestScenario::~DownloadTestScenario() {
+  assert(RemoveTree(tmp_path_));
+}
+
+void DownloadTestScenario::GenerateObjects() {
+  string data(object_size_, '\0');
+  for (int i = 0; i < num_objects_; ++i) {
+    for (int j = 0; j < object_size_; ++j)
+      data[j] = prng_.Next(UCHAR_MAX + 1);
+    const string name = "object" + StringifyInt(i);
+    assert(SafeWriteToFile(data, tmp_path_ + "/" + name, 0644));
+    urls_.push_back("http://127.0.0.1:" + StringifyInt(port_) + "/" + name);
+    hashes_.push_back(shash::Any(shash::kSha1));
+    shash::HashString(data, &hashes_[i]);
+  }
+}
+
+void *DownloadTestScenario::MainFetch(void *data) {
+  FetchThread *thread = static_cast<FetchThread *>(data);
+  DownloadTestScenario *scenario = thread->scenario;
+  for (unsigned i = thread->first; i < scenario->urls_.size();
+       i += thread->stride)
+  {
+    download::JobInfo info(&scenario->urls_[i], false /* compressed */,
+                           false /* probe hosts */, &scenario->hashes_[i]);
+    thread->download_mgr->Fetch(&info);
+    if (info.error_code != download::kFailOk)
+      atomic_inc32(&scenario->num_errors_);
+    free(info.destination_mem.data);
+  }
+  return NULL;
+}
+
+int DownloadTestScenario::Run(unsigned num_shards, unsigned num_threads) {
+  perf::Statistics statistics;
+  download::DownloadManager download_mgr;
+  download_mgr.Init(16, perf::StatisticsTemplate("download", &statistics),
+                    num_shards);
+  download_mgr.Spawn();
+  atomic_init32(&num_errors_);
+
+  vector<FetchThread> threads(num_threads);
+  vector<pthread_t> thread_ids(num_threads);
+  uint64_t start = platform_monotonic_time_ns();
+  for (unsigned i = 0; i < num_threads; ++i) {
+    threads[i].scenario = this;
+    threads[i].download_mgr = &download_mgr;
+    threads[i].first = i;
+    threads[i].stride = num_threads;
+    int retval = pthread_create(&thread_ids[i], NULL, MainFetch, &threads[i]);
+    assert(retval == 0);
+  }
+  for (unsigned i = 0; i < num_threads; ++i)
+    pthread_join(thread_ids[i], NULL);
+  uint64_t end = platform_monotonic_time_ns();
+  download_mgr.Fini();
+
+  if (atomic_read32(&num_errors_) > 0) {
+    LogCvmfs(kLogCvmfs, kLogStderr, "%d downloads failed",
+             atomic_read32(&num_errors_));
+    return 1;
+  }
+
+  double duration = (end - start) * 1e-9;
+  LogCvmfs(kLogCvmfs, kLogStdout, "%u shard(s), %u thread(s): %d objects "
+           "in %f seconds (%.1f objects/s)", num_shards, num_threads,
+           num_objects_, duration, num_objects_ / duration);
+  return 0;
+}
+
+void Usage() {
+  LogCvmfs(kLogCvmfs, kLogStderr,
+           "CVMFS download manager benchmark.\n"
+           "Serves random objects from a local mock HTTP server and fetches\n"
+           "them concurrently with the download manager, first with a single\n"
+           "download thread and then with the given number of shards.\n"
+           "Outputs the time duration of each run.\n\n"
+           "Usage: downloadbenchmark [-n num-objects] [-s object-size] "
+           "[-j fetch-threads] [-d shards] [-p port] [-t tmp-path] [-h]\n"
+           "Options:\n"
+           "  -n number of objects\n"
+           "  -s size of the objects\n"
+           "  -j number of concurrent client threads\n"
+           "  -d number of download shards of the sharded run\n"
+           "  -p port of the mock HTTP server\n"
+           "  -t temporary path for the served objects\n"
+           "  -h print this usage message\n");
+}
+
+int main(int argc, char *argv[]) {
+  string tmp_path = "/tmp/downloadbenchmark";
+  int num_objects = 10000, object_size = 4096, port = 8089;
+  unsigned num_threads = 64, num_shards = 4;
+
+  int c;
+  while ((c = getopt(argc, argv, "n:s:j:d:p:t:h")) != -1) {
+    switch (c) {
+      case 'n':
+        num_objects = atoi(optarg);
+        break;
+      case 's':
+        object_size = atoi(optarg);
+        break;
+      case 'j':
+        num_threads = atoi(optarg);
+        break;
+      case 'd':
+        num_shards = atoi(optarg);
+        break;
+      case 'p':
+        port = atoi(optarg);
+        break;
+      case 't':
+        tmp_path = string(optarg);
+        break;
+      case 'h':
+        Usage();
+        return 0;
+      case '?':
+      default:
+        Usage();
+        return 1;
+    }
+  }
+  if ((num_objects <= 0) || (object_size <= 0) || (num_threads == 0) ||
+      (num_shards == 0) || (port <= 0))
+  {
+    Usage();
+    return 1;
+  }
+
+  DownloadTestScenario scenario(tmp_path, port, num_objects, object_size);
+  MockFileServer file_server(port, tmp_path);
+  int retval = scenario.Run(1, num_threads);
+  if ((retval == 0) && (num_shards > 1))
+    retval = scenario.Run(num_shards, num_threads);
+  return retval;
+}
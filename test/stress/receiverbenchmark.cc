@@ -0,0 +1,211 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "crypto/hash.h"
+#include "pack.h"
+#include "receiver/params.h"
+#include "receiver/payload_processor.h"
+#include "util/logging.h"
+#include "util/platform.h"
+#include "util/posix.h"
+#include "util/prng.h"
+#include "util/smalloc.h"
+#include "util/string.h"
+
+using namespace std;  // NOLINT
+
+/**
+ * Unpacks into a local stratum 0 instead of the repository configured in
+ * /etc/cvmfs/repositories.d
+ */
+class LocalPayloadProcessor : public receiver::PayloadProcessor {
+ public:
+  LocalPayloadProcessor(const string &stratum0, unsigned num_upload_tasks)
+    : stratum0_(stratum0)
+    , num_upload_tasks_(num_upload_tasks)
+  { }
+
+  virtual Result Initialize() {
+    receiver::Params params;
+    params.spooler_configuration =
+      "local," + stratum0_ + "/data/txn," + stratum0_;
+    params.hash_alg = shash::kSha1;
+    params.compression_alg = zlib::kNoCompression;
+    params.generate_legacy_bulk_chunks = false;
+    params.use_file_chunking = true;
+    params.min_chunk_size = 4 * 1024 * 1024;
+    params.avg_chunk_size = 8 * 1024 * 1024;
+    params.max_chunk_size = 16 * 1024 * 1024;
+    params.num_upload_tasks = num_upload_tasks_;
+    return InitializeUploader(params);
+  }
+
+ private:
+  string stratum0_;
+  unsigned num_upload_tasks_;
+};
+
+class ReceiverTestScenario {
+ public:
+  ReceiverTestScenario(const string &tmp_path, int num_objects,
+                       int object_size);
+  ~ReceiverTestScenario();
+
+  int Run(unsigned num_upload_tasks);
+
+ private:
+  void GeneratePack();
+
+  string tmp_path_;
+  string pack_path_;
+  int num_objects_;
+  int object_size_;
+  shash::Any digest_;
+  unsigned header_size_;
+  Prng prng_;
+};
+
+ReceiverTestScenario::ReceiverTestScenario(
+  const string &tmp_path,
+  int num_objects,
+  int object_size)
+  : tmp_path_(tmp_path)
+  , pack_path_(tmp_path + "/payload.pack")
+  , num_objects_(num_objects)
+  , object_size_(object_size)
+  , digest_(shash::kSha1)
+  , header_size_(0)
+{
+  prng_.InitLocaltime();
+  assert(MkdirDeep(tmp_path_, 0755, true));
+  GeneratePack();
+}
+
+ReceiverTestScenario::~ReceiverTestScenario() {
+  assert(RemoveTree(tmp_path_));
+}
+
+void ReceiverTestScenario::GeneratePack() {
+  ObjectPack pack(uint64_t(num_objects_) * object_size_ + 1);
+  unsigned char *data = static_cast<unsigned char *>(smalloc(object_size_));
+  for (int i = 0; i < num_objects_; ++i) {
+    for (int j = 0; j < object_size_; ++j)
+      data[j] = prng_.Next(UCHAR_MAX + 1);
+    ObjectPack::BucketHandle bucket = pack.NewBucket();
+    ObjectPack::AddToBucket(data, object_size_, bucket);
+    shash::Any id(shash::kSha1);
+    shash::HashMem(data, object_size_, &id);
+    assert(pack.CommitBucket(ObjectPack::kCas, id, bucket));
+  }
+  free(data);
+
+  ObjectPackProducer serializer(&pack);
+  serializer.GetDigest(&digest_);
+  header_size_ = serializer.GetHeaderSize();
+  FILE *f = fopen(pack_path_.c_str(), "w");
+  assert(f != NULL);
+  vector<unsigned char> buffer(1024 * 1024);
+  unsigned nbytes;
+  while ((nbytes = serializer.ProduceNext(buffer.size(), &buffer[0])) > 0)
+    assert(fwrite(&buffer[0], 1, nbytes, f) == nbytes);
+  fclose(f);
+}
+
+int ReceiverTestScenario::Run(unsigned num_upload_tasks) {
+  const string stratum0 =
+    tmp_path_ + "/stratum0_" + StringifyInt(num_upload_tasks);
+  assert(MakeCacheDirectories(stratum0 + "/data", 0755));
+  assert(MkdirDeep(stratum0 + "/data/txn", 0755));
+
+  int fd = open(pack_path_.c_str(), O_RDONLY);
+  assert(fd >= 0);
+  LocalPayloadProcessor processor(stratum0, num_upload_tasks);
+  uint64_t start = platform_monotonic_time_ns();
+  receiver::PayloadProcessor::Result result = processor.Process(
+    fd, digest_.ToString(false), "receiverbenchmark", header_size_);
+  uint64_t end = platform_monotonic_time_ns();
+  close(fd);
+  assert(RemoveTree(stratum0));
+
+  if (result != receiver::PayloadProcessor::kSuccess) {
+    LogCvmfs(kLogCvmfs, kLogStderr, "Processing the payload failed (%d)",
+             result);
+    return 1;
+  }
+
+  double duration = (end - start) * 1e-9;
+  double mbytes =
+    static_cast<double>(num_objects_) * object_size_ / (1024 * 1024);
+  LogCvmfs(kLogCvmfs, kLogStdout, "%u upload task(s): %d objects, %.1f MB "
+           "in %f seconds (%.1f MB/s)", num_upload_tasks, num_objects_,
+           mbytes, duration, mbytes / duration);
+  return 0;
+}
+
+void Usage() {
+  LogCvmfs(kLogCvmfs, kLogStderr,
+           "CVMFS receiver payload benchmark.\n"
+           "Generates an object pack with random objects and unpacks it with\n"
+           "the receiver's PayloadProcessor into a local stratum 0, first\n"
+           "with a single upload task and then with the given number of\n"
+           "upload tasks (pipelined mode).\n"
+           "Outputs the time duration of each run.\n\n"
+           "Usage: receiverbenchmark [-n num-objects] [-s object-size] "
+           "[-u upload-tasks] [-t tmp-path] [-h]\n"
+           "Options:\n"
+           "  -n number of objects in the pack\n"
+           "  -s size of the objects\n"
+           "  -u number of upload tasks of the pipelined run\n"
+           "  -t temporary path for the pack and the stratum 0\n"
+           "  -h print this usage message\n");
+}
+
+int main(int argc, char *argv[]) {
+  string tmp_path = "/tmp/receiverbenchmark";
+  int num_objects = 1000, object_size = 1024 * 1024;
+  unsigned num_upload_tasks = 8;
+
+  int c;
+  while ((c = getopt(argc, argv, "n:s:u:t:h")) != -1) {
+    switch (c) {
+      case 'n':
+        num_objects = atoi(optarg);
+        break;
+      case 's':
+        object_size = atoi(optarg);
+        break;
+      case 'u':
+        num_upload_tasks = atoi(optarg);
+        break;
+      case 't':
+        tmp_path = string(optarg);
+        break;
+      case 'h':
+        Usage();
+        return 0;
+      case '?':
+      default:
+        Usage();
+        return 1;
+    }
+  }
+  if ((num_objects <= 0) || (object_size <= 0) || (num_upload_tasks == 0)) {
+    Usage();
+    return 1;
+  }
+
+  ReceiverTestScenario scenario(tmp_path, num_objects, object_size);
+  int retval = scenario.Run(1);
+  if ((retval == 0) && (num_upload_tasks > 1))
+    retval = scenario.Run(num_upload_tasks);
+  return retval;
+}
@@ -0,0 +1,312 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#include <gtest/gtest.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "compression.h"
+#include "crypto/hash.h"
+#include "libcvmfs.h"
+#include "shrinkwrap/fs_traversal_interface.h"
+#include "shrinkwrap/image/format.h"
+#include "shrinkwrap/image/interface.h"
+#include "shrinkwrap/image/reader.h"
+#include "util/pointer.h"
+#include "util/posix.h"
+#include "util/string.h"
+
+#include "testutil_shrinkwrap.h"
+
+using namespace shrinkwrap::image;  // NOLINT
+
+class T_FsImage : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    interface_ = image_get_interface();
+    const char *test_name
+      = ::testing::UnitTest::GetInstance()->current_test_info()->name();
+    image_path_ = std::string("./") + test_name + ".img";
+    interface_->context_ = interface_->initialize(test_name,
+      "./", image_path_.c_str(), NULL, 0);
+    ASSERT_TRUE(interface_->context_ != NULL);
+  }
+
+  virtual void TearDown() {
+    if (interface_->context_ != NULL)
+      interface_->finalize(interface_->context_);
+    interface_->context_ = NULL;
+    delete interface_;
+    interface_ = NULL;
+    unlink(image_path_.c_str());
+  }
+
+  void Finalize() {
+    interface_->finalize(interface_->context_);
+    interface_->context_ = NULL;
+  }
+
+  /**
+   * Touches, writes and links a file with the given content
+   */
+  void AddFile(const char *path, const std::string &content) {
+    shash::Any content_hash(shash::kSha1);
+    shash::HashString(content, &content_hash);
+    struct cvmfs_attr *stat = CreateSampleStat(GetFileName(path).c_str(), 0,
+      S_IFREG | 0644, content.length(), NULL, &content_hash);
+    char *ident = interface_->get_identifier(interface_->context_, stat);
+    if (interface_->touch(interface_->context_, stat) == 0) {
+      void *handle = interface_->get_handle(interface_->context_, ident);
+      EXPECT_EQ(0, interface_->do_fopen(handle, fs_open_write));
+      EXPECT_EQ(0, interface_->do_fwrite(handle, content.data(),
+                                         content.length()));
+      EXPECT_EQ(0, interface_->do_fclose(handle));
+      interface_->do_ffree(handle);
+    } else {
+      EXPECT_EQ(EEXIST, errno);
+    }
+    EXPECT_EQ(0, interface_->do_link(interface_->context_, path, ident));
+    free(ident);
+    cvmfs_attr_free(stat);
+  }
+
+  std::string ReadFile(const char *path) {
+    struct cvmfs_attr *stat = cvmfs_attr_init();
+    EXPECT_EQ(0, interface_->get_stat(interface_->context_, path, stat, true));
+    char *ident = interface_->get_identifier(interface_->context_, stat);
+    void *handle = interface_->get_handle(interface_->context_, ident);
+    EXPECT_EQ(0, interface_->do_fopen(handle, fs_open_read));
+    std::string result;
+    char buffer[1000];
+    size_t nbytes;
+    do {
+      EXPECT_EQ(0, interface_->do_fread(handle, buffer, sizeof(buffer),
+                                        &nbytes));
+      result.append(buffer, nbytes);
+    } while (nbytes == sizeof(buffer));
+    interface_->do_ffree(handle);
+    free(ident);
+    cvmfs_attr_free(stat);
+    return result;
+  }
+
+  struct fs_traversal *interface_;
+  std::string image_path_;
+};
+
+
+TEST_F(T_FsImage, Init) {
+  Finalize();
+  std::string image;
+  int fd = open(image_path_.c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  EXPECT_TRUE(SafeReadToString(fd, &image));
+  close(fd);
+  ASSERT_GE(image.size(), kImageDataOffset + kImageInodeSize);
+  EXPECT_EQ(0, memcmp(image.data(), kImageMagic, sizeof(kImageMagic)));
+  // The version is stored in little-endian byte order
+  EXPECT_EQ(std::string("\x01\x00\x00\x00", 4), image.substr(8, 4));
+
+  UniquePtr<ImageReader> reader(ImageReader::Open(image_path_));
+  ASSERT_TRUE(reader.IsValid());
+  EXPECT_EQ(kImageVersion, reader->superblock().version);
+  EXPECT_EQ(1U, reader->num_inodes());
+  EXPECT_EQ(0U, reader->superblock().num_extents);
+  EXPECT_TRUE(S_ISDIR(reader->inode(0).mode));
+  EXPECT_EQ(0U, reader->inode(0).count);
+
+  // Corrupt superblock
+  image[0] = 'X';
+  fd = open(image_path_.c_str(), O_WRONLY);
+  ASSERT_GE(fd, 0);
+  EXPECT_TRUE(SafeWrite(fd, image.data(), image.size()));
+  close(fd);
+  EXPECT_EQ(NULL, ImageReader::Open(image_path_));
+  EXPECT_EQ(NULL, ImageReader::Open(image_path_ + ".no-such-file"));
+}
+
+
+TEST_F(T_FsImage, FinalizeError) {
+  // The image tables cannot be written to /dev/full
+  struct fs_traversal_context *context = interface_->initialize("full",
+    "./", "/dev/full", NULL, 0);
+  ASSERT_TRUE(context != NULL);
+  EXPECT_EQ(-1, interface_->finalize(context));
+}
+
+
+TEST_F(T_FsImage, MkdirListDir) {
+  struct cvmfs_attr *stat = CreateSampleStat("dir", 0, S_IFDIR | 0755, 0,
+                                             NULL);
+  EXPECT_EQ(0, interface_->do_mkdir(interface_->context_, "/dir", stat));
+  EXPECT_EQ(-1, interface_->do_mkdir(interface_->context_, "/dir", stat));
+  EXPECT_EQ(EEXIST, errno);
+  EXPECT_EQ(-1, interface_->do_mkdir(interface_->context_, "/no/dir", stat));
+  EXPECT_EQ(ENOENT, errno);
+  EXPECT_EQ(0, interface_->do_mkdir(interface_->context_, "/dir/sub", stat));
+  AddFile("/dir/file", "content");
+  cvmfs_attr_free(stat);
+
+  size_t len = 0;
+  char **list;
+  interface_->list_dir(interface_->context_, "/dir", &list, &len);
+  EXPECT_EQ(2U, len);
+  ExpectListHas("sub", list);
+  ExpectListHas("file", list);
+  FreeList(list, len);
+
+  EXPECT_EQ(-1, interface_->do_rmdir(interface_->context_, "/dir"));
+  EXPECT_EQ(ENOTEMPTY, errno);
+  EXPECT_EQ(0, interface_->do_unlink(interface_->context_, "/dir/file"));
+  EXPECT_EQ(0, interface_->do_rmdir(interface_->context_, "/dir/sub"));
+  EXPECT_EQ(0, interface_->do_rmdir(interface_->context_, "/dir"));
+  interface_->list_dir(interface_->context_, "", &list, &len);
+  EXPECT_EQ(0U, len);
+  FreeList(list, len);
+}
+
+
+TEST_F(T_FsImage, ReadWriteDedup) {
+  std::string large;
+  for (unsigned i = 0; i < 3 * kImageDefaultBlockSize / 16; ++i)
+    large += StringifyInt(i % 10000) + "-abcdefghijkl";
+  AddFile("/large", large);
+  AddFile("/small", "small content");
+  AddFile("/copy", "small content");
+  EXPECT_EQ(large, ReadFile("/large"));
+  EXPECT_EQ("small content", ReadFile("/small"));
+  EXPECT_EQ("small content", ReadFile("/copy"));
+
+  struct cvmfs_attr *stat = cvmfs_attr_init();
+  EXPECT_EQ(0, interface_->get_stat(interface_->context_, "/large", stat,
+                                    true));
+  EXPECT_TRUE(S_ISREG(stat->st_mode));
+  EXPECT_EQ(large.length(), static_cast<size_t>(stat->st_size));
+  EXPECT_TRUE(interface_->is_hash_consistent(interface_->context_, stat));
+  cvmfs_attr_free(stat);
+
+  Finalize();
+  UniquePtr<ImageReader> reader(ImageReader::Open(image_path_));
+  ASSERT_TRUE(reader.IsValid());
+  ASSERT_EQ(4U, reader->num_inodes());
+  // Compressed, and the duplicate content is stored only once
+  EXPECT_LT(reader->superblock().data_size, large.length());
+  // Sorted by name: copy, large, small
+  EXPECT_EQ("copy", reader->GetName(1));
+  EXPECT_EQ("large", reader->GetName(2));
+  EXPECT_EQ("small", reader->GetName(3));
+  EXPECT_EQ(reader->inode(1).first, reader->inode(3).first);
+  EXPECT_EQ(4U, reader->inode(2).count);
+  EXPECT_EQ(reader->inode(2).count + 1, reader->superblock().num_extents);
+
+  uint64_t inode;
+  std::string content;
+  EXPECT_TRUE(reader->Lookup("/large", &inode));
+  EXPECT_EQ(2U, inode);
+  EXPECT_TRUE(reader->ReadFile(inode, &content));
+  EXPECT_EQ(large, content);
+  EXPECT_TRUE(reader->Lookup("/copy", &inode));
+  EXPECT_TRUE(reader->ReadFile(inode, &content));
+  EXPECT_EQ("small content", content);
+  EXPECT_FALSE(reader->Lookup("/none", &inode));
+}
+
+
+TEST_F(T_FsImage, RoundTrip) {
+  struct cvmfs_attr *stat = CreateSampleStat("dir", 0, S_IFDIR | 0750, 0,
+                                             NULL);
+  EXPECT_EQ(0, interface_->do_mkdir(interface_->context_, "/dir", stat));
+  EXPECT_EQ(0, interface_->do_mkdir(interface_->context_, "/dir/sub", stat));
+  EXPECT_EQ(0, interface_->do_mkdir(interface_->context_, "/empty", stat));
+  cvmfs_attr_free(stat);
+  stat = CreateSampleStat("link", 0, S_IFLNK | 0777, 0, NULL, NULL, "../b");
+  EXPECT_EQ(0, interface_->do_symlink(interface_->context_, "/dir/link",
+                                      "../b", stat));
+  cvmfs_attr_free(stat);
+  AddFile("/b", "bbb");
+  AddFile("/a", "");
+  AddFile("/dir/sub/c", "ccc");
+  AddFile("/dir/sub/a", "bbb");
+  std::string incompressible;
+  for (unsigned i = 0; i < kImageDefaultBlockSize + 1; ++i)
+    incompressible.push_back(static_cast<char>(random()));
+  AddFile("/dir/random", incompressible);
+  Finalize();
+
+  UniquePtr<ImageReader> reader(ImageReader::Open(image_path_));
+  ASSERT_TRUE(reader.IsValid());
+  EXPECT_EQ(10U, reader->num_inodes());
+  EXPECT_EQ(kImageCompressionZlib, reader->superblock().compression);
+  EXPECT_EQ(kImageDefaultBlockSize, reader->superblock().block_size);
+
+  std::vector<std::string> names;
+  EXPECT_TRUE(reader->ListDirectory(0, &names));
+  ASSERT_EQ(4U, names.size());
+  EXPECT_EQ("a", names[0]);
+  EXPECT_EQ("b", names[1]);
+  EXPECT_EQ("dir", names[2]);
+  EXPECT_EQ("empty", names[3]);
+
+  uint64_t inode;
+  ASSERT_TRUE(reader->Lookup("/dir", &inode));
+  EXPECT_TRUE(S_ISDIR(reader->inode(inode).mode));
+  EXPECT_EQ(0750U, reader->inode(inode).mode & 0777);
+  EXPECT_TRUE(reader->ListDirectory(inode, &names));
+  ASSERT_EQ(3U, names.size());
+  EXPECT_EQ("link", names[0]);
+  EXPECT_EQ("random", names[1]);
+  EXPECT_EQ("sub", names[2]);
+  ASSERT_TRUE(reader->Lookup("/empty", &inode));
+  EXPECT_TRUE(reader->ListDirectory(inode, &names));
+  EXPECT_TRUE(names.empty());
+
+  std::string content;
+  ASSERT_TRUE(reader->Lookup("/dir/link", &inode));
+  EXPECT_FALSE(reader->ReadFile(inode, &content));
+  EXPECT_TRUE(reader->ReadLink(inode, &content));
+  EXPECT_EQ("../b", content);
+  ASSERT_TRUE(reader->Lookup("/a", &inode));
+  EXPECT_TRUE(reader->ReadFile(inode, &content));
+  EXPECT_EQ("", content);
+  ASSERT_TRUE(reader->Lookup("/dir/sub/a", &inode));
+  EXPECT_TRUE(reader->ReadFile(inode, &content));
+  EXPECT_EQ("bbb", content);
+  ASSERT_TRUE(reader->Lookup("dir/./sub/c", &inode));
+  EXPECT_EQ("c", reader->GetName(inode));
+  EXPECT_TRUE(reader->ReadFile(inode, &content));
+  EXPECT_EQ("ccc", content);
+  ASSERT_TRUE(reader->Lookup("/dir/random", &inode));
+  EXPECT_EQ(incompressible.size(), reader->inode(inode).size);
+  EXPECT_TRUE(reader->ReadFile(inode, &content));
+  EXPECT_EQ(incompressible, content);
+  EXPECT_FALSE(reader->Lookup("/dir/random/x", &inode));
+  EXPECT_FALSE(reader->Lookup("/dir/sub/b", &inode));
+
+  EXPECT_TRUE(reader->Lookup("/", &inode));
+  EXPECT_EQ(0U, inode);
+  EXPECT_TRUE(reader->Lookup("", &inode));
+  EXPECT_EQ(0U, inode);
+}
+
+
+TEST_F(T_FsImage, Symlink) {
+  struct cvmfs_attr *stat = CreateSampleStat("link", 0, S_IFLNK | 0777, 0,
+                                             NULL, NULL, "./target");
+  EXPECT_EQ(0, interface_->do_symlink(interface_->context_, "/link",
+                                      "./target", stat));
+  cvmfs_attr_free(stat);
+  stat = cvmfs_attr_init();
+  EXPECT_EQ(0, interface_->get_stat(interface_->context_, "/link", stat,
+                                    false));
+  EXPECT_TRUE(S_ISLNK(stat->st_mode));
+  EXPECT_STREQ("./target", stat->cvm_symlink);
+  cvmfs_attr_free(stat);
+}
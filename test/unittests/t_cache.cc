@@ -10,7 +10,9 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cstdio>
 #include <cstring>
 #include <string>
 
@@ -608,6 +610,17 @@ TEST_F(T_CacheManager, Dup) {
 }
 
 
+TEST_F(T_CacheManager, GetBackingFd) {
+  int fd = cache_mgr_->Open(CacheManager::Bless(hash_one_));
+  EXPECT_GE(fd, 0);
+  int backing_fd = cache_mgr_->GetBackingFd(fd);
+  EXPECT_GE(backing_fd, 0);
+  char buf;
+  EXPECT_EQ(1, pread(backing_fd, &buf, 1, 0));
+  EXPECT_EQ(0, cache_mgr_->Close(fd));
+}
+
+
 TEST_F(T_CacheManager, GetSize) {
   int fd = cache_mgr_->Open(CacheManager::Bless(hash_null_));
   EXPECT_GE(fd, 0);
@@ -623,6 +636,92 @@ TEST_F(T_CacheManager, GetSize) {
 }
 
 
+TEST_F(T_CacheManager, IoUringWrite) {
+  if (!cache_mgr_->EnableIoUring(4)) {
+    printf("Skipping, io_uring not available\n");
+    return;
+  }
+  const unsigned kSize = 1024 * 1024 + 100;
+  string data(kSize, '\0');
+  for (unsigned i = 0; i < kSize; ++i)
+    data[i] = i % 251;
+  shash::Any rnd_hash;
+  rnd_hash.Randomize();
+  void *txn = alloca(cache_mgr_->SizeOfTxn());
+
+  // Small objects get a single, small buffer on the first write
+  EXPECT_GE(cache_mgr_->StartTxn(rnd_hash, 100, txn), 0);
+  PosixCacheManager::AsyncWrites *async =
+    reinterpret_cast<PosixCacheManager::Transaction *>(txn)->async;
+  ASSERT_TRUE(async != NULL);
+  EXPECT_EQ(100U, async->buffer_size);
+  for (unsigned i = 0; i < PosixCacheManager::AsyncWrites::kNumBuffers; ++i)
+    EXPECT_TRUE(async->buffers[i] == NULL);
+  EXPECT_EQ(100, cache_mgr_->Write(data.data(), 100, txn));
+  EXPECT_TRUE(async->buffers[0] != NULL);
+  for (unsigned i = 1; i < PosixCacheManager::AsyncWrites::kNumBuffers; ++i)
+    EXPECT_TRUE(async->buffers[i] == NULL);
+  EXPECT_EQ(0, cache_mgr_->AbortTxn(txn));
+
+  // Odd write sizes span the io_uring buffers
+  EXPECT_GE(cache_mgr_->StartTxn(rnd_hash, kSize, txn), 0);
+  async = reinterpret_cast<PosixCacheManager::Transaction *>(txn)->async;
+  ASSERT_TRUE(async != NULL);
+  const unsigned kBufferSize = PosixCacheManager::AsyncWrites::kBufferSize;
+  EXPECT_EQ(kBufferSize, async->buffer_size);
+  EXPECT_EQ(1000, cache_mgr_->Write(data.data(), 1000, txn));
+  EXPECT_EQ(0, cache_mgr_->Reset(txn));
+  for (unsigned pos = 0; pos < kSize; pos += 1000) {
+    const unsigned size = std::min(1000U, kSize - pos);
+    EXPECT_EQ(static_cast<int64_t>(size),
+              cache_mgr_->Write(data.data() + pos, size, txn));
+  }
+  int fd = cache_mgr_->OpenFromTxn(txn);
+  EXPECT_GE(fd, 0);
+  EXPECT_EQ(static_cast<int64_t>(kSize), cache_mgr_->GetSize(fd));
+  EXPECT_EQ(0, cache_mgr_->Close(fd));
+  EXPECT_EQ(0, cache_mgr_->CommitTxn(txn));
+
+  unsigned char *buffer;
+  uint64_t size;
+  EXPECT_TRUE(cache_mgr_->Open2Mem(rnd_hash, "", &buffer, &size));
+  EXPECT_EQ(kSize, size);
+  EXPECT_EQ(0, memcmp(data.data(), buffer, kSize));
+  free(buffer);
+
+  // Streaming readers see the written buffers right away
+  rnd_hash.Randomize();
+  EXPECT_GE(cache_mgr_->StartTxn(rnd_hash, kSize, txn), 0);
+  fd = cache_mgr_->OpenFromTxnStreaming(txn);
+  EXPECT_GE(fd, 0);
+  EXPECT_EQ(100000, cache_mgr_->Write(data.data(), 100000, txn));
+  char buf[4096];
+  EXPECT_EQ(4096, cache_mgr_->Pread(fd, buf, 4096, 60000));
+  EXPECT_EQ(0, memcmp(data.data() + 60000, buf, 4096));
+  EXPECT_EQ(static_cast<int64_t>(kSize - 100000),
+            cache_mgr_->Write(data.data() + 100000, kSize - 100000, txn));
+  EXPECT_EQ(0, cache_mgr_->CommitTxn(txn));
+  EXPECT_EQ(4096, cache_mgr_->Pread(fd, buf, 4096, kSize - 4096));
+  EXPECT_EQ(0, memcmp(data.data() + kSize - 4096, buf, 4096));
+  EXPECT_EQ(0, cache_mgr_->Close(fd));
+
+  // Aborted with writes in flight
+  rnd_hash.Randomize();
+  EXPECT_GE(cache_mgr_->StartTxn(rnd_hash, kSize, txn), 0);
+  EXPECT_EQ(static_cast<int64_t>(kSize),
+            cache_mgr_->Write(data.data(), kSize, txn));
+  EXPECT_EQ(0, cache_mgr_->AbortTxn(txn));
+
+  // Failed writes are reported by a later call
+  fd = cache_mgr_->StartTxn(rnd_hash, kSize, txn);
+  EXPECT_GE(fd, 0);
+  EXPECT_EQ(0, close(fd));
+  EXPECT_EQ(-EBADF, cache_mgr_->Write(data.data(), kSize, txn));
+  EXPECT_EQ(-EBADF, cache_mgr_->CommitTxn(txn));
+  EXPECT_EQ(-ENOENT, cache_mgr_->Open(CacheManager::Bless(rnd_hash)));
+}
+
+
 TEST_F(T_CacheManager, Open) {
   delete cache_mgr_->quota_mgr_;
   cache_mgr_->quota_mgr_ = new TestQuotaManager();
@@ -683,6 +782,116 @@ TEST_F(T_CacheManager, OpenFromTxn) {
 }
 
 
+struct StreamReader {
+  PosixCacheManager *cache_mgr;
+  int fd;
+  unsigned char buf[8192];
+  int64_t result;
+};
+
+static void *MainStreamReader(void *data) {
+  StreamReader *reader = static_cast<StreamReader *>(data);
+  reader->result = reader->cache_mgr->Pread(
+    reader->fd, reader->buf, sizeof(reader->buf), 0);
+  return NULL;
+}
+
+TEST_F(T_CacheManager, OpenFromTxnStreaming) {
+  const unsigned kSize = 8192;
+  shash::Any rnd_hash;
+  rnd_hash.Randomize();
+  void *txn = alloca(cache_mgr_->SizeOfTxn());
+  unsigned char data[kSize];
+  memset(data, 'A', kSize);
+
+  EXPECT_GE(cache_mgr_->StartTxn(rnd_hash, CacheManager::kSizeUnknown, txn),
+            0);
+  EXPECT_EQ(-EINVAL, cache_mgr_->OpenFromTxnStreaming(txn));
+  cache_mgr_->AbortTxn(txn);
+
+  // Readers block until their range is written
+  EXPECT_GE(cache_mgr_->StartTxn(rnd_hash, kSize, txn), 0);
+  int fd = cache_mgr_->OpenFromTxnStreaming(txn);
+  EXPECT_GE(fd, 0);
+  EXPECT_EQ(static_cast<int64_t>(kSize), cache_mgr_->GetSize(fd));
+  EXPECT_EQ(-1, cache_mgr_->GetBackingFd(fd));
+  int fd_dup = cache_mgr_->Dup(fd);
+  EXPECT_GE(fd_dup, 0);
+  EXPECT_EQ(2U, cache_mgr_->streams_.size());
+
+  StreamReader reader;
+  reader.cache_mgr = cache_mgr_;
+  reader.fd = fd_dup;
+  reader.result = -1;
+  pthread_t thread_reader;
+  ASSERT_EQ(0, pthread_create(&thread_reader, NULL, MainStreamReader,
+                              &reader));
+  EXPECT_EQ(4096, cache_mgr_->Write(data, 4096, txn));
+  EXPECT_EQ(4096, cache_mgr_->Write(data + 4096, 4096, txn));
+  unsigned char buf[kSize];
+  EXPECT_EQ(4096, cache_mgr_->Pread(fd, buf, 4096, 0));
+  SafeSleepMs(50);
+  EXPECT_EQ(-1, reader.result);
+  EXPECT_EQ(0, cache_mgr_->CommitTxn(txn));
+  pthread_join(thread_reader, NULL);
+  EXPECT_EQ(static_cast<int64_t>(kSize), reader.result);
+  EXPECT_EQ(0, memcmp(data, reader.buf, kSize));
+  EXPECT_EQ(fd_dup, cache_mgr_->GetBackingFd(fd_dup));
+  EXPECT_EQ(0, cache_mgr_->Close(fd));
+  EXPECT_EQ(0, cache_mgr_->Close(fd_dup));
+  EXPECT_TRUE(cache_mgr_->streams_.empty());
+  EXPECT_EQ(0, atomic_read32(&cache_mgr_->num_streams_));
+  fd = cache_mgr_->Open(CacheManager::Bless(rnd_hash));
+  EXPECT_GE(fd, 0);
+  EXPECT_EQ(fd, cache_mgr_->GetBackingFd(fd));
+  EXPECT_EQ(0, cache_mgr_->Close(fd));
+
+  // Aborting the transaction wakes up and fails the readers
+  rnd_hash.Randomize();
+  EXPECT_GE(cache_mgr_->StartTxn(rnd_hash, kSize, txn), 0);
+  fd = cache_mgr_->OpenFromTxnStreaming(txn);
+  EXPECT_GE(fd, 0);
+  reader.fd = fd;
+  reader.result = -1;
+  ASSERT_EQ(0, pthread_create(&thread_reader, NULL, MainStreamReader,
+                              &reader));
+  EXPECT_EQ(4097, cache_mgr_->Write(data, 4097, txn));
+  EXPECT_EQ(4096, cache_mgr_->Pread(fd, buf, 4096, 0));
+  EXPECT_EQ(0, cache_mgr_->AbortTxn(txn));
+  pthread_join(thread_reader, NULL);
+  EXPECT_EQ(-EIO, reader.result);
+  EXPECT_EQ(-EIO, cache_mgr_->Pread(fd, buf, 1, 0));
+  EXPECT_EQ(0, cache_mgr_->Close(fd));
+
+  // A restarted download only fails the readers that have seen discarded data
+  EXPECT_GE(cache_mgr_->StartTxn(rnd_hash, kSize, txn), 0);
+  fd = cache_mgr_->OpenFromTxnStreaming(txn);
+  EXPECT_GE(fd, 0);
+  int fd_late = cache_mgr_->OpenFromTxnStreaming(txn);
+  EXPECT_GE(fd_late, 0);
+  EXPECT_EQ(4097, cache_mgr_->Write(data, 4097, txn));
+  EXPECT_EQ(1, cache_mgr_->Pread(fd, buf, 1, 0));
+  EXPECT_EQ(0, cache_mgr_->Reset(txn));
+  EXPECT_EQ(-EIO, cache_mgr_->Pread(fd, buf, 1, 0));
+  reader.fd = fd_late;
+  reader.result = -1;
+  ASSERT_EQ(0, pthread_create(&thread_reader, NULL, MainStreamReader,
+                              &reader));
+  memset(data, 'B', kSize);
+  EXPECT_EQ(static_cast<int64_t>(kSize), cache_mgr_->Write(data, kSize, txn));
+  EXPECT_EQ(0, cache_mgr_->CommitTxn(txn));
+  pthread_join(thread_reader, NULL);
+  EXPECT_EQ(static_cast<int64_t>(kSize), reader.result);
+  EXPECT_EQ(0, memcmp(data, reader.buf, kSize));
+  EXPECT_EQ(fd_late, cache_mgr_->GetBackingFd(fd_late));
+  EXPECT_EQ(-EIO, cache_mgr_->Pread(fd, buf, 1, 0));
+  EXPECT_EQ(-1, cache_mgr_->GetBackingFd(fd));
+  EXPECT_EQ(0, cache_mgr_->Close(fd));
+  EXPECT_EQ(0, cache_mgr_->Close(fd_late));
+  EXPECT_TRUE(cache_mgr_->streams_.empty());
+}
+
+
 TEST_F(T_CacheManager, Pread) {
   char buf[1024];
   int fd = cache_mgr_->Open(CacheManager::Bless(hash_one_));
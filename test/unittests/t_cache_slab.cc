@@ -0,0 +1,368 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <alloca.h>
+#include <errno.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "cache_slab.h"
+#include "crypto/hash.h"
+#include "statistics.h"
+#include "testutil.h"
+#include "util/posix.h"
+
+using namespace std;  // NOLINT
+
+static const uint64_t kSegmentSize = 64 * 1024;
+static const uint64_t kLimit = 4 * kSegmentSize;
+
+class T_SlabCacheManager : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    used_fds_ = GetNoUsedFds();
+    tmp_path_ = CreateTempDir(GetCurrentWorkingDirectory() + "/cvmfs_ut_slab");
+    ASSERT_FALSE(tmp_path_.empty());
+    num_instances_ = 0;
+    cache_mgr_ = NULL;
+    Recreate();
+  }
+
+  virtual void TearDown() {
+    delete cache_mgr_;
+    if (tmp_path_ != "")
+      RemoveTree(tmp_path_);
+    EXPECT_EQ(used_fds_, GetNoUsedFds());
+  }
+
+  void Recreate(const uint64_t limit = kLimit) {
+    delete cache_mgr_;
+    cache_mgr_ = SlabCacheManager::Create(
+      tmp_path_ + "/cache", limit, kSegmentSize, 64,
+      perf::StatisticsTemplate("slab" + StringifyInt(num_instances_++),
+                               &statistics_));
+    ASSERT_TRUE(cache_mgr_ != NULL);
+    cache_mgr_->AcquireQuotaManager(SlabQuotaManager::Create(cache_mgr_));
+  }
+
+  shash::Any Store(const string &content,
+                   CacheManager::ObjectType type = CacheManager::kTypeRegular,
+                   const string &description = "")
+  {
+    shash::Any id(shash::kSha1);
+    shash::HashString(content, &id);
+    void *txn = alloca(cache_mgr_->SizeOfTxn());
+    EXPECT_EQ(0, cache_mgr_->StartTxn(id, content.size(), txn));
+    cache_mgr_->CtrlTxn(CacheManager::ObjectInfo(type, description), 0, txn);
+    EXPECT_EQ(static_cast<int64_t>(content.size()),
+              cache_mgr_->Write(content.data(), content.size(), txn));
+    EXPECT_EQ(0, cache_mgr_->CommitTxn(txn));
+    return id;
+  }
+
+  string Load(const shash::Any &id) {
+    int fd = cache_mgr_->Open(CacheManager::Bless(id));
+    if (fd < 0)
+      return "<missing>";
+    string result(cache_mgr_->GetSize(fd), '\0');
+    EXPECT_EQ(static_cast<int64_t>(result.size()),
+              cache_mgr_->Pread(fd, &result[0], result.size(), 0));
+    EXPECT_EQ(0, cache_mgr_->Close(fd));
+    return result;
+  }
+
+  int64_t GetCounter(const string &name) {
+    return statistics_.Lookup("slab" + StringifyInt(num_instances_ - 1) +
+                              "." + name)->Get();
+  }
+
+  perf::Statistics statistics_;
+  SlabCacheManager *cache_mgr_;
+  string tmp_path_;
+  unsigned num_instances_;
+  unsigned used_fds_;
+};
+
+
+TEST_F(T_SlabCacheManager, CommitAndRead) {
+  const string content = "Hello, World!";
+  shash::Any id = Store(content);
+  EXPECT_EQ(content, Load(id));
+
+  int fd = cache_mgr_->Open(CacheManager::Bless(id));
+  ASSERT_GE(fd, 0);
+  char buf[8];
+  EXPECT_EQ(5, cache_mgr_->Pread(fd, buf, 5, 7));
+  EXPECT_EQ(0, memcmp(buf, "World", 5));
+  EXPECT_EQ(1, cache_mgr_->Pread(fd, buf, sizeof(buf), content.size() - 1));
+  EXPECT_EQ(0, cache_mgr_->Pread(fd, buf, sizeof(buf), content.size()));
+  int fd_dup = cache_mgr_->Dup(fd);
+  ASSERT_GE(fd_dup, 0);
+  EXPECT_EQ(0, cache_mgr_->Close(fd));
+  EXPECT_EQ(static_cast<int64_t>(content.size()), cache_mgr_->GetSize(fd_dup));
+  EXPECT_EQ(0, cache_mgr_->Close(fd_dup));
+  EXPECT_EQ(-EBADF, cache_mgr_->Close(fd));
+  EXPECT_EQ(-EBADF, cache_mgr_->Pread(fd, buf, 1, 0));
+
+  shash::Any rnd_id(shash::kSha1);
+  rnd_id.Randomize();
+  EXPECT_EQ(-ENOENT, cache_mgr_->Open(CacheManager::Bless(rnd_id)));
+  EXPECT_EQ(1, GetCounter("n_segments"));
+}
+
+
+TEST_F(T_SlabCacheManager, Transactions) {
+  shash::Any id(shash::kSha1);
+  id.Randomize();
+  void *txn = alloca(cache_mgr_->SizeOfTxn());
+
+  EXPECT_EQ(0, cache_mgr_->StartTxn(id, 4, txn));
+  EXPECT_EQ(-EFBIG, cache_mgr_->Write("12345", 5, txn));
+  EXPECT_EQ(2, cache_mgr_->Write("12", 2, txn));
+  EXPECT_EQ(-EIO, cache_mgr_->CommitTxn(txn));
+  EXPECT_EQ("<missing>", Load(id));
+
+  EXPECT_EQ(0, cache_mgr_->StartTxn(id, 4, txn));
+  EXPECT_EQ(4, cache_mgr_->Write("xxxx", 4, txn));
+  EXPECT_EQ(0, cache_mgr_->Reset(txn));
+  EXPECT_EQ(4, cache_mgr_->Write("abcd", 4, txn));
+  int fd = cache_mgr_->OpenFromTxn(txn);
+  ASSERT_GE(fd, 0);
+  EXPECT_EQ(0, cache_mgr_->AbortTxn(txn));
+  char buf[4];
+  EXPECT_EQ(4, cache_mgr_->Pread(fd, buf, 4, 0));
+  EXPECT_EQ(0, memcmp(buf, "abcd", 4));
+  EXPECT_EQ(0, cache_mgr_->Close(fd));
+  EXPECT_EQ("<missing>", Load(id));
+
+  // Unknown size
+  EXPECT_EQ(0, cache_mgr_->StartTxn(id, CacheManager::kSizeUnknown, txn));
+  const string content(10000, 'x');
+  for (unsigned i = 0; i < content.size(); i += 1000)
+    EXPECT_EQ(1000, cache_mgr_->Write(content.data() + i, 1000, txn));
+  EXPECT_EQ(0, cache_mgr_->CommitTxn(txn));
+  EXPECT_EQ(content, Load(id));
+}
+
+
+TEST_F(T_SlabCacheManager, LargeObject) {
+  const string content(2 * kSegmentSize, 'L');
+  shash::Any id = Store(content);
+  EXPECT_EQ(content, Load(id));
+  EXPECT_EQ(1, GetCounter("n_segments"));
+
+  // Still fits into the limit together with a regular segment
+  shash::Any id_small = Store("small");
+  EXPECT_EQ(2, GetCounter("n_segments"));
+  EXPECT_EQ(content, Load(id));
+  EXPECT_EQ("small", Load(id_small));
+}
+
+
+TEST_F(T_SlabCacheManager, Recover) {
+  shash::Any id1 = Store("first", CacheManager::kTypeRegular, "one");
+  shash::Any id2 = Store("second", CacheManager::kTypeCatalog, "two");
+
+  // Pending transactions do not survive
+  shash::Any id3(shash::kSha1);
+  id3.Randomize();
+  void *txn = alloca(cache_mgr_->SizeOfTxn());
+  EXPECT_EQ(0, cache_mgr_->StartTxn(id3, 5, txn));
+  EXPECT_EQ(5, cache_mgr_->Write("third", 5, txn));
+  EXPECT_EQ(0, cache_mgr_->AbortTxn(txn));
+
+  Recreate();
+  EXPECT_EQ("first", Load(id1));
+  EXPECT_EQ("second", Load(id2));
+  EXPECT_EQ("<missing>", Load(id3));
+  vector<string> catalogs = cache_mgr_->quota_mgr()->ListCatalogs();
+  ASSERT_EQ(1U, catalogs.size());
+  EXPECT_EQ("two", catalogs[0]);
+
+  // Records are appended after the existing ones
+  shash::Any id4 = Store("fourth");
+  Recreate();
+  EXPECT_EQ("first", Load(id1));
+  EXPECT_EQ("fourth", Load(id4));
+
+  // Garbage in the cache directory
+  EXPECT_TRUE(SafeWriteToFile("garbage", tmp_path_ + "/cache/segment.100",
+                              0600));
+  Recreate();
+  EXPECT_FALSE(FileExists(tmp_path_ + "/cache/segment.100"));
+  EXPECT_EQ("fourth", Load(id4));
+}
+
+
+TEST_F(T_SlabCacheManager, Reclaim) {
+  const unsigned kObjectSize = 1000;
+  vector<shash::Any> ids;
+  for (unsigned i = 0; i < 400; ++i) {
+    string content(kObjectSize, 'a' + (i % 26));
+    content += StringifyInt(i);
+    ids.push_back(Store(content,
+                        (i == 0) ? CacheManager::kTypePinned
+                                 : CacheManager::kTypeRegular));
+    if (i == 1) {
+      // Opened after its segment became inactive, copied forward
+      EXPECT_EQ(kObjectSize + 1, Load(ids[1]).size());
+    }
+    if (i == 100)
+      EXPECT_EQ(kObjectSize + 1, Load(ids[1]).size());
+  }
+
+  EXPECT_LE(cache_mgr_->allocated_, kLimit);
+  EXPECT_GT(GetCounter("n_reclaimed"), 0);
+  EXPECT_GT(GetCounter("n_dropped"), 0);
+  EXPECT_GE(GetCounter("n_copied"), 2);
+  EXPECT_EQ(0, GetCounter("n_full"));
+  EXPECT_EQ(string(kObjectSize, 'a') + "0", Load(ids[0]));
+  EXPECT_EQ(string(kObjectSize, 'b') + "1", Load(ids[1]));
+  EXPECT_EQ("<missing>", Load(ids[2]));
+  EXPECT_EQ(string(kObjectSize, 'a' + (399 % 26)) + "399", Load(ids[399]));
+
+  // Segments in use are not reclaimed
+  int fd = cache_mgr_->Open(CacheManager::Bless(ids[0]));
+  ASSERT_GE(fd, 0);
+  EXPECT_FALSE(cache_mgr_->quota_mgr()->Cleanup(0));
+  EXPECT_EQ(1U, cache_mgr_->segments_.size());
+  EXPECT_EQ(1, GetCounter("n_full"));
+  EXPECT_EQ(0, cache_mgr_->Close(fd));
+  // Pinned objects cannot be copied forward during cleanup
+  EXPECT_FALSE(cache_mgr_->quota_mgr()->Cleanup(0));
+  EXPECT_EQ(string(kObjectSize, 'a') + "0", Load(ids[0]));
+  cache_mgr_->quota_mgr()->Unpin(ids[0]);
+  EXPECT_TRUE(cache_mgr_->quota_mgr()->Cleanup(0));
+  EXPECT_TRUE(cache_mgr_->index_.empty());
+  EXPECT_TRUE(cache_mgr_->segments_.empty());
+  EXPECT_EQ(0U, cache_mgr_->quota_mgr()->GetSize());
+}
+
+
+TEST_F(T_SlabCacheManager, Quota) {
+  QuotaManager *quota_mgr = cache_mgr_->quota_mgr();
+  EXPECT_EQ(kLimit, quota_mgr->GetCapacity());
+  EXPECT_EQ(0U, quota_mgr->GetSize());
+
+  shash::Any id_regular = Store("regular", CacheManager::kTypeRegular, "/r");
+  shash::Any id_volatile = Store("volatile", CacheManager::kTypeVolatile, "/v");
+  shash::Any id_pinned = Store("pinned", CacheManager::kTypePinned, "/p");
+  EXPECT_EQ(3 * 128U, quota_mgr->GetSize());
+  EXPECT_EQ(6U, quota_mgr->GetSizePinned());
+
+  EXPECT_EQ(vector<string>(1, "/r"), quota_mgr->List());
+  EXPECT_EQ(vector<string>(1, "/v"), quota_mgr->ListVolatile());
+  EXPECT_EQ(vector<string>(1, "/p"), quota_mgr->ListPinned());
+  EXPECT_TRUE(quota_mgr->ListCatalogs().empty());
+
+  // Pinned objects cannot take more than half of the cache
+  const string large(kLimit / 2, 'P');
+  shash::Any id_large(shash::kSha1);
+  shash::HashString(large, &id_large);
+  void *txn = alloca(cache_mgr_->SizeOfTxn());
+  EXPECT_EQ(0, cache_mgr_->StartTxn(id_large, large.size(), txn));
+  cache_mgr_->CtrlTxn(
+    CacheManager::ObjectInfo(CacheManager::kTypePinned, ""), 0, txn);
+  EXPECT_EQ(static_cast<int64_t>(large.size()),
+            cache_mgr_->Write(large.data(), large.size(), txn));
+  EXPECT_EQ(-ENOSPC, cache_mgr_->CommitTxn(txn));
+  EXPECT_EQ("<missing>", Load(id_large));
+
+  quota_mgr->Remove(id_regular);
+  EXPECT_EQ("<missing>", Load(id_regular));
+  EXPECT_EQ("volatile", Load(id_volatile));
+  Recreate();
+  EXPECT_EQ("<missing>", Load(id_regular));
+  EXPECT_EQ("pinned", Load(id_pinned));
+
+  // Clients are asked to release pinned catalogs above the high watermark
+  quota_mgr = cache_mgr_->quota_mgr();
+  int channel[2];
+  quota_mgr->RegisterBackChannel(channel, "test");
+  const string catalog(kLimit * 2 / 5, 'C');
+  shash::Any id_catalog = Store(catalog, CacheManager::kTypeRegular, "/c");
+  EXPECT_TRUE(quota_mgr->Pin(id_catalog, catalog.size(), "/c", true));
+  char command;
+  ReadPipe(channel[0], &command, 1);
+  EXPECT_EQ('R', command);
+  quota_mgr->UnregisterBackChannel(channel, "test");
+}
+
+
+TEST_F(T_SlabCacheManager, SaveRestore) {
+  shash::Any id1 = Store("first");
+  shash::Any id2 = Store("second");
+  // The root catalog is closed before a reload
+  int fd_root = cache_mgr_->Open(CacheManager::Bless(id1));
+  int fd2 = cache_mgr_->Open(CacheManager::Bless(id2));
+  ASSERT_EQ(1, fd2);
+  EXPECT_EQ(0, cache_mgr_->Close(fd_root));
+
+  void *state = cache_mgr_->SaveState(-1);
+  const uint64_t active = cache_mgr_->active_->id;
+  Recreate();
+  fd_root = cache_mgr_->Open(CacheManager::Bless(id1));
+  EXPECT_EQ(0, fd_root);
+  EXPECT_EQ(0, cache_mgr_->RestoreState(-1, state));
+  cache_mgr_->FreeState(-1, state);
+  ASSERT_TRUE(cache_mgr_->active_ != NULL);
+  EXPECT_EQ(active, cache_mgr_->active_->id);
+
+  char buf[6];
+  EXPECT_EQ(6, cache_mgr_->Pread(fd2, buf, 6, 0));
+  EXPECT_EQ(0, memcmp(buf, "second", 6));
+  EXPECT_EQ(5, cache_mgr_->Pread(fd_root, buf, 5, 0));
+  EXPECT_EQ(0, memcmp(buf, "first", 5));
+  EXPECT_EQ(0, cache_mgr_->Close(fd2));
+  EXPECT_EQ(0, cache_mgr_->Close(fd_root));
+  EXPECT_EQ(0U, cache_mgr_->active_->num_refs);
+}
+
+
+TEST_F(T_SlabCacheManager, SaveRestoreOverLimit) {
+  // One object per segment
+  const string content1(kSegmentSize / 2 + 1, '1');
+  const string content2(kSegmentSize / 2 + 1, '2');
+  const string content3(kSegmentSize / 2 + 1, '3');
+  shash::Any id1 = Store(content1);
+  shash::Any id2 = Store(content2);
+  shash::Any id3 = Store(content3);
+  EXPECT_EQ(3, GetCounter("n_segments"));
+  int fd1 = cache_mgr_->Open(CacheManager::Bless(id1));
+  EXPECT_EQ(0, fd1);
+  EXPECT_TRUE(cache_mgr_->quota_mgr()->Pin(id3, content3.size(), "", false));
+
+  void *state = cache_mgr_->SaveState(-1);
+  // The new instance has space for two and a half segments.  The segment of
+  // the open file and the one of the pinned object survive.
+  const uint64_t limit = 2 * kSegmentSize + kSegmentSize / 2;
+  Recreate(limit);
+  EXPECT_FALSE(FileExists(tmp_path_ + "/cache/held"));
+  EXPECT_EQ(2U, cache_mgr_->segments_.size());
+  // No root file catalog
+  EXPECT_EQ(-1, cache_mgr_->RestoreState(-1, state));
+  cache_mgr_->FreeState(-1, state);
+
+  string buf(content1.size(), '\0');
+  EXPECT_EQ(static_cast<int64_t>(content1.size()),
+            cache_mgr_->Pread(fd1, &buf[0], buf.size(), 0));
+  EXPECT_EQ(content1, buf);
+  EXPECT_EQ("<missing>", Load(id2));
+  EXPECT_EQ(content3, Load(id3));
+  vector<string> pinned = cache_mgr_->quota_mgr()->ListPinned();
+  EXPECT_EQ(1U, pinned.size());
+  EXPECT_EQ(0, cache_mgr_->Close(fd1));
+
+  // Once the file is closed, its segment can be reclaimed
+  EXPECT_EQ(content2, Load(Store(content2)));
+  EXPECT_LE(cache_mgr_->allocated_, limit);
+  EXPECT_EQ("<missing>", Load(id1));
+  EXPECT_EQ(content3, Load(id3));
+  EXPECT_EQ(1U, cache_mgr_->quota_mgr()->ListPinned().size());
+}
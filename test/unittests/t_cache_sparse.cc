@@ -0,0 +1,298 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <errno.h>
+
+#include <climits>
+#include <string>
+
+#include "cache_posix.h"
+#include "cache_sparse.h"
+#include "crypto/hash.h"
+#include "network/download.h"
+#include "statistics.h"
+#include "testutil.h"
+#include "util/posix.h"
+#include "util/prng.h"
+
+using namespace std;  // NOLINT
+
+static const int64_t kBlockSize = 4096;
+static const int64_t kSize = 10 * kBlockSize + 100;
+
+class T_SparseCache : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    used_fds_ = GetNoUsedFds();
+    tmp_path_ =
+      CreateTempDir(GetCurrentWorkingDirectory() + "/cvmfs_ut_sparse");
+    ASSERT_FALSE(tmp_path_.empty());
+
+    Prng prng;
+    prng.InitSeed(42);
+    data_.resize(kSize);
+    for (int64_t i = 0; i < kSize; ++i)
+      data_[i] = prng.Next(UCHAR_MAX + 1);
+    hash_ = shash::Any(shash::kSha1);
+    shash::HashString(data_, &hash_);
+    const string object_path = tmp_path_ + "/data/" + hash_.MakePath();
+    ASSERT_TRUE(MkdirDeep(GetParentPath(object_path), 0700));
+    ASSERT_TRUE(SafeWriteToFile(data_, object_path, 0600));
+    ASSERT_TRUE(SafeWriteToFile(data_, tmp_path_ + "/external", 0600));
+
+    download_mgr_ = new download::DownloadManager();
+    download_mgr_->Init(8, perf::StatisticsTemplate("test", &statistics_));
+    download_mgr_->SetHostChain("file://" + tmp_path_);
+
+    cache_mgr_ = PosixCacheManager::Create(tmp_path_ + "/cache", false);
+    ASSERT_TRUE(cache_mgr_ != NULL);
+    sparse_cache_ = SparseCache::Create(
+      tmp_path_ + "/sparse", kBlockSize, 1024 * 1024, cache_mgr_,
+      download_mgr_, download_mgr_,
+      perf::StatisticsTemplate("sparse", &statistics_));
+    ASSERT_TRUE(sparse_cache_ != NULL);
+  }
+
+  virtual void TearDown() {
+    delete sparse_cache_;
+    delete cache_mgr_;
+    download_mgr_->Fini();
+    delete download_mgr_;
+    if (tmp_path_ != "")
+      RemoveTree(tmp_path_);
+    EXPECT_EQ(used_fds_, GetNoUsedFds());
+  }
+
+  int64_t GetCounter(const string &name) {
+    return statistics_.Lookup("sparse." + name)->Get();
+  }
+
+  /**
+   * Complete objects are verified in the background
+   */
+  void WaitForCounter(const string &name, int64_t value) {
+    for (unsigned i = 0; (i < 1000) && (GetCounter(name) != value); ++i)
+      SafeSleepMs(10);
+    EXPECT_EQ(value, GetCounter(name));
+  }
+
+  perf::Statistics statistics_;
+  download::DownloadManager *download_mgr_;
+  PosixCacheManager *cache_mgr_;
+  SparseCache *sparse_cache_;
+  string tmp_path_;
+  string data_;
+  shash::Any hash_;
+  unsigned used_fds_;
+};
+
+
+TEST_F(T_SparseCache, IsEligible) {
+  EXPECT_FALSE(sparse_cache_->IsEligible(kSize, zlib::kZlibDefault));
+  EXPECT_TRUE(sparse_cache_->IsEligible(kSize, zlib::kNoCompression));
+  EXPECT_FALSE(sparse_cache_->IsEligible(kBlockSize, zlib::kNoCompression));
+}
+
+
+TEST_F(T_SparseCache, ReadSparse) {
+  int64_t handle = sparse_cache_->Open(hash_, kSize, "", false);
+  ASSERT_GE(handle, 0);
+
+  char buf[2 * kBlockSize];
+  EXPECT_EQ(100, sparse_cache_->Pread(handle, buf, 100, 3 * kBlockSize + 10));
+  EXPECT_EQ(0, memcmp(buf, data_.data() + 3 * kBlockSize + 10, 100));
+  EXPECT_EQ(1, GetCounter("n_blocks"));
+  EXPECT_EQ(kBlockSize, GetCounter("sz_downloaded"));
+  EXPECT_EQ(kSize - kBlockSize, GetCounter("sz_saved"));
+  EXPECT_EQ(4096U, sparse_cache_->used());
+
+  // Spans two blocks, one of them is present
+  EXPECT_EQ(200, sparse_cache_->Pread(handle, buf, 200, 4 * kBlockSize - 100));
+  EXPECT_EQ(0, memcmp(buf, data_.data() + 4 * kBlockSize - 100, 200));
+  EXPECT_EQ(2, GetCounter("n_blocks"));
+
+  // The last block is short
+  EXPECT_EQ(100, sparse_cache_->Pread(handle, buf, sizeof(buf),
+                                      10 * kBlockSize));
+  EXPECT_EQ(0, memcmp(buf, data_.data() + 10 * kBlockSize, 100));
+  EXPECT_EQ(2U * 4096 + 100, sparse_cache_->used());
+  EXPECT_EQ(0, sparse_cache_->Pread(handle, buf, sizeof(buf), kSize));
+
+  // A second handle shares the blocks
+  int64_t handle2 = sparse_cache_->Open(hash_, kSize, "", false);
+  ASSERT_GE(handle2, 0);
+  EXPECT_NE(handle, handle2);
+  EXPECT_EQ(10, sparse_cache_->Pread(handle2, buf, 10, 3 * kBlockSize));
+  EXPECT_EQ(3, GetCounter("n_blocks"));
+
+  EXPECT_EQ(0, sparse_cache_->Close(handle));
+  EXPECT_EQ(0, sparse_cache_->Close(handle2));
+  EXPECT_EQ(-EBADF, sparse_cache_->Close(handle));
+  EXPECT_EQ(-EBADF, sparse_cache_->Pread(handle, buf, 1, 0));
+
+  // Closed objects are kept
+  handle = sparse_cache_->Open(hash_, kSize, "", false);
+  EXPECT_EQ(10, sparse_cache_->Pread(handle, buf, 10, 3 * kBlockSize));
+  EXPECT_EQ(3, GetCounter("n_blocks"));
+  EXPECT_EQ(0, sparse_cache_->Close(handle));
+}
+
+
+TEST_F(T_SparseCache, ReadAll) {
+  int64_t handle = sparse_cache_->Open(hash_, kSize, "/external", true);
+  ASSERT_GE(handle, 0);
+  string buf(kSize, '\0');
+  EXPECT_EQ(kSize, sparse_cache_->Pread(handle, &buf[0], kSize, 0));
+  EXPECT_EQ(data_, buf);
+  EXPECT_EQ(11, GetCounter("n_blocks"));
+  EXPECT_EQ(0, GetCounter("sz_saved"));
+
+  // The verified object is committed to the cache manager and the sparse
+  // file is dropped once the object is closed
+  WaitForCounter("n_committed", 1);
+  EXPECT_EQ(0, GetCounter("n_verify_failed"));
+  const int fd = cache_mgr_->Open(CacheManager::Bless(hash_));
+  ASSERT_GE(fd, 0);
+  EXPECT_EQ(kSize, cache_mgr_->GetSize(fd));
+  EXPECT_EQ(0, cache_mgr_->Close(fd));
+  EXPECT_EQ(kSize, sparse_cache_->Pread(handle, &buf[0], kSize, 0));
+  EXPECT_EQ(0, sparse_cache_->Close(handle));
+  EXPECT_EQ(0U, sparse_cache_->used());
+}
+
+
+TEST_F(T_SparseCache, VerifyFailed) {
+  shash::Any wrong_hash(shash::kSha1);
+  wrong_hash.Randomize();
+  const string object_path = tmp_path_ + "/data/" + wrong_hash.MakePath();
+  ASSERT_TRUE(MkdirDeep(GetParentPath(object_path), 0700));
+  ASSERT_TRUE(SafeWriteToFile(data_, object_path, 0600));
+
+  int64_t handle = sparse_cache_->Open(wrong_hash, kSize, "", false);
+  ASSERT_GE(handle, 0);
+  char buf[kBlockSize];
+  EXPECT_EQ(kBlockSize, sparse_cache_->Pread(handle, buf, kBlockSize, 0));
+  string all(kSize, '\0');
+  sparse_cache_->Pread(handle, &all[0], kSize, 0);
+  WaitForCounter("n_verify_failed", 1);
+  EXPECT_EQ(0, GetCounter("n_committed"));
+  EXPECT_EQ(-EIO, sparse_cache_->Pread(handle, buf, kBlockSize, 0));
+  EXPECT_EQ(-EIO, sparse_cache_->Open(wrong_hash, kSize, "", false));
+
+  // Dropped once closed
+  EXPECT_EQ(0, sparse_cache_->Close(handle));
+  EXPECT_EQ(0U, sparse_cache_->used());
+  handle = sparse_cache_->Open(wrong_hash, kSize, "", false);
+  ASSERT_GE(handle, 0);
+  EXPECT_EQ(kBlockSize, sparse_cache_->Pread(handle, buf, kBlockSize, 0));
+  EXPECT_EQ(0, sparse_cache_->Close(handle));
+}
+
+
+TEST_F(T_SparseCache, DownloadFailure) {
+  shash::Any rnd_hash(shash::kSha1);
+  rnd_hash.Randomize();
+  int64_t handle = sparse_cache_->Open(rnd_hash, kSize, "", false);
+  ASSERT_GE(handle, 0);
+  char buf[10];
+  EXPECT_EQ(-EIO, sparse_cache_->Pread(handle, buf, sizeof(buf), 0));
+  EXPECT_EQ(0U, sparse_cache_->used());
+  EXPECT_EQ(0, sparse_cache_->Close(handle));
+}
+
+
+TEST_F(T_SparseCache, Evict) {
+  delete sparse_cache_;
+  sparse_cache_ = SparseCache::Create(
+    tmp_path_ + "/sparse", kBlockSize, 2 * kBlockSize, NULL,
+    download_mgr_, download_mgr_,
+    perf::StatisticsTemplate("sparse_small", &statistics_));
+  ASSERT_TRUE(sparse_cache_ != NULL);
+
+  shash::Any other_hash(shash::kSha1);
+  other_hash.Randomize();
+  const string object_path = tmp_path_ + "/data/" + other_hash.MakePath();
+  ASSERT_TRUE(MkdirDeep(GetParentPath(object_path), 0700));
+  ASSERT_TRUE(SafeWriteToFile(data_, object_path, 0600));
+
+  char buf[2 * kBlockSize];
+  int64_t handle = sparse_cache_->Open(hash_, kSize, "", false);
+  EXPECT_EQ(2 * kBlockSize,
+            sparse_cache_->Pread(handle, buf, 2 * kBlockSize, 0));
+  EXPECT_EQ(0, sparse_cache_->Close(handle));
+  EXPECT_EQ(1U, sparse_cache_->objects_.size());
+
+  handle = sparse_cache_->Open(other_hash, kSize, "", false);
+  EXPECT_EQ(kBlockSize, sparse_cache_->Pread(handle, buf, kBlockSize, 0));
+  EXPECT_EQ(1U, sparse_cache_->objects_.size());
+  EXPECT_EQ(4096U, sparse_cache_->used());
+
+  // Open objects are not evicted, the limit is exceeded
+  EXPECT_EQ(2 * kBlockSize,
+            sparse_cache_->Pread(handle, buf, 2 * kBlockSize, kBlockSize));
+  EXPECT_EQ(3U * 4096, sparse_cache_->used());
+  EXPECT_EQ(0, sparse_cache_->Close(handle));
+  EXPECT_EQ(0U, sparse_cache_->used());
+  EXPECT_TRUE(sparse_cache_->objects_.empty());
+}
+
+
+TEST_F(T_SparseCache, SaveRestore) {
+  char buf[kBlockSize];
+  const int64_t handle = sparse_cache_->Open(hash_, kSize, "", false);
+  ASSERT_GE(handle, 0);
+  EXPECT_EQ(kBlockSize, sparse_cache_->Pread(handle, buf, kBlockSize, 0));
+  SparseCache::SavedState *state = sparse_cache_->SaveState();
+  EXPECT_EQ(0U, sparse_cache_->used());
+  EXPECT_EQ(-EBADF, sparse_cache_->Pread(handle, buf, kBlockSize, 0));
+  delete sparse_cache_;
+
+  sparse_cache_ = SparseCache::Create(
+    tmp_path_ + "/sparse", kBlockSize, 1024 * 1024, cache_mgr_,
+    download_mgr_, download_mgr_,
+    perf::StatisticsTemplate("sparse_restored", &statistics_));
+  ASSERT_TRUE(sparse_cache_ != NULL);
+  sparse_cache_->RestoreState(state);
+  SparseCache::FreeState(state);
+  EXPECT_EQ(static_cast<uint64_t>(kBlockSize), sparse_cache_->used());
+
+  // The saved handle is still valid and the stored block is not downloaded
+  // again
+  EXPECT_EQ(kBlockSize, sparse_cache_->Pread(handle, buf, kBlockSize, 0));
+  EXPECT_EQ(0, memcmp(buf, data_.data(), kBlockSize));
+  EXPECT_EQ(0, statistics_.Lookup("sparse_restored.n_blocks")->Get());
+
+  // New handles do not collide with the saved ones
+  const int64_t handle2 = sparse_cache_->Open(hash_, kSize, "", false);
+  EXPECT_GT(handle2, handle);
+  EXPECT_EQ(0, sparse_cache_->Close(handle2));
+  EXPECT_EQ(-EBADF, sparse_cache_->Pread(handle2, buf, kBlockSize, 0));
+  EXPECT_EQ(0, sparse_cache_->Close(handle));
+  EXPECT_EQ(1U, sparse_cache_->objects_.size());
+}
+
+
+TEST_F(T_SparseCache, RestoreOtherBlockSize) {
+  char buf[kBlockSize];
+  const int64_t handle = sparse_cache_->Open(hash_, kSize, "", false);
+  ASSERT_GE(handle, 0);
+  EXPECT_EQ(kBlockSize, sparse_cache_->Pread(handle, buf, kBlockSize, 0));
+  SparseCache::SavedState *state = sparse_cache_->SaveState();
+  delete sparse_cache_;
+
+  sparse_cache_ = SparseCache::Create(
+    tmp_path_ + "/sparse", kBlockSize / 2, 1024 * 1024, cache_mgr_,
+    download_mgr_, download_mgr_,
+    perf::StatisticsTemplate("sparse_restored", &statistics_));
+  ASSERT_TRUE(sparse_cache_ != NULL);
+  sparse_cache_->RestoreState(state);
+  SparseCache::FreeState(state);
+  EXPECT_EQ(0U, sparse_cache_->used());
+  EXPECT_EQ(kBlockSize, sparse_cache_->Pread(handle, buf, kBlockSize, 0));
+  EXPECT_EQ(0, memcmp(buf, data_.data(), kBlockSize));
+  EXPECT_EQ(2, statistics_.Lookup("sparse_restored.n_blocks")->Get());
+  EXPECT_EQ(0, sparse_cache_->Close(handle));
+}
@@ -4,16 +4,27 @@
 
 #include <gtest/gtest.h>
 
+#include <fcntl.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <vector>
+
+#include "cache_posix.h"
 #include "catalog.h"
+#include "catalog_index.h"
+#include "catalog_revision_diff.h"
 #include "catalog_rw.h"
 #include "compression.h"
 #include "crypto/hash.h"
 #include "shortstring.h"
+#include "sqlitevfs.h"
+#include "statistics.h"
 #include "testutil.h"
+#include "util/pointer.h"
 #include "util/posix.h"
+#include "util/string.h"
 
 using namespace std;  // NOLINT
 
@@ -131,6 +142,30 @@ class T_Catalog : public ::testing::Test {
     RemoveTree(sandbox);
   }
 
+  static void *MainConcurrentLookup(void *data) {
+    Catalog *catalog = reinterpret_cast<Catalog *>(data);
+    const PathString path("/dir/dir/bar2");
+    const PathString dir_path("/dir/dir");
+    uintptr_t errors = 0;
+    for (unsigned i = 0; i < 1000; ++i) {
+      DirectoryEntry dirent;
+      if (!catalog->LookupPath(path, &dirent) ||
+          (dirent.name() != NameString("bar2")))
+      {
+        errors++;
+      }
+      if (catalog->LookupPath(PathString("/fakepath"), &dirent))
+        errors++;
+      StatEntryList listing;
+      if (!catalog->ListingPathStat(dir_path, &listing) ||
+          (listing.size() != 3))
+      {
+        errors++;
+      }
+    }
+    return reinterpret_cast<void *>(errors);
+  }
+
   Catalog *catalog;
   Catalog *nested;
   string sandbox;
@@ -367,6 +402,322 @@ TEST_F(T_Catalog, Listing) {
     EXPECT_NE(NameString("hidden"), root_stat_entry_list.At(i).name);
 }
 
+TEST_F(T_Catalog, PathIndex) {
+  perf::Statistics statistics;
+  perf::Counter *n_hits = statistics.Register("test.hits", "");
+  perf::Counter *n_misses = statistics.Register("test.misses", "");
+  perf::Counter *n_builds = statistics.Register("test.builds", "");
+  PathIndexBudget budget(1024 * 1024, 2, n_hits, n_misses, n_builds);
+  catalog = catalog::Catalog::AttachFreely("",
+                                           catalog_db_root,
+                                           shash::Any(),
+                                           NULL,
+                                           false);
+  Catalog *indexed = catalog::Catalog::AttachFreely("",
+                                                    catalog_db_root,
+                                                    shash::Any(),
+                                                    NULL,
+                                                    false);
+  indexed->SetPathIndexBudget(&budget);
+
+  const char *paths[] = {"", "/foo", "/hidden", "/dir", "/dir/dir",
+                         "/dir/folder", "/dir/dir/bar", "/dir/dir/link",
+                         "/fakepath", "/dir/fakefile"};
+  for (unsigned i = 0; i < sizeof(paths) / sizeof(paths[0]); ++i) {
+    PathString path(paths[i]);
+    DirectoryEntry expected;
+    DirectoryEntry dirent;
+    const bool found = catalog->LookupPath(path, &expected);
+    EXPECT_EQ(found, indexed->LookupPath(path, &dirent)) << paths[i];
+    if (found) {
+      EXPECT_EQ(expected.name(), dirent.name()) << paths[i];
+      EXPECT_EQ(expected.inode(), dirent.inode()) << paths[i];
+      EXPECT_EQ(expected.mode(), dirent.mode()) << paths[i];
+      EXPECT_EQ(expected.checksum(), dirent.checksum()) << paths[i];
+      EXPECT_EQ(expected.symlink(), dirent.symlink()) << paths[i];
+      EXPECT_EQ(expected.IsHidden(), dirent.IsHidden()) << paths[i];
+      EXPECT_EQ(expected.IsChunkedFile(), dirent.IsChunkedFile()) << paths[i];
+      EXPECT_EQ(expected.IsNestedCatalogMountpoint(),
+                dirent.IsNestedCatalogMountpoint()) << paths[i];
+    }
+
+    DirectoryEntryList expected_listing;
+    DirectoryEntryList listing;
+    EXPECT_TRUE(catalog->ListingPath(path, &expected_listing));
+    EXPECT_TRUE(indexed->ListingPath(path, &listing));
+    ASSERT_EQ(expected_listing.size(), listing.size()) << paths[i];
+    for (unsigned j = 0; j < listing.size(); ++j)
+      EXPECT_EQ(expected_listing[j].name(), listing[j].name()) << paths[i];
+
+    StatEntryList expected_stat_listing;
+    StatEntryList stat_listing;
+    EXPECT_TRUE(catalog->ListingPathStat(path, &expected_stat_listing));
+    EXPECT_TRUE(indexed->ListingPathStat(path, &stat_listing));
+    ASSERT_EQ(expected_stat_listing.size(), stat_listing.size()) << paths[i];
+    for (unsigned j = 0; j < stat_listing.size(); ++j) {
+      EXPECT_EQ(expected_stat_listing.AtPtr(j)->name,
+                stat_listing.AtPtr(j)->name) << paths[i];
+    }
+  }
+
+  EXPECT_EQ(1, n_builds->Get());
+  EXPECT_EQ(1, n_misses->Get());
+  EXPECT_EQ(3 * 10 - 1, n_hits->Get());
+  EXPECT_GT(budget.used(), 0u);
+  delete indexed;
+  EXPECT_EQ(0u, budget.used());
+
+  // Not enough space for the index
+  PathIndexBudget small_budget(1024, 1, n_hits, n_misses, n_builds);
+  indexed = catalog::Catalog::AttachFreely("",
+                                           catalog_db_root,
+                                           shash::Any(),
+                                           NULL,
+                                           false);
+  indexed->SetPathIndexBudget(&small_budget);
+  DirectoryEntry dirent;
+  EXPECT_TRUE(indexed->LookupPath(PathString("/dir/dir/bar"), &dirent));
+  EXPECT_EQ(NameString("bar"), dirent.name());
+  EXPECT_FALSE(indexed->LookupPath(PathString("/fakepath"), &dirent));
+  EXPECT_EQ(1, n_builds->Get());
+  EXPECT_EQ(0u, small_budget.used());
+  delete indexed;
+}
+
+TEST_F(T_Catalog, LookupPaths) {
+  perf::Statistics statistics;
+  perf::Counter *n_hits = statistics.Register("test.hits", "");
+  perf::Counter *n_misses = statistics.Register("test.misses", "");
+  perf::Counter *n_builds = statistics.Register("test.builds", "");
+  PathIndexBudget budget(1024 * 1024, 1, n_hits, n_misses, n_builds);
+  catalog = catalog::Catalog::AttachFreely("",
+                                           catalog_db_root,
+                                           shash::Any(),
+                                           NULL,
+                                           false);
+  Catalog *indexed = catalog::Catalog::AttachFreely("",
+                                                    catalog_db_root,
+                                                    shash::Any(),
+                                                    NULL,
+                                                    false);
+  indexed->SetPathIndexBudget(&budget);
+
+  const char *paths[] = {"", "/foo", "/hidden", "/dir", "/dir/dir",
+                         "/dir/folder", "/dir/dir/bar", "/dir/dir/link",
+                         "/fakepath", "/dir/fakefile", "/foo"};
+  const unsigned num_paths = sizeof(paths) / sizeof(paths[0]);
+  // More than one SQL batch
+  std::vector<PathString> path_list;
+  for (unsigned i = 0; i < 2 * SqlLookupPathHashes::kMaxPaths; ++i)
+    path_list.push_back(PathString(paths[i % num_paths]));
+
+  std::vector<DirectoryEntry> dirents;
+  std::vector<DirectoryEntry> indexed_dirents;
+  catalog->LookupPaths(path_list, &dirents);
+  indexed->LookupPaths(path_list, &indexed_dirents);
+  ASSERT_EQ(path_list.size(), dirents.size());
+  ASSERT_EQ(path_list.size(), indexed_dirents.size());
+  EXPECT_EQ(1, n_builds->Get());
+  for (unsigned i = 0; i < path_list.size(); ++i) {
+    DirectoryEntry expected;
+    const bool found = catalog->LookupPath(path_list[i], &expected);
+    EXPECT_EQ(!found, dirents[i].IsNegative()) << path_list[i].c_str();
+    EXPECT_EQ(!found, indexed_dirents[i].IsNegative()) << path_list[i].c_str();
+    if (!found)
+      continue;
+    EXPECT_EQ(expected.name(), dirents[i].name());
+    EXPECT_EQ(expected.inode(), dirents[i].inode());
+    EXPECT_EQ(expected.mode(), dirents[i].mode());
+    EXPECT_EQ(expected.symlink(), dirents[i].symlink());
+    EXPECT_EQ(expected.IsNestedCatalogMountpoint(),
+              dirents[i].IsNestedCatalogMountpoint());
+    EXPECT_EQ(expected.name(), indexed_dirents[i].name());
+    EXPECT_EQ(expected.inode(), indexed_dirents[i].inode());
+  }
+  delete indexed;
+}
+
+TEST_F(T_Catalog, PathFilter) {
+  const unsigned kNumEntries = 10000;
+  PathFilter filter(kNumEntries);
+  for (unsigned i = 0; i < kNumEntries; ++i)
+    filter.Add(shash::Md5(shash::AsciiPtr("/in/" + StringifyInt(i))));
+  for (unsigned i = 0; i < kNumEntries; ++i) {
+    EXPECT_TRUE(filter.MayContain(
+      shash::Md5(shash::AsciiPtr("/in/" + StringifyInt(i)))));
+  }
+  unsigned num_false_positives = 0;
+  for (unsigned i = 0; i < kNumEntries; ++i) {
+    if (filter.MayContain(
+          shash::Md5(shash::AsciiPtr("/out/" + StringifyInt(i)))))
+    {
+      num_false_positives++;
+    }
+  }
+  EXPECT_LT(num_false_positives, kNumEntries / 50);
+
+  perf::Statistics statistics;
+  PathFilterCounters counters;
+  counters.n_rejects = statistics.Register("test.rejects", "");
+  counters.n_false_positives = statistics.Register("test.false_positives", "");
+  catalog = catalog::Catalog::AttachFreely("",
+                                           catalog_db_root,
+                                           shash::Any(),
+                                           NULL,
+                                           false);
+  catalog->EnablePathFilter(&counters);
+
+  const char *paths[] = {"/foo", "/hidden", "/dir", "/dir/dir",
+                         "/dir/folder", "/dir/dir/bar", "/dir/dir/link"};
+  for (unsigned i = 0; i < sizeof(paths) / sizeof(paths[0]); ++i) {
+    DirectoryEntry dirent;
+    EXPECT_TRUE(catalog->LookupPath(PathString(paths[i]), &dirent))
+      << paths[i];
+  }
+  EXPECT_EQ(0, counters.n_rejects->Get());
+  EXPECT_EQ(0, counters.n_false_positives->Get());
+
+  for (unsigned i = 0; i < 100; ++i) {
+    EXPECT_FALSE(catalog->LookupPath(
+      PathString("/dir/fakefile" + StringifyInt(i)), NULL));
+  }
+  EXPECT_EQ(100, counters.n_rejects->Get() +
+                 counters.n_false_positives->Get());
+  EXPECT_GT(counters.n_rejects->Get(), 90);
+}
+
+TEST_F(T_Catalog, RevisionDiff) {
+  const string catalog_db_new = CreateTempPath(sandbox + "/catalog", 0666);
+  ASSERT_TRUE(CopyPath2Path(catalog_db_root, catalog_db_new));
+  catalog::WritableCatalog *writable =
+    catalog::WritableCatalog::AttachFreely("", catalog_db_new,
+                                           shash::Any(shash::kSha1));
+  ASSERT_TRUE(writable != NULL);
+  AddEntry(writable, "new", "/dir", S_IFREG,
+           "38be7d1b981f2fb6a4a0a052453f887373dc1fe8");
+  writable->RemoveEntry("/dir/dir/link");
+  writable->RemoveEntry("/dir/dir/bar2");
+  AddEntry(writable, "bar2", "/dir/dir", S_IFREG,
+           "639daad06642a8eb86821ff7649e86f5f59c6139");
+  writable->InsertNestedCatalog("/dir/dir", NULL, shash::Any(shash::kSha1), 0);
+  writable->Commit();
+  delete writable;
+
+  catalog = Catalog::AttachFreely("", catalog_db_root, shash::Any(), NULL,
+                                  false);
+  Catalog *new_catalog =
+    Catalog::AttachFreely("", catalog_db_new, shash::Any(), NULL, false);
+  ASSERT_TRUE(new_catalog != NULL);
+
+  catalog::RevisionDiff diff;
+  diff.AddCatalogs(catalog, new_catalog);
+  diff.Finalize();
+  EXPECT_EQ(1U, diff.num_diffed_catalogs());
+  EXPECT_TRUE(diff.has_new_nested_catalogs());
+  EXPECT_TRUE(diff.Contains(shash::Md5(shash::AsciiPtr("/dir/new"))));
+  EXPECT_TRUE(diff.Contains(shash::Md5(shash::AsciiPtr("/dir"))));
+  EXPECT_TRUE(diff.Contains(shash::Md5(shash::AsciiPtr("/dir/dir/link"))));
+  EXPECT_TRUE(diff.Contains(shash::Md5(shash::AsciiPtr("/dir/dir"))));
+  EXPECT_TRUE(diff.Contains(shash::Md5(shash::AsciiPtr("/dir/dir/bar2"))));
+  EXPECT_FALSE(diff.Contains(shash::Md5(shash::AsciiPtr("/dir/dir/bar"))));
+  EXPECT_FALSE(diff.Contains(shash::Md5(shash::AsciiPtr("/foo"))));
+  EXPECT_FALSE(diff.Contains(shash::Md5(shash::AsciiPtr("/hidden"))));
+  EXPECT_FALSE(diff.Contains(shash::Md5(shash::AsciiPtr("/dir/folder"))));
+
+  // Catalog removed in the new revision
+  catalog::RevisionDiff diff_removed;
+  diff_removed.AddCatalogs(catalog, NULL);
+  diff_removed.Finalize();
+  EXPECT_TRUE(diff_removed.Contains(shash::Md5(shash::AsciiPtr("/foo"))));
+  EXPECT_FALSE(diff_removed.has_new_nested_catalogs());
+
+  // Identical revisions
+  catalog::RevisionDiff diff_identical;
+  diff_identical.AddCatalogs(catalog, catalog);
+  diff_identical.Finalize();
+  EXPECT_EQ(0U, diff_identical.num_paths());
+  delete new_catalog;
+}
+
+TEST_F(T_Catalog, ConcurrentLookup) {
+  catalog = catalog::Catalog::AttachFreely("",
+                                           catalog_db_root,
+                                           shash::Any(),
+                                           NULL,
+                                           false);
+  const unsigned kNumThreads = 16;
+  pthread_t threads[kNumThreads];
+  for (unsigned i = 0; i < kNumThreads; ++i) {
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL, MainConcurrentLookup,
+                                catalog));
+  }
+  for (unsigned i = 0; i < kNumThreads; ++i) {
+    void *errors;
+    pthread_join(threads[i], &errors);
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(errors));
+  }
+}
+
+// Client catalogs are opened on a cache manager file descriptor.  Every
+// reader needs its own descriptor, otherwise closing the readers closes the
+// descriptor of the catalog several times.
+TEST_F(T_Catalog, ConcurrentLookupVfs) {
+  const string cache_path = sandbox + "/cache";
+  ASSERT_TRUE(MkdirDeep(cache_path, 0700));
+  UniquePtr<PosixCacheManager> cache_mgr(
+    PosixCacheManager::Create(cache_path, false));
+  ASSERT_TRUE(cache_mgr.IsValid());
+  string content;
+  const int fd_db = open(catalog_db_root.c_str(), O_RDONLY);
+  ASSERT_GE(fd_db, 0);
+  ASSERT_TRUE(SafeReadToString(fd_db, &content));
+  close(fd_db);
+  shash::Any id(shash::kSha1);
+  shash::HashString(content, &id);
+  ASSERT_TRUE(cache_mgr->CommitFromMem(id,
+    reinterpret_cast<const unsigned char *>(content.data()), content.size(),
+    "catalog"));
+  perf::Statistics statistics;
+  ASSERT_TRUE(sqlite::RegisterVfsRdOnly(cache_mgr.weak_ref(), &statistics,
+                                        sqlite::kVfsOptDefault));
+  const int fd = cache_mgr->Open(CacheManager::Bless(id));
+  ASSERT_GE(fd, 0);
+
+  catalog = catalog::Catalog::AttachFreely("", "@" + StringifyInt(fd), id,
+                                           NULL, false);
+  ASSERT_TRUE(catalog != NULL);
+  // Open all the readers, each of them on its own descriptor
+  vector<Catalog::Reader *> readers;
+  for (unsigned i = 0; i < Catalog::kMaxReaders; ++i) {
+    readers.push_back(catalog->AcquireReader());
+    ASSERT_TRUE(readers.back() != NULL);
+  }
+  EXPECT_EQ(NULL, catalog->AcquireReader());
+  EXPECT_EQ(static_cast<int64_t>(Catalog::kMaxReaders) + 1,
+            statistics.Lookup("sqlite.no_open")->Get());
+  for (unsigned i = 0; i < readers.size(); ++i)
+    catalog->ReleaseReader(readers[i]);
+
+  const unsigned kNumThreads = 16;
+  pthread_t threads[kNumThreads];
+  for (unsigned i = 0; i < kNumThreads; ++i) {
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL, MainConcurrentLookup,
+                                catalog));
+  }
+  for (unsigned i = 0; i < kNumThreads; ++i) {
+    void *errors;
+    pthread_join(threads[i], &errors);
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(errors));
+  }
+
+  // Every connection closes its descriptor exactly once
+  delete catalog;
+  catalog = NULL;
+  EXPECT_EQ(0, statistics.Lookup("sqlite.no_open")->Get());
+  EXPECT_EQ(-1, fcntl(fd, F_GETFD));
+  EXPECT_TRUE(sqlite::UnregisterVfsRdOnly());
+}
+
 TEST_F(T_Catalog, Chunks) {
   catalog = catalog::Catalog::AttachFreely("",
                                            catalog_db_root,
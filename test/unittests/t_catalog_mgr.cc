@@ -4,15 +4,20 @@
 
 #include <gtest/gtest.h>
 
+#include <pthread.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <string>
+#include <vector>
+
 #include "catalog.h"
 #include "catalog_balancer.h"
 #include "catalog_mgr.h"
 #include "crypto/hash.h"
 #include "shortstring.h"
 #include "testutil.h"
+#include "util/posix.h"
 
 using namespace std;  // NOLINT
 
@@ -219,6 +224,176 @@ TEST_F(T_CatalogManager, Lookup) {
   EXPECT_EQ(4, catalog_mgr_.GetNumCatalogs());
 }
 
+TEST_F(T_CatalogManager, LookupPaths) {
+  ASSERT_TRUE(catalog_mgr_.Init());
+  AddTree();
+  const char *paths[] = {"/dir", "/file1", "/fakefile", "/dir/dir/dir/file4",
+                         "/dir/dir/dir/fakefile", "/nested/file6", "/dir"};
+  const unsigned num_paths = sizeof(paths) / sizeof(paths[0]);
+  std::vector<PathString> path_list;
+  for (unsigned i = 0; i < num_paths; ++i)
+    path_list.push_back(PathString(paths[i]));
+
+  std::vector<catalog::DirectoryEntry> dirents;
+  std::vector<bool> found;
+  EXPECT_EQ(5U, catalog_mgr_.LookupPaths(path_list, kLookupDefault,
+                                         &dirents, &found));
+  ASSERT_EQ(num_paths, dirents.size());
+  ASSERT_EQ(num_paths, found.size());
+  // Paths in nested catalogs mount the catalogs
+  EXPECT_EQ(3, catalog_mgr_.GetNumCatalogs());
+  for (unsigned i = 0; i < num_paths; ++i) {
+    catalog::DirectoryEntry dirent;
+    EXPECT_EQ(catalog_mgr_.LookupPath(paths[i], kLookupDefault, &dirent),
+              found[i]) << paths[i];
+    EXPECT_EQ(dirent.name(), dirents[i].name()) << paths[i];
+    EXPECT_EQ(dirent.inode(), dirents[i].inode()) << paths[i];
+    EXPECT_EQ(dirent.IsNegative(), dirents[i].IsNegative()) << paths[i];
+  }
+  EXPECT_TRUE(dirents[2].IsNegative());
+  EXPECT_TRUE(dirents[4].IsNegative());
+}
+
+/**
+ * Blocks loading the nested catalog at /nested until it is released through
+ * pipe_release_
+ */
+class BlockingCatalogManager : public MockCatalogManager {
+ public:
+  explicit BlockingCatalogManager(perf::Statistics *statistics)
+    : MockCatalogManager(statistics)
+  {
+    MakePipe(pipe_loading_);
+    MakePipe(pipe_release_);
+  }
+
+  virtual ~BlockingCatalogManager() {
+    ClosePipe(pipe_loading_);
+    ClosePipe(pipe_release_);
+  }
+
+  virtual LoadError LoadCatalog(const PathString &mountpoint,
+                                const shash::Any &hash,
+                                std::string  *catalog_path,
+                                shash::Any   *catalog_hash)
+  {
+    if (mountpoint == PathString("/nested")) {
+      char c = 'L';
+      WritePipe(pipe_loading_[1], &c, 1);
+      ReadPipe(pipe_release_[0], &c, 1);
+    }
+    return MockCatalogManager::LoadCatalog(mountpoint, hash, catalog_path,
+                                           catalog_hash);
+  }
+
+  int pipe_loading_[2];
+  int pipe_release_[2];
+};
+
+static void *MainLookupNested(void *data) {
+  BlockingCatalogManager *catalog_mgr =
+    reinterpret_cast<BlockingCatalogManager *>(data);
+  catalog::DirectoryEntry dirent;
+  const bool found =
+    catalog_mgr->LookupPath("/nested/file6", kLookupDefault, &dirent);
+  return found ? data : NULL;
+}
+
+TEST_F(T_CatalogManager, LookupWhileMounting) {
+  perf::Statistics statistics;
+  BlockingCatalogManager catalog_mgr(&statistics);
+  ASSERT_TRUE(catalog_mgr.Init());
+  const shash::Any empty_content;
+  const shash::Any hash(shash::kSha1,
+                        reinterpret_cast<const unsigned char*>(hashes[0]),
+                        shash::kSha1);
+  MockCatalog *root_catalog = catalog_mgr.RetrieveRootCatalog();
+  root_catalog->AddFile(empty_content, 4096, "", "");
+  root_catalog->AddFile(hash, 4096, "", "file1");
+  root_catalog->AddFile(empty_content, 4096, "", "nested");
+  MockCatalog *nested_catalog = new MockCatalog("/nested", shash::Any(),
+                                                4096, 1, 0, false,
+                                                root_catalog, NULL);
+  nested_catalog->AddFile(hash, 4096, "/nested", "file6");
+  catalog_mgr.RegisterNewCatalog(nested_catalog);
+
+  pthread_t thread_lookup;
+  ASSERT_EQ(0, pthread_create(&thread_lookup, NULL, MainLookupNested,
+                              &catalog_mgr));
+  char c;
+  ReadPipe(catalog_mgr.pipe_loading_[0], &c, 1);
+  // Loading the nested catalog must not block lookups in the root catalog
+  catalog::DirectoryEntry dirent;
+  EXPECT_TRUE(catalog_mgr.LookupPath("/file1", kLookupDefault, &dirent));
+  EXPECT_TRUE(dirent.IsRegular());
+  EXPECT_EQ(1, catalog_mgr.GetNumCatalogs());
+  WritePipe(catalog_mgr.pipe_release_[1], &c, 1);
+
+  void *found;
+  ASSERT_EQ(0, pthread_join(thread_lookup, &found));
+  EXPECT_TRUE(found != NULL);
+  EXPECT_EQ(2, catalog_mgr.GetNumCatalogs());
+}
+
+/**
+ * Records the mount points of the catalogs handed to PrefetchCatalogs()
+ */
+class PrefetchCatalogManager : public MockCatalogManager {
+ public:
+  explicit PrefetchCatalogManager(perf::Statistics *statistics)
+    : MockCatalogManager(statistics) { }
+
+  virtual void PrefetchCatalogs(const Catalog::NestedCatalogList &catalogs) {
+    for (unsigned i = 0; i < catalogs.size(); ++i)
+      prefetched_.push_back(catalogs[i].mountpoint.ToString());
+  }
+
+  vector<string> prefetched_;
+};
+
+TEST_F(T_CatalogManager, PrefetchSiblings) {
+  perf::Statistics statistics;
+  PrefetchCatalogManager catalog_mgr(&statistics);
+  catalog_mgr.SetNestedPrefetchBudget(2);
+  ASSERT_TRUE(catalog_mgr.Init());
+  const shash::Any empty_content;
+  const shash::Any hash(shash::kSha1,
+                        reinterpret_cast<const unsigned char*>(hashes[0]),
+                        shash::kSha1);
+  MockCatalog *root_catalog = catalog_mgr.RetrieveRootCatalog();
+  root_catalog->AddFile(empty_content, 4096, "", "");
+  const char *names[] = {"a", "b", "c", "d"};
+  for (unsigned i = 0; i < 4; ++i) {
+    root_catalog->AddFile(empty_content, 4096, "", names[i]);
+    MockCatalog *nested_catalog = new MockCatalog(string("/") + names[i],
+                                                  shash::Any(), 4096, 1, 0,
+                                                  false, root_catalog, NULL);
+    nested_catalog->AddFile(hash, 4096, string("/") + names[i], "file");
+    catalog_mgr.RegisterNewCatalog(nested_catalog);
+  }
+
+  catalog::DirectoryEntry dirent;
+  // Mounting /b prefetches the siblings that follow it
+  EXPECT_TRUE(catalog_mgr.LookupPath("/b/file", kLookupDefault, &dirent));
+  ASSERT_EQ(2U, catalog_mgr.prefetched_.size());
+  EXPECT_EQ("/c", catalog_mgr.prefetched_[0]);
+  EXPECT_EQ("/d", catalog_mgr.prefetched_[1]);
+
+  // Attached catalogs are not prefetched
+  catalog_mgr.prefetched_.clear();
+  EXPECT_TRUE(catalog_mgr.LookupPath("/d/file", kLookupDefault, &dirent));
+  ASSERT_EQ(2U, catalog_mgr.prefetched_.size());
+  EXPECT_EQ("/a", catalog_mgr.prefetched_[0]);
+  EXPECT_EQ("/c", catalog_mgr.prefetched_[1]);
+  EXPECT_EQ(3, catalog_mgr.GetNumCatalogs());
+
+  // Without a budget, nothing is prefetched
+  catalog_mgr.prefetched_.clear();
+  catalog_mgr.SetNestedPrefetchBudget(0);
+  EXPECT_TRUE(catalog_mgr.LookupPath("/c/file", kLookupDefault, &dirent));
+  EXPECT_TRUE(catalog_mgr.prefetched_.empty());
+}
+
 TEST_F(T_CatalogManager, LongLookup) {
   catalog::DirectoryEntry dirent;
   ASSERT_TRUE(catalog_mgr_.Init());
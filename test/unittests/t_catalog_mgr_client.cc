@@ -0,0 +1,188 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "catalog.h"
+#include "catalog_mgr_client.h"
+#include "catalog_test_tools.h"
+#include "crypto/hash.h"
+#include "mountpoint.h"
+#include "network/download.h"
+#include "options.h"
+#include "shortstring.h"
+#include "statistics.h"
+#include "testutil.h"
+#include "util/pointer.h"
+#include "util/posix.h"
+#include "util/string.h"
+#include "util/uuid.h"
+
+using namespace std;  // NOLINT
+
+namespace catalog {
+
+class T_ClientCatalogManager : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    repo_path_ = "repo";
+    uuid_dummy_ = cvmfs::Uuid::Create("");
+    used_fds_ = GetNoUsedFds();
+    fd_cwd_ = open(".", O_RDONLY);
+    ASSERT_GE(fd_cwd_, 0);
+    tmp_path_ = CreateTempDir("./cvmfs_ut_catalog_mgr_client");
+    options_mgr_.SetValue("CVMFS_CACHE_BASE", tmp_path_);
+    options_mgr_.SetValue("CVMFS_SHARED_CACHE", "no");
+    options_mgr_.SetValue("CVMFS_MAX_RETRIES", "0");
+    options_mgr_.SetValue("CVMFS_MOUNT_DIR", "/no/such/dir");
+    fs_info_.name = "unit-test";
+    fs_info_.options_mgr = &options_mgr_;
+    CreateMiniRepository(&options_mgr_, &repo_path_);
+    file_system_ = FileSystem::Create(fs_info_);
+    ASSERT_EQ(loader::kFailOk, file_system_->boot_status());
+  }
+
+  virtual void TearDown() {
+    delete file_system_;
+    delete uuid_dummy_;
+    int retval = fchdir(fd_cwd_);
+    ASSERT_EQ(0, retval);
+    close(fd_cwd_);
+    if (tmp_path_ != "")
+      RemoveTree(tmp_path_);
+    if (repo_path_ != "")
+      RemoveTree(repo_path_);
+    EXPECT_EQ(used_fds_, GetNoUsedFds()) << ShowOpenFiles();
+  }
+
+  /**
+   * Nested catalogs that cannot be found anywhere
+   */
+  static Catalog::NestedCatalogList MakeNested(unsigned n) {
+    Catalog::NestedCatalogList result;
+    for (unsigned i = 0; i < n; ++i) {
+      Catalog::NestedCatalog nested;
+      nested.mountpoint = PathString("/nested" + StringifyInt(i));
+      nested.hash = shash::Any(shash::kSha1, shash::kSuffixCatalog);
+      nested.hash.Randomize(i);
+      nested.size = 0;
+      result.push_back(nested);
+    }
+    return result;
+  }
+
+  FileSystem::FileSystemInfo fs_info_;
+  SimpleOptionsParser options_mgr_;
+  FileSystem *file_system_;
+  string tmp_path_;
+  string repo_path_;
+  int fd_cwd_;
+  unsigned used_fds_;
+  cvmfs::Uuid *uuid_dummy_;
+};
+
+
+TEST_F(T_ClientCatalogManager, Prefetch) {
+  options_mgr_.SetValue("CVMFS_CATALOG_PREFETCH", "100000");
+  {
+    UniquePtr<MountPoint> mp(MountPoint::Create("keys.cern.ch", file_system_));
+    ASSERT_EQ(loader::kFailOk, mp->boot_status());
+    const unsigned max_budget = ClientCatalogManager::kMaxPrefetchBudget;
+    EXPECT_EQ(max_budget, mp->catalog_mgr()->prefetch_budget_);
+  }
+
+  // A server that accepts connections but never answers keeps the prefetch
+  // threads busy until the download times out
+  int fd_server = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_GE(fd_server, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t addr_len = sizeof(addr);
+  ASSERT_EQ(0, bind(fd_server, reinterpret_cast<struct sockaddr *>(&addr),
+                    addr_len));
+  ASSERT_EQ(0, listen(fd_server, 16));
+  ASSERT_EQ(0, getsockname(fd_server,
+                           reinterpret_cast<struct sockaddr *>(&addr),
+                           &addr_len));
+
+  const Catalog::NestedCatalogList nested = MakeNested(7);
+  const unsigned num_threads = FindDirectories("/proc/self/task").size();
+  options_mgr_.SetValue("CVMFS_CATALOG_PREFETCH", "2");
+  UniquePtr<MountPoint> mp(MountPoint::Create("keys.cern.ch", file_system_));
+  ASSERT_EQ(loader::kFailOk, mp->boot_status());
+  mp->download_mgr()->SetHostChain(
+    "http://127.0.0.1:" + StringifyInt(ntohs(addr.sin_port)) + "/repo");
+  mp->download_mgr()->SetTimeout(1, 1);
+  ClientCatalogManager *catalog_mgr = mp->catalog_mgr();
+
+  // Occupy all the prefetch threads
+  const unsigned num_prefetch_threads =
+    ClientCatalogManager::kNumPrefetchThreads;
+  for (unsigned i = 0; i < num_prefetch_threads; i += 2) {
+    catalog_mgr->PrefetchCatalogs(Catalog::NestedCatalogList(
+      nested.begin() + i, nested.begin() + i + 2));
+    while (true) {
+      {
+        MutexLockGuard m(&catalog_mgr->lock_prefetch_);
+        if (catalog_mgr->prefetch_inflight_.size() == i + 2)
+          break;
+      }
+      SafeSleepMs(10);
+    }
+  }
+  EXPECT_EQ(num_prefetch_threads, catalog_mgr->threads_prefetch_.size());
+
+  // In-flight and queued catalogs are not queued again, at most the budget
+  // of catalogs is queued
+  Catalog::NestedCatalogList batch;
+  batch.push_back(nested[0]);
+  batch.push_back(nested[4]);
+  catalog_mgr->PrefetchCatalogs(batch);
+  batch.clear();
+  batch.push_back(nested[4]);
+  batch.push_back(nested[5]);
+  batch.push_back(nested[6]);
+  catalog_mgr->PrefetchCatalogs(batch);
+  {
+    MutexLockGuard m(&catalog_mgr->lock_prefetch_);
+    ASSERT_EQ(2U, catalog_mgr->prefetch_queue_.size());
+    EXPECT_EQ(nested[4].hash, catalog_mgr->prefetch_queue_[0].hash);
+    EXPECT_EQ(nested[5].hash, catalog_mgr->prefetch_queue_[1].hash);
+    EXPECT_EQ(num_prefetch_threads, catalog_mgr->prefetch_inflight_.size());
+  }
+
+  // Queued catalogs are dropped from the queue, in-flight ones are waited for
+  catalog_mgr->WaitForPrefetch(nested[5].hash);
+  EXPECT_EQ(0, catalog_mgr->n_prefetch_waits_->Get());
+  catalog_mgr->WaitForPrefetch(nested[0].hash);
+  EXPECT_EQ(1, catalog_mgr->n_prefetch_waits_->Get());
+  {
+    // The thread that prefetched the waited for catalog picks up the next
+    // queued one before it releases the lock
+    MutexLockGuard m(&catalog_mgr->lock_prefetch_);
+    EXPECT_EQ(0U, catalog_mgr->prefetch_inflight_.count(nested[0].hash));
+    EXPECT_EQ(1U, catalog_mgr->prefetch_inflight_.count(nested[4].hash));
+    EXPECT_TRUE(catalog_mgr->prefetch_queue_.empty());
+  }
+  EXPECT_EQ(0, catalog_mgr->n_prefetch_->Get());
+
+  // Unmounting joins the prefetch threads while they are still downloading
+  mp.Destroy();
+  EXPECT_EQ(num_threads, FindDirectories("/proc/self/task").size());
+  close(fd_server);
+}
+
+}  // namespace catalog
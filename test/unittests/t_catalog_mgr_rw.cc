@@ -4,11 +4,23 @@
 
 #include <gtest/gtest.h>
 
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "catalog_diff_tool.h"
+#include "catalog_mgr_ro.h"
 #include "catalog_mgr_rw.h"
+#include "catalog_sql.h"
 #include "catalog_test_tools.h"
+#include "compression.h"
 #include "network/download.h"
+#include "server_tool.h"
 #include "statistics.h"
+#include "testutil.h"
 #include "upload.h"
+#include "util/pointer.h"
+#include "util/posix.h"
 
 using namespace std;  // NOLINT
 
@@ -74,6 +86,88 @@ DirSpec MakeBaseSpec() {
   return spec;
 }
 
+/**
+ * Records the reported differences and the directories that the diff
+ * descended into
+ */
+class DiffRecorder : public CatalogDiffTool<catalog::SimpleCatalogManager> {
+ public:
+  DiffRecorder(const std::string &repo_path,
+               const shash::Any &old_root_hash,
+               const shash::Any &new_root_hash,
+               download::DownloadManager *download_manager)
+    : CatalogDiffTool<catalog::SimpleCatalogManager>(
+        repo_path, old_root_hash, new_root_hash,
+        GetCurrentWorkingDirectory() + "/diff_recorder", download_manager)
+  { }
+
+  std::vector<std::string> visited;
+  std::vector<std::string> changes;
+
+ protected:
+  virtual bool IsIgnoredPath(const PathString &path) {
+    visited.push_back(path.ToString());
+    return false;
+  }
+  virtual void ReportAddition(const PathString &path,
+                              const catalog::DirectoryEntry & /* entry */,
+                              const XattrList & /* xattrs */,
+                              const FileChunkList & /* chunks */)
+  {
+    changes.push_back("+" + path.ToString());
+  }
+  virtual void ReportRemoval(const PathString &path,
+                             const catalog::DirectoryEntry & /* entry */)
+  {
+    changes.push_back("-" + path.ToString());
+  }
+  virtual bool ReportModification(const PathString &path,
+                                  const catalog::DirectoryEntry & /* old */,
+                                  const catalog::DirectoryEntry & /* new */,
+                                  const XattrList & /* xattrs */,
+                                  const FileChunkList & /* chunks */)
+  {
+    changes.push_back("~" + path.ToString());
+    return true;
+  }
+};
+
+bool Contains(const std::vector<std::string> &list, const std::string &item) {
+  for (unsigned i = 0; i < list.size(); ++i) {
+    if (list[i] == item)
+      return true;
+  }
+  return false;
+}
+
+/**
+ * Stores a copy of the catalog with schema revision 6, i.e. without the
+ * directory digests table, and returns its hash
+ */
+shash::Any StoreAsRevision6(const std::string &stratum0,
+                            const shash::Any &catalog_hash)
+{
+  const std::string db_path = CreateTempPath("./catalog_rev6", 0600);
+  EXPECT_TRUE(zlib::DecompressPath2Path(
+    stratum0 + "/data/" + catalog_hash.MakePath(), db_path));
+  {
+    UniquePtr<catalog::CatalogDatabase> db(catalog::CatalogDatabase::Open(
+      db_path, catalog::CatalogDatabase::kOpenReadWrite));
+    EXPECT_TRUE(db.IsValid());
+    EXPECT_TRUE(sqlite::Sql(db->sqlite_db(),
+      "DROP TABLE directory_digests;").Execute());
+    EXPECT_TRUE(sqlite::Sql(db->sqlite_db(),
+      "UPDATE properties SET value=6 WHERE key='schema_revision';").Execute());
+  }
+  const std::string compressed_path = db_path + ".z";
+  shash::Any result(catalog_hash.algorithm, shash::kSuffixCatalog);
+  EXPECT_TRUE(zlib::CompressPath2Path(db_path, compressed_path, &result));
+  EXPECT_EQ(0, rename(compressed_path.c_str(),
+                      (stratum0 + "/data/" + result.MakePath()).c_str()));
+  unlink(db_path.c_str());
+  return result;
+}
+
 }  // anonymous namespace
 
 
@@ -222,4 +316,160 @@ TEST_F(T_CatalogMgrRw, SwapNestedCatalogFailSlow) {
                                               subX_hash, subX_size));
 }
 
+
+TEST_F(T_CatalogMgrRw, DirectoryDigests) {
+  CatalogTestTool tester("directory_digests");
+  EXPECT_TRUE(tester.Init());
+
+  DirSpec spec = MakeBaseSpec();
+  EXPECT_TRUE(tester.ApplyAtRootHash(tester.manifest()->catalog_hash(), spec));
+
+  catalog::WritableCatalogManager *catalog_mgr = tester.catalog_mgr();
+  shash::Any digest_dir;
+  EXPECT_FALSE(catalog_mgr->LookupDirectoryDigest(PathString("/dir"),
+                                                  &digest_dir));
+
+  // First commit with digests computes all digests of the modified catalog
+  catalog_mgr->SetDirectoryDigests(true);
+  catalog_mgr->RemoveFile("dir/dir2/file2");
+  EXPECT_TRUE(catalog_mgr->Commit(false, 0, tester.manifest()));
+  shash::Any digest_root, digest_dir_dir, digest_dir2, digest_dir3;
+  EXPECT_TRUE(catalog_mgr->LookupDirectoryDigest(PathString(""),
+                                                 &digest_root));
+  EXPECT_TRUE(catalog_mgr->LookupDirectoryDigest(PathString("/dir"),
+                                                 &digest_dir));
+  EXPECT_TRUE(catalog_mgr->LookupDirectoryDigest(PathString("/dir/dir"),
+                                                 &digest_dir_dir));
+  EXPECT_TRUE(catalog_mgr->LookupDirectoryDigest(PathString("/dir/dir2"),
+                                                 &digest_dir2));
+  EXPECT_TRUE(catalog_mgr->LookupDirectoryDigest(PathString("/dir/dir3"),
+                                                 &digest_dir3));
+  EXPECT_NE(digest_dir2, digest_dir3);
+  EXPECT_NE(digest_dir, digest_dir_dir);
+  // The unmodified nested catalog has no digests yet
+  shash::Any digest_nested;
+  EXPECT_FALSE(catalog_mgr->LookupDirectoryDigest(PathString("/dir/dir/dir"),
+                                                  &digest_nested));
+
+  // Incremental update: only the modified directories change
+  catalog_mgr->RemoveFile("dir/dir3/file2");
+  EXPECT_TRUE(catalog_mgr->Commit(false, 0, tester.manifest()));
+  shash::Any digest;
+  EXPECT_TRUE(catalog_mgr->LookupDirectoryDigest(PathString("/dir/dir3"),
+                                                 &digest));
+  EXPECT_NE(digest_dir3, digest);
+  EXPECT_EQ(digest_dir2, digest);
+  EXPECT_TRUE(catalog_mgr->LookupDirectoryDigest(PathString("/dir/dir"),
+                                                 &digest));
+  EXPECT_EQ(digest_dir_dir, digest);
+  EXPECT_TRUE(catalog_mgr->LookupDirectoryDigest(PathString("/dir"),
+                                                 &digest));
+  EXPECT_NE(digest_dir, digest);
+  EXPECT_TRUE(catalog_mgr->LookupDirectoryDigest(PathString(""), &digest));
+  EXPECT_NE(digest_root, digest);
+
+  // Modifications of nested catalogs propagate into the parent digests
+  digest_root = digest;
+  catalog_mgr->RemoveFile("dir/dir/dir/sub1/file1");
+  EXPECT_TRUE(catalog_mgr->Commit(false, 0, tester.manifest()));
+  EXPECT_TRUE(catalog_mgr->LookupDirectoryDigest(PathString("/dir/dir/dir"),
+                                                 &digest_nested));
+  EXPECT_TRUE(catalog_mgr->LookupDirectoryDigest(PathString(""), &digest));
+  EXPECT_NE(digest_root, digest);
+}
+
+
+/**
+ * Builds the same two revisions once without and once with directory digests
+ */
+class DigestRevisions {
+ public:
+  explicit DigestRevisions(CatalogTestTool *tester) {
+    const shash::Any base = tester->manifest()->catalog_hash();
+    for (unsigned i = 0; i < 2; ++i) {
+      EXPECT_TRUE(tester->ApplyAtRootHash(base, MakeBaseSpec()));
+      WritableCatalogManager *catalog_mgr = tester->catalog_mgr();
+      catalog_mgr->SetDirectoryDigests(i == 1);
+      catalog_mgr->RemoveFile("dir/file1");
+      EXPECT_TRUE(catalog_mgr->Commit(false, 0, tester->manifest()));
+      old_hashes[i] = tester->manifest()->catalog_hash();
+      catalog_mgr->RemoveFile("dir/dir2/file2");
+      EXPECT_TRUE(catalog_mgr->Commit(false, 0, tester->manifest()));
+      new_hashes[i] = tester->manifest()->catalog_hash();
+    }
+  }
+
+  // Index 0: no digests, index 1: with digests
+  shash::Any old_hashes[2];
+  shash::Any new_hashes[2];
+};
+
+
+TEST_F(T_CatalogMgrRw, DirectoryDigestsPruneDiff) {
+  CatalogTestTool tester("directory_digests_prune");
+  EXPECT_TRUE(tester.Init());
+  DigestRevisions revisions(&tester);
+  UniquePtr<ServerTool> server_tool(new ServerTool());
+  EXPECT_TRUE(server_tool->InitDownloadManager(true, ""));
+  const std::string stratum0 = "file://" + tester.repo_name();
+
+  DiffRecorder plain(stratum0, revisions.old_hashes[0],
+                     revisions.new_hashes[0], server_tool->download_manager());
+  EXPECT_TRUE(plain.Init());
+  EXPECT_TRUE(plain.Run(PathString("")));
+  DiffRecorder digests(stratum0, revisions.old_hashes[1],
+                       revisions.new_hashes[1],
+                       server_tool->download_manager());
+  EXPECT_TRUE(digests.Init());
+  EXPECT_TRUE(digests.Run(PathString("")));
+
+  EXPECT_TRUE(Contains(digests.changes, "-/dir/dir2/file2"));
+  // The changed directory and its parents are compared in both cases
+  EXPECT_TRUE(Contains(digests.visited, "/dir"));
+  EXPECT_TRUE(Contains(digests.visited, "/dir/dir2"));
+  // Unchanged directories are only descended into without digests
+  EXPECT_TRUE(Contains(plain.visited, "/dir/dir"));
+  EXPECT_TRUE(Contains(plain.visited, "/dir/dir3"));
+  EXPECT_FALSE(Contains(digests.visited, "/dir/dir"));
+  EXPECT_FALSE(Contains(digests.visited, "/dir/dir3"));
+  EXPECT_LT(digests.visited.size(), plain.visited.size());
+}
+
+
+TEST_F(T_CatalogMgrRw, DirectoryDigestsSameDiff) {
+  CatalogTestTool tester("directory_digests_same");
+  EXPECT_TRUE(tester.Init());
+  DigestRevisions revisions(&tester);
+  UniquePtr<ServerTool> server_tool(new ServerTool());
+  EXPECT_TRUE(server_tool->InitDownloadManager(true, ""));
+  const std::string stratum0 = "file://" + tester.repo_name();
+
+  // Index 2: the revisions with digests stored as schema revision 6
+  shash::Any old_hashes[3];
+  shash::Any new_hashes[3];
+  for (unsigned i = 0; i < 2; ++i) {
+    old_hashes[i] = revisions.old_hashes[i];
+    new_hashes[i] = revisions.new_hashes[i];
+  }
+  old_hashes[2] = StoreAsRevision6(tester.repo_name(), old_hashes[1]);
+  new_hashes[2] = StoreAsRevision6(tester.repo_name(), new_hashes[1]);
+
+  DiffRecorder plain(stratum0, old_hashes[0], new_hashes[0],
+                     server_tool->download_manager());
+  EXPECT_TRUE(plain.Init());
+  EXPECT_TRUE(plain.Run(PathString("")));
+  EXPECT_TRUE(Contains(plain.changes, "-/dir/dir2/file2"));
+
+  // Digests on both sides, on one side, and on neither side
+  for (unsigned i = 1; i < 3; ++i) {
+    for (unsigned j = 1; j < 3; ++j) {
+      DiffRecorder diff(stratum0, old_hashes[i], new_hashes[j],
+                        server_tool->download_manager());
+      EXPECT_TRUE(diff.Init());
+      EXPECT_TRUE(diff.Run(PathString("")));
+      EXPECT_EQ(plain.changes, diff.changes) << "old " << i << ", new " << j;
+    }
+  }
+}
+
 }  // namespace catalog
@@ -4,10 +4,14 @@
 
 #include "gtest/gtest.h"
 
+#include <pthread.h>
 #include <unistd.h>
 
 #include <cassert>
 #include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
 
 #include "c_file_sandbox.h"
 #include "c_http_server.h"
@@ -17,9 +21,11 @@
 #include "network/download.h"
 #include "network/sink.h"
 #include "statistics.h"
+#include "util/atomic.h"
 #include "util/file_guard.h"
 #include "util/posix.h"
 #include "util/prng.h"
+#include "util/string.h"
 
 using namespace std;  // NOLINT
 
@@ -352,6 +358,70 @@ TEST_F(T_Download, RemoteFileSwitchProxies) {
   EXPECT_STREQ(info.destination_mem.data, src_content.c_str());
 }
 
+struct ShardedFetchJob {
+  DownloadManager *download_mgr;
+  const vector<string> *urls;
+  const vector<shash::Any> *hashes;
+  atomic_int32 *num_errors;
+};
+
+static void *MainShardedFetch(void *data) {
+  ShardedFetchJob *job = static_cast<ShardedFetchJob *>(data);
+  for (unsigned i = 0; i < job->urls->size(); ++i) {
+    JobInfo info(&(*job->urls)[i], false /* compressed */,
+                 false /* probe hosts */, &(*job->hashes)[i]);
+    job->download_mgr->Fetch(&info);
+    if (info.error_code != kFailOk)
+      atomic_inc32(job->num_errors);
+    free(info.destination_mem.data);
+  }
+  return NULL;
+}
+
+TEST_F(T_Download, RemoteFileSharded) {
+  const unsigned kNumFiles = 16;
+  const unsigned kNumThreads = 4;
+  vector<string> urls;
+  vector<shash::Any> hashes;
+  for (unsigned i = 0; i < kNumFiles; ++i) {
+    const string content = "sharded content " + StringifyInt(i);
+    const string name = "sharded" + StringifyInt(i);
+    ASSERT_TRUE(SafeWriteToFile(content, sandbox_path_ + "/" + name, 0600));
+    urls.push_back("http://127.0.0.1:8082/" + name);
+    hashes.push_back(shash::Any(shash::kSha1));
+    shash::HashString(content, &hashes[i]);
+  }
+
+  DownloadManager sharded_mgr;
+  sharded_mgr.Init(8, perf::StatisticsTemplate("sharded", &statistics), 4);
+  EXPECT_EQ(4U, sharded_mgr.num_shards());
+  sharded_mgr.Spawn();
+
+  MockFileServer file_server(8082, sandbox_path_);
+  atomic_int32 num_errors;
+  atomic_init32(&num_errors);
+  ShardedFetchJob job;
+  job.download_mgr = &sharded_mgr;
+  job.urls = &urls;
+  job.hashes = &hashes;
+  job.num_errors = &num_errors;
+  pthread_t threads[kNumThreads];
+  for (unsigned i = 0; i < kNumThreads; ++i)
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL, MainShardedFetch, &job));
+  for (unsigned i = 0; i < kNumThreads; ++i)
+    pthread_join(threads[i], NULL);
+  EXPECT_EQ(0, atomic_read32(&num_errors));
+  EXPECT_EQ(static_cast<int>(kNumFiles * kNumThreads),
+            file_server.num_processed_requests());
+
+  DownloadManager *clone = sharded_mgr.Clone(
+    perf::StatisticsTemplate("sharded_clone", &statistics));
+  EXPECT_EQ(4U, clone->num_shards());
+  clone->Fini();
+  delete clone;
+  sharded_mgr.Fini();
+}
+
 TEST_F(T_Download, RemoteFileEmpty) {
   string src_path = GetEmptyFile();
 
@@ -306,6 +306,45 @@ TEST_F(T_Fetcher, FetchUncompressed) {
 }
 
 
+TEST_F(T_Fetcher, FetchStreaming) {
+  {
+    Fetcher f(cache_mgr_, download_mgr_, &backoff_throttle_,
+              perf::StatisticsTemplate("fetch-streaming", &statistics_));
+    f.EnableStreaming(1);
+    // Streaming requires a known size
+    int fd = f.Fetch(hash_uncompressed_, CacheManager::kSizeUnknown, "x",
+                     zlib::kNoCompression, CacheManager::kTypeRegular,
+                     "", -1, true);
+    EXPECT_GE(fd, 0);
+    EXPECT_EQ(0, cache_mgr_->Close(fd));
+    EXPECT_EQ(0, unlink(
+      (tmp_path_ + "/" + hash_uncompressed_.MakePath()).c_str()));
+
+    fd = f.Fetch(hash_uncompressed_, 1, "x",
+                 zlib::kNoCompression, CacheManager::kTypeRegular,
+                 "", -1, true);
+    EXPECT_GE(fd, 0);
+    unsigned char buf = 0;
+    EXPECT_EQ(1, cache_mgr_->Pread(fd, &buf, 1, 0));
+    EXPECT_EQ('x', buf);
+    EXPECT_EQ(0, cache_mgr_->Close(fd));
+
+    // Readers of a failed stream get EIO
+    shash::Any rnd_hash(shash::kSha1);
+    rnd_hash.Randomize();
+    fd = f.Fetch(rnd_hash, 1, "rnd", zlib::kNoCompression,
+                 CacheManager::kTypeRegular, "", -1, true);
+    EXPECT_GE(fd, 0);
+    EXPECT_EQ(-EIO, cache_mgr_->Pread(fd, &buf, 1, 0));
+    EXPECT_EQ(0, cache_mgr_->Close(fd));
+  }
+  // The fetcher waits for the streamed downloads on destruction
+  int fd = cache_mgr_->Open(CacheManager::Bless(hash_uncompressed_));
+  EXPECT_GE(fd, 0);
+  EXPECT_EQ(0, cache_mgr_->Close(fd));
+}
+
+
 TEST_F(T_Fetcher, FetchAltPath) {
   unlink((src_path_ + "/" + hash_regular_.MakePath()).c_str());
   int fd;
@@ -373,7 +412,7 @@ void *TestFetchCollapse2(void *data) {
     Fetcher::ThreadQueues::iterator iDownloadQueue =
       f->queues_download_.begin();
     for (; iDownloadQueue != f->queues_download_.end(); ++iDownloadQueue) {
-      if (iDownloadQueue->second->size() > 0) {
+      if (iDownloadQueue->second->num_waiters > 0) {
         // printf("open up %s", iDownloadQueue->first.ToString().c_str());
         bcm->stall_in_ctrltxn = false;
         atomic_inc32(&bcm->continue_ctrltxn);
@@ -431,37 +470,37 @@ TEST_F(T_Fetcher, SignalWaitingThreads) {
   EXPECT_TRUE(cache_mgr_->CommitFromMem(hash_regular_, &x, 1, ""));
   int fd = cache_mgr_->Open(CacheManager::Bless(hash_regular_));
   EXPECT_GE(fd, 0);
-  int tls_pipe[2];
-  MakePipe(tls_pipe);
-
-  fetcher_->queues_download_[hash_regular_] = NULL;
-  fetcher_->queues_download_[hash_catalog_] = NULL;
-  fetcher_->queues_download_[hash_cert_] = NULL;
 
-  fetcher_->GetTls()->other_pipes_waiting.push_back(tls_pipe[1]);
-  fetcher_->SignalWaitingThreads(-1, hash_regular_, fetcher_->GetTls());
+  Fetcher::InflightDownload *inflight = new Fetcher::InflightDownload();
+  fetcher_->queues_download_[hash_regular_] = inflight;
+  fetcher_->SignalWaitingThreads(-1, hash_regular_, inflight);
   EXPECT_EQ(0U, fetcher_->queues_download_.count(hash_regular_));
 
-  fetcher_->GetTls()->other_pipes_waiting.push_back(tls_pipe[1]);
-  fetcher_->SignalWaitingThreads(fd, hash_catalog_, fetcher_->GetTls());
+  inflight = new Fetcher::InflightDownload();
+  inflight->num_waiters = 2;
+  atomic_xadd32(&inflight->refcount, 2);
+  fetcher_->queues_download_[hash_catalog_] = inflight;
+  fetcher_->SignalWaitingThreads(fd, hash_catalog_, inflight);
   EXPECT_EQ(0U, fetcher_->queues_download_.count(hash_catalog_));
-
-  fetcher_->GetTls()->other_pipes_waiting.push_back(tls_pipe[1]);
-  fetcher_->SignalWaitingThreads(1000000, hash_cert_, fetcher_->GetTls());
-  EXPECT_EQ(0U, fetcher_->queues_download_.count(hash_cert_));
-
-  int fd_return0;
-  int fd_return1;
-  int fd_return2;
-  ReadPipe(tls_pipe[0], &fd_return0, sizeof(fd_return0));
-  ReadPipe(tls_pipe[0], &fd_return1, sizeof(fd_return1));
-  ReadPipe(tls_pipe[0], &fd_return2, sizeof(fd_return2));
-  EXPECT_EQ(-1, fd_return0);
+  int fd_return0 = inflight->Wait(0);
+  int fd_return1 = inflight->Wait(1);
+  EXPECT_NE(fd, fd_return0);
   EXPECT_NE(fd, fd_return1);
+  EXPECT_NE(fd_return0, fd_return1);
+  EXPECT_EQ(0, cache_mgr_->Close(fd_return0));
   EXPECT_EQ(0, cache_mgr_->Close(fd_return1));
-  EXPECT_EQ(-EBADF, fd_return2);
+  inflight->Release();
+  inflight->Release();
+
+  inflight = new Fetcher::InflightDownload();
+  inflight->num_waiters = 1;
+  atomic_inc32(&inflight->refcount);
+  fetcher_->queues_download_[hash_cert_] = inflight;
+  fetcher_->SignalWaitingThreads(1000000, hash_cert_, inflight);
+  EXPECT_EQ(0U, fetcher_->queues_download_.count(hash_cert_));
+  EXPECT_EQ(-EBADF, inflight->Wait(0));
+  inflight->Release();
 
-  ClosePipe(tls_pipe);
   EXPECT_EQ(0, cache_mgr_->Close(fd));
 }
 
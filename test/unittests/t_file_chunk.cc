@@ -107,3 +107,46 @@ TEST_F(T_FileChunk, HashChunkList) {
   HashMem(buf, 40, &hash_cmp);
   EXPECT_EQ(h, hash_cmp);
 }
+
+
+TEST_F(T_FileChunk, ChunkTables) {
+  ChunkTables tables;
+  EXPECT_EQ(0U, tables.NumHandles());
+
+  for (uint64_t inode = 1; inode <= 100; ++inode) {
+    const uint64_t handle = tables.NextHandle();
+    EXPECT_EQ(inode + 1, handle);
+    ChunkTables::Shard *handle_shard = tables.Handle2Shard(handle);
+    handle_shard->Lock();
+    handle_shard->handle2fd.Insert(handle, ChunkFd());
+    handle_shard->handle2uniqino.Insert(handle, inode);
+    handle_shard->Unlock();
+    tables.Inode2Shard(inode)->inode2references.Insert(inode, 1);
+  }
+  EXPECT_EQ(100U, tables.NumHandles());
+  EXPECT_EQ(tables.Handle2Shard(42), tables.Inode2Shard(42));
+
+  // The keys must be spread over the shards
+  unsigned num_used_shards = 0;
+  for (unsigned i = 0; i < ChunkTables::kNumShards; ++i) {
+    if (tables.shards[i].handle2fd.size() > 0)
+      num_used_shards++;
+  }
+  EXPECT_GT(num_used_shards, ChunkTables::kNumShards / 2);
+
+  // Copies are used to save the state across reloads
+  ChunkTables copy(tables);
+  EXPECT_EQ(100U, copy.NumHandles());
+  EXPECT_EQ(102U, copy.NextHandle());
+  uint64_t inode;
+  EXPECT_TRUE(copy.Handle2Shard(51)->handle2uniqino.Lookup(51, &inode));
+  EXPECT_EQ(50U, inode);
+  uint32_t refctr;
+  EXPECT_TRUE(copy.Inode2Shard(50)->inode2references.Lookup(50, &refctr));
+  EXPECT_EQ(1U, refctr);
+
+  ChunkTables empty;
+  copy = empty;
+  EXPECT_EQ(0U, copy.NumHandles());
+  EXPECT_EQ(2U, copy.NextHandle());
+}
@@ -4,8 +4,12 @@
 
 #include <gtest/gtest.h>
 
+#include <utility>
+
 #include "fuse_evict.h"
 #include "glue_buffer.h"
+#include "shortstring.h"
+#include "util/platform.h"
 #include "util/string.h"
 
 class T_FuseInvalidator : public ::testing::Test {
@@ -103,3 +107,48 @@ TEST_F(T_FuseInvalidator, InvalidateOps) {
   EXPECT_EQ(FuseInvalidator::kCheckTimeoutFreqOps + 1024,
             fuse_lowlevel_notify_inval_entry_cnt);
 }
+
+
+TEST_F(T_FuseInvalidator, InvalidateKeys) {
+  FuseInvalidator *invalidator =
+    new FuseInvalidator(&inode_tracker_, &dentry_tracker_, NULL, true);
+  invalidator->fuse_channel_or_session_ = reinterpret_cast<void **>(this);
+  invalidator->set_max_ops_per_sec(100);
+  invalidator->Spawn();
+  for (unsigned i = 0; i < 1024; ++i) {
+    dentry_tracker_.Add(i, "404", 100000);
+  }
+
+  FuseInvalidator::Keys *keys = new FuseInvalidator::Keys();
+  for (unsigned i = 2; i < 102; ++i)
+    keys->inodes.push_back(i);
+  keys->inodes.push_back(2);
+  for (unsigned i = 0; i < 50; ++i)
+    keys->dentries.push_back(std::make_pair(1, NameString("changed")));
+  keys->dentries.push_back(std::make_pair(2, NameString("changed")));
+
+  const unsigned inode_cnt = fuse_lowlevel_notify_inval_inode_cnt;
+  const unsigned entry_cnt = fuse_lowlevel_notify_inval_entry_cnt;
+  const uint64_t start_ns = platform_monotonic_time_ns();
+  FuseInvalidator::Handle handle(1000000);
+  invalidator->InvalidateKeys(&handle, keys);
+  handle.WaitFor();
+  EXPECT_TRUE(handle.IsDone());
+  // Duplicates removed, the tracked dentries are untouched
+  EXPECT_EQ(inode_cnt + 100, fuse_lowlevel_notify_inval_inode_cnt);
+  EXPECT_EQ(entry_cnt + 2, fuse_lowlevel_notify_inval_entry_cnt);
+  // 102 notifications exceed the budget of 100 per second
+  EXPECT_GE(platform_monotonic_time_ns() - start_ns, 900U * 1000 * 1000);
+
+  invalidator->terminated_ = 1;
+  keys = new FuseInvalidator::Keys();
+  for (unsigned i = 0; i < 1024; ++i)
+    keys->inodes.push_back(1000 + i);
+  handle.Reset();
+  invalidator->InvalidateKeys(&handle, keys);
+  handle.WaitFor();
+  EXPECT_TRUE(handle.IsDone());
+  EXPECT_EQ(inode_cnt + 100 + FuseInvalidator::kCheckTimeoutFreqOps,
+            fuse_lowlevel_notify_inval_inode_cnt);
+  delete invalidator;
+}
@@ -6,6 +6,7 @@
 
 #include <set>
 #include <string>
+#include <vector>
 
 #include "glue_buffer.h"
 #include "shortstring.h"
@@ -13,6 +14,7 @@
 #include "util/platform.h"
 #include "util/posix.h"
 #include "util/prng.h"
+#include "util/string.h"
 
 namespace glue {
 
@@ -88,6 +90,303 @@ TEST_F(T_GlueBuffer, InodeTracker) {
   EXPECT_TRUE(inode_tracker_.FindDentry(4, &inode_parent, &name));
   EXPECT_STREQ("bar", name.c_str());
   EXPECT_EQ(2U, inode_parent);
+
+  shash::Md5 md5path;
+  unsigned num_paths = 0;
+  cursor = inode_tracker_.BeginEnumerate();
+  while (inode_tracker_.NextPath(&cursor, &md5path, &inode, &inode_parent,
+                                 &name))
+  {
+    if (md5path == shash::Md5(shash::AsciiPtr("/foo/bar"))) {
+      EXPECT_EQ(4U, inode);
+      EXPECT_EQ(2U, inode_parent);
+      EXPECT_EQ("bar", name.ToString());
+    }
+    num_paths++;
+  }
+  inode_tracker_.EndEnumerate(&cursor);
+  EXPECT_EQ(3U, num_paths);
+}
+
+
+TEST_F(T_GlueBuffer, InodeTrackerGetPut) {
+  const unsigned kNumDirs = 10;
+  const unsigned kNumFiles = 1000;
+  inode_tracker_.VfsGet(InodeEx(1, InodeEx::kDirectory), PathString(""));
+  for (unsigned i = 0; i < kNumDirs; ++i) {
+    const std::string dir = "/dir" + StringifyInt(i);
+    for (unsigned j = 0; j < kNumFiles; ++j) {
+      inode_tracker_.VfsGet(
+        InodeEx(1000 * (i + 1) + j, InodeEx::kRegular),
+        PathString(dir + "/file" + StringifyInt(j)));
+    }
+  }
+  // Second reference to the same inode and path
+  inode_tracker_.VfsGet(InodeEx(1000, InodeEx::kRegular),
+                        PathString("/dir0/file0"));
+
+  // Keep every 100th file and the directory of the first file
+  inode_tracker_.VfsGet(InodeEx(2, InodeEx::kDirectory), PathString("/dir0"));
+  {
+    InodeTracker::VfsPutRaii raii = inode_tracker_.GetVfsPutRaii();
+    EXPECT_FALSE(raii.VfsPut(1000, 1));
+    for (unsigned i = 0; i < kNumDirs; ++i) {
+      for (unsigned j = 0; j < kNumFiles; ++j) {
+        if ((j % 100) != 0) {
+          EXPECT_TRUE(raii.VfsPut(1000 * (i + 1) + j, 1));
+        }
+      }
+    }
+    EXPECT_FALSE(raii.VfsPut(42, 1));
+  }
+  EXPECT_EQ(kNumDirs * kNumFiles + 2,
+            inode_tracker_.GetStatistics().num_inserts);
+  EXPECT_EQ(kNumDirs * (kNumFiles - kNumFiles / 100),
+            inode_tracker_.GetStatistics().num_removes);
+
+  PathString path;
+  InodeEx inode_ex(1000 * 3 + 200, InodeEx::kUnknownType);
+  EXPECT_TRUE(inode_tracker_.FindPath(&inode_ex, &path));
+  EXPECT_EQ("/dir2/file200", path.ToString());
+  EXPECT_EQ(InodeEx::kRegular, inode_ex.GetFileType());
+  inode_ex = InodeEx(1000 * 3 + 201, InodeEx::kUnknownType);
+  EXPECT_FALSE(inode_tracker_.FindPath(&inode_ex, &path));
+  EXPECT_EQ(1000U * 3 + 200,
+            inode_tracker_.FindInode(PathString("/dir2/file200")));
+  EXPECT_EQ(0U, inode_tracker_.FindInode(PathString("/dir2/file201")));
+  EXPECT_EQ(0U, inode_tracker_.FindInode(PathString("/dir2")));
+  EXPECT_EQ(2U, inode_tracker_.FindInode(PathString("/dir0")));
+
+  uint64_t inode_parent;
+  NameString name;
+  EXPECT_TRUE(inode_tracker_.FindDentry(1000, &inode_parent, &name));
+  EXPECT_EQ(2U, inode_parent);
+  EXPECT_EQ("file0", name.ToString());
+
+  // The copy has to survive the original
+  InodeTracker *copy = new InodeTracker(inode_tracker_);
+  inode_tracker_.~InodeTracker();
+  new (&inode_tracker_) InodeTracker();
+
+  unsigned num_entries = 0;
+  unsigned num_inodes = 0;
+  uint64_t inode;
+  InodeTracker::Cursor cursor = copy->BeginEnumerate();
+  while (copy->NextEntry(&cursor, &inode_parent, &name))
+    num_entries++;
+  while (copy->NextInode(&cursor, &inode))
+    num_inodes++;
+  copy->EndEnumerate(&cursor);
+  // Root, directories, and the remaining files
+  EXPECT_EQ(1 + kNumDirs + kNumDirs * kNumFiles / 100, num_entries);
+  EXPECT_EQ(2 + kNumDirs * kNumFiles / 100, num_inodes);
+
+  inode_ex = InodeEx(1000 * 10 + 900, InodeEx::kUnknownType);
+  path.Clear();
+  EXPECT_TRUE(copy->FindPath(&inode_ex, &path));
+  EXPECT_EQ("/dir9/file900", path.ToString());
+  delete copy;
+}
+
+
+TEST_F(T_GlueBuffer, InodeTrackerMove) {
+  inode_tracker_.VfsGet(InodeEx(1, InodeEx::kDirectory), PathString(""));
+  inode_tracker_.VfsGet(InodeEx(2, InodeEx::kRegular), PathString("/a"));
+  // Same inode under a new name
+  inode_tracker_.VfsGet(InodeEx(2, InodeEx::kRegular), PathString("/b"));
+
+  PathString path;
+  InodeEx inode_ex(2, InodeEx::kUnknownType);
+  EXPECT_TRUE(inode_tracker_.FindPath(&inode_ex, &path));
+  EXPECT_EQ("/b", path.ToString());
+  EXPECT_EQ(0U, inode_tracker_.FindInode(PathString("/a")));
+  EXPECT_EQ(2U, inode_tracker_.FindInode(PathString("/b")));
+
+  EXPECT_TRUE(inode_tracker_.ReplaceInode(2, InodeEx(3, InodeEx::kRegular)));
+  EXPECT_EQ(3U, inode_tracker_.FindInode(PathString("/b")));
+  inode_ex = InodeEx(2, InodeEx::kUnknownType);
+  EXPECT_FALSE(inode_tracker_.FindPath(&inode_ex, &path));
+
+  unsigned num_entries = 0;
+  uint64_t inode_parent;
+  NameString name;
+  InodeTracker::Cursor cursor = inode_tracker_.BeginEnumerate();
+  while (inode_tracker_.NextEntry(&cursor, &inode_parent, &name))
+    num_entries++;
+  inode_tracker_.EndEnumerate(&cursor);
+  EXPECT_EQ(2U, num_entries);
+}
+
+
+TEST_F(T_GlueBuffer, InodeTrackerSwap) {
+  inode_tracker_.VfsGet(InodeEx(1, InodeEx::kDirectory), PathString(""));
+  inode_tracker_.VfsGet(InodeEx(2, InodeEx::kDirectory), PathString("/a"));
+  inode_tracker_.VfsGet(InodeEx(3, InodeEx::kRegular), PathString("/a/b"));
+
+  // Round trip as on reload
+  InodeTracker saved;
+  saved.Swap(&inode_tracker_);
+  EXPECT_EQ(0U, inode_tracker_.FindInode(PathString("/a/b")));
+  EXPECT_EQ(3U, saved.FindInode(PathString("/a/b")));
+  InodeTracker restored;
+  restored.Swap(&saved);
+  EXPECT_EQ(0U, saved.FindInode(PathString("/a/b")));
+  EXPECT_EQ(3, restored.GetStatistics().num_inserts);
+
+  PathString path;
+  InodeEx inode_ex(3, InodeEx::kUnknownType);
+  EXPECT_TRUE(restored.FindPath(&inode_ex, &path));
+  EXPECT_EQ("/a/b", path.ToString());
+  EXPECT_EQ(InodeEx::kRegular, inode_ex.GetFileType());
+  restored.VfsGet(InodeEx(4, InodeEx::kRegular), PathString("/a/c"));
+  EXPECT_EQ(4U, restored.FindInode(PathString("/a/c")));
+  EXPECT_TRUE(restored.GetVfsPutRaii().VfsPut(3, 1));
+  EXPECT_EQ(0U, restored.FindInode(PathString("/a/b")));
+}
+
+
+TEST_F(T_GlueBuffer, InodeTrackerSharedPath) {
+  inode_tracker_.VfsGet(InodeEx(1, InodeEx::kDirectory), PathString(""));
+  // An open file and its replacement use the same path
+  EXPECT_TRUE(inode_tracker_.VfsGet(InodeEx(2, InodeEx::kRegular),
+                                    PathString("/a")));
+  EXPECT_TRUE(inode_tracker_.VfsGet(InodeEx(3, InodeEx::kRegular),
+                                    PathString("/a")));
+  EXPECT_TRUE(inode_tracker_.VfsGet(InodeEx(4, InodeEx::kRegular),
+                                    PathString("/a")));
+  // The first inode wins as long as it is in use
+  EXPECT_EQ(2U, inode_tracker_.FindInode(PathString("/a")));
+  EXPECT_TRUE(inode_tracker_.GetVfsPutRaii().VfsPut(3, 1));
+  EXPECT_EQ(2U, inode_tracker_.FindInode(PathString("/a")));
+  // Then another inode of the path takes over
+  EXPECT_TRUE(inode_tracker_.GetVfsPutRaii().VfsPut(2, 1));
+  EXPECT_EQ(4U, inode_tracker_.FindInode(PathString("/a")));
+  PathString path;
+  InodeEx inode_ex(4, InodeEx::kUnknownType);
+  EXPECT_TRUE(inode_tracker_.FindPath(&inode_ex, &path));
+  EXPECT_EQ("/a", path.ToString());
+
+  // Moving the remaining inode away hands the path over as well
+  EXPECT_TRUE(inode_tracker_.VfsGet(InodeEx(5, InodeEx::kRegular),
+                                    PathString("/a")));
+  EXPECT_TRUE(inode_tracker_.VfsGet(InodeEx(4, InodeEx::kRegular),
+                                    PathString("/b")));
+  EXPECT_EQ(5U, inode_tracker_.FindInode(PathString("/a")));
+  EXPECT_EQ(4U, inode_tracker_.FindInode(PathString("/b")));
+
+  // Replacing the inode of the path
+  EXPECT_TRUE(inode_tracker_.ReplaceInode(5, InodeEx(6, InodeEx::kRegular)));
+  EXPECT_EQ(6U, inode_tracker_.FindInode(PathString("/a")));
+  EXPECT_TRUE(inode_tracker_.GetVfsPutRaii().VfsPut(4, 2));
+  EXPECT_EQ(0U, inode_tracker_.FindInode(PathString("/b")));
+  EXPECT_EQ(6U, inode_tracker_.FindInode(PathString("/a")));
+}
+
+
+TEST_F(T_GlueBuffer, NameTable) {
+  NameTable names;
+  const uint32_t id_foo = names.Add("foo", 3);
+  const uint32_t id_bar = names.Add("bar", 3);
+  EXPECT_NE(id_foo, id_bar);
+  EXPECT_EQ(id_foo, names.Add("foo", 3));
+  EXPECT_EQ(std::string("foo"),
+            std::string(names.Get(id_foo).data(), names.Get(id_foo).length()));
+
+  names.Remove(id_foo);
+  EXPECT_EQ(3U, names.Get(id_foo).length());
+  names.Remove(id_foo);
+  // Ids are recycled
+  EXPECT_EQ(id_foo, names.Add("baz", 3));
+
+  // Removals eventually compact the heap; surviving names stay valid
+  std::vector<uint32_t> ids;
+  for (unsigned i = 0; i < 10000; ++i)
+    ids.push_back(names.Add(("name" + StringifyInt(i)).data(),
+                            4 + StringifyInt(i).length()));
+  for (unsigned i = 0; i < 10000; ++i) {
+    if ((i % 10) != 0)
+      names.Remove(ids[i]);
+  }
+  NameTable copy(names);
+  for (unsigned i = 0; i < 10000; i += 10) {
+    const std::string expected = "name" + StringifyInt(i);
+    EXPECT_EQ(expected, std::string(names.Get(ids[i]).data(),
+                                    names.Get(ids[i]).length()));
+    EXPECT_EQ(expected, std::string(copy.Get(ids[i]).data(),
+                                    copy.Get(ids[i]).length()));
+  }
+  EXPECT_EQ(id_bar, names.Add("bar", 3));
+}
+
+
+TEST_F(T_GlueBuffer, NameTableCompaction) {
+  // Small heaps are never compacted
+  NameTable names;
+  std::vector<uint32_t> ids;
+  for (unsigned i = 0; i < 10000; ++i)
+    ids.push_back(names.Add(("name" + StringifyInt(i)).data(),
+                            4 + StringifyInt(i).length()));
+  const uint64_t small_size = names.GetHeapSize();
+  for (unsigned i = 1; i < 10000; ++i)
+    names.Remove(ids[i]);
+  EXPECT_EQ(small_size, names.GetHeapSize());
+
+  // Large heaps are compacted once half of the heap is garbage
+  const std::string padding(200, 'x');
+  ids.clear();
+  for (unsigned i = 0; i < 40000; ++i) {
+    const std::string name = padding + StringifyInt(i);
+    ids.push_back(names.Add(name.data(), name.length()));
+  }
+  const uint64_t large_size = names.GetHeapSize();
+  EXPECT_GT(large_size, 4U * 1024 * 1024);
+  for (unsigned i = 0; i < 15000; ++i)
+    names.Remove(ids[i]);
+  EXPECT_EQ(large_size, names.GetHeapSize());
+  for (unsigned i = 15000; i < 25000; ++i)
+    names.Remove(ids[i]);
+  EXPECT_LT(names.GetHeapSize(), large_size);
+  for (unsigned i = 25000; i < 40000; ++i) {
+    const std::string expected = padding + StringifyInt(i);
+    EXPECT_EQ(expected, std::string(names.Get(ids[i]).data(),
+                                    names.Get(ids[i]).length()));
+  }
+}
+
+
+TEST_F(T_GlueBuffer, NameTableFull) {
+  // Strings of 100 characters take 102 bytes including the length field
+  StringHeap string_heap(0, 1024);
+  uint32_t handle;
+  std::string name(100, 'x');
+  unsigned num_strings = 0;
+  while (string_heap.AddString(name.length(), name.data(), &handle))
+    num_strings++;
+  EXPECT_EQ(10U, num_strings);
+  EXPECT_EQ(1020U, string_heap.size());
+
+  const uint32_t kNoId = NameTable::kNoId;
+  NameTable names(1024);
+  std::vector<uint32_t> ids;
+  for (unsigned i = 0; i < num_strings; ++i) {
+    name[0] = 'a' + i;
+    ids.push_back(names.Add(name.data(), name.length()));
+    EXPECT_NE(kNoId, ids[i]);
+  }
+  EXPECT_EQ(kNoId, names.Add("yyy", 3));
+  // Existing names can still be referenced
+  EXPECT_EQ(ids[2], names.Add(name.replace(0, 1, "c").data(), name.length()));
+  // Garbage is dropped to make room
+  names.Remove(ids[1]);
+  const uint32_t id_y = names.Add("yyy", 3);
+  EXPECT_NE(kNoId, id_y);
+  EXPECT_EQ(std::string("yyy"),
+            std::string(names.Get(id_y).data(), names.Get(id_y).length()));
+  EXPECT_EQ(name, std::string(names.Get(ids[2]).data(),
+                              names.Get(ids[2]).length()));
+  names.Remove(ids[2]);
+  EXPECT_EQ(name, std::string(names.Get(ids[2]).data(),
+                              names.Get(ids[2]).length()));
 }
 
 
@@ -5,8 +5,10 @@
 #include <gtest/gtest.h>
 
 #include "pack.h"
+#include "receiver/params.h"
 #include "receiver/payload_processor.h"
 #include "util/concurrency.h"
+#include "util/posix.h"
 #include "util/string.h"
 
 using namespace receiver;  // NOLINT
@@ -30,6 +32,35 @@ class MockPayloadProcessor : public PayloadProcessor {
   int num_files_received_;
 };
 
+/**
+ * Unpacks into a local stratum 0 in the working directory, using the
+ * pipelined mode
+ */
+class PipelinedPayloadProcessor : public PayloadProcessor {
+ public:
+  explicit PipelinedPayloadProcessor(const std::string &stratum0)
+    : stratum0_(stratum0) {}
+  virtual ~PipelinedPayloadProcessor() {}
+
+  virtual Result Initialize() {
+    Params params;
+    params.spooler_configuration =
+      "local," + stratum0_ + "/data/txn," + stratum0_;
+    params.hash_alg = shash::kSha1;
+    params.compression_alg = zlib::kNoCompression;
+    params.generate_legacy_bulk_chunks = false;
+    params.use_file_chunking = true;
+    params.min_chunk_size = 4194304;
+    params.avg_chunk_size = 8388608;
+    params.max_chunk_size = 16777216;
+    params.num_upload_tasks = 4;
+    return InitializeUploader(params);
+  }
+
+ private:
+  std::string stratum0_;
+};
+
 class T_PayloadProcessor : public ::testing::Test {
  protected:
   T_PayloadProcessor()
@@ -111,3 +142,18 @@ TEST_F(T_PayloadProcessor, Basic) {
                          serializer_->GetHeaderSize()));
   ASSERT_EQ(1, proc.num_files_received_);
 }
+
+TEST_F(T_PayloadProcessor, Pipelined) {
+  const std::string stratum0 = GetCurrentWorkingDirectory() +
+                               "/payload_processor_pipelined";
+  ASSERT_TRUE(MakeCacheDirectories(stratum0 + "/data", 0755));
+  ASSERT_TRUE(MkdirDeep(stratum0 + "/data/txn", 0755));
+
+  PipelinedPayloadProcessor proc(stratum0);
+  ASSERT_EQ(PayloadProcessor::kSuccess,
+            proc.Process(read_fd_, digest_.ToString(false), "some_path",
+                         serializer_->GetHeaderSize()));
+  EXPECT_EQ(0, proc.GetNumErrors());
+  EXPECT_TRUE(FileExists(stratum0 + "/data/" + pack_.BucketId(0).MakePath()));
+  EXPECT_TRUE(RemoveTree(stratum0));
+}
@@ -40,6 +40,28 @@ class SessionContextMocked : public upload::SessionContext {
   }
 };
 
+class SessionContextParallel : public upload::SessionContext {
+ public:
+  SessionContextParallel() { atomic_init32(&num_jobs_finished_); }
+
+  using SessionContextBase::ReportUpload;
+  using SessionContextBase::GetPackSize;
+
+  atomic_int32 num_jobs_finished_;
+
+ protected:
+  virtual bool Commit(const std::string& /*old_catalog*/,
+                      const std::string& /*new_catalog*/,
+                      const RepositoryTag& /*tag_name*/) {
+    return true;
+  }
+
+  virtual bool DoUpload(const UploadJob* /*job*/) {
+    atomic_inc32(&num_jobs_finished_);
+    return true;
+  }
+};
+
 class T_SessionContext : public ::testing::Test {};
 
 TEST_F(T_SessionContext, BasicLifeCycle) {
@@ -166,6 +188,60 @@ TEST_F(T_SessionContext, MultipleFilesForcedDispatchEach) {
   EXPECT_EQ(10, ctx.num_jobs_finished_);
 }
 
+TEST_F(T_SessionContext, MultipleFilesParallelUpload) {
+  SessionContextParallel ctx;
+  EXPECT_TRUE(ctx.Initialize("http://my.repo.address:4929/api/v1",
+                             "/path/to/the/session_file", "some_key_id",
+                             "some_secret", 5000, 1, 4));
+
+  for (int i = 0; i < 100; ++i) {
+    ObjectPack::BucketHandle hd = ctx.NewBucket();
+
+    unsigned char buffer[4096];
+    memset(buffer, 0, 4096);
+    ObjectPack::AddToBucket(buffer, 4096, hd);
+
+    shash::Any hash(shash::kSha1);
+    EXPECT_TRUE(ctx.CommitBucket(ObjectPack::kCas, hash, hd, ""));
+  }
+
+  EXPECT_TRUE(ctx.Finalize(true, "fake/old_root_hash", "fake/new_root_hash",
+                           TestRepositoryTag()));
+  EXPECT_EQ(100, atomic_read32(&ctx.num_jobs_finished_));
+}
+
+TEST_F(T_SessionContext, AdaptivePackSize) {
+  const uint64_t kMiB = 1024 * 1024;
+  SessionContextParallel ctx;
+  EXPECT_TRUE(ctx.Initialize("http://my.repo.address:4929/api/v1",
+                             "/path/to/the/session_file", "some_key_id",
+                             "some_secret", 100 * kMiB));
+  EXPECT_EQ(100 * kMiB, ctx.GetPackSize());
+
+  // Small packs say nothing about the throughput
+  ctx.ReportUpload(1024, 1000ULL * 1000 * 1000);
+  EXPECT_EQ(100 * kMiB, ctx.GetPackSize());
+
+  // 1 MiB/s: a pack should take kTargetPackUploadSec
+  const uint64_t target_sec = upload::SessionContextBase::kTargetPackUploadSec;
+  ctx.ReportUpload(20 * kMiB, 20ULL * 1000 * 1000 * 1000);
+  EXPECT_EQ(target_sec * kMiB, ctx.GetPackSize());
+
+  // Slow uploads don't shrink the packs below the minimum size
+  const uint64_t min_size = upload::SessionContextBase::kMinPackSize;
+  for (unsigned i = 0; i < 20; ++i)
+    ctx.ReportUpload(5 * kMiB, 1000ULL * 1000 * 1000 * 1000);
+  EXPECT_EQ(min_size, ctx.GetPackSize());
+
+  // Fast uploads don't grow the packs beyond the configured maximum
+  for (unsigned i = 0; i < 20; ++i)
+    ctx.ReportUpload(100 * kMiB, 1000ULL * 1000);
+  EXPECT_EQ(100 * kMiB, ctx.GetPackSize());
+
+  EXPECT_TRUE(ctx.Finalize(true, "fake/old_root_hash", "fake/new_root_hash",
+                           TestRepositoryTag()));
+}
+
 TEST_F(T_SessionContext, FirstAddAllThenCommit) {
   SessionContextMocked ctx;
   EXPECT_TRUE(ctx.Initialize("http://my.repo.address:4929/api/v1",
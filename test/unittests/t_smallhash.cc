@@ -119,6 +119,29 @@ TEST_F(T_Smallhash, InsertAndCopyMd5Slow) {
 }
 
 
+TEST_F(T_Smallhash, Swap) {
+  unsigned N = kNumElements;
+  for (unsigned i = 0; i < N; ++i)
+    smallhash_.Insert(i, i);
+
+  SmallHashDynamic<int, int> other;
+  other.Init(16, -1, hasher_int);
+  other.Insert(-2, 0);
+  other.Swap(&smallhash_);
+  EXPECT_EQ(N, other.size());
+  EXPECT_EQ(1U, smallhash_.size());
+  EXPECT_TRUE(smallhash_.Contains(-2));
+  for (unsigned i = 0; i < N; ++i) {
+    int value;
+    EXPECT_TRUE(other.Lookup(i, &value));
+    EXPECT_EQ(static_cast<int>(i), value);
+  }
+  other.Erase(0);
+  EXPECT_FALSE(other.Contains(0));
+  EXPECT_EQ(N - 1, other.size());
+}
+
+
 TEST_F(T_Smallhash, InsertAndErase) {
   unsigned N = kNumElements;
   unsigned initial_capacity = smallhash_.capacity();
@@ -0,0 +1,119 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "cache_posix.h"
+#include "crypto/hash.h"
+#include "duplex_sqlite3.h"
+#include "sqlitevfs.h"
+#include "statistics.h"
+#include "util/pointer.h"
+#include "util/posix.h"
+#include "util/string.h"
+
+using namespace std;  // NOLINT
+
+class T_SqliteVfs : public ::testing::Test {
+ protected:
+  static const unsigned kNumRows = 10000;
+
+  virtual void SetUp() {
+    tmp_path_ = CreateTempDir("./cvmfs_ut_sqlitevfs");
+    ASSERT_FALSE(tmp_path_.empty());
+    cache_mgr_ = PosixCacheManager::Create(tmp_path_, false);
+    ASSERT_TRUE(cache_mgr_.IsValid());
+
+    // Create a database with the regular VFS and move it into the cache
+    const string db_path = tmp_path_ + "/catalog.db";
+    sqlite3 *db;
+    ASSERT_EQ(SQLITE_OK, sqlite3_open_v2(db_path.c_str(), &db,
+      SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, "unix"));
+    string sql = "CREATE TABLE t (key INTEGER PRIMARY KEY, value TEXT);"
+                 "BEGIN;";
+    for (unsigned i = 0; i < kNumRows; ++i) {
+      sql += "INSERT INTO t VALUES (" + StringifyInt(i) + ", '" +
+             string(100, 'a' + (i % 26)) + "');";
+    }
+    sql += "COMMIT;";
+    ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL));
+    ASSERT_EQ(SQLITE_OK, sqlite3_close(db));
+
+    id_ = shash::Any(shash::kSha1);
+    ASSERT_TRUE(shash::HashFile(db_path, &id_));
+    int fd = open(db_path.c_str(), O_RDONLY);
+    ASSERT_GE(fd, 0);
+    string content;
+    ASSERT_TRUE(SafeReadToString(fd, &content));
+    close(fd);
+    ASSERT_TRUE(cache_mgr_->CommitFromMem(id_,
+      reinterpret_cast<const unsigned char *>(content.data()), content.size(),
+      "catalog"));
+  }
+
+  virtual void TearDown() {
+    EXPECT_TRUE(sqlite::UnregisterVfsRdOnly());
+    cache_mgr_.Destroy();
+    if (tmp_path_ != "")
+      RemoveTree(tmp_path_);
+  }
+
+  /**
+   * Opens the database from the cache through the cvmfs VFS and sums up all
+   * the values.
+   */
+  void Query(int64_t *sum, int64_t *length) {
+    const int fd = cache_mgr_->Open(CacheManager::Bless(id_));
+    ASSERT_GE(fd, 0);
+    sqlite3 *db;
+    ASSERT_EQ(SQLITE_OK, sqlite3_open_v2(("@" + StringifyInt(fd)).c_str(),
+      &db, SQLITE_OPEN_READONLY, "cvmfs-readonly"));
+    ASSERT_EQ(SQLITE_OK, sqlite3_exec(db,
+      "PRAGMA mmap_size=9223372036854775807;", NULL, NULL, NULL));
+    sqlite3_stmt *stmt;
+    ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db,
+      "SELECT sum(key), sum(length(value)) FROM t;", -1, &stmt, NULL));
+    ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+    *sum = sqlite3_column_int64(stmt, 0);
+    *length = sqlite3_column_int64(stmt, 1);
+    EXPECT_EQ(1, statistics_.Lookup("sqlite.no_open")->Get());
+    sqlite3_finalize(stmt);
+    EXPECT_EQ(SQLITE_OK, sqlite3_close(db));
+    EXPECT_EQ(0, statistics_.Lookup("sqlite.no_open")->Get());
+  }
+
+  string tmp_path_;
+  UniquePtr<PosixCacheManager> cache_mgr_;
+  perf::Statistics statistics_;
+  shash::Any id_;
+};
+
+
+TEST_F(T_SqliteVfs, Read) {
+  ASSERT_TRUE(sqlite::RegisterVfsRdOnly(cache_mgr_.weak_ref(), &statistics_,
+                                        sqlite::kVfsOptNone, false));
+  int64_t sum, length;
+  Query(&sum, &length);
+  EXPECT_EQ(int64_t(kNumRows) * (kNumRows - 1) / 2, sum);
+  EXPECT_EQ(int64_t(kNumRows) * 100, length);
+  EXPECT_EQ(0, statistics_.Lookup("sqlite.n_fetch")->Get());
+  EXPECT_GT(statistics_.Lookup("sqlite.n_read")->Get(), 1);
+}
+
+
+TEST_F(T_SqliteVfs, Mmap) {
+  ASSERT_TRUE(sqlite::RegisterVfsRdOnly(cache_mgr_.weak_ref(), &statistics_,
+                                        sqlite::kVfsOptNone, true));
+  int64_t sum, length;
+  Query(&sum, &length);
+  EXPECT_EQ(int64_t(kNumRows) * (kNumRows - 1) / 2, sum);
+  EXPECT_EQ(int64_t(kNumRows) * 100, length);
+  EXPECT_GT(statistics_.Lookup("sqlite.n_fetch")->Get(), 1);
+  EXPECT_EQ(0, statistics_.Lookup("sqlite.no_mmap")->Get());
+}
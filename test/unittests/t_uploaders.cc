@@ -9,6 +9,7 @@
 #include <unistd.h>
 
 #include <string>
+#include <vector>
 
 #include "c_file_sandbox.h"
 #include "c_http_server.h"
@@ -329,8 +330,15 @@ class T_Uploaders : public FileSandbox {
     int *n429 = static_cast<int *>(data);
 
     HTTPResponse response;
-    // strip bucket name
+    // strip bucket name and query string
     std::string req_file = req.path.substr(req.path.find("/", 1) + 1);
+    std::string query;
+    const size_t pos_query = req_file.find('?');
+    if (pos_query != std::string::npos) {
+      query = req_file.substr(pos_query + 1);
+      req_file = req_file.substr(0, pos_query);
+    }
+    const std::string path = T_Uploaders::dest_dir + "/" + req_file;
 
     if ((*n429 > 0) &&
         (req.path.size() >= 5) &&
@@ -339,8 +347,66 @@ class T_Uploaders : public FileSandbox {
       response.code = 429;
       response.reason = "Too Many Requests";
       response.AddHeader("Retry-After", "1");
+    } else if ((req.method == "POST") && (query == "uploads")) {
+      response.body = "<InitiateMultipartUploadResult><UploadId>" +
+                      req_file + "-upload</UploadId>"
+                      "</InitiateMultipartUploadResult>";
+    } else if ((req.method == "PUT") && HasPrefix(query, "partNumber=", false))
+    {
+      const std::string part_number =
+        query.substr(11, query.find('&') - 11);
+      const bool retval =
+        SafeWriteToFile(req.body, path + ".part" + part_number, 0600);
+      assert(retval);
+      response.AddHeader("ETag", "\"etag" + part_number + "\"");
+    } else if ((req.method == "POST") && HasPrefix(query, "uploadId=", false) &&
+               HasSuffix(req_file, "BADCOMPLETE", false))
+    {
+      response.code = 400;
+      response.reason = "Bad Request";
+    } else if ((req.method == "POST") && HasPrefix(query, "uploadId=", false))
+    {
+      // Assemble the object from the parts listed in the request
+      std::vector<std::string> part_paths;
+      std::vector<std::string> parts;
+      size_t pos = 0;
+      while ((pos = req.body.find("<PartNumber>", pos)) != std::string::npos) {
+        pos += 12;
+        part_paths.push_back(
+          path + ".part" + req.body.substr(pos, req.body.find('<', pos) - pos));
+        const int fd = open(part_paths.back().c_str(), O_RDONLY);
+        assert(fd >= 0);
+        parts.push_back("");
+        const bool retval = SafeReadToString(fd, &parts.back());
+        assert(retval);
+        close(fd);
+      }
+      // Like S3, only the last part may be smaller than 5 MiB
+      bool too_small = false;
+      for (unsigned i = 0; i + 1 < parts.size(); ++i)
+        too_small = too_small || (parts[i].size() < 5 * 1024 * 1024);
+      if (too_small) {
+        response.code = 400;
+        response.reason = "Bad Request";
+        response.body = "<Error><Code>EntityTooSmall</Code></Error>";
+      } else {
+        std::string content;
+        for (unsigned i = 0; i < parts.size(); ++i) {
+          content += parts[i];
+          remove(part_paths[i].c_str());
+        }
+        const bool retval = SafeWriteToFile(content, path, 0600);
+        assert(retval);
+        response.body = "<CompleteMultipartUploadResult>"
+                        "</CompleteMultipartUploadResult>";
+      }
+    } else if ((req.method == "DELETE") && HasPrefix(query, "uploadId=", false))
+    {
+      for (unsigned i = 1; FileExists(path + ".part" + StringifyInt(i)); ++i)
+        remove((path + ".part" + StringifyInt(i)).c_str());
+      response.code = 204;
+      response.reason = "No Content";
     } else if (req.method == "PUT") {
-      std::string path = T_Uploaders::dest_dir + "/" + req_file;
       FILE* file = fopen(path.c_str(), "w");
       assert(file != NULL);
       FileGuard file_guard(file);
@@ -352,13 +418,12 @@ class T_Uploaders : public FileSandbox {
       int retval = fsync(fid);
       assert(retval == 0);
     } else if (req.method == "HEAD") {
-      if (!FileExists(T_Uploaders::dest_dir + "/" + req_file)) {
+      if (!FileExists(path)) {
         response.code = 404;
         response.reason = "Not Found";
       }
 
     } else if (req.method == "DELETE") {
-      std::string path = T_Uploaders::dest_dir + "/" + req_file;
       if (FileExists(path)) {
         int retval = remove(path.c_str());
         assert(retval == 0);
@@ -396,6 +461,9 @@ class T_Uploaders : public FileSandbox {
         StringifyInt(parallel_connections) + "\n"
         "CVMFS_S3_HOST=127.0.0.1\n"
         "CVMFS_S3_DNS_BUCKETS=false\n"
+        // Upload the big file as a single part and the huge file in parts
+        "CVMFS_S3_MULTIPART_THRESHOLD=2097152\n"
+        "CVMFS_S3_MULTIPART_PART_SIZE=5242880\n"
         "CVMFS_S3_PORT=" + StringifyInt(CVMFS_S3_TEST_MOCKUP_SERVER_PORT);
 
     fprintf(s3_conf, "%s\n", conf_str.c_str());
@@ -554,6 +622,64 @@ TYPED_TEST(T_Uploaders, SimpleFileUpload) {
 //------------------------------------------------------------------------------
 
 
+TYPED_TEST(T_Uploaders, MultipartUpload) {
+  if (!TestFixture::IsS3()) {
+    return;
+  }
+
+  const std::string big_file_path = TestFixture::GetBigFile();
+  const std::string dest_name     = "big_file";
+
+  this->uploader_->UploadFile(big_file_path,
+                              dest_name,
+                              AbstractUploader::MakeClosure(
+                              &UploadCallbacks::SimpleUploadClosure,
+                              &this->delegate_,
+                              UploaderResults(0, big_file_path)));
+
+  this->uploader_->WaitForUpload();
+  EXPECT_TRUE(TestFixture::CheckFile(dest_name));
+  EXPECT_FALSE(TestFixture::CheckFile(dest_name + ".part1"));
+  TestFixture::CompareFileContents(big_file_path,
+                                   TestFixture::AbsoluteDestinationPath(
+                                       dest_name));
+
+  upload::S3Uploader *s3uploader =
+    static_cast<upload::S3Uploader *>(this->uploader_);
+  EXPECT_EQ(1U, s3uploader->GetS3FanoutManager()->GetStatistics()
+                  .num_multipart_uploads);
+}
+
+
+//------------------------------------------------------------------------------
+
+
+TYPED_TEST(T_Uploaders, MultipartUploadCompleteFails) {
+  if (!TestFixture::IsS3()) {
+    return;
+  }
+
+  const std::string big_file_path = TestFixture::GetBigFile();
+  const std::string dest_name     = "big_file_BADCOMPLETE";
+
+  this->uploader_->UploadFile(big_file_path,
+                              dest_name,
+                              AbstractUploader::MakeClosure(
+                              &UploadCallbacks::SimpleUploadClosure,
+                              &this->delegate_,
+                              UploaderResults(99, big_file_path)));
+
+  this->uploader_->WaitForUpload();
+  EXPECT_EQ(1, atomic_read32(&(this->delegate_.simple_upload_invocations)));
+  EXPECT_FALSE(TestFixture::CheckFile(dest_name));
+  // The upload is aborted, which drops the parts
+  EXPECT_FALSE(TestFixture::CheckFile(dest_name + ".part1"));
+}
+
+
+//------------------------------------------------------------------------------
+
+
 TYPED_TEST(T_Uploaders, IngestionSource) {
   const std::string small_file_path = TestFixture::GetSmallFile();
   int fd = open(small_file_path.c_str(), O_RDONLY);
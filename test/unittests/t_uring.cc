@@ -0,0 +1,95 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include "gtest/gtest.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "testutil.h"
+#include "util/pointer.h"
+#include "util/posix.h"
+#include "util/uring.h"
+
+using namespace std;  // NOLINT
+
+class T_IoUring : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    path_ = CreateTempPath(GetCurrentWorkingDirectory() + "/cvmfs_ut_uring",
+                           0600);
+    ASSERT_FALSE(path_.empty());
+    fd_ = open(path_.c_str(), O_RDWR);
+    ASSERT_GE(fd_, 0);
+  }
+
+  virtual void TearDown() {
+    close(fd_);
+    unlink(path_.c_str());
+  }
+
+  string path_;
+  int fd_;
+};
+
+
+TEST_F(T_IoUring, ReadWrite) {
+  UniquePtr<IoUring> io_uring(IoUring::Create(4));
+  if (!io_uring.IsValid()) {
+    printf("Skipping, io_uring not available\n");
+    return;
+  }
+  EXPECT_GE(io_uring->queue_depth(), 4U);
+
+  EXPECT_EQ(5, io_uring->Pwrite(fd_, "hello", 5, 10));
+  char buf[16];
+  EXPECT_EQ(5, io_uring->Pread(fd_, buf, 5, 10));
+  EXPECT_EQ(0, memcmp(buf, "hello", 5));
+  EXPECT_EQ(0, io_uring->Pread(fd_, buf, sizeof(buf), 15));
+  EXPECT_EQ(-EBADF, io_uring->Pread(-1, buf, sizeof(buf), 0));
+}
+
+
+TEST_F(T_IoUring, Saturate) {
+  UniquePtr<IoUring> io_uring(IoUring::Create(2));
+  if (!io_uring.IsValid()) {
+    printf("Skipping, io_uring not available\n");
+    return;
+  }
+
+  // More requests than queue entries
+  const unsigned kNumRequests = 64;
+  const unsigned kBlockSize = 4096;
+  string data(kNumRequests * kBlockSize, '\0');
+  for (unsigned i = 0; i < data.size(); ++i)
+    data[i] = i % 253;
+  vector<IoUring::Request *> requests;
+  for (unsigned i = 0; i < kNumRequests; ++i) {
+    requests.push_back(new IoUring::Request());
+    EXPECT_TRUE(io_uring->SubmitWrite(fd_, data.data() + i * kBlockSize,
+                                      kBlockSize, i * kBlockSize,
+                                      requests[i]));
+  }
+  for (unsigned i = 0; i < kNumRequests; ++i) {
+    EXPECT_EQ(static_cast<int64_t>(kBlockSize), requests[i]->Wait());
+    EXPECT_TRUE(requests[i]->IsDone());
+  }
+
+  // Requests can be reused
+  string buf(data.size(), '\0');
+  for (unsigned i = 0; i < kNumRequests; ++i) {
+    EXPECT_TRUE(io_uring->SubmitRead(fd_, &buf[i * kBlockSize], kBlockSize,
+                                     i * kBlockSize, requests[i]));
+  }
+  for (unsigned i = 0; i < kNumRequests; ++i) {
+    EXPECT_EQ(static_cast<int64_t>(kBlockSize), requests[i]->Wait());
+    delete requests[i];
+  }
+  EXPECT_EQ(data, buf);
+}